@@ -0,0 +1 @@
+#include "Precompiled.hpp"
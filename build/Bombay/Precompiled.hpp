@@ -0,0 +1 @@
+#include <cat/AllBombay.hpp>
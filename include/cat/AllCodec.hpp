@@ -37,6 +37,7 @@
 
 #include <cat/codec/Huffman.hpp>
 #include <cat/codec/RangeCoder.hpp>
+#include <cat/codec/RaptorQ.hpp>
 #include <cat/fec/Wirehair.hpp>
 
 #if defined(CAT_COMPILER_MSVC) && defined(CAT_BUILD_DLL)
@@ -46,6 +46,7 @@
 #include <cat/hash/Murmur.hpp>
 
 #include <cat/threads/Atomic.hpp>
+#include <cat/threads/EpochReclaim.hpp>
 #include <cat/threads/Mutex.hpp>
 #include <cat/threads/RWLock.hpp>
 #include <cat/threads/Thread.hpp>
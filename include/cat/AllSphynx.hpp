@@ -50,6 +50,9 @@
 #include <cat/sphynx/Server.hpp>
 #include <cat/sphynx/Transport.hpp>
 #include <cat/sphynx/FileTransfer.hpp>
+#include <cat/sphynx/MTUDiscovery.hpp>
+#include <cat/sphynx/Replication.hpp>
+#include <cat/sphynx/TransferPipeline.hpp>
 
 #if defined(CAT_COMPILER_MSVC) && defined(CAT_BUILD_DLL)
 # pragma warning(pop)
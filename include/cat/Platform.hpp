@@ -744,6 +744,24 @@ template<typename T> CAT_INLINE T Bound(const T &minimum, const T &maximum, cons
 #endif
 
 
+//// SIMD ////
+
+// SSE2 is part of the x86-64 baseline, so it is always available there
+#if defined(__SSE2__) || (defined(CAT_COMPILER_MSVC) && (defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)))
+# define CAT_HAS_SSE2
+#endif
+
+// AVX2 must be enabled explicitly with -mavx2 or /arch:AVX2
+#if defined(__AVX2__)
+# define CAT_HAS_AVX2
+#endif
+
+// NEON is available on ARMv8 and on ARMv7 built with -mfpu=neon
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+# define CAT_HAS_NEON
+#endif
+
+
 //// No Copy ////
 
 #define CAT_NO_COPY(T) \
@@ -30,7 +30,8 @@
 // so this is a little different from practical usage.  For the netcode stuff
 // I am thinking about incorporating LZMA compression for the packets
 
-// TODO: Optimize out the STL classes and specialize for byte streams with binary encoding
+// HuffmanCodec below is the practical version: canonical length-limited byte
+// codes packed into a bitstream, without the STL classes
 
 #ifndef CAT_CODEC_HUFFMAN_HPP
 #define CAT_CODEC_HUFFMAN_HPP
@@ -146,6 +147,77 @@ public:
 };
 
 
+/*
+	HuffmanCodec: Canonical Huffman codes for byte streams
+
+	Codes are limited to MAX_CODE_BITS so that a decoder table is small and
+	so the code lengths fit in 4 bits each.  Canonical codes are determined by
+	their lengths alone, so a static table for chat text or game messages is
+	just the 256 lengths, which PackLengths() squeezes into 128 bytes.
+
+	Bits are written least-significant first through a 64-bit accumulator.
+	Decoding looks up TABLE_BITS bits at a time in a table that yields up to
+	two symbols per lookup; longer codes fall back to a canonical search.
+
+	Symbols with zero count get no code, so Encode() fails on them.  Add one
+	to every count when any byte must stay encodable.
+*/
+class HuffmanCodec
+{
+public:
+	static const u32 MAX_SYMBOLS = 256;
+	static const u32 MAX_CODE_BITS = 15;
+	static const u32 TABLE_BITS = 11;
+	static const u32 PACKED_LENGTH_BYTES = MAX_SYMBOLS / 2;
+
+protected:
+	u8 _lengths[MAX_SYMBOLS];			// Code length of each symbol, or 0 if not coded
+	u16 _codes[MAX_SYMBOLS];			// Code of each symbol, bit-reversed for writing
+	u32 _table[1 << TABLE_BITS];		// Decoder table, see Huffman.cpp for entry format
+
+	// Canonical search for codes longer than TABLE_BITS
+	u16 _first_code[MAX_CODE_BITS + 2];	// First code of each length
+	u16 _length_count[MAX_CODE_BITS + 1];	// Number of codes of each length
+	u16 _length_offset[MAX_CODE_BITS + 1];	// Index in _sorted of the first code of each length
+	u8 _sorted[MAX_SYMBOLS];			// Symbols in canonical order
+
+	bool _initialized;
+
+	// Decode one symbol with a code longer than TABLE_BITS, returning its length or 0 if invalid
+	u32 DecodeSlow(u64 bits, u8 &symbol);
+
+	// Shared decode loop; stops after out_bytes symbols or after a null symbol if text is set
+	int DecodeSymbols(const u8 *in, u32 in_bytes, u8 *out, u32 out_bytes, bool text, u32 &used);
+
+public:
+	HuffmanCodec();
+
+	// Build length-limited codes from symbol counts
+	bool InitializeFromCounts(const u32 counts[MAX_SYMBOLS]);
+
+	// Build canonical codes from code lengths, as returned by GetLength()
+	// Returns false if the lengths are over-subscribed or too long
+	bool InitializeFromLengths(const u8 lengths[MAX_SYMBOLS]);
+
+	CAT_INLINE u32 GetLength(u8 symbol) { return _lengths[symbol]; }
+
+	// Serialize code lengths as 4 bits per symbol
+	void PackLengths(u8 packed[PACKED_LENGTH_BYTES]);
+	bool UnpackLengths(const u8 packed[PACKED_LENGTH_BYTES]);
+
+	// Returns the number of bytes written, or -1 if out of space or a symbol has no code
+	int Encode(const void *data, u32 bytes, void *out, u32 out_bytes);
+
+	// Decode exactly out_bytes symbols
+	// Returns the number of input bytes used, or -1 if the input is corrupt
+	int Decode(const void *in, u32 in_bytes, void *out, u32 out_bytes);
+
+	// Decode a null-terminated string, as written by Encode() including the null
+	// Returns the string length not counting the null, like RangeDecoder::Text(), or -1 on error
+	int DecodeText(const void *in, u32 in_bytes, char *out, u32 out_bytes);
+};
+
+
 } // namespace cat
 
 #endif // CAT_CODEC_HUFFMAN_HPP
@@ -27,8 +27,16 @@
 */
 
 /*
-	Based on the IETF draft version 5 of RaptorQ by M. Luby and Qualcomm
-	http://tools.ietf.org/html/draft-ietf-rmt-bb-fec-raptorq-05
+	Based on RFC 6330, RaptorQ Forward Error Correction Scheme for Object Delivery
+	by M. Luby, A. Shokrollahi, M. Watson, T. Stockhammer and L. Minder
+	http://tools.ietf.org/html/rfc6330
+
+	The RFC fixes the code with two published tables that are not reproduced
+	here: the V0..V3 tables behind Rand() and the systematic index table that
+	gives K', J, S, H and W for each K.  This codec follows the RFC construction
+	with stand-ins for both (see RaptorQ.cpp), so it is not yet wire compatible
+	with other RaptorQ implementations.  Swapping in the tables is all that is
+	needed for that.
 */
 
 #ifndef CAT_RAPTORQ_HPP
@@ -44,8 +52,13 @@ namespace cat {
 
 	Efficient O(n) forward error correction (FEC) within 1 dB of Shannon
 	channel capacity for the binary erasure channel (BEC)
+
+	This object splits a transfer into source blocks that can each be
+	handed to a raptorq::Encoder or raptorq::Decoder (RFC 6330 section 4.4.1).
+	Sub-blocking is not used because the codecs work on whole symbols in
+	memory, so N is always 1.
 */
-class RaptorQ
+class CAT_EXPORT RaptorQ
 {
 	// Common
 	u64 F; // Total bytes (< 2^40)
@@ -56,10 +69,258 @@ class RaptorQ
 	u16 N; // Sub-block count
 	u16 Al; // Symbol alignment
 
+	// Source block partition
+	u32 KL, KS; // Symbols in large and small source blocks
+	u16 ZL; // Number of large source blocks (they come first)
+
+public:
+	RaptorQ();
+
+	// Partition a transfer of transfer_bytes into source blocks of at most
+	// max_block_bytes each (the WS parameter of the RFC)
+	// Returns false if the parameters are out of range
+	bool Initialize(u64 transfer_bytes, u16 symbol_bytes, u16 alignment = 4, u32 max_block_bytes = 64000000);
+
+	CAT_INLINE u64 GetTransferBytes() { return F; }
+	CAT_INLINE u16 GetSymbolBytes() { return T; }
+	CAT_INLINE u16 GetSourceBlockCount() { return Z; }
+
+	// Look up the object byte range covered by source block sbn
+	// Returns false if sbn is out of range
+	bool GetSourceBlock(u16 sbn, u64 &offset, u32 &bytes);
+};
+
+
+namespace raptorq {
+
+
+//// Result object
+
+enum Result
+{
+	R_WIN,				// Operation: Success!
+	R_MORE_BLOCKS,		// Codec wants more symbols
+
+	R_ERROR,			// Return codes higher than this one are errors:
+	R_BAD_INPUT,		// Input parameters were incorrect
+	R_TOO_LARGE,		// message_bytes / symbol_bytes is too large.  Try increasing symbol_bytes or splitting with RaptorQ
+	R_BAD_SEED,			// The systematic index does not solve this source block
+	R_OUT_OF_MEMORY,	// Out of memory, try reducing the message size
+};
+
+// Get Result String function
+const char *GetResultString(Result r);
+
+// Most source symbols in one source block (K'max in the RFC)
+static const u32 MAX_SOURCE_SYMBOLS = 56403;
+
+
+//// Encoder/Decoder Combined Implementation
+
+class CAT_EXPORT Codec
+{
+	// Parameters (RFC 6330 section 5.3.3.3)
+	u32 _symbol_bytes;			// T: Bytes per symbol
+	u32 _source_count;			// K: Number of source symbols
+	u32 _padded_count;			// K': Number of source symbols after padding
+	u32 _final_bytes;			// Number of bytes in the final source symbol
+	u32 _j;						// J(K'): Systematic index
+	u32 _s;						// S: Number of LDPC symbols
+	u32 _h;						// H: Number of HDPC symbols
+	u32 _w;						// W: Number of LT symbols
+	u32 _l;						// L: Number of intermediate symbols
+	u32 _p;						// P: Number of permanently inactive (PI) symbols
+	u32 _p1;					// P1: Smallest prime at or above P
+	u32 _b;						// B: Number of LT symbols that are not LDPC symbols
+	u32 _u;						// U: Number of PI symbols that are not HDPC symbols
+
+	// Intermediate symbols
+	u8 *_intermediate;			// L intermediate symbols once solved
+	u32 _intermediate_allocated;	// Bytes allocated for intermediate symbols
+
+	// LT rows handed to the solver, by internal symbol identifier (ISI)
+	u32 *_row_isis;				// ISI of each LT row
+	const u8 **_row_values;		// Symbol value of each LT row, or 0 for a zero padding symbol
+	u32 _rows_allocated;		// Number of LT rows allocated
+
+	// Solver scratch memory
+	u8 *_workspace;				// Sparse matrix and peeling state
+	u32 _workspace_allocated;	// Bytes allocated for workspace
+	u8 *_ge_workspace;			// Dense matrix for the inactivated columns
+	u32 _ge_allocated;			// Bytes allocated for dense matrix
+
+	// Encoder state
+	const u8 *_message_in;		// Caller's message
+	u8 *_final_symbol;			// Final source symbol padded with zeroes
+	u32 _final_allocated;		// Bytes allocated for final symbol
+
+	// Decoder state
+	u8 *_received;				// Received symbols, each padded to symbol bytes
+	u32 _received_allocated;	// Number of received symbols that fit
+	u32 _received_count;		// Number of received symbols
+	u32 *_source_slots;			// Received symbol index for each source ESI, or NO_SLOT
+	u32 _slots_allocated;		// Number of source slots allocated
+	u32 _source_received;		// Number of distinct source symbols received
+	bool _solved;				// Boolean: Message can be reconstructed
+	static const u32 NO_SLOT = 0xffffffff;
+
+	struct Tuple;
+	struct Solver;
+
+
+	//// Symbol Generation
+
+	// Map an encoding symbol identifier (ESI) to an ISI
+	CAT_INLINE u32 GetISI(u32 esi) { return (esi < _source_count) ? esi : esi + _padded_count - _source_count; }
+
+	// Generate the LT encoding parameters for an ISI (RFC 6330 section 5.3.5.4)
+	void GenerateTuple(u32 isi, Tuple &tuple);
+
+	// Fill cols with the intermediate symbols summed to generate an ISI, returning the count
+	u32 GenerateLTColumns(u32 isi, u16 *cols);
+
+	// Generate the symbol for an ISI from the intermediate symbols
+	void GenerateSymbol(u32 isi, u8 *symbol_out);
+
+
+	//// Solver
+
+	// Choose parameters for a source block, and search for a systematic index
+	Result ChooseParameters(int message_bytes, int symbol_bytes);
+
+	// Set up LT rows for the padding symbols starting at row first_row, returning the new row count
+	u32 AddPaddingRows(u32 first_row);
+
+	// Solve for the intermediate symbols from row_count LT rows (values = false checks rank only)
+	Result Solve(u32 row_count, bool values);
+
+	// Sparse peeling with inactivation (RFC 6330 section 5.4.2.2)
+	bool BuildRows(Solver &solver, u32 row_count);
+	void PeelRows(Solver &solver);
+
+	// Dense solution for the inactivated columns
+	bool BuildDenseRows(Solver &solver, bool values);
+	bool EliminateDenseRows(Solver &solver, bool values);
+
+	// Back-substitute to recover the peeled symbols
+	void SubstitutePeeled(Solver &solver);
+
+
+	//// Memory Management
+
+	// Grow a buffer to at least the given size, keeping its contents if asked
+	static bool Reserve(u8 *&buffer, u32 &allocated, u32 bytes, bool keep = false);
+	bool ReserveRows(u32 count);
+	bool ReserveReceived(u32 count);
+	bool ReserveSlots(u32 count);
+	void FreeMemory();
+
 public:
+	Codec();
+	~Codec();
+
+	CAT_INLINE u32 SourceCount() { return _source_count; }
+
+
+	//// Encoder Mode
+
+	// Solve for the intermediate symbols of a message
+	// The message must stay valid while encoding
+	Result InitializeEncoder(const void *message_in, int message_bytes, int symbol_bytes);
+
+	// Write the symbol for an ESI, returning the number of bytes written
+	u32 Encode(u32 esi, void *symbol_out);
+
+
+	//// Decoder Mode
+
+	// Initialize decoder mode
+	Result InitializeDecoder(int message_bytes, int symbol_bytes);
+
+	// Feed decoder a symbol, returning R_WIN once the message can be reconstructed
+	Result DecodeFeed(u32 esi, const void *symbol_in);
+
+	// Call if DecodeFeed returns R_WIN
+	Result ReconstructOutput(void *message_out, u32 message_bytes);
 };
 
 
+/*
+	RaptorQ Encoder
+
+	Example usage:
+
+		raptorq::Encoder encoder;
+		raptorq::Result r = encoder.BeginEncode(message, message_bytes, symbol_bytes);
+		if (r) return r;
+
+		// The first SourceCount() symbols are the message itself
+		for (u32 esi = 0; esi < symbol_count; ++esi)
+		{
+			u32 bytes = encoder.Encode(esi, symbol);
+
+			// Transmit (esi, symbol, bytes)
+		}
+*/
+class CAT_EXPORT Encoder : protected Codec
+{
+public:
+	CAT_INLINE u32 SourceCount() { return Codec::SourceCount(); }
+
+	// Solve for the intermediate symbols of a message
+	// The message must stay valid while encoding
+	CAT_INLINE Result BeginEncode(const void *message_in, int message_bytes, int symbol_bytes)
+	{
+		return Codec::InitializeEncoder(message_in, message_bytes, symbol_bytes);
+	}
+
+	// Write the symbol for an encoding symbol identifier (ESI), returning the number of bytes written
+	CAT_INLINE u32 Encode(u32 esi, void *symbol_out)
+	{
+		return Codec::Encode(esi, symbol_out);
+	}
+};
+
+
+/*
+	RaptorQ Decoder
+
+	Call Decode() with each symbol as it arrives.  It returns R_MORE_BLOCKS
+	until enough symbols have arrived, and R_WIN once message_out holds the
+	whole message.  Decoding almost always succeeds with K symbols, and
+	each extra symbol cuts the failure rate by about two orders of magnitude.
+*/
+class CAT_EXPORT Decoder : protected Codec
+{
+	void *_message_out;
+	u32 _message_bytes;
+
+public:
+	CAT_INLINE u32 SourceCount() { return Codec::SourceCount(); }
+
+	CAT_INLINE Result BeginDecode(void *message_out, int message_bytes, int symbol_bytes)
+	{
+		// Remember output message location
+		_message_out = message_out;
+		_message_bytes = message_bytes;
+
+		return Codec::InitializeDecoder(message_bytes, symbol_bytes);
+	}
+
+	// Feed decoder a symbol
+	// esi: Encoding symbol identifier, esi < SourceCount are the original message
+	// symbol_in: Has symbol bytes, or fewer for the final source symbol
+	CAT_INLINE Result Decode(u32 esi, const void *symbol_in)
+	{
+		Result r = Codec::DecodeFeed(esi, symbol_in);
+		if (!r) r = Codec::ReconstructOutput(_message_out, _message_bytes);
+		return r; // Return R_WIN when message has been reconstructed
+	}
+};
+
+
+} // namespace raptorq
+
 } // namespace cat
 
 #endif // CAT_RAPTORQ_HPP
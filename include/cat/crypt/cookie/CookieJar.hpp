@@ -34,6 +34,18 @@
 namespace cat {
 
 
+// One handshake waiting for CookieJar::GenerateBatch() or VerifyBatch()
+struct QueuedCookie
+{
+    const void *address_info; // Address info bytes, or 0 to use ip and port
+    int bytes;                // Length of address info, <= 48
+    u32 ip;
+    u16 port;
+    u32 cookie;               // Output of GenerateBatch(), input to VerifyBatch()
+    bool valid;               // Output of VerifyBatch(): True if the cookie is good
+};
+
+
 class CAT_EXPORT CookieJar
 {
     static const int EXPIRE_TIME = 4000; // ms
@@ -45,10 +57,18 @@ class CAT_EXPORT CookieJar
 
     u32 Salsa6(u32 *x);
 
+    // Add the address and epoch to a keyed state, one word every 'stride' words
+    void AddInput(u32 *x, int stride, u32 ip, u16 port, u32 epoch);
+    void AddInput(u32 *x, int stride, const void *address_info, int bytes, u32 epoch);
+
     u32 Hash(u32 ip, u16 port, u32 epoch);
     u32 Hash(const void *address_info, int bytes, u32 epoch);
 
+    // Hash each queued cookie with its own epoch, several at a time
+    void HashBatch(const QueuedCookie *cookies, const u32 *epochs, u32 *hashes, int count);
+
     u32 GetEpoch();
+    u32 ReconstructEpoch(u32 cookie, u32 epoch);
     u32 ReconstructEpoch(u32 cookie);
 
 public:
@@ -62,6 +82,11 @@ public:
     // Thread-safe and lock-free
     bool Verify(u32 ip, u16 port, u32 cookie);
     bool Verify(const void *address_info, int bytes, u32 cookie); // bytes <= 48
+
+    // Thread-safe and lock-free.  Same cookies as the single versions,
+    // computed 4 at a time with SSE2 or 8 at a time with AVX2
+    void GenerateBatch(QueuedCookie *cookies, int count);
+    void VerifyBatch(QueuedCookie *cookies, int count);
 };
 
 
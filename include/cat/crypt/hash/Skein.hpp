@@ -42,6 +42,9 @@ namespace cat {
 // Base class for various versions of Skein
 class CAT_EXPORT Skein : public ICryptHash
 {
+	friend class SkeinMultiBuffer;
+	friend class SkeinTree;
+
 protected:
     // Tweak word 1 bit field starting positions
     static const int T1_POS_TREE_LVL = 112-64; // bits 112..118 : level in hash tree
@@ -90,7 +93,8 @@ protected:
 
     HashComputation hash_func;
 
-    void GenerateInitialState(int bits);
+    // tree_info holds the leaf size, fan-out and height bytes for tree hashing
+    void GenerateInitialState(int bits, u64 tree_info = 0);
 
 public:
     ~Skein();
@@ -0,0 +1,122 @@
+/*
+	Copyright (c) 2012 Christopher A. Taylor.  All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	* Redistributions of source code must retain the above copyright notice,
+	  this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	* Neither the name of LibCat nor the names of its contributors may be used
+	  to endorse or promote products derived from this software without
+	  specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef CAT_SKEIN_MULTI_BUFFER_HPP
+#define CAT_SKEIN_MULTI_BUFFER_HPP
+
+#include <cat/crypt/hash/Skein.hpp>
+
+namespace cat {
+
+
+/*
+	Multi-buffer Skein
+
+	Runs up to four independent Skein hashes side by side, one hash per 64-bit
+	vector lane, so the Threefish rounds of every lane are computed by the same
+	instructions.  With AVX2 the four lanes fill one 256-bit register, with SSE2
+	they fill two 128-bit registers, and otherwise each lane is run through the
+	scalar compression function.  On x86 the AVX2 lanes are built even when the
+	compiler is not targeting AVX2, and are used if the CPU has it.
+
+	Each lane produces exactly the output of a Skein object given the same key
+	and message.  The lanes share one set of tweak flags, so they must all use
+	the same hash size and mode.  Messages may differ in length as long as they
+	span the same number of blocks (see CountBlocks), which always holds for
+	messages no longer than one block: 32 bytes for Skein-256, 64 for Skein-512.
+
+	Usage:
+		BeginKey() or SetKey()
+		BeginMAC() or BeginKDF() if SetKey() was used
+		CrunchFinal()
+		Generate()
+*/
+class CAT_EXPORT SkeinMultiBuffer
+{
+public:
+	static const int MAX_LANES = 4;
+
+protected:
+	static const int MAX_WORDS = Skein::MAX_WORDS;
+	static const int MAX_BYTES = Skein::MAX_BYTES;
+
+	// Word-sliced: State[word][lane]
+	u64 State[MAX_WORDS][MAX_LANES];
+	u64 Tweak0[MAX_LANES]; // Byte position, may differ between lanes
+	u64 Tweak1; // Flags, shared by all lanes
+	int lanes, digest_bytes, digest_words, digest_bytes_shift;
+	u64 output_block_counter;
+
+	typedef void (SkeinMultiBuffer::*HashComputation)(const u64 message[][MAX_LANES], const u32 *byte_counts, u64 NextState[][MAX_LANES]);
+
+	void HashComputation256(const u64 message[][MAX_LANES], const u32 *byte_counts, u64 NextState[][MAX_LANES]);
+	void HashComputation512(const u64 message[][MAX_LANES], const u32 *byte_counts, u64 NextState[][MAX_LANES]);
+
+	HashComputation hash_func;
+
+	// Lane-at-a-time fallback for targets without vector registers
+	void ScalarComputation(const u64 message[][MAX_LANES], const u32 *byte_counts, u64 NextState[][MAX_LANES]);
+
+	void SetTweak(u64 t1);
+
+public:
+	~SkeinMultiBuffer();
+
+	// Returns the number of blocks CrunchFinal() compresses for a message
+	static int CountBlocks(int bits, int bytes);
+
+	// Returns the name of the lane engine in use: "AVX2", "SSE2" or "Scalar"
+	static const char *GetEngineName();
+
+	CAT_INLINE int GetLaneCount() { return lanes; }
+	CAT_INLINE int GetDigestByteCount() { return digest_bytes; }
+
+	// Begin a new unkeyed hash in every lane, ready for CrunchFinal()
+	bool BeginKey(int lanes, int bits);
+
+	// Start every lane from the same existing key
+	bool SetKey(int lanes, ICryptHash *parent);
+
+	bool BeginMAC();
+	bool BeginKDF();
+
+	// Crunch one whole message per lane and finalize, like Skein::Crunch() + End()
+	// Returns false if the messages do not all span the same number of blocks
+	bool CrunchFinal(const void * const *messages, const int *bytes);
+
+	// Extended hash output mode, producing bytes[lane] bytes for each lane
+	void Generate(void * const *out, const int *bytes, int strengthening_rounds = 0);
+
+	// Same number of output bytes for every lane
+	void Generate(void * const *out, int bytes, int strengthening_rounds = 0);
+};
+
+
+} // namespace cat
+
+#endif // CAT_SKEIN_MULTI_BUFFER_HPP
@@ -0,0 +1,162 @@
+/*
+	Copyright (c) 2012 Christopher A. Taylor.  All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	* Redistributions of source code must retain the above copyright notice,
+	  this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	* Neither the name of LibCat nor the names of its contributors may be used
+	  to endorse or promote products derived from this software without
+	  specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef CAT_SKEIN_TREE_HPP
+#define CAT_SKEIN_TREE_HPP
+
+#include <cat/crypt/hash/Skein.hpp>
+
+namespace cat {
+
+
+/*
+	Skein tree hashing mode
+
+	Implements the tree mode from the Skein specification: the message is cut
+	into leaves of leaf_bytes, each leaf is hashed independently, and the leaf
+	digests are hashed together fanout at a time, level by level, until one
+	digest remains.  The leaf size and fan-out are part of the configuration
+	block, so the result differs from sequential Skein and from trees with
+	other parameters.  Both ends of a transfer must agree on them.
+
+	Because the leaves are independent, whole batches of leaves are hashed in
+	parallel across the WorkerThreads pool, with the calling thread helping.
+	Interior nodes are folded in as leaves complete, so memory use is bounded
+	by one batch no matter how long the message is.
+
+	Crunch() may be called with any amount of data.  To avoid a copy, data
+	can also be written straight into the batch buffer with GetCrunchBuffer()
+	and CrunchWritten(), which is what CrunchReader() does for a
+	PolledFileReader.
+
+	Usage:
+		BeginKey()
+		Crunch(), CrunchWritten() or CrunchReader(), any number of times
+		End()
+		Generate()
+*/
+class CAT_EXPORT SkeinTree
+{
+public:
+	static const u32 DEFAULT_LEAF_BYTES = 65536;
+	static const u32 DEFAULT_FANOUT = 8;
+	static const u32 MAX_LEAF_BYTES = 16777216;
+	static const u32 MAX_FANOUT = 256;
+
+	// Upper bound on the memory used for one parallel batch of leaves
+	static const u32 MAX_BATCH_BYTES = 16777216;
+
+protected:
+	static const int MAX_BYTES = Skein::MAX_BYTES;
+	static const int MAX_LEVELS = 66;
+
+	// Maximum tree height, stored in the configuration block.  Trees over
+	// 64-bit message lengths with fan-out of at least 2 never reach it
+	static const u32 MAX_HEIGHT = 0xFF;
+
+	Skein _root;			// State after the tree configuration block
+	Skein _output;			// State for the output stage once End() is called
+	int _digest_bytes;
+	u32 _leaf_bytes, _node_bytes;
+
+	// Batch of leaves waiting to be hashed in parallel
+	u8 *_batch, *_batch_digests;
+	u32 _batch_leaves, _batch_used;
+	u32 _worker_count;
+	u64 _leaf_count;		// Leaves hashed so far
+
+	// Per tree level, the child digests not yet hashed into a node
+	u8 *_levels;
+	u32 _level_count;
+	u32 _level_used[MAX_LEVELS];
+	u64 _level_nodes[MAX_LEVELS]; // Nodes hashed so far at each level
+	u32 _top_level;
+
+	void Cleanup();
+
+	void HashNode(u32 level, u64 position, const void *data, u32 bytes, u8 *digest);
+	void HashLeaf(u32 index, u32 leaf_count);
+	void HashBatch();
+	void PushNode(u32 level, const u8 *digest);
+
+	friend struct SkeinTreeJob;
+
+public:
+	SkeinTree();
+	~SkeinTree();
+
+	CAT_INLINE int GetDigestByteCount() { return _digest_bytes; }
+	CAT_INLINE u32 GetLeafBytes() { return _leaf_bytes; }
+
+	// Begin a new tree hash with 256 or 512 bits of state
+	// leaf_bytes and fanout must be powers of two, with leaf_bytes at least
+	// twice the state size.  Set use_workers = false to hash on this thread only
+	bool BeginKey(int bits, u32 leaf_bytes = DEFAULT_LEAF_BYTES, u32 fanout = DEFAULT_FANOUT, bool use_workers = true);
+
+	// Crunch some message bytes
+	void Crunch(const void *message, u32 bytes);
+
+	// Zero-copy streaming: write up to 'space' bytes at the returned pointer,
+	// then report how many were written with CrunchWritten()
+	u8 *GetCrunchBuffer(u32 &space);
+	void CrunchWritten(u32 bytes);
+
+	// Crunch what is ready in a PolledFileReader, or any reader with the same
+	// bool Read(u8 *buffer, u32 requested, u32 &bytes_read) method.
+	// Returns false once the reader reports the end of the file, or true if it
+	// stopped because the reader had no bytes ready; call it again later
+	template<class Reader>
+	bool CrunchReader(Reader &reader)
+	{
+		for (;;)
+		{
+			u32 space, bytes_read;
+			u8 *buffer = GetCrunchBuffer(space);
+
+			if (!reader.Read(buffer, space, bytes_read))
+				return false;
+
+			// Nothing ready yet, so do not spin on the reader
+			if (bytes_read == 0)
+				return true;
+
+			CrunchWritten(bytes_read);
+		}
+	}
+
+	// Finalize the hash and prepare to generate output
+	void End();
+
+	// Extended hash output mode
+	void Generate(void *out, int bytes);
+};
+
+
+} // namespace cat
+
+#endif // CAT_SKEIN_TREE_HPP
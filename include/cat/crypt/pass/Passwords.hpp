@@ -169,6 +169,15 @@ public:
 							void *out_hash /* 32 bytes */);
 };
 
+// One login waiting for PasswordVerifier::VerifyHashBatch()
+struct QueuedLogin
+{
+	const void *hash;        // 32 bytes provided by the client
+	const void *salted_hash; // 32 bytes from the account database
+	u32 salt;                // 4 bytes from the account database
+	bool valid;              // Output: True if the password was correct
+};
+
 class PasswordVerifier : public PasswordBase
 {
 public:
@@ -185,6 +194,10 @@ public:
 	bool VerifyHash(const void *in_hash /* 32 bytes */,
 					const void *in_salted_hash /* 32 bytes */,
 					u32 in_salt /* 4 bytes */);
+
+	// Verify many queued logins at once, hashing up to four in parallel
+	// Sets the valid flag on each login; Returns false on failure
+	bool VerifyHashBatch(QueuedLogin *logins, int count);
 };
 
 
@@ -61,6 +61,13 @@
 			+ Does not have a limit of 2^16 output blocks
 			+ Skein-PRNG is guaranteed sufficient security properties anyway
 
+	+ Output Keystream
+		+ Each FortunaOutput keys a ChaCha cipher from its Skein-PRNG output
+		+ Keystream is generated 4 KB at a time, four blocks in parallel with SSE2
+		+ The first 32 bytes of every batch re-key ChaCha for the next batch
+			+ So the state never holds a key for output already handed out
+		+ Bytes are erased from the cache as they are handed out
+
 	The Fortuna algorithm is broken up into two objects for efficient thread-safety:
 
 	+ FortunaFactory
@@ -79,6 +86,7 @@
 
 #include <cat/rand/IRandom.hpp>
 #include <cat/crypt/hash/Skein.hpp>
+#include <cat/crypt/symmetric/ChaCha.hpp>
 #include <cat/threads/Mutex.hpp>
 #include <cat/lang/RefSingleton.hpp>
 
@@ -190,14 +198,18 @@ class CAT_EXPORT FortunaOutput : public IRandom
 	CAT_NO_COPY(FortunaOutput);
 	FortunaOutput();
 
-	static const int OUTPUT_CACHE_BYTES = FortunaFactory::POOL_BYTES * 8; // Arbitrary
+	static const int KEYSTREAM_BLOCKS = 64; // Multiple of 4 for SSE2
+	static const int OUTPUT_CACHE_BYTES = KEYSTREAM_BLOCKS * 64;
+	static const int KEY_BYTES = 32;
 
 	u32 thread_id, SeedRevision;
 	Skein OutputHash;
+	ChaChaOutput KeyStream;
 	u8 CachedRandomBytes[OUTPUT_CACHE_BYTES];
 	int used_bytes;
 
 	void Reseed();
+	void Refill();
 
 public:
 	~FortunaOutput();
@@ -140,6 +140,10 @@ public:
 
 	// Generate 16 words of keystream, endian-neutral
 	void GenerateNeutralKeyStream(u32 out[16]);
+
+	// Generate whole 64-byte blocks of keystream: the same bytes that Crypt()
+	// would XOR into the message.  Computes four blocks at a time with SSE2
+	void GenerateKeyStream(void *out, int blocks);
 };
 
 
@@ -127,6 +127,9 @@ public:
 	// Use a key derivation function to generate a new key from the existing key
 	bool GenerateKey(const char *key_name, void *key, int bytes);
 
+	// Generate several keys at once from the existing key, running up to four KDFs in parallel
+	bool GenerateKeys(const char * const *key_names, void * const *keys, const int *bytes, int count);
+
 public:
     // Generate a proof that the local host has the key
     bool GenerateProof(u8 *local_proof, int proof_bytes);
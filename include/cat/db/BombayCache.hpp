@@ -0,0 +1,203 @@
+/*
+	Copyright (c) 2012 Christopher A. Taylor.  All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	* Redistributions of source code must retain the above copyright notice,
+	  this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	* Neither the name of LibCat nor the names of its contributors may be used
+	  to endorse or promote products derived from this software without
+	  specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef CAT_BOMBAY_CACHE_HPP
+#define CAT_BOMBAY_CACHE_HPP
+
+#include <cat/threads/Mutex.hpp>
+
+namespace cat {
+
+namespace bombay {
+
+
+static const u64 INVALID_RECORD_OFFSET = ~(u64)0;
+
+
+/*
+	Record cache for Bombay tables
+
+	Records are cached in a segmented LRU (SLRU) so that a full-table
+	scan does not flush out the hot records:
+
+		New records enter the head of the probationary segment.
+		A hit on a probationary record promotes it to the head of the
+		protected segment.  When the protected segment grows past its
+		limit, its tail is demoted back to the head of probation.
+		Victims are always taken from the tail of probation first.
+
+	A record that is touched only once (for example during a scan) never
+	makes it past probation, so it cannot displace the working set.
+
+	The cache is split into CACHE_STRIPES independent stripes, each with
+	its own lock, hash table, node pool and LRU lists.  Offsets are mapped
+	to stripes by hash, so unrelated queries do not contend on one lock.
+
+	While a Query() read is in flight the record is pinned in the cache:
+	pinned nodes are never evicted, and if the record is written by an
+	Update() during the read, the completed read will return the newer
+	cached copy rather than overwriting it with stale data from disk.
+	If the record is removed during the read instead, the node is marked
+	dead and is freed by the last Fill() or Unpin() without caching the
+	data that was read.
+
+	If every node in a stripe is pinned, Lookup() cannot reserve one and
+	reports that the read is unpinned.  That read must not drop a pin it
+	does not hold, so Fill() is told whether the read was pinned and
+	Unpin() is only called for pinned reads.  An unpinned read is not
+	cached, since nothing would tell it about a Remove() during the read.
+*/
+
+struct CacheNode
+{
+	CacheNode *hash_next;	// Next node in the hash bucket chain
+	CacheNode *prev, *next;	// Segment list links: prev is toward the head
+	u64 offset;				// Record offset, INVALID_RECORD_OFFSET when free
+	u32 pins;				// Number of in-flight reads holding this node
+	u8 segment;				// CACHE_SEG_*
+	u8 valid;				// Non-zero when record data is present
+	u8 dead;				// Non-zero when removed during a read; freed when the last pin drops
+};
+
+enum CacheSegments
+{
+	CACHE_SEG_PROBATION,
+	CACHE_SEG_PROTECTED,
+
+	CACHE_SEG_COUNT
+};
+
+struct CacheStats
+{
+	u64 hits;			// Lookups served from cache
+	u64 misses;			// Lookups that needed a disk read
+	u64 evictions;		// Records dropped to make room
+	u64 promotions;		// Probation -> protected moves
+	u64 pin_failures;	// Misses that could not reserve a node (all pinned)
+	u32 pinned;			// Nodes currently pinned
+	u32 resident;		// Nodes currently holding a record
+};
+
+
+class CAT_EXPORT RecordCache
+{
+	static const u32 CACHE_STRIPES = 16; // Power of two
+	static const u32 PROTECTED_PERCENT = 80;
+	static const u32 MIN_STRIPE_NODES = 16;
+
+	struct Segment
+	{
+		CacheNode *head, *tail;
+		u32 count;
+	};
+
+	struct Stripe
+	{
+		Mutex lock;
+
+		CacheNode **buckets;
+		u32 bucket_mask;
+
+		CacheNode *free_head;
+		Segment segments[CACHE_SEG_COUNT];
+		u32 protected_limit;
+
+		CacheStats stats;
+
+		// Keep stripes on separate cache lines
+		u8 padding[CAT_DEFAULT_CACHE_LINE_SIZE];
+	};
+
+	u32 _record_bytes, _node_bytes;
+	u32 _cache_bytes;
+	Stripe *_stripes;
+	u8 *_cache; // Cache memory
+
+	static CAT_INLINE u8 *GetData(CacheNode *node) { return GetTrailingBytes(node); }
+
+	CacheNode *FindNode(Stripe *stripe, u32 key, u64 offset);
+	void LinkNode(Stripe *stripe, u32 key, CacheNode *node);
+	void UnlinkNode(Stripe *stripe, CacheNode *node);
+
+	// Unlink a resident node and return it to the free list
+	void FreeNode(Stripe *stripe, CacheNode *node);
+
+	void PushHead(Stripe *stripe, u32 segment, CacheNode *node);
+	void RemoveFromSegment(Stripe *stripe, CacheNode *node);
+	void Touch(Stripe *stripe, CacheNode *node);
+
+	// Returns a free node, evicting an unpinned record if needed.  May return 0
+	CacheNode *AcquireNode(Stripe *stripe);
+
+	CAT_INLINE Stripe *GetStripe(u64 offset, u32 &key);
+
+public:
+	RecordCache();
+	~RecordCache();
+
+	bool Initialize(u32 record_bytes, u32 cache_bytes);
+	void Finalize();
+
+	CAT_INLINE bool Valid() { return _cache != 0; }
+	CAT_INLINE u32 GetCacheBytes() { return _cache_bytes; }
+	CAT_INLINE u32 GetRecordBytes() { return _record_bytes; }
+
+	// Returns true on a hit, after copying the record into data.
+	// On a miss, pinned is set if the record was pinned for the read the
+	// caller is about to issue.  The caller must then invoke Fill() with
+	// the same pinned flag, or Unpin() if pinned, exactly once
+	bool Lookup(u64 offset, void *data, bool &pinned);
+
+	// Copies the record into data if present, without pinning or counting a reference
+	bool Peek(u64 offset, void *data);
+
+	// Completes a read.  If the record was stored while the read was in
+	// flight, data is overwritten with the newer cached record.  If it was
+	// removed while the read was in flight, or the read was not pinned,
+	// nothing is cached
+	void Fill(u64 offset, void *data, bool pinned);
+
+	// Abandons a pinned read.  Never call this for an unpinned read
+	void Unpin(u64 offset);
+
+	// Write-through insert or update of a record
+	void Store(u64 offset, const void *data);
+
+	// Drop a record from the cache, including one with a read in flight
+	void Remove(u64 offset);
+
+	// Sum statistics across all stripes
+	void GetStats(CacheStats &stats);
+};
+
+
+} // namespace bombay
+
+} // namespace cat
+
+#endif // CAT_BOMBAY_CACHE_HPP
@@ -30,52 +30,151 @@
 #define CAT_BOMBAY_TABLE_HPP
 
 #include <cat/threads/RWLock.hpp>
-#include <cat/io/ThreadPoolFiles.hpp>
+#include <cat/lang/MergeSort.hpp>
+#include <cat/io/Buffers.hpp>
 #include <cat/db/BombayTableIndex.hpp>
+#include <cat/db/BombayCache.hpp>
 
 namespace cat {
 
 namespace bombay {
 
 
-static u64 INVALID_RECORD_OFFSET = ~(u64)0;
+class TableIndex;
+class IHash;
+
+
+///// Query
 
-struct CacheNode
+struct QueryBuffer;
+
+// Invoked once per Query(): success is false if the record could not be read.
+// tls is 0 when the record was served from cache before Query() returned.
+// Return true to release the buffer, or false to keep it
+typedef Delegate3<bool, ThreadLocalStorage *, bool, QueryBuffer *> QueryCallback;
+
+// Query() read buffer; the record data follows it in memory
+struct QueryBuffer : public ReadBuffer
 {
-	CacheNode *parent, *lower, *higher;
-	u64 offset;
+	QueryCallback on_query;
+	RefObject *reference;	// Released after the callback, if set
+	u64 record_offset;		// Offset passed to Query()
+	bool pinned;			// Set by Query() when the cache reserved a node for the read
+
+	// Allocates a buffer with room for one record of record_bytes
+	static QueryBuffer *Acquire(u32 record_bytes);
+	void Release();
+
+	CAT_INLINE u8 *GetData() { return GetTrailingBytes(this); }
+	CAT_INLINE u64 GetOffset() { return record_offset; }
+
+	CAT_INLINE void SetCallback(const QueryCallback &callback, RefObject *ref = 0)
+	{
+		if (ref)
+			ref->AddRef(CAT_REFOBJECT_TRACE);
+
+		on_query = callback;
+		reference = ref;
+	}
 };
 
-class TableIndex;
-class IHash;
 
+///// BatchQuery
+
+class BatchQuery;
+
+// Invoked once per batch, after every record has been read or has failed
+typedef Delegate2<void, ThreadLocalStorage *, BatchQuery *> BatchQueryCallback;
+
+// One record requested as part of a BatchQuery
+class BatchQueryItem : public SortableItem<BatchQueryItem, u64>
+{
+	friend class Table;
+	friend class BatchQuery;
+
+	u64 _offset;
+	u8 *_data;
+	bool _success;
+	bool _pinned; // Set when the cache reserved a node for the read
 
-// Query() AsyncBuffer tag must derive from AsyncQueryRead
-struct AsyncQueryRead
+public:
+	CAT_INLINE u64 GetOffset() { return _offset; }
+	CAT_INLINE u8 *GetData() { return _data; }
+	CAT_INLINE bool Succeeded() { return _success; }
+};
+
+/*
+	BatchQuery: A set of record offsets looked up together by Table::QueryBatch()
+
+	Cache hits are served immediately.  Misses are sorted by file offset and
+	neighbouring records are coalesced into a few large reads, so a batch of
+	N misses costs far fewer than N disk operations.  The callback fires once
+	when the whole batch has resolved; check Succeeded() on each item.
+*/
+class BatchQuery
 {
-	ThreadRefObject *_reference;
-	AsyncCallback _callback;
+	friend class Table;
 
-	CAT_INLINE void SetCallback(AsyncCallback callback = 0, ThreadRefObject *reference = 0)
+	BatchQueryCallback _callback;
+	RefObject *_reference;
+	volatile u32 _pending; // Outstanding reads, plus one while submitting
+	u32 _count, _record_bytes;
+	u32 _hits, _reads;
+	BatchQueryItem *_items;
+	u8 *_records;
+
+	BatchQuery() {}
+	~BatchQuery() {}
+
+public:
+	// Allocates room for count records of record_bytes each
+	static BatchQuery *Acquire(u32 count, u32 record_bytes);
+	void Release();
+
+	CAT_INLINE void SetOffset(u32 index, u64 offset) { _items[index]._offset = offset; }
+
+	CAT_INLINE void SetCallback(const BatchQueryCallback &callback, RefObject *reference = 0)
 	{
 		if (reference)
-			reference->AddRef();
+			reference->AddRef(CAT_REFOBJECT_TRACE);
 
 		_callback = callback;
 		_reference = reference;
 	}
+
+	CAT_INLINE u32 GetCount() { return _count; }
+	CAT_INLINE BatchQueryItem &GetItem(u32 index) { return _items[index]; }
+
+	// Number of records served from cache and number of disk reads issued
+	CAT_INLINE u32 GetCacheHits() { return _hits; }
+	CAT_INLINE u32 GetDiskReads() { return _reads; }
 };
 
 
 ///// Table
 
+/*
+	Table: A file of fixed-size records with a record cache and hash indices
+
+	Create the Table with RefObjects::Create(), run MakeIndex() for all of
+	the desired indexing routines, and then run Initialize(), which opens
+	the database file and starts rebuilding any index that was missing or
+	damaged on disk.
+
+	Reads and writes run on the IO threads and complete on the worker
+	threads.  Each one holds a reference to the Table, so after Destroy()
+	the indices are saved and the cache is freed once the last of them
+	has completed.
+*/
 class Table : public AsyncFile
 {
-	ShutdownObserver *_shutdown_observer;
 	u32 _record_bytes; // Bytes per record (without CacheNode overhead)
 	u64 _next_record; // Next record offset
 
 protected:
+	char _file_path[MAX_TABLE_PATH];
+
+	// Protects the index lists and record allocation.  The cache has its own striped locks
 	RWLock _lock;
 
 	u64 _index_database_size, _index_read_offset, _index_read_completed;
@@ -83,81 +182,91 @@ protected:
 	static const u32 MAX_INDEX_READ_SIZE = 32768;
 	static const int NUM_PARALLEL_INDEX_READS = 3;
 
-	// Cache hash table of binary trees
-	static const u32 TARGET_TREE_SIZE = 16;
-	static const u32 MIN_TABLE_SIZE = 2048;
-
-	u32 _hash_table_size;
-	CacheNode **_cache_hash_table;
+	// Batched query misses separated by at most MAX_BATCH_READ_GAP bytes
+	// are merged into one read of up to MAX_BATCH_READ_SIZE bytes
+	static const u32 MAX_BATCH_READ_SIZE = 65536;
+	static const u32 MAX_BATCH_READ_GAP = 4096;
 
-	u8 *_cache; // Cache memory
-	u32 _cache_bytes; // Cache bytes
-	u32 _next_cache_slot; // Offset in cache memory to next free slot
-	bool _cache_full; // Cache full flag for optimization
+	RecordCache _cache;
 
 	TableIndex *_head_index, *_head_index_unique;
 	TableIndex *_head_index_waiting, *_head_index_update;
 
-	bool AllocateCache();
-	void FreeCache();
-
-	// Node versions
-	CacheNode *FindNode(u64 offset);
-	void UnlinkNode(CacheNode *node);
-	void InsertNode(u64 offset, u32 key, CacheNode *hint, CacheNode *node);
-
-	// Always returns with a cache node; may re-use an old cache node
-	u8 *SetOffset(u64 offset);
-	u8 *InsertOffset(u64 offset);
-	u8 *PeekOffset(u64 offset);
-	bool RemoveOffset(u64 offset);
-
 public:
-	Table(const char *file_path, u32 record_bytes, u32 cache_bytes, ShutdownObserver *shutdown_observer);
+	Table();
 	virtual ~Table();
 
+	CAT_INLINE const char *GetRefObjectName() { return "BombayTable"; }
+
 private:
 	TableIndex *MakeIndex(const char *index_file_path, IHash *hash_function, bool unique);
 	u64 UniqueIndexLookup(const void *data);
 
 public:
-	// To initialize, run MakeIndex() for all of the desired indexing routines,
-	// and then run Initialize(), which will initialize index objects.
+	// Run MakeIndex() for each index before Initialize()
 	template<class THashFunc> CAT_INLINE TableIndex *MakeIndex(const char *index_file_path, bool unique)
 	{
 		return MakeIndex(index_file_path, new THashFunc, unique);
 	}
 
-	bool Initialize();
+	bool Initialize(const char *file_path, u32 record_bytes, u32 cache_bytes);
 
 public:
-	CAT_INLINE u32 GetCacheBytes() { return _cache_bytes; }
+	CAT_INLINE const char *GetFilePath() { return _file_path; }
+	CAT_INLINE u32 GetCacheBytes() { return _cache.GetCacheBytes(); }
 	CAT_INLINE u32 GetRecordBytes() { return _record_bytes; }
 
+	// Hit/miss/eviction counters summed across the cache stripes
+	CAT_INLINE void GetCacheStats(CacheStats &stats) { _cache.GetStats(stats); }
+
+	// True while any index is being rebuilt from the database file
+	bool IsIndexing();
+
 protected:
-	virtual bool OnRemoveRead(ThreadPoolLocalStorage *tls, int error, AsyncBuffer *buffer, u32 bytes);
-	virtual bool OnQueryRead(ThreadPoolLocalStorage *tls, int error, AsyncBuffer *buffer, u32 bytes);
+	virtual void OnDestroy();
+	virtual bool OnFinalize();
+
+	// Queue a write of one record, or of zeroes if data is 0
+	bool WriteRecord(u64 offset, const void *data);
+
+	// Unindex the record and zero it on disk
+	bool RemoveRecord(const void *data, u64 offset);
+
+	void OnWrite(ThreadLocalStorage &tls, const BatchSet &buffers);
+	void OnRemoveRead(ThreadLocalStorage &tls, const BatchSet &buffers);
+	void OnQueryRead(ThreadLocalStorage &tls, const BatchSet &buffers);
+	void OnBatchRead(ThreadLocalStorage &tls, const BatchSet &buffers);
+
+	bool StartBatchRead(BatchQuery *batch, BatchQueryItem *first, u32 count, u64 offset, u32 bytes);
+	void CompleteBatch(ThreadLocalStorage *tls, BatchQuery *batch);
 
 protected:
 	bool StartIndexing();
 	bool StartIndexingRead();
 	void OnIndexingDone();
 
-	virtual bool OnIndexingRead(ThreadPoolLocalStorage *tls, int error, AsyncBuffer *buffer, u32 bytes);
+	void OnIndexingRead(ThreadLocalStorage &tls, const BatchSet &buffers);
 
 public:
 	bool RequestIndexRebuild(TableIndex *index);
 
 public:
-	// Insert an AsyncBuffer data buffer
-	u64 Insert(void *data);
-
-	// Update with an AsyncBuffer data buffer
-	bool Update(void *data, u64 offset);
-
-	// Query with an AsyncBuffer
-	// NOTE: Query() AsyncBuffer tag must derive from AsyncQueryRead
-	bool Query(u64 offset, AsyncBuffer *buffer);
+	// Insert a copy of the record, returning its offset or INVALID_RECORD_OFFSET
+	u64 Insert(const void *data);
+
+	// Overwrite the record at the given offset with a copy of data
+	bool Update(const void *data, u64 offset);
+
+	// Query one record.  If it is cached, the callback runs before this
+	// returns.  Returns false if the read could not be queued, in which
+	// case the callback is not invoked and the caller keeps the buffer
+	bool Query(u64 offset, QueryBuffer *buffer);
+
+	// Query many records at once; the batch callback is invoked exactly once.
+	// If every record is cached, the callback runs before this returns.
+	// Returns false if a disk read could not be queued, in which case the
+	// affected items are reported as failed to the callback
+	bool QueryBatch(BatchQuery *batch);
 
 	// Remove based on offset
 	bool Remove(u64 offset);
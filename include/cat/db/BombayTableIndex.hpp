@@ -29,13 +29,18 @@
 #ifndef CAT_BOMBAY_TABLE_INDEX_HPP
 #define CAT_BOMBAY_TABLE_INDEX_HPP
 
-#include <cat/db/BombayTable.hpp>
+#include <cat/db/BombayCache.hpp>
+#include <cat/threads/RWLock.hpp>
+#include <cat/io/MappedFile.hpp>
 
 namespace cat {
 
 namespace bombay {
 
 
+static const u32 MAX_TABLE_PATH = 260;
+
+
 /*
 	Returning 0 from one of these hash functions will cause insertion or lookup to fail,
 	which is how invalid input is intended to be handled.
@@ -44,6 +49,8 @@ namespace bombay {
 class IHash
 {
 public:
+	CAT_INLINE virtual ~IHash() {}
+
 	virtual u64 HashField(const void *just_field) = 0;
 	virtual u64 HashComplete(const void *complete_record) = 0;
 	virtual u64 HashVarField(const void *just_field, u32 bytes) { return HashField(just_field); }
@@ -75,88 +82,155 @@ public: \
 	the entry given just that set of bytes.  For example, mapping a user
 	name to a database node.
 
-	The table index should be loaded from disk on startup.  If this is
-	not possible, then an index rebuild will need to be done on startup.
-
-	Hash table size will be at least twice as large as the number of
-	database entries, growing as needed.
-
-	To avoid a lot of expensive setup, each element is arranged like this:
-
-		<-- MSB           LSB -->
-		C(1 bit) || OFFSET+1 (63 bits)
-		HASH(64 bits)
-
-	C: Collision flag
-		0 = No collision
-		1 = Collision, actual data may be stored at next walk location
-
-	OFFSET+1: Database file offset for this entry that contains the
-		full unique identifier.  One(1) is added to the offset in
-		the memory representation of the index table element, so that
-		OFFSET = ~0 will be set by zeroing out the table.
-		0 = No data at this table element.
-		Other values = Valid offset+1
-
-	HASH: 64-bit full hash
-		Only low bits are used for table lookup, so hash does not need
-		to be recomputed if the table grows and lookup of something that
-		is not in the table does not have collisions half the time.
-
-	The whole structure fits in one cache line on an x86 server.
+	The index is an open-addressed hash table of buckets.  Each bucket
+	holds 16 slots and a 16-byte array of tags, one per slot:
+
+		TAG_EMPTY (0x80)   = Slot has never been used
+		TAG_DELETED (0xFE) = Slot was removed, keep probing past it
+		0..127             = Slot is used; tag is the high 7 bits of the hash
+
+	A probe compares all 16 tags of a bucket against the wanted tag at
+	once (with SSE2 compare-masks where available), so the full 64-bit
+	hash in a slot is only read for the ~1/128 false positives.  Probing
+	walks buckets in triangular order and stops at the first bucket that
+	still has an empty slot.
+
+	Each slot stores the database file offset and the full 64-bit hash.
+	Only low bits of the hash select the bucket, so the hash does not
+	need to be recomputed when the table grows.
+
+	Growth is incremental: when the table gets 7/8 full, a table twice
+	the size is allocated and each later Insert() or Remove() moves a few
+	buckets across.  Lookups check the new table and then the old one
+	until the move completes, so no single operation pays for a rehash.
+
+	The index is saved when its Table is finalized, and on startup the
+	index file is memory-mapped rather than read in full.
+	The file is split into chunks of buckets that each carry a checksum
+	in the footer.  A chunk is copied into memory and verified the first
+	time any operation probes into it, and each operation also loads one
+	chunk ahead, so lookups are served immediately and the rest of the
+	index streams in behind them.
+
+	File layout:
+		Buckets (bucket count * 272 bytes)
+		Chunk checksums (chunk count * 8 bytes)
+		Footer: Used elements, bucket count, footer checksum (8 bytes each)
 */
 
 class Table;
 
-class TableIndex : public AsyncFile
+class TableIndex
 {
 	friend class Table;
 
-	ShutdownObserver *_shutdown_observer;
 	Table *_parent;
 	IHash *_index_hash;
 	TableIndex *_next, *_next_unique, *_next_loading;
 
 protected:
-	// (multiplier-1) divisible by all prime factors of table size
-	// (multiplier-1) is a multiple of 4 if table size is a multiple of 4
-	// Increment is relatively prime to the table size.
-	static const u32 COLLISION_MULTIPLIER = 71*7487 * 4 + 1;
-	static const u32 COLLISION_INCREMENTER = 1017234223;
+	static const u32 BUCKET_SLOTS = 16;
+	static const u32 MIN_BUCKETS = 64;
+	static const u32 LOAD_CHUNK_BUCKETS = 256; // Power of two, 68 KB per chunk
+	static const u32 LOAD_CHUNKS_PER_OP = 1;
+	static const u32 MIGRATE_BUCKETS_PER_OP = 8;
+
+	static const u8 TAG_EMPTY = 0x80;
+	static const u8 TAG_DELETED = 0xFE;
+
+	static const u64 TABLE_CHECK_HASH_SALT = 0x74B1301234DEADBF;
+
+	struct IndexSlot
+	{
+		u64 offset;
+		u64 hash;
+	};
 
-	static const u64 OFFSET_MASK = (~(u64)0) >> 1;
-	static const u64 COLLIDE_MASK = ~OFFSET_MASK;
-	static const u32 MIN_ELEMENTS = 1024;
+	struct IndexBucket
+	{
+		u8 tags[BUCKET_SLOTS];
+		IndexSlot slots[BUCKET_SLOTS];
+	};
 
-	static const u32 TABLE_FOOTER_BYTES = 16;
-	static const u64 TABLE_CHECK_HASH_SALT = 0x74B1301234DEADBE;
+	struct IndexFooter
+	{
+		u64 used_elements;
+		u64 bucket_count;
+		u64 check_hash;
+	};
 
 	RWLock _lock;
 
-	u64 *_table;
+	// Active table: Buckets followed by chunk checksums and footer, as written to disk
+	u8 *_table;
 	u32 _table_raw_bytes;
-	u32 _table_elements; // A power of 2; just subtract 1 to make a mask
-	u32 _used_elements;
-
-	char _file_path[MAX_PATH+1];
+	IndexBucket *_buckets;
+	u32 _bucket_count; // A power of 2; just subtract 1 to make a mask
+	u32 _used_elements, _deleted_elements;
+
+	// Table being drained by an incremental resize
+	u8 *_old_table;
+	IndexBucket *_old_buckets;
+	u32 _old_bucket_count;
+	u32 _migrate_next;
+
+	// Demand loading from the mapped index file
+	Mutex _load_lock;
+	MappedFile _disk_file;
+	MappedView _disk_view;
+	const u8 *_disk_buckets;
+	volatile u8 *_chunk_loaded;
+	u32 _chunk_buckets, _chunk_count;
+	volatile u32 _chunks_remaining;
+	volatile u32 _next_load_chunk; // Claimed with Atomic::Add() since Lookup() loads ahead under the read lock
+	volatile bool _corrupt;
+
+	char _file_path[MAX_TABLE_PATH];
+
+	static u32 GetTableBytes(u32 bucket_count, u32 &chunk_buckets, u32 &chunk_count);
+	static u8 *AllocateBuckets(u32 bucket_count, u32 &raw_bytes);
+	static CAT_INLINE u64 *GetChunkHashes(u8 *table, u32 bucket_count)
+	{
+		return reinterpret_cast<u64*>( table + bucket_count * sizeof(IndexBucket) );
+	}
 
 	bool AllocateTable();
-	bool DoubleTable();
 	void FreeTable();
 
+	// Incremental resize
+	bool StartResize();
+	void MigrateBuckets(u32 count);
+	void FinishResize();
+
+	// Demand loading
+	CAT_INLINE void DemandLoad(u32 bucket)
+	{
+		if (_chunks_remaining)
+		{
+			u32 chunk = bucket / _chunk_buckets;
+			if (!_chunk_loaded[chunk]) LoadChunk(chunk);
+		}
+	}
+	void LoadChunk(u32 chunk);
+	void LoadAhead();
+	void FinishLoading();
+	void Regenerate();
+
+	// Probe primitives
+	u64 Find(IndexBucket *buckets, u32 bucket_count, u64 hash, bool demand);
+	void Place(IndexBucket *buckets, u32 bucket_count, u64 hash, u64 offset, bool demand);
+	bool Erase(IndexBucket *buckets, u32 bucket_count, u64 hash, bool demand);
+
 protected:
+	// Blocks until the index file is written
 	void Save();
 
 public:
-	TableIndex(Table *parent, const char *index_file_path,
-			   IHash *hash_function, ShutdownObserver *shutdown_observer);
+	TableIndex(Table *parent, const char *index_file_path, IHash *hash_function);
 	~TableIndex();
 
 	bool Initialize();
 
-protected:
-	virtual bool OnRead(ThreadPoolLocalStorage *tls, int error, AsyncBuffer *buffer, u32 bytes);
-
 public:
 	CAT_INLINE const char *GetFilePath() { return _file_path; }
 
@@ -84,8 +84,14 @@ class CAT_EXPORT Encoder : protected Codec
 public:
 	CAT_INLINE u32 BlockCount() { return Codec::BlockCount(); }
 
+	// Split block value operations across the WorkerThreads (call before BeginEncode)
+	CAT_INLINE void UseWorkerThreads(bool enable = true) { Codec::UseWorkerThreads(enable); }
+
 	// Attempt to initialize with the given message size and number of bytes per block
 	// message_in: Has message_bytes
+	// May be called again for the next message, keeping the allocations.  If the
+	// next message has the same block count and block bytes, the matrix solution
+	// is reused and only the block values are generated
 	CAT_INLINE Result BeginEncode(const void *message_in, int message_bytes, int block_bytes)
 	{
 		Result r = Codec::InitializeEncoder(message_bytes, block_bytes);
@@ -101,6 +107,15 @@ public:
 	{
 		return Codec::Encode(id, block_out);
 	}
+
+	// Generate count encoded blocks with ids starting at first_id,
+	// spread across the WorkerThreads if enabled
+	// blocks_out : Array of count pointers to blocks with block_bytes
+	// bytes_out : Receives number of bytes written for each block
+	CAT_INLINE void EncodeBatch(u32 first_id, u32 count, void * const *blocks_out, u32 *bytes_out)
+	{
+		Codec::EncodeBatch(first_id, count, blocks_out, bytes_out);
+	}
 };
 
 
@@ -151,6 +166,9 @@ class CAT_EXPORT Decoder : protected Codec
 public:
 	CAT_INLINE u32 BlockCount() { return Codec::BlockCount(); }
 
+	// Split block value operations across the WorkerThreads
+	CAT_INLINE void UseWorkerThreads(bool enable = true) { Codec::UseWorkerThreads(enable); }
+
 	// Attempt to initialize the codec with the given message size and block bytes
 	CAT_INLINE Result BeginDecode(void *message_out, int message_bytes, int block_bytes)
 	{
@@ -160,9 +178,25 @@ public:
 		return Codec::InitializeDecoder(message_bytes, block_bytes);
 	}
 
+	// Streaming version: Original blocks are written straight into message_out as
+	// they arrive, and only the missing blocks are solved for at the end.
+	// on_progress is called with the number of leading message bytes that are
+	// final each time it grows, so they can be consumed before decoding completes.
+	// Pass an invalid delegate to skip progress reports
+	CAT_INLINE Result BeginStreamingDecode(void *message_out, int message_bytes, int block_bytes, const DecodeProgress &on_progress)
+	{
+		// Remember output message location
+		_message_out = message_out;
+
+		Codec::SetDecodeProgress(on_progress);
+
+		return Codec::InitializeDecoder(message_bytes, block_bytes, message_out);
+	}
+
 	// Multi-threaded optimized version (splits feeding from solving,
 	// so solving can be attempted in a separate thread; note that the
-	// solver can fail and require more blocks)
+	// solver can fail and require more blocks.  With UseWorkerThreads()
+	// the recovery and output blocks are generated on the WorkerThreads)
 
 	// Feed decoder a block
 	// id: Block number, id < BlockCount are same as original message
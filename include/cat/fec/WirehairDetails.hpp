@@ -30,6 +30,7 @@
 #define CAT_WIREHAIR_DETAILS_HPP
 
 #include <cat/rand/AbyssinianPRNG.hpp>
+#include <cat/lang/Delegates.hpp>
 
 // Debugging:
 //#define CAT_DUMP_CODEC_DEBUG /* Turn on debug output for decoder */
@@ -50,6 +51,7 @@
 #define CAT_WINDOWED_BACKSUB /* Use window optimization for back-substitution (faster) */
 #define CAT_WINDOWED_LOWERTRI /* Use window optimization for lower triangle elimination (faster) */
 #define CAT_ALL_ORIGINAL /* Avoid doing calculations for 0 losses -- Requires CAT_COPY_FIRST_N (faster) */
+#define CAT_WORKER_MIN_SLICE 256 /* Smallest column range of block bytes to hand to a worker thread */
 
 // Heavy rows:
 #define CAT_HEAVY_ROWS 6 /* Number of heavy rows to add - Tune for desired overhead / performance trade-off */
@@ -80,6 +82,9 @@ enum Result
 // Get Result String function
 const char *GetResultString(Result r);
 
+// Streaming decoder progress: Number of leading message bytes that are final
+typedef Delegate1<void, u32> DecodeProgress;
+
 
 //// Encoder/Decoder Combined Implementation
 
@@ -93,6 +98,7 @@ class CAT_EXPORT Codec
 	u32 _p_seed;				// Seed for peeled rows of check matrix
 	u32 _d_seed;				// Seed for dense rows of check matrix
 	u16 _row_count;				// Number of stored rows
+	bool _decoder_solving;		// Boolean: SolveMatrix() has run, so later blocks resume it
 	u16 _mix_count;				// Number of mix columns
 	u16 _mix_next_prime;		// Next prime number at or above dense count
 	u16 _dense_count;			// Number of added dense code rows
@@ -101,6 +107,14 @@ class CAT_EXPORT Codec
 	u32 _input_final_bytes;		// Number of bytes in final block of input
 	u32 _output_final_bytes;	// Number of bytes in final block of output
 	u32 _input_allocated;		// Number of bytes allocated for input, or 0 if referenced
+	u32 _value_bytes;			// Number of bytes in each block touched by value operations
+	u32 _worker_count;			// Number of worker threads to share value operations, or 0 for none
+	bool _encoder_solved;		// Boolean: Symbolic solve for the current N and block bytes can be reused
+	u8 *_stream_blocks;			// Output message holding the leading row slots while streaming, or 0
+	u16 _stream_rows;			// Number of row slots stored in the output message
+	u16 _ready_blocks;			// Number of leading original blocks in place in the output message
+	u16 _free_row;				// Lowest row slot that may still be unused while streaming
+	DecodeProgress _on_progress;	// Streaming decoder progress callback
 #if defined(CAT_ALL_ORIGINAL)
 	bool _all_original;			// Boolean: Only seen original data block identifiers
 #endif
@@ -109,6 +123,8 @@ class CAT_EXPORT Codec
 	struct PeelRow;
 	struct PeelColumn;
 	struct PeelRefs;
+	struct WorkerTask;
+	struct WorkerJob;
 	PeelRow *_peel_rows;		// Array of N peeling matrix rows
 	PeelColumn *_peel_cols;		// Array of N peeling matrix columns
 	PeelRefs *_peel_col_refs;	// List of column references
@@ -177,6 +193,9 @@ class CAT_EXPORT Codec
 	// Diagonalize the peeling matrix, generating compression matrix
 	void PeelDiagonal();
 
+	// Generate row values for the diagonalized peeling matrix
+	void PeelDiagonalValues();
+
 	// Copy deferred rows from the compress matrix to the GE matrix
 	void CopyDeferredRows();
 
@@ -201,6 +220,9 @@ class CAT_EXPORT Codec
 	// Triangularize the GE matrix (may fail if pivot cannot be found)
 	bool Triangle();
 
+	// Map dense rows to the columns they solve
+	void MapDenseRows();
+
 	// Initialize column values for GE matrix
 	void InitializeColumnValues();
 
@@ -219,6 +241,26 @@ class CAT_EXPORT Codec
 	// Regenerate all of the sparse peeled rows to diagonalize them
 	void Substitute();
 
+	// Run all value operations that generate the recovery blocks
+	void GenerateRecoveryValues();
+
+	// Regenerate output blocks that were not received
+	void RegenerateOutput(u8 *output_blocks);
+
+
+	//// Worker Threads
+
+	// Restrict value operations to a column range of the parent codec's blocks
+	void SetValueView(const Codec &parent, u32 offset, u32 bytes);
+	void ClearValueView();
+
+	// Split a job across the worker threads and this thread
+	void RunWorkerJob(WorkerJob *job);
+	void RunWorkerItem(WorkerJob *job, u32 index);
+
+	// Split value operations by column ranges across the worker threads, or return false to run them here
+	bool RunSlicedPass(int pass, u8 *output_blocks);
+
 
 	//// Main Driver
 
@@ -239,6 +281,13 @@ class CAT_EXPORT Codec
 
 	//// Memory Management
 
+	// Look up the stored block for a row slot
+	CAT_INLINE u8 *GetInputBlock(u32 row_i)
+	{
+		if (row_i < _stream_rows) return _stream_blocks + _block_bytes * row_i;
+		return _input_blocks + _block_bytes * (row_i - _stream_rows);
+	}
+
 	void SetInput(const void *message_in);
 	bool AllocateInput();
 	void FreeInput();
@@ -260,6 +309,9 @@ public:
 	CAT_INLINE u32 CSeed() { return _d_seed; }
 	CAT_INLINE u32 BlockCount() { return _block_count; }
 
+	// Share block value operations with the WorkerThreads (off by default)
+	void UseWorkerThreads(bool enable);
+
 
 	//// Encoder Mode
 
@@ -272,11 +324,18 @@ public:
 	// Encode a block, returning number of bytes written
 	u32 Encode(u32 id, void *block_out);
 
+	// Encode count blocks starting from first_id, storing bytes written for each
+	void EncodeBatch(u32 first_id, u32 count, void * const *blocks_out, u32 *bytes_out);
+
 
 	//// Decoder Mode
 
 	// Initialize decoder mode
-	Result InitializeDecoder(int message_bytes, int block_bytes);
+	// If message_out is given, original blocks are stored straight into it as they arrive
+	Result InitializeDecoder(int message_bytes, int block_bytes, void *message_out = 0);
+
+	// Set the streaming decoder progress callback, invalid for none
+	CAT_INLINE void SetDecodeProgress(const DecodeProgress &on_progress) { _on_progress = on_progress; }
 
 	// Feed decoder a block
 	Result DecodeFeed(u32 id, const void *block_in);
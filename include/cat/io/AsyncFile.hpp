@@ -0,0 +1,118 @@
+/*
+	Copyright (c) 2012 Christopher A. Taylor.  All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	* Redistributions of source code must retain the above copyright notice,
+	  this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	* Neither the name of LibCat nor the names of its contributors may be used
+	  to endorse or promote products derived from this software without
+	  specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	On Linux, ASYNCFILE_NOBUFFER opens the file with O_DIRECT.  The kernel
+	then requires the buffer address, file offset and transfer size to be
+	multiples of the logical sector size, and rejects the request otherwise.
+	Buffers from FileWriteAllocator and LargeAllocator are page-aligned, and
+	the page size is a multiple of every sector size we care about, so those
+	are safe to use directly.  If the filesystem does not support O_DIRECT
+	(tmpfs for example) the file falls back to buffered access.
+*/
+
+#ifndef CAT_IO_ASYNCFILE_HPP
+#define CAT_IO_ASYNCFILE_HPP
+
+#include <cat/lang/RefObject.hpp>
+#include <cat/io/IOThreadPools.hpp>
+
+namespace cat {
+
+struct ReadBuffer;
+struct WriteBuffer;
+
+
+enum AsyncFileFlags
+{
+	// Open for read and/or write?
+	ASYNCFILE_READ = 1,
+	ASYNCFILE_WRITE = 2,
+
+	// Select whether the data will be accessed sequentially or randomly
+	ASYNCFILE_RANDOM = 4,
+	ASYNCFILE_SEQUENTIAL = 8,
+
+	// Only a good idea for infrequently accessed data or in combination with manual memory caching
+	ASYNCFILE_NOBUFFER = 16,
+
+	// Truncate the file if it already exists (only makes a difference with writing)
+	ASYNCFILE_TRUNC = 32,
+};
+
+
+class CAT_EXPORT AsyncFile : public RefObject
+{
+	friend class IOThread;
+
+	int _file;
+	u32 _align_mask;	// Non-zero when O_DIRECT alignment rules apply
+	IOThreadPool *_pool;
+
+	bool Post(BatchHead *request, IOLayerFileOverhead &iointernal, u32 io_type, u64 offset, void *data, u32 bytes);
+
+public:
+	AsyncFile();
+	virtual ~AsyncFile();
+
+	CAT_INLINE const char *GetRefObjectName() { return "AsyncFile"; }
+
+	CAT_INLINE bool Valid() { return _file >= 0; }
+	CAT_INLINE int GetHandle() { return _file; }
+
+	// True if the file was opened with O_DIRECT
+	CAT_INLINE bool IsUnbuffered() { return _align_mask != 0; }
+
+	/*
+		In read mode, Open() will fail if the file does not exist.
+		In write mode, Open() will create the file if it does not exist.
+
+		async_file_modes may be any combination of AsyncFileFlags
+	*/
+	bool Open(const char *file_path, u32 async_file_modes);
+	void Close();
+
+	bool SetSize(u64 bytes);
+	u64 GetSize();
+
+	// Set the callback before invoking these functions
+	// Note that the data buffers must be pinned in memory until the read/write completes
+	// If ASYNCFILE_NOBUFFER is specified, the data buffers must be aligned to a page boundary
+	bool Read(ReadBuffer *buffer, u64 offset, void *data, u32 bytes);
+	bool Write(WriteBuffer *buffer, u64 offset, void *data, u32 bytes);
+
+protected:
+	virtual bool OnInitialize();
+	virtual void OnDestroy();
+	virtual bool OnFinalize();
+};
+
+
+} // namespace cat
+
+#endif // CAT_IO_ASYNCFILE_HPP
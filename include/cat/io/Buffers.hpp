@@ -37,8 +37,8 @@
 # include <cat/iocp/AsyncFile.hpp>
 # include <cat/iocp/UDPEndpoint.hpp>
 #else
-# include <cat/io/AsyncFile.hpp>
 # include <cat/io/IOThreadPools.hpp>
+# include <cat/io/AsyncFile.hpp>
 # include <cat/io/UDPEndpoint.hpp>
 #endif
 
@@ -64,17 +64,17 @@ struct SendBuffer : public UDPSendBatchHead
 // Compatible with WorkerBuffer object
 struct RecvBuffer : BatchHead
 {
+	// Worker layer specific overhead
+	// Kept out of the union since a delegate has a constructor
+	WorkerDelegate callback;
+
 	union
 	{
 		// IO layer specific overhead pimpl
 		IOLayerRecvOverhead iointernal;
 
 		// Worker layer specific overhead
-		struct
-		{
-			WorkerDelegate callback;
-			UNetAddr addr;
-		};
+		UNetAddr addr;
 	};
 
 	// Shared overhead
@@ -89,7 +89,7 @@ struct RecvBuffer : BatchHead
 struct WriteBuffer : public BatchHead
 {
 	// Shared overhead
-	WorkerDelegate callback;	// Optional - Completes inside IOThread rather than a worker
+	WorkerDelegate callback;	// Optional - Completes inside IOThread (IOCP) or a worker (portable IO threads)
 	void *data; // Pointer to where the file data will be read
 
 	union
@@ -111,7 +111,7 @@ struct WriteBuffer : public BatchHead
 struct ReadBuffer : public BatchHead
 {
 	// Shared overhead
-	WorkerDelegate callback;	// Optional - Completes inside IOThread rather than a worker
+	WorkerDelegate callback;	// Optional - Completes inside IOThread (IOCP) or a worker (portable IO threads)
 	void *data; // Pointer to where the file data will be written
 
 	union
@@ -0,0 +1,153 @@
+/*
+	Copyright (c) 2012 Christopher A. Taylor.  All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	* Redistributions of source code must retain the above copyright notice,
+	  this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	* Neither the name of LibCat nor the names of its contributors may be used
+	  to endorse or promote products derived from this software without
+	  specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef CAT_IO_IO_THREADS_HPP
+#define CAT_IO_IO_THREADS_HPP
+
+#include <cat/threads/Thread.hpp>
+#include <cat/threads/Mutex.hpp>
+#include <cat/threads/WaitableFlag.hpp>
+#include <cat/net/Sockets.hpp>
+#include <cat/mem/IAllocator.hpp>
+#include <cat/lang/RefSingleton.hpp>
+
+/*
+	Portable IO thread pool
+
+	There is no completion port outside of Windows, so file IO is serviced
+	by a small pool of threads that each own a request queue and issue
+	blocking pread()/pwrite() calls.  Requests are handed out round-robin,
+	so the number of IO threads is the effective queue depth seen by the
+	disk.  Completed buffers that have a callback are delivered to the
+	WorkerThreads in one batch per wake-up, so a slow callback never holds
+	up the next disk request.
+*/
+
+namespace cat {
+
+
+class IOThread;
+class IOThreadPool;
+class IOThreadPools;
+class AsyncFile;
+
+enum IOType
+{
+	IOTYPE_UDP_SEND,
+	IOTYPE_UDP_RECV,
+	IOTYPE_FILE_WRITE,
+	IOTYPE_FILE_READ
+};
+
+struct IOLayerFileOverhead
+{
+	AsyncFile *file;
+	u64 offset;
+	u32 bytes;
+
+	// A value from enum IOType
+	u32 io_type;
+};
+
+typedef IOLayerFileOverhead IOLayerReadOverhead;
+typedef IOLayerFileOverhead IOLayerWriteOverhead;
+
+struct IOLayerRecvOverhead
+{
+	int addr_len;
+	sockaddr_in6 addr;
+};
+
+struct IOLayerSendOverhead
+{
+};
+
+static const u32 IOTHREADS_BUFFER_READ_BYTES = 1450;
+static const u32 IOTHREADS_BUFFER_COUNT = 10000;
+
+
+// Thread that services blocking file requests
+class CAT_EXPORT IOThread : public Thread
+{
+	WaitableFlag _event_flag;
+	volatile bool _kill_flag;
+
+	Mutex _queue_lock;
+	BatchSet _queue;
+
+	void HandleRequests(BatchHead *node);
+
+	virtual bool Entrypoint(void *vmaster);
+
+public:
+	IOThread();
+	CAT_INLINE virtual ~IOThread() {}
+
+	CAT_INLINE void SetKillFlag() { _kill_flag = true; _event_flag.Set(); }
+
+	void Post(BatchHead *request);
+};
+
+
+// A pool of IOThreads
+class CAT_EXPORT IOThreadPool
+{
+	u32 _worker_count;
+	IOThread *_workers;
+
+	volatile u32 _next_worker;
+
+public:
+	IOThreadPool();
+
+	CAT_INLINE u32 GetWorkerCount() { return _worker_count; }
+
+	bool Startup(u32 max_worker_count = 0); // 0 = no limit
+	bool Shutdown();
+
+	// Queue a ReadBuffer or WriteBuffer that has its iointernal filled in
+	bool Post(BatchHead *request);
+};
+
+
+// Owner of the shared IOThreadPool
+class CAT_EXPORT IOThreadPools : public RefSingleton<IOThreadPools>
+{
+	bool OnInitialize();
+	void OnFinalize();
+
+	IOThreadPool _shared_pool;
+
+public:
+	CAT_INLINE IOThreadPool *GetSharedPool() { return &_shared_pool; }
+};
+
+
+} // namespace cat
+
+#endif // CAT_IO_IO_THREADS_HPP
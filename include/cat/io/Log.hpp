@@ -117,6 +117,9 @@ public:
 	void DefaultLogCallback(EventSeverity severity, const char *source, const std::string &msg);
 };
 
+// Declared ahead of the inline users below so CAT_SINGLETON(Log) may define it
+template<> Log *Singleton<Log>::ref();
+
 
 //// Recorder
 
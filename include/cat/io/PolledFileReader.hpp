@@ -44,56 +44,123 @@
 	to have your cake and eat it too.  Note that this means that the read
 	buffers must be page-aligned, but that is handled internally here.
 
-	+ There are always 2 * (processor count) requests outstanding, and at
-	least 16 even if the processor count is low to allow for very fast
-	RAID arrays of SSDs to perform at their peak.
-	For single mechanical disks, this can be set lower without hurting.
-
-	+ Each read from the disks is 32768 bytes.  It's the magic number.
-	In some cases raising the number will help.
-	In most cases lowering this number will hurt.
+	+ There is no single right answer for request size and queue depth.
+	A single mechanical disk is happiest with a couple of 32 KB requests
+	outstanding, while an NVMe drive wants dozens of large requests in
+	flight.  So by default the reader auto-tunes: it starts from 32 KB x 16,
+	measures throughput over a window of completions, and hill-climbs the
+	queue depth and then the chunk size until neither direction helps.
+	Throughput is the bytes completed over the time reads were in flight,
+	so a slow consumer does not make the disk look slow.
+
+	+ Once it settles, the operating point is logged and can be read back
+	with GetOperatingPoint().  Set IO.PolledFileReader.ChunkSize and
+	IO.PolledFileReader.QueueDepth, or call SetOperatingPoint() before
+	Open(), to pin it for a volume and skip tuning.
 */
 
 namespace cat {
 
 
-// See above for rationale of these choices
+// Starting point for auto-tuning, and the old fixed operating point
 static const u32 OPTIMAL_FILE_READ_CHUNK_SIZE = 32768;
 static const u32 OPTIMAL_FILE_MINIMUM_PARALLELISM = 16;
 static const u32 OPTIMAL_FILE_READ_MODE = ASYNCFILE_READ | ASYNCFILE_SEQUENTIAL | ASYNCFILE_NOBUFFER;
 
+// Bounds for auto-tuning
+static const u32 MIN_FILE_READ_CHUNK_SIZE = 16384;
+static const u32 MAX_FILE_READ_CHUNK_SIZE = 1048576;
+static const u32 MAX_FILE_READ_DEPTH = 64;
+
+// Chosen request size and queue depth for a reader
+struct FileReadOperatingPoint
+{
+	u32 chunk_size;		// Bytes per read request
+	u32 queue_depth;	// Read requests kept outstanding
+	double mbps;		// Throughput measured at this point (0 if not measured)
+	double latency_usec;// Average completion latency at this point
+	bool converged;		// True once tuning has settled or the point was pinned
+};
+
 class CAT_EXPORT PolledFileReader : public AsyncFile
 {
-	// Double-buffered cache system
-	u8 *_cache[2];
-	u32 _cache_size;		// Bytes in each cache buffer
-	u32 _cache_front_index;	// Buffer index where data is available now
-	u32 _cache_front_bytes;	// Bytes available in front buffer
-	u32 _cache_offset;		// Offset to next unread byte in front buffer
-	u8 _cache_back_done;	// Flag to indicate that the back buffer read completed
-	u8 _cache_front_done;	// Flag to indicate that the front buffer read completed
-	u32 _cache_back_bytes;	// Bytes available in back buffer
+	enum TuneStages
+	{
+		TUNE_DEPTH_UP,
+		TUNE_DEPTH_DOWN,
+		TUNE_CHUNK_UP,
+		TUNE_CHUNK_DOWN,
+		TUNE_DONE
+	};
+
+	// One read request and the chunk of cache it fills
+	struct ReadSlot
+	{
+		ReadBuffer buffer;		// Must be first: completions are cast back to the slot
+		u8 *data;				// Cache memory for this slot
+		double issue_usec;		// Time the read was issued
+		u32 bytes;				// Bytes read, valid once done is set
+		volatile u32 done;		// Set by the completion callback
+	};
+
+	// Read-ahead cache split into queue_depth slots of chunk_size bytes
+	u8 *_cache;
+	u32 _cache_size;		// Read-ahead memory budget, chunk_size * queue_depth never exceeds this
+	ReadSlot _slots[MAX_FILE_READ_DEPTH];
+	u32 _head;				// Slot being consumed
+	u32 _occupied;			// Slots in flight or holding unconsumed data
+	u32 _consume_offset;	// Offset to next unread byte in head slot
+	bool _eof;				// Last read has been issued or a read failed
+	volatile u32 _in_flight;// Reads issued and not yet completed, including any abandoned after a short read
 
 	// Read state
 	u64 _file_size;			// Total file size
 	u64 _offset;			// Next offset for reading from disk
-	ReadBuffer _buffer;		// Read request object for reading from disk
+	u64 _consumed;			// Bytes handed to the application so far
+
+	// Current and requested operating point; changes wait for the ring to drain
+	u32 _chunk_size, _depth;
+	u32 _next_chunk_size, _next_depth;
+
+	// Tuning state
+	bool _pinned;
+	bool _tune_moved;		// The current stage has already improved on the baseline
+	u32 _tune_stage;
+	FileReadOperatingPoint _best;
+	volatile double _busy_start_usec;	// Time _in_flight last rose from zero
+	volatile u32 _window_bytes, _window_reads, _window_latency_usec;
+	volatile u32 _window_busy_usec;		// Time with reads in flight, for completed busy periods
 
-	void OnFirstRead(ThreadLocalStorage &tls, const BatchSet &buffers);
 	void OnRead(ThreadLocalStorage &tls, const BatchSet &buffers);
 
+	// Block until every issued read has completed, so its slot memory can be reused or freed
+	void WaitForReads();
+
+	bool IssueReads();
+	void ApplyOperatingPoint();
+	void OnWindowComplete(double now);
+	bool TryOperatingPoint(u32 chunk_size, u32 depth);
+	void SettleOperatingPoint();
+
 public:
 	PolledFileReader();
 	virtual ~PolledFileReader();
 
-	CAT_INLINE u64 Offset() { return _offset; }
+	CAT_INLINE u64 Offset() { return _consumed; }
 	CAT_INLINE u64 Size() { return _file_size; }
 	CAT_INLINE u64 Remaining()
 	{
-		s64 remaining = (s64)(_file_size - _offset);
+		s64 remaining = (s64)(_file_size - _consumed);
 		return remaining > 0 ? remaining : 0;
 	}
 
+	// Pin the chunk size and queue depth and disable auto-tuning
+	// Call before Open().  Values are clamped to the bounds above
+	void SetOperatingPoint(u32 chunk_size, u32 queue_depth);
+
+	// Returns the operating point in use, or the one tuning settled on
+	void GetOperatingPoint(FileReadOperatingPoint &point);
+
 	bool Open(const char *file_path, u32 worker_id);
 
 	/*
@@ -103,6 +170,10 @@ public:
 		Not thread-safe to read from the same object with multiple threads.
 	*/
 	bool Read(u8 *buffer, u32 requested, u32 &bytes_read);
+
+protected:
+	// Waits for reads in flight before the file is closed
+	virtual void OnDestroy();
 };
 
 
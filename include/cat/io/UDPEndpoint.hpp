@@ -0,0 +1,146 @@
+/*
+	Copyright (c) 2012 Christopher A. Taylor.  All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	* Redistributions of source code must retain the above copyright notice,
+	  this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	* Neither the name of LibCat nor the names of its contributors may be used
+	  to endorse or promote products derived from this software without
+	  specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef CAT_IO_UDP_ENDPOINT_HPP
+#define CAT_IO_UDP_ENDPOINT_HPP
+
+#include <cat/net/Sockets.hpp>
+#include <cat/lang/RefObject.hpp>
+#include <cat/mem/IAllocator.hpp>
+#include <cat/threads/Thread.hpp>
+#include <cat/io/IOThreadPools.hpp>
+
+/*
+	Portable UDP endpoint
+
+	Same interface as the IOCP version.  Each endpoint owns one thread that
+	blocks in recvmsg() and hands the datagrams to OnRecvRouting().  Every
+	delivered RecvBuffer holds a reference on the endpoint until it is
+	returned through ReleaseRecvBuffers().  Writes are issued synchronously
+	from the calling thread; the kernel socket buffer does the queueing.
+*/
+
+/*
+	Segmentation offload
+
+	On Linux the endpoint asks the kernel for UDP_SEGMENT (GSO) and UDP_GRO.
+	With GSO, a run of equal-sized datagrams written to the same address is
+	handed to the kernel in one sendmsg() call and cut into datagrams below
+	the socket layer.  With GRO, one recvmsg() can return several datagrams
+	from the same peer glued together; they are split back into separate
+	RecvBuffers before OnRecvRouting().
+
+	If the socket refuses GSO (ENOPROTOOPT, EOPNOTSUPP), or the device fails
+	the very first offloaded send (EIO), GSO is switched off for good.  Any
+	other failure of an offloaded send, like EINVAL for a segment larger than
+	the path allows, only sends that run one datagram at a time.
+*/
+
+namespace cat {
+
+
+struct RecvBuffer;
+struct SendBuffer;
+
+
+// Datagrams drained without blocking after a wake-up, before routing them
+static const u32 UDP_READ_BATCH_LIMIT = 32;
+
+// Reader thread wakes up this often to check for shutdown
+static const u32 UDP_READ_TIMEOUT_MSEC = 100;
+
+// Segmentation offload limits
+static const u32 UDP_GSO_MAX_SEGMENTS = 64; // Kernel limit per sendmsg()
+static const u32 UDP_GSO_MAX_BYTES = 65507; // Largest UDP payload
+static const u32 UDP_GRO_BUFFER_BYTES = 65535; // Room for a coalesced read
+
+
+class UDPEndpoint;
+
+
+// Thread that reads from one UDP endpoint
+class CAT_EXPORT UDPReadThread : public Thread
+{
+	virtual bool Entrypoint(void *vendpoint);
+};
+
+
+// Object that represents a UDP endpoint bound to a single port
+class CAT_EXPORT UDPEndpoint : public RefObject, public UDPSocket
+{
+	friend class UDPReadThread;
+
+	UDPReadThread _reader;
+
+	volatile bool _gso, _gro;	// Segmentation offload is in use
+	volatile bool _gso_proven;	// An offloaded send has succeeded
+	u8 *_gro_buffer;			// Workspace for coalesced reads
+
+	void EnableOffload();
+	u32 ReadCoalesced(BatchSet &set, int flags);
+	u32 ReadDirect(BatchSet &set, int flags);
+	void ProcessReads();
+
+	BatchHead *WriteRun(BatchHead *node, const sockaddr *addr, int addr_len, u32 &write_count);
+
+public:
+    UDPEndpoint();
+    virtual ~UDPEndpoint();
+
+	CAT_INLINE const char *GetRefObjectName() { return "UDPEndpoint"; }
+
+	// Results are only valid after Initialize()
+	CAT_INLINE bool UsesSegmentOffload() { return _gso; }
+	CAT_INLINE bool UsesReceiveOffload() { return _gro; }
+
+	bool Initialize(Port port = 0, bool ignoreUnreachable = true, bool RequestIPv6 = true, bool RequireIPv4 = true, int kernelReceiveBufferBytes = 0);
+
+	// If SupportsIPv6() == true, the address must be promoted to IPv6
+	// before calling using addr.PromoteTo6()
+	// Buffers are released whether or not the write succeeds
+	bool Write(const BatchSet &buffers, u32 count, const NetAddr &addr);
+
+	bool Write(u8 *data, u32 data_bytes, const NetAddr &addr);
+
+	// When done with read buffers, call this function to add them back to the available pool
+	void ReleaseRecvBuffers(BatchSet buffers, u32 count);
+
+protected:
+	void SetRemoteAddress(RecvBuffer *buffer);
+
+	virtual void OnRecvRouting(const BatchSet &buffers) = 0;
+
+	virtual bool OnInitialize();
+	virtual void OnDestroy();
+	virtual bool OnFinalize();
+};
+
+
+} // namespace cat
+
+#endif // CAT_IO_UDP_ENDPOINT_HPP
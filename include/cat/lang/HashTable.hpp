@@ -32,6 +32,7 @@
 #include <cat/lang/Strings.hpp>
 #include <cat/lang/LinkedLists.hpp>
 #include <cat/lang/MergeSort.hpp>
+#include <cstdlib>
 
 namespace cat {
 
@@ -73,7 +74,7 @@ class CAT_EXPORT KeyAdapter
 	u32 _hash;
 
 public:
-	CAT_INLINE KeyAdapter::KeyAdapter(SanitizedKey &key)
+	CAT_INLINE KeyAdapter(SanitizedKey &key)
 	{
 		_key = key.Key();
 		_len = key.Length();
@@ -111,7 +111,7 @@ public:
 
 // Classes that derive from RefObject have asynchronously managed lifetimes
 // Never delete a RefObject directly.  Use the Destroy() member instead
-class CAT_EXPORT RefObject : DListItem
+class CAT_EXPORT RefObject : public DListItem
 {
 	friend class RefObjects;
 
@@ -151,6 +151,8 @@ protected:
 	CAT_INLINE void Watch(RefSingletonBase *obj);
 };
 
+template<class T> class RefSingleton;
+
 // Internal class
 template<class T>
 class RefSingletonImpl : public RefSingletonImplBase
@@ -265,7 +267,7 @@ public:
 // Use this alternative form to specify which Mutex object to use
 #define CAT_REF_SINGLETON_MUTEX(T, M)	\
 	static cat::RefSingletonImpl<T> m_T_rss;	\
-	template<> T *RefSingleton<T>::ref() { return m_T_rss.GetRef(M); }
+	namespace cat { template<> T *RefSingleton<T>::ref() { return m_T_rss.GetRef(M); } }
 
 // In the C file for the object, use this macro:
 #define CAT_REF_SINGLETON(T)	CAT_REF_SINGLETON_MUTEX(T, GetRefSingletonMutex())
@@ -295,6 +297,9 @@ public:
 	static void AtExit();
 };
 
+// Declared ahead of the inline user below so CAT_SINGLETON(RefSingletons) may define it
+template<> RefSingletons *Singleton<RefSingletons>::ref();
+
 // Internal inline member function definition
 CAT_INLINE void RefSingletonImplBase::Watch(RefSingletonBase *obj)
 {
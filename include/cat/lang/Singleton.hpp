@@ -87,6 +87,8 @@
 namespace cat {
 
 
+template<class T> class Singleton;
+
 // Internal class
 template<class T>
 class SingletonImpl
@@ -192,7 +194,7 @@ public:
 // Use this alternative form to specify which Mutex object to use
 #define CAT_SINGLETON_MUTEX(T, M)			\
 	static cat::SingletonImpl<T> m_T_ss;	\
-	template<> T *Singleton<T>::ref() { return m_T_ss.GetRef(M); }
+	namespace cat { template<> T *Singleton<T>::ref() { return m_T_ss.GetRef(M); } }
 
 // In the C file for the object, use this macro:
 #define CAT_SINGLETON(T)	CAT_SINGLETON_MUTEX(T, GetSingletonMutex())
@@ -34,6 +34,12 @@
 namespace cat {
 
 
+/*
+	The XOR engine is picked on first use: AVX2 if the CPU supports it,
+	otherwise SSE2 or NEON when built for them, otherwise 64-bit scalar.
+	Buffers may have any alignment and length.
+*/
+
 // In-place XOR of voutput buffer by vinput buffer
 void memxor(void *voutput, const void *vinput, int bytes);
 
@@ -43,6 +49,9 @@ void memxor_set(void *voutput, const void *va, const void *vb, int bytes);
 // XOR of two buffers XORed into voutput buffer
 void memxor_add(void *voutput, const void *va, const void *vb, int bytes);
 
+// Name of the engine picked for this CPU: "AVX2", "SSE2", "NEON" or "Scalar"
+const char *memxor_engine();
+
 
 } // namespace cat
 
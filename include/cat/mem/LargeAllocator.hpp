@@ -42,7 +42,7 @@ namespace cat {
 class CAT_EXPORT LargeAllocator : public IAllocator, public Singleton<LargeAllocator>
 {
 public:
-	// Acquires memory aligned to a CPU cache-line byte boundary from the heap
+	// Acquires memory aligned to a page boundary from the heap
     void *Acquire(u32 bytes);
 
 	// Unable to resize
@@ -36,6 +36,10 @@
 # include <WS2tcpip.h>
 #else
 # include <unistd.h>
+# include <sys/types.h>
+# include <sys/socket.h>
+# include <netinet/in.h>
+# include <arpa/inet.h>
 #endif
 
 /*
@@ -66,7 +70,7 @@ typedef u16 Port;
 	typedef int SocketHandle;
 	static const SocketHandle INVALID_SOCKET = -1;
 	static const int SOCKET_ERROR = -1;
-	CAT_INLINE bool CloseSocketHandle(Socket s) { return !close(s); }
+	CAT_INLINE bool CloseSocketHandle(SocketHandle s) { return !close(s); }
 #endif
 
 
@@ -274,7 +278,8 @@ public:
 
 	// Call these after binding:
 
-	// Disabled by default; useful for MTU discovery
+	// Disabled by default; useful for MTU discovery.
+	// Sets DF on IPv4 and IPV6_DONTFRAG on IPv6, so oversized datagrams are dropped instead of fragmented
 	bool DontFragment(bool df = true);
 };
 
@@ -30,6 +30,7 @@
 #define CAT_SPHYNX_CLIENT_HPP
 
 #include <cat/sphynx/Transport.hpp>
+#include <cat/sphynx/MTUDiscovery.hpp>
 #include <cat/crypt/tunnel/KeyAgreementInitiator.hpp>
 #include <cat/threads/Thread.hpp>
 #include <cat/threads/WaitableFlag.hpp>
@@ -72,8 +73,7 @@ class CAT_EXPORT Client : public UDPEndpoint, public Transport
 	u32 _last_hello_post;
 	s32 _hello_post_interval;
 
-	u32 _mtu_discovery_time;
-	int _mtu_discovery_attempts;
+	MTUDiscovery _mtu_discovery;
 	u32 _next_sync_time;
 	u32 _sync_attempts;
 
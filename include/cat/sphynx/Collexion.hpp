@@ -29,8 +29,13 @@
 #ifndef CAT_SPHYNX_COLLEXION_HPP
 #define CAT_SPHYNX_COLLEXION_HPP
 
+#include <cat/sphynx/Common.hpp>
 #include <cat/threads/Mutex.hpp>
-#include <cat/sphynx/Connexion.hpp>
+#include <cat/threads/EpochReclaim.hpp>
+#include <cat/threads/WorkerThreads.hpp>
+#include <cat/lang/RefObject.hpp>
+#include <cmath>
+#include <new>
 
 namespace cat {
 
@@ -49,9 +54,24 @@ namespace sphynx {
 	The design is optimized for cache usage, re-using common code to benefit
 	from code cache and allocating and accessing table entries on cache line
 	boundaries to double memory performance over a naive approach.
+
+	Broadcasting to everyone is the most common use, so the Collexion also
+	publishes a copy-on-write snapshot of its members, binned by worker.
+	Readers take it without the table lock and without touching member
+	reference counts.  After membership changes the next reader builds a
+	new version, and the old snapshot and the references of removed
+	members are retired to an EpochReclaim so they outlive any reader
+	still walking them.  Nothing is released from inside a read section:
+	the owner calls Reclaim() from a periodic tick, such as Server::OnTick(),
+	to hand back what the readers have finished with.
 */
 
 
+// Connexion.hpp includes this file through Transport.hpp, so only members
+// that are templated on the Connexion type may look inside one
+class Connexion;
+
+
 //// IConnexionCriterion
 
 // Interface base class for a connexion match criterion
@@ -137,6 +157,8 @@ public:
 
 	CAT_INLINE int Count() { return _used; }
 
+	CAT_INLINE Connexion **GetList() { return _list; }
+
 	CAT_INLINE Connexion *operator[](int index) { return _list[index]; }
 };
 
@@ -185,6 +207,438 @@ public:
 };
 
 
+//// ConnexionSnapshot
+
+template<class T> class Collexion;
+
+// Immutable list of Collexion members, grouped by worker thread
+class ConnexionSnapshot
+{
+	template<class T> friend class Collexion;
+
+	u32 _version;
+	int _count, _worker_count;
+
+	// Offset of each worker's bin in the member list, plus one for the end
+	int *_offsets;
+
+	// Member list, followed by the offsets in the same allocation
+	Connexion **_members;
+
+	ConnexionSnapshot() {}
+	~ConnexionSnapshot() {}
+
+	// Filled in two passes over the same members:
+	// CountMember() each, FinishCount(), PlaceMember() each, FinishPlace()
+	// Templated so Connexion only needs to be complete where Collexion<T> is used
+	template<class T> CAT_INLINE void CountMember(T *conn) { ++_offsets[conn->GetWorkerID() + 1]; }
+	void FinishCount();
+	template<class T> CAT_INLINE void PlaceMember(T *conn) { _members[_offsets[conn->GetWorkerID()]++] = conn; }
+	void FinishPlace();
+
+public:
+	// Allocate room for up to max_count members, returns 0 on failure
+	static ConnexionSnapshot *Acquire(u32 version, int max_count, int worker_count);
+
+	// EpochReleaser for retired snapshots
+	static void Release(void *snapshot);
+
+	CAT_INLINE u32 GetVersion() { return _version; }
+	CAT_INLINE int Count() { return _count; }
+	CAT_INLINE int WorkerCount() { return _worker_count; }
+
+	CAT_INLINE Connexion *operator[](int index) { return _members[index]; }
+
+	// Members served by one worker are contiguous
+	CAT_INLINE Connexion **GetBin(int worker_id, int &bin_count)
+	{
+		int offset = _offsets[worker_id];
+		bin_count = _offsets[worker_id + 1] - offset;
+		return _members + offset;
+	}
+};
+
+
+//// InterestGrid
+
+/*
+	Interest management for area-of-interest broadcasts
+
+	Game servers usually only want to tell players about events happening
+	near them.  Evaluating an IConnexionCriterion against every member of a
+	Collexion makes each of these broadcasts cost O(all players), which is
+	what limits the size of a zone.
+
+	InterestGrid is a spatial hash over a uniform grid of square cells on
+	the ground plane.  Each member with a position lives in exactly one cell
+	bucket, so a query only visits the cells that overlap the area of
+	interest and the members inside them.  Moving within a cell just updates
+	the stored position, and moving to another cell relinks one node.
+
+	Cells are hashed rather than stored densely, so the world does not need
+	to have fixed bounds.  The cell size should be roughly the typical query
+	radius: much smaller and queries visit many empty cells, much larger and
+	they test many members that are out of range.
+
+	Nodes are addressed by index + 1 so that the Collexion can remember where
+	each member lives across table growth.  This class does no locking of its
+	own; the owning Collexion serializes access with its table lock.
+*/
+
+template<class T>
+struct InterestGridNode
+{
+	// Last reported position
+	float x, y;
+
+	// Cell coordinates
+	s32 cell_x, cell_y;
+
+	// Bucket list links: Node index + 1, or 0 for none.
+	// When the node is free, next links the free list instead.
+	u32 prev, next;
+
+	// Member at this position, or 0 if the node is free
+	T *conn;
+};
+
+template<class T>
+class InterestGrid
+{
+	static const u32 MIN_ALLOCATED = 32;
+
+	// Cell dimensions, or 0 if the grid is disabled
+	float _cell_size, _inv_cell_size;
+
+	// Number of used/allocated nodes, also the number of buckets
+	u32 _used, _allocated;
+
+	// First node in the free list + 1
+	u32 _free_head;
+
+	// Node table
+	InterestGridNode<T> *_nodes;
+
+	// Bucket table: First node in each bucket + 1
+	u32 *_buckets;
+
+	static CAT_INLINE u32 HashCell(s32 cell_x, s32 cell_y)
+	{
+		return (u32)cell_x * 73856093 ^ (u32)cell_y * 19349663;
+	}
+
+	CAT_INLINE s32 ToCell(float v)
+	{
+		return (s32)std::floor(v * _inv_cell_size);
+	}
+
+	void Link(u32 node);
+	void Unlink(u32 node);
+
+	// Attempt to double the number of nodes and buckets
+	bool DoubleTable();
+
+public:
+	InterestGrid();
+	~InterestGrid();
+
+	// Free all nodes and disable the grid
+	void Cleanup();
+
+	// Enable the grid with the given cell size in world units
+	bool Initialize(float cell_size);
+
+	CAT_INLINE bool IsEnabled() { return _cell_size > 0.f; }
+	CAT_INLINE u32 Count() { return _used; }
+
+	// Add a member at a position; returns node index + 1, or 0 on failure
+	u32 Insert(T *conn, float x, float y);
+
+	// Update the position of a member
+	void Move(u32 node, float x, float y);
+
+	// Remove a member from the grid
+	void Remove(u32 node);
+
+	// Add members within the box [min_x, max_x] x [min_y, max_y] to the subset.
+	// If radius_squared >= 0, members must also be within the circle around (x, y).
+	// Members rejected by the optional criterion are skipped
+	template<class TSubset>
+	int Gather(TSubset &subset, float min_x, float min_y, float max_x, float max_y,
+			   float x, float y, float radius_squared, IConnexionCriterion<T> *criterion);
+};
+
+template<class T>
+InterestGrid<T>::InterestGrid()
+{
+	_cell_size = 0.f;
+	_inv_cell_size = 0.f;
+	_used = 0;
+	_allocated = 0;
+	_free_head = 0;
+	_nodes = 0;
+	_buckets = 0;
+}
+
+template<class T>
+InterestGrid<T>::~InterestGrid()
+{
+	Cleanup();
+}
+
+template<class T>
+void InterestGrid<T>::Cleanup()
+{
+	if (_nodes) delete []_nodes;
+	if (_buckets) delete []_buckets;
+
+	_nodes = 0;
+	_buckets = 0;
+	_used = 0;
+	_allocated = 0;
+	_free_head = 0;
+	_cell_size = 0.f;
+	_inv_cell_size = 0.f;
+}
+
+template<class T>
+bool InterestGrid<T>::Initialize(float cell_size)
+{
+	if (!(cell_size > 0.f))
+		return false;
+
+	_cell_size = cell_size;
+	_inv_cell_size = 1.f / cell_size;
+	return true;
+}
+
+template<class T>
+void InterestGrid<T>::Link(u32 node)
+{
+	InterestGridNode<T> *n = &_nodes[node - 1];
+	u32 bucket = HashCell(n->cell_x, n->cell_y) & (_allocated - 1);
+
+	// Link to front of bucket list
+	u32 head = _buckets[bucket];
+	if (head) _nodes[head - 1].prev = node;
+	n->next = head;
+	n->prev = 0;
+	_buckets[bucket] = node;
+}
+
+template<class T>
+void InterestGrid<T>::Unlink(u32 node)
+{
+	InterestGridNode<T> *n = &_nodes[node - 1];
+	u32 prev = n->prev, next = n->next;
+
+	if (prev) _nodes[prev - 1].next = next;
+	else _buckets[HashCell(n->cell_x, n->cell_y) & (_allocated - 1)] = next;
+	if (next) _nodes[next - 1].prev = prev;
+}
+
+template<class T>
+bool InterestGrid<T>::DoubleTable()
+{
+	u32 new_allocated = _allocated << 1;
+	if (new_allocated < MIN_ALLOCATED) new_allocated = MIN_ALLOCATED;
+
+	// Allocate bucket table
+	u32 *new_buckets = new (std::nothrow) u32[new_allocated];
+	if (!new_buckets) return false;
+
+	// Allocate node table
+	InterestGridNode<T> *new_nodes = new (std::nothrow) InterestGridNode<T>[new_allocated];
+	if (!new_nodes)
+	{
+		delete []new_buckets;
+		return false;
+	}
+
+	CAT_CLR(new_buckets, new_allocated * sizeof(u32));
+
+	// Node indices are preserved so the Collexion can keep its references
+	if (_nodes)
+	{
+		memcpy(new_nodes, _nodes, _allocated * sizeof(InterestGridNode<T>));
+		delete []_nodes;
+	}
+	if (_buckets) delete []_buckets;
+
+	// Put the new nodes on the free list in order
+	for (u32 ii = _allocated; ii < new_allocated; ++ii)
+	{
+		new_nodes[ii].conn = 0;
+		new_nodes[ii].next = (ii + 1 < new_allocated) ? ii + 2 : _free_head;
+	}
+	_free_head = _allocated + 1;
+
+	u32 old_allocated = _allocated;
+	_nodes = new_nodes;
+	_buckets = new_buckets;
+	_allocated = new_allocated;
+
+	// Relink every used node into the larger bucket table
+	for (u32 ii = 0; ii < old_allocated; ++ii)
+	{
+		if (_nodes[ii].conn)
+			Link(ii + 1);
+	}
+
+	return true;
+}
+
+template<class T>
+u32 InterestGrid<T>::Insert(T *conn, float x, float y)
+{
+	if (!IsEnabled())
+		return 0;
+
+	// If no nodes are free,
+	if (!_free_head && !DoubleTable())
+		return 0;
+
+	// Pop a node off the free list
+	u32 node = _free_head;
+	InterestGridNode<T> *n = &_nodes[node - 1];
+	_free_head = n->next;
+
+	n->x = x;
+	n->y = y;
+	n->cell_x = ToCell(x);
+	n->cell_y = ToCell(y);
+	n->conn = conn;
+
+	Link(node);
+	++_used;
+
+	return node;
+}
+
+template<class T>
+void InterestGrid<T>::Move(u32 node, float x, float y)
+{
+	InterestGridNode<T> *n = &_nodes[node - 1];
+
+	n->x = x;
+	n->y = y;
+
+	s32 cell_x = ToCell(x), cell_y = ToCell(y);
+
+	// If it moved to a different cell,
+	if (cell_x != n->cell_x || cell_y != n->cell_y)
+	{
+		Unlink(node);
+
+		n->cell_x = cell_x;
+		n->cell_y = cell_y;
+
+		Link(node);
+	}
+}
+
+template<class T>
+void InterestGrid<T>::Remove(u32 node)
+{
+	Unlink(node);
+
+	// Push node on the free list
+	InterestGridNode<T> *n = &_nodes[node - 1];
+	n->conn = 0;
+	n->next = _free_head;
+	_free_head = node;
+
+	--_used;
+}
+
+template<class T> template<class TSubset>
+int InterestGrid<T>::Gather(TSubset &subset, float min_x, float min_y, float max_x, float max_y,
+							float x, float y, float radius_squared, IConnexionCriterion<T> *criterion)
+{
+	if (!_used || !(min_x <= max_x) || !(min_y <= max_y))
+		return 0;
+
+	int count = 0;
+
+	s32 cell_x0 = ToCell(min_x), cell_x1 = ToCell(max_x);
+	s32 cell_y0 = ToCell(min_y), cell_y1 = ToCell(max_y);
+	u64 cells = ((u64)(cell_x1 - cell_x0) + 1) * ((u64)(cell_y1 - cell_y0) + 1);
+
+	// If the area covers more cells than there are nodes, a linear scan is cheaper
+	if (cells >= _allocated)
+	{
+		for (u32 ii = 0; ii < _allocated; ++ii)
+		{
+			InterestGridNode<T> *n = &_nodes[ii];
+			T *conn = n->conn;
+
+			if (!conn ||
+				n->x < min_x || n->x > max_x ||
+				n->y < min_y || n->y > max_y)
+				continue;
+
+			if (radius_squared >= 0.f)
+			{
+				float dx = n->x - x, dy = n->y - y;
+				if (dx * dx + dy * dy > radius_squared)
+					continue;
+			}
+
+			if (criterion && !criterion->In(conn))
+				continue;
+
+			subset.Insert(conn);
+			++count;
+		}
+
+		return count;
+	}
+
+	const u32 mask = _allocated - 1;
+
+	// For each overlapped cell,
+	for (s32 cell_y = cell_y0;; ++cell_y)
+	{
+		for (s32 cell_x = cell_x0;; ++cell_x)
+		{
+			// For each node in the cell's bucket,
+			for (u32 node = _buckets[HashCell(cell_x, cell_y) & mask]; node; node = _nodes[node - 1].next)
+			{
+				InterestGridNode<T> *n = &_nodes[node - 1];
+
+				// Skip nodes from other cells that share the bucket
+				if (n->cell_x != cell_x || n->cell_y != cell_y)
+					continue;
+
+				// Edge cells are only partially covered
+				if (n->x < min_x || n->x > max_x ||
+					n->y < min_y || n->y > max_y)
+					continue;
+
+				if (radius_squared >= 0.f)
+				{
+					float dx = n->x - x, dy = n->y - y;
+					if (dx * dx + dy * dy > radius_squared)
+						continue;
+				}
+
+				if (criterion && !criterion->In(n->conn))
+					continue;
+
+				subset.Insert(n->conn);
+				++count;
+			}
+
+			if (cell_x == cell_x1) break;
+		}
+
+		if (cell_y == cell_y1) break;
+	}
+
+	return count;
+}
+
+
 //// Collexion
 
 template<class T>
@@ -207,6 +661,9 @@ struct CollexionElement2
 
 	// Hash of data pointer from main entry (so it doesn't need to be recalculated during growth)
 	u32 hash;
+
+	// Interest grid node + 1, or 0 if no position has been set
+	u32 grid;
 };
 
 template<class T>
@@ -217,8 +674,6 @@ class Collexion
 	static const u32 NEXT_MASK = 0x3fffffff;
 	static const u32 MIN_ALLOCATED = 32;
 
-	static const u32 MAX_DEFER_RELEASE = 64;
-
 	// Number of used/allocated table elements
 	u32 _used, _allocated;
 
@@ -242,6 +697,27 @@ class Collexion
 	// Table lock
 	Mutex _lock;
 
+	// Optional spatial index for area-of-interest queries
+	InterestGrid<T> _grid;
+
+	// Membership version, incremented on every insertion and removal
+	volatile u32 _version;
+
+	// Latest published snapshot, or 0 if none has been built yet
+	ConnexionSnapshot * volatile _snapshot;
+
+	// Defers release of old snapshots and removed members past lock-free readers
+	EpochReclaim _reclaim;
+
+	// EpochReleaser for member references
+	static void ReleaseMember(void *conn)
+	{
+		static_cast<T*>(conn)->ReleaseRef(CAT_REFOBJECT_TRACE);
+	}
+
+	// Build and publish a snapshot of the current members (takes lock)
+	ConnexionSnapshot *PublishSnapshot();
+
 	// Attempt to double size of hash table (does not hold lock)
 	bool DoubleTable();
 
@@ -265,14 +741,17 @@ class Collexion
 		return (u32)key;
 	}
 
+	// Find the table key for a Connexion object, returns key + 1 or 0 if not found
+	u32 Find(T *conn);
+
 	// Unlink an active table key
 	void UnlinkActive(u32 key);
 
 	// Inactivate an active table key
 	void Inactivate(u32 key);
 
-	// Release entire inactive list
-	int ReleaseInactive(T **defer_release_list);
+	// Retire entire inactive list
+	void ReleaseInactive();
 
 public:
 	// Ctor zeros everything
@@ -291,12 +770,70 @@ public:
 	bool Remove(T *conn);
 
 	// Extract a subset of the listed Connexion objects that match the search criterion
+	// A null criterion matches every Connexion object
+	// Returns the number of elements that matched
+	int SubsetAcquire(ConnexionSubset &subset, IConnexionCriterion<T> *criterion = 0);
+	int BinnedSubsetAcquire(BinnedConnexionSubset &subset, IConnexionCriterion<T> *criterion = 0);
+
+	// Enable area-of-interest queries, with cells of the given size in world units.
+	// Returns false if the cell size is invalid or the grid is already enabled
+	bool EnableInterestGrid(float cell_size);
+
+	// Set or update the position of a member for area-of-interest queries.
+	// Call this whenever the game moves the player; it is cheap within a cell.
+	// Returns false if the grid is disabled, the member is not listed, or out of memory
+	bool SetPosition(T *conn, float x, float y);
+
+	// Extract the members within a radius of a point, or within an axis-aligned area.
+	// Only members that have a position are considered, and the optional
+	// criterion is evaluated only for members inside the area.
 	// Returns the number of elements that matched
-	int SubsetAcquire(ConnexionSubset &subset, IConnexionCriterion<T> *criterion = &AnyConnexion());
-	int BinnedSubsetAcquire(BinnedConnexionSubset &subset, IConnexionCriterion<T> *criterion = &AnyConnexion<T>());
+	int BinnedRadiusAcquire(BinnedConnexionSubset &subset, float x, float y, float radius, IConnexionCriterion<T> *criterion = 0);
+	int BinnedAreaAcquire(BinnedConnexionSubset &subset, float min_x, float min_y, float max_x, float max_y, IConnexionCriterion<T> *criterion = 0);
 
 	// Call this when finished using a subset to release references
 	void SubsetRelease();
+
+	// Get the current member snapshot for lock-free iteration.
+	// Returns 0 only if no snapshot could ever be allocated.
+	// Call SnapshotRelease() with the ticket when done, and do not block in between
+	ConnexionSnapshot *SnapshotAcquire(u32 &ticket);
+
+	CAT_INLINE void SnapshotRelease(u32 ticket) { _reclaim.LeaveRead(ticket); }
+
+	// Release removed members and old snapshots that no reader can still see.
+	// Call this periodically from a tick, outside of any snapshot, or removed
+	// Connexion objects will keep a reference until Cleanup()
+	CAT_INLINE void Reclaim() { _reclaim.Reclaim(); }
+};
+
+
+//// AutoCollexionSnapshot
+
+template<class T>
+class AutoCollexionSnapshot
+{
+	Collexion<T> *_collexion;
+	ConnexionSnapshot *_snapshot;
+	u32 _ticket;
+
+public:
+	CAT_INLINE AutoCollexionSnapshot(Collexion<T> &collexion)
+	{
+		_collexion = &collexion;
+		_snapshot = collexion.SnapshotAcquire(_ticket);
+	}
+
+	CAT_INLINE ~AutoCollexionSnapshot()
+	{
+		_collexion->SnapshotRelease(_ticket);
+	}
+
+	CAT_INLINE ConnexionSnapshot *Get() { return _snapshot; }
+
+	CAT_INLINE int Count() { return _snapshot ? _snapshot->Count() : 0; }
+
+	CAT_INLINE T *operator[](int index) { return static_cast<T*>((*_snapshot)[index]); }
 };
 
 
@@ -312,6 +849,8 @@ Collexion<T>::Collexion()
 	_table = 0;
 	_table2 = 0;
 	_reference_count = 0;
+	_version = 0;
+	_snapshot = 0;
 }
 
 template<class T>
@@ -323,10 +862,16 @@ Collexion<T>::~Collexion()
 template<class T>
 void Collexion<T>::Cleanup()
 {
-	StdAllocator *allocator = StdAllocator::ref();
+	// Drop the spatial index
+	_grid.Cleanup();
+
+	// Release the published snapshot and anything retired so far
+	if (_snapshot) ConnexionSnapshot::Release(_snapshot);
+	_snapshot = 0;
+	_reclaim.Synchronize();
 
 	// If second table exists, free memory
-	if (_table2) allocator->Release(_table2);
+	if (_table2) delete []_table2;
 	_table2 = 0;
 
 	// If table doesn't exist, return
@@ -342,9 +887,13 @@ void Collexion<T>::Cleanup()
 		if (conn) conn->ReleaseRef(CAT_REFOBJECT_TRACE);
 	}
 
-	// Release table memory
-	allocator->Release(_table);
+	// Release table memory (allocated by DoubleTable)
+	delete []_table;
 	_table = 0;
+	_allocated = 0;
+	_used = 0;
+	_active_head = 0;
+	_inactive_head = 0;
 }
 
 template<class T>
@@ -374,7 +923,7 @@ bool Collexion<T>::DoubleTable()
 	// If old table exists,
 	if (_table && _table2)
 	{
-		const u32 mask = _allocated - 1;
+		const u32 mask = new_allocated - 1;
 
 		// Active list:
 
@@ -382,8 +931,8 @@ bool Collexion<T>::DoubleTable()
 		register u32 old_key = _active_head;
 		while (old_key)
 		{
-			CollexionElement<T> *old_element = &_table[old_key];
-			u32 hash = _table2[old_key].hash;
+			CollexionElement<T> *old_element = &_table[old_key - 1];
+			u32 hash = _table2[old_key - 1].hash;
 			u32 new_key = hash & mask;
 
 			// While collisions occur,
@@ -399,12 +948,13 @@ bool Collexion<T>::DoubleTable()
 			// Fill new table element
 			new_table[new_key].conn = old_element->conn;
 			new_table2[new_key].hash = hash;
+			new_table2[new_key].grid = _table2[old_key - 1].grid;
 
 			// Link new element to new list
 			if (new_active_head)
 			{
 				new_table[new_key].next |= new_active_head;
-				new_table2[new_active_head - 1].prev = new_key;
+				new_table2[new_active_head - 1].prev = new_key + 1;
 			}
 
 			// Update the new head
@@ -427,8 +977,8 @@ bool Collexion<T>::DoubleTable()
 		old_key = _inactive_head;
 		while (old_key)
 		{
-			CollexionElement<T> *old_element = &_table[old_key];
-			u32 hash = _table2[old_key].hash;
+			CollexionElement<T> *old_element = &_table[old_key - 1];
+			u32 hash = _table2[old_key - 1].hash;
 			u32 new_key = hash & mask;
 
 			// While collisions occur,
@@ -444,12 +994,13 @@ bool Collexion<T>::DoubleTable()
 			// Fill new table element
 			new_table[new_key].conn = old_element->conn;
 			new_table2[new_key].hash = hash;
+			new_table2[new_key].grid = _table2[old_key - 1].grid;
 
 			// Link new element to new list
 			if (new_inactive_head)
 			{
 				new_table[new_key].next |= new_inactive_head;
-				new_table2[new_inactive_head - 1].prev = new_key;
+				new_table2[new_inactive_head - 1].prev = new_key + 1;
 			}
 
 			// Set kill flag
@@ -536,6 +1087,7 @@ bool Collexion<T>::Insert(T *conn)
 
 	// Increment used count
 	++_used;
+	++_version;
 
 	// Link new element to front of list
 	if (_active_head) _table2[_active_head - 1].prev = key + 1;
@@ -546,6 +1098,7 @@ bool Collexion<T>::Insert(T *conn)
 	_table[key].conn = conn;
 	_table2[key].hash = hash;
 	_table2[key].prev = 0;
+	_table2[key].grid = 0;
 
 	lock.Release();
 
@@ -554,6 +1107,31 @@ bool Collexion<T>::Insert(T *conn)
 	return true;
 }
 
+template<class T>
+u32 Collexion<T>::Find(T *conn)
+{
+	// If table doesn't exist,
+	if (_used <= 0) return 0;
+
+	// Mask off high bits to make table key from hash
+	const u32 mask = _allocated - 1;
+	u32 key = HashPtr(conn) & mask;
+
+	// While target table entry not found,
+	CAT_FOREVER
+	{
+		// If target was found,
+		if (_table[key].conn == conn)
+			return key + 1;
+
+		if (!(_table[key].next & COLLIDE_MASK))
+			return 0; // End of collision list
+
+		// Walk collision list
+		key = (key * COLLISION_MULTIPLIER + COLLISION_INCREMENTER) & mask;
+	}
+}
+
 template<class T>
 void Collexion<T>::UnlinkActive(u32 key)
 {
@@ -633,6 +1211,17 @@ bool Collexion<T>::Remove(T *conn)
 		T *e_conn = _table[key].conn;
 		if (e_conn == conn)
 		{
+			// Invalidate the published snapshot
+			++_version;
+
+			// Stop matching area-of-interest queries right away
+			u32 grid = _table2[key].grid;
+			if (grid)
+			{
+				_grid.Remove(grid);
+				_table2[key].grid = 0;
+			}
+
 			// If no references,
 			if (_reference_count == 0)
 			{
@@ -642,8 +1231,9 @@ bool Collexion<T>::Remove(T *conn)
 
 				lock.Release();
 
-				// Release Connexion reference at this point
-				conn->ReleaseRef(CAT_REFOBJECT_TRACE);
+				// Release Connexion reference on a later Reclaim(), once snapshot readers are done with it
+				// NOTE: Remove() is often called from inside a snapshot, so do not reclaim here
+				_reclaim.Retire(conn, ReleaseMember);
 			}
 			else
 			{
@@ -685,7 +1275,7 @@ int Collexion<T>::SubsetAcquire(ConnexionSubset &subset, IConnexionCriterion<T>
 	{
 		// If Connexion is in the set,
 		T *conn = _table[key - 1].conn;
-		if (criterion->In(conn))
+		if (!criterion || criterion->In(conn))
 		{
 			// Add it
 			subset.Insert(conn);
@@ -718,7 +1308,7 @@ int Collexion<T>::BinnedSubsetAcquire(BinnedConnexionSubset &subset, IConnexionC
 	{
 		// If Connexion is in the set,
 		T *conn = _table[key - 1].conn;
-		if (criterion->In(conn))
+		if (!criterion || criterion->In(conn))
 		{
 			// Add it
 			subset.Insert(conn);
@@ -739,7 +1329,89 @@ int Collexion<T>::BinnedSubsetAcquire(BinnedConnexionSubset &subset, IConnexionC
 }
 
 template<class T>
-int Collexion<T>::ReleaseInactive(T **defer_release_list)
+bool Collexion<T>::EnableInterestGrid(float cell_size)
+{
+	AutoMutex lock(_lock);
+
+	if (_grid.IsEnabled())
+		return false;
+
+	return _grid.Initialize(cell_size);
+}
+
+template<class T>
+bool Collexion<T>::SetPosition(T *conn, float x, float y)
+{
+	AutoMutex lock(_lock);
+
+	if (!_grid.IsEnabled())
+		return false;
+
+	// If not listed,
+	u32 key = Find(conn);
+	if (!key) return false;
+	--key;
+
+	// If it has been removed but is waiting on subset references,
+	if (_table[key].next & KILL_MASK)
+		return false;
+
+	// If it already has a position,
+	u32 grid = _table2[key].grid;
+	if (grid)
+	{
+		_grid.Move(grid, x, y);
+		return true;
+	}
+
+	grid = _grid.Insert(conn, x, y);
+	if (!grid) return false;
+
+	_table2[key].grid = grid;
+	return true;
+}
+
+template<class T>
+int Collexion<T>::BinnedRadiusAcquire(BinnedConnexionSubset &subset, float x, float y, float radius, IConnexionCriterion<T> *criterion)
+{
+	subset.Clear();
+
+	if (!(radius >= 0.f)) return 0;
+
+	AutoMutex lock(_lock);
+
+	// Visit only the cells overlapping the circle's bounding box
+	int count = _grid.Gather(subset, x - radius, y - radius, x + radius, y + radius, x, y, radius * radius, criterion);
+
+	// If nothing was added,
+	if (count <= 0) return 0;
+
+	// Increment reference count
+	_reference_count++;
+
+	return count;
+}
+
+template<class T>
+int Collexion<T>::BinnedAreaAcquire(BinnedConnexionSubset &subset, float min_x, float min_y, float max_x, float max_y, IConnexionCriterion<T> *criterion)
+{
+	subset.Clear();
+
+	AutoMutex lock(_lock);
+
+	int count = _grid.Gather(subset, min_x, min_y, max_x, max_y, 0.f, 0.f, -1.f, criterion);
+
+	// If nothing was added,
+	if (count <= 0) return 0;
+
+	// Increment reference count
+	_reference_count++;
+
+	return count;
+}
+
+template<class T>
+void Collexion<T>::ReleaseInactive()
 {
 	// For each inactive key,
 	u32 count = 0;
@@ -747,20 +1419,8 @@ int Collexion<T>::ReleaseInactive(T **defer_release_list)
 	{
 		next = _table[--key].next;
 
-		// Release reference
-		T *conn = _table[key].conn;
-
-		// If release count is under max,
-		if (count < MAX_DEFER_RELEASE)
-		{
-			// Defer the release
-			defer_release_list[count] = conn;
-		}
-		else
-		{
-			// Release immediately (unfortunate)
-			conn->ReleaseRef(CAT_REFOBJECT_TRACE);
-		}
+		// Release reference once snapshot readers are done with it
+		_reclaim.Retire(_table[key].conn, ReleaseMember);
 
 		++count;
 
@@ -797,8 +1457,6 @@ int Collexion<T>::ReleaseInactive(T **defer_release_list)
 	// Update inactive list
 	_inactive_head = 0;
 	_used -= count;
-
-	return count < MAX_DEFER_RELEASE ? count : MAX_DEFER_RELEASE;
 }
 
 template<class T>
@@ -809,21 +1467,67 @@ void Collexion<T>::SubsetRelease()
 	// Decrement reference count
 	if (--_reference_count == 0)
 	{
-		// If elements are waiting to release,
+		// If elements are waiting to release, retire them for the next Reclaim()
 		if (_inactive_head)
-		{
-			T *defer_release_list[MAX_DEFER_RELEASE];
-			int defer_release_count = ReleaseInactive(defer_release_list);
+			ReleaseInactive();
+	}
+}
 
-			lock.Release();
+template<class T>
+ConnexionSnapshot *Collexion<T>::PublishSnapshot()
+{
+	AutoMutex lock(_lock);
 
-			// For each deferred release,
-			for (int ii = 0; ii < defer_release_count; ++ii)
-			{
-				defer_release_list[ii]->ReleaseRef(CAT_REFOBJECT_TRACE);
-			}
-		}
+	// If another reader already rebuilt it while we waited on the lock,
+	ConnexionSnapshot *old_snapshot = _snapshot;
+	if (old_snapshot && old_snapshot->GetVersion() == _version)
+		return old_snapshot;
+
+	// Allocate room for every listed element, including inactive ones
+	ConnexionSnapshot *snapshot = ConnexionSnapshot::Acquire(_version, _used, WorkerThreads::ref()->GetWorkerCount());
+	if (!snapshot)
+	{
+		CAT_WARN("Collexion") << "Out of memory building snapshot";
+		return old_snapshot; // Stale but still safe to read
 	}
+
+	// Bin active members by worker so broadcasts can hand each worker one block
+	for (u32 key = _active_head; key; key = _table[key - 1].next & NEXT_MASK)
+		snapshot->CountMember(_table[key - 1].conn);
+
+	snapshot->FinishCount();
+
+	for (u32 key = _active_head; key; key = _table[key - 1].next & NEXT_MASK)
+		snapshot->PlaceMember(_table[key - 1].conn);
+
+	snapshot->FinishPlace();
+
+	// Make sure the contents are visible before the pointer is
+	Atomic::StoreMemoryBarrier();
+
+	_snapshot = snapshot;
+
+	lock.Release();
+
+	// NOTE: The caller is inside a read section, so the old snapshot waits for the next Reclaim()
+	if (old_snapshot)
+		_reclaim.Retire(old_snapshot, ConnexionSnapshot::Release);
+
+	return snapshot;
+}
+
+template<class T>
+ConnexionSnapshot *Collexion<T>::SnapshotAcquire(u32 &ticket)
+{
+	ticket = _reclaim.EnterRead();
+
+	// If the published snapshot is current, use it without locking
+	ConnexionSnapshot *snapshot = _snapshot;
+	if (snapshot && snapshot->GetVersion() == _version)
+		return snapshot;
+
+	// Copy on write: First reader after a membership change builds the next version
+	return PublishSnapshot();
 }
 
 
@@ -91,7 +91,7 @@ static const int SESSION_KEY_BYTES = 32;
 static const int HANDSHAKE_TICK_RATE = 100; // milliseconds
 static const int INITIAL_HELLO_POST_INTERVAL = 200; // milliseconds
 static const int CONNECT_TIMEOUT = 6000; // milliseconds
-static const u32 MTU_PROBE_INTERVAL = 8000; // seconds
+static const u32 MTU_PROBE_INTERVAL = 8000; // milliseconds
 static const int CLIENT_THREAD_KILL_TIMEOUT = 10000; // seconds
 static const int SILENCE_LIMIT = 4357; // Time silent before sending a keep-alive (0-length unordered reliable message), milliseconds
 
@@ -203,10 +203,14 @@ static const u32 IOP_S2C_TIME_PONG_LEN = 1 + 4 + 4 + 4;
 static const u32 IOP_HUGE_MINLEN = 1 + 1;
 static const u32 IOP_DISCO_LEN = 1 + 1;
 
-// MTU discovery guesses
+// Set in the IOP_C2S_MTU_PROBE opcode byte when the client has fallen back
+// to this size after a black hole, so the server lowers its size to match
+static const u8 IOP_C2S_MTU_PROBE_RESET = 4;
+
+// MTU discovery bounds
 static const u32 MINIMUM_MTU = 576; // Dial-up
-static const u32 MEDIUM_MTU = 1400; // Highspeed with unexpected overhead, maybe VPN
 static const u32 MAXIMUM_MTU = 1500; // Highspeed
+static const u32 MAXIMUM_JUMBO_MTU = 9000; // Jumbo Ethernet frames; the search is also capped by IOTHREADS_BUFFER_READ_BYTES
 
 
 //// sphynx::Transport
@@ -269,20 +273,36 @@ struct RecvQueue
 	// Message contents follow
 };
 
+// Send state: Immutable message data shared by the OutgoingMessage nodes of a broadcast
+struct SharedPayload
+{
+	volatile u32 references;	// Number of OutgoingMessage nodes still pointing at this payload
+	u32 bytes;					// Message bytes, including the opcode byte
+	u32 compressed_bytes;		// LZ4-compressed message bytes for fragmented sends, or 0 if not smaller
+
+	// Message data follows, then compressed message data
+};
+
 // Send state: Send queue
 struct OutgoingMessage : ResizableBuffer<OutgoingMessage>
 {
 	OutgoingMessage *next;	// Next in queue
+	SharedPayload *shared;	// Message data if it is shared, or 0 if it follows this object
 
 	union
 	{
 		// In send queue:
 		struct
 		{
-			u32 frag_count;		// Number of fragments remaining to be delivered
+			union
+			{
+				u32 frag_count;	// Number of fragments remaining to be delivered
+				u32 ts_expire;	// Unreliable queue: Millisecond timestamp after which it is dropped
+			};
 			u32 send_bytes;		// Number of bytes to send this time, calculated in DequeueBandwidth()
 			u16 sent_bytes;		// Number of bytes sent so far in a small fragmented message
 			u16 orig_bytes;		// Number of bytes in decompressed message (only for fragmented messages)
+			u32 ts_queued;		// Millisecond-resolution timestamp when it was queued
 		};
 
 		// In sent list:
@@ -44,12 +44,15 @@ class CAT_EXPORT Connexion : public Transport, public RefObject
 {
 	friend class Server;
 	friend class ConnexionMap;
+	friend class ConnexionMapBench; // tests/ConnexionMapBench populates a map directly
+	friend class CollexionTest; // tests/CollexionTest assigns workers without a Server
+	friend class InterestGridBench; // tests/InterestGridBench assigns workers without a Server
 
 	Server *_parent; // Server object that owns this one
 
 	NetAddr _client_addr;
-	u16 _flood_key; // Flood key based on IP address, not necessarily unique
-	u16 _my_id; // Unique connexion id number
+	u32 _flood_key; // Flood key based on IP address, not necessarily unique
+	u32 _my_id; // Unique connexion id number
 	u32 _worker_id; // Worker thread index
 
 #if !defined(CAT_SPHYNX_ROAMING_IP)
@@ -80,8 +83,8 @@ public:
 	CAT_INLINE const char *GetRefObjectName() { return "Connexion"; }
 
 	CAT_INLINE const NetAddr &GetAddress() { return _client_addr; }
-	CAT_INLINE u16 GetMyID() { return _my_id; }
-	CAT_INLINE u16 GetFloodKey() { return _flood_key; }
+	CAT_INLINE u32 GetMyID() { return _my_id; }
+	CAT_INLINE u32 GetFloodKey() { return _flood_key; }
 	CAT_INLINE u32 GetWorkerID() { return _worker_id; }
 
 	// Current local time
@@ -31,7 +31,8 @@
 
 #include <cat/net/Sockets.hpp>
 #include <cat/sphynx/Connexion.hpp>
-#include <cat/threads/RWLock.hpp>
+#include <cat/threads/EpochReclaim.hpp>
+#include <cat/crypt/rand/Fortuna.hpp>
 
 /*
 	Roaming IP
@@ -56,41 +57,71 @@ namespace cat {
 namespace sphynx {
 
 
+/*
+	Lock-free lookups
+
+		Datagram routing looks up a connexion for every source address
+	change in a batch, so the read side takes no lock.  Both tables are
+	published through a pointer and replaced wholesale when they grow or
+	fill with tombstones.  Removed connexions and replaced tables are
+	handed to an EpochReclaim object, and the map's reference is only
+	released once no reader can still be holding the old pointer.
+	Insert(), Remove() and ShutdownAll() are serialized by a mutex.
+*/
+
 // Maps remote address to connected clients
 class CAT_EXPORT ConnexionMap
 {
 public:
-	static const u16 INVALID_KEY = ~(u16)0;
-	static const int HASH_TABLE_SIZE = 32768; // Power-of-2
-	static const int HASH_TABLE_MASK = HASH_TABLE_SIZE - 1;
-	static const int MAX_POPULATION = HASH_TABLE_SIZE / 2;
+	static const u32 INVALID_KEY = ~(u32)0;
+#if defined(CAT_SPHYNX_ROAMING_IP)
+	static const u32 MAX_POPULATION = 65535; // Connexion ids are 16 bits on the wire, and ~0 is invalid
+#else
+	static const u32 MAX_POPULATION = 262144;
+#endif
+	static const int FLOOD_TABLE_SIZE = 262144; // Power-of-2, large enough that unrelated addresses rarely share a counter
+	static const int FLOOD_TABLE_MASK = FLOOD_TABLE_SIZE - 1;
 	static const int CONNECTION_FLOOD_THRESHOLD = 10;
 
 private:
+	static const u32 MAP_PREALLOC = 64; // Power-of-2
+
 	volatile bool _is_shutdown;
 
-#if defined(CAT_SPHYNX_ROAMING_IP)
-	static const int MAP_PREALLOC = 64;
-	u32 _flood_salt, _first_free;
+	// Connexion pointer table published to readers
+	struct Table
+	{
+		u32 mask;	// Slot count - 1
+		u32 used;	// Slots holding a connexion or a tombstone
 
-	Connexion **_conn_table;
-	u16 *_free_table;
-	u32 _map_alloc;
+		CAT_INLINE Connexion * volatile *GetSlots() { return reinterpret_cast<Connexion * volatile *>( GetTrailingBytes(this) ); }
+	};
 
-#else // IP-based version:
-	u32 _flood_salt, _ip_salt, _port_salt;
+	static Table *AcquireTable(u32 size);
+	static void ReleaseTable(void *table);
+	static void ReleaseConnexion(void *conn);
 
-	struct Slot
-	{
-		Connexion *conn;
-		u8 collision;
-	};
+	EpochReclaim _reclaim;
+	Mutex _write_lock;
+
+	// Connexion by id
+	Table * volatile _id_table;
+	u32 *_free_ids;		// Free list links, only touched by writers
+	u32 _first_free;
 
-	Slot _map_table[HASH_TABLE_SIZE];
+	bool AllocateID(u32 &id);
+
+#if !defined(CAT_SPHYNX_ROAMING_IP)
+	u32 _ip_salt, _port_salt;
+
+	// Connexion by address, open addressing with tombstones
+	Table * volatile _addr_table;
+
+	void RebuildAddressTable(u32 size);
 #endif // CAT_SPHYNX_ROAMING_IP
 
-	RWLock _table_lock;
-	u8 _flood_table[HASH_TABLE_SIZE];
+	u32 _flood_salt;
+	u16 _flood_table[FLOOD_TABLE_SIZE];
 
 	volatile u32 _count;
 
@@ -125,6 +156,10 @@ public:
 
 	// Invoke ->RequestShutdown() on all Connexion objects
 	void ShutdownAll();
+
+	// Release removed connexions and replaced tables once no reader can see them.
+	// Insert() and Remove() only do this as they go, so call it from a timer too
+	CAT_INLINE void Reclaim() { _reclaim.Reclaim(); }
 };
 
 
@@ -30,7 +30,7 @@
 #define CAT_SPHYNX_FILE_TRANSFER_HPP
 
 #include <cat/sphynx/Transport.hpp>
-#include <cat/fec/Wirehair.hpp>
+#include <cat/sphynx/TransferPipeline.hpp>
 #include <vector>
 #include <queue> // priority_queue<>
 
@@ -99,7 +99,7 @@ enum TransferOpCodes
 	TOP_STREAM_DONE,	// HDR | StreamID(1)
 
 	// Adjust transmit rate on all streams
-	// RateCounter: Speed of transfer
+	// RateCounter: Bytes per second the transmitter may send, set by TransferSink
 	TOP_RATE,			// HDR | RateCounter(4)
 
 	// Close transfer and indicate reason (including success)
@@ -134,25 +134,6 @@ enum TransferOpCodes
 	Encode streams are added whenever there is no more data requested but more data to send in the file.
 */
 
-enum TransferAbortReasons
-{
-	TXERR_NO_PROBLEMO,		// OK
-
-	TXERR_BUSY,				// Source is not idle and cannot service another request
-	TXERR_REJECTED,			// Source rejected the request based on file name
-	TXERR_INVALID_INPUT,	// Operation input was invalid
-	TXERR_BAD_STATE,		// Operation requested in bad state
-	TXERR_FILE_OPEN_FAIL,	// Source unable to open the requested file
-	TXERR_FILE_READ_FAIL,	// Source unable to read part of the requested file
-	TXERR_FILE_WRITE_FAIL,	// Receiver unable to write part of the transmitted file
-	TXERR_FEC_FAIL,			// Forward error correction codec reported an error
-	TXERR_OUT_OF_MEMORY,	// Source ran out of memory
-	TXERR_USER_ABORT,		// Closed by user
-	TXERR_SHUTDOWN,			// Remote host is shutting down
-	TXERR_INTERNAL,			// Some kind of internal error occurred
-};
-
-
 // Get string from reason code
 const char *GetTransferAbortReasonString(int reason);
 
@@ -169,14 +150,6 @@ enum TransferStatusFlags
 	TXFLAG_IDLE,		// Not being used
 };
 
-static const u32 FT_STREAM_ID_SHIFT = 2;
-static const u32 FT_STREAM_ID_MASK = 31;
-static const u32 FT_COMPRESS_ID_MASK = 0x80;
-static const u32 FT_MAX_HEADER_BYTES = 1 + 1 + 3;
-
-#define CAT_FT_MSS_TO_BLOCK_BYTES(mss) ( (mss) - FT_MAX_HEADER_BYTES )
-
-
 /*
 	FECHugeEndpoint
 */
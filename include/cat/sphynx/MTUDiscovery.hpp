@@ -0,0 +1,142 @@
+/*
+	Copyright (c) 2012 Christopher A. Taylor.  All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	* Redistributions of source code must retain the above copyright notice,
+	  this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	* Neither the name of LibCat nor the names of its contributors may be used
+	  to endorse or promote products derived from this software without
+	  specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef CAT_SPHYNX_MTU_DISCOVERY_HPP
+#define CAT_SPHYNX_MTU_DISCOVERY_HPP
+
+#include <cat/sphynx/Common.hpp>
+
+/*
+	Packetization layer path MTU discovery
+
+		ICMP "fragmentation needed" messages are filtered on a lot of paths,
+	so instead of trusting them the client sends padded probe datagrams with
+	the DF bit set and the server reports each probe that arrives.  A probe
+	that is not reported within PROBE_TIMEOUT is sent again, and a size that
+	is lost PROBE_TRIES times in a row is judged too large.
+
+		Sizes are UDP payload bytes (the whole encrypted datagram), so the
+	result does not depend on guessing the IP header size.  The search
+	starts at a base size that always works and bisects the range up to a
+	ceiling, trying the ceiling first because most paths carry it.  It stops
+	once the range is narrower than SEARCH_RESOLUTION bytes.
+
+		After the search, the current size is confirmed every
+	MTU_PROBE_INTERVAL.  If CONFIRM_TRIES confirmations in a row are lost,
+	the path has turned into a black hole for that size (a route change
+	onto a tunnel, usually), so the size falls back to the base.  A base
+	size probe is repeated until it is reported, so that the peer hears
+	about the fallback, and then the search runs again below the failed
+	size.  Every RAISE_INTERVAL the
+	search is also retried above the current size in case the path got
+	better.
+
+	This class only decides what to probe and when; the owner posts the
+	probes and feeds back the reports.  It is not thread-safe.
+*/
+
+namespace cat {
+
+
+namespace sphynx {
+
+
+//// MTUDiscovery
+
+class CAT_EXPORT MTUDiscovery
+{
+public:
+	static const u32 PROBE_TIMEOUT = 1000; // milliseconds
+	static const u32 PROBE_TRIES = 2;
+	static const u32 CONFIRM_TRIES = 3;
+	static const u32 SEARCH_RESOLUTION = 16; // bytes
+	static const u32 RAISE_INTERVAL = 10 * 60 * 1000; // milliseconds
+
+	enum State
+	{
+		STATE_DISABLED,		// Not probing; size stays at the base
+		STATE_RESET,		// Reporting a fall back to the base size
+		STATE_SEARCH,		// Bisecting between the confirmed size and the ceiling
+		STATE_COMPLETE,		// Waiting to confirm or raise the current size
+		STATE_CONFIRM		// Probing the current size to detect black holes
+	};
+
+private:
+	State _state;
+	u32 _base, _ceiling;
+
+	u32 _low;	// Largest size known to get through
+	u32 _high;	// Largest size that might get through
+
+	u32 _probe_bytes;	// Size in flight, or 0
+	u32 _probe_time;	// Time the last probe was posted
+	u32 _probe_tries;	// Posts of the size in flight
+	u32 _next_time;		// Time of the next confirmation
+	u32 _search_time;	// Time the last search finished
+
+	bool _try_ceiling;	// Next search probe is the ceiling
+	u32 _black_hole_count;
+
+	u32 NextSearchProbe();
+	void StartSearch(u32 high);
+	void FinishSearch(u32 now);
+	void OnProbeLost(bool &black_hole);
+
+public:
+	MTUDiscovery();
+
+	// Start searching from a base size that is assumed to get through, up to the ceiling
+	void Initialize(u32 now, u32 base_bytes, u32 ceiling_bytes);
+
+	// Stop probing and fall back to the base size
+	void Disable();
+
+	// Returns the size of a probe to post now, or 0 if none is due.
+	// Sets black_hole if the current size was just found to be lost;
+	// GetPMTU() has already dropped to the base when it returns
+	u32 Tick(u32 now, bool &black_hole);
+
+	// A probe of this size was reported by the peer.
+	// Returns true if GetPMTU() increased
+	bool OnProbeReport(u32 now, u32 bytes);
+
+	// A search probe could not be posted (too large for the local interface,
+	// for instance); treat it as lost without waiting
+	void OnProbeFailure(u32 now);
+
+	CAT_INLINE State GetState() { return _state; }
+	CAT_INLINE u32 GetPMTU() { return _low; }
+	CAT_INLINE u32 GetBlackHoleCount() { return _black_hole_count; }
+};
+
+
+} // namespace sphynx
+
+} // namespace cat
+
+#endif // CAT_SPHYNX_MTU_DISCOVERY_HPP
@@ -0,0 +1,190 @@
+/*
+	Copyright (c) 2012 Christopher A. Taylor.  All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	* Redistributions of source code must retain the above copyright notice,
+	  this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	* Neither the name of LibCat nor the names of its contributors may be used
+	  to endorse or promote products derived from this software without
+	  specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef CAT_SPHYNX_REPLICATION_HPP
+#define CAT_SPHYNX_REPLICATION_HPP
+
+#include <cat/sphynx/Transport.hpp>
+
+/*
+	Delta-compressed state replication
+
+		Games tend to send the whole state of the world to every client on
+	every tick, and most of it has not changed since the last tick.  The
+	StateReplicator on the server remembers the last HISTORY states it sent
+	to one client, and encodes each new state as the XOR difference from the
+	newest state that the client has acknowledged.  Unchanged bytes XOR to
+	zero runs, which the encoding skips over.
+
+		Updates are sent unreliably, so a lost update is simply replaced by
+	the next one.  The client acknowledges each update it decodes with a
+	small unreliable message, and the server moves its baseline forward when
+	it hears the ack.  If no baseline is acknowledged yet, or the newest one
+	has fallen out of the history, the update is encoded against zeros and
+	carries the full state.  Sphynx reliable ACK-IDs only cover reliable
+	streams, so the acks are part of this protocol rather than borrowed from
+	the transport.
+
+	Update message format:
+
+		Sequence(2) | BaselineAge(1) | StateBytes(varint) | Runs(X)
+
+	Sequence: Increments by one for each update, little-endian
+	BaselineAge: Sequence - baseline sequence, or 0 for a full state
+	StateBytes: Size of the state after decoding
+	Runs: Repeated ZeroCount(varint) | LiteralCount(varint) | Literals(LiteralCount)
+		until StateBytes bytes are covered.  Zero bytes copy the baseline,
+		literal bytes are XORed with the baseline.  The baseline is treated
+		as zero-padded if it is shorter than the new state.
+
+	Ack message format:
+
+		Sequence(2)
+
+	Neither class is thread-safe.  Use one pair per replicated object per
+	client, and call them from the Connexion's worker thread.
+*/
+
+namespace cat {
+
+
+namespace sphynx {
+
+
+//// StateReplicator
+
+class CAT_EXPORT StateReplicator
+{
+public:
+	static const u32 HISTORY = 32; // Power-of-2, less than 256
+	static const u32 HEADER_BYTES = 2 + 1 + 5;
+	static const u32 MAX_STATE_BYTES = 0x1000000;
+
+	// Zero runs shorter than this are folded into the surrounding literal
+	static const u32 MIN_ZERO_RUN = 4;
+
+	// Worst-case encoded size for a state of the given size.
+	// Every run after the first starts with MIN_ZERO_RUN zeros, so the
+	// two varint lengths per run can at most add half the state size
+	static CAT_INLINE u32 MaxEncodedBytes(u32 state_bytes)
+	{
+		return HEADER_BYTES + state_bytes + state_bytes / 2 + 10;
+	}
+
+private:
+	struct Baseline
+	{
+		u8 *data;
+		u32 bytes, allocated;
+		u16 seq;
+		bool valid;
+	};
+
+	Baseline _history[HISTORY];
+	u16 _next_seq;
+	u16 _acked_seq;
+	bool _has_ack;
+
+	u8 *_workspace;
+	u32 _workspace_bytes;
+
+	// Statistics
+	u32 _full_count, _delta_count;
+	u64 _state_bytes, _encoded_bytes;
+
+	Baseline *GetAckedBaseline();
+
+public:
+	StateReplicator();
+	~StateReplicator();
+
+	// Encode the next update into out, returns the number of bytes written or 0 on failure
+	u32 Encode(const void *state, u32 state_bytes, u8 *out, u32 out_limit);
+
+	// Encode the next update and send it unreliably.  If it is too large for a
+	// datagram, it goes out reliably on the fallback stream instead
+	bool Write(Transport *transport, u8 msg_opcode, const void *state, u32 state_bytes, StreamMode fallback_stream = STREAM_BULK);
+
+	// Process an ack message from the remote StateReceiver
+	bool OnAck(const u8 *msg, u32 bytes);
+
+	// Forget the acknowledged baseline so the next update carries the full state
+	void Reset();
+
+	CAT_INLINE u32 GetFullCount() { return _full_count; }
+	CAT_INLINE u32 GetDeltaCount() { return _delta_count; }
+	CAT_INLINE u64 GetStateBytes() { return _state_bytes; }
+	CAT_INLINE u64 GetEncodedBytes() { return _encoded_bytes; }
+};
+
+
+//// StateReceiver
+
+class CAT_EXPORT StateReceiver
+{
+public:
+	static const u32 HISTORY = StateReplicator::HISTORY;
+	static const u32 ACK_BYTES = 2;
+
+private:
+	struct Baseline
+	{
+		u8 *data;
+		u32 bytes, allocated;
+		u16 seq;
+		bool valid;
+	};
+
+	Baseline _history[HISTORY];
+	Baseline *_latest;
+
+public:
+	StateReceiver();
+	~StateReceiver();
+
+	// Decode an update message.  Returns false if it is corrupt, older than
+	// the latest state, or refers to a baseline that is no longer available
+	bool OnUpdate(const u8 *msg, u32 bytes);
+
+	// Latest decoded state, or 0 if none yet
+	CAT_INLINE const u8 *GetState() { return _latest ? _latest->data : 0; }
+	CAT_INLINE u32 GetStateBytes() { return _latest ? _latest->bytes : 0; }
+
+	// Write the ack for the latest decoded state into out[ACK_BYTES]
+	bool GetAck(u8 *out);
+
+	// Send the ack for the latest decoded state unreliably
+	bool WriteAck(Transport *transport, u8 msg_opcode);
+};
+
+
+} // namespace sphynx
+
+
+} // namespace cat
+
+#endif // CAT_SPHYNX_REPLICATION_HPP
@@ -56,9 +56,16 @@ class CAT_EXPORT Server : public UDPEndpoint
 	TunnelPublicKey _public_key;
 	u32 _connect_worker;
 
-	bool PostConnectionCookie(const NetAddr &dest);
+	// Handshake packets whose cookies are computed together in OnRecv()
+	static const int COOKIE_BATCH = 64;
+
+	bool PostConnectionCookie(const NetAddr &dest, u32 cookie);
 	bool PostConnectionError(const NetAddr &dest, SphynxError err);
 
+	void OnHelloBatch(RecvBuffer **buffers, QueuedCookie *cookies, int count);
+	void OnChallengeBatch(ThreadLocalStorage &tls, RecvBuffer **buffers, QueuedCookie *cookies, int count);
+	void OnChallenge(ThreadLocalStorage &tls, RecvBuffer *buffer);
+
 public:
 	Server();
 	virtual ~Server();
@@ -85,7 +92,7 @@ protected:
 
 	virtual void OnRecvRouting(const BatchSet &buffers);
 	virtual void OnRecv(ThreadLocalStorage &tls, const BatchSet &buffers);
-	virtual void OnTick(ThreadLocalStorage &tls, u32 now);
+	virtual void OnTick(ThreadLocalStorage &tls, u32 now); // Overrides must call Server::OnTick()
 };
 
 
@@ -0,0 +1,514 @@
+/*
+	Copyright (c) 2012 Christopher A. Taylor.  All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	* Redistributions of source code must retain the above copyright notice,
+	  this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	* Neither the name of LibCat nor the names of its contributors may be used
+	  to endorse or promote products derived from this software without
+	  specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef CAT_SPHYNX_TRANSFER_PIPELINE_HPP
+#define CAT_SPHYNX_TRANSFER_PIPELINE_HPP
+
+#include <cat/threads/Mutex.hpp>
+#include <cat/lang/Delegates.hpp>
+#include <cat/fec/Wirehair.hpp>
+#include <vector>
+
+/*
+	Pipelined bulk transfer engine
+
+		A file is cut into chunks, and each chunk goes through four stages:
+	it is read from disk, compressed with LZ4, prepared for Wirehair FEC and
+	then sent as a stream of blocks until the receiver reports that it has
+	decoded the chunk.  Doing these one chunk at a time leaves the link idle
+	while the disk and the CPU work, and the other way around.
+
+		TransferSource keeps a window of up to FT_MAX_STREAMS chunks in
+	flight, one per stream id.  Worker threads call DoWork() to run the
+	read, compress and encode stages of whichever chunks are waiting on
+	them, oldest chunk first, so chunks further back in the window are
+	being read and encoded while earlier ones are on the wire.  The send
+	stage is NextBlock(), called by the thread that owns the socket.
+
+		Several files can be queued at once.  New chunks are taken from the
+	queued files in turn, so a small file is not stuck behind a large one.
+	Each file is identified by a caller-chosen file id in the stream start
+	message and ends with an OnFileDone callback.
+
+		TransferSink is the receiving end.  It feeds blocks to a Wirehair
+	decoder per stream, and when a chunk decodes its workers decompress it
+	and hand it to the writer.  The stream is reported done only after the
+	write, so the sender window also bounds the memory held by the sink.
+	The sink requests blocks on each stream as it needs them, and asks for
+	more if a stream goes quiet before it decodes.  Each chunk carries a
+	hash of its contents.  If a decoded chunk does not match, or the
+	decoder takes far more blocks than it should without finishing, the
+	sink starts the stream's decoder over and asks for fresh blocks, up to
+	MAX_CHUNK_RETRIES times.
+
+		Transfers can be resumed.  The sink tracks, per file hash, how many
+	bytes from the start of the file have been written, and AddFile()
+	returns that offset so the sender can start from there on the next
+	attempt.  Chunks that finish out of order are remembered until the gap
+	before them is filled.  SetResumeOffset() restores progress that the
+	application saved from GetResumeOffset() in an earlier session.
+
+		The sink also sets the pace.  Block ids on a stream count up, so
+	the gaps show which blocks were lost.  Every rate interval the sink
+	works out the loss and how fast bytes arrived.  The lowest loss seen
+	over the last few intervals is taken to be random loss on the path,
+	and anything above it to be the source sending faster than the link
+	can carry.  While that excess stays under LOSS_LOW the rate grows,
+	doubling at first and then by a sixteenth at a time, and when the
+	excess passes LOSS_HIGH the rate falls back to what the link actually
+	delivered.  The new rate goes out through OnRate for TOP_RATE, and
+	TransferSource::OnRate() paces NextBlock() with a token bucket.
+	Requests are sized for the loss measured on each stream, so a chunk
+	normally decodes from its first request without another round trip.
+
+		Block messages use the IOP_HUGE layout described in FileTransfer.hpp,
+	without the transport header byte.  The IOP bits of the first byte are
+	left zero for the caller to fill in, and are ignored on receipt.
+	Control messages are raised through delegates so that FECHugeEndpoint
+	can carry them as TOP_STREAM_START, TOP_STREAM_REQUEST and
+	TOP_STREAM_DONE.  The file id travels with each stream start.
+*/
+
+namespace cat {
+
+
+namespace sphynx {
+
+
+enum TransferAbortReasons
+{
+	TXERR_NO_PROBLEMO,		// OK
+
+	TXERR_BUSY,				// Source is not idle and cannot service another request
+	TXERR_REJECTED,			// Source rejected the request based on file name
+	TXERR_INVALID_INPUT,	// Operation input was invalid
+	TXERR_BAD_STATE,		// Operation requested in bad state
+	TXERR_FILE_OPEN_FAIL,	// Source unable to open the requested file
+	TXERR_FILE_READ_FAIL,	// Source unable to read part of the requested file
+	TXERR_FILE_WRITE_FAIL,	// Receiver unable to write part of the transmitted file
+	TXERR_FEC_FAIL,			// Forward error correction codec reported an error
+	TXERR_OUT_OF_MEMORY,	// Source ran out of memory
+	TXERR_USER_ABORT,		// Closed by user
+	TXERR_SHUTDOWN,			// Remote host is shutting down
+	TXERR_INTERNAL,			// Some kind of internal error occurred
+};
+
+static const u32 FT_STREAM_ID_SHIFT = 2;
+static const u32 FT_STREAM_ID_MASK = 31;
+static const u32 FT_COMPRESS_ID_MASK = 0x80;
+static const u32 FT_MAX_HEADER_BYTES = 1 + 1 + 3;
+static const u32 FT_MAX_STREAMS = FT_STREAM_ID_MASK + 1;
+
+// Block message header: IOP_HUGE|STREAM(1) + ID(3)
+static const u32 FT_BLOCK_HEADER_BYTES = FT_MAX_HEADER_BYTES - 1;
+
+#define CAT_FT_MSS_TO_BLOCK_BYTES(mss) ( (mss) - FT_MAX_HEADER_BYTES )
+
+
+// Description of one chunk, carried by TOP_STREAM_START
+struct TransferStreamInfo
+{
+	u32 stream_id;		// 0..FT_STREAM_ID_MASK
+	u32 file_id;		// Caller-chosen file id
+	u64 file_offset;	// Offset of the chunk in the file
+	u32 chunk_bytes;	// Bytes after decompression
+	u32 compress_bytes;	// Bytes protected by FEC; equal to chunk_bytes if stored uncompressed
+	u32 block_bytes;	// Bytes of FEC data per block message
+	u32 chunk_hash;		// MurmurHash of the chunk after decompression
+};
+
+
+// Reads file data for TransferSource.  Called from worker threads
+class CAT_EXPORT ITransferReader
+{
+public:
+	CAT_INLINE virtual ~ITransferReader() {}
+
+	// Return false on failure
+	virtual bool ReadChunk(u32 file_id, u64 offset, u8 *buffer, u32 bytes) = 0;
+};
+
+// Writes file data for TransferSink.  Called from worker threads
+class CAT_EXPORT ITransferWriter
+{
+public:
+	CAT_INLINE virtual ~ITransferWriter() {}
+
+	// Return false on failure
+	virtual bool WriteChunk(u32 file_id, u64 offset, const u8 *data, u32 bytes) = 0;
+};
+
+
+//// TransferSource
+
+class CAT_EXPORT TransferSource
+{
+public:
+	// Post TOP_STREAM_START for a chunk that is ready to send
+	typedef Delegate1<void, const TransferStreamInfo &> OnStreamStart;
+
+	// File has been sent completely, or failed with the given TXERR_ reason
+	typedef Delegate2<void, u32 /*file id*/, int /*reason*/> OnFileDone;
+
+protected:
+	enum SlotStates
+	{
+		SLOT_FREE,		// Not in use
+		SLOT_READ,		// Waiting for a worker to read the chunk
+		SLOT_COMPRESS,	// Waiting for a worker to compress the chunk
+		SLOT_ENCODE,	// Waiting for a worker to initialize the encoder
+		SLOT_SEND,		// Sending blocks on request
+	};
+
+	struct Slot
+	{
+		u32 state;					// SLOT_ state
+		bool busy;					// A worker is running the current stage
+		u32 seq;					// Chunk sequence number, for oldest-first scheduling
+		u32 file_id;
+		u64 file_offset;
+		u32 chunk_bytes;
+		u32 chunk_hash;
+		u32 compress_bytes;			// Bytes covered by FEC
+		u32 block_count;			// Number of original blocks
+		u8 *read_buffer;			// Raw chunk data
+		u8 *compress_buffer;		// Compressed chunk data
+		const u8 *message;			// Points at whichever buffer is sent
+		wirehair::Encoder encoder;	// Unused if block_count == 1
+		u32 next_id;				// Next block id to send
+		u32 requested;				// Blocks requested and not sent yet
+	};
+
+	struct File
+	{
+		u32 file_id;
+		u64 file_bytes;
+		u64 next_offset;	// Offset of the next chunk to read
+		u32 in_flight;		// Chunks of this file in the window
+		int reason;			// TXERR_ code if the file failed
+	};
+
+	Mutex _lock;
+
+	ITransferReader *_reader;
+	OnStreamStart _on_stream_start;
+	OnFileDone _on_file_done;
+
+	u32 _block_bytes, _chunk_bytes, _window;
+	Slot _slots[FT_MAX_STREAMS];
+	std::vector<File> _files;
+	u32 _next_file;			// Round-robin index into _files
+	u32 _next_seq;			// Sequence number for the next chunk
+	u32 _send_slot;			// Round-robin index for NextBlock()
+
+	// Pacing, see OnRate()
+	u32 _rate;				// Bytes per second, or 0 for no limit
+	s32 _tokens;			// Bytes that may be sent right now
+	u32 _last_refill;		// Time the tokens were last topped up
+
+	// Statistics
+	u64 _sent_blocks;
+	u64 _read_bytes;
+	u64 _compress_bytes;
+
+	File *FindFile(u32 file_id);
+
+	// Assign queued file data to free slots.  Lock must be held
+	void FillWindow();
+
+	// Fail the chunk's file and free the slot.  Lock must be held
+	void FailSlot(Slot *slot, int reason);
+
+	// Remove finished files and return one of them.  Lock must be held
+	bool PopDoneFile(u32 &file_id, int &reason);
+
+	void ReportDoneFiles();
+	void FreeBuffers();
+
+public:
+	TransferSource();
+	~TransferSource();
+
+	// block_bytes: FEC data per block message, see CAT_FT_MSS_TO_BLOCK_BYTES()
+	// chunk_bytes: Size of the chunks files are cut into
+	// window: Chunks in flight, at most FT_MAX_STREAMS
+	bool Initialize(ITransferReader *reader, u32 block_bytes, u32 chunk_bytes, u32 window);
+
+	CAT_INLINE void SetCallbacks(const OnStreamStart &on_stream_start, const OnFileDone &on_file_done)
+	{
+		_on_stream_start = on_stream_start;
+		_on_file_done = on_file_done;
+	}
+
+	// Queue a file to send, starting at start_offset (from TransferSink::AddFile())
+	bool AddFile(u32 file_id, u64 file_bytes, u64 start_offset = 0);
+
+	// Run one read, compress or encode job.  Called from worker threads.
+	// Returns false if there was nothing to do
+	bool DoWork();
+
+	// Returns true if NextBlock() has a block to send
+	bool HasData();
+
+	// Write the next requested block message into packet, which must have
+	// room for GetMaxPacketBytes().  Returns the message length, or 0 if
+	// nothing is requested or the send rate has been used up for now
+	u32 NextBlock(u32 now, u8 *packet);
+
+	CAT_INLINE u32 GetMaxPacketBytes() { return FT_BLOCK_HEADER_BYTES + _block_bytes; }
+
+	// On TOP_STREAM_REQUEST
+	void OnStreamRequest(u32 stream_id, u32 count);
+
+	// On TOP_STREAM_DONE
+	void OnStreamDone(u32 stream_id);
+
+	// On TOP_RATE.  Limits NextBlock() to this many bytes per second.
+	// Sending is not paced until the first rate arrives
+	void OnRate(u32 rate_counter);
+
+	CAT_INLINE u32 GetRate() { return _rate; }
+
+	// Returns true if no files are queued
+	bool IsIdle();
+
+	CAT_INLINE u64 GetSentBlocks() { return _sent_blocks; }
+	CAT_INLINE u64 GetReadBytes() { return _read_bytes; }
+	CAT_INLINE u64 GetCompressedBytes() { return _compress_bytes; }
+};
+
+
+//// TransferSink
+
+class CAT_EXPORT TransferSink
+{
+public:
+	// Post TOP_STREAM_REQUEST
+	typedef Delegate2<void, u32 /*stream id*/, u32 /*count*/> OnStreamRequest;
+
+	// Post TOP_STREAM_DONE
+	typedef Delegate1<void, u32 /*stream id*/> OnStreamDone;
+
+	// File has been written completely, or failed with the given TXERR_ reason
+	typedef Delegate2<void, u32 /*file id*/, int /*reason*/> OnFileDone;
+
+	// Post TOP_RATE
+	typedef Delegate1<void, u32 /*bytes per second*/> OnRate;
+
+	// Milliseconds without a block before a stream asks for more
+	static const u32 REQUEST_TIMEOUT = 100;
+
+	// Milliseconds between rate updates
+	static const u32 RATE_INTERVAL = 100;
+
+	// Send rate before the first measurement, and the lowest rate, in bytes per second
+	static const u32 INITIAL_RATE = 1000000;
+	static const u32 MIN_RATE = 16384;
+
+	// Loss above the random loss of the path, per 65536 blocks.  Below
+	// LOSS_LOW the rate grows, and above LOSS_HIGH it is cut
+	static const u32 LOSS_LOW = 1024;
+	static const u32 LOSS_HIGH = 4096;
+
+	// Highest loss that requests make up for, per 65536 blocks
+	static const u32 MAX_LOSS = 32768;
+
+	// Random loss is the lowest loss seen over this many intervals
+	static const u32 LOSS_HISTORY = 8;
+
+	// Fewest blocks in an interval for its loss to count
+	static const u32 MIN_LOSS_SAMPLES = 32;
+
+	// Extra blocks requested beyond the expected need, per 256 blocks
+	static const u32 REQUEST_OVERHEAD = 4;
+
+	// Times a chunk that decodes to the wrong hash or stalls is decoded again
+	static const u32 MAX_CHUNK_RETRIES = 3;
+
+protected:
+	enum SlotStates
+	{
+		SLOT_FREE,		// Not in use
+		SLOT_RECEIVE,	// Feeding blocks to the decoder
+		SLOT_WRITE,		// Waiting for a worker to decompress and write
+		SLOT_RETRY,		// Chunk was corrupt or stalled, waiting for Tick() to decode it again
+	};
+
+	struct Slot
+	{
+		volatile u32 state;			// SLOT_ state
+		bool busy;					// A worker is writing the chunk
+		u32 file_id;
+		u64 file_offset;
+		u32 chunk_bytes;
+		u32 chunk_hash;
+		u32 compress_bytes;
+		u32 block_bytes;
+		u32 block_count;
+		u32 retries;				// Times the chunk was decoded again
+		u8 *write_buffer;			// Decompressed chunk data
+		u8 *compress_buffer;		// Compressed chunk data
+		wirehair::Decoder decoder;	// Unused if block_count == 1
+		u32 received;				// Blocks fed to the decoder
+		u32 requested;				// Blocks requested so far
+		u32 last_msec;				// Time of the last block or request
+		u32 next_id;				// One past the highest block id seen
+		u32 interval_arrived;		// Blocks that arrived this rate interval
+		u32 interval_lost;			// Block ids skipped this rate interval
+		u32 loss;					// Smoothed loss on this stream, per 65536 blocks
+	};
+
+	struct Extent
+	{
+		u64 offset, end;
+	};
+
+	struct File
+	{
+		u32 file_id;
+		u64 file_hash;
+		u64 file_bytes;
+		u64 done_bytes;				// Bytes written from the start of the file
+		std::vector<Extent> later;	// Chunks written past a gap
+	};
+
+	struct Progress
+	{
+		u64 file_hash;
+		u64 done_bytes;
+	};
+
+	Mutex _lock;
+
+	ITransferWriter *_writer;
+	OnStreamRequest _on_stream_request;
+	OnStreamDone _on_stream_done;
+	OnFileDone _on_file_done;
+	OnRate _on_rate;
+
+	u32 _chunk_bytes;
+	u32 _request_timeout;
+	Slot _slots[FT_MAX_STREAMS];
+
+	// Rate control, run by the receiving thread
+	u32 _rate_interval;
+	u32 _rate;					// Last rate sent to the source, or 0 before the first stream
+	bool _slow_start;			// Doubling the rate until the first loss
+	u32 _interval_start;
+	u64 _interval_bytes;		// Block message bytes that arrived this interval
+	u32 _loss;					// Smoothed loss on all streams, per 65536 blocks
+	u32 _loss_history[LOSS_HISTORY];
+	u32 _loss_index;
+	u32 _random_loss;			// Lowest loss in _loss_history
+	std::vector<File> _files;
+	std::vector<Progress> _progress;
+
+	// Statistics
+	u64 _received_blocks, _useless_blocks;
+	u32 _corrupt_chunks, _stalled_chunks;
+
+	File *FindFile(u32 file_id);
+	Progress *FindProgress(u64 file_hash);
+
+	// Record a written chunk.  Returns true if the file is complete.  Lock must be held
+	bool CompleteExtent(File *file, u64 offset, u32 bytes);
+
+	// Drop a file that is complete or has failed.  Lock must be held
+	void RemoveFile(u32 file_id);
+
+	// Prepare the decoder and request blocks.  Returns false on failure
+	bool StartDecode(u32 stream_id);
+
+	u32 GetRequestCount(Slot *slot);
+	void FreeBuffers();
+
+	// Measure the last rate interval and post a new rate
+	void UpdateRate(u32 now);
+
+public:
+	TransferSink();
+	~TransferSink();
+
+	// chunk_bytes: Largest chunk the source will send
+	bool Initialize(ITransferWriter *writer, u32 chunk_bytes);
+
+	CAT_INLINE void SetCallbacks(const OnStreamRequest &on_stream_request, const OnStreamDone &on_stream_done, const OnFileDone &on_file_done)
+	{
+		_on_stream_request = on_stream_request;
+		_on_stream_done = on_stream_done;
+		_on_file_done = on_file_done;
+	}
+
+	CAT_INLINE void SetRateCallback(const OnRate &on_rate) { _on_rate = on_rate; }
+
+	CAT_INLINE void SetRequestTimeout(u32 msec) { _request_timeout = msec; }
+	CAT_INLINE void SetRateInterval(u32 msec) { _rate_interval = msec; }
+
+	// Expect a file and return the offset the source should start from.
+	// If it equals file_bytes, the file is already complete and is not added
+	u64 AddFile(u32 file_id, u64 file_hash, u64 file_bytes);
+
+	// Bytes written from the start of the file with this hash
+	u64 GetResumeOffset(u64 file_hash);
+	void SetResumeOffset(u64 file_hash, u64 done_bytes);
+
+	// The following three are called from the receiving thread, one at a time:
+
+	// On TOP_STREAM_START.  Requests the first blocks
+	bool OnStreamStart(u32 now, const TransferStreamInfo &info);
+
+	// On IOP_HUGE
+	void OnBlock(u32 now, const u8 *packet, u32 bytes);
+
+	// Ask for more blocks on streams that have gone quiet, restart
+	// streams that decoded to the wrong data and update the send rate
+	void Tick(u32 now);
+
+	// Run one decompress and write job.  Called from worker threads.
+	// Returns false if there was nothing to do
+	bool DoWork();
+
+	// Returns true if no files are expected
+	bool IsIdle();
+
+	CAT_INLINE u64 GetReceivedBlocks() { return _received_blocks; }
+	CAT_INLINE u64 GetUselessBlocks() { return _useless_blocks; }
+	CAT_INLINE u32 GetCorruptChunks() { return _corrupt_chunks; }
+	CAT_INLINE u32 GetStalledChunks() { return _stalled_chunks; }
+	CAT_INLINE u32 GetRate() { return _rate; }
+	CAT_INLINE u32 GetLoss() { return _loss; }
+	CAT_INLINE u32 GetRandomLoss() { return _random_loss; }
+};
+
+
+} // namespace sphynx
+
+
+} // namespace cat
+
+#endif // CAT_SPHYNX_TRANSFER_PIPELINE_HPP
@@ -35,6 +35,7 @@
 #include <cat/parse/BufferStream.hpp>
 #include <cat/time/Clock.hpp>
 #include <cat/math/BitMath.hpp>
+#include <cat/rand/AbyssinianPRNG.hpp>
 #include <cat/sphynx/FlowControl.hpp>
 #include <cat/sphynx/Collexion.hpp>
 
@@ -280,6 +281,16 @@ struct SendQueue
 };
 
 
+// Queueing delay statistics for one scheduled queue
+struct QueueDelayStats
+{
+	u32 messages;		// Messages that left the queue
+	u32 expired;		// Unreliable messages dropped because they waited past their expiry
+	u32 max_msec;		// Longest time a message spent queued
+	u64 total_msec;		// Sum of the time messages spent queued
+};
+
+
 // A doubly-linked version of the above queue for the sent list
 struct SentList : SendQueue
 {
@@ -369,6 +380,8 @@ class CAT_EXPORT Transport
 {
 	friend struct SendQueue;
 	friend struct SentList;
+	friend class SchedulerTest; // tests/SchedulerTest drives ScheduleQueues() directly
+	friend class SharedPayloadTest; // tests/SharedPayloadTest drives the send and acknowledgment paths directly
 
 	static const u8 SHUTDOWN_TICK_COUNT = 3; // Number of ticks before shutting down the object
 
@@ -388,7 +401,9 @@ class CAT_EXPORT Transport
 	static const u32 MIN_RTT = 2; // Minimum milliseconds for RTT
 	static const int INITIAL_RTT = 1500; // milliseconds
 
-	static const u32 IPV6_OPTIONS_BYTES = 40; // TODO: Not sure about this
+	// Header estimates are only used for flow control accounting and the
+	// initial datagram size; MTU discovery measures whole datagrams instead
+	static const u32 IPV6_OPTIONS_BYTES = 40;
 	static const u32 IPV6_HEADER_BYTES = 40 + IPV6_OPTIONS_BYTES;
 
 	static const u32 IPV4_OPTIONS_BYTES = 40;
@@ -403,6 +418,13 @@ class CAT_EXPORT Transport
 	static const u32 OUT_OF_ORDER_LIMIT = 4096; // Stop acknowledging out of order packets after caching this many
 	static const u32 OUT_OF_ORDER_LOOPS = 32; // Max number of loops looking for the insertion point for out of order arrivals
 
+public:
+	// Scheduled queues: One per reliable stream, then queued unreliable messages
+	static const u32 UNRELIABLE_QUEUE = NUM_STREAMS;
+	static const u32 NUM_SCHEDULED_QUEUES = NUM_STREAMS + 1;
+
+private:
+
 	// Transport thread local storage object pointer
 	TransportTLS *_ttls;
 
@@ -442,12 +464,32 @@ class CAT_EXPORT Transport
 	// Send state: Queue of messages that are being sent
 	SendQueue _sending_queue[NUM_STREAMS];
 
+	// Send state: Unreliable messages waiting for the scheduler, and being sent
+	// Protected by _send_queue_lock and the tick respectively, like the reliable queues
+	SendQueue _send_unreliable_queue, _sending_unreliable_queue;
+
+	// Send state: Scheduler weights and target queueing delays, indexed by scheduled queue
+	u32 _queue_weight[NUM_SCHEDULED_QUEUES];
+	u32 _queue_deadline[NUM_SCHEDULED_QUEUES];
+
+	// Send state: Queueing delay statistics, indexed by scheduled queue
+	QueueDelayStats _queue_delay[NUM_SCHEDULED_QUEUES];
+
+	CAT_INLINE void RecordQueueDelay(u32 queue, u32 delay);
+
 	// Send state: List of messages that are waiting to be acknowledged
 	SentList _sent_list[NUM_STREAMS];
 
 	CAT_INLINE void RetransmitNegative(u32 recv_time, u32 stream, u32 last_ack_id, u32 &loss_count);
 	static void FreeSentNode(OutgoingMessage *node);
 
+	// Shared message data for broadcasts
+	static CAT_INLINE u8 *GetMessageData(OutgoingMessage *node);
+	static CAT_INLINE void ReleaseMessage(OutgoingMessage *node);
+	static SharedPayload *AcquireSharedPayload(u8 msg_opcode, const void *msg_data, u32 msg_bytes);
+	static OutgoingMessage *AcquireSharedMessages(SharedPayload *payload, int count, SuperOpcode super_opcode); // One node per recipient, linked by next
+	static void AppendSharedPayload(SharedPayload *payload, int worker_id, Connexion **list, int count, StreamMode stream, SuperOpcode super_opcode);
+
 	// Queue of outgoing datagrams for batched output
 	// Protected by _send_cluster_lock
 	BatchSet _outgoing_datagrams;
@@ -488,6 +530,18 @@ class CAT_EXPORT Transport
 	// Write one SendQueue node into the send buffer
 	bool WriteSendQueueNode(OutgoingMessage *node, u32 now, u32 stream, s32 &remaining);
 
+	// Append an unreliable message to the send cluster, with _send_cluster_lock held
+	// Returns the number of bytes flushed to make room for it
+	u32 ClusterUnreliableAppend(u8 msg_opcode, const u8 *msg_data, u32 msg_bytes, u32 super_opcode);
+
+	// Write queued unreliable messages up to and including tail (or all if 0), dropping expired ones
+	void WriteQueuedUnreliable(u32 now, OutgoingMessage *tail, s32 &remaining);
+
+	// Split bandwidth between the queue heads in out_head by weight, then by deadline.
+	// Fills out_tail and order[] with the queues to write in deadline order, and clears
+	// out_head for queues given nothing.  Returns the number of queues in order[]
+	u32 ScheduleQueues(s32 bandwidth, OutgoingMessage *out_head[], OutgoingMessage *out_tail[], u32 order[]);
+
 	// Returns true if send cluster is still locked
 	bool WriteQueuedReliable();
 
@@ -509,9 +563,27 @@ public:
 	bool WriteUnreliable(u8 msg_opcode, const void *msg_data = 0, u32 msg_bytes = 0, SuperOpcode super_opcode = SOP_DATA);
 	bool WriteReliable(StreamMode stream, u8 msg_opcode, const void *msg_data = 0, u32 msg_bytes = 0, SuperOpcode super_opcode = SOP_DATA);
 
-	// Broadcast version
+	// Queue an unreliable message for the scheduler, which shares bandwidth with the reliable streams.
+	// If it has not been sent within expire_msec it is dropped instead
+	bool QueueUnreliable(u8 msg_opcode, const void *msg_data, u32 msg_bytes, u32 expire_msec, SuperOpcode super_opcode = SOP_DATA);
+
+	// Scheduler: When several queues are backlogged, each gets bandwidth in proportion to its weight.
+	// Bandwidth they leave unused goes to the queue whose oldest message is nearest its deadline.
+	// queue: A StreamMode or UNRELIABLE_QUEUE
+	void SetQueueWeight(u32 queue, u32 weight);
+	void SetQueueDeadline(u32 queue, u32 msec);
+
+	// Queueing delay statistics, updated on the transport tick
+	// queue: A StreamMode or UNRELIABLE_QUEUE
+	void GetQueueDelayStats(u32 queue, QueueDelayStats &stats);
+	void ResetQueueDelayStats();
+
+	// Broadcast version: All of the connexions share one reference-counted copy of the message
 	static bool BroadcastReliable(BinnedConnexionSubset &subset, StreamMode stream, u8 msg_opcode, const void *msg_data = 0, u32 msg_bytes = 0, SuperOpcode super_opcode = SOP_DATA);
 
+	// Snapshot version: Caller must hold the snapshot (see Collexion::SnapshotAcquire)
+	static bool BroadcastReliable(ConnexionSnapshot *snapshot, StreamMode stream, u8 msg_opcode, const void *msg_data = 0, u32 msg_bytes = 0, SuperOpcode super_opcode = SOP_DATA);
+
 	// Helper connexion-criterion version
 	template<class T>
 	static CAT_INLINE void BroadcastReliable(Collexion<T> *conn_list, IConnexionCriterion<T> *criterion, StreamMode stream, u8 msg_opcode, const void *msg_data = 0, u32 msg_bytes = 0, SuperOpcode super_opcode = SOP_DATA)
@@ -524,12 +596,22 @@ public:
 		}
 	}
 
-	// Helper any-connexion version
+	// Helper any-connexion version: Walks the lock-free member snapshot
 	template<class T>
 	static CAT_INLINE void BroadcastReliable(Collexion<T> *conn_list, StreamMode stream, u8 msg_opcode, const void *msg_data = 0, u32 msg_bytes = 0, SuperOpcode super_opcode = SOP_DATA)
+	{
+		AutoCollexionSnapshot<T> snapshot(*conn_list);
+		if (snapshot.Count() > 0)
+			Transport::BroadcastReliable(snapshot.Get(), stream, msg_opcode, msg_data, msg_bytes, super_opcode);
+	}
+
+	// Helper area-of-interest version: Delivers to members positioned within radius of (x, y)
+	// NOTE: Requires Collexion::EnableInterestGrid() and SetPosition() updates
+	template<class T>
+	static CAT_INLINE void BroadcastReliable(Collexion<T> *conn_list, float x, float y, float radius, StreamMode stream, u8 msg_opcode, const void *msg_data = 0, u32 msg_bytes = 0, SuperOpcode super_opcode = SOP_DATA)
 	{
 		BinnedConnexionSubset subset;
-		if (conn_list->BinnedSubsetAcquire(subset))
+		if (conn_list->BinnedRadiusAcquire(subset, x, y, radius))
 		{
 			Transport::BroadcastReliable(subset, stream, msg_opcode, msg_data, msg_bytes, super_opcode);
 			conn_list->SubsetRelease();
@@ -590,7 +672,9 @@ protected:
 	virtual void OnInternal(u32 recv_time, BufferStream msg, u32 bytes) = 0; // precondition: bytes > 0
 	virtual void OnDisconnectReason(u8 reason) = 0; // Called to help explain why a disconnect is happening
 
-	bool PostMTUProbe(u32 mtu);
+	// Post an unreliable probe datagram of the given size (UDP payload bytes).
+	// Set reset when falling back to this size after a black hole
+	bool PostMTUProbe(u32 datagram_bytes, bool reset);
 
 	void OnFlowControlWrite(u32 bytes);
 };
@@ -0,0 +1,146 @@
+/*
+	Copyright (c) 2012 Christopher A. Taylor.  All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	* Redistributions of source code must retain the above copyright notice,
+	  this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	* Neither the name of LibCat nor the names of its contributors may be used
+	  to endorse or promote products derived from this software without
+	  specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef CAT_EPOCH_RECLAIM_HPP
+#define CAT_EPOCH_RECLAIM_HPP
+
+#include <cat/threads/Atomic.hpp>
+#include <cat/threads/Mutex.hpp>
+
+/*
+	Epoch-based reclamation
+
+		Lets readers walk a shared data structure without taking a lock
+	while writers replace parts of it.  Readers bracket each walk with
+	EnterRead() and LeaveRead(), which only bump a counter in a stripe
+	owned by the calling thread.  Writers unlink an object first and then
+	hand it to Retire().  The object is released once the epoch has
+	advanced twice, at which point no reader that could have seen it is
+	still inside.
+
+		The epoch only advances when the readers of the previous parity
+	have drained, so reclamation is driven by Reclaim(), which never
+	blocks, and Synchronize(), which waits.  Read sections must be short
+	and must not call back into the writer side.
+*/
+
+namespace cat {
+
+
+// Called once it is safe to free a retired object
+typedef void (*EpochReleaser)(void *object);
+
+
+//// EpochReclaim
+
+class CAT_EXPORT EpochReclaim
+{
+public:
+	static const u32 STRIPES = 16; // Power-of-2
+
+private:
+	struct Stripe
+	{
+		volatile u32 active[2]; // Readers inside, by epoch parity
+		u8 padding[CAT_DEFAULT_CACHE_LINE_SIZE - 2 * sizeof(u32)];
+	};
+
+	struct Retired
+	{
+		Retired *next;
+		void *object;
+		EpochReleaser releaser;
+		u32 epoch;
+	};
+
+	Stripe _stripes[STRIPES];
+	volatile u32 _epoch;
+
+	Mutex _lock; // Protects the retired list and epoch advance
+	Retired *_retired; // Newest first
+	u32 _retired_count;
+
+	static u32 GetStripe();
+
+	// Returns true if the epoch advanced
+	bool TryAdvance();
+
+	// Unlink retired objects that are at least two epochs old
+	Retired *CollectReady();
+
+	static void ReleaseList(Retired *list);
+
+public:
+	EpochReclaim();
+	~EpochReclaim();
+
+	// Returns a ticket to pass to LeaveRead()
+	u32 EnterRead();
+
+	CAT_INLINE void LeaveRead(u32 ticket)
+	{
+		Atomic::Add(&_stripes[ticket >> 1].active[ticket & 1], -1);
+	}
+
+	// Queue an object that has already been unlinked from the shared structure
+	void Retire(void *object, EpochReleaser releaser);
+
+	// Advance the epoch if readers allow it and release anything that is now safe
+	void Reclaim();
+
+	// Wait for readers to drain and release everything retired so far
+	void Synchronize();
+
+	CAT_INLINE u32 GetRetiredCount() { return _retired_count; }
+};
+
+
+//// AutoEpochRead
+
+class AutoEpochRead
+{
+	EpochReclaim *_reclaim;
+	u32 _ticket;
+
+public:
+	CAT_INLINE AutoEpochRead(EpochReclaim &reclaim)
+	{
+		_reclaim = &reclaim;
+		_ticket = reclaim.EnterRead();
+	}
+
+	CAT_INLINE ~AutoEpochRead()
+	{
+		_reclaim->LeaveRead(_ticket);
+	}
+};
+
+
+} // namespace cat
+
+#endif // CAT_EPOCH_RECLAIM_HPP
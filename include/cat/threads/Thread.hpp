@@ -130,6 +130,8 @@ public:
 };
 
 
+template<class T> class TLSInstance;
+
 /*
 	SlowThreadLocalStorage
 
@@ -27,6 +27,9 @@
 */
 
 #include <cat/codec/Huffman.hpp>
+#include <cat/port/EndianNeutral.hpp>
+#include <cat/io/Log.hpp>
+#include <cstring>
 using namespace std;
 using namespace cat;
 
@@ -276,3 +279,445 @@ HuffmanTree *HuffmanTreeFactory::BuildTree(u32 code_symbols)
 
 	return tree;
 }
+
+
+//// HuffmanCodec
+
+/*
+	Decoder table entries, indexed by the next TABLE_BITS bits of input:
+
+	bits 0-7: First symbol
+	bits 8-15: Second symbol
+	bits 16-19: Length of first code
+	bits 20-24: Length of both codes
+	bits 25-26: Number of symbols in the entry (0 = code longer than TABLE_BITS)
+*/
+
+static const u32 TABLE_SECOND_SHIFT = 8;
+static const u32 TABLE_LENGTH_SHIFT = 16;
+static const u32 TABLE_TOTAL_SHIFT = 20;
+static const u32 TABLE_COUNT_SHIFT = 25;
+
+// Reverse the low bits of a code so that it can be written least-significant bit first
+static CAT_INLINE u32 ReverseCode(u32 code, u32 bits)
+{
+	u32 reversed = 0;
+
+	for (u32 ii = 0; ii < bits; ++ii)
+	{
+		reversed = (reversed << 1) | (code & 1);
+		code >>= 1;
+	}
+
+	return reversed;
+}
+
+/*
+	In-place minimum-redundancy code lengths for counts sorted in increasing
+	order, from Moffat and Katajainen, "In-Place Calculation of
+	Minimum-Redundancy Codes" (1995).  Replaces each count with the code
+	length of its symbol.
+*/
+static void CalculateCodeLengths(u32 *a, int n)
+{
+	if (n == 1)
+	{
+		a[0] = 1;
+		return;
+	}
+
+	// Phase 1: Combine counts into internal nodes, storing parent pointers
+	a[0] += a[1];
+	int root = 0, leaf = 2;
+
+	for (int next = 1; next < n - 1; ++next)
+	{
+		if (leaf >= n || a[root] < a[leaf])
+		{
+			a[next] = a[root];
+			a[root++] = next;
+		}
+		else
+			a[next] = a[leaf++];
+
+		if (leaf >= n || (root < next && a[root] < a[leaf]))
+		{
+			a[next] += a[root];
+			a[root++] = next;
+		}
+		else
+			a[next] += a[leaf++];
+	}
+
+	// Phase 2: Convert parent pointers to internal node depths
+	a[n - 2] = 0;
+	for (int next = n - 3; next >= 0; --next)
+		a[next] = a[a[next]] + 1;
+
+	// Phase 3: Convert internal node depths to leaf depths
+	int available = 1, used = 0, depth = 0, next = n - 1;
+	root = n - 2;
+
+	while (available > 0)
+	{
+		while (root >= 0 && (int)a[root] == depth)
+		{
+			++used;
+			--root;
+		}
+
+		while (available > used)
+		{
+			a[next--] = depth;
+			--available;
+		}
+
+		available = 2 * used;
+		++depth;
+		used = 0;
+	}
+}
+
+HuffmanCodec::HuffmanCodec()
+{
+	_initialized = false;
+}
+
+bool HuffmanCodec::InitializeFromCounts(const u32 counts[MAX_SYMBOLS])
+{
+	u32 sorted_counts[MAX_SYMBOLS];
+	u8 sorted_symbols[MAX_SYMBOLS];
+	int n = 0;
+
+	// Insertion sort the coded symbols by increasing count
+	for (u32 symbol = 0; symbol < MAX_SYMBOLS; ++symbol)
+	{
+		u32 count = counts[symbol];
+		if (!count) continue;
+
+		int ii = n++;
+		while (ii > 0 && sorted_counts[ii - 1] > count)
+		{
+			sorted_counts[ii] = sorted_counts[ii - 1];
+			sorted_symbols[ii] = sorted_symbols[ii - 1];
+			--ii;
+		}
+		sorted_counts[ii] = count;
+		sorted_symbols[ii] = (u8)symbol;
+	}
+
+	if (n == 0) return false;
+
+	CalculateCodeLengths(sorted_counts, n);
+
+	// Count codes of each length, folding lengths over the limit into the limit
+	u32 length_count[MAX_SYMBOLS + 1] = { 0 };
+	for (int ii = 0; ii < n; ++ii)
+	{
+		u32 length = sorted_counts[ii];
+		++length_count[length > MAX_CODE_BITS ? MAX_CODE_BITS : length];
+	}
+
+	// Restore the Kraft sum by moving a code down a level for each excess leaf at the limit
+	u32 kraft = 0;
+	for (u32 length = 1; length <= MAX_CODE_BITS; ++length)
+		kraft += length_count[length] << (MAX_CODE_BITS - length);
+
+	while (kraft > ((u32)1 << MAX_CODE_BITS))
+	{
+		--length_count[MAX_CODE_BITS];
+
+		for (u32 length = MAX_CODE_BITS - 1; length > 0; --length)
+		{
+			if (length_count[length])
+			{
+				--length_count[length];
+				length_count[length + 1] += 2;
+				break;
+			}
+		}
+
+		--kraft;
+	}
+
+	// Hand out the longest codes to the least likely symbols
+	u8 lengths[MAX_SYMBOLS] = { 0 };
+	int ii = 0;
+	for (u32 length = MAX_CODE_BITS; length > 0; --length)
+	{
+		for (u32 jj = 0; jj < length_count[length]; ++jj)
+			lengths[sorted_symbols[ii++]] = (u8)length;
+	}
+
+	return InitializeFromLengths(lengths);
+}
+
+bool HuffmanCodec::InitializeFromLengths(const u8 lengths[MAX_SYMBOLS])
+{
+	_initialized = false;
+
+	// Count codes of each length
+	CAT_OBJCLR(_length_count);
+	u32 kraft = 0, coded = 0;
+	for (u32 symbol = 0; symbol < MAX_SYMBOLS; ++symbol)
+	{
+		u32 length = lengths[symbol];
+		if (length > MAX_CODE_BITS) return false;
+		if (!length) continue;
+
+		++_length_count[length];
+		kraft += (u32)1 << (MAX_CODE_BITS - length);
+		++coded;
+	}
+
+	// If there are no codes or they are over-subscribed,
+	if (!coded || kraft > ((u32)1 << MAX_CODE_BITS))
+		return false;
+
+	// First canonical code and first sorted index of each length
+	u16 next_code[MAX_CODE_BITS + 1], next_index[MAX_CODE_BITS + 1];
+	u32 code = 0, index = 0;
+	for (u32 length = 1; length <= MAX_CODE_BITS; ++length)
+	{
+		code = (code + _length_count[length - 1]) << 1;
+		_first_code[length] = next_code[length] = (u16)code;
+		_length_offset[length] = next_index[length] = (u16)index;
+		index += _length_count[length];
+	}
+	_first_code[MAX_CODE_BITS + 1] = 0;
+
+	// Assign codes in symbol order within each length
+	u32 single[1 << TABLE_BITS] = { 0 };
+	for (u32 symbol = 0; symbol < MAX_SYMBOLS; ++symbol)
+	{
+		u32 length = lengths[symbol];
+		_lengths[symbol] = (u8)length;
+		if (!length) continue;
+
+		u32 reversed = ReverseCode(next_code[length]++, length);
+		_codes[symbol] = (u16)reversed;
+		_sorted[next_index[length]++] = (u8)symbol;
+
+		// Fill every table slot that starts with this code
+		if (length <= TABLE_BITS)
+		{
+			u32 entry = symbol | (length << TABLE_LENGTH_SHIFT) | (length << TABLE_TOTAL_SHIFT) | (1 << TABLE_COUNT_SHIFT);
+
+			for (u32 ii = reversed; ii < (1 << TABLE_BITS); ii += (u32)1 << length)
+				single[ii] = entry;
+		}
+	}
+
+	// Pair each short code with the code that follows it when both fit in the table bits
+	for (u32 ii = 0; ii < (1 << TABLE_BITS); ++ii)
+	{
+		u32 entry = single[ii];
+		_table[ii] = entry;
+		if (!entry) continue;
+
+		u32 length = (entry >> TABLE_LENGTH_SHIFT) & 15;
+		u32 second = single[ii >> length];
+		u32 second_length = (second >> TABLE_LENGTH_SHIFT) & 15;
+
+		if (second && length + second_length <= TABLE_BITS)
+		{
+			_table[ii] = (entry & 0xff) | ((second & 0xff) << TABLE_SECOND_SHIFT)
+				| (length << TABLE_LENGTH_SHIFT) | ((length + second_length) << TABLE_TOTAL_SHIFT)
+				| (2 << TABLE_COUNT_SHIFT);
+		}
+	}
+
+	_initialized = true;
+	return true;
+}
+
+void HuffmanCodec::PackLengths(u8 packed[PACKED_LENGTH_BYTES])
+{
+	for (u32 ii = 0; ii < PACKED_LENGTH_BYTES; ++ii)
+		packed[ii] = (u8)(_lengths[ii * 2] | (_lengths[ii * 2 + 1] << 4));
+}
+
+bool HuffmanCodec::UnpackLengths(const u8 packed[PACKED_LENGTH_BYTES])
+{
+	u8 lengths[MAX_SYMBOLS];
+
+	for (u32 ii = 0; ii < PACKED_LENGTH_BYTES; ++ii)
+	{
+		lengths[ii * 2] = packed[ii] & 15;
+		lengths[ii * 2 + 1] = packed[ii] >> 4;
+	}
+
+	return InitializeFromLengths(lengths);
+}
+
+int HuffmanCodec::Encode(const void *data, u32 bytes, void *out, u32 out_bytes)
+{
+	if (!_initialized) return -1;
+
+	const u8 *in = reinterpret_cast<const u8*>( data );
+	u8 *next = reinterpret_cast<u8*>( out );
+	u8 *out_end = next + out_bytes;
+
+	// Codes accumulate in the low bits and leave 32 bits at a time
+	u64 bits = 0;
+	u32 bit_count = 0;
+
+	for (u32 ii = 0; ii < bytes; ++ii)
+	{
+		u8 symbol = in[ii];
+		u32 length = _lengths[symbol];
+		if (!length) return -1;
+
+		bits |= (u64)_codes[symbol] << bit_count;
+		bit_count += length;
+
+		if (bit_count >= 32)
+		{
+			if (out_end - next < 4) return -1;
+
+			u32 word = getLE32((u32)bits);
+			memcpy(next, &word, 4);
+			next += 4;
+
+			bits >>= 32;
+			bit_count -= 32;
+		}
+	}
+
+	// Flush remaining whole and partial bytes
+	while (bit_count > 0)
+	{
+		if (next >= out_end) return -1;
+
+		*next++ = (u8)bits;
+		bits >>= 8;
+		bit_count = (bit_count > 8) ? bit_count - 8 : 0;
+	}
+
+	return (int)(next - reinterpret_cast<u8*>( out ));
+}
+
+u32 HuffmanCodec::DecodeSlow(u64 bits, u8 &symbol)
+{
+	u32 code = 0;
+
+	// Codes are written most-significant bit first within each code
+	for (u32 length = 1; length <= MAX_CODE_BITS; ++length)
+	{
+		code = (code << 1) | (u32)(bits & 1);
+		bits >>= 1;
+
+		u32 offset = code - _first_code[length];
+		if (offset < _length_count[length])
+		{
+			symbol = _sorted[_length_offset[length] + offset];
+			return length;
+		}
+	}
+
+	return 0;
+}
+
+int HuffmanCodec::DecodeSymbols(const u8 *in, u32 in_bytes, u8 *out, u32 out_bytes, bool text, u32 &used)
+{
+	if (!_initialized) return -1;
+
+	const u8 *next = in, *in_end = in + in_bytes;
+	u64 bits = 0;
+	u32 bit_count = 0, written = 0;
+	u32 overrun = 0; // Zero bytes read past the end of the input
+
+	while (written < out_bytes)
+	{
+		// Refill to at least 56 bits
+		if (in_end - next >= 8)
+		{
+			u64 word;
+			memcpy(&word, next, 8);
+			bits |= getLE64(word) << bit_count;
+			next += (63 - bit_count) >> 3;
+			bit_count |= 56;
+		}
+		else
+		{
+			while (bit_count <= 56)
+			{
+				if (next < in_end)
+					bits |= (u64)*next++ << bit_count;
+				else
+					++overrun;
+				bit_count += 8;
+			}
+		}
+
+		u32 entry = _table[bits & ((1 << TABLE_BITS) - 1)];
+		u32 count = entry >> TABLE_COUNT_SHIFT;
+
+		// If the code is longer than the table bits,
+		if (!count)
+		{
+			u8 symbol;
+			u32 length = DecodeSlow(bits, symbol);
+			if (!length) return -1;
+
+			out[written++] = symbol;
+			bits >>= length;
+			bit_count -= length;
+
+			if (text && !symbol) break;
+			continue;
+		}
+
+		u8 symbol = (u8)entry;
+		out[written++] = symbol;
+
+		// If only the first symbol is needed,
+		if (count == 1 || written >= out_bytes || (text && !symbol))
+		{
+			u32 length = (entry >> TABLE_LENGTH_SHIFT) & 15;
+			bits >>= length;
+			bit_count -= length;
+
+			if (text && !symbol) break;
+			continue;
+		}
+
+		symbol = (u8)(entry >> TABLE_SECOND_SHIFT);
+		out[written++] = symbol;
+
+		u32 length = (entry >> TABLE_TOTAL_SHIFT) & 31;
+		bits >>= length;
+		bit_count -= length;
+
+		if (text && !symbol) break;
+	}
+
+	// Fail if more bits were decoded than the input holds
+	u32 consumed_bits = (u32)(next - in + overrun) * 8 - bit_count;
+	if (consumed_bits > in_bytes * 8)
+		return -1;
+
+	used = (consumed_bits + 7) / 8;
+	return (int)written;
+}
+
+int HuffmanCodec::Decode(const void *in, u32 in_bytes, void *out, u32 out_bytes)
+{
+	u32 used;
+	int written = DecodeSymbols(reinterpret_cast<const u8*>( in ), in_bytes, reinterpret_cast<u8*>( out ), out_bytes, false, used);
+	if (written < 0) return -1;
+
+	return (int)used;
+}
+
+int HuffmanCodec::DecodeText(const void *in, u32 in_bytes, char *out, u32 out_bytes)
+{
+	u32 used;
+	int written = DecodeSymbols(reinterpret_cast<const u8*>( in ), in_bytes, reinterpret_cast<u8*>( out ), out_bytes, true, used);
+
+	// Fail if there was no null terminator
+	if (written <= 0 || out[written - 1] != '\0')
+		return -1;
+
+	return written - 1;
+}
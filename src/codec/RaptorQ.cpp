@@ -0,0 +1,1659 @@
+/*
+	Copyright (c) 2012 Christopher A. Taylor.  All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	* Redistributions of source code must retain the above copyright notice,
+	  this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	* Neither the name of LibCat nor the names of its contributors may be used
+	  to endorse or promote products derived from this software without
+	  specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <cat/codec/RaptorQ.hpp>
+#include <cat/math/MemXOR.hpp>
+#include <cat/math/BitMath.hpp>
+#include <cstring>
+#include <new>
+using namespace cat;
+using namespace raptorq;
+
+#if defined(CAT_ISA_X86) && defined(CAT_HAS_SSE2)
+# if defined(__SSSE3__) || defined(CAT_HAS_AVX2)
+#  define CAT_OCT_SSSE3
+#  define CAT_SSSE3_TARGET
+# elif defined(CAT_COMPILER_MSVC) && (_MSC_VER >= 1500)
+// SSSE3 kernels are built anyway and selected at runtime if the CPU has SSSE3
+#  define CAT_OCT_SSSE3
+#  define CAT_OCT_SSSE3_DISPATCH
+#  define CAT_SSSE3_TARGET
+# elif defined(__clang__) || (defined(CAT_COMPILER_GCC) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)))
+#  define CAT_OCT_SSSE3
+#  define CAT_OCT_SSSE3_DISPATCH
+#  define CAT_SSSE3_TARGET __attribute__((target("ssse3")))
+# endif
+#endif
+
+#if defined(CAT_OCT_SSSE3)
+# include <tmmintrin.h>
+#endif
+
+#if defined(CAT_OCT_SSSE3_DISPATCH)
+# if defined(CAT_COMPILER_MSVC)
+#  include <intrin.h>
+# else
+#  include <cpuid.h>
+# endif
+#endif
+
+#if defined(CAT_HAS_NEON) && defined(__aarch64__)
+# include <arm_neon.h>
+# define CAT_OCT_NEON
+#endif
+
+
+//// Result object
+
+const char *cat::raptorq::GetResultString(Result r)
+{
+	switch (r)
+	{
+	case R_WIN:				return "R_WIN";
+	case R_MORE_BLOCKS:		return "R_MORE_BLOCKS";
+	case R_BAD_INPUT:		return "R_BAD_INPUT";
+	case R_TOO_LARGE:		return "R_TOO_LARGE";
+	case R_BAD_SEED:		return "R_BAD_SEED";
+	case R_OUT_OF_MEMORY:	return "R_OUT_OF_MEMORY";
+
+	default:				if (r >= R_ERROR) return "R_UNKNOWN_ERROR";
+							else return "R_UNKNOWN";
+	}
+}
+
+
+//// GF(256) Octet Math
+
+/*
+	Symbols are vectors over GF(256) with the generator polynomial
+	x^8 + x^4 + x^3 + x^2 + 1 (RFC 6330 section 5.7).
+
+	Row operations multiply a whole symbol by a constant.  The SIMD
+	kernels split each octet into nibbles and look up both halves of the
+	product with a byte shuffle, so a 16-byte lane is done in a few
+	instructions.  OCT_NIBBLE holds the two 16-entry tables for every
+	constant.
+*/
+
+static u8 OCT_EXP[510];
+static u8 OCT_LOG[256];
+static u8 OCT_MUL[256][256];
+static CAT_ALIGNED(16) u8 OCT_NIBBLE[256][32];
+
+static CAT_INLINE u8 OctInverse(u8 x)
+{
+	return OCT_EXP[255 - OCT_LOG[x]];
+}
+
+static void OctMulAddScalar(u8 *dest, const u8 *src, u8 c, int bytes)
+{
+	const u8 *table = OCT_MUL[c];
+
+	for (int ii = 0; ii < bytes; ++ii)
+		dest[ii] ^= table[src[ii]];
+}
+
+static void OctMulScalar(u8 *dest, u8 c, int bytes)
+{
+	const u8 *table = OCT_MUL[c];
+
+	for (int ii = 0; ii < bytes; ++ii)
+		dest[ii] = table[dest[ii]];
+}
+
+#if defined(CAT_OCT_SSSE3)
+
+CAT_SSSE3_TARGET static void OctMulAddSSSE3(u8 *dest, const u8 *src, u8 c, int bytes)
+{
+	const __m128i table_lo = _mm_load_si128((const __m128i*)OCT_NIBBLE[c]);
+	const __m128i table_hi = _mm_load_si128((const __m128i*)(OCT_NIBBLE[c] + 16));
+	const __m128i mask = _mm_set1_epi8(0x0f);
+
+	while (bytes >= 16)
+	{
+		__m128i x = _mm_loadu_si128((const __m128i*)src);
+		__m128i lo = _mm_shuffle_epi8(table_lo, _mm_and_si128(x, mask));
+		__m128i hi = _mm_shuffle_epi8(table_hi, _mm_and_si128(_mm_srli_epi64(x, 4), mask));
+		__m128i y = _mm_loadu_si128((const __m128i*)dest);
+		_mm_storeu_si128((__m128i*)dest, _mm_xor_si128(y, _mm_xor_si128(lo, hi)));
+
+		src += 16;
+		dest += 16;
+		bytes -= 16;
+	}
+
+	OctMulAddScalar(dest, src, c, bytes);
+}
+
+CAT_SSSE3_TARGET static void OctMulSSSE3(u8 *dest, u8 c, int bytes)
+{
+	const __m128i table_lo = _mm_load_si128((const __m128i*)OCT_NIBBLE[c]);
+	const __m128i table_hi = _mm_load_si128((const __m128i*)(OCT_NIBBLE[c] + 16));
+	const __m128i mask = _mm_set1_epi8(0x0f);
+
+	while (bytes >= 16)
+	{
+		__m128i x = _mm_loadu_si128((const __m128i*)dest);
+		__m128i lo = _mm_shuffle_epi8(table_lo, _mm_and_si128(x, mask));
+		__m128i hi = _mm_shuffle_epi8(table_hi, _mm_and_si128(_mm_srli_epi64(x, 4), mask));
+		_mm_storeu_si128((__m128i*)dest, _mm_xor_si128(lo, hi));
+
+		dest += 16;
+		bytes -= 16;
+	}
+
+	OctMulScalar(dest, c, bytes);
+}
+
+#endif // CAT_OCT_SSSE3
+
+#if defined(CAT_OCT_NEON)
+
+static void OctMulAddNEON(u8 *dest, const u8 *src, u8 c, int bytes)
+{
+	const uint8x16_t table_lo = vld1q_u8(OCT_NIBBLE[c]);
+	const uint8x16_t table_hi = vld1q_u8(OCT_NIBBLE[c] + 16);
+	const uint8x16_t mask = vdupq_n_u8(0x0f);
+
+	while (bytes >= 16)
+	{
+		uint8x16_t x = vld1q_u8(src);
+		uint8x16_t lo = vqtbl1q_u8(table_lo, vandq_u8(x, mask));
+		uint8x16_t hi = vqtbl1q_u8(table_hi, vshrq_n_u8(x, 4));
+		vst1q_u8(dest, veorq_u8(vld1q_u8(dest), veorq_u8(lo, hi)));
+
+		src += 16;
+		dest += 16;
+		bytes -= 16;
+	}
+
+	OctMulAddScalar(dest, src, c, bytes);
+}
+
+static void OctMulNEON(u8 *dest, u8 c, int bytes)
+{
+	const uint8x16_t table_lo = vld1q_u8(OCT_NIBBLE[c]);
+	const uint8x16_t table_hi = vld1q_u8(OCT_NIBBLE[c] + 16);
+	const uint8x16_t mask = vdupq_n_u8(0x0f);
+
+	while (bytes >= 16)
+	{
+		uint8x16_t x = vld1q_u8(dest);
+		uint8x16_t lo = vqtbl1q_u8(table_lo, vandq_u8(x, mask));
+		uint8x16_t hi = vqtbl1q_u8(table_hi, vshrq_n_u8(x, 4));
+		vst1q_u8(dest, veorq_u8(lo, hi));
+
+		dest += 16;
+		bytes -= 16;
+	}
+
+	OctMulScalar(dest, c, bytes);
+}
+
+#endif // CAT_OCT_NEON
+
+#if defined(CAT_OCT_SSSE3_DISPATCH)
+
+// True if the CPU supports SSSE3
+static bool HasSSSE3()
+{
+#if defined(CAT_COMPILER_MSVC)
+	int info[4];
+	__cpuid(info, 1);
+	return (info[2] & (1 << 9)) != 0;
+#else
+	u32 regs[4];
+	if (!__get_cpuid(1, &regs[0], &regs[1], &regs[2], &regs[3]))
+		return false;
+	return (regs[2] & (1 << 9)) != 0;
+#endif
+}
+
+#endif // CAT_OCT_SSSE3_DISPATCH
+
+static void (*m_oct_muladd)(u8 *dest, const u8 *src, u8 c, int bytes) = 0;
+static void (*m_oct_mul)(u8 *dest, u8 c, int bytes) = 0;
+
+// Generate the tables and pick the kernels on first use; racing threads all do the same thing
+static void InitializeOctets()
+{
+	if (m_oct_muladd) return;
+
+	u32 x = 1;
+	for (int ii = 0; ii < 255; ++ii)
+	{
+		OCT_EXP[ii] = OCT_EXP[ii + 255] = (u8)x;
+		OCT_LOG[x] = (u8)ii;
+
+		x <<= 1;
+		if (x & 0x100) x ^= 0x11d;
+	}
+
+	for (int a = 0; a < 256; ++a)
+	{
+		OCT_MUL[a][0] = OCT_MUL[0][a] = 0;
+
+		for (int b = 1; b < 256; ++b)
+			if (a) OCT_MUL[a][b] = OCT_EXP[OCT_LOG[a] + OCT_LOG[b]];
+
+		for (int n = 0; n < 16; ++n)
+		{
+			OCT_NIBBLE[a][n] = OCT_MUL[a][n];
+			OCT_NIBBLE[a][n + 16] = OCT_MUL[a][n << 4];
+		}
+	}
+
+	void (*muladd)(u8 *dest, const u8 *src, u8 c, int bytes) = OctMulAddScalar;
+	void (*mul)(u8 *dest, u8 c, int bytes) = OctMulScalar;
+
+#if defined(CAT_OCT_SSSE3_DISPATCH)
+	if (HasSSSE3())
+	{
+		muladd = OctMulAddSSSE3;
+		mul = OctMulSSSE3;
+	}
+#elif defined(CAT_OCT_SSSE3)
+	muladd = OctMulAddSSSE3;
+	mul = OctMulSSSE3;
+#elif defined(CAT_OCT_NEON)
+	muladd = OctMulAddNEON;
+	mul = OctMulNEON;
+#endif
+
+	m_oct_mul = mul;
+	m_oct_muladd = muladd;
+}
+
+// dest += c * src
+static CAT_INLINE void OctMulAdd(u8 *dest, const u8 *src, u8 c, int bytes)
+{
+	if (c == 1)
+		memxor(dest, src, bytes);
+	else if (c)
+		m_oct_muladd(dest, src, c, bytes);
+}
+
+// dest *= c
+static CAT_INLINE void OctMul(u8 *dest, u8 c, int bytes)
+{
+	if (c == 0)
+		memset(dest, 0, bytes);
+	else if (c != 1)
+		m_oct_mul(dest, c, bytes);
+}
+
+
+//// Parameters
+
+/*
+	RFC 6330 rounds K up to the next K' listed in its Table 2 and takes J, S,
+	H and W from that row.  The RFC's table is not reproduced here, so
+	SYSTEMATIC_INDEX below has the same layout but its own rows: K' steps up
+	by about 1/64 at a time, and each row was computed offline as follows.
+
+	S = smallest prime >= ceil(0.01 K') + X, where X is the smallest
+		integer with X(X - 1) >= 2K' (the same rule as RFC 5053)
+	H = max(10, ceil(log2 K'))
+	W = largest prime <= K' + S - floor(K' / 150), so that P grows with
+		K' much like it does in the RFC table
+	J = smallest index for which the K' source symbols can be solved with
+		the Rand() below
+
+	Replacing this table and Rand() with the RFC's is all that is needed for
+	wire compatibility.  The two must change together, since every J in
+	this table was searched for with the stand-in Rand().  The repair
+	symbols pinned by CheckRaptorQVector() in FECBench change with them.
+*/
+
+struct SystematicIndex
+{
+	u16 kp, j, s, h, w;	// K', J(K'), S(K'), H(K'), W(K')
+};
+
+static const SystematicIndex SYSTEMATIC_INDEX[] = {
+	{ 10, 0, 7, 10, 17 }, { 11, 0, 7, 10, 17 }, { 12, 0, 7, 10, 19 }, { 13, 0, 7, 10, 19 },
+	{ 14, 0, 7, 10, 19 }, { 15, 0, 7, 10, 19 }, { 16, 0, 11, 10, 23 }, { 17, 0, 11, 10, 23 },
+	{ 18, 0, 11, 10, 29 }, { 19, 0, 11, 10, 29 }, { 20, 0, 11, 10, 31 }, { 21, 0, 11, 10, 31 },
+	{ 22, 0, 11, 10, 31 }, { 23, 0, 11, 10, 31 }, { 24, 0, 11, 10, 31 }, { 25, 0, 11, 10, 31 },
+	{ 26, 0, 11, 10, 37 }, { 27, 0, 11, 10, 37 }, { 28, 0, 11, 10, 37 }, { 29, 0, 11, 10, 37 },
+	{ 30, 0, 11, 10, 41 }, { 31, 0, 11, 10, 41 }, { 32, 0, 11, 10, 43 }, { 33, 0, 11, 10, 43 },
+	{ 34, 0, 11, 10, 43 }, { 35, 0, 11, 10, 43 }, { 36, 0, 11, 10, 47 }, { 37, 0, 11, 10, 47 },
+	{ 38, 0, 11, 10, 47 }, { 39, 0, 11, 10, 47 }, { 40, 0, 11, 10, 47 }, { 41, 0, 11, 10, 47 },
+	{ 42, 0, 11, 10, 53 }, { 43, 0, 11, 10, 53 }, { 44, 0, 11, 10, 53 }, { 45, 0, 11, 10, 53 },
+	{ 46, 0, 13, 10, 59 }, { 47, 0, 13, 10, 59 }, { 48, 0, 13, 10, 61 }, { 49, 0, 13, 10, 61 },
+	{ 50, 0, 13, 10, 61 }, { 51, 0, 13, 10, 61 }, { 52, 0, 13, 10, 61 }, { 53, 0, 13, 10, 61 },
+	{ 54, 0, 13, 10, 67 }, { 55, 0, 13, 10, 67 }, { 56, 0, 13, 10, 67 }, { 57, 0, 13, 10, 67 },
+	{ 58, 0, 13, 10, 71 }, { 59, 0, 13, 10, 71 }, { 60, 0, 13, 10, 73 }, { 61, 0, 13, 10, 73 },
+	{ 62, 0, 13, 10, 73 }, { 63, 0, 13, 10, 73 }, { 64, 0, 13, 10, 73 }, { 65, 0, 13, 10, 73 },
+	{ 66, 0, 13, 10, 79 }, { 67, 0, 17, 10, 83 }, { 68, 0, 17, 10, 83 }, { 69, 0, 17, 10, 83 },
+	{ 70, 0, 17, 10, 83 }, { 71, 0, 17, 10, 83 }, { 72, 0, 17, 10, 89 }, { 73, 0, 17, 10, 89 },
+	{ 74, 0, 17, 10, 89 }, { 75, 0, 17, 10, 89 }, { 76, 0, 17, 10, 89 }, { 77, 0, 17, 10, 89 },
+	{ 78, 0, 17, 10, 89 }, { 79, 0, 17, 10, 89 }, { 80, 0, 17, 10, 97 }, { 81, 0, 17, 10, 97 },
+	{ 82, 0, 17, 10, 97 }, { 83, 0, 17, 10, 97 }, { 84, 0, 17, 10, 101 }, { 85, 0, 17, 10, 101 },
+	{ 86, 0, 17, 10, 103 }, { 87, 0, 17, 10, 103 }, { 88, 0, 17, 10, 103 }, { 89, 0, 17, 10, 103 },
+	{ 90, 0, 17, 10, 107 }, { 91, 0, 17, 10, 107 }, { 92, 0, 17, 10, 109 }, { 93, 0, 17, 10, 109 },
+	{ 94, 0, 17, 10, 109 }, { 95, 0, 17, 10, 109 }, { 96, 0, 17, 10, 113 }, { 97, 0, 17, 10, 113 },
+	{ 98, 0, 17, 10, 113 }, { 99, 0, 17, 10, 113 }, { 100, 0, 17, 10, 113 }, { 101, 0, 17, 10, 113 },
+	{ 102, 0, 17, 10, 113 }, { 103, 0, 17, 10, 113 }, { 104, 0, 17, 10, 113 }, { 105, 0, 17, 10, 113 },
+	{ 106, 0, 19, 10, 113 }, { 107, 0, 19, 10, 113 }, { 108, 0, 19, 10, 127 }, { 109, 0, 19, 10, 127 },
+	{ 110, 0, 19, 10, 127 }, { 111, 0, 19, 10, 127 }, { 112, 0, 19, 10, 131 }, { 113, 0, 19, 10, 131 },
+	{ 114, 0, 19, 10, 131 }, { 115, 0, 19, 10, 131 }, { 116, 0, 19, 10, 131 }, { 117, 0, 19, 10, 131 },
+	{ 118, 0, 19, 10, 137 }, { 119, 0, 19, 10, 137 }, { 120, 0, 19, 10, 139 }, { 121, 0, 19, 10, 139 },
+	{ 122, 0, 19, 10, 139 }, { 123, 0, 19, 10, 139 }, { 124, 0, 19, 10, 139 }, { 125, 0, 19, 10, 139 },
+	{ 126, 0, 19, 10, 139 }, { 127, 0, 19, 10, 139 }, { 128, 0, 19, 10, 139 }, { 130, 0, 19, 10, 149 },
+	{ 132, 0, 19, 10, 151 }, { 134, 0, 19, 10, 151 }, { 136, 0, 19, 10, 151 }, { 138, 0, 23, 10, 157 },
+	{ 140, 0, 23, 10, 163 }, { 142, 0, 23, 10, 163 }, { 144, 0, 23, 10, 167 }, { 146, 0, 23, 10, 167 },
+	{ 148, 0, 23, 10, 167 }, { 150, 0, 23, 10, 167 }, { 152, 0, 23, 10, 173 }, { 154, 0, 23, 10, 173 },
+	{ 156, 0, 23, 10, 173 }, { 158, 0, 23, 10, 179 }, { 160, 0, 23, 10, 181 }, { 162, 0, 23, 10, 181 },
+	{ 164, 0, 23, 10, 181 }, { 166, 0, 23, 10, 181 }, { 168, 0, 23, 10, 181 }, { 170, 0, 23, 10, 191 },
+	{ 172, 0, 23, 10, 193 }, { 174, 0, 23, 10, 193 }, { 176, 0, 23, 10, 197 }, { 178, 0, 23, 10, 199 },
+	{ 180, 0, 23, 10, 199 }, { 182, 0, 23, 10, 199 }, { 184, 0, 23, 10, 199 }, { 186, 0, 23, 10, 199 },
+	{ 188, 0, 23, 10, 199 }, { 190, 0, 23, 10, 211 }, { 192, 0, 23, 10, 211 }, { 195, 0, 23, 10, 211 },
+	{ 198, 0, 23, 10, 211 }, { 201, 0, 29, 10, 229 }, { 204, 0, 29, 10, 229 }, { 207, 0, 29, 10, 233 },
+	{ 210, 0, 29, 10, 233 }, { 213, 0, 29, 10, 241 }, { 216, 0, 29, 10, 241 }, { 219, 0, 29, 10, 241 },
+	{ 222, 0, 29, 10, 241 }, { 225, 0, 29, 10, 251 }, { 228, 0, 29, 10, 251 }, { 231, 0, 29, 10, 257 },
+	{ 234, 1, 29, 10, 257 }, { 237, 0, 29, 10, 263 }, { 240, 0, 29, 10, 263 }, { 243, 0, 29, 10, 271 },
+	{ 246, 0, 29, 10, 271 }, { 249, 0, 29, 10, 277 }, { 252, 0, 29, 10, 277 }, { 255, 0, 29, 10, 283 },
+	{ 258, 0, 29, 10, 283 }, { 262, 0, 29, 10, 283 }, { 266, 0, 29, 10, 293 }, { 270, 0, 29, 10, 293 },
+	{ 274, 0, 29, 10, 293 }, { 278, 0, 29, 10, 293 }, { 282, 0, 29, 10, 307 }, { 286, 0, 29, 10, 313 },
+	{ 290, 0, 29, 10, 317 }, { 294, 0, 29, 10, 317 }, { 298, 0, 29, 10, 317 }, { 302, 0, 31, 10, 331 },
+	{ 306, 0, 31, 10, 331 }, { 310, 0, 31, 10, 337 }, { 314, 0, 31, 10, 337 }, { 318, 0, 31, 10, 347 },
+	{ 322, 0, 31, 10, 349 }, { 327, 0, 31, 10, 353 }, { 332, 0, 31, 10, 359 }, { 337, 0, 31, 10, 359 },
+	{ 342, 0, 31, 10, 367 }, { 347, 0, 31, 10, 373 }, { 352, 0, 37, 10, 383 }, { 357, 0, 37, 10, 389 },
+	{ 362, 0, 37, 10, 397 }, { 367, 0, 37, 10, 401 }, { 372, 0, 37, 10, 401 }, { 377, 0, 37, 10, 409 },
+	{ 382, 0, 37, 10, 409 }, { 387, 0, 37, 10, 421 }, { 393, 0, 37, 10, 421 }, { 399, 0, 37, 10, 433 },
+	{ 405, 0, 37, 10, 439 }, { 411, 0, 37, 10, 443 }, { 417, 0, 37, 10, 449 }, { 423, 0, 37, 10, 457 },
+	{ 429, 0, 37, 10, 463 }, { 435, 0, 37, 10, 467 }, { 441, 0, 37, 10, 467 }, { 447, 0, 37, 10, 479 },
+	{ 453, 0, 37, 10, 487 }, { 460, 0, 37, 10, 491 }, { 467, 0, 37, 10, 499 }, { 474, 0, 37, 10, 503 },
+	{ 481, 0, 37, 10, 509 }, { 488, 0, 37, 10, 521 }, { 495, 0, 37, 10, 523 }, { 502, 0, 41, 10, 523 },
+	{ 509, 0, 41, 10, 547 }, { 516, 0, 41, 10, 547 }, { 524, 0, 41, 10, 557 }, { 532, 0, 41, 10, 569 },
+	{ 540, 0, 41, 10, 577 }, { 548, 0, 41, 10, 577 }, { 556, 0, 41, 10, 593 }, { 564, 0, 41, 10, 601 },
+	{ 572, 0, 41, 10, 607 }, { 580, 0, 41, 10, 617 }, { 589, 0, 41, 10, 619 }, { 598, 0, 43, 10, 631 },
+	{ 607, 0, 43, 10, 643 }, { 616, 0, 43, 10, 653 }, { 625, 0, 43, 10, 661 }, { 634, 0, 47, 10, 677 },
+	{ 643, 0, 47, 10, 683 }, { 653, 0, 47, 10, 691 }, { 663, 0, 47, 10, 701 }, { 673, 0, 47, 10, 709 },
+	{ 683, 0, 47, 10, 719 }, { 693, 0, 47, 10, 733 }, { 703, 0, 47, 10, 743 }, { 713, 0, 47, 10, 751 },
+	{ 724, 0, 47, 10, 761 }, { 735, 0, 47, 10, 773 }, { 746, 0, 53, 10, 787 }, { 757, 0, 53, 10, 797 },
+	{ 768, 0, 53, 10, 811 }, { 780, 0, 53, 10, 827 }, { 792, 0, 53, 10, 839 }, { 804, 0, 53, 10, 839 },
+	{ 816, 0, 53, 10, 863 }, { 828, 0, 53, 10, 863 }, { 840, 0, 53, 10, 887 }, { 853, 0, 53, 10, 887 },
+	{ 866, 0, 53, 10, 911 }, { 879, 0, 53, 10, 919 }, { 892, 0, 53, 10, 937 }, { 905, 0, 59, 10, 953 },
+	{ 919, 0, 59, 10, 971 }, { 933, 0, 59, 10, 983 }, { 947, 0, 59, 10, 997 }, { 961, 0, 59, 10, 1013 },
+	{ 976, 0, 59, 10, 1021 }, { 991, 0, 59, 10, 1039 }, { 1006, 0, 59, 10, 1051 }, { 1021, 0, 59, 10, 1069 },
+	{ 1036, 0, 59, 11, 1087 }, { 1052, 0, 59, 11, 1103 }, { 1068, 0, 59, 11, 1117 }, { 1084, 0, 59, 11, 1129 },
+	{ 1100, 0, 59, 11, 1151 }, { 1117, 0, 61, 11, 1171 }, { 1134, 0, 61, 11, 1187 }, { 1151, 0, 61, 11, 1201 },
+	{ 1168, 0, 61, 11, 1217 }, { 1186, 0, 67, 11, 1237 }, { 1204, 0, 67, 11, 1259 }, { 1222, 0, 67, 11, 1279 },
+	{ 1241, 0, 67, 11, 1297 }, { 1260, 0, 67, 11, 1319 }, { 1279, 0, 67, 11, 1327 }, { 1298, 0, 67, 11, 1327 },
+	{ 1318, 0, 67, 11, 1373 }, { 1338, 0, 67, 11, 1381 }, { 1358, 0, 67, 11, 1409 }, { 1379, 0, 71, 11, 1439 },
+	{ 1400, 0, 71, 11, 1459 }, { 1421, 0, 71, 11, 1483 }, { 1443, 0, 71, 11, 1499 }, { 1465, 0, 71, 11, 1523 },
+	{ 1487, 0, 71, 11, 1549 }, { 1510, 0, 73, 11, 1571 }, { 1533, 0, 73, 11, 1583 }, { 1556, 0, 73, 11, 1619 },
+	{ 1580, 0, 73, 11, 1637 }, { 1604, 0, 79, 11, 1669 }, { 1629, 0, 79, 11, 1697 }, { 1654, 0, 79, 11, 1721 },
+	{ 1679, 0, 79, 11, 1747 }, { 1705, 0, 79, 11, 1759 }, { 1731, 0, 79, 11, 1789 }, { 1758, 0, 79, 11, 1823 },
+	{ 1785, 0, 79, 11, 1847 }, { 1812, 0, 83, 11, 1879 }, { 1840, 0, 83, 11, 1907 }, { 1868, 0, 83, 11, 1933 },
+	{ 1897, 0, 83, 11, 1951 }, { 1926, 0, 83, 11, 1997 }, { 1956, 0, 89, 11, 2029 }, { 1986, 0, 89, 11, 2053 },
+	{ 2017, 0, 89, 11, 2089 }, { 2048, 0, 89, 11, 2113 }, { 2080, 0, 89, 12, 2153 }, { 2112, 0, 89, 12, 2179 },
+	{ 2145, 0, 89, 12, 2213 }, { 2178, 0, 89, 12, 2251 }, { 2212, 0, 97, 12, 2293 }, { 2246, 0, 97, 12, 2311 },
+	{ 2281, 0, 97, 12, 2357 }, { 2316, 0, 97, 12, 2393 }, { 2352, 0, 97, 12, 2423 }, { 2388, 0, 97, 12, 2467 },
+	{ 2425, 0, 97, 12, 2503 }, { 2462, 0, 97, 12, 2543 }, { 2500, 0, 97, 12, 2579 }, { 2539, 0, 101, 12, 2621 },
+	{ 2578, 0, 101, 12, 2659 }, { 2618, 0, 101, 12, 2699 }, { 2658, 0, 101, 12, 2741 }, { 2699, 0, 101, 12, 2777 },
+	{ 2741, 0, 103, 12, 2819 }, { 2783, 0, 107, 12, 2861 }, { 2826, 0, 107, 12, 2909 }, { 2870, 0, 107, 12, 2957 },
+	{ 2914, 0, 107, 12, 3001 }, { 2959, 0, 109, 12, 3049 }, { 3005, 0, 113, 12, 3089 }, { 3051, 0, 113, 12, 3137 },
+	{ 3098, 0, 113, 12, 3191 }, { 3146, 0, 113, 12, 3229 }, { 3195, 0, 113, 12, 3271 }, { 3244, 0, 127, 12, 3347 },
+	{ 3294, 0, 127, 12, 3391 }, { 3345, 0, 127, 12, 3449 }, { 3397, 0, 127, 12, 3499 }, { 3450, 0, 127, 12, 3547 },
+	{ 3503, 0, 127, 12, 3607 }, { 3557, 0, 127, 12, 3659 }, { 3612, 0, 127, 12, 3709 }, { 3668, 0, 127, 12, 3769 },
+	{ 3725, 0, 127, 12, 3823 }, { 3783, 0, 127, 12, 3881 }, { 3842, 0, 131, 12, 3947 }, { 3902, 0, 131, 12, 4007 },
+	{ 3962, 0, 131, 12, 4057 }, { 4023, 0, 137, 12, 4133 }, { 4085, 0, 137, 12, 4177 }, { 4148, 0, 137, 13, 4253 },
+	{ 4212, 0, 137, 13, 4297 }, { 4277, 0, 137, 13, 4373 }, { 4343, 0, 139, 13, 4451 }, { 4410, 0, 149, 13, 4523 },
+	{ 4478, 0, 149, 13, 4597 }, { 4547, 0, 149, 13, 4663 }, { 4618, 0, 149, 13, 4733 }, { 4690, 0, 149, 13, 4801 },
+	{ 4763, 0, 149, 13, 4877 }, { 4837, 0, 149, 13, 4951 }, { 4912, 0, 151, 13, 5023 }, { 4988, 0, 151, 13, 5101 },
+	{ 5065, 0, 157, 13, 5189 }, { 5144, 0, 157, 13, 5261 }, { 5224, 0, 157, 13, 5347 }, { 5305, 0, 163, 13, 5431 },
+	{ 5387, 0, 163, 13, 5507 }, { 5471, 0, 163, 13, 5591 }, { 5556, 0, 163, 13, 5669 }, { 5642, 0, 167, 13, 5749 },
+	{ 5730, 0, 167, 13, 5857 }, { 5819, 0, 173, 13, 5953 }, { 5909, 0, 173, 13, 6043 }, { 6001, 0, 173, 13, 6133 },
+	{ 6094, 0, 173, 13, 6221 }, { 6189, 0, 179, 13, 6323 }, { 6285, 0, 179, 13, 6421 }, { 6383, 0, 179, 13, 6491 },
+	{ 6482, 0, 181, 13, 6619 }, { 6583, 0, 191, 13, 6719 }, { 6685, 0, 191, 13, 6829 }, { 6789, 0, 191, 13, 6917 },
+	{ 6895, 0, 191, 13, 7039 }, { 7002, 0, 191, 13, 7129 }, { 7111, 0, 193, 13, 7253 }, { 7222, 0, 197, 13, 7369 },
+	{ 7334, 0, 197, 13, 7481 }, { 7448, 0, 199, 13, 7591 }, { 7564, 0, 211, 13, 7723 }, { 7682, 0, 211, 13, 7841 },
+	{ 7802, 0, 211, 13, 7951 }, { 7923, 0, 211, 13, 8081 }, { 8046, 0, 211, 13, 8191 }, { 8171, 0, 211, 13, 8317 },
+	{ 8298, 0, 223, 14, 8461 }, { 8427, 0, 223, 14, 8581 }, { 8558, 0, 223, 14, 8719 }, { 8691, 0, 223, 14, 8849 },
+	{ 8826, 0, 223, 14, 8971 }, { 8963, 0, 227, 14, 9127 }, { 9103, 0, 229, 14, 9257 }, { 9245, 0, 233, 14, 9413 },
+	{ 9389, 0, 233, 14, 9551 }, { 9535, 0, 239, 14, 9697 }, { 9683, 0, 239, 14, 9857 }, { 9834, 0, 241, 14, 10009 },
+	{ 9987, 0, 251, 14, 10169 }, { 10143, 0, 251, 14, 10321 }, { 10301, 0, 251, 14, 10477 }, { 10461, 0, 251, 14, 10639 },
+	{ 10624, 0, 257, 14, 10799 }, { 10790, 0, 257, 14, 10973 }, { 10958, 0, 263, 14, 11131 }, { 11129, 0, 263, 14, 11317 },
+	{ 11302, 0, 269, 14, 11491 }, { 11478, 0, 269, 14, 11657 }, { 11657, 0, 271, 14, 11839 }, { 11839, 0, 277, 14, 12037 },
+	{ 12023, 0, 277, 14, 12211 }, { 12210, 0, 281, 14, 12409 }, { 12400, 0, 283, 14, 12601 }, { 12593, 0, 293, 14, 12799 },
+	{ 12789, 0, 293, 14, 12983 }, { 12988, 0, 293, 14, 13187 }, { 13190, 0, 307, 14, 13399 }, { 13396, 0, 307, 14, 13613 },
+	{ 13605, 0, 307, 14, 13807 }, { 13817, 0, 307, 14, 14029 }, { 14032, 0, 311, 14, 14249 }, { 14251, 0, 313, 14, 14461 },
+	{ 14473, 0, 317, 14, 14683 }, { 14699, 0, 331, 14, 14929 }, { 14928, 0, 331, 14, 15149 }, { 15161, 0, 331, 14, 15391 },
+	{ 15397, 0, 331, 14, 15619 }, { 15637, 0, 337, 14, 15859 }, { 15881, 0, 347, 14, 16111 }, { 16129, 0, 347, 14, 16369 },
+	{ 16381, 0, 347, 14, 16619 }, { 16636, 0, 353, 15, 16879 }, { 16895, 0, 359, 15, 17137 }, { 17158, 0, 359, 15, 17401 },
+	{ 17426, 0, 367, 15, 17669 }, { 17698, 0, 367, 15, 17939 }, { 17974, 0, 373, 15, 18223 }, { 18254, 0, 379, 15, 18503 },
+	{ 18539, 0, 383, 15, 18797 }, { 18828, 0, 389, 15, 19087 }, { 19122, 0, 389, 15, 19381 }, { 19420, 0, 397, 15, 19687 },
+	{ 19723, 0, 401, 15, 19993 }, { 20031, 0, 409, 15, 20297 }, { 20343, 0, 409, 15, 20611 }, { 20660, 0, 419, 15, 20939 },
+	{ 20982, 0, 419, 15, 21247 }, { 21309, 0, 421, 15, 21587 }, { 21641, 0, 431, 15, 21911 }, { 21979, 0, 431, 15, 22259 },
+	{ 22322, 0, 439, 15, 22613 }, { 22670, 0, 443, 15, 22961 }, { 23024, 0, 449, 15, 23311 }, { 23383, 0, 457, 15, 23677 },
+	{ 23748, 0, 457, 15, 24043 }, { 24119, 0, 463, 15, 24421 }, { 24495, 0, 467, 15, 24799 }, { 24877, 0, 479, 15, 25189 },
+	{ 25265, 0, 479, 15, 25561 }, { 25659, 0, 487, 15, 25969 }, { 26059, 0, 491, 15, 26371 }, { 26466, 0, 499, 15, 26783 },
+	{ 26879, 0, 503, 15, 27197 }, { 27298, 0, 509, 15, 27617 }, { 27724, 0, 521, 15, 28057 }, { 28157, 0, 521, 15, 28477 },
+	{ 28596, 0, 541, 15, 28933 }, { 29042, 0, 541, 15, 29389 }, { 29495, 0, 541, 15, 29837 }, { 29955, 0, 547, 15, 30293 },
+	{ 30423, 0, 557, 15, 30773 }, { 30898, 0, 563, 15, 31253 }, { 31380, 0, 569, 15, 31729 }, { 31870, 0, 577, 15, 32233 },
+	{ 32367, 0, 587, 15, 32719 }, { 32872, 0, 587, 16, 33223 }, { 33385, 0, 593, 16, 33751 }, { 33906, 0, 601, 16, 34273 },
+	{ 34435, 0, 613, 16, 34819 }, { 34973, 0, 617, 16, 35353 }, { 35519, 0, 631, 16, 35911 }, { 36073, 0, 631, 16, 36457 },
+	{ 36636, 0, 641, 16, 37021 }, { 37208, 0, 647, 16, 37607 }, { 37789, 0, 659, 16, 38197 }, { 38379, 0, 673, 16, 38791 },
+	{ 38978, 0, 673, 16, 39383 }, { 39587, 0, 683, 16, 39989 }, { 40205, 0, 691, 16, 40627 }, { 40833, 0, 701, 16, 41257 },
+	{ 41471, 0, 709, 16, 41903 }, { 42118, 0, 719, 16, 42557 }, { 42776, 0, 727, 16, 43207 }, { 43444, 0, 733, 16, 43867 },
+	{ 44122, 0, 743, 16, 44563 }, { 44811, 0, 751, 16, 45263 }, { 45511, 0, 761, 16, 45959 }, { 46222, 0, 769, 16, 46681 },
+	{ 46944, 0, 787, 16, 47419 }, { 47677, 0, 787, 16, 48131 }, { 48421, 0, 797, 16, 48889 }, { 49177, 0, 809, 16, 49639 },
+	{ 49945, 0, 821, 16, 50423 }, { 50725, 0, 829, 16, 51203 }, { 51517, 0, 839, 16, 52009 }, { 52321, 0, 853, 16, 52817 },
+	{ 53138, 0, 859, 16, 53639 }, { 53968, 0, 877, 16, 54469 }, { 54811, 0, 881, 16, 55313 }, { 55667, 0, 907, 16, 56197 },
+	{ 56403, 0, 907, 16, 56929 }
+};
+
+static const u32 SYSTEMATIC_INDEX_COUNT = sizeof(SYSTEMATIC_INDEX) / sizeof(SYSTEMATIC_INDEX[0]);
+
+// Most columns in an LT row: degree is at most 30, plus at most 3 PI columns
+static const u32 MAX_LT_WEIGHT = 33;
+
+static bool IsPrime(u32 n)
+{
+	if (n < 2) return false;
+	if (n < 4) return true;
+	if ((n & 1) == 0) return false;
+
+	for (u32 d = 3; d * d <= n; d += 2)
+		if (n % d == 0) return false;
+
+	return true;
+}
+
+static u32 NextPrime(u32 n)
+{
+	while (!IsPrime(n)) ++n;
+	return n;
+}
+
+/*
+	Rand[y, i, m] (RFC 6330 section 5.3.5.1)
+
+	The RFC mixes four bytes of y through the published V0..V3 tables:
+
+		x0 = (y + i) mod 2^8
+		x1 = (floor(y / 2^8) + i) mod 2^8
+		x2 = (floor(y / 2^16) + i) mod 2^8
+		x3 = (floor(y / 2^24) + i) mod 2^8
+		Rand = (V0[x0] ^ V1[x1] ^ V2[x2] ^ V3[x3]) % m
+
+	This stand-in mixes y and i with the MurmurHash3 finalizer instead.
+*/
+static CAT_INLINE u32 Rand(u32 y, u32 i, u32 m)
+{
+	u32 x = y + i * 0x9E3779B9;
+	x ^= x >> 16;
+	x *= 0x85EBCA6B;
+	x ^= x >> 13;
+	x *= 0xC2B2AE35;
+	x ^= x >> 16;
+	return x % m;
+}
+
+// Degree distribution (RFC 6330 section 5.3.5.2)
+static const u32 DEGREE_DIST[31] = {
+	0, 5243, 529531, 704294, 791675, 844104, 879057, 904023,
+	922747, 937311, 948962, 958494, 966438, 973160, 978921,
+	983914, 988283, 992138, 995565, 998631, 1001391, 1003887,
+	1006157, 1008229, 1010129, 1011876, 1013490, 1014983,
+	1016370, 1017662, 1048576
+};
+
+static u32 Deg(u32 v, u32 w)
+{
+	u32 d = 1;
+	while (v >= DEGREE_DIST[d]) ++d;
+
+	return (d < w - 2) ? d : w - 2;
+}
+
+struct Codec::Tuple
+{
+	u32 d, a, b;		// LT symbols: count, step and first
+	u32 d1, a1, b1;		// PI symbols: count, step and first
+};
+
+void Codec::GenerateTuple(u32 isi, Tuple &tuple)
+{
+	u32 A = 53591 + _j * 997;
+	if (A % 2 == 0) ++A;
+	u32 B = 10267 * (_j + 1);
+	u32 y = B + isi * A;
+
+	tuple.d = Deg(Rand(y, 0, 1 << 20), _w);
+	tuple.a = 1 + Rand(y, 1, _w - 1);
+	tuple.b = Rand(y, 2, _w);
+	tuple.d1 = (tuple.d < 4) ? 2 + Rand(isi, 3, 2) : 2;
+	tuple.a1 = 1 + Rand(isi, 4, _p1 - 1);
+	tuple.b1 = Rand(isi, 5, _p1);
+}
+
+u32 Codec::GenerateLTColumns(u32 isi, u16 *cols)
+{
+	Tuple tuple;
+	GenerateTuple(isi, tuple);
+
+	const u32 w = _w, p = _p, p1 = _p1;
+	u32 count = 0;
+
+	// LT symbols
+	u32 b = tuple.b;
+	cols[count++] = (u16)b;
+	for (u32 jj = 1; jj < tuple.d; ++jj)
+	{
+		b = (b + tuple.a) % w;
+		cols[count++] = (u16)b;
+	}
+
+	// PI symbols, skipping the gap between P and P1
+	u32 b1 = tuple.b1;
+	while (b1 >= p) b1 = (b1 + tuple.a1) % p1;
+	cols[count++] = (u16)(w + b1);
+	for (u32 jj = 1; jj < tuple.d1; ++jj)
+	{
+		b1 = (b1 + tuple.a1) % p1;
+		while (b1 >= p) b1 = (b1 + tuple.a1) % p1;
+		cols[count++] = (u16)(w + b1);
+	}
+
+	return count;
+}
+
+void Codec::GenerateSymbol(u32 isi, u8 *symbol_out)
+{
+	const u32 symbol_bytes = _symbol_bytes;
+	u16 cols[MAX_LT_WEIGHT];
+	u32 count = GenerateLTColumns(isi, cols);
+
+	memcpy(symbol_out, _intermediate + symbol_bytes * cols[0], symbol_bytes);
+	for (u32 ii = 1; ii < count; ++ii)
+		memxor(symbol_out, _intermediate + symbol_bytes * cols[ii], symbol_bytes);
+}
+
+Result Codec::ChooseParameters(int message_bytes, int symbol_bytes)
+{
+	if (message_bytes <= 0 || symbol_bytes <= 0)
+		return R_BAD_INPUT;
+
+	u32 source_count = ((u32)message_bytes + symbol_bytes - 1) / symbol_bytes;
+	if (source_count > MAX_SOURCE_SYMBOLS)
+		return R_TOO_LARGE;
+
+	_final_bytes = message_bytes - (source_count - 1) * symbol_bytes;
+	_symbol_bytes = symbol_bytes;
+	_source_count = source_count;
+
+	// Round K up to the first K' in the table that holds it
+	u32 lo = 0, hi = SYSTEMATIC_INDEX_COUNT - 1;
+	while (lo < hi)
+	{
+		u32 mid = (lo + hi) / 2;
+
+		if (SYSTEMATIC_INDEX[mid].kp < source_count)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	const SystematicIndex *row = &SYSTEMATIC_INDEX[lo];
+
+	_padded_count = row->kp;
+	_j = row->j;
+	_s = row->s;
+	_h = row->h;
+	_w = row->w;
+	_l = _padded_count + _s + _h;
+	_p = _l - _w;
+	_p1 = NextPrime(_p);
+	_b = _w - _s;
+	_u = _p - _h;
+
+	return R_WIN;
+}
+
+u32 Codec::AddPaddingRows(u32 first_row)
+{
+	for (u32 isi = _source_count; isi < _padded_count; ++isi)
+	{
+		_row_isis[first_row] = isi;
+		_row_values[first_row++] = 0;
+	}
+
+	return first_row;
+}
+
+
+//// Solver
+
+/*
+	The intermediate symbols C[0..L-1] are solved from S LDPC rows, H HDPC
+	rows, and one LT row per known symbol (RFC 6330 section 5.3.3.4).
+	Columns W..L-1 are the PI symbols, which start out inactive.
+
+	1. Peeling: LDPC and LT rows are sparse and binary.  A row with one
+	   active column solves that column.  When no such row remains, the row
+	   with the fewest active columns keeps the one with the fewest
+	   references and its others are inactivated, as in section 5.4.2.2.
+	2. Dense rows: Each peeled column is a known value plus a sum of
+	   inactive columns, tracked as a bitmask.  Unused sparse rows and the
+	   HDPC rows are rewritten over the inactive columns only.  The HDPC
+	   rows are MT * GAMMA, and GAMMA is a running sum with a factor of
+	   alpha per column, so they are built in one pass over the columns.
+	3. Gaussian elimination over GF(256) solves the inactive columns.
+	4. Back-substitution in peeling order solves the peeled columns.
+*/
+
+enum ColumnMarks
+{
+	MARK_ACTIVE,	// Not solved yet
+	MARK_PEEL,		// Solved by peeling
+	MARK_INACTIVE	// Solved by Gaussian elimination
+};
+
+struct Codec::Solver
+{
+	// Sparse rows: S LDPC rows followed by the LT rows
+	u32 row_count;
+	u32 *row_start;			// Offset of the columns of each row, row_count + 1 entries
+	u16 *row_cols;			// Column indices of each row
+	u16 *row_weight;		// Number of active columns in each row
+	u8 *row_used;			// Non-zero if the row solved a peeled column
+
+	// Columns
+	u32 *col_start;			// Offset of the rows of each LT column, W + 1 entries
+	u32 *col_rows;			// Row indices of each LT column
+	u8 *col_mark;			// ColumnMarks for each column
+	u32 *col_row;			// Row that solved each peeled column
+	u16 *col_index;			// Peeling position of peeled columns, dense column of inactive columns
+	u16 *peel_order;		// Peeled columns in the order they were solved
+	u32 peel_count;
+	u16 *inactive_cols;		// Column for each dense column
+	u32 inactive_count;
+	u32 *queue;				// Rows waiting to be peeled
+
+	// Dense rows over the inactive columns
+	u32 mask_words;			// Words per peeled column mask
+	u64 *masks;				// Inactive columns summed into each peeled column, in peeling order
+	u32 dense_count;		// Number of dense rows
+	u32 *dense_order;		// Pivot order of dense rows
+	u8 *dense;				// Coefficients, inactive_count per row
+	u8 *dense_values;		// Symbol values, symbol bytes per row
+	u8 *gamma;				// Running HDPC sum of coefficients
+	u8 *gamma_value;		// Running HDPC sum of values
+};
+
+// Carve an array out of a workspace
+template<class T> static CAT_INLINE T *Carve(u8 *&workspace, u32 count)
+{
+	T *array = reinterpret_cast<T*>( workspace );
+	workspace += (count * sizeof(T) + 7) & ~(u32)7;
+	return array;
+}
+
+template<class T> static CAT_INLINE u32 CarveBytes(u32 count)
+{
+	return (count * sizeof(T) + 7) & ~(u32)7;
+}
+
+bool Codec::BuildRows(Solver &solver, u32 row_count)
+{
+	const u32 s = _s, w = _w, b = _b, p = _p, l = _l;
+	const u32 rows = s + row_count;
+	const u32 max_entries = 3 * b + 3 * s + row_count * MAX_LT_WEIGHT;
+
+	u32 bytes = CarveBytes<u32>(rows + 1) + CarveBytes<u32>(w + 1) + CarveBytes<u32>(max_entries)
+		+ CarveBytes<u32>(l) + CarveBytes<u32>(rows) + CarveBytes<u16>(max_entries)
+		+ CarveBytes<u16>(rows) + CarveBytes<u16>(l) + CarveBytes<u16>(w) + CarveBytes<u16>(l)
+		+ CarveBytes<u8>(rows) + CarveBytes<u8>(l);
+
+	if (!Reserve(_workspace, _workspace_allocated, bytes))
+		return false;
+
+	u8 *workspace = _workspace;
+	solver.row_count = rows;
+	solver.row_start = Carve<u32>(workspace, rows + 1);
+	solver.col_start = Carve<u32>(workspace, w + 1);
+	solver.col_rows = Carve<u32>(workspace, max_entries);
+	solver.col_row = Carve<u32>(workspace, l);
+	solver.queue = Carve<u32>(workspace, rows);
+	solver.row_cols = Carve<u16>(workspace, max_entries);
+	solver.row_weight = Carve<u16>(workspace, rows);
+	solver.col_index = Carve<u16>(workspace, l);
+	solver.peel_order = Carve<u16>(workspace, w);
+	solver.inactive_cols = Carve<u16>(workspace, l);
+	solver.row_used = Carve<u8>(workspace, rows);
+	solver.col_mark = Carve<u8>(workspace, l);
+
+	u32 *row_start = solver.row_start;
+	u16 *row_cols = solver.row_cols;
+	u32 *cursor = solver.queue;
+
+	// Count LDPC row entries (RFC 6330 section 5.3.3.3)
+	memset(row_start, 0, (s + 1) * sizeof(u32));
+	for (u32 ii = 0; ii < b; ++ii)
+	{
+		u32 a = 1 + ii / s, row = ii % s;
+		++row_start[row + 1];
+		row = (row + a) % s;
+		++row_start[row + 1];
+		row = (row + a) % s;
+		++row_start[row + 1];
+	}
+	for (u32 ii = 0; ii < s; ++ii)
+	{
+		row_start[ii + 1] += 3;
+		row_start[ii + 1] += row_start[ii];
+		cursor[ii] = row_start[ii];
+	}
+
+	// Fill LDPC rows: the LT columns in increasing order, then the identity and PI columns
+	for (u32 ii = 0; ii < b; ++ii)
+	{
+		u32 a = 1 + ii / s, row = ii % s;
+		row_cols[cursor[row]++] = (u16)ii;
+		row = (row + a) % s;
+		row_cols[cursor[row]++] = (u16)ii;
+		row = (row + a) % s;
+		row_cols[cursor[row]++] = (u16)ii;
+	}
+	for (u32 ii = 0; ii < s; ++ii)
+	{
+		u16 *cols = row_cols + cursor[ii];
+		cols[0] = (u16)(b + ii);
+		cols[1] = (u16)(w + ii % p);
+		cols[2] = (u16)(w + (ii + 1) % p);
+	}
+
+	// Sort each LDPC row and cancel repeated columns, which can appear for small S
+	u32 entries = 0;
+	for (u32 row = 0; row < s; ++row)
+	{
+		u16 *cols = row_cols + row_start[row];
+		u32 count = row_start[row + 1] - row_start[row];
+
+		// Insertion sort: rows are nearly sorted already
+		for (u32 ii = 1; ii < count; ++ii)
+		{
+			u16 col = cols[ii];
+			u32 jj = ii;
+			while (jj > 0 && cols[jj - 1] > col)
+			{
+				cols[jj] = cols[jj - 1];
+				--jj;
+			}
+			cols[jj] = col;
+		}
+
+		u32 first = entries;
+		for (u32 ii = 0; ii < count; ++ii)
+		{
+			if (ii + 1 < count && cols[ii] == cols[ii + 1])
+				++ii;
+			else
+				row_cols[entries++] = cols[ii];
+		}
+		row_start[row] = first;
+	}
+	row_start[s] = entries;
+
+	// LT rows
+	for (u32 row = 0; row < row_count; ++row)
+	{
+		entries += GenerateLTColumns(_row_isis[row], row_cols + entries);
+		row_start[s + row + 1] = entries;
+	}
+
+	// Count references to the LT columns and set row weights
+	u32 *col_start = solver.col_start;
+	memset(col_start, 0, (w + 1) * sizeof(u32));
+	for (u32 row = 0; row < rows; ++row)
+	{
+		u32 weight = 0;
+		for (u32 ii = row_start[row], end = row_start[row + 1]; ii < end; ++ii)
+		{
+			u16 col = row_cols[ii];
+			if (col < w)
+			{
+				++weight;
+				++col_start[col + 1];
+			}
+		}
+		solver.row_weight[row] = (u16)weight;
+	}
+	for (u32 col = 0; col < w; ++col)
+	{
+		col_start[col + 1] += col_start[col];
+		solver.col_row[col] = col_start[col];
+	}
+
+	// Fill column references
+	for (u32 row = 0; row < rows; ++row)
+	{
+		for (u32 ii = row_start[row], end = row_start[row + 1]; ii < end; ++ii)
+		{
+			u16 col = row_cols[ii];
+			if (col < w) solver.col_rows[solver.col_row[col]++] = row;
+		}
+	}
+
+	// PI columns start out inactive
+	memset(solver.row_used, 0, rows);
+	memset(solver.col_mark, MARK_ACTIVE, w);
+	memset(solver.col_mark + w, MARK_INACTIVE, p);
+	for (u32 ii = 0; ii < p; ++ii)
+	{
+		solver.col_index[w + ii] = (u16)ii;
+		solver.inactive_cols[ii] = (u16)(w + ii);
+	}
+	solver.inactive_count = p;
+	solver.peel_count = 0;
+
+	return true;
+}
+
+void Codec::PeelRows(Solver &solver)
+{
+	const u32 rows = solver.row_count, w = _w;
+	const u32 *row_start = solver.row_start, *col_start = solver.col_start, *col_rows = solver.col_rows;
+	const u16 *row_cols = solver.row_cols;
+	u16 *row_weight = solver.row_weight;
+	u8 *row_used = solver.row_used, *col_mark = solver.col_mark;
+	u32 *queue = solver.queue;
+	u32 head = 0, tail = 0;
+
+	// Each row is queued at most once: when its weight first reaches 1
+	for (u32 row = 0; row < rows; ++row)
+		if (row_weight[row] == 1) queue[tail++] = row;
+
+	u32 active_count = w;
+	while (active_count > 0)
+	{
+		// If a row is ready to peel,
+		if (head < tail)
+		{
+			u32 row = queue[head++];
+			if (row_used[row] || row_weight[row] != 1)
+				continue;
+
+			// Find its active column
+			u32 ii = row_start[row];
+			while (col_mark[row_cols[ii]] != MARK_ACTIVE) ++ii;
+			u16 col = row_cols[ii];
+
+			// Solve the column with this row
+			col_mark[col] = MARK_PEEL;
+			solver.col_row[col] = row;
+			solver.col_index[col] = (u16)solver.peel_count;
+			solver.peel_order[solver.peel_count++] = col;
+			row_used[row] = 1;
+			--active_count;
+
+			for (u32 jj = col_start[col], end = col_start[col + 1]; jj < end; ++jj)
+			{
+				u32 ref = col_rows[jj];
+				if (!row_used[ref] && --row_weight[ref] == 1)
+					queue[tail++] = ref;
+			}
+
+			continue;
+		}
+
+		// Find the unused row with the fewest active columns, at least two
+		u32 best_row = rows, best_weight = 0x10000;
+		for (u32 row = 0; row < rows; ++row)
+		{
+			u32 weight = row_weight[row];
+			if (!row_used[row] && weight >= 2 && weight < best_weight)
+			{
+				best_row = row;
+				best_weight = weight;
+				if (weight == 2) break;
+			}
+		}
+
+		// If no row can be peeled, the rest of the columns are left to elimination
+		if (best_row >= rows)
+		{
+			for (u32 col = 0; col < w; ++col)
+			{
+				if (col_mark[col] == MARK_ACTIVE)
+				{
+					col_mark[col] = MARK_INACTIVE;
+					solver.col_index[col] = (u16)solver.inactive_count;
+					solver.inactive_cols[solver.inactive_count++] = (u16)col;
+				}
+			}
+			break;
+		}
+
+		// Keep the active column with the fewest references
+		u32 keep = 0, keep_refs = 0xffffffff;
+		for (u32 ii = row_start[best_row], end = row_start[best_row + 1]; ii < end; ++ii)
+		{
+			u16 col = row_cols[ii];
+			if (col_mark[col] == MARK_ACTIVE && col_start[col + 1] - col_start[col] < keep_refs)
+			{
+				keep = col;
+				keep_refs = col_start[col + 1] - col_start[col];
+			}
+		}
+
+		// Inactivate the others, which leaves the row ready to peel
+		for (u32 ii = row_start[best_row], end = row_start[best_row + 1]; ii < end; ++ii)
+		{
+			u16 col = row_cols[ii];
+			if (col == keep || col_mark[col] != MARK_ACTIVE)
+				continue;
+
+			col_mark[col] = MARK_INACTIVE;
+			solver.col_index[col] = (u16)solver.inactive_count;
+			solver.inactive_cols[solver.inactive_count++] = col;
+			--active_count;
+
+			for (u32 jj = col_start[col], end2 = col_start[col + 1]; jj < end2; ++jj)
+			{
+				u32 ref = col_rows[jj];
+				if (!row_used[ref] && --row_weight[ref] == 1)
+					queue[tail++] = ref;
+			}
+		}
+	}
+}
+
+// Add a peeled column's mask of inactive columns into a row of GF(256) coefficients
+static CAT_INLINE void AddMask(u8 *coeffs, const u64 *mask, u32 words)
+{
+	for (u32 ii = 0; ii < words; ++ii)
+	{
+		u64 bits = mask[ii];
+		u8 *base = coeffs + ii * 64;
+
+		while (bits)
+		{
+			base[BSF64(bits)] ^= 1;
+			bits &= bits - 1;
+		}
+	}
+}
+
+bool Codec::BuildDenseRows(Solver &solver, bool values)
+{
+	const u32 s = _s, h = _h, w = _w, symbol_bytes = _symbol_bytes;
+	const u32 u = solver.inactive_count, words = (u + 63) / 64;
+	const u32 dense_count = solver.row_count - solver.peel_count + h;
+	const u32 value_bytes = values ? symbol_bytes : 0;
+
+	// Coefficient rows are padded so that AddMask() can clear whole words of bits
+	const u32 stride = words * 64;
+
+	u32 bytes = CarveBytes<u64>(solver.peel_count * words) + CarveBytes<u32>(dense_count)
+		+ CarveBytes<u8>(dense_count * stride) + CarveBytes<u8>(dense_count * value_bytes)
+		+ CarveBytes<u8>(stride) + CarveBytes<u8>(value_bytes);
+
+	if (!Reserve(_ge_workspace, _ge_allocated, bytes))
+		return false;
+
+	u8 *workspace = _ge_workspace;
+	solver.mask_words = words;
+	solver.masks = Carve<u64>(workspace, solver.peel_count * words);
+	solver.dense_count = dense_count;
+	solver.dense_order = Carve<u32>(workspace, dense_count);
+	solver.dense = Carve<u8>(workspace, dense_count * stride);
+	solver.dense_values = Carve<u8>(workspace, dense_count * value_bytes);
+	solver.gamma = Carve<u8>(workspace, stride);
+	solver.gamma_value = Carve<u8>(workspace, value_bytes);
+
+	const u32 *row_start = solver.row_start;
+	const u16 *row_cols = solver.row_cols;
+	const u8 *col_mark = solver.col_mark;
+	const u16 *col_index = solver.col_index;
+	u8 *intermediate = _intermediate;
+
+	// Express each peeled column as a value plus a sum of inactive columns, in peeling order
+	for (u32 pos = 0; pos < solver.peel_count; ++pos)
+	{
+		u16 col = solver.peel_order[pos];
+		u32 row = solver.col_row[col];
+		u64 *mask = solver.masks + pos * words;
+		memset(mask, 0, words * sizeof(u64));
+
+		u8 *dest = intermediate + symbol_bytes * col;
+		if (values)
+		{
+			const u8 *src = (row < s) ? 0 : _row_values[row - s];
+			if (src) memcpy(dest, src, symbol_bytes);
+			else memset(dest, 0, symbol_bytes);
+		}
+
+		for (u32 ii = row_start[row], end = row_start[row + 1]; ii < end; ++ii)
+		{
+			u16 other = row_cols[ii];
+			if (other == col) continue;
+
+			// Other columns were peeled earlier or are inactive
+			if (col_mark[other] == MARK_PEEL)
+			{
+				const u64 *other_mask = solver.masks + col_index[other] * words;
+				for (u32 jj = 0; jj < words; ++jj)
+					mask[jj] ^= other_mask[jj];
+
+				if (values) memxor(dest, intermediate + symbol_bytes * other, symbol_bytes);
+			}
+			else
+			{
+				u32 bit = col_index[other];
+				mask[bit >> 6] ^= (u64)1 << (bit & 63);
+			}
+		}
+	}
+
+	// Rewrite the unused sparse rows over the inactive columns
+	memset(solver.dense, 0, dense_count * stride);
+	u32 dense_row = 0;
+	for (u32 row = 0; row < solver.row_count; ++row)
+	{
+		if (solver.row_used[row]) continue;
+
+		u8 *coeffs = solver.dense + dense_row * stride;
+		u8 *value = solver.dense_values + dense_row * value_bytes;
+
+		if (values)
+		{
+			const u8 *src = (row < s) ? 0 : _row_values[row - s];
+			if (src) memcpy(value, src, symbol_bytes);
+			else memset(value, 0, symbol_bytes);
+		}
+
+		for (u32 ii = row_start[row], end = row_start[row + 1]; ii < end; ++ii)
+		{
+			u16 col = row_cols[ii];
+
+			if (col_mark[col] == MARK_PEEL)
+			{
+				AddMask(coeffs, solver.masks + col_index[col] * words, words);
+				if (values) memxor(value, intermediate + symbol_bytes * col, symbol_bytes);
+			}
+			else
+				coeffs[col_index[col]] ^= 1;
+		}
+
+		++dense_row;
+	}
+
+	/*
+		HDPC rows: G_HDPC = MT * GAMMA over the first K' + S columns
+		(RFC 6330 section 5.3.3.3).  Row i sums MT[i][k] * Y[k], where
+		Y[k] = alpha * Y[k - 1] + C[k].  MT has two ones in each column
+		except the last, which is alpha^i.
+	*/
+	u8 *hdpc = solver.dense + dense_row * stride;
+	u8 *hdpc_values = solver.dense_values + dense_row * value_bytes;
+	u8 *gamma = solver.gamma, *gamma_value = solver.gamma_value;
+	memset(gamma, 0, stride);
+	if (values)
+	{
+		memset(hdpc_values, 0, h * symbol_bytes);
+		memset(gamma_value, 0, symbol_bytes);
+	}
+
+	const u32 gamma_cols = _padded_count + s;
+	for (u32 col = 0; col < gamma_cols; ++col)
+	{
+		OctMul(gamma, 2, u);
+		if (values) OctMul(gamma_value, 2, symbol_bytes);
+
+		if (col_mark[col] == MARK_PEEL)
+		{
+			AddMask(gamma, solver.masks + col_index[col] * words, words);
+			if (values) memxor(gamma_value, intermediate + symbol_bytes * col, symbol_bytes);
+		}
+		else
+			gamma[col_index[col]] ^= 1;
+
+		if (col + 1 < gamma_cols)
+		{
+			u32 i1 = Rand(col + 1, 6, h);
+			u32 i2 = (i1 + Rand(col + 1, 7, h - 1) + 1) % h;
+
+			memxor(hdpc + i1 * stride, gamma, u);
+			memxor(hdpc + i2 * stride, gamma, u);
+
+			if (values)
+			{
+				memxor(hdpc_values + i1 * symbol_bytes, gamma_value, symbol_bytes);
+				memxor(hdpc_values + i2 * symbol_bytes, gamma_value, symbol_bytes);
+			}
+		}
+		else
+		{
+			for (u32 ii = 0; ii < h; ++ii)
+			{
+				OctMulAdd(hdpc + ii * stride, gamma, OCT_EXP[ii], u);
+				if (values) OctMulAdd(hdpc_values + ii * symbol_bytes, gamma_value, OCT_EXP[ii], symbol_bytes);
+			}
+		}
+	}
+
+	// Identity part over the HDPC symbols, which are the last H PI columns
+	for (u32 ii = 0; ii < h; ++ii)
+		hdpc[ii * stride + col_index[w + _u + ii]] ^= 1;
+
+	return true;
+}
+
+bool Codec::EliminateDenseRows(Solver &solver, bool values)
+{
+	const u32 u = solver.inactive_count, stride = solver.mask_words * 64;
+	const u32 dense_count = solver.dense_count, symbol_bytes = _symbol_bytes;
+	u32 *order = solver.dense_order;
+	u8 *dense = solver.dense, *dense_values = solver.dense_values;
+
+	if (dense_count < u)
+		return false;
+
+	for (u32 ii = 0; ii < dense_count; ++ii)
+		order[ii] = ii;
+
+	// Forward elimination
+	for (u32 col = 0; col < u; ++col)
+	{
+		// Find a pivot
+		u32 pivot_i = col;
+		while (pivot_i < dense_count && !dense[order[pivot_i] * stride + col])
+			++pivot_i;
+
+		if (pivot_i >= dense_count)
+			return false;
+
+		u32 pivot_row = order[pivot_i];
+		order[pivot_i] = order[col];
+		order[col] = pivot_row;
+
+		// Normalize it
+		u8 *pivot = dense + pivot_row * stride;
+		u8 *pivot_value = dense_values + pivot_row * symbol_bytes;
+		u8 inverse = OctInverse(pivot[col]);
+		OctMul(pivot + col, inverse, u - col);
+		if (values) OctMul(pivot_value, inverse, symbol_bytes);
+
+		// Eliminate the column from the rows below
+		for (u32 ii = col + 1; ii < dense_count; ++ii)
+		{
+			u32 row = order[ii];
+			u8 *coeffs = dense + row * stride;
+			u8 c = coeffs[col];
+
+			if (c)
+			{
+				OctMulAdd(coeffs + col, pivot + col, c, u - col);
+				if (values) OctMulAdd(dense_values + row * symbol_bytes, pivot_value, c, symbol_bytes);
+			}
+		}
+	}
+
+	if (!values)
+		return true;
+
+	// Back-substitution
+	for (u32 col = u; col-- > 1;)
+	{
+		const u8 *pivot_value = dense_values + order[col] * symbol_bytes;
+
+		for (u32 ii = 0; ii < col; ++ii)
+		{
+			u32 row = order[ii];
+			OctMulAdd(dense_values + row * symbol_bytes, pivot_value, dense[row * stride + col], symbol_bytes);
+		}
+	}
+
+	// Store the inactive columns
+	for (u32 col = 0; col < u; ++col)
+		memcpy(_intermediate + symbol_bytes * solver.inactive_cols[col], dense_values + order[col] * symbol_bytes, symbol_bytes);
+
+	return true;
+}
+
+void Codec::SubstitutePeeled(Solver &solver)
+{
+	const u32 s = _s, symbol_bytes = _symbol_bytes;
+	const u32 *row_start = solver.row_start;
+	const u16 *row_cols = solver.row_cols;
+	u8 *intermediate = _intermediate;
+
+	for (u32 pos = 0; pos < solver.peel_count; ++pos)
+	{
+		u16 col = solver.peel_order[pos];
+		u32 row = solver.col_row[col];
+		u8 *dest = intermediate + symbol_bytes * col;
+
+		const u8 *src = (row < s) ? 0 : _row_values[row - s];
+		if (src) memcpy(dest, src, symbol_bytes);
+		else memset(dest, 0, symbol_bytes);
+
+		for (u32 ii = row_start[row], end = row_start[row + 1]; ii < end; ++ii)
+		{
+			u16 other = row_cols[ii];
+			if (other != col) memxor(dest, intermediate + symbol_bytes * other, symbol_bytes);
+		}
+	}
+}
+
+Result Codec::Solve(u32 row_count, bool values)
+{
+	Solver solver;
+
+	if (!BuildRows(solver, row_count))
+		return R_OUT_OF_MEMORY;
+
+	PeelRows(solver);
+
+	if (values && !Reserve(_intermediate, _intermediate_allocated, _l * _symbol_bytes))
+		return R_OUT_OF_MEMORY;
+
+	if (!BuildDenseRows(solver, values))
+		return R_OUT_OF_MEMORY;
+
+	if (!EliminateDenseRows(solver, values))
+		return R_MORE_BLOCKS;
+
+	if (values) SubstitutePeeled(solver);
+
+	return R_WIN;
+}
+
+
+//// Memory Management
+
+Codec::Codec()
+{
+	InitializeOctets();
+
+	_symbol_bytes = 0;
+	_source_count = 0;
+	_j = 0;
+
+	_intermediate = 0;
+	_intermediate_allocated = 0;
+	_row_isis = 0;
+	_row_values = 0;
+	_rows_allocated = 0;
+	_workspace = 0;
+	_workspace_allocated = 0;
+	_ge_workspace = 0;
+	_ge_allocated = 0;
+
+	_message_in = 0;
+	_final_symbol = 0;
+	_final_allocated = 0;
+
+	_received = 0;
+	_received_allocated = 0;
+	_received_count = 0;
+	_source_slots = 0;
+	_slots_allocated = 0;
+	_source_received = 0;
+	_solved = false;
+}
+
+Codec::~Codec()
+{
+	FreeMemory();
+}
+
+void Codec::FreeMemory()
+{
+	delete []_intermediate;
+	delete []_row_isis;
+	delete []_row_values;
+	delete []_workspace;
+	delete []_ge_workspace;
+	delete []_final_symbol;
+	delete []_received;
+	delete []_source_slots;
+}
+
+bool Codec::Reserve(u8 *&buffer, u32 &allocated, u32 bytes, bool keep)
+{
+	// If already big enough,
+	if (allocated >= bytes)
+		return true;
+
+	// Grow by half again to avoid reallocating for each new symbol
+	u32 size = bytes + bytes / 2;
+	u8 *grown = new (std::nothrow) u8[size];
+	if (!grown) return false;
+
+	if (keep && buffer) memcpy(grown, buffer, allocated);
+
+	delete []buffer;
+	buffer = grown;
+	allocated = size;
+	return true;
+}
+
+bool Codec::ReserveRows(u32 count)
+{
+	// If already big enough,
+	if (_rows_allocated >= count)
+		return true;
+
+	u32 size = count + count / 2;
+	u32 *isis = new (std::nothrow) u32[size];
+	const u8 **values = new (std::nothrow) const u8*[size];
+	if (!isis || !values)
+	{
+		delete []isis;
+		delete []values;
+		return false;
+	}
+
+	// Keep the ISIs of rows set up so far
+	if (_row_isis) memcpy(isis, _row_isis, _rows_allocated * sizeof(u32));
+
+	delete []_row_isis;
+	delete []_row_values;
+	_row_isis = isis;
+	_row_values = values;
+	_rows_allocated = size;
+	return true;
+}
+
+bool Codec::ReserveReceived(u32 count)
+{
+	u32 bytes = count * _symbol_bytes;
+
+	// If already big enough,
+	if (_received_allocated >= bytes)
+		return true;
+
+	return Reserve(_received, _received_allocated, bytes, true);
+}
+
+bool Codec::ReserveSlots(u32 count)
+{
+	// If already big enough,
+	if (_slots_allocated >= count)
+		return true;
+
+	u32 *slots = new (std::nothrow) u32[count];
+	if (!slots) return false;
+
+	delete []_source_slots;
+	_source_slots = slots;
+	_slots_allocated = count;
+	return true;
+}
+
+
+//// Encoder Mode
+
+Result Codec::InitializeEncoder(const void *message_in, int message_bytes, int symbol_bytes)
+{
+	if (!message_in) return R_BAD_INPUT;
+
+	Result r = ChooseParameters(message_bytes, symbol_bytes);
+	if (r) return r;
+
+	const u32 source_count = _source_count, padded_count = _padded_count;
+	_message_in = reinterpret_cast<const u8*>( message_in );
+
+	if (!Reserve(_final_symbol, _final_allocated, _symbol_bytes) || !ReserveRows(padded_count))
+		return R_OUT_OF_MEMORY;
+
+	// Pad the final source symbol with zeroes
+	const u8 *final_symbol = _message_in + (source_count - 1) * _symbol_bytes;
+	memcpy(_final_symbol, final_symbol, _final_bytes);
+	memset(_final_symbol + _final_bytes, 0, _symbol_bytes - _final_bytes);
+
+	// Source symbols have ISI 0..K-1, followed by zero padding symbols
+	for (u32 isi = 0; isi < source_count - 1; ++isi)
+	{
+		_row_isis[isi] = isi;
+		_row_values[isi] = _message_in + isi * _symbol_bytes;
+	}
+	_row_isis[source_count - 1] = source_count - 1;
+	_row_values[source_count - 1] = _final_symbol;
+	AddPaddingRows(source_count);
+
+	r = Solve(padded_count, true);
+
+	// The systematic index guarantees that this succeeds
+	return (r == R_MORE_BLOCKS) ? R_BAD_SEED : r;
+}
+
+u32 Codec::Encode(u32 esi, void *symbol_out)
+{
+	u8 *out = reinterpret_cast<u8*>( symbol_out );
+
+	// If it is a source symbol, copy it from the message
+	if (esi < _source_count)
+	{
+		u32 bytes = (esi == _source_count - 1) ? _final_bytes : _symbol_bytes;
+		memcpy(out, _message_in + esi * _symbol_bytes, bytes);
+		return bytes;
+	}
+
+	GenerateSymbol(GetISI(esi), out);
+	return _symbol_bytes;
+}
+
+
+//// Decoder Mode
+
+Result Codec::InitializeDecoder(int message_bytes, int symbol_bytes)
+{
+	Result r = ChooseParameters(message_bytes, symbol_bytes);
+	if (r) return r;
+
+	const u32 source_count = _source_count;
+
+	if (!ReserveReceived(source_count + 2) || !ReserveRows(_padded_count + 2) ||
+		!Reserve(_final_symbol, _final_allocated, _symbol_bytes) || !ReserveSlots(source_count))
+	{
+		return R_OUT_OF_MEMORY;
+	}
+
+	for (u32 esi = 0; esi < source_count; ++esi)
+		_source_slots[esi] = NO_SLOT;
+
+	_received_count = 0;
+	_source_received = 0;
+	_solved = false;
+
+	return R_WIN;
+}
+
+/*
+	DecodeFeed
+
+		Received symbols are kept in order of arrival, and each one is an
+	LT row for the solver.  Once K symbols have arrived, the intermediate
+	symbols are solved from all of them on each new symbol until the
+	solver succeeds.  If all of the source symbols arrive, no solution is
+	needed at all.
+*/
+
+Result Codec::DecodeFeed(u32 esi, const void *symbol_in)
+{
+	if (!symbol_in) return R_BAD_INPUT;
+	if (_solved) return R_WIN;
+
+	const u32 source_count = _source_count, symbol_bytes = _symbol_bytes;
+
+	// If this source symbol was already received, ignore it
+	if (esi < source_count && _source_slots[esi] != NO_SLOT)
+		return R_MORE_BLOCKS;
+
+	u32 slot = _received_count;
+	if (!ReserveReceived(slot + 1) || !ReserveRows(slot + 1 + _padded_count - source_count))
+		return R_OUT_OF_MEMORY;
+
+	// Store the symbol, padding the final source symbol with zeroes
+	u8 *dest = _received + slot * symbol_bytes;
+	if (esi == source_count - 1)
+	{
+		memcpy(dest, symbol_in, _final_bytes);
+		memset(dest + _final_bytes, 0, symbol_bytes - _final_bytes);
+	}
+	else
+		memcpy(dest, symbol_in, symbol_bytes);
+
+	_row_isis[slot] = GetISI(esi);
+	_received_count = slot + 1;
+
+	if (esi < source_count)
+	{
+		_source_slots[esi] = slot;
+
+		// If every source symbol has arrived,
+		if (++_source_received == source_count)
+		{
+			_solved = true;
+			return R_WIN;
+		}
+	}
+
+	// If not enough symbols have arrived to solve yet,
+	if (_received_count < source_count)
+		return R_MORE_BLOCKS;
+
+	// Attempt to solve from all of the received symbols and the padding
+	for (u32 row = 0; row < _received_count; ++row)
+		_row_values[row] = _received + row * symbol_bytes;
+
+	Result r = Solve(AddPaddingRows(_received_count), true);
+	if (!r) _solved = true;
+	return r;
+}
+
+Result Codec::ReconstructOutput(void *message_out, u32 message_bytes)
+{
+	if (!message_out || message_bytes < (_source_count - 1) * _symbol_bytes + _final_bytes)
+		return R_BAD_INPUT;
+
+	u8 *out = reinterpret_cast<u8*>( message_out );
+	const u32 source_count = _source_count, symbol_bytes = _symbol_bytes;
+
+	for (u32 esi = 0; esi < source_count; ++esi, out += symbol_bytes)
+	{
+		u32 bytes = (esi == source_count - 1) ? _final_bytes : symbol_bytes;
+		u32 slot = _source_slots[esi];
+
+		// If the symbol was received, copy it
+		if (slot != NO_SLOT)
+			memcpy(out, _received + slot * symbol_bytes, bytes);
+		else if (bytes == symbol_bytes)
+			GenerateSymbol(esi, out);
+		else
+		{
+			// Regenerate the final symbol, which is only partly copied
+			GenerateSymbol(esi, _final_symbol);
+			memcpy(out, _final_symbol, bytes);
+		}
+	}
+
+	return R_WIN;
+}
+
+
+//// RaptorQ
+
+RaptorQ::RaptorQ()
+{
+	F = 0;
+	T = 0;
+	Z = 0;
+	N = 0;
+	Al = 0;
+	KL = KS = 0;
+	ZL = 0;
+}
+
+bool RaptorQ::Initialize(u64 transfer_bytes, u16 symbol_bytes, u16 alignment, u32 max_block_bytes)
+{
+	// Validate input (RFC 6330 section 4.3)
+	if (transfer_bytes == 0 || transfer_bytes >= ((u64)1 << 40) ||
+		alignment == 0 || symbol_bytes == 0 || symbol_bytes % alignment != 0)
+	{
+		return false;
+	}
+
+	// Largest source block in symbols
+	u32 max_k = max_block_bytes / symbol_bytes;
+	if (max_k > MAX_SOURCE_SYMBOLS) max_k = MAX_SOURCE_SYMBOLS;
+	if (max_k == 0) return false;
+
+	// Total symbols and source block count, which must fit in the 8-bit SBN
+	u64 kt = (transfer_bytes + symbol_bytes - 1) / symbol_bytes;
+	u64 z = (kt + max_k - 1) / max_k;
+	if (z > 256) return false;
+
+	F = transfer_bytes;
+	T = symbol_bytes;
+	Al = alignment;
+	Z = (u16)z;
+	N = 1;
+
+	// Partition[Kt, Z] (RFC 6330 section 4.4.1.2)
+	KL = (u32)((kt + z - 1) / z);
+	KS = (u32)(kt / z);
+	ZL = (u16)(kt - (u64)KS * z);
+
+	return true;
+}
+
+bool RaptorQ::GetSourceBlock(u16 sbn, u64 &offset, u32 &bytes)
+{
+	if (sbn >= Z) return false;
+
+	// Large blocks come first
+	u64 first_symbol;
+	u32 k;
+	if (sbn < ZL)
+	{
+		first_symbol = (u64)sbn * KL;
+		k = KL;
+	}
+	else
+	{
+		first_symbol = (u64)ZL * KL + (u64)(sbn - ZL) * KS;
+		k = KS;
+	}
+
+	offset = first_symbol * T;
+
+	// The final block may be cut short by the end of the transfer
+	u64 remaining = F - offset;
+	u64 block_bytes = (u64)k * T;
+	bytes = (u32)((block_bytes < remaining) ? block_bytes : remaining);
+
+	return true;
+}
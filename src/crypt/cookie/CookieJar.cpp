@@ -31,6 +31,26 @@
 #include <cat/math/BitMath.hpp>
 using namespace cat;
 
+#if defined(CAT_HAS_AVX2)
+# include <immintrin.h>
+# define CAT_HAS_SIMD_COOKIES
+typedef __m256i Lanes;
+static const int LANE_COUNT = 8;
+# define LANES_ADD(a, b) _mm256_add_epi32(a, b)
+# define LANES_XOR(a, b) _mm256_xor_si256(a, b)
+# define LANES_ROL(a, n) _mm256_or_si256(_mm256_slli_epi32(a, n), _mm256_srli_epi32(a, 32 - (n)))
+# define LANES_STORE(p, a) _mm256_store_si256((__m256i*)(p), a)
+#elif defined(CAT_HAS_SSE2)
+# include <emmintrin.h>
+# define CAT_HAS_SIMD_COOKIES
+typedef __m128i Lanes;
+static const int LANE_COUNT = 4;
+# define LANES_ADD(a, b) _mm_add_epi32(a, b)
+# define LANES_XOR(a, b) _mm_xor_si128(a, b)
+# define LANES_ROL(a, n) _mm_or_si128(_mm_slli_epi32(a, n), _mm_srli_epi32(a, 32 - (n)))
+# define LANES_STORE(p, a) _mm_store_si128((__m128i*)(p), a)
+#endif
+
 // Initialize to a random 512-bit key on startup
 void CookieJar::Initialize(FortunaOutput *csprng)
 {
@@ -79,32 +99,23 @@ u32 CookieJar::Salsa6(u32 *x)
     return x[0] ^ x[5] ^ x[10] ^ x[15];
 }
 
-u32 CookieJar::Hash(u32 ip, u16 port, u32 epoch)
+void CookieJar::AddInput(u32 *x, int stride, u32 ip, u16 port, u32 epoch)
 {
-    u32 x[16];
-
-    memcpy(x, key, sizeof(x));
-
-    x[4] += ip;
-    x[6] += epoch;
-    x[8] += port;
-    x[10] += epoch;
-
-    return Salsa6(x);
+    x[4 * stride] += ip;
+    x[6 * stride] += epoch;
+    x[8 * stride] += port;
+    x[10 * stride] += epoch;
 }
 
-u32 CookieJar::Hash(const void *address_info, int bytes, u32 epoch)
+void CookieJar::AddInput(u32 *x, int stride, const void *address_info, int bytes, u32 epoch)
 {
-    u32 x[16];
-
-    memcpy(x, key, sizeof(x));
-
     // Add address info to the key one word at a time
     const u32 *info32 = (const u32 *)address_info;
-    u32 *y = &x[4];
+    u32 *y = &x[4 * stride];
     while (bytes >= 4)
     {
-        *y++ += *info32++;
+        *y += *info32++;
+        y += stride;
         bytes -= 4;
     }
 
@@ -117,12 +128,138 @@ u32 CookieJar::Hash(const void *address_info, int bytes, u32 epoch)
     case 1: *y += info8[0]; break;
     }
 
-    x[6] += epoch;
-    x[10] += epoch;
+    x[6 * stride] += epoch;
+    x[10 * stride] += epoch;
+}
+
+u32 CookieJar::Hash(u32 ip, u16 port, u32 epoch)
+{
+    u32 x[16];
+
+    memcpy(x, key, sizeof(x));
+
+    AddInput(x, 1, ip, port, epoch);
 
     return Salsa6(x);
 }
 
+u32 CookieJar::Hash(const void *address_info, int bytes, u32 epoch)
+{
+    u32 x[16];
+
+    memcpy(x, key, sizeof(x));
+
+    AddInput(x, 1, address_info, bytes, epoch);
+
+    return Salsa6(x);
+}
+
+#if defined(CAT_HAS_SIMD_COOKIES)
+
+// Salsa6 on LANES independent states, word-sliced so that x[ii] holds
+// word ii of every lane
+static void Salsa6Lanes(Lanes *x)
+{
+#define CAT_SALSA_STEP(a, b, c, r) x[a] = LANES_XOR(x[a], LANES_ROL(LANES_ADD(x[b], x[c]), r));
+
+    for (int ii = 6; ii > 0; ii -= 2)
+    {
+        CAT_SALSA_STEP(4, 0, 12, 7)
+        CAT_SALSA_STEP(8, 4, 0, 9)
+        CAT_SALSA_STEP(12, 8, 4, 13)
+        CAT_SALSA_STEP(0, 12, 8, 18)
+        CAT_SALSA_STEP(9, 5, 1, 7)
+        CAT_SALSA_STEP(13, 9, 5, 9)
+        CAT_SALSA_STEP(1, 13, 9, 13)
+        CAT_SALSA_STEP(5, 1, 13, 18)
+        CAT_SALSA_STEP(14, 10, 6, 7)
+        CAT_SALSA_STEP(2, 14, 10, 9)
+        CAT_SALSA_STEP(6, 2, 14, 13)
+        CAT_SALSA_STEP(10, 6, 2, 18)
+        CAT_SALSA_STEP(3, 15, 11, 7)
+        CAT_SALSA_STEP(7, 3, 15, 9)
+        CAT_SALSA_STEP(11, 7, 3, 13)
+        CAT_SALSA_STEP(15, 11, 7, 18)
+        CAT_SALSA_STEP(1, 0, 3, 7)
+        CAT_SALSA_STEP(2, 1, 0, 9)
+        CAT_SALSA_STEP(3, 2, 1, 13)
+        CAT_SALSA_STEP(0, 3, 2, 18)
+        CAT_SALSA_STEP(6, 5, 4, 7)
+        CAT_SALSA_STEP(7, 6, 5, 9)
+        CAT_SALSA_STEP(4, 7, 6, 13)
+        CAT_SALSA_STEP(5, 4, 7, 18)
+        CAT_SALSA_STEP(11, 10, 9, 7)
+        CAT_SALSA_STEP(8, 11, 10, 9)
+        CAT_SALSA_STEP(9, 8, 11, 13)
+        CAT_SALSA_STEP(10, 9, 8, 18)
+        CAT_SALSA_STEP(12, 15, 14, 7)
+        CAT_SALSA_STEP(13, 12, 15, 9)
+        CAT_SALSA_STEP(14, 13, 12, 13)
+        CAT_SALSA_STEP(15, 14, 13, 18)
+    }
+
+#undef CAT_SALSA_STEP
+
+    x[0] = LANES_XOR(LANES_XOR(x[0], x[5]), LANES_XOR(x[10], x[15]));
+}
+
+#endif // CAT_HAS_SIMD_COOKIES
+
+void CookieJar::HashBatch(const QueuedCookie *cookies, const u32 *epochs, u32 *hashes, int count)
+{
+#if defined(CAT_HAS_SIMD_COOKIES)
+    CAT_ALIGNED(32) u32 keyed[16 * LANE_COUNT];
+    CAT_ALIGNED(32) u32 x[16 * LANE_COUNT];
+    CAT_ALIGNED(32) u32 out[LANE_COUNT];
+
+    // Copy the key into every lane once
+    for (int ii = 0; ii < 16; ++ii)
+        for (int lane = 0; lane < LANE_COUNT; ++lane)
+            keyed[ii * LANE_COUNT + lane] = key[ii];
+
+    while (count > 0)
+    {
+        int used = count < LANE_COUNT ? count : LANE_COUNT;
+
+        memcpy(x, keyed, sizeof(x));
+
+        // Unused lanes hash the first cookie again and are ignored
+        for (int lane = 0; lane < LANE_COUNT; ++lane)
+        {
+            int index = lane < used ? lane : 0;
+            const QueuedCookie &cookie = cookies[index];
+
+            if (cookie.address_info)
+                AddInput(x + lane, LANE_COUNT, cookie.address_info, cookie.bytes, epochs[index]);
+            else
+                AddInput(x + lane, LANE_COUNT, cookie.ip, cookie.port, epochs[index]);
+        }
+
+        Lanes *v = (Lanes *)x;
+        Salsa6Lanes(v);
+        LANES_STORE(out, v[0]);
+
+        for (int lane = 0; lane < used; ++lane)
+            hashes[lane] = out[lane];
+
+        cookies += used;
+        epochs += used;
+        hashes += used;
+        count -= used;
+    }
+#else
+    for (int ii = 0; ii < count; ++ii)
+    {
+        const QueuedCookie &cookie = cookies[ii];
+
+        if (cookie.address_info)
+            hashes[ii] = Hash(cookie.address_info, cookie.bytes, epochs[ii]);
+        else
+            hashes[ii] = Hash(cookie.ip, cookie.port, epochs[ii]);
+    }
+#endif
+}
+
 u32 CookieJar::GetEpoch()
 {
     return Clock::msec_fast() / BIN_TIME;
@@ -130,8 +267,11 @@ u32 CookieJar::GetEpoch()
 
 u32 CookieJar::ReconstructEpoch(u32 cookie)
 {
-    u32 epoch = GetEpoch();
+    return ReconstructEpoch(cookie, GetEpoch());
+}
 
+u32 CookieJar::ReconstructEpoch(u32 cookie, u32 epoch)
+{
     u32 cookie_bin = cookie & BIN_MASK;
 
     // Attempt to reconstruct the epoch used to generate this cookie
@@ -167,3 +307,51 @@ bool CookieJar::Verify(const void *address_info, int bytes, u32 cookie)
 {
     return (Hash(address_info, bytes, ReconstructEpoch(cookie)) << 4) == (cookie & ~BIN_MASK);
 }
+
+void CookieJar::GenerateBatch(QueuedCookie *cookies, int count)
+{
+    static const int CHUNK = 64;
+    u32 epochs[CHUNK], hashes[CHUNK];
+
+    u32 epoch = GetEpoch();
+
+    for (int ii = 0; ii < CHUNK; ++ii)
+        epochs[ii] = epoch;
+
+    while (count > 0)
+    {
+        int chunk = count < CHUNK ? count : CHUNK;
+
+        HashBatch(cookies, epochs, hashes, chunk);
+
+        for (int ii = 0; ii < chunk; ++ii)
+            cookies[ii].cookie = (hashes[ii] << 4) | (epoch & BIN_MASK);
+
+        cookies += chunk;
+        count -= chunk;
+    }
+}
+
+void CookieJar::VerifyBatch(QueuedCookie *cookies, int count)
+{
+    static const int CHUNK = 64;
+    u32 epochs[CHUNK], hashes[CHUNK];
+
+    u32 epoch = GetEpoch();
+
+    while (count > 0)
+    {
+        int chunk = count < CHUNK ? count : CHUNK;
+
+        for (int ii = 0; ii < chunk; ++ii)
+            epochs[ii] = ReconstructEpoch(cookies[ii].cookie, epoch);
+
+        HashBatch(cookies, epochs, hashes, chunk);
+
+        for (int ii = 0; ii < chunk; ++ii)
+            cookies[ii].valid = (hashes[ii] << 4) == (cookies[ii].cookie & ~BIN_MASK);
+
+        cookies += chunk;
+        count -= chunk;
+    }
+}
@@ -37,9 +37,9 @@ Skein::~Skein()
 	CAT_SECURE_OBJCLR(Work);
 }
 
-void Skein::GenerateInitialState(int bits)
+void Skein::GenerateInitialState(int bits, u64 tree_info)
 {
-	u64 w[MAX_WORDS] = { getLE64(SCHEMA_VER), getLE64(bits), 0 };
+	u64 w[MAX_WORDS] = { getLE64(SCHEMA_VER), getLE64(bits), getLE64(tree_info) };
 
 	CAT_OBJCLR(State);
 
@@ -116,6 +116,7 @@ bool Skein::SetKey(ICryptHash *key_hash)
 	memcpy(State, parent->State, sizeof(State));
 	digest_bytes = parent->digest_bytes;
 	digest_words = parent->digest_words;
+	digest_bytes_shift = parent->digest_bytes_shift;
 	hash_func = parent->hash_func;
 
 	// The user will then call one of the Begin() functions below:
@@ -194,6 +195,9 @@ void Skein::Crunch(const void *_message, int bytes)
 		int eat_bytes = bytes - 1;
 
 		// Hash directly from the message
+		// NOTE: This advances the tweak by the whole run for each block, unlike the
+		// specification.  The tunnel handshake depends on it, so changing it is a
+		// wire change and is not made here
 		u32 hash_blocks = eat_bytes >> digest_bytes_shift;
 		u32 block_bytes = hash_blocks << digest_bytes_shift;
 		(this->*hash_func)(buffer, hash_blocks, block_bytes, State);
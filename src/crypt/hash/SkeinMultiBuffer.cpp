@@ -0,0 +1,537 @@
+/*
+	Copyright (c) 2012 Christopher A. Taylor.  All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	* Redistributions of source code must retain the above copyright notice,
+	  this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	* Neither the name of LibCat nor the names of its contributors may be used
+	  to endorse or promote products derived from this software without
+	  specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <cat/crypt/hash/SkeinMultiBuffer.hpp>
+#include <cat/port/EndianNeutral.hpp>
+using namespace cat;
+
+#if defined(CAT_ISA_X86) && !defined(CAT_HAS_AVX2) && defined(CAT_HAS_SSE2)
+// AVX2 lanes are built anyway and selected at runtime if the CPU has AVX2
+# if defined(CAT_COMPILER_MSVC) && (_MSC_VER >= 1700)
+#  define CAT_SKEIN_AVX2_DISPATCH
+#  define CAT_AVX2_TARGET
+# elif defined(__clang__) || (defined(CAT_COMPILER_GCC) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)))
+#  define CAT_SKEIN_AVX2_DISPATCH
+#  define CAT_AVX2_TARGET __attribute__((target("avx2")))
+# endif
+#elif defined(CAT_HAS_AVX2)
+# define CAT_AVX2_TARGET
+#endif
+
+#if defined(CAT_HAS_AVX2) || defined(CAT_SKEIN_AVX2_DISPATCH)
+# include <immintrin.h>
+# define CAT_SKEIN_LANES_AVX2
+# define CAT_SKEIN_LANES_SIMD
+#endif
+
+#if defined(CAT_HAS_SSE2) && !defined(CAT_HAS_AVX2)
+# include <emmintrin.h>
+# define CAT_SKEIN_LANES_SSE2
+# define CAT_SKEIN_LANES_SIMD
+#endif
+
+#if defined(CAT_SKEIN_AVX2_DISPATCH)
+# if defined(CAT_COMPILER_MSVC)
+#  include <intrin.h>
+# else
+#  include <cpuid.h>
+# endif
+#endif
+
+
+#if defined(CAT_SKEIN_LANES_SIMD)
+
+static const int LANES = SkeinMultiBuffer::MAX_LANES;
+
+// Threefish key schedule parity constant, the same as Skein::KS_PARITY
+static const u64 KS_PARITY = 0x1BD11BDAA9FC1A22ULL;
+
+
+//// AVX2 lanes
+
+#if defined(CAT_SKEIN_LANES_AVX2)
+
+namespace SkeinLanesAVX2 {
+
+// One 64-bit word from each of the four lanes in one 256-bit register
+typedef __m256i Lanes;
+
+CAT_AVX2_TARGET static CAT_INLINE Lanes LanesLoad(const u64 *w) { return _mm256_loadu_si256((const __m256i *)w); }
+CAT_AVX2_TARGET static CAT_INLINE void LanesStore(u64 *w, Lanes x) { _mm256_storeu_si256((__m256i *)w, x); }
+CAT_AVX2_TARGET static CAT_INLINE Lanes LanesSet(u64 w) { return _mm256_set1_epi64x((long long)w); }
+CAT_AVX2_TARGET static CAT_INLINE Lanes LanesAdd(Lanes a, Lanes b) { return _mm256_add_epi64(a, b); }
+CAT_AVX2_TARGET static CAT_INLINE Lanes LanesXor(Lanes a, Lanes b) { return _mm256_xor_si256(a, b); }
+CAT_AVX2_TARGET static CAT_INLINE Lanes LanesRol(Lanes x, int r) { return _mm256_or_si256(_mm256_slli_epi64(x, r), _mm256_srli_epi64(x, 64 - r)); }
+
+#define CAT_SKEIN_LANES_TARGET CAT_AVX2_TARGET
+#include "SkeinMultiBufferLanes.inc"
+#undef CAT_SKEIN_LANES_TARGET
+
+} // namespace SkeinLanesAVX2
+
+#endif // CAT_SKEIN_LANES_AVX2
+
+
+//// SSE2 lanes
+
+#if defined(CAT_SKEIN_LANES_SSE2)
+
+namespace SkeinLanesSSE2 {
+
+// One 64-bit word from each of the four lanes in two 128-bit registers
+struct Lanes { __m128i lo, hi; };
+
+static CAT_INLINE Lanes LanesLoad(const u64 *w)
+{
+	Lanes x = { _mm_loadu_si128((const __m128i *)w), _mm_loadu_si128((const __m128i *)(w + 2)) };
+	return x;
+}
+static CAT_INLINE void LanesStore(u64 *w, Lanes x)
+{
+	_mm_storeu_si128((__m128i *)w, x.lo);
+	_mm_storeu_si128((__m128i *)(w + 2), x.hi);
+}
+static CAT_INLINE Lanes LanesSet(u64 w)
+{
+	__m128i v = _mm_set_epi32((u32)(w >> 32), (u32)w, (u32)(w >> 32), (u32)w);
+	Lanes x = { v, v };
+	return x;
+}
+static CAT_INLINE Lanes LanesAdd(Lanes a, Lanes b)
+{
+	Lanes x = { _mm_add_epi64(a.lo, b.lo), _mm_add_epi64(a.hi, b.hi) };
+	return x;
+}
+static CAT_INLINE Lanes LanesXor(Lanes a, Lanes b)
+{
+	Lanes x = { _mm_xor_si128(a.lo, b.lo), _mm_xor_si128(a.hi, b.hi) };
+	return x;
+}
+static CAT_INLINE Lanes LanesRol(Lanes a, int r)
+{
+	Lanes x = { _mm_or_si128(_mm_slli_epi64(a.lo, r), _mm_srli_epi64(a.lo, 64 - r)),
+				_mm_or_si128(_mm_slli_epi64(a.hi, r), _mm_srli_epi64(a.hi, 64 - r)) };
+	return x;
+}
+
+#define CAT_SKEIN_LANES_TARGET
+#include "SkeinMultiBufferLanes.inc"
+#undef CAT_SKEIN_LANES_TARGET
+
+} // namespace SkeinLanesSSE2
+
+#endif // CAT_SKEIN_LANES_SSE2
+
+
+//// Engine selection
+
+struct SkeinLanesEngine
+{
+	const char *name;
+	void (*threefish256)(const u64 State[][LANES], const u64 *Tweak0, u64 Tweak1, const u64 message[][LANES], u64 NextState[][LANES]);
+	void (*threefish512)(const u64 State[][LANES], const u64 *Tweak0, u64 Tweak1, const u64 message[][LANES], u64 NextState[][LANES]);
+};
+
+#if defined(CAT_SKEIN_LANES_AVX2)
+static const SkeinLanesEngine m_avx2_engine = {
+	"AVX2", SkeinLanesAVX2::Threefish256, SkeinLanesAVX2::Threefish512
+};
+#endif
+
+#if defined(CAT_SKEIN_LANES_SSE2)
+static const SkeinLanesEngine m_sse2_engine = {
+	"SSE2", SkeinLanesSSE2::Threefish256, SkeinLanesSSE2::Threefish512
+};
+#endif
+
+#if defined(CAT_SKEIN_AVX2_DISPATCH)
+
+// True if the CPU has AVX2 and the OS saves the YMM registers
+static bool HasAVX2()
+{
+	u32 regs[4], xcr0;
+
+#if defined(CAT_COMPILER_MSVC)
+	int info[4];
+
+	__cpuid(info, 0);
+	if (info[0] < 7) return false;
+
+	__cpuid(info, 1);
+	regs[2] = info[2];
+#else
+	if (__get_cpuid_max(0, 0) < 7) return false;
+
+	__cpuid(1, regs[0], regs[1], regs[2], regs[3]);
+#endif
+
+	// If the OS does not save the AVX registers (OSXSAVE and AVX bits),
+	if ((regs[2] & 0x18000000) != 0x18000000)
+		return false;
+
+#if defined(CAT_COMPILER_MSVC)
+	xcr0 = (u32)_xgetbv(0);
+
+	__cpuidex(info, 7, 0);
+	regs[1] = info[1];
+#else
+	u32 xcr0_high;
+	__asm__ __volatile__ ("xgetbv" : "=a" (xcr0), "=d" (xcr0_high) : "c" (0));
+
+	__cpuid_count(7, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+
+	// XMM and YMM state enabled, and AVX2 present
+	return (xcr0 & 6) == 6 && (regs[1] & (1 << 5)) != 0;
+}
+
+#endif // CAT_SKEIN_AVX2_DISPATCH
+
+static const SkeinLanesEngine *SelectEngine()
+{
+#if defined(CAT_HAS_AVX2)
+	return &m_avx2_engine;
+#elif defined(CAT_SKEIN_AVX2_DISPATCH)
+	return HasAVX2() ? &m_avx2_engine : &m_sse2_engine;
+#else
+	return &m_sse2_engine;
+#endif
+}
+
+// Selected on first use; racing threads all pick the same engine
+static const SkeinLanesEngine *m_engine = 0;
+
+static CAT_INLINE const SkeinLanesEngine *GetEngine()
+{
+	if (!m_engine)
+		m_engine = SelectEngine();
+
+	return m_engine;
+}
+
+void SkeinMultiBuffer::HashComputation256(const u64 message[][MAX_LANES], const u32 *byte_counts, u64 NextState[][MAX_LANES])
+{
+	// Key schedule: Tweak
+	for (int lane = 0; lane < MAX_LANES; ++lane)
+		Tweak0[lane] += byte_counts[lane];
+
+	GetEngine()->threefish256(State, Tweak0, Tweak1, message, NextState);
+
+	// Update tweak
+	Tweak1 &= ~Skein::T1_MASK_FIRST;
+}
+
+void SkeinMultiBuffer::HashComputation512(const u64 message[][MAX_LANES], const u32 *byte_counts, u64 NextState[][MAX_LANES])
+{
+	// Key schedule: Tweak
+	for (int lane = 0; lane < MAX_LANES; ++lane)
+		Tweak0[lane] += byte_counts[lane];
+
+	GetEngine()->threefish512(State, Tweak0, Tweak1, message, NextState);
+
+	// Update tweak
+	Tweak1 &= ~Skein::T1_MASK_FIRST;
+}
+
+const char *SkeinMultiBuffer::GetEngineName()
+{
+	return GetEngine()->name;
+}
+
+#else // CAT_SKEIN_LANES_SIMD
+
+// Without vector registers there is nothing to gain from interleaving the
+// lanes, so each active lane is run through the scalar compression function
+void SkeinMultiBuffer::ScalarComputation(const u64 message[][MAX_LANES], const u32 *byte_counts, u64 NextState[][MAX_LANES])
+{
+	Skein hash;
+	u64 block[MAX_WORDS], next[MAX_WORDS];
+
+	Skein::HashComputation scalar_func = (digest_bytes == 256 / 8) ?
+		&Skein::HashComputation256 : &Skein::HashComputation512;
+
+	for (int lane = 0; lane < lanes; ++lane)
+	{
+		for (int ii = 0; ii < digest_words; ++ii)
+		{
+			hash.State[ii] = State[ii][lane];
+			block[ii] = getLE(message[ii][lane]);
+		}
+
+		hash.Tweak[0] = Tweak0[lane];
+		hash.Tweak[1] = Tweak1;
+
+		(hash.*scalar_func)(block, 1, byte_counts[lane], next);
+
+		for (int ii = 0; ii < digest_words; ++ii)
+			NextState[ii][lane] = next[ii];
+
+		Tweak0[lane] = hash.Tweak[0];
+	}
+
+	// Update tweak
+	Tweak1 &= ~Skein::T1_MASK_FIRST;
+}
+
+void SkeinMultiBuffer::HashComputation256(const u64 message[][MAX_LANES], const u32 *byte_counts, u64 NextState[][MAX_LANES])
+{
+	ScalarComputation(message, byte_counts, NextState);
+}
+
+void SkeinMultiBuffer::HashComputation512(const u64 message[][MAX_LANES], const u32 *byte_counts, u64 NextState[][MAX_LANES])
+{
+	ScalarComputation(message, byte_counts, NextState);
+}
+
+const char *SkeinMultiBuffer::GetEngineName()
+{
+	return "Scalar";
+}
+
+#endif // CAT_SKEIN_LANES_SIMD
+
+
+//// SkeinMultiBuffer
+
+/*
+	The lane state, transposed blocks and outputs are whole words, so they are
+	cleared a word at a time.  CAT_SECURE_OBJCLR() stores a byte at a time,
+	which cost more than the Threefish rounds saved by batching small messages.
+*/
+#define CAT_SECURE_WORDCLR(obj) SecureClearWords(obj, sizeof(obj) / sizeof(u64))
+
+static CAT_INLINE void SecureClearWords(void *words, u32 count)
+{
+	volatile u64 *p = (volatile u64 *)words;
+
+	while (count--)
+		*p++ = 0;
+}
+
+SkeinMultiBuffer::~SkeinMultiBuffer()
+{
+	CAT_SECURE_WORDCLR(State);
+	CAT_SECURE_WORDCLR(Tweak0);
+}
+
+int SkeinMultiBuffer::CountBlocks(int bits, int bytes)
+{
+	int block_bytes = bits <= 256 ? 32 : 64;
+
+	// The final block is always held back for End(), even when it is empty
+	return bytes <= block_bytes ? 1 : (bytes + block_bytes - 1) / block_bytes;
+}
+
+void SkeinMultiBuffer::SetTweak(u64 t1)
+{
+	CAT_OBJCLR(Tweak0);
+	Tweak1 = t1;
+}
+
+bool SkeinMultiBuffer::BeginKey(int lane_count, int bits)
+{
+	// Borrow the cached initial states from the scalar implementation
+	Skein key;
+
+	if (!key.BeginKey(bits)) return false;
+	if (!SetKey(lane_count, &key)) return false;
+
+	// T1 = FIRST | KEY
+	SetTweak(Skein::T1_MASK_FIRST | ((u64)Skein::BLK_TYPE_KEY << Skein::T1_POS_BLK_TYPE));
+
+	return true;
+}
+
+bool SkeinMultiBuffer::SetKey(int lane_count, ICryptHash *key_hash)
+{
+	const Skein *parent = static_cast<const Skein *>(key_hash);
+	if (!parent || lane_count < 1 || lane_count > MAX_LANES) return false;
+
+	lanes = lane_count;
+	digest_bytes = parent->digest_bytes;
+	digest_words = parent->digest_words;
+
+	if (digest_bytes == 256 / 8)
+	{
+		digest_bytes_shift = 5;
+		hash_func = &SkeinMultiBuffer::HashComputation256;
+	}
+	else if (digest_bytes == 512 / 8)
+	{
+		digest_bytes_shift = 6;
+		hash_func = &SkeinMultiBuffer::HashComputation512;
+	}
+	else return false;
+
+	// Unused lanes are computed along with the others and ignored
+	for (int ii = 0; ii < MAX_WORDS; ++ii)
+		for (int lane = 0; lane < MAX_LANES; ++lane)
+			State[ii][lane] = parent->State[ii];
+
+	// The user will then call one of the Begin() functions below:
+
+	return true;
+}
+
+bool SkeinMultiBuffer::BeginMAC()
+{
+	// T1 = FIRST | MSG
+	SetTweak(Skein::T1_MASK_FIRST | ((u64)Skein::BLK_TYPE_MSG << Skein::T1_POS_BLK_TYPE));
+
+	return true;
+}
+
+bool SkeinMultiBuffer::BeginKDF()
+{
+	// T1 = FIRST | KDF
+	SetTweak(Skein::T1_MASK_FIRST | ((u64)Skein::BLK_TYPE_KDF << Skein::T1_POS_BLK_TYPE));
+
+	return true;
+}
+
+bool SkeinMultiBuffer::CrunchFinal(const void * const *messages, const int *bytes)
+{
+	const int bits = digest_bytes * 8;
+	int blocks = CountBlocks(bits, bytes[0]);
+
+	for (int lane = 1; lane < lanes; ++lane)
+		if (CountBlocks(bits, bytes[lane]) != blocks)
+			return false;
+
+	CAT_ALIGNED(32) u64 block[MAX_WORDS][MAX_LANES];
+	u64 words[MAX_WORDS];
+	u32 byte_counts[MAX_LANES] = { 0 };
+
+	CAT_OBJCLR(block);
+
+	for (int ii = 0; ii < blocks; ++ii)
+	{
+		const u32 offset = (u32)ii << digest_bytes_shift;
+
+		// Transpose this block of each message into the word-sliced layout
+		for (int lane = 0; lane < lanes; ++lane)
+		{
+			u32 copy_bytes = (u32)bytes[lane] - offset;
+			if (copy_bytes > (u32)digest_bytes)
+				copy_bytes = digest_bytes;
+
+			// Pad with zeroes
+			CAT_OBJCLR(words);
+			memcpy(words, (const u8 *)messages[lane] + offset, copy_bytes);
+
+			for (int jj = 0; jj < digest_words; ++jj)
+				block[jj][lane] = getLE(words[jj]);
+
+			byte_counts[lane] = copy_bytes;
+		}
+
+		// Final message hash
+		if (ii == blocks - 1)
+			Tweak1 |= Skein::T1_MASK_FINAL;
+
+		(this->*hash_func)(block, byte_counts, State);
+	}
+
+	CAT_SECURE_WORDCLR(block);
+	CAT_SECURE_WORDCLR(words);
+
+	output_block_counter = 0;
+
+	return true;
+}
+
+void SkeinMultiBuffer::Generate(void * const *out, int bytes, int strengthening_rounds)
+{
+	int lane_bytes[MAX_LANES] = { bytes, bytes, bytes, bytes };
+
+	Generate(out, lane_bytes, strengthening_rounds);
+}
+
+void SkeinMultiBuffer::Generate(void * const *out, const int *bytes, int strengthening_rounds)
+{
+	// Put the Skein generator in counter mode and generate WORDS at a time
+	CAT_ALIGNED(32) u64 FinalMessage[MAX_WORDS][MAX_LANES];
+	CAT_ALIGNED(32) u64 NextState[MAX_WORDS][MAX_LANES];
+	const u32 byte_counts[MAX_LANES] = { 8, 8, 8, 8 };
+	const u64 t1 = Skein::T1_MASK_FIRST | Skein::T1_MASK_FINAL | ((u64)Skein::BLK_TYPE_OUT << Skein::T1_POS_BLK_TYPE);
+
+	CAT_OBJCLR(FinalMessage);
+
+	// In strengthened mode, discard a number of rounds before producing real output
+	while (strengthening_rounds-- >= 1)
+	{
+		// T1 = FIRST | FINAL | OUT
+		SetTweak(t1);
+
+		for (int lane = 0; lane < MAX_LANES; ++lane)
+			FinalMessage[0][lane] = output_block_counter;
+
+		// Produce next output
+		(this->*hash_func)(FinalMessage, byte_counts, NextState);
+
+		// Next counter
+		++output_block_counter;
+	}
+
+	int max_bytes = 0;
+	for (int lane = 0; lane < lanes; ++lane)
+		if (max_bytes < bytes[lane])
+			max_bytes = bytes[lane];
+
+	for (int offset = 0; offset < max_bytes; offset += digest_bytes)
+	{
+		// T1 = FIRST | FINAL | OUT
+		SetTweak(t1);
+
+		for (int lane = 0; lane < MAX_LANES; ++lane)
+			FinalMessage[0][lane] = output_block_counter;
+
+		// Produce next output
+		(this->*hash_func)(FinalMessage, byte_counts, NextState);
+
+		// Copy however many bytes each lane wanted
+		for (int lane = 0; lane < lanes; ++lane)
+		{
+			int copy_bytes = bytes[lane] - offset;
+			if (copy_bytes <= 0) continue;
+			if (copy_bytes > digest_bytes) copy_bytes = digest_bytes;
+
+			u64 words[MAX_WORDS];
+			for (int ii = 0; ii < digest_words; ++ii)
+				words[ii] = getLE(NextState[ii][lane]);
+
+			memcpy((u8 *)out[lane] + offset, words, copy_bytes);
+			CAT_SECURE_WORDCLR(words);
+		}
+
+		// Next counter
+		++output_block_counter;
+	}
+
+	CAT_SECURE_WORDCLR(NextState);
+}
@@ -0,0 +1,399 @@
+/*
+	Copyright (c) 2012 Christopher A. Taylor.  All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	* Redistributions of source code must retain the above copyright notice,
+	  this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	* Neither the name of LibCat nor the names of its contributors may be used
+	  to endorse or promote products derived from this software without
+	  specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <cat/crypt/hash/SkeinTree.hpp>
+#include <cat/threads/WorkerThreads.hpp>
+#include <cat/threads/Atomic.hpp>
+#include <cat/port/EndianNeutral.hpp>
+#include <cat/math/BitMath.hpp>
+using namespace cat;
+
+
+//// SkeinTreeJob
+
+// One batch of leaves shared between the calling thread and the workers.
+// Workers that start after the batch is finished find no leaves left and
+// only drop their reference, so the job outlives the SkeinTree if needed
+namespace cat {
+
+struct SkeinTreeJob;
+
+struct SkeinTreeTask : WorkerBuffer
+{
+	SkeinTreeJob *job;
+};
+
+struct SkeinTreeJob
+{
+	SkeinTree *tree;
+	u32 leaf_count;
+	volatile u32 next_leaf, done_leaves, refs;
+	WaitableFlag finished;
+	SkeinTreeTask tasks[MAX_WORKER_THREADS];
+
+	void Work()
+	{
+		u32 hashed = 0;
+
+		// Claim leaves until none are left
+		for (;;)
+		{
+			u32 index = Atomic::Add(&next_leaf, 1);
+			if (index >= leaf_count) break;
+
+			tree->HashLeaf(index, leaf_count);
+			++hashed;
+		}
+
+		// If this thread hashed the last leaf,
+		if (hashed && Atomic::Add(&done_leaves, hashed) + hashed == leaf_count)
+			finished.Set();
+	}
+
+	void Release()
+	{
+		if (Atomic::Add(&refs, -1) == 1)
+			delete this;
+	}
+
+	void OnWork(ThreadLocalStorage &tls, const BatchSet &buffers)
+	{
+		for (BatchHead *node = buffers.head, *next; node; node = next)
+		{
+			next = node->batch_next;
+
+			SkeinTreeJob *job = static_cast<SkeinTreeTask*>( node )->job;
+
+			job->Work();
+			job->Release();
+		}
+	}
+};
+
+} // namespace cat
+
+
+//// SkeinTree
+
+SkeinTree::SkeinTree()
+{
+	_batch = 0;
+	_batch_digests = 0;
+	_levels = 0;
+}
+
+SkeinTree::~SkeinTree()
+{
+	Cleanup();
+}
+
+void SkeinTree::Cleanup()
+{
+	if (_batch)
+	{
+		delete []_batch;
+		_batch = 0;
+	}
+
+	if (_batch_digests)
+	{
+		delete []_batch_digests;
+		_batch_digests = 0;
+	}
+
+	if (_levels)
+	{
+		delete []_levels;
+		_levels = 0;
+	}
+}
+
+bool SkeinTree::BeginKey(int bits, u32 leaf_bytes, u32 fanout, bool use_workers)
+{
+	Cleanup();
+
+	if (bits != 256 && bits != 512) return false;
+
+	_digest_bytes = bits / 8;
+
+	// Validate tree shape
+	if (!CAT_IS_POWER_OF_2(leaf_bytes) || leaf_bytes < (u32)_digest_bytes * 2 || leaf_bytes > MAX_LEAF_BYTES)
+		return false;
+	if (!CAT_IS_POWER_OF_2(fanout) || fanout < 2 || fanout > MAX_FANOUT)
+		return false;
+
+	u32 leaf_log = BSR32(leaf_bytes / _digest_bytes);
+	u32 fanout_log = BSR32(fanout);
+
+	// Configuration block carries the tree parameters
+	u64 tree_info = leaf_log | ((u64)fanout_log << 8) | ((u64)MAX_HEIGHT << 16);
+
+	if (!_root.BeginKey(bits)) return false;
+	_root.GenerateInitialState(bits, tree_info);
+
+	_leaf_bytes = leaf_bytes;
+	_node_bytes = _digest_bytes * fanout;
+
+	// Leaves are level 1; enough levels to cover a 2^64 byte message
+	_level_count = 2 + (64 - BSR32(leaf_bytes) + fanout_log - 1) / fanout_log;
+	if (_level_count > MAX_LEVELS) _level_count = MAX_LEVELS;
+
+	// Enough leaves per batch to keep every worker and this thread busy
+	_worker_count = 0;
+	if (use_workers)
+	{
+		_worker_count = WorkerThreads::ref()->GetWorkerCount();
+		if (_worker_count > MAX_WORKER_THREADS) _worker_count = MAX_WORKER_THREADS;
+	}
+
+	_batch_leaves = 4 * (_worker_count + 1);
+	if (_batch_leaves * leaf_bytes > MAX_BATCH_BYTES)
+		_batch_leaves = MAX_BATCH_BYTES / leaf_bytes;
+	if (_batch_leaves < 1) _batch_leaves = 1;
+
+	_batch = new (std::nothrow) u8[_batch_leaves * leaf_bytes];
+	_batch_digests = new (std::nothrow) u8[_batch_leaves * _digest_bytes];
+	_levels = new (std::nothrow) u8[_level_count * _node_bytes];
+
+	if (!_batch || !_batch_digests || !_levels)
+	{
+		Cleanup();
+		return false;
+	}
+
+	_batch_used = 0;
+	_leaf_count = 0;
+	_top_level = 1;
+	CAT_OBJCLR(_level_used);
+	CAT_OBJCLR(_level_nodes);
+
+	return true;
+}
+
+void SkeinTree::HashNode(u32 level, u64 position, const void *data, u32 bytes, u8 *digest)
+{
+	Skein node;
+
+	node.SetKey(&_root);
+
+	// T1 = FIRST | MSG | level, T0 = byte position within this level
+	node.Tweak[0] = position;
+	node.Tweak[1] = Skein::T1_MASK_FIRST | ((u64)Skein::BLK_TYPE_MSG << Skein::T1_POS_BLK_TYPE) | ((u64)level << Skein::T1_POS_TREE_LVL);
+	node.used_bytes = 0;
+	node.output_prng_mode = false;
+
+	// NOTE: Skein::Crunch() advances the tweak by the whole run for each block of
+	// a multi-block run, so feed it a block at a time to follow the specification
+	const u8 *message = (const u8 *)data;
+	const u32 block_bytes = _digest_bytes;
+	while (bytes > block_bytes)
+	{
+		node.Crunch(message, block_bytes);
+		message += block_bytes;
+		bytes -= block_bytes;
+	}
+	node.Crunch(message, bytes);
+	node.End();
+
+	for (int ii = 0, words = _digest_bytes / 8; ii < words; ++ii)
+	{
+		u64 word = getLE(node.State[ii]);
+		memcpy(digest + ii * 8, &word, 8);
+	}
+}
+
+void SkeinTree::HashLeaf(u32 index, u32 leaf_count)
+{
+	u32 offset = index * _leaf_bytes;
+	u32 bytes = (index == leaf_count - 1) ? _batch_used - offset : _leaf_bytes;
+
+	HashNode(1, (_leaf_count + index) * _leaf_bytes, _batch + offset, bytes, _batch_digests + index * _digest_bytes);
+}
+
+void SkeinTree::HashBatch()
+{
+	// An empty message still has one empty leaf
+	u32 leaf_count = (_batch_used + _leaf_bytes - 1) / _leaf_bytes;
+	if (leaf_count == 0) leaf_count = 1;
+
+	u32 helpers = leaf_count - 1;
+	if (helpers > _worker_count) helpers = _worker_count;
+
+	SkeinTreeJob *job = 0;
+
+	if (helpers > 0)
+		job = new (std::nothrow) SkeinTreeJob;
+
+	// If there is nobody to share with,
+	if (!job)
+	{
+		for (u32 ii = 0; ii < leaf_count; ++ii)
+			HashLeaf(ii, leaf_count);
+	}
+	else
+	{
+		job->tree = this;
+		job->leaf_count = leaf_count;
+		job->next_leaf = 0;
+		job->done_leaves = 0;
+		job->refs = helpers + 1;
+
+		WorkerThreads *workers = WorkerThreads::ref();
+
+		for (u32 ii = 0; ii < helpers; ++ii)
+		{
+			SkeinTreeTask *task = &job->tasks[ii];
+			task->job = job;
+			task->callback.SetMember<SkeinTreeJob, &SkeinTreeJob::OnWork>(job);
+
+			workers->DeliverBuffers(WQPRIO_LO, ii, task);
+		}
+
+		// Help out, then wait for leaves still being hashed by the workers
+		job->Work();
+
+		while (job->done_leaves != leaf_count)
+			job->finished.Wait();
+
+		job->Release();
+	}
+
+	// Fold leaf digests into the tree in order
+	for (u32 ii = 0; ii < leaf_count; ++ii)
+		PushNode(1, _batch_digests + ii * _digest_bytes);
+
+	_leaf_count += leaf_count;
+	_batch_used = 0;
+}
+
+void SkeinTree::PushNode(u32 level, const u8 *digest)
+{
+	u8 parent[MAX_BYTES];
+
+	for (;;)
+	{
+		u8 *children = _levels + level * _node_bytes;
+
+		memcpy(children + _level_used[level], digest, _digest_bytes);
+		_level_used[level] += _digest_bytes;
+
+		if (_top_level < level)
+			_top_level = level;
+
+		// If this level does not have a full node yet,
+		if (_level_used[level] < _node_bytes || level + 1 >= _level_count)
+			break;
+
+		// Hash the full node into the next level up
+		HashNode(level + 1, _level_nodes[level + 1]++ * _node_bytes, children, _node_bytes, parent);
+		_level_used[level] = 0;
+
+		digest = parent;
+		++level;
+	}
+}
+
+void SkeinTree::Crunch(const void *_message, u32 bytes)
+{
+	const u8 *message = (const u8 *)_message;
+
+	while (bytes > 0)
+	{
+		u32 space;
+		u8 *buffer = GetCrunchBuffer(space);
+
+		u32 copy_bytes = bytes < space ? bytes : space;
+		memcpy(buffer, message, copy_bytes);
+		CrunchWritten(copy_bytes);
+
+		message += copy_bytes;
+		bytes -= copy_bytes;
+	}
+}
+
+u8 *SkeinTree::GetCrunchBuffer(u32 &space)
+{
+	space = _batch_leaves * _leaf_bytes - _batch_used;
+
+	return _batch + _batch_used;
+}
+
+void SkeinTree::CrunchWritten(u32 bytes)
+{
+	_batch_used += bytes;
+
+	// Only hash a full batch: a partial last leaf may still grow
+	if (_batch_used >= _batch_leaves * _leaf_bytes)
+		HashBatch();
+}
+
+void SkeinTree::End()
+{
+	// Hash the remaining leaves, or the single empty leaf of an empty message
+	if (_batch_used > 0 || _leaf_count == 0)
+		HashBatch();
+
+	// Hash the partial nodes left on each level, from the leaves up
+	u32 level = 1;
+	u8 parent[MAX_BYTES];
+
+	while (level < _top_level || _level_used[level] > (u32)_digest_bytes)
+	{
+		if (_level_used[level] > 0)
+		{
+			HashNode(level + 1, _level_nodes[level + 1]++ * _node_bytes, _levels + level * _node_bytes, _level_used[level], parent);
+			_level_used[level] = 0;
+
+			PushNode(level + 1, parent);
+		}
+
+		++level;
+	}
+
+	// The single digest left at the top is the tree root
+	const u8 *root = _levels + _top_level * _node_bytes;
+
+	_output.SetKey(&_root);
+
+	for (int ii = 0, words = _digest_bytes / 8; ii < words; ++ii)
+	{
+		u64 word;
+		memcpy(&word, root + ii * 8, 8);
+		_output.State[ii] = getLE(word);
+	}
+
+	_output.output_block_counter = 0;
+	_output.output_prng_mode = false;
+
+	CAT_SECURE_CLR(_levels, _level_count * _node_bytes);
+}
+
+void SkeinTree::Generate(void *out, int bytes)
+{
+	_output.Generate(out, bytes);
+}
@@ -27,7 +27,7 @@
 */
 
 #include <cat/crypt/pass/Passwords.hpp>
-#include <cat/crypt/hash/Skein.hpp>
+#include <cat/crypt/hash/SkeinMultiBuffer.hpp>
 #include <cat/lang/Strings.hpp>
 #include <cat/crypt/SecureEqual.hpp>
 using namespace cat;
@@ -88,6 +88,8 @@ bool PasswordVerifier::SaltHash(IRandom *prng,
 
 	*out_salt = prng->Generate();
 
+	// NOTE: This is H(I || S), while VerifyHash() checks H(S || I).  Stored
+	// verifiers depend on this order, so it is left alone here
 	if (!hash.BeginKey(HASH_BITS)) return false;
 	hash.Crunch(in_hash, HASH_BYTES);
 	hash.Crunch(out_salt, sizeof(*out_salt));
@@ -116,3 +118,61 @@ bool PasswordVerifier::VerifyHash(const void *in_hash /* 32 bytes */,
 
 	return cat::SecureEqual(in_salted_hash, Jp, HASH_BYTES);
 }
+
+bool PasswordVerifier::VerifyHashBatch(QueuedLogin *logins, int count)
+{
+#if defined(CAT_USER_ERROR_CHECKING)
+	if (!logins || count < 0) return false;
+#endif
+
+	const int MAX_LANES = SkeinMultiBuffer::MAX_LANES;
+	const int MESSAGE_BYTES = sizeof(u32) + HASH_BYTES;
+
+	u8 messages[MAX_LANES][MESSAGE_BYTES];
+	u8 Jp[MAX_LANES][HASH_BYTES];
+	const void *message_ptrs[MAX_LANES];
+	void *Jp_ptrs[MAX_LANES];
+	int message_bytes[MAX_LANES];
+
+	for (int lane = 0; lane < MAX_LANES; ++lane)
+	{
+		message_ptrs[lane] = messages[lane];
+		message_bytes[lane] = MESSAGE_BYTES;
+		Jp_ptrs[lane] = Jp[lane];
+	}
+
+	while (count > 0)
+	{
+		int lanes = count < MAX_LANES ? count : MAX_LANES;
+
+		// J' = H(S || I) for each login
+		for (int lane = 0; lane < lanes; ++lane)
+		{
+			QueuedLogin *login = logins + lane;
+
+#if defined(CAT_USER_ERROR_CHECKING)
+			if (!login->hash || !login->salted_hash) return false;
+#endif
+
+			memcpy(messages[lane], &login->salt, sizeof(u32));
+			memcpy(messages[lane] + sizeof(u32), login->hash, HASH_BYTES);
+		}
+
+		SkeinMultiBuffer hash;
+
+		if (!hash.BeginKey(lanes, HASH_BITS)) return false;
+		if (!hash.CrunchFinal(message_ptrs, message_bytes)) return false;
+		hash.Generate(Jp_ptrs, HASH_BYTES);
+
+		for (int lane = 0; lane < lanes; ++lane)
+			logins[lane].valid = cat::SecureEqual(logins[lane].salted_hash, Jp[lane], HASH_BYTES);
+
+		logins += lanes;
+		count -= lanes;
+	}
+
+	CAT_SECURE_OBJCLR(messages);
+	CAT_SECURE_OBJCLR(Jp);
+
+	return true;
+}
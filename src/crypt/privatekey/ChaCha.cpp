@@ -31,6 +31,10 @@
 #include <string.h>
 using namespace cat;
 
+#if defined(CAT_HAS_SSE2)
+# include <emmintrin.h>
+#endif
+
 static const int CAT_CHACHA_ROUNDS = 14; // Multiple of 2
 
 
@@ -199,5 +203,100 @@ void ChaChaOutput::Crypt(const void *in_bytes, void *out_bytes, int bytes)
 #endif
 }
 
+#if defined(CAT_HAS_SSE2)
+
+#define ROL_EPI32(x, n) _mm_or_si128(_mm_slli_epi32(x, n), _mm_srli_epi32(x, 32 - (n)))
+
+#define QUARTERROUND_SSE2(A,B,C,D)																		\
+	x[A] = _mm_add_epi32(x[A], x[B]); x[D] = ROL_EPI32(_mm_xor_si128(x[D], x[A]), 16);	\
+	x[C] = _mm_add_epi32(x[C], x[D]); x[B] = ROL_EPI32(_mm_xor_si128(x[B], x[C]), 12);	\
+	x[A] = _mm_add_epi32(x[A], x[B]); x[D] = ROL_EPI32(_mm_xor_si128(x[D], x[A]), 8);	\
+	x[C] = _mm_add_epi32(x[C], x[D]); x[B] = ROL_EPI32(_mm_xor_si128(x[B], x[C]), 7);
+
+// Four blocks at once: each register holds the same state word of all four blocks
+static void GenerateFourBlocks(const u32 state[16], u8 *out)
+{
+	__m128i s[16], x[16];
+
+	for (int ii = 0; ii < 16; ++ii)
+		s[ii] = _mm_set1_epi32(state[ii]);
+
+	// Block counters are state[12] + 1..4, caller ensures they do not carry
+	s[12] = _mm_add_epi32(s[12], _mm_set_epi32(4, 3, 2, 1));
+
+	for (int ii = 0; ii < 16; ++ii)
+		x[ii] = s[ii];
+
+	for (int round = CAT_CHACHA_ROUNDS; round > 0; round -= 2)
+	{
+		QUARTERROUND_SSE2(0, 4, 8,  12)
+		QUARTERROUND_SSE2(1, 5, 9,  13)
+		QUARTERROUND_SSE2(2, 6, 10, 14)
+		QUARTERROUND_SSE2(3, 7, 11, 15)
+		QUARTERROUND_SSE2(0, 5, 10, 15)
+		QUARTERROUND_SSE2(1, 6, 11, 12)
+		QUARTERROUND_SSE2(2, 7, 8,  13)
+		QUARTERROUND_SSE2(3, 4, 9,  14)
+	}
+
+	// Add state and transpose four words at a time back into block order
+	for (int ii = 0; ii < 16; ii += 4)
+	{
+		__m128i a = _mm_add_epi32(x[ii], s[ii]);
+		__m128i b = _mm_add_epi32(x[ii + 1], s[ii + 1]);
+		__m128i c = _mm_add_epi32(x[ii + 2], s[ii + 2]);
+		__m128i d = _mm_add_epi32(x[ii + 3], s[ii + 3]);
+
+		__m128i ab_lo = _mm_unpacklo_epi32(a, b), ab_hi = _mm_unpackhi_epi32(a, b);
+		__m128i cd_lo = _mm_unpacklo_epi32(c, d), cd_hi = _mm_unpackhi_epi32(c, d);
+
+		_mm_storeu_si128((__m128i*)(out + ii * 4), _mm_unpacklo_epi64(ab_lo, cd_lo));
+		_mm_storeu_si128((__m128i*)(out + 64 + ii * 4), _mm_unpackhi_epi64(ab_lo, cd_lo));
+		_mm_storeu_si128((__m128i*)(out + 128 + ii * 4), _mm_unpacklo_epi64(ab_hi, cd_hi));
+		_mm_storeu_si128((__m128i*)(out + 192 + ii * 4), _mm_unpackhi_epi64(ab_hi, cd_hi));
+	}
+}
+
+#undef QUARTERROUND_SSE2
+#undef ROL_EPI32
+
+#endif // CAT_HAS_SSE2
+
+void ChaChaOutput::GenerateKeyStream(void *out_bytes, int blocks)
+{
+	u8 *out = (u8 *)out_bytes;
+
+#if defined(CAT_HAS_SSE2)
+	// If the low counter word will not roll over, do four blocks at a time
+	while (blocks >= 4 && state[12] <= 0xfffffffb)
+	{
+		GenerateFourBlocks(state, out);
+		state[12] += 4;
+
+		out += 256;
+		blocks -= 4;
+	}
+#endif
+
+	while (blocks-- > 0)
+	{
+		if (!++state[12]) state[13]++;
+
+		register u32 x[16];
+
+		// Copy state into work registers
+		for (int ii = 0; ii < 16; ++ii)
+			x[ii] = state[ii];
+
+		CHACHA_MIX;
+
+		u32 *out32 = (u32 *)out;
+		for (int ii = 0; ii < 16; ++ii)
+			out32[ii] = getLE(x[ii] + state[ii]);
+
+		out += 64;
+	}
+}
+
 #undef QUARTERROUND
 #undef CHACHA_MIX
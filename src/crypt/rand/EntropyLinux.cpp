@@ -38,6 +38,8 @@ using namespace cat;
 #include <unistd.h>
 #include <stdio.h>
 
+static Clock *m_clock = 0;
+
 #if !defined(CAT_NO_ENTROPY_THREAD)
 
 bool FortunaFactory::Entrypoint(void *)
@@ -85,6 +87,8 @@ bool FortunaFactory::InitializeEntropySources()
 {
     urandom_fd = open("/dev/urandom", O_RDONLY);
 
+	m_clock = Clock::ref();
+
     // Fire poll for entropy all goes into pool 0
     PollInvariantSources(0);
     PollSlowEntropySources(0);
@@ -197,7 +201,7 @@ void FortunaFactory::PollSlowEntropySources(int pool_index)
         read(urandom_fd, Sources.system_prng, sizeof(Sources.system_prng));
 
     // Poll time in microseconds
-    Sources.this_request = Clock::usec();
+    Sources.this_request = m_clock->usec();
 
     // Time since last poll in microseconds
     static double last_request = 0;
@@ -225,7 +229,7 @@ void FortunaFactory::PollFastEntropySources(int pool_index)
     Sources.cycles_start = Clock::cycles();
 
     // Poll time in microseconds
-    Sources.this_request = Clock::usec();
+    Sources.this_request = m_clock->usec();
 
     // Time since last poll in microseconds
     static double last_request = 0;
@@ -53,14 +53,48 @@ void FortunaOutput::Reseed()
 {
 	m_factory->GetNextKey(this);
 
-	OutputHash.Generate(CachedRandomBytes, OUTPUT_CACHE_BYTES);
-	used_bytes = 0;
+	// Key the keystream from the freshly seeded Skein-PRNG
+	u8 key_material[KEY_BYTES];
+	OutputHash.Generate(key_material, sizeof(key_material));
+
+	ChaChaKey key;
+	key.Set(key_material, sizeof(key_material));
+	KeyStream.ReKey(key, 0);
+
+	CAT_SECURE_OBJCLR(key_material);
+
+	Refill();
+}
+
+void FortunaOutput::Refill()
+{
+	KeyStream.GenerateKeyStream(CachedRandomBytes, KEYSTREAM_BLOCKS);
+
+	// Re-key from the front of the batch so the old key cannot be recovered
+	ChaChaKey key;
+	key.Set(CachedRandomBytes, KEY_BYTES);
+	KeyStream.ReKey(key, 0);
+
+	CAT_SECURE_CLR(CachedRandomBytes, KEY_BYTES);
+	used_bytes = KEY_BYTES;
 }
 
 // Generate a 32-bit random number
 u32 FortunaOutput::Generate()
 {
 	u32 x;
+
+	// If the cache can fill this request, skip the general path
+	if (SeedRevision == m_factory->MasterSeedRevision &&
+		used_bytes <= OUTPUT_CACHE_BYTES - (int)sizeof(x))
+	{
+		u8 *cached = CachedRandomBytes + used_bytes;
+		memcpy(&x, cached, sizeof(x));
+		memset(cached, 0, sizeof(x));
+		used_bytes += sizeof(x);
+		return x;
+	}
+
 	Generate(&x, sizeof(x));
 	return x;
 }
@@ -71,35 +105,39 @@ void FortunaOutput::Generate(void *buffer, int bytes)
 	if (SeedRevision != m_factory->MasterSeedRevision)
 		Reseed();
 
-	int remaining = OUTPUT_CACHE_BYTES - used_bytes;
+	u8 *output = (u8*)buffer;
 
-	// If the cache can fill this request, just copy it out
-	if (bytes < remaining)
+	for (;;)
 	{
-		memcpy(buffer, CachedRandomBytes + used_bytes, bytes);
-		used_bytes += bytes;
-		return;
-	}
+		int remaining = OUTPUT_CACHE_BYTES - used_bytes;
+		u8 *cached = CachedRandomBytes + used_bytes;
 
-	// Copy as much as we can from what remains
-	memcpy(buffer, CachedRandomBytes + used_bytes, remaining);
-	bytes -= remaining;
-	u8 *output = (u8*)buffer + remaining;
+		// If the cache can fill the rest of this request, just copy it out
+		if (bytes <= remaining)
+		{
+			memcpy(output, cached, bytes);
+			CAT_SECURE_CLR(cached, bytes);
+			used_bytes += bytes;
+			return;
+		}
 
-	// Copy whole new blocks at a time
-	while (bytes >= OUTPUT_CACHE_BYTES)
-	{
-		OutputHash.Generate(output, OUTPUT_CACHE_BYTES);
-		bytes -= OUTPUT_CACHE_BYTES;
-		output += OUTPUT_CACHE_BYTES;
-	}
+		// Copy as much as we can from what remains
+		memcpy(output, cached, remaining);
+		CAT_SECURE_CLR(cached, remaining);
+		bytes -= remaining;
+		output += remaining;
 
-	// Generate a new cached block
-	OutputHash.Generate(CachedRandomBytes, OUTPUT_CACHE_BYTES);
+		// Write whole blocks straight to the output, then re-key on refill
+		int blocks = bytes / 64;
+		if (blocks > 0)
+		{
+			KeyStream.GenerateKeyStream(output, blocks);
+			bytes -= blocks * 64;
+			output += blocks * 64;
+		}
 
-	// Copy any remaining needed bytes
-	memcpy(output, CachedRandomBytes, bytes);
-	used_bytes = bytes;
+		Refill();
+	}
 }
 
 
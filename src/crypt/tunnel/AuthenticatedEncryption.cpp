@@ -27,6 +27,7 @@
 */
 
 #include <cat/crypt/tunnel/AuthenticatedEncryption.hpp>
+#include <cat/crypt/hash/SkeinMultiBuffer.hpp>
 #include <cat/port/EndianNeutral.hpp>
 #include <cat/crypt/SecureEqual.hpp>
 #include <cat/crypt/tunnel/KeyAgreement.hpp>
@@ -52,52 +53,65 @@ bool AuthenticatedEncryption::SetKey(int KeyBytes, Skein *key, bool is_initiator
 	key_hash.CrunchString(key_name);
     key_hash.End();
 
-	// MAC keys:
-
-	u8 mac_key[160];
-
-	if (!GenerateKey(CAT_KEYNAME_MAC(is_initiator), mac_key, sizeof(mac_key)))
-		return false;
-	_local_mac.SetKey(mac_key);
-
-	if (!GenerateKey(CAT_KEYNAME_MAC(!is_initiator), mac_key, sizeof(mac_key)))
-		return false;
-	_remote_mac.SetKey(mac_key);
+	// Derive all six session keys together, four at a time in a multi-buffer KDF:
+
+	u8 mac_keys[2][160];
+	u8 cipher_keys[2][KeyAgreementCommon::MAX_BYTES];
+
+	const char *key_names[6] = {
+		CAT_KEYNAME_MAC(is_initiator), CAT_KEYNAME_MAC(!is_initiator),
+		CAT_KEYNAME_CIPHER(is_initiator), CAT_KEYNAME_CIPHER(!is_initiator),
+		CAT_KEYNAME_IV(is_initiator), CAT_KEYNAME_IV(!is_initiator)
+	};
+	void *keys[6] = {
+		mac_keys[0], mac_keys[1],
+		cipher_keys[0], cipher_keys[1],
+		&local_iv, &remote_iv
+	};
+	const int key_bytes[6] = {
+		sizeof(mac_keys[0]), sizeof(mac_keys[1]),
+		KeyBytes, KeyBytes,
+		sizeof(local_iv), sizeof(remote_iv)
+	};
+
+	bool success = GenerateKeys(key_names, keys, key_bytes, 6);
+
+	if (success)
+	{
+		// MAC keys:
 
-	// Encryption keys:
+		_local_mac.SetKey(mac_keys[0]);
+		_remote_mac.SetKey(mac_keys[1]);
 
-	u8 cipher_key[KeyAgreementCommon::MAX_BYTES];
+		// Encryption keys:
 
-	if (!GenerateKey(CAT_KEYNAME_CIPHER(is_initiator), cipher_key, KeyBytes))
-		return false;
-    local_cipher_key.Set(cipher_key, KeyBytes);
+		local_cipher_key.Set(cipher_keys[0], KeyBytes);
+		remote_cipher_key.Set(cipher_keys[1], KeyBytes);
 
 #ifdef CAT_AUDIT
-	printf("AUDIT: local_cipher_key ");
-	for (int ii = 0; ii < KeyBytes; ++ii)
-	{
-		printf("%02x", (cat::u8)cipher_key[ii]);
-	}
-	printf("\n");
+		printf("AUDIT: local_cipher_key ");
+		for (int ii = 0; ii < KeyBytes; ++ii)
+		{
+			printf("%02x", (cat::u8)cipher_keys[0][ii]);
+		}
+		printf("\n");
+
+		printf("AUDIT: remote_cipher_key ");
+		for (int ii = 0; ii < KeyBytes; ++ii)
+		{
+			printf("%02x", (cat::u8)cipher_keys[1][ii]);
+		}
+		printf("\n");
 #endif
+	}
 
-	if (!GenerateKey(CAT_KEYNAME_CIPHER(!is_initiator), cipher_key, KeyBytes))
-		return false;
-	remote_cipher_key.Set(cipher_key, KeyBytes);
+	CAT_SECURE_OBJCLR(mac_keys);
+	CAT_SECURE_OBJCLR(cipher_keys);
 
-#ifdef CAT_AUDIT
-	printf("AUDIT: remote_cipher_key ");
-	for (int ii = 0; ii < KeyBytes; ++ii)
-	{
-		printf("%02x", (cat::u8)cipher_key[ii]);
-	}
-	printf("\n");
-#endif
+	if (!success) return false;
 
 	// Random IVs:
 
-	if (!GenerateKey(CAT_KEYNAME_IV(is_initiator), &local_iv, sizeof(local_iv)))
-		return false;
 	local_iv = getLE(local_iv);
 
 #ifdef CAT_AUDIT
@@ -109,8 +123,6 @@ bool AuthenticatedEncryption::SetKey(int KeyBytes, Skein *key, bool is_initiator
 	printf("\n");
 #endif
 
-	if (!GenerateKey(CAT_KEYNAME_IV(!is_initiator), &remote_iv, sizeof(remote_iv)))
-		return false;
 	remote_iv = getLE(remote_iv);
 
 #ifdef CAT_AUDIT
@@ -138,6 +150,41 @@ bool AuthenticatedEncryption::GenerateKey(const char *key_name, void *key, int b
 	return true;
 }
 
+bool AuthenticatedEncryption::GenerateKeys(const char * const *key_names, void * const *keys, const int *bytes, int count)
+{
+	const int MAX_LANES = SkeinMultiBuffer::MAX_LANES;
+
+	while (count > 0)
+	{
+		int lanes = count < MAX_LANES ? count : MAX_LANES;
+		int name_bytes[MAX_LANES];
+
+		// Key names are crunched with their nul-terminators, like CrunchString()
+		for (int lane = 0; lane < lanes; ++lane)
+			name_bytes[lane] = (int)strlen(key_names[lane]) + 1;
+
+		SkeinMultiBuffer kdf;
+
+		if (!kdf.SetKey(lanes, &key_hash)) return false;
+		if (!kdf.BeginKDF()) return false;
+		if (!kdf.CrunchFinal((const void * const *)key_names, name_bytes))
+		{
+			// Names spanning different numbers of blocks are derived one at a time
+			for (int lane = 0; lane < lanes; ++lane)
+				if (!GenerateKey(key_names[lane], keys[lane], bytes[lane]))
+					return false;
+		}
+		else kdf.Generate(keys, bytes);
+
+		key_names += lanes;
+		keys += lanes;
+		bytes += lanes;
+		count -= lanes;
+	}
+
+	return true;
+}
+
 bool AuthenticatedEncryption::GenerateProof(u8 *local_proof, int proof_bytes)
 {
     Skein mac;
@@ -0,0 +1,528 @@
+/*
+	Copyright (c) 2012 Christopher A. Taylor.  All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	* Redistributions of source code must retain the above copyright notice,
+	  this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	* Neither the name of LibCat nor the names of its contributors may be used
+	  to endorse or promote products derived from this software without
+	  specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <cat/db/BombayCache.hpp>
+#include <cat/mem/LargeAllocator.hpp>
+#include <cat/math/BitMath.hpp>
+#include <cat/io/Log.hpp>
+using namespace cat;
+using namespace bombay;
+
+// Hash 64-bit file offset to a 32-bit hash table key
+static CAT_INLINE u32 GetHash64(u64 key)
+{
+	key = (~key) + (key << 18);
+	key = key ^ (key >> 31);
+	key = key * 21;
+	key = key ^ (key >> 11);
+	key = key + (key << 6);
+	key = key ^ (key >> 22);
+	return (u32)key;
+}
+
+RecordCache::RecordCache()
+{
+	_record_bytes = 0;
+	_node_bytes = 0;
+	_cache_bytes = 0;
+	_stripes = 0;
+	_cache = 0;
+}
+
+RecordCache::~RecordCache()
+{
+	Finalize();
+}
+
+bool RecordCache::Initialize(u32 record_bytes, u32 cache_bytes)
+{
+	Finalize();
+
+	_record_bytes = record_bytes;
+
+	// Keep the record data following each node aligned to 8 bytes
+	u32 node_bytes = (u32)CAT_CEIL(sizeof(CacheNode) + record_bytes, 8);
+	_node_bytes = node_bytes;
+
+	// Divide the cache evenly between the stripes
+	u32 stripe_nodes = cache_bytes / node_bytes / CACHE_STRIPES;
+	if (stripe_nodes < MIN_STRIPE_NODES) stripe_nodes = MIN_STRIPE_NODES;
+
+	u32 stripe_bytes = stripe_nodes * node_bytes;
+	_cache_bytes = stripe_bytes * CACHE_STRIPES;
+
+	// Size the hash tables to about one node per bucket
+	u32 bucket_count = NextHighestPow2(stripe_nodes);
+
+	CAT_INFO("RecordCache") << "Allocating " << CACHE_STRIPES << " stripes of " << stripe_nodes << " records with " << bucket_count << "-element hash tables, for " << _cache_bytes << " bytes of cache memory";
+
+	_stripes = new (std::nothrow) Stripe[CACHE_STRIPES];
+	if (!_stripes) return false;
+
+	for (u32 ii = 0; ii < CACHE_STRIPES; ++ii)
+		_stripes[ii].buckets = 0;
+
+	// Allocate cache memory
+	_cache = (u8*)LargeAllocator::ref()->Acquire(_cache_bytes);
+	if (!_cache)
+	{
+		Finalize();
+		return false;
+	}
+
+	// For each stripe,
+	for (u32 ii = 0; ii < CACHE_STRIPES; ++ii)
+	{
+		Stripe *stripe = &_stripes[ii];
+
+		stripe->buckets = new (std::nothrow) CacheNode*[bucket_count];
+		if (!stripe->buckets)
+		{
+			Finalize();
+			return false;
+		}
+
+		CAT_CLR(stripe->buckets, bucket_count * sizeof(CacheNode*));
+		stripe->bucket_mask = bucket_count - 1;
+
+		CAT_OBJCLR(stripe->segments);
+		CAT_OBJCLR(stripe->stats);
+
+		stripe->protected_limit = stripe_nodes * PROTECTED_PERCENT / 100;
+
+		// Thread the stripe's nodes onto its free list
+		u8 *memory = _cache + ii * stripe_bytes;
+		CacheNode *free_head = 0;
+
+		for (u32 jj = stripe_nodes; jj > 0; --jj)
+		{
+			CacheNode *node = reinterpret_cast<CacheNode*>( memory + (jj - 1) * node_bytes );
+
+			node->offset = INVALID_RECORD_OFFSET;
+			node->pins = 0;
+			node->valid = 0;
+			node->dead = 0;
+			node->hash_next = free_head;
+			free_head = node;
+		}
+
+		stripe->free_head = free_head;
+	}
+
+	return true;
+}
+
+void RecordCache::Finalize()
+{
+	if (_stripes)
+	{
+		for (u32 ii = 0; ii < CACHE_STRIPES; ++ii)
+		{
+			if (_stripes[ii].buckets)
+				delete []_stripes[ii].buckets;
+		}
+
+		delete []_stripes;
+		_stripes = 0;
+	}
+
+	if (_cache)
+	{
+		LargeAllocator::ref()->Release(_cache);
+		_cache = 0;
+	}
+}
+
+CAT_INLINE RecordCache::Stripe *RecordCache::GetStripe(u64 offset, u32 &key)
+{
+	u32 hash = GetHash64(offset);
+
+	Stripe *stripe = &_stripes[hash & (CACHE_STRIPES - 1)];
+
+	// Use the bits above the stripe selector for the bucket
+	key = (hash / CACHE_STRIPES) & stripe->bucket_mask;
+
+	return stripe;
+}
+
+
+//// Hash chains
+
+CacheNode *RecordCache::FindNode(Stripe *stripe, u32 key, u64 offset)
+{
+	for (CacheNode *node = stripe->buckets[key]; node; node = node->hash_next)
+		if (node->offset == offset)
+			return node;
+
+	return 0;
+}
+
+void RecordCache::LinkNode(Stripe *stripe, u32 key, CacheNode *node)
+{
+	node->hash_next = stripe->buckets[key];
+	stripe->buckets[key] = node;
+}
+
+void RecordCache::UnlinkNode(Stripe *stripe, CacheNode *node)
+{
+	u32 key = (GetHash64(node->offset) / CACHE_STRIPES) & stripe->bucket_mask;
+
+	CacheNode **prev = &stripe->buckets[key];
+
+	// Walk the bucket chain to find the link that points at this node
+	while (*prev != node)
+		prev = &(*prev)->hash_next;
+
+	*prev = node->hash_next;
+}
+
+void RecordCache::FreeNode(Stripe *stripe, CacheNode *node)
+{
+	RemoveFromSegment(stripe, node);
+	UnlinkNode(stripe, node);
+
+	node->offset = INVALID_RECORD_OFFSET;
+	node->valid = 0;
+	node->dead = 0;
+	node->hash_next = stripe->free_head;
+	stripe->free_head = node;
+}
+
+
+//// Segment lists
+
+void RecordCache::PushHead(Stripe *stripe, u32 segment, CacheNode *node)
+{
+	Segment *seg = &stripe->segments[segment];
+
+	node->segment = (u8)segment;
+	node->prev = 0;
+	node->next = seg->head;
+
+	if (seg->head) seg->head->prev = node;
+	else seg->tail = node;
+
+	seg->head = node;
+	seg->count++;
+}
+
+void RecordCache::RemoveFromSegment(Stripe *stripe, CacheNode *node)
+{
+	Segment *seg = &stripe->segments[node->segment];
+
+	CacheNode *prev = node->prev, *next = node->next;
+
+	if (prev) prev->next = next;
+	else seg->head = next;
+
+	if (next) next->prev = prev;
+	else seg->tail = prev;
+
+	seg->count--;
+}
+
+void RecordCache::Touch(Stripe *stripe, CacheNode *node)
+{
+	RemoveFromSegment(stripe, node);
+
+	// If it is already protected,
+	if (node->segment == CACHE_SEG_PROTECTED)
+	{
+		// Just move it back to the head
+		PushHead(stripe, CACHE_SEG_PROTECTED, node);
+		return;
+	}
+
+	// Promote from probation to protected
+	PushHead(stripe, CACHE_SEG_PROTECTED, node);
+	stripe->stats.promotions++;
+
+	// If protected segment has overflowed,
+	Segment *prot = &stripe->segments[CACHE_SEG_PROTECTED];
+	if (prot->count > stripe->protected_limit)
+	{
+		// Demote its tail to the head of probation for a second chance
+		CacheNode *demoted = prot->tail;
+
+		RemoveFromSegment(stripe, demoted);
+		PushHead(stripe, CACHE_SEG_PROBATION, demoted);
+	}
+}
+
+CacheNode *RecordCache::AcquireNode(Stripe *stripe)
+{
+	// Use a free node if one is available
+	CacheNode *node = stripe->free_head;
+	if (node)
+	{
+		stripe->free_head = node->hash_next;
+		return node;
+	}
+
+	// Evict from the tail of probation first, then from the tail of protected
+	for (u32 segment = CACHE_SEG_PROBATION; segment < CACHE_SEG_COUNT; ++segment)
+	{
+		for (node = stripe->segments[segment].tail; node; node = node->prev)
+		{
+			// Skip nodes held by in-flight reads
+			if (node->pins) continue;
+
+			RemoveFromSegment(stripe, node);
+			UnlinkNode(stripe, node);
+
+			stripe->stats.evictions++;
+
+			return node;
+		}
+	}
+
+	return 0;
+}
+
+
+//// User Interface
+
+bool RecordCache::Lookup(u64 offset, void *data, bool &pinned)
+{
+	pinned = false;
+
+	u32 key;
+	Stripe *stripe = GetStripe(offset, key);
+
+	AutoMutex lock(stripe->lock);
+
+	CacheNode *node = FindNode(stripe, key, offset);
+
+	if (node)
+	{
+		// If the record is present,
+		if (node->valid)
+		{
+			memcpy(data, GetData(node), _record_bytes);
+
+			Touch(stripe, node);
+			stripe->stats.hits++;
+
+			return true;
+		}
+
+		// Another read is already in flight for this record: share its pin.
+		// If the record was removed meanwhile, this read will not be cached either
+		node->pins++;
+		stripe->stats.misses++;
+
+		pinned = true;
+		return false;
+	}
+
+	stripe->stats.misses++;
+
+	node = AcquireNode(stripe);
+	if (!node)
+	{
+		// Every node is pinned so the read will complete without a reservation
+		stripe->stats.pin_failures++;
+		return false;
+	}
+
+	// Reserve a pending node for the read
+	node->offset = offset;
+	node->pins = 1;
+	node->valid = 0;
+	node->dead = 0;
+
+	LinkNode(stripe, key, node);
+	PushHead(stripe, CACHE_SEG_PROBATION, node);
+
+	pinned = true;
+	return false;
+}
+
+bool RecordCache::Peek(u64 offset, void *data)
+{
+	u32 key;
+	Stripe *stripe = GetStripe(offset, key);
+
+	AutoMutex lock(stripe->lock);
+
+	CacheNode *node = FindNode(stripe, key, offset);
+	if (!node || !node->valid) return false;
+
+	memcpy(data, GetData(node), _record_bytes);
+
+	return true;
+}
+
+void RecordCache::Fill(u64 offset, void *data, bool pinned)
+{
+	u32 key;
+	Stripe *stripe = GetStripe(offset, key);
+
+	AutoMutex lock(stripe->lock);
+
+	CacheNode *node = FindNode(stripe, key, offset);
+
+	// If the read could not reserve a node,
+	if (!pinned)
+	{
+		// Only pick up a newer copy; any pending node belongs to another read
+		if (node && node->valid)
+			memcpy(data, GetData(node), _record_bytes);
+		return;
+	}
+
+	// Pinned nodes are never evicted or freed, so the node is still here
+	if (!node || !node->pins) return;
+
+	// If the record was removed while the read was in flight,
+	if (node->dead)
+	{
+		// Do not cache what was read, and free the node after the last read
+		if (--node->pins == 0)
+			FreeNode(stripe, node);
+		return;
+	}
+
+	// If the record was stored while the read was in flight,
+	if (node->valid)
+	{
+		// The cached copy is newer than what was read from disk
+		memcpy(data, GetData(node), _record_bytes);
+	}
+	else
+	{
+		memcpy(GetData(node), data, _record_bytes);
+		node->valid = 1;
+	}
+
+	node->pins--;
+}
+
+void RecordCache::Unpin(u64 offset)
+{
+	u32 key;
+	Stripe *stripe = GetStripe(offset, key);
+
+	AutoMutex lock(stripe->lock);
+
+	CacheNode *node = FindNode(stripe, key, offset);
+	if (!node || !node->pins) return;
+
+	// If this was the last pin on a record that never arrived or was removed,
+	if (--node->pins == 0 && (!node->valid || node->dead))
+	{
+		// Return the node to the free list
+		FreeNode(stripe, node);
+	}
+}
+
+void RecordCache::Store(u64 offset, const void *data)
+{
+	u32 key;
+	Stripe *stripe = GetStripe(offset, key);
+
+	AutoMutex lock(stripe->lock);
+
+	CacheNode *node = FindNode(stripe, key, offset);
+
+	if (node)
+	{
+		// Writing a cached record counts as a reference to it
+		Touch(stripe, node);
+
+		// A record stored after a removal is live again, and in-flight reads will return it
+		node->dead = 0;
+	}
+	else
+	{
+		node = AcquireNode(stripe);
+		if (!node) return;
+
+		node->offset = offset;
+		node->pins = 0;
+		node->dead = 0;
+
+		LinkNode(stripe, key, node);
+		PushHead(stripe, CACHE_SEG_PROBATION, node);
+	}
+
+	memcpy(GetData(node), data, _record_bytes);
+	node->valid = 1;
+}
+
+void RecordCache::Remove(u64 offset)
+{
+	u32 key;
+	Stripe *stripe = GetStripe(offset, key);
+
+	AutoMutex lock(stripe->lock);
+
+	CacheNode *node = FindNode(stripe, key, offset);
+	if (!node) return;
+
+	// If a read is in flight, mark the node dead so the read does not cache the old record
+	if (node->pins)
+	{
+		node->valid = 0;
+		node->dead = 1;
+		return;
+	}
+
+	FreeNode(stripe, node);
+}
+
+void RecordCache::GetStats(CacheStats &stats)
+{
+	CAT_OBJCLR(stats);
+
+	if (!_stripes) return;
+
+	// For each stripe,
+	for (u32 ii = 0; ii < CACHE_STRIPES; ++ii)
+	{
+		Stripe *stripe = &_stripes[ii];
+
+		AutoMutex lock(stripe->lock);
+
+		stats.hits += stripe->stats.hits;
+		stats.misses += stripe->stats.misses;
+		stats.evictions += stripe->stats.evictions;
+		stats.promotions += stripe->stats.promotions;
+		stats.pin_failures += stripe->stats.pin_failures;
+
+		// Count pinned and resident nodes
+		for (u32 segment = 0; segment < CACHE_SEG_COUNT; ++segment)
+		{
+			for (CacheNode *node = stripe->segments[segment].head; node; node = node->next)
+			{
+				if (node->pins) stats.pinned++;
+				if (node->valid) stats.resident++;
+			}
+		}
+	}
+}
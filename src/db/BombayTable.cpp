@@ -27,392 +27,143 @@
 */
 
 #include <cat/db/BombayTable.hpp>
-#include <cat/port/AlignedAlloc.hpp>
-#include <cat/io/Logging.hpp>
-#include <cat/math/BitMath.hpp>
+#include <cat/mem/StdAllocator.hpp>
+#include <cat/io/Log.hpp>
+#include <cat/threads/Atomic.hpp>
+#include <new>
 using namespace cat;
 using namespace bombay;
 
-// Hash 64-bit file offset to a 32-bit hash table key
-static CAT_INLINE u32 GetHash64(u64 key)
-{
-	key = (~key) + (key << 18);
-	key = key ^ (key >> 31);
-	key = key * 21;
-	key = key ^ (key >> 11);
-	key = key + (key << 6);
-	key = key ^ (key >> 22);
-	return (u32)key;
-}
-
-Table::Table(const char *file_path, u32 record_bytes, u32 cache_bytes, ShutdownObserver *shutdown_observer)
-	: AsyncFile(REFOBJ_PRIO_0+16)
-{
-	_shutdown_observer = shutdown_observer;
-	if (shutdown_observer)
-		shutdown_observer->AddRef();
-
-	CAT_STRNCPY(_file_path, file_path, sizeof(_file_path));
-	_record_bytes = record_bytes;
-
-	// Set index read size to a multiple of record bytes as stored in the database file
-	_index_read_size = MAX_INDEX_READ_SIZE - (MAX_INDEX_READ_SIZE % record_bytes);
-
-	// Set cache bytes to a multiple of record bytes with cache node header
-	u32 node_bytes = sizeof(CacheNode) + record_bytes;
-	_cache_bytes = cache_bytes - (cache_bytes % node_bytes);
 
-	// Calculate hash table size
-	u32 node_count = _cache_bytes / node_bytes;
-	u32 hash_table_size = node_count / TARGET_TREE_SIZE;
-	if (hash_table_size < MIN_TABLE_SIZE)
-		_hash_table_size = MIN_TABLE_SIZE;
-	else
-	{
-		// Round hash table size up to the next highest power-of-2
-		_hash_table_size = NextHighestPow2(hash_table_size);
-	}
-
-	_cache_hash_table = 0;
-	_cache = 0;
-	_cache_full = false;
-	_next_record = 0;
-	_next_cache_slot = 0;
+//// QueryBuffer
 
-	_head_index_waiting = 0;
-	_head_index_update = 0;
-	_head_index = 0;
-	_head_index_unique = 0;
-}
-
-Table::~Table()
+QueryBuffer *QueryBuffer::Acquire(u32 record_bytes)
 {
-	// Release all indices
-	for (TableIndex *index = _head_index, *next; index; index = next)
-	{
-		next = index->_next;
-		index->Save();
-		index->ReleaseRef();
-	}
+	QueryBuffer *buffer = StdAllocator::ref()->AcquireTrailing<QueryBuffer>(record_bytes);
+	if (!buffer) return 0;
 
-	FreeCache();
+	buffer->reference = 0;
+	buffer->record_offset = INVALID_RECORD_OFFSET;
+	buffer->pinned = false;
 
-	ThreadRefObject::SafeRelease(_shutdown_observer);
+	return buffer;
 }
 
-bool Table::AllocateCache()
+void QueryBuffer::Release()
 {
-	FreeCache();
-
-	INFO("Table") << "Allocating a " << _hash_table_size << "-element hash table for " << _file_path << ", and " << _cache_bytes << " bytes of cache memory";
-
-	// Allocate hash table memory
-	_cache_hash_table = new CacheNode*[_hash_table_size];
-	if (!_cache_hash_table) return false;
-
-	// Clear hash table memory
-	CAT_CLR(_cache_hash_table, _hash_table_size * sizeof(CacheNode*));
-
-	// Allocate cache memory
-	_cache = (u8*)LargeAligned::Acquire(_cache_bytes);
-	return _cache != 0;
+	StdAllocator::ref()->Release(this);
 }
 
-void Table::FreeCache()
-{
-	if (_cache_hash_table)
-	{
-		delete []_cache_hash_table;
-		_cache_hash_table = 0;
-	}
 
-	if (_cache)
-	{
-		LargeAligned::Release(_cache);
-		_cache = 0;
-	}
-}
+//// BatchQuery
 
-CacheNode *Table::FindNode(u64 offset)
+BatchQuery *BatchQuery::Acquire(u32 count, u32 record_bytes)
 {
-	// Get root node for this offset
-	u32 key = GetHash64(offset) & (_hash_table_size - 1);
-	CacheNode *node = _cache_hash_table[key];
-
-	// Search for node or approximation of insertion point
-	while (node)
-	{
-		// If node was found in cache (yay!),
-		if (node->offset == offset)
-			return node;
-		else if (offset > node->offset)
-			node = node->higher;
-		else
-			node = node->lower;
-	}
+	BatchQuery *batch = new (std::nothrow) BatchQuery;
+	if (!batch) return 0;
 
-	return 0;
-}
+	batch->_items = new (std::nothrow) BatchQueryItem[count];
+	batch->_records = new (std::nothrow) u8[(count ? count : 1) * record_bytes];
 
-void Table::UnlinkNode(CacheNode *node)
-{
-	CacheNode *parent = node->parent;
-	CacheNode *lower = node->lower;
-	CacheNode *higher = node->higher;
-
-	// If the node is not at the root,
-	if (parent)
-	{
-		// If the node is the lower branch of its parent,
-		if (parent->lower == node)
-		{
-			if (!lower)
-			{
-				// Re-link the higher child tree to its parent
-				parent->lower = higher;
-				if (higher) higher->parent = parent;
-			}
-			else if (!higher)
-			{
-				// Re-link the lower child tree to its parent
-				parent->lower = lower;
-				if (lower) lower->parent = parent;
-			}
-			else
-			{
-				// Re-link the higher child tree to its parent
-				parent->lower = higher;
-				higher->parent = parent;
-
-				// Move the lower child tree to the far left in the higher child tree
-				CacheNode *leftmost = higher;
-				while (leftmost->lower) leftmost = leftmost->lower;
-				leftmost->lower = lower;
-				lower->parent = leftmost;
-			}
-		}
-		else
-		{
-			if (!lower)
-			{
-				// Re-link the higher child tree to its parent
-				parent->higher = higher;
-				if (higher) higher->parent = parent;
-			}
-			else if (!higher)
-			{
-				// Re-link the lower child tree to its parent
-				parent->higher = lower;
-				if (lower) lower->parent = parent;
-			}
-			else
-			{
-				// Re-link the lower child tree to its parent
-				parent->higher = lower;
-				lower->parent = parent;
-
-				// Move the lower child tree to the far left in the higher child tree
-				CacheNode *rightmost = lower;
-				while (rightmost->higher) rightmost = rightmost->higher;
-				rightmost->higher = higher;
-				higher->parent = rightmost;
-			}
-		}
-	}
-	else // At root (no parent):
+	if (!batch->_items || !batch->_records)
 	{
-		u32 old_key = GetHash64(node->offset) & (_hash_table_size - 1);
-
-		if (!lower)
-		{
-			// Re-link the higher child tree to its parent
-			_cache_hash_table[old_key] = higher;
-			if (higher) higher->parent = 0;
-		}
-		else if (!higher)
-		{
-			// Re-link the lower child tree to its parent
-			_cache_hash_table[old_key] = lower;
-			if (lower) lower->parent = 0;
-		}
-		else
-		{
-			// Re-link the higher child tree to its parent
-			_cache_hash_table[old_key] = higher;
-			higher->parent = 0;
-
-			// Move the lower child tree to the far left in the higher child tree
-			CacheNode *leftmost = higher;
-			while (leftmost->lower) leftmost = leftmost->lower;
-			leftmost->lower = lower;
-			lower->parent = leftmost;
-		}
+		delete []batch->_items;
+		delete []batch->_records;
+		delete batch;
+		return 0;
 	}
-}
 
-void Table::InsertNode(u64 offset, u32 key, CacheNode *hint, CacheNode *node)
-{
-	node->lower = 0;
-	node->higher = 0;
-	node->offset = offset;
+	batch->_count = count;
+	batch->_record_bytes = record_bytes;
+	batch->_reference = 0;
+	batch->_pending = 0;
+	batch->_hits = 0;
+	batch->_reads = 0;
 
-	// If insertion point got to root,
-	if (!hint)
+	// Each item gets its own slice of the record buffer
+	for (u32 ii = 0; ii < count; ++ii)
 	{
-		// Look up root
-		hint = _cache_hash_table[key];
-
-		// If root is not set,
-		if (!hint)
-		{
-			_cache_hash_table[key] = node;
+		BatchQueryItem *item = &batch->_items[ii];
 
-			node->parent = 0;
-
-			return;
-		}
-	}
-
-	// Look starting from a node, knowing it won't already be inserted
-	for (;;)
-	{
-		if (offset > hint->offset)
-		{
-			// Search right for empty leaf
-			CacheNode *higher = hint->higher;
-			if (!higher)
-			{
-				hint->higher = node;
-				break;
-			}
-			hint = higher;
-		}
-		else
-		{
-			// Search left for empty leaf
-			CacheNode *lower = hint->lower;
-			if (!lower)
-			{
-				hint->lower = node;
-				break;
-			}
-			hint = lower;
-		}
+		item->_offset = INVALID_RECORD_OFFSET;
+		item->_data = batch->_records + ii * record_bytes;
+		item->_success = false;
+		item->_pinned = false;
 	}
 
-	node->parent = hint;
+	return batch;
 }
 
-u8 *Table::SetOffset(u64 offset)
+void BatchQuery::Release()
 {
-	// Get root node for this offset
-	u32 key = GetHash64(offset) & (_hash_table_size - 1);
-	CacheNode *insert = _cache_hash_table[key];
-
-	// Search for node or approximation of insertion point
-	while (insert)
-	{
-		// If node was found in cache (yay!),
-		if (insert->offset == offset)
-			return GetTrailingBytes(insert);
-		else if (offset > insert->offset)
-		{
-			CacheNode *higher = insert->higher;
-			if (!higher) break;
-			insert = higher;
-		}
-		else
-		{
-			CacheNode *lower = insert->lower;
-			if (!lower) break;
-			insert = lower;
-		}
-	}
-
-	// We will need to insert a new node:
-
-	// Grab memory for the node
-	u32 next = _next_cache_slot;
-	CacheNode *node = reinterpret_cast<CacheNode*>( &_cache[next] );
+	delete []_items;
+	delete []_records;
+	delete this;
+}
 
-	// If node is already used, unlink it!
-	if (node->offset != INVALID_RECORD_OFFSET && _cache_full)
-	{
-		// If the parent happens to be the one we're replacing, use parent instead
-		if (insert == node) insert = insert->parent;
 
-		UnlinkNode(node);
-	}
+//// Table
 
-	// Mark next cache slot
-	next += sizeof(CacheNode) + _record_bytes;
-	if (next >= _cache_bytes) { next = 0; _cache_full = true; }
-	_next_cache_slot = next;
+Table::Table()
+{
+	_record_bytes = 0;
+	_next_record = 0;
+	_file_path[0] = '\0';
 
-	InsertNode(offset, key, insert, node);
+	_index_database_size = 0;
+	_index_read_offset = 0;
+	_index_read_completed = 0;
+	_index_read_size = 0;
 
-	return GetTrailingBytes(node);
+	_head_index_waiting = 0;
+	_head_index_update = 0;
+	_head_index = 0;
+	_head_index_unique = 0;
 }
 
-u8 *Table::InsertOffset(u64 offset)
+Table::~Table()
 {
-	// We will need to insert a new node:
-
-	// Grab memory for the node
-	u32 next = _next_cache_slot;
-	CacheNode *node = reinterpret_cast<CacheNode*>( &_cache[next] );
-
-	// If node is already used, unlink it!
-	if (_cache_full && node->offset != INVALID_RECORD_OFFSET)
-	{
-		UnlinkNode(node);
-	}
-
-	// Mark next cache slot
-	next += sizeof(CacheNode) + _record_bytes;
-	if (next >= _cache_bytes) { next = 0; _cache_full = true; }
-	_next_cache_slot = next;
-
-	// Get root node for this offset
-	u32 key = GetHash64(offset) & (_hash_table_size - 1);
-	CacheNode *insert = _cache_hash_table[key];
-
-	InsertNode(offset, key, insert, node);
-
-	return GetTrailingBytes(node);
 }
 
-u8 *Table::PeekOffset(u64 offset)
+void Table::OnDestroy()
 {
-	CacheNode *node = FindNode(offset);
-	if (!node) return 0;
-
-	return GetTrailingBytes(node);
+	// Keep the file open until the last read or write completes; ~AsyncFile() closes it
 }
 
-bool Table::RemoveOffset(u64 offset)
+bool Table::OnFinalize()
 {
-	CacheNode *node = FindNode(offset);
-	if (!node) return false;
+	// Save and free all indices
+	for (TableIndex *index = _head_index, *next; index; index = next)
+	{
+		next = index->_next;
+		index->Save();
+		delete index;
+	}
 
-	UnlinkNode(node);
+	_head_index = 0;
+	_head_index_unique = 0;
+	_head_index_waiting = 0;
+	_head_index_update = 0;
 
-	// Mark cache node as invalid
-	node->offset = INVALID_RECORD_OFFSET;
+	_cache.Finalize();
 
-	return true;
+	return AsyncFile::OnFinalize();
 }
 
 TableIndex *Table::MakeIndex(const char *index_file_path, IHash *hash_function, bool unique)
 {
 	if (!hash_function) return 0;
 
-	TableIndex *index = new TableIndex(this, index_file_path, hash_function, _shutdown_observer);
-	if (!index) return 0;
+	TableIndex *index = new (std::nothrow) TableIndex(this, index_file_path, hash_function);
+	if (!index)
+	{
+		delete hash_function;
+		return 0;
+	}
 
 	if (!index->Initialize())
 	{
-		index->ReleaseRef();
+		delete index;
 		return 0;
 	}
 
@@ -421,54 +172,78 @@ TableIndex *Table::MakeIndex(const char *index_file_path, IHash *hash_function,
 	_head_index = index;
 
 	// Add to unique list
-	index->_next_unique = _head_index_unique;
-	_head_index_unique = index;
+	if (unique)
+	{
+		index->_next_unique = _head_index_unique;
+		_head_index_unique = index;
+	}
 
 	return index;
 }
 
-bool Table::Initialize()
+bool Table::Initialize(const char *file_path, u32 record_bytes, u32 cache_bytes)
 {
-	if (!AllocateCache())
+	CAT_STRNCPY(_file_path, file_path, sizeof(_file_path));
+	_record_bytes = record_bytes;
+
+	// Set index read size to a multiple of record bytes as stored in the database file
+	_index_read_size = MAX_INDEX_READ_SIZE - (MAX_INDEX_READ_SIZE % record_bytes);
+
+	if (!_cache.Initialize(record_bytes, cache_bytes))
 	{
-		WARN("Table") << "Out of memory: Unable to allocate table cache for " << _file_path;
+		CAT_WARN("Table") << "Out of memory: Unable to allocate table cache for " << _file_path;
 		return false;
 	}
 
 	if (!Open(_file_path, ASYNCFILE_READ | ASYNCFILE_WRITE | ASYNCFILE_RANDOM))
 	{
-		WARN("Table") << "Unable to open database file " << _file_path;
+		CAT_WARN("Table") << "Unable to open database file " << _file_path;
 		return false;
 	}
 
-	// NOTE: Does not support files larger than 4 GB
 	_next_record = GetSize();
 
+	// Start rebuilding any index that was waiting for the database file
 	OnIndexingDone();
 
 	return true;
 }
 
+bool Table::IsIndexing()
+{
+	AutoReadLock lock(_lock);
+
+	return _head_index_update != 0 || _head_index_waiting != 0;
+}
+
 
 //// Indexing
 
 bool Table::StartIndexingRead()
 {
-	AsyncBuffer *buffer;
-	if (!AsyncBuffer::Acquire(buffer, _index_read_size))
+	ReadBuffer *buffer = StdAllocator::ref()->AcquireTrailing<ReadBuffer>(_index_read_size);
+	if (!buffer)
 	{
-		WARN("Table") << "Out of memory: Unable to acquire read object for indexing database " << _file_path;
+		CAT_WARN("Table") << "Out of memory: Unable to acquire read object for indexing database " << _file_path;
 		return false;
 	}
 
-	if (!Read(buffer, _index_read_offset, fastdelegate::MakeDelegate(this, &Table::OnIndexingRead)))
+	buffer->callback.SetMember<Table, &Table::OnIndexingRead>(this);
+
+	AutoWriteLock lock(_lock);
+
+	u64 offset = _index_read_offset;
+	_index_read_offset = offset + _index_read_size;
+
+	lock.Release();
+
+	if (!Read(buffer, offset, GetTrailingBytes(buffer), _index_read_size))
 	{
-		WARN("Table") << "Read failure while indexing database " << _file_path;
+		CAT_WARN("Table") << "Read failure while indexing database " << _file_path;
+		StdAllocator::ref()->Release(buffer);
 		return false;
 	}
 
-	_index_read_offset += _index_read_size;
-
 	return true;
 }
 
@@ -479,13 +254,13 @@ bool Table::StartIndexing()
 	// If database is empty, just return true (no work to do)
 	if (_index_database_size <= 0)
 	{
-		INFO("Table") << "Database table " << _file_path << " is empty so aborting index job";
+		CAT_INFO("Table") << "Database table " << _file_path << " is empty so aborting index job";
 
 		OnIndexingDone();
 		return true;
 	}
 
-	INFO("Table") << "Starting indexing of database table " << _file_path;
+	CAT_INFO("Table") << "Starting indexing of database table " << _file_path;
 
 	_index_read_completed = 0;
 	_index_read_offset = 0;
@@ -501,10 +276,12 @@ bool Table::StartIndexing()
 
 void Table::OnIndexingDone()
 {
+	AutoWriteLock lock(_lock);
+
 	// Unlink loaded indices
 	for (TableIndex *index = _head_index_update, *next; index; index = next)
 	{
-		INFO("Table") << "Table indexing has completed for " << index->GetFilePath();
+		CAT_INFO("Table") << "Table indexing has completed for " << index->GetFilePath();
 		next = index->_next_loading;
 		index->_next_loading = 0;
 	}
@@ -513,8 +290,12 @@ void Table::OnIndexingDone()
 	_head_index_update = _head_index_waiting;
 	_head_index_waiting = 0;
 
+	bool restart = _head_index_update != 0;
+
+	lock.Release();
+
 	// If the indexing should be restarted,
-	if (_head_index_update)
+	if (restart)
 	{
 		StartIndexing();
 	}
@@ -533,7 +314,7 @@ bool Table::RequestIndexRebuild(TableIndex *index)
 	}
 
 	// If not initialized or update in progress,
-	if (!_cache || _head_index_update)
+	if (!_cache.Valid() || _head_index_update)
 	{
 		// Insert in waiting list
 		index->_next_loading = _head_index_waiting;
@@ -551,68 +332,78 @@ bool Table::RequestIndexRebuild(TableIndex *index)
 	return StartIndexing();
 }
 
-bool Table::OnIndexingRead(ThreadPoolLocalStorage *tls, int error, AsyncBuffer *buffer, u32 bytes)
+void Table::OnIndexingRead(ThreadLocalStorage &tls, const BatchSet &buffers)
 {
-	u64 *data = buffer->GetData<u64>();
-	u64 offset = buffer->GetOffset();
+	u32 step = _record_bytes;
 
-	if (!bytes)
+	for (BatchHead *next, *node = buffers.head; node; node = next)
 	{
-		// Probably read beyond end of data (this is normal)
-		return true; // Release buffer
-	}
+		next = node->batch_next;
+		ReadBuffer *buffer = static_cast<ReadBuffer*>( node );
 
-	u32 step = _record_bytes;
-	u32 records = bytes / step;
+		u32 bytes = buffer->data_bytes;
 
-	// For each record from the file,
-	while (records--)
-	{
-		// For each table index,
-		for (TableIndex *index = _head_index_update; index; index = index->_next_loading)
+		// If read beyond end of data (this is normal),
+		if (!bytes)
 		{
-			// Insert record into index
-			index->InsertComplete(data, offset);
+			StdAllocator::ref()->Release(buffer);
+			continue;
 		}
 
-		data += step;
-		offset += step;
-	}
+		const u8 *data = reinterpret_cast<const u8*>( buffer->data );
+		u64 offset = buffer->offset;
+		u32 records = bytes / step;
 
-	AutoWriteLock lock(_lock);
+		// For each record from the file,
+		while (records--)
+		{
+			// For each table index,
+			for (TableIndex *index = _head_index_update; index; index = index->_next_loading)
+			{
+				// Insert record into index
+				index->InsertComplete(data, offset);
+			}
 
-	u64 completed = _index_read_completed + bytes;
-	_index_read_completed = completed;
+			data += step;
+			offset += step;
+		}
 
-	u64 next_read_offset = _index_read_offset + _index_read_size;
-	_index_read_offset = next_read_offset;
+		AutoWriteLock lock(_lock);
 
-	lock.Release();
+		u64 completed = _index_read_completed + bytes;
+		_index_read_completed = completed;
 
-	// If reading has completed,
-	if (completed >= _index_database_size)
-	{
-		INANE("Table") << "Done(1): Releasing indexing buffer for " << _file_path;
+		u64 next_read_offset = _index_read_offset;
+		_index_read_offset = next_read_offset + _index_read_size;
 
-		OnIndexingDone();
-	}
-	else
-	{
-		if (next_read_offset >= _index_database_size)
+		lock.Release();
+
+		// If reading has completed,
+		if (completed >= _index_database_size)
 		{
-			INANE("Table") << "Done(2): Releasing indexing buffer for " << _file_path;
+			CAT_INANE("Table") << "Done(1): Releasing indexing buffer for " << _file_path;
+
+			StdAllocator::ref()->Release(buffer);
+
+			OnIndexingDone();
 		}
-		else
+		else if (next_read_offset >= _index_database_size)
 		{
-			INANE("Table") << "Reading another page indexing " << _file_path;
+			CAT_INANE("Table") << "Done(2): Releasing indexing buffer for " << _file_path;
 
-			Read(buffer, next_read_offset, fastdelegate::MakeDelegate(this, &Table::OnIndexingRead));
+			StdAllocator::ref()->Release(buffer);
+		}
+		else
+		{
+			CAT_INANE("Table") << "Reading another page indexing " << _file_path;
 
-			return false; // Keep buffer
+			if (!Read(buffer, next_read_offset, buffer->data, _index_read_size))
+			{
+				CAT_WARN("Table") << "Read failure while indexing database " << _file_path;
+				StdAllocator::ref()->Release(buffer);
+			}
 		}
 	}
-
-	return true; // Release buffer
 }
 
 u64 Table::UniqueIndexLookup(const void *data)
@@ -634,84 +425,252 @@ u64 Table::UniqueIndexLookup(const void *data)
 	return INVALID_RECORD_OFFSET;
 }
 
-bool Table::OnRemoveRead(ThreadPoolLocalStorage *tls, int error, AsyncBuffer *buffer, u32 bytes)
+
+//// Record IO
+
+bool Table::WriteRecord(u64 offset, const void *data)
 {
-	// Erase buffer and abort on failure
-	if (error || bytes != _record_bytes)
+	u32 record_bytes = _record_bytes;
+
+	WriteBuffer *buffer = StdAllocator::ref()->AcquireTrailing<WriteBuffer>(record_bytes);
+	if (!buffer)
 	{
-		WARN("Table") << "Remove record failure in " << _file_path << ". Error #" << error;
-		return true;
+		CAT_WARN("Table") << "Out of memory: Unable to allocate record write for " << _file_path;
+		return false;
 	}
 
+	u8 *record = GetTrailingBytes(buffer);
+
+	if (data) memcpy(record, data, record_bytes);
+	else CAT_CLR(record, record_bytes);
+
+	buffer->callback.SetMember<Table, &Table::OnWrite>(this);
+
+	if (!Write(buffer, offset, record, record_bytes))
+	{
+		StdAllocator::ref()->Release(buffer);
+		return false;
+	}
+
+	return true;
+}
+
+void Table::OnWrite(ThreadLocalStorage &tls, const BatchSet &buffers)
+{
+	for (BatchHead *next, *node = buffers.head; node; node = next)
+	{
+		next = node->batch_next;
+		WriteBuffer *buffer = static_cast<WriteBuffer*>( node );
+
+		if (buffer->data_bytes != _record_bytes)
+		{
+			CAT_WARN("Table") << "Record write failure in " << _file_path << " at offset " << buffer->offset;
+		}
+
+		StdAllocator::ref()->Release(buffer);
+	}
+}
+
+bool Table::RemoveRecord(const void *data, u64 offset)
+{
 	// For each table index,
 	for (TableIndex *index = _head_index; index; index = index->_next)
 	{
-		index->RemoveComplete(buffer->GetData());
+		index->RemoveComplete(data);
 	}
 
-	buffer->Zero();
+	// Also drops the record from any Query() read still in flight
+	_cache.Remove(offset);
 
-	if (!Write(buffer, buffer->GetOffset()))
+	if (!WriteRecord(offset, 0))
 	{
-		WARN("Table") << "Remove record file write failure in " << _file_path;
+		CAT_WARN("Table") << "Remove record file write failure in " << _file_path;
+		return false;
 	}
 
-	return false; // Do not erase buffer
+	return true;
 }
 
-bool Table::OnQueryRead(ThreadPoolLocalStorage *tls, int error, AsyncBuffer *buffer, u32 bytes)
+void Table::OnRemoveRead(ThreadLocalStorage &tls, const BatchSet &buffers)
 {
-	// Erase buffer and abort on failure
-	if (error || bytes != _record_bytes)
+	for (BatchHead *next, *node = buffers.head; node; node = next)
 	{
-		WARN("Table") << "Query record failure in " << _file_path << ". Error #" << error;
-		return true;
+		next = node->batch_next;
+		ReadBuffer *buffer = static_cast<ReadBuffer*>( node );
+
+		if (buffer->data_bytes != _record_bytes)
+		{
+			CAT_WARN("Table") << "Remove record failure in " << _file_path << " at offset " << buffer->offset;
+		}
+		else
+		{
+			RemoveRecord(buffer->data, buffer->offset);
+		}
+
+		StdAllocator::ref()->Release(buffer);
 	}
+}
 
-	// Update cache immediately
-	AutoWriteLock lock(_lock);
+void Table::OnQueryRead(ThreadLocalStorage &tls, const BatchSet &buffers)
+{
+	for (BatchHead *next, *node = buffers.head; node; node = next)
+	{
+		next = node->batch_next;
+		QueryBuffer *buffer = static_cast<QueryBuffer*>( node );
 
-		memcpy(SetOffset(buffer->GetOffset()), buffer->GetData(), bytes);
+		u64 offset = buffer->record_offset;
+		bool success = buffer->data_bytes == _record_bytes;
 
-	lock.Release();
+		if (success)
+		{
+			// Update cache immediately, or pick up a newer copy written during the read
+			_cache.Fill(offset, buffer->GetData(), buffer->pinned);
+		}
+		else
+		{
+			CAT_WARN("Table") << "Query record failure in " << _file_path << " at offset " << offset;
+
+			if (buffer->pinned)
+				_cache.Unpin(offset);
+		}
+
+		// The callback may reuse the buffer for another query
+		RefObject *reference = buffer->reference;
+
+		if (buffer->on_query(&tls, success, buffer))
+			buffer->Release();
+
+		if (reference)
+			reference->ReleaseRef(CAT_REFOBJECT_TRACE);
+	}
+}
+
+
+// Batched read: first item of a run in the sorted list and the run length
+struct BatchReadBuffer : public ReadBuffer
+{
+	BatchQuery *batch;
+	BatchQueryItem *first;
+	u32 count;
+};
+
+bool Table::StartBatchRead(BatchQuery *batch, BatchQueryItem *first, u32 count, u64 offset, u32 bytes)
+{
+	BatchReadBuffer *buffer = StdAllocator::ref()->AcquireTrailing<BatchReadBuffer>(bytes);
+	if (buffer)
+	{
+		buffer->batch = batch;
+		buffer->first = first;
+		buffer->count = count;
+		buffer->callback.SetMember<Table, &Table::OnBatchRead>(this);
+
+		Atomic::Add(&batch->_pending, 1);
+		batch->_reads++;
+
+		if (Read(buffer, offset, GetTrailingBytes(buffer), bytes))
+			return true;
+
+		batch->_reads--;
+		Atomic::Add(&batch->_pending, -1);
+		StdAllocator::ref()->Release(buffer);
+	}
+
+	CAT_WARN("Table") << "Unable to queue batched read of " << count << " records from " << _file_path;
+
+	// Fail the items in this run
+	for (BatchQueryItem *item = first; count--; item = item->_sort_next)
+	{
+		if (item->_pinned)
+			_cache.Unpin(item->_offset);
+		item->_success = false;
+	}
+
+	return false;
+}
+
+void Table::OnBatchRead(ThreadLocalStorage &tls, const BatchSet &buffers)
+{
+	u32 record_bytes = _record_bytes;
+
+	for (BatchHead *next, *node = buffers.head; node; node = next)
+	{
+		next = node->batch_next;
+		BatchReadBuffer *buffer = static_cast<BatchReadBuffer*>( node );
+
+		u32 bytes = buffer->data_bytes;
+		u64 base = buffer->offset;
+		const u8 *data = reinterpret_cast<const u8*>( buffer->data );
+
+		if (!bytes)
+		{
+			CAT_WARN("Table") << "Batched query read failure in " << _file_path << " at offset " << base;
+		}
+
+		// Scatter the records of this run back to their items
+		u32 count = buffer->count;
+		for (BatchQueryItem *item = buffer->first; count--; item = item->_sort_next)
+		{
+			u32 rel = (u32)(item->_offset - base);
+
+			// If the record was fully read,
+			if (rel + record_bytes <= bytes)
+			{
+				memcpy(item->_data, data + rel, record_bytes);
 
-	AsyncQueryRead *tag;
-	buffer->GetTag(tag);
+				// Update cache, or pick up a newer copy written during the read
+				_cache.Fill(item->_offset, item->_data, item->_pinned);
+				item->_success = true;
+			}
+			else
+			{
+				if (item->_pinned)
+					_cache.Unpin(item->_offset);
+				item->_success = false;
+			}
+		}
 
-	bool result = tag->_callback(tls, error, buffer, bytes);
+		BatchQuery *batch = buffer->batch;
 
-	if (tag->_reference)
-		tag->_reference->ReleaseRef();
+		StdAllocator::ref()->Release(buffer);
 
-	return result;
+		// If this was the last outstanding read,
+		if (Atomic::Add(&batch->_pending, -1) == 1)
+			CompleteBatch(&tls, batch);
+	}
+}
+
+void Table::CompleteBatch(ThreadLocalStorage *tls, BatchQuery *batch)
+{
+	RefObject *reference = batch->_reference;
+	batch->_reference = 0;
+
+	batch->_callback(tls, batch);
+
+	if (reference)
+		reference->ReleaseRef(CAT_REFOBJECT_TRACE);
 }
 
 
 //// User Interface
 
-u64 Table::Insert(void *data)
+u64 Table::Insert(const void *data)
 {
 	u32 record_bytes = _record_bytes;
-	AsyncBuffer *buffer = AsyncBuffer::Promote(data);
 
 	// Update cache immediately
 	AutoWriteLock lock(_lock);
 
 		// If it already exists,
 		if (INVALID_RECORD_OFFSET != UniqueIndexLookup(data))
-		{
-			buffer->Release();
 			return INVALID_RECORD_OFFSET;
-		}
 
 		// Get next offset
 		u64 offset = _next_record;
 		_next_record = offset + record_bytes;
 
-		INANE("Table") << "Insert " << offset << " in " << _file_path;
+		CAT_INANE("Table") << "Insert " << offset << " in " << _file_path;
 
-		u8 *cache = InsertOffset(offset);
-		memcpy(cache, data, record_bytes);
+		_cache.Store(offset, data);
 
 		// For each index,
 		for (TableIndex *index = _head_index; index; index = index->_next)
@@ -722,99 +681,159 @@ u64 Table::Insert(void *data)
 	lock.Release();
 
 	// Queue a disk write
-	if (!Write(buffer, offset))
+	if (!WriteRecord(offset, data))
 	{
-		WARN("Table") << "Disk write failure on insertion for " << _file_path;
+		CAT_WARN("Table") << "Disk write failure on insertion for " << _file_path;
 		return INVALID_RECORD_OFFSET;
 	}
 
 	return offset;
 }
 
-bool Table::Update(void *data, u64 offset)
+bool Table::Update(const void *data, u64 offset)
 {
-	u32 record_bytes = _record_bytes;
-	AsyncBuffer *buffer = AsyncBuffer::Promote(data);
-
-	INANE("Table") << "Replace " << offset << " in " << _file_path;
+	CAT_INANE("Table") << "Replace " << offset << " in " << _file_path;
 
 	// Update cache immediately
-	AutoWriteLock lock(_lock);
-
-		memcpy(SetOffset(offset), data, record_bytes);
-
-	lock.Release();
+	_cache.Store(offset, data);
 
 	// Queue a disk write
-	return Write(buffer, offset);
+	return WriteRecord(offset, data);
 }
 
-bool Table::Query(u64 offset, AsyncBuffer *buffer)
+bool Table::Query(u64 offset, QueryBuffer *buffer)
 {
-	u32 record_bytes = _record_bytes;
+	CAT_INANE("Table") << "Query " << offset << " in " << _file_path;
 
-	INANE("Table") << "Query " << offset << " in " << _file_path;
+	buffer->record_offset = offset;
 
-	// Check cache first
-	AutoReadLock lock(_lock);
-
-		u8 *cache = PeekOffset(offset);
+	// Check cache first; on a miss the record is pinned until the read completes
+	if (_cache.Lookup(offset, buffer->GetData(), buffer->pinned))
+	{
+		RefObject *reference = buffer->reference;
 
-		if (cache)
-		{
-			memcpy(buffer->GetData(), cache, record_bytes);
+		if (buffer->on_query(0, true, buffer))
+			buffer->Release();
 
-			lock.Release();
+		if (reference)
+			reference->ReleaseRef(CAT_REFOBJECT_TRACE);
 
-			AsyncQueryRead *tag;
-			buffer->GetTag(tag);
+		return true;
+	}
 
-			if (tag->_callback(0, 0, buffer, record_bytes))
-				buffer->Release();
-			if (tag->_reference)
-				tag->_reference->ReleaseRef();
+	buffer->callback.SetMember<Table, &Table::OnQueryRead>(this);
 
-			return true;
-		}
+	// Queue a disk read if not in cache
+	if (!Read(buffer, offset, buffer->GetData(), _record_bytes))
+	{
+		if (buffer->pinned)
+			_cache.Unpin(offset);
 
-	lock.Release();
+		RefObject::Release(buffer->reference);
+		return false;
+	}
 
-	// Queue a disk read if not in cache
-	return Read(buffer, offset, fastdelegate::MakeDelegate(this, &Table::OnQueryRead));
+	return true;
 }
 
 bool Table::Remove(u64 offset)
 {
 	u32 record_bytes = _record_bytes;
 
-	INANE("Table") << "Remove " << offset << " from " << _file_path;
+	CAT_INANE("Table") << "Remove " << offset << " from " << _file_path;
 
-	AsyncBuffer *buffer;
-	if (!AsyncBuffer::Acquire(buffer, record_bytes))
+	ReadBuffer *buffer = StdAllocator::ref()->AcquireTrailing<ReadBuffer>(record_bytes);
+	if (!buffer)
 	{
-		WARN("Table") << "Out of memory: Unable to allocate object to remove record from " << _file_path;
+		CAT_WARN("Table") << "Out of memory: Unable to allocate object to remove record from " << _file_path;
 		return false;
 	}
 
-	// Check cache first
-	AutoReadLock lock(_lock);
+	u8 *data = GetTrailingBytes(buffer);
+
+	// If the record is cached, complete the removal without reading it back
+	if (_cache.Peek(offset, data))
+	{
+		bool success = RemoveRecord(data, offset);
+
+		StdAllocator::ref()->Release(buffer);
+		return success;
+	}
 
-	u8 *cache = PeekOffset(offset);
+	buffer->callback.SetMember<Table, &Table::OnRemoveRead>(this);
 
-	if (cache)
+	// Queue a disk read if not in cache
+	if (!Read(buffer, offset, data, record_bytes))
 	{
-		memcpy(buffer->GetData(), cache, record_bytes);
+		StdAllocator::ref()->Release(buffer);
+		return false;
+	}
 
-		lock.Release();
+	return true;
+}
 
-		if (OnRemoveRead(0, 0, buffer, record_bytes))
-			buffer->Release();
+bool Table::QueryBatch(BatchQuery *batch)
+{
+	u32 record_bytes = _record_bytes;
 
-		return true;
+	CAT_INANE("Table") << "Query batch of " << batch->_count << " records in " << _file_path;
+
+	// Hold the batch open until every read has been queued
+	batch->_pending = 1;
+	batch->_hits = 0;
+	batch->_reads = 0;
+
+	// Serve hits immediately and collect the misses, which stay pinned until read
+	BatchQueryItem *head = 0;
+	for (u32 ii = 0, count = batch->_count; ii < count; ++ii)
+	{
+		BatchQueryItem *item = &batch->_items[ii];
+
+		if (_cache.Lookup(item->_offset, item->_data, item->_pinned))
+		{
+			item->_success = true;
+			batch->_hits++;
+		}
+		else
+		{
+			item->_sort_value = item->_offset;
+			item->_sort_next = head;
+			head = item;
+		}
 	}
 
-	lock.Release();
+	// Sort misses by file offset so neighbouring records can share a read
+	head = BatchQueryItem::MergeSort(head);
 
-	// Queue a disk read if not in cache
-	return Read(buffer, offset, fastdelegate::MakeDelegate(this, &Table::OnRemoveRead));
+	bool success = true;
+
+	while (head)
+	{
+		BatchQueryItem *first = head, *next = head->_sort_next;
+		u64 run_start = head->_offset;
+		u64 run_end = run_start + record_bytes;
+		u32 count = 1;
+
+		// Extend the run while the next miss is close by and the read stays bounded
+		while (next && next->_offset <= run_end + MAX_BATCH_READ_GAP &&
+			   next->_offset + record_bytes - run_start <= MAX_BATCH_READ_SIZE)
+		{
+			u64 end = next->_offset + record_bytes;
+			if (end > run_end) run_end = end;
+
+			++count;
+			next = next->_sort_next;
+		}
+
+		if (!StartBatchRead(batch, first, count, run_start, (u32)(run_end - run_start)))
+			success = false;
+
+		head = next;
+	}
+
+	// If no reads are outstanding,
+	if (Atomic::Add(&batch->_pending, -1) == 1)
+		CompleteBatch(0, batch);
+
+	return success;
 }
@@ -26,29 +26,101 @@
 	POSSIBILITY OF SUCH DAMAGE.
 */
 
-#include <cat/db/BombayTableIndex.hpp>
-#include <cat/port/AlignedAlloc.hpp>
-#include <cat/io/Logging.hpp>
+#include <cat/db/BombayTable.hpp>
+#include <cat/mem/LargeAllocator.hpp>
+#include <cat/io/Log.hpp>
 #include <cat/hash/Murmur.hpp>
+#include <cat/math/BitMath.hpp>
+#include <cat/threads/Atomic.hpp>
+
+#include <cstdio>
+
+#if defined(CAT_HAS_SSE2)
+# include <emmintrin.h>
+#endif
+
 using namespace cat;
 using namespace bombay;
 
-TableIndex::TableIndex(Table *parent, const char *file_path,
-					   IHash *hash_function, ShutdownObserver *shutdown_observer)
-	: AsyncFile(REFOBJ_PRIO_0+17)
+
+//// Tag matching
+
+static CAT_INLINE u8 GetTag(u64 hash)
+{
+	return (u8)(hash >> 57);
+}
+
+// Returns a 16-bit mask with a bit set for each tag equal to the given value
+static CAT_INLINE u32 MatchTags(const u8 *tags, u8 value)
+{
+#if defined(CAT_HAS_SSE2)
+
+	__m128i group = _mm_load_si128((const __m128i*)tags);
+
+	return (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)value)));
+
+#else
+
+	u32 mask = 0;
+
+	for (u32 ii = 0; ii < 16; ++ii)
+		if (tags[ii] == value)
+			mask |= 1 << ii;
+
+	return mask;
+
+#endif
+}
+
+// Returns a 16-bit mask with a bit set for each empty or deleted slot
+static CAT_INLINE u32 MatchFree(const u8 *tags)
 {
-	_shutdown_observer = shutdown_observer;
-	if (shutdown_observer)
-		shutdown_observer->AddRef();
+#if defined(CAT_HAS_SSE2)
+
+	// Used slots have the high bit clear
+	__m128i group = _mm_load_si128((const __m128i*)tags);
+
+	return (u32)_mm_movemask_epi8(group);
+
+#else
+
+	u32 mask = 0;
+
+	for (u32 ii = 0; ii < 16; ++ii)
+		if (tags[ii] & 0x80)
+			mask |= 1 << ii;
 
+	return mask;
+
+#endif
+}
+
+
+TableIndex::TableIndex(Table *parent, const char *file_path, IHash *hash_function)
+{
 	_parent = parent;
 	_index_hash = hash_function;
 	CAT_STRNCPY(_file_path, file_path, sizeof(_file_path));
 
 	_table = 0;
-	_table_elements = 0;
-	_used_elements = 0;
 	_table_raw_bytes = 0;
+	_buckets = 0;
+	_bucket_count = 0;
+	_used_elements = 0;
+	_deleted_elements = 0;
+
+	_old_table = 0;
+	_old_buckets = 0;
+	_old_bucket_count = 0;
+	_migrate_next = 0;
+
+	_disk_buckets = 0;
+	_chunk_loaded = 0;
+	_chunk_buckets = 0;
+	_chunk_count = 0;
+	_chunks_remaining = 0;
+	_next_load_chunk = 0;
+	_corrupt = false;
 
 	_next = 0;
 	_next_unique = 0;
@@ -60,202 +132,490 @@ TableIndex::~TableIndex()
 	FreeTable();
 
 	if (_index_hash) delete _index_hash;
-
-	ThreadRefObject::SafeRelease(_shutdown_observer);
 }
 
 
 //// Table Management
 
-bool TableIndex::AllocateTable()
+u32 TableIndex::GetTableBytes(u32 bucket_count, u32 &chunk_buckets, u32 &chunk_count)
+{
+	chunk_buckets = bucket_count < LOAD_CHUNK_BUCKETS ? bucket_count : LOAD_CHUNK_BUCKETS;
+	chunk_count = bucket_count / chunk_buckets;
+
+	return bucket_count * sizeof(IndexBucket) + chunk_count * sizeof(u64) + sizeof(IndexFooter);
+}
+
+u8 *TableIndex::AllocateBuckets(u32 bucket_count, u32 &raw_bytes)
 {
-	static const u32 MIN_BYTES = (MIN_ELEMENTS << 4) + TABLE_FOOTER_BYTES;
+	u32 chunk_buckets, chunk_count;
+	raw_bytes = GetTableBytes(bucket_count, chunk_buckets, chunk_count);
 
-	u64 *page = (u64*)LargeAligned::Acquire(MIN_BYTES);
-	if (!page)
+	u8 *table = (u8*)LargeAllocator::ref()->Acquire(raw_bytes);
+	if (!table) return 0;
+
+	// Mark every slot empty
+	IndexBucket *buckets = reinterpret_cast<IndexBucket*>( table );
+	for (u32 ii = 0; ii < bucket_count; ++ii)
+		memset(buckets[ii].tags, TAG_EMPTY, BUCKET_SLOTS);
+
+	return table;
+}
+
+bool TableIndex::AllocateTable()
+{
+	u32 raw_bytes;
+	u8 *table = AllocateBuckets(MIN_BUCKETS, raw_bytes);
+	if (!table)
 	{
-		FATAL("TableIndex") << "Out of memory: Unable to allocate minimum size table for " << _file_path;
+		CAT_FATAL("TableIndex") << "Out of memory: Unable to allocate minimum size table for " << _file_path;
 		return false;
 	}
 
 	FreeTable();
 
-	_table_elements = MIN_ELEMENTS;
-	_table_raw_bytes = MIN_BYTES;
-	_table = page;
+	_table = table;
+	_table_raw_bytes = raw_bytes;
+	_buckets = reinterpret_cast<IndexBucket*>( table );
+	_bucket_count = MIN_BUCKETS;
 	_used_elements = 0;
+	_deleted_elements = 0;
 
 	return true;
 }
 
-bool TableIndex::DoubleTable()
+void TableIndex::FreeTable()
 {
-	// Calculate next highest power-of-2
-	u32 target_size = _table_elements << 1;
-	u32 bytes = (target_size << 4) + TABLE_FOOTER_BYTES;
+	// Abandon any load in progress
+	_chunks_remaining = 0;
+	_disk_view.Close();
+	_disk_file.Close();
+	_disk_buckets = 0;
 
-	// Allocate that amount of memory
-	u64 *page = (u64*)LargeAligned::Acquire(bytes);
-	if (!page) return false;
+	if (_chunk_loaded)
+	{
+		delete [](u8*)_chunk_loaded;
+		_chunk_loaded = 0;
+	}
 
-	// Zero it
-	CAT_CLR(page, bytes - TABLE_FOOTER_BYTES);
+	if (_old_table)
+	{
+		LargeAllocator::ref()->Release(_old_table);
 
-	// If there is an old table (should be),
-	u64 *old = _table;
-	if (old)
+		_old_table = 0;
+		_old_buckets = 0;
+		_old_bucket_count = 0;
+	}
+
+	if (_table)
 	{
-		// Redistribute the old table elements across the expanded table
-		for (u32 ii = 0, end = _table_elements, mask = target_size - 1; ii < end; ++ii)
-		{
-			u64 offset = old[ii << 1];
+		LargeAllocator::ref()->Release(_table);
 
-			// If this old element is used,
-			if (offset)
-			{
-				u64 hash = old[(ii << 1) + 1];
-				u32 key = (u32)hash & mask;
+		_table = 0;
+		_table_raw_bytes = 0;
+		_buckets = 0;
+		_bucket_count = 0;
+		_used_elements = 0;
+		_deleted_elements = 0;
+	}
+}
 
-				// While collision in new table,
-				u64 newoffset;
-				while ((newoffset = page[key << 1]))
-				{
-					page[key << 1] = newoffset | COLLIDE_MASK;
 
-					// LCG with period equal to the table size
-					key = (key * COLLISION_MULTIPLIER + COLLISION_INCREMENTER) & mask;
-				}
+//// Incremental Resize
 
-				// Write old element in new table
-				page[key << 1] = offset & OFFSET_MASK;
-				page[(key << 1) + 1] = hash;
-			}
-		}
+bool TableIndex::StartResize()
+{
+	// Resizing copies whole buckets, so the table must be fully in memory
+	FinishLoading();
 
-		LargeAligned::Release(old);
-	}
+	// Finish any previous resize before starting another
+	FinishResize();
+
+	// Double the table unless most of the fill is tombstones
+	u32 bucket_count = _bucket_count;
+	if (_used_elements >= bucket_count * BUCKET_SLOTS / 2)
+		bucket_count <<= 1;
+
+	u32 raw_bytes;
+	u8 *table = AllocateBuckets(bucket_count, raw_bytes);
+	if (!table) return false;
+
+	CAT_INANE("TableIndex") << "Growing index " << _file_path << " to " << bucket_count << " buckets";
 
-	// Choose new table
-	_table = page;
-	_table_elements = target_size;
-	_table_raw_bytes = bytes;
+	// Current table is drained into the new one a few buckets at a time
+	_old_table = _table;
+	_old_buckets = _buckets;
+	_old_bucket_count = _bucket_count;
+	_migrate_next = 0;
+
+	_table = table;
+	_table_raw_bytes = raw_bytes;
+	_buckets = reinterpret_cast<IndexBucket*>( table );
+	_bucket_count = bucket_count;
+	_deleted_elements = 0;
 
 	return true;
 }
 
-void TableIndex::FreeTable()
+void TableIndex::MigrateBuckets(u32 count)
 {
-	if (_table)
+	if (!_old_table) return;
+
+	u32 end = _migrate_next + count;
+	if (end > _old_bucket_count) end = _old_bucket_count;
+
+	// For each bucket to move,
+	for (u32 ii = _migrate_next; ii < end; ++ii)
 	{
-		LargeAligned::Release(_table);
+		IndexBucket *bucket = &_old_buckets[ii];
 
-		_table = 0;
-		_table_elements = 0;
-		_table_raw_bytes = 0;
-		_used_elements = 0;
+		// For each used slot,
+		for (u32 used = ~MatchFree(bucket->tags) & 0xffff; used; used &= used - 1)
+		{
+			u32 slot = BSF32(used);
+
+			Place(_buckets, _bucket_count, bucket->slots[slot].hash, bucket->slots[slot].offset, false);
+
+			// Leave a tombstone so that old probe chains stay intact for lookups
+			bucket->tags[slot] = TAG_DELETED;
+		}
+	}
+
+	_migrate_next = end;
+
+	// If the old table is drained,
+	if (end >= _old_bucket_count)
+	{
+		LargeAllocator::ref()->Release(_old_table);
+
+		_old_table = 0;
+		_old_buckets = 0;
+		_old_bucket_count = 0;
 	}
 }
 
+void TableIndex::FinishResize()
+{
+	if (_old_table)
+		MigrateBuckets(_old_bucket_count);
+}
 
-//// Access
 
-void TableIndex::Save()
+//// Demand Loading
+
+void TableIndex::LoadChunk(u32 chunk)
 {
-	if (!_table) return;
+	AutoMutex lock(_load_lock);
+
+	// If another thread loaded it first,
+	if (!_chunks_remaining || _chunk_loaded[chunk])
+		return;
+
+	u32 first = chunk * _chunk_buckets;
+	u32 bytes = _chunk_buckets * sizeof(IndexBucket);
+	u8 *dest = reinterpret_cast<u8*>( &_buckets[first] );
 
-	INFO("TableIndex") << "Saving index file for " << _file_path;
+	memcpy(dest, _disk_buckets + first * sizeof(IndexBucket), bytes);
 
-	AsyncBuffer *buffer = AsyncBuffer::Wrap(_table, _table_raw_bytes);
-	if (!buffer)
+	// If the chunk does not match its checksum,
+	if (MurmurHash(dest, bytes, TABLE_CHECK_HASH_SALT + chunk).Get64() != GetChunkHashes(_table, _bucket_count)[chunk])
 	{
-		WARN("TableIndex") << "Out of memory: Unable to write table index for " << _file_path;
-		return;
+		CAT_WARN("TableIndex") << "Table index for " << _file_path << " was corrupted in chunk " << chunk;
+
+		// Present the chunk as empty until the index is regenerated
+		for (u32 ii = 0; ii < _chunk_buckets; ++ii)
+			memset(_buckets[first + ii].tags, TAG_EMPTY, BUCKET_SLOTS);
+
+		_corrupt = true;
 	}
 
-	// Write footer
-	_table[_table_elements << 1] = _used_elements;
-	_table[(_table_elements << 1) + 1] = MurmurHash(_table, _table_raw_bytes - 8, TABLE_CHECK_HASH_SALT).Get64();
+	// Publish the chunk contents before the loaded flag
+	Atomic::StoreMemoryBarrier();
 
-	if (!Write(buffer, 0))
+	_chunk_loaded[chunk] = 1;
+
+	// If this was the last chunk,
+	if (--_chunks_remaining == 0)
 	{
-		WARN("TableIndex") << "Unable to write table index for " << _file_path;
+		CAT_INFO("TableIndex") << "Table index for " << _file_path << " is fully loaded";
+
+		_disk_view.Close();
+		_disk_file.Close();
+		_disk_buckets = 0;
 	}
 }
 
-bool TableIndex::Initialize()
+void TableIndex::LoadAhead()
 {
-	if (!Open(_file_path, ASYNCFILE_READ | ASYNCFILE_WRITE))
+	for (u32 ii = 0; ii < LOAD_CHUNKS_PER_OP && _chunks_remaining; ++ii)
 	{
-		FATAL("TableIndex") << "Unable to open index file " << _file_path;
-		return false;
-	}
+		// Claim the next chunk: concurrent Lookup() calls each get a different one
+		u32 chunk = Atomic::Add(&_next_load_chunk, 1);
 
-	u32 size = (u32)GetSize(); // Table size is always assumed < 4 GB
-	u32 element_bytes = size - TABLE_FOOTER_BYTES;
-	u32 table_elements = element_bytes >> 4;
+		// Skip chunks that were already loaded on demand
+		while (chunk < _chunk_count && _chunk_loaded[chunk])
+			chunk = Atomic::Add(&_next_load_chunk, 1);
 
-	if (!size || table_elements < MIN_ELEMENTS || !CAT_IS_POWER_OF_2(element_bytes))
-	{
-		WARN("TableIndex") << "Table index for " << _file_path << " was not found.  Regenerating index..";
+		if (chunk >= _chunk_count) break;
 
-		return AllocateTable() && _parent->RequestIndexRebuild(this);
+		LoadChunk(chunk);
 	}
-	else
+}
+
+void TableIndex::FinishLoading()
+{
+	for (u32 chunk = 0; _chunks_remaining && chunk < _chunk_count; ++chunk)
 	{
-		INFO("TableIndex") << "Requesting read of index file for " << _parent->GetFilePath() << "..";
+		if (!_chunk_loaded[chunk])
+			LoadChunk(chunk);
+	}
+}
+
+void TableIndex::Regenerate()
+{
+	AutoWriteLock lock(_lock);
+
+	// If another thread already handled it,
+	if (!_corrupt) return;
+
+	_corrupt = false;
+
+	CAT_WARN("TableIndex") << "Regenerating index " << _file_path;
 
-		_table_elements = table_elements;
-		_table_raw_bytes = size;
+	if (!AllocateTable()) return;
+
+	lock.Release();
+
+	_parent->RequestIndexRebuild(this);
+}
 
-		_table = (u64*)LargeAligned::Acquire(size);
-		if (!_table)
+
+//// Probing
+
+u64 TableIndex::Find(IndexBucket *buckets, u32 bucket_count, u64 hash, bool demand)
+{
+	u32 mask = bucket_count - 1;
+	u32 key = (u32)hash & mask;
+	u8 tag = GetTag(hash);
+
+	// Triangular probe visits every bucket of a power-of-two table
+	for (u32 step = 1; step <= bucket_count; ++step)
+	{
+		if (demand) DemandLoad(key);
+
+		IndexBucket *bucket = &buckets[key];
+
+		// For each slot with a matching tag,
+		for (u32 match = MatchTags(bucket->tags, tag); match; match &= match - 1)
 		{
-			FATAL("TableIndex") << "Out of memory: Unable to allocate table index " << _file_path;
-			return false;
+			u32 slot = BSF32(match);
+
+			if (bucket->slots[slot].hash == hash)
+				return bucket->slots[slot].offset;
 		}
 
-		AsyncBuffer *buffer = AsyncBuffer::Wrap(_table, size);
-		if (!buffer)
+		// Stop at the first bucket that was never full
+		if (MatchTags(bucket->tags, TAG_EMPTY))
+			break;
+
+		key = (key + step) & mask;
+	}
+
+	return INVALID_RECORD_OFFSET;
+}
+
+void TableIndex::Place(IndexBucket *buckets, u32 bucket_count, u64 hash, u64 offset, bool demand)
+{
+	u32 mask = bucket_count - 1;
+	u32 key = (u32)hash & mask;
+
+	for (u32 step = 1; step <= bucket_count; ++step)
+	{
+		if (demand) DemandLoad(key);
+
+		IndexBucket *bucket = &buckets[key];
+
+		u32 free = MatchFree(bucket->tags);
+
+		// If the bucket has room,
+		if (free)
 		{
-			WARN("TableIndex") << "Out of memory: Unable to acquire read object for " << _file_path;
-			return false;
+			u32 slot = BSF32(free);
+
+			if (bucket->tags[slot] == TAG_DELETED)
+				--_deleted_elements;
+
+			bucket->tags[slot] = GetTag(hash);
+			bucket->slots[slot].offset = offset;
+			bucket->slots[slot].hash = hash;
+			return;
 		}
 
-		if (!Read(buffer, 0, fastdelegate::MakeDelegate(this, &TableIndex::OnRead)))
+		key = (key + step) & mask;
+	}
+
+	// Unreachable: the load factor keeps free slots in the table
+	CAT_FATAL("TableIndex") << "Index table full for " << _file_path;
+}
+
+bool TableIndex::Erase(IndexBucket *buckets, u32 bucket_count, u64 hash, bool demand)
+{
+	u32 mask = bucket_count - 1;
+	u32 key = (u32)hash & mask;
+	u8 tag = GetTag(hash);
+
+	for (u32 step = 1; step <= bucket_count; ++step)
+	{
+		if (demand) DemandLoad(key);
+
+		IndexBucket *bucket = &buckets[key];
+
+		for (u32 match = MatchTags(bucket->tags, tag); match; match &= match - 1)
 		{
-			FATAL("TableIndex") << "Read failure: Unable to read table index " << _file_path;
-			return false;
+			u32 slot = BSF32(match);
+
+			if (bucket->slots[slot].hash == hash)
+			{
+				// If no probe continues past this bucket, the slot can be reused freely
+				if (MatchTags(bucket->tags, TAG_EMPTY))
+					bucket->tags[slot] = TAG_EMPTY;
+				else
+				{
+					bucket->tags[slot] = TAG_DELETED;
+
+					// Only tombstones in the active table count toward its growth
+					if (buckets == _buckets) ++_deleted_elements;
+				}
+
+				return true;
+			}
 		}
+
+		if (MatchTags(bucket->tags, TAG_EMPTY))
+			break;
+
+		key = (key + step) & mask;
 	}
 
-	return true;
+	return false;
+}
+
+
+//// Access
+
+void TableIndex::Save()
+{
+	AutoWriteLock lock(_lock);
+
+	// Do not persist an index that is waiting to be regenerated
+	if (!_table || _corrupt) return;
+
+	// The whole table must be in memory and in one piece to be written
+	FinishLoading();
+	FinishResize();
+
+	CAT_INFO("TableIndex") << "Saving index file for " << _file_path;
+
+	u32 chunk_buckets, chunk_count;
+	GetTableBytes(_bucket_count, chunk_buckets, chunk_count);
+
+	// Write chunk checksums
+	u64 *chunk_hashes = GetChunkHashes(_table, _bucket_count);
+	for (u32 ii = 0; ii < chunk_count; ++ii)
+		chunk_hashes[ii] = MurmurHash(&_buckets[ii * chunk_buckets], chunk_buckets * sizeof(IndexBucket), TABLE_CHECK_HASH_SALT + ii).Get64();
+
+	// Write footer
+	IndexFooter *footer = reinterpret_cast<IndexFooter*>( chunk_hashes + chunk_count );
+	footer->used_elements = _used_elements;
+	footer->bucket_count = _bucket_count;
+	footer->check_hash = MurmurHash(chunk_hashes, chunk_count * sizeof(u64) + 16, TABLE_CHECK_HASH_SALT).Get64();
+
+	// Written under the lock so that no insert can change the table mid-write
+	FILE *file = fopen(_file_path, "wb");
+	if (!file)
+	{
+		CAT_WARN("TableIndex") << "Unable to open index file " << _file_path;
+		return;
+	}
+
+	if (fwrite(_table, 1, _table_raw_bytes, file) != _table_raw_bytes)
+	{
+		CAT_WARN("TableIndex") << "Unable to write table index for " << _file_path;
+	}
+
+	fclose(file);
 }
 
-bool TableIndex::OnRead(ThreadPoolLocalStorage *tls, int error, AsyncBuffer *buffer, u32 bytes)
+bool TableIndex::Initialize()
 {
-	u64 *data = buffer->GetData<u64>();
-	u64 offset = buffer->GetOffset();
+	if (!_disk_file.Open(_file_path, true))
+	{
+		CAT_WARN("TableIndex") << "Table index for " << _file_path << " was not found.  Regenerating index..";
+
+		return AllocateTable() && _parent->RequestIndexRebuild(this);
+	}
+
+	u64 size = _disk_file.GetLength(); // Table size is always assumed < 4 GB
+	const u8 *disk = 0;
+
+	if (size > sizeof(IndexFooter) && _disk_view.Open(&_disk_file))
+		disk = _disk_view.MapView(0, (u32)size);
 
-	if (error || offset != 0 || bytes != _table_raw_bytes || data != _table)
+	const IndexFooter *footer = disk ? reinterpret_cast<const IndexFooter*>( disk + size - sizeof(IndexFooter) ) : 0;
+
+	u32 bucket_count = footer ? (u32)footer->bucket_count : 0;
+	u32 chunk_buckets, chunk_count;
+
+	if (!footer || bucket_count < MIN_BUCKETS || !CAT_IS_POWER_OF_2(bucket_count) ||
+		GetTableBytes(bucket_count, chunk_buckets, chunk_count) != size)
 	{
-		WARN("TableIndex") << "Table index for " << _file_path << " was truncated.  Regenerating index..";
+		CAT_WARN("TableIndex") << "Table index for " << _file_path << " was truncated.  Regenerating index..";
 
-		AllocateTable() && _parent->RequestIndexRebuild(this);
-		return true;
+		FreeTable();
+		return AllocateTable() && _parent->RequestIndexRebuild(this);
 	}
 
-	// Read footer
-	_used_elements = (u32)_table[_table_elements << 1];
+	// Verify the chunk checksums and footer, which are all that is read up front
+	const u8 *disk_chunk_hashes = disk + bucket_count * sizeof(IndexBucket);
 
-	if (_table[(_table_elements << 1) + 1] != MurmurHash(_table, _table_raw_bytes - 8, TABLE_CHECK_HASH_SALT).Get64())
+	if (footer->check_hash != MurmurHash(disk_chunk_hashes, chunk_count * sizeof(u64) + 16, TABLE_CHECK_HASH_SALT).Get64())
 	{
-		WARN("TableIndex") << "Table index for " << _file_path << " was corrupted.  Regenerating index..";
+		CAT_WARN("TableIndex") << "Table index for " << _file_path << " was corrupted.  Regenerating index..";
+
+		FreeTable();
+		return AllocateTable() && _parent->RequestIndexRebuild(this);
+	}
+
+	u32 raw_bytes = (u32)size;
+	u8 *table = (u8*)LargeAllocator::ref()->Acquire(raw_bytes);
+	u8 *chunk_loaded = new u8[chunk_count];
 
-		AllocateTable() && _parent->RequestIndexRebuild(this);
-		return true;
+	if (!table || !chunk_loaded)
+	{
+		CAT_FATAL("TableIndex") << "Out of memory: Unable to allocate table index " << _file_path;
+		if (table) LargeAllocator::ref()->Release(table);
+		if (chunk_loaded) delete []chunk_loaded;
+		return false;
 	}
 
-	INFO("TableIndex") << "Table index read for " << _file_path << " successful.";
+	// Bring in the checksums now; buckets are copied in as they are touched
+	memcpy(GetChunkHashes(table, bucket_count), disk_chunk_hashes, chunk_count * sizeof(u64) + sizeof(IndexFooter));
+	CAT_CLR(chunk_loaded, chunk_count);
+
+	_table = table;
+	_table_raw_bytes = raw_bytes;
+	_buckets = reinterpret_cast<IndexBucket*>( table );
+	_bucket_count = bucket_count;
+	_used_elements = (u32)footer->used_elements;
+	_deleted_elements = 0; // Tombstones are only counted for growth, so start fresh
+
+	_disk_buckets = disk;
+	_chunk_loaded = chunk_loaded;
+	_chunk_buckets = chunk_buckets;
+	_chunk_count = chunk_count;
+	_next_load_chunk = 0;
+	_chunks_remaining = chunk_count;
+
+	CAT_INFO("TableIndex") << "Table index for " << _file_path << " mapped with " << _used_elements << " elements; loading on demand";
 
 	return true;
 }
@@ -267,127 +627,67 @@ u64 TableIndex::Lookup(u64 hash)
 {
 	if (!hash) return INVALID_RECORD_OFFSET;
 
-	u32 mask = _table_elements - 1;
-	u32 key = (hash - 1) & mask;
-
 	AutoReadLock lock(_lock);
 
-	// Find table entry starting from key
-	u64 *table = _table;
-	u64 offset;
-	while ((offset = table[key << 1]))
-	{
-		u64 existing = table[(key << 1) + 1];
+	u64 offset = Find(_buckets, _bucket_count, hash, true);
 
-		// If we found it,
-		if (hash == existing) return (offset & OFFSET_MASK) - 1;
+	// If not found and a resize is in progress, check the old table too
+	if (offset == INVALID_RECORD_OFFSET && _old_table)
+		offset = Find(_old_buckets, _old_bucket_count, hash, false);
 
-		// Break on a break in the collision list
-		if (!(offset & COLLIDE_MASK)) break;
+	LoadAhead();
 
-		// LCG with period equal to the table size
-		key = (key * COLLISION_MULTIPLIER + COLLISION_INCREMENTER) & mask;
-	}
+	lock.Release();
 
-	return INVALID_RECORD_OFFSET;
+	if (_corrupt) Regenerate();
+
+	return offset;
 }
 
 void TableIndex::Insert(u64 hash, u64 offset)
 {
 	if (!hash) return;
 
-	u32 mask = _table_elements - 1;
-	u32 key = (hash - 1) & mask;
-
 	AutoWriteLock lock(_lock);
 
-	// Grow if too many used elements
-	if (_used_elements >= (_table_elements >> 1))
+	// Grow if too many used elements, counting tombstones since they lengthen probes
+	if (_used_elements + _deleted_elements >= _bucket_count * BUCKET_SLOTS / 8 * 7)
 	{
-		if (!DoubleTable())
+		if (!StartResize())
 		{
-			FATAL("TableIndex") << "Out of memory: Unable to double size of index table " << _file_path;
+			CAT_FATAL("TableIndex") << "Out of memory: Unable to grow index table " << _file_path;
 			return;
 		}
 	}
 
-	// Find insertion point in the case of collision
-	u64 *table = _table;
-	u64 oldoffset;
-	while ((oldoffset = table[key << 1]) & OFFSET_MASK)
-	{
-		table[key << 1] = oldoffset | COLLIDE_MASK;
+	Place(_buckets, _bucket_count, hash, offset, true);
 
-		// LCG with period equal to the table size
-		key = (key * COLLISION_MULTIPLIER + COLLISION_INCREMENTER) & mask;
-	}
+	++_used_elements;
 
-	// Insert preserving collision flag
-	table[key << 1] = oldoffset | (offset + 1);
-	table[(key << 1) + 1] = hash;
+	MigrateBuckets(MIGRATE_BUCKETS_PER_OP);
+	LoadAhead();
 
-	++_used_elements;
+	lock.Release();
+
+	if (_corrupt) Regenerate();
 }
 
 void TableIndex::Remove(u64 hash)
 {
 	if (!hash) return;
 
-	u32 mask = _table_elements - 1;
-	u32 key = (hash - 1) & mask;
-	u32 last = key; // Represents the last valid entry
-
 	AutoWriteLock lock(_lock);
 
-	// Find insertion point in the case of collision
-	u64 *table = _table;
-	u64 offset;
-	while ((offset = table[key << 1]))
+	if (Erase(_buckets, _bucket_count, hash, true) ||
+		(_old_table && Erase(_old_buckets, _old_bucket_count, hash, false)))
 	{
-		u64 existing = table[(key << 1) + 1];
-
-		// If found entry to remove,
-		if (hash == existing)
-		{
-			offset &= COLLIDE_MASK;
-
-			table[key << 1] = offset;
-			table[(key << 1) + 1] = 0; // Set invalid hash value
-
-			--_used_elements;
-
-			// If last entry is to be unlinked,
-			if (!offset && last != key)
-			{
-				// Unlink from previous
-				table[last << 1] &= OFFSET_MASK;
-
-				// Zero out entries between previous and removed entry
-				for (;;)
-				{
-					// LCG with period equal to the table size
-					last = (last * COLLISION_MULTIPLIER + COLLISION_INCREMENTER) & mask;
-
-					if (last == key) break;
-
-					table[last << 1] = 0;
-				}
-			}
+		--_used_elements;
+	}
 
-			break;
-		}
+	MigrateBuckets(MIGRATE_BUCKETS_PER_OP);
+	LoadAhead();
 
-		// Break on a break in the collision list
-		if (!(offset & COLLIDE_MASK)) break;
+	lock.Release();
 
-		// If offset is set,
-		if (offset & OFFSET_MASK)
-		{
-			// Relocate the last valid entry
-			last = key;
-		}
-
-		// LCG with period equal to the table size
-		key = (key * COLLISION_MULTIPLIER + COLLISION_INCREMENTER) & mask;
-	}
+	if (_corrupt) Regenerate();
 }
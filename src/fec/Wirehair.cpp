@@ -202,6 +202,8 @@
 
 #include <cat/fec/Wirehair.hpp>
 #include <cat/math/MemXOR.hpp>
+#include <cat/threads/WorkerThreads.hpp>
+#include <cat/threads/Atomic.hpp>
 #if defined(CAT_HEAVY_WIN_MULT)
 #include <cat/port/EndianNeutral.hpp>
 #endif
@@ -1013,12 +1015,15 @@ struct Codec::PeelRow
 		struct
 		{
 			u16 peel_column;	// Peeling column that is solved by this row
-			u8 is_copied;		// Row value is copied yet?
+			u16 copy_row;		// First peeled row to add its value into this one, or LIST_TERM
 		};
 	};
 };
 #pragma pack(pop)
 
+// Identifier for PeelRow slots not yet used by the streaming decoder
+static const u32 UNUSED_ROW_ID = 0xffffffff;
+
 // Marks for PeelColumn
 enum MarkTypes
 {
@@ -1053,6 +1058,75 @@ struct Codec::PeelRefs
 };
 #pragma pack(pop)
 
+// Work handed to worker threads
+enum WorkerPasses
+{
+	PASS_RECOVERY,		// GenerateRecoveryValues() on a column range
+	PASS_RECONSTRUCT,	// RegenerateOutput() on a column range
+	PASS_ENCODE			// Encode() one block of a batch
+};
+
+struct Codec::WorkerTask : WorkerBuffer
+{
+	WorkerJob *job;
+};
+
+// One job shared between the calling thread and the workers.
+// Workers that start after the job is finished find no items left and
+// only drop their reference, so the job outlives the call if needed
+struct Codec::WorkerJob
+{
+	Codec *codec;
+	int pass;					// One of the WorkerPasses
+	u32 item_count;				// Number of column ranges or blocks
+	u32 slice_bytes;			// Bytes per column range
+	u8 *output_blocks;			// Message output for PASS_RECONSTRUCT
+	u32 first_id;				// First block identifier for PASS_ENCODE
+	void * const *blocks_out;	// Block outputs for PASS_ENCODE
+	u32 *bytes_out;				// Bytes written to each block for PASS_ENCODE
+	volatile u32 next_item, done_items, refs;
+	WaitableFlag finished;
+	WorkerTask tasks[MAX_WORKER_THREADS];
+
+	void Work()
+	{
+		u32 worked = 0;
+
+		// Claim items until none are left
+		for (;;)
+		{
+			u32 index = Atomic::Add(&next_item, 1);
+			if (index >= item_count) break;
+
+			codec->RunWorkerItem(this, index);
+			++worked;
+		}
+
+		// If this thread finished the last item,
+		if (worked && Atomic::Add(&done_items, worked) + worked == item_count)
+			finished.Set();
+	}
+
+	void Release()
+	{
+		if (Atomic::Add(&refs, -1) == 1)
+			delete this;
+	}
+
+	void OnWork(ThreadLocalStorage &tls, const BatchSet &buffers)
+	{
+		for (BatchHead *node = buffers.head, *next; node; node = next)
+		{
+			next = node->batch_next;
+
+			WorkerJob *job = static_cast<WorkerTask*>( node )->job;
+
+			job->Work();
+			job->Release();
+		}
+	}
+};
+
 
 //// (1) Peeling:
 
@@ -1322,8 +1396,8 @@ void Codec::Peel(u16 row_i, PeelRow *row, u16 column_i)
 	row->next = LIST_TERM;
 	_peel_tail_rows = row;
 
-	// Indicate that this row hasn't been copied yet
-	row->is_copied = 0;
+	// Indicate that no row value has been added to this one yet
+	row->copy_row = LIST_TERM;
 
 	// Attempt to avalanche and solve other columns
 	PeelAvalanche(column_i);
@@ -1614,34 +1688,28 @@ void Codec::SetMixingColumnsForDeferredRows()
 		This function diagonalizes the peeled rows and columns of the
 	check matrix.  The result is that the peeled submatrix is the
 	identity matrix, and that the other columns of the peeled rows are
-	very dense and have temporary block values assigned.  These dense
-	columns are used to efficiently zero out the peeled columns of the
-	other rows.
+	very dense.  These dense columns are used to efficiently zero out
+	the peeled columns of the other rows.
 
-		This function is one of the most expensive in the whole codec,
-	because its memory access patterns are not cache-friendly.
+		The temporary block values are assigned later by the
+	PeelDiagonalValues() function, which is one of the most expensive
+	in the whole codec because its memory access patterns are not
+	cache-friendly.  Here it only notes the first row to add its
+	value into each peeled row, so that the message block can be
+	combined with it in one pass.
 
 	For each peeled row in forward solution order,
 		Set mixing column bits for the row in the Compression matrix.
-		Generate row block value.
 		For each row that references this row in the peeling matrix,
 			Add Compression matrix row to referencing row.
-			If row is peeled,
-				Add row block value.
+			If row is peeled and has no value added to it yet,
+				Remember this row as its first one.
 */
 
 void Codec::PeelDiagonal()
 {
 	CAT_IF_DUMP(cout << endl << "---- PeelDiagonal ----" << endl << endl;)
 
-	/*
-		This function optimizes the block value generation by combining the first
-		memcpy and memxor operations together into a three-way memxor if possible,
-		using the is_copied row member.
-	*/
-
-	CAT_IF_ROWOP(int rowops = 0;)
-
 	// For each peeled row in forward solution order,
 	PeelRow *row;
 	for (u16 peel_row_i = _peel_head_rows; peel_row_i != LIST_TERM; peel_row_i = row->next)
@@ -1675,30 +1743,91 @@ void Codec::PeelDiagonal()
 		ge_row[ge_column_i >> 6] ^= (u64)1 << (ge_column_i & 63);
 		CAT_IF_DUMP(cout << " " << ge_column_i << endl;)
 
+		CAT_IF_DUMP(cout << "++ Adding to referencing rows:";)
+
+		// For each row that references this one,
+		PeelRefs *refs = &_peel_col_refs[peel_column_i];
+		u16 count = refs->row_count;
+		u16 *ref_row = refs->rows;
+		while (count--)
+		{
+			u16 ref_row_i = *ref_row++;
+
+			// Skip this row
+			if (ref_row_i == peel_row_i) continue;
+
+			CAT_IF_DUMP(cout << " " << ref_row_i;)
+
+			// Add GE row to referencing GE row
+			u64 *ge_ref_row = _compress_matrix + _ge_pitch * ref_row_i;
+			for (int ii = 0; ii < _ge_pitch; ++ii) ge_ref_row[ii] ^= ge_row[ii];
+
+			// If referencing row is peeled and nothing has been added to it yet,
+			PeelRow *ref_row = &_peel_rows[ref_row_i];
+			if (ref_row->peel_column != LIST_TERM && ref_row->copy_row == LIST_TERM)
+			{
+				// Combine its message block with this row value later (optimization)
+				ref_row->copy_row = peel_row_i;
+			}
+		} // next referencing row
+
+		CAT_IF_DUMP(cout << endl;)
+	} // next peeled row
+}
+
+/*
+	PeelDiagonalValues
+
+		This function replays the PeelDiagonal() row operations on the
+	block values.  It is separated from the symbolic step so that it can
+	be run on each column range of the blocks independently.
+
+	For each peeled row in forward solution order,
+		If no row value was added into it yet,
+			Copy its message block to the peeled column.
+		For each referencing row that is peeled,
+			Add row block value.
+*/
+
+void Codec::PeelDiagonalValues()
+{
+	CAT_IF_DUMP(cout << endl << "---- PeelDiagonalValues ----" << endl << endl;)
+
+	/*
+		This function optimizes the block value generation by combining the first
+		memcpy and memxor operations together into a three-way memxor if possible,
+		using the copy_row member set by PeelDiagonal().
+	*/
+
+	CAT_IF_ROWOP(int rowops = 0;)
+
+	// For each peeled row in forward solution order,
+	PeelRow *row;
+	for (u16 peel_row_i = _peel_head_rows; peel_row_i != LIST_TERM; peel_row_i = row->next)
+	{
+		row = &_peel_rows[peel_row_i];
+
 		// Lookup output block
+		u16 peel_column_i = row->peel_column;
 		u8 *temp_block_src = _recovery_blocks + _block_bytes * peel_column_i;
 
 		// If row has not been copied yet,
-		if (!row->is_copied)
+		if (row->copy_row == LIST_TERM)
 		{
 			// Copy it directly to the output block
-			const u8 *block_src = _input_blocks + _block_bytes * peel_row_i;
+			const u8 *block_src = GetInputBlock(peel_row_i);
 			if (peel_row_i != _block_count - 1)
-				memcpy(temp_block_src, block_src, _block_bytes);
+				memcpy(temp_block_src, block_src, _value_bytes);
 			else
 			{
 				memcpy(temp_block_src, block_src, _input_final_bytes);
-				memset(temp_block_src + _input_final_bytes, 0, _block_bytes - _input_final_bytes);
+				memset(temp_block_src + _input_final_bytes, 0, _value_bytes - _input_final_bytes);
 			}
 			CAT_IF_ROWOP(++rowops;)
 
 			CAT_IF_DUMP(cout << "-- Copied from " << peel_row_i << " because has not been copied yet.  Output block = " << (int)temp_block_src[0] << endl;)
-
-			// NOTE: Do not need to set is_copied here because no further rows reference this one
 		}
 
-		CAT_IF_DUMP(cout << "++ Adding to referencing rows:";)
-
 		// For each row that references this one,
 		PeelRefs *refs = &_peel_col_refs[peel_column_i];
 		u16 count = refs->row_count;
@@ -1710,12 +1839,6 @@ void Codec::PeelDiagonal()
 			// Skip this row
 			if (ref_row_i == peel_row_i) continue;
 
-			CAT_IF_DUMP(cout << " " << ref_row_i;)
-
-			// Add GE row to referencing GE row
-			u64 *ge_ref_row = _compress_matrix + _ge_pitch * ref_row_i;
-			for (int ii = 0; ii < _ge_pitch; ++ii) ge_ref_row[ii] ^= ge_row[ii];
-
 			// If row is peeled,
 			PeelRow *ref_row = &_peel_rows[ref_row_i];
 			u16 ref_column_i = ref_row->peel_column;
@@ -1725,33 +1848,29 @@ void Codec::PeelDiagonal()
 				u8 *temp_block_dest = _recovery_blocks + _block_bytes * ref_column_i;
 
 				// If referencing row is already copied to the recovery blocks,
-				if (ref_row->is_copied)
+				if (ref_row->copy_row != peel_row_i)
 				{
 					// Add this row block value to it
-					memxor(temp_block_dest, temp_block_src, _block_bytes);
+					memxor(temp_block_dest, temp_block_src, _value_bytes);
 				}
 				else
 				{
 					// Add this row block value with message block to it (optimization)
-					const u8 *block_src = _input_blocks + _block_bytes * ref_row_i;
+					const u8 *block_src = GetInputBlock(ref_row_i);
 					if (ref_row_i != _block_count - 1)
-						memxor_set(temp_block_dest, temp_block_src, block_src, _block_bytes);
+						memxor_set(temp_block_dest, temp_block_src, block_src, _value_bytes);
 					else
 					{
 						memxor_set(temp_block_dest, temp_block_src, block_src, _input_final_bytes);
-						memcpy(temp_block_dest + _input_final_bytes, temp_block_src + _input_final_bytes, _block_bytes - _input_final_bytes);
+						memcpy(temp_block_dest + _input_final_bytes, temp_block_src + _input_final_bytes, _value_bytes - _input_final_bytes);
 					}
-
-					ref_row->is_copied = 1;
 				}
 				CAT_IF_ROWOP(++rowops;)
 			} // end if referencing row is peeled
 		} // next referencing row
-
-		CAT_IF_DUMP(cout << endl;)
 	} // next peeled row
 
-	CAT_IF_ROWOP(cout << "PeelDiagonal used " << rowops << " row ops = " << rowops / (double)_block_count << "*N" << endl;)
+	CAT_IF_ROWOP(cout << "PeelDiagonalValues used " << rowops << " row ops = " << rowops / (double)_block_count << "*N" << endl;)
 }
 
 /*
@@ -2634,6 +2753,66 @@ bool Codec::Triangle()
 
 //// (4) Substitute
 
+/*
+	MapDenseRows
+
+		This function stores which column solves each dense row so that
+	the value operations that follow can look them up.  It only touches
+	the row map and runs once before any column range of the values is
+	generated.
+
+	For each pivot that solves the GE matrix,
+		If GE row is from a dense row,
+			Set the GE row map entry to the column it solves.
+
+	For each remaining unused row, (happens in the decoder for extra rows)
+		If the unused row is a dense row,
+			Set the GE row map entry to LIST_TERM so it can be ignored later.
+*/
+
+void Codec::MapDenseRows()
+{
+	CAT_IF_DUMP(cout << endl << "---- MapDenseRows ----" << endl << endl;)
+
+	const u16 first_heavy_row = _defer_count + _dense_count;
+	const u16 column_count = _defer_count + _mix_count;
+
+	// For each pivot,
+	u16 pivot_i;
+	for (pivot_i = 0; pivot_i < column_count; ++pivot_i)
+	{
+		u16 ge_row_i = _pivots[pivot_i];
+
+		// If it is a dense/heavy(non-extra) row,
+		if (ge_row_i < _dense_count ||
+			ge_row_i >= (first_heavy_row + _extra_count))
+		{
+			// Store which column solves the dense row
+			_ge_row_map[ge_row_i] = _ge_col_map[pivot_i];
+		}
+	}
+
+	// For each remaining pivot,
+	for (; pivot_i < _pivot_count; ++pivot_i)
+	{
+		u16 ge_row_i = _pivots[pivot_i];
+
+		// If row is a dense row,
+		if (ge_row_i < _dense_count ||
+			(ge_row_i >= first_heavy_row && ge_row_i < column_count))
+		{
+			// Mark it for skipping
+			_ge_row_map[ge_row_i] = LIST_TERM;
+
+			CAT_IF_DUMP(cout << "Did not use GE row " << ge_row_i << ", which is a dense row." << endl;)
+		}
+		else
+		{
+			CAT_IF_DUMP(cout << "Did not use deferred row " << ge_row_i << ", which is not a dense row." << endl;)
+		}
+	}
+}
+
 /*
 	InitializeColumnValues
 
@@ -2649,10 +2828,6 @@ bool Codec::Triangle()
 		Else it is from a deferred row,
 			For each peeled column that it references,
 				Add in that peeled column's row value from Compression.
-
-	For each remaining unused row, (happens in the decoder for extra rows)
-		If the unused row is a dense row,
-			Set the GE row map entry to LIST_TERM so it can be ignored later.
 */
 
 void Codec::InitializeColumnValues()
@@ -2665,8 +2840,7 @@ void Codec::InitializeColumnValues()
 	const u16 column_count = _defer_count + _mix_count;
 
 	// For each pivot,
-	u16 pivot_i;
-	for (pivot_i = 0; pivot_i < column_count; ++pivot_i)
+	for (u16 pivot_i = 0; pivot_i < column_count; ++pivot_i)
 	{
 		// Lookup pivot column, GE row, and destination buffer
 		u16 dest_column_i = _ge_col_map[pivot_i];
@@ -2680,10 +2854,7 @@ void Codec::InitializeColumnValues()
 			ge_row_i >= (first_heavy_row + _extra_count))
 		{
 			// Dense/heavy rows sum to zero
-			memset(buffer_dest, 0, _block_bytes);
-
-			// Store which column solves the dense row
-			_ge_row_map[ge_row_i] = dest_column_i;
+			memset(buffer_dest, 0, _value_bytes);
 
 			CAT_IF_DUMP(cout << "[0]" << endl;)
 			CAT_IF_ROWOP(++rowops;)
@@ -2693,7 +2864,7 @@ void Codec::InitializeColumnValues()
 
 		// Look up row and input value for GE row
 		u16 row_i = _ge_row_map[ge_row_i];
-		const u8 *combo = _input_blocks + _block_bytes * row_i;
+		const u8 *combo = GetInputBlock(row_i);
 		PeelRow *row = &_peel_rows[row_i];
 
 		CAT_IF_DUMP(cout << "[" << (int)combo[0] << "]";)
@@ -2702,7 +2873,7 @@ void Codec::InitializeColumnValues()
 		if (row_i == _block_count - 1)
 		{
 			memcpy(buffer_dest, combo, _input_final_bytes);
-			memset(buffer_dest + _input_final_bytes, 0, _block_bytes - _input_final_bytes);
+			memset(buffer_dest + _input_final_bytes, 0, _value_bytes - _input_final_bytes);
 			CAT_IF_ROWOP(++rowops;)
 			combo = 0;
 		}
@@ -2719,11 +2890,11 @@ void Codec::InitializeColumnValues()
 			{
 				// If combo unused,
 				if (!combo)
-					memxor(buffer_dest, _recovery_blocks + _block_bytes * column_i, _block_bytes);
+					memxor(buffer_dest, _recovery_blocks + _block_bytes * column_i, _value_bytes);
 				else
 				{
 					// Use combo
-					memxor_set(buffer_dest, combo, _recovery_blocks + _block_bytes * column_i, _block_bytes);
+					memxor_set(buffer_dest, combo, _recovery_blocks + _block_bytes * column_i, _value_bytes);
 					combo = 0;
 				}
 				CAT_IF_ROWOP(++rowops;)
@@ -2735,30 +2906,10 @@ void Codec::InitializeColumnValues()
 		}
 
 		// If combo still unused,
-		if (combo) memcpy(buffer_dest, combo, _block_bytes);
+		if (combo) memcpy(buffer_dest, combo, _value_bytes);
 		CAT_IF_DUMP(cout << endl;)
 	}
 
-	// For each remaining pivot,
-	for (; pivot_i < _pivot_count; ++pivot_i)
-	{
-		u16 ge_row_i = _pivots[pivot_i];
-
-		// If row is a dense row,
-		if (ge_row_i < _dense_count ||
-			(ge_row_i >= first_heavy_row && ge_row_i < column_count))
-		{
-			// Mark it for skipping
-			_ge_row_map[ge_row_i] = LIST_TERM;
-
-			CAT_IF_DUMP(cout << "Did not use GE row " << ge_row_i << ", which is a dense row." << endl;)
-		}
-		else
-		{
-			CAT_IF_DUMP(cout << "Did not use deferred row " << ge_row_i << ", which is not a dense row." << endl;)
-		}
-	}
-
 	CAT_IF_ROWOP(cout << "InitializeColumnValues used " << rowops << " row ops = " << rowops / (double)_block_count << "*N" << endl;)
 }
 
@@ -2831,13 +2982,13 @@ void Codec::MultiplyDenseValues()
 				else if (combo == temp_block)
 				{
 					// Else if combo has been used: XOR it in
-					memxor(temp_block, src, _block_bytes);
+					memxor(temp_block, src, _value_bytes);
 					CAT_IF_ROWOP(++rowops;)
 				}
 				else
 				{
 					// Else if combo needs to be used: Combine into block
-					memxor_set(temp_block, combo, src, _block_bytes);
+					memxor_set(temp_block, combo, src, _value_bytes);
 					CAT_IF_ROWOP(++rowops;)
 					combo = temp_block;
 				}
@@ -2848,13 +2999,13 @@ void Codec::MultiplyDenseValues()
 
 		// If no combo ever triggered,
 		if (!combo)
-			memset(temp_block, 0, _block_bytes);
+			memset(temp_block, 0, _value_bytes);
 		else
 		{
 			// Else if never combined two: Just copy it
 			if (combo != temp_block)
 			{
-				memcpy(temp_block, combo, _block_bytes);
+				memcpy(temp_block, combo, _value_bytes);
 				CAT_IF_ROWOP(++rowops;)
 			}
 
@@ -2862,7 +3013,7 @@ void Codec::MultiplyDenseValues()
 			u16 dest_column_i = _ge_row_map[*row];
 			if (dest_column_i != LIST_TERM)
 			{
-				memxor(_recovery_blocks + _block_bytes * dest_column_i, temp_block, _block_bytes);
+				memxor(_recovery_blocks + _block_bytes * dest_column_i, temp_block, _value_bytes);
 				CAT_IF_ROWOP(++rowops;)
 			}
 		}
@@ -2884,19 +3035,19 @@ void Codec::MultiplyDenseValues()
 				if (bit1 < max_x && column[bit1].mark == MARK_PEEL)
 				{
 					CAT_IF_DUMP(cout << " " << column_i + bit0 << "+" << column_i + bit1;)
-					memxor_add(temp_block, source_block + _block_bytes * bit0, source_block + _block_bytes * bit1, _block_bytes);
+					memxor_add(temp_block, source_block + _block_bytes * bit0, source_block + _block_bytes * bit1, _value_bytes);
 				}
 				else
 				{
 					CAT_IF_DUMP(cout << " " << column_i + bit0;)
-					memxor(temp_block, source_block + _block_bytes * bit0, _block_bytes);
+					memxor(temp_block, source_block + _block_bytes * bit0, _value_bytes);
 				}
 				CAT_IF_ROWOP(++rowops;)
 			}
 			else if (bit1 < max_x && column[bit1].mark == MARK_PEEL)
 			{
 				CAT_IF_DUMP(cout << " " << column_i + bit1;)
-				memxor(temp_block, source_block + _block_bytes * bit1, _block_bytes);
+				memxor(temp_block, source_block + _block_bytes * bit1, _value_bytes);
 				CAT_IF_ROWOP(++rowops;)
 			}
 
@@ -2906,7 +3057,7 @@ void Codec::MultiplyDenseValues()
 			u16 dest_column_i = _ge_row_map[*row++];
 			if (dest_column_i != LIST_TERM)
 			{
-				memxor(_recovery_blocks + _block_bytes * dest_column_i, temp_block, _block_bytes);
+				memxor(_recovery_blocks + _block_bytes * dest_column_i, temp_block, _value_bytes);
 				CAT_IF_ROWOP(++rowops;)
 			}
 		}
@@ -2927,19 +3078,19 @@ void Codec::MultiplyDenseValues()
 				if (bit1 < max_x && column[bit1].mark == MARK_PEEL)
 				{
 					CAT_IF_DUMP(cout << " " << column_i + bit0 << "+" << column_i + bit1;)
-					memxor_add(temp_block, source_block + _block_bytes * bit0, source_block + _block_bytes * bit1, _block_bytes);
+					memxor_add(temp_block, source_block + _block_bytes * bit0, source_block + _block_bytes * bit1, _value_bytes);
 				}
 				else
 				{
 					CAT_IF_DUMP(cout << " " << column_i + bit0;)
-					memxor(temp_block, source_block + _block_bytes * bit0, _block_bytes);
+					memxor(temp_block, source_block + _block_bytes * bit0, _value_bytes);
 				}
 				CAT_IF_ROWOP(++rowops;)
 			}
 			else if (bit1 < max_x && column[bit1].mark == MARK_PEEL)
 			{
 				CAT_IF_DUMP(cout << " " << column_i + bit1;)
-				memxor(temp_block, source_block + _block_bytes * bit1, _block_bytes);
+				memxor(temp_block, source_block + _block_bytes * bit1, _value_bytes);
 				CAT_IF_ROWOP(++rowops;)
 			}
 
@@ -2949,7 +3100,7 @@ void Codec::MultiplyDenseValues()
 			u16 dest_column_i = _ge_row_map[*row++];
 			if (dest_column_i != LIST_TERM)
 			{
-				memxor(_recovery_blocks + _block_bytes * dest_column_i, temp_block, _block_bytes);
+				memxor(_recovery_blocks + _block_bytes * dest_column_i, temp_block, _value_bytes);
 				CAT_IF_ROWOP(++rowops;)
 			}
 		}
@@ -3072,7 +3223,7 @@ void Codec::AddSubdiagonalValues()
 					{
 						// Back-substitute
 						u8 *dest = _recovery_blocks + _block_bytes * _ge_col_map[dest_pivot_i];
-						memxor(dest, src, _block_bytes);
+						memxor(dest, src, _value_bytes);
 						CAT_IF_ROWOP(++rowops;)
 
 						CAT_IF_DUMP(cout << " " << dest_pivot_i;)
@@ -3087,20 +3238,20 @@ void Codec::AddSubdiagonalValues()
 			// Generate window table: 2 bits
 			win_table[1] = _recovery_blocks + _block_bytes * _ge_col_map[pivot_i];
 			win_table[2] = _recovery_blocks + _block_bytes * _ge_col_map[pivot_i + 1];
-			memxor_set(win_table[3], win_table[1], win_table[2], _block_bytes);
+			memxor_set(win_table[3], win_table[1], win_table[2], _value_bytes);
 			CAT_IF_ROWOP(++rowops;)
 
 			// Generate window table: 3 bits
 			win_table[4] = _recovery_blocks + _block_bytes * _ge_col_map[pivot_i + 2];
-			memxor_set(win_table[5], win_table[1], win_table[4], _block_bytes);
-			memxor_set(win_table[6], win_table[2], win_table[4], _block_bytes);
-			memxor_set(win_table[7], win_table[1], win_table[6], _block_bytes);
+			memxor_set(win_table[5], win_table[1], win_table[4], _value_bytes);
+			memxor_set(win_table[6], win_table[2], win_table[4], _value_bytes);
+			memxor_set(win_table[7], win_table[1], win_table[6], _value_bytes);
 			CAT_IF_ROWOP(rowops += 3;)
 
 			// Generate window table: 4 bits
 			win_table[8] = _recovery_blocks + _block_bytes * _ge_col_map[pivot_i + 3];
 			for (int ii = 1; ii < 8; ++ii)
-				memxor_set(win_table[8 + ii], win_table[ii], win_table[8], _block_bytes);
+				memxor_set(win_table[8 + ii], win_table[ii], win_table[8], _value_bytes);
 			CAT_IF_ROWOP(rowops += 7;)
 
 			// Generate window table: 5+ bits
@@ -3108,21 +3259,21 @@ void Codec::AddSubdiagonalValues()
 			{
 				win_table[16] = _recovery_blocks + _block_bytes * _ge_col_map[pivot_i + 4];
 				for (int ii = 1; ii < 16; ++ii)
-					memxor_set(win_table[16 + ii], win_table[ii], win_table[16], _block_bytes);
+					memxor_set(win_table[16 + ii], win_table[ii], win_table[16], _value_bytes);
 				CAT_IF_ROWOP(rowops += 15;)
 
 				if (w >= 6)
 				{
 					win_table[32] = _recovery_blocks + _block_bytes * _ge_col_map[pivot_i + 5];
 					for (int ii = 1; ii < 32; ++ii)
-						memxor_set(win_table[32 + ii], win_table[ii], win_table[32], _block_bytes);
+						memxor_set(win_table[32 + ii], win_table[ii], win_table[32], _value_bytes);
 					CAT_IF_ROWOP(rowops += 31;)
 
 					if (w >= 7)
 					{
 						win_table[64] = _recovery_blocks + _block_bytes * _ge_col_map[pivot_i + 6];
 						for (int ii = 1; ii < 64; ++ii)
-							memxor_set(win_table[64 + ii], win_table[ii], win_table[64], _block_bytes);
+							memxor_set(win_table[64 + ii], win_table[ii], win_table[64], _value_bytes);
 						CAT_IF_ROWOP(rowops += 63;)
 					}
 				}
@@ -3153,7 +3304,7 @@ void Codec::AddSubdiagonalValues()
 
 						// Back-substitute
 						u8 *dest = _recovery_blocks + _block_bytes * _ge_col_map[ge_below_i];
-						memxor(dest, win_table[win_bits], _block_bytes);
+						memxor(dest, win_table[win_bits], _value_bytes);
 						CAT_IF_ROWOP(++rowops;)
 					}
 				}
@@ -3180,7 +3331,7 @@ void Codec::AddSubdiagonalValues()
 
 						// Back-substitute
 						u8 *dest = _recovery_blocks + _block_bytes * _ge_col_map[ge_below_i];
-						memxor(dest, win_table[win_bits], _block_bytes);
+						memxor(dest, win_table[win_bits], _value_bytes);
 						CAT_IF_ROWOP(++rowops;)
 					}
 				}
@@ -3246,14 +3397,14 @@ void Codec::AddSubdiagonalValues()
 
 				if (code_value == 1)
 				{
-					memxor(dest, src, _block_bytes);
+					memxor(dest, src, _value_bytes);
 					CAT_IF_ROWOP(++rowops;)
 
 					CAT_IF_DUMP(cout << " *" << ge_column_i << "=[" << (int)src[0] << "]";)
 				}
 				else
 				{
-					GF256MemMulAdd(dest, code_value, src, _block_bytes);
+					GF256MemMulAdd(dest, code_value, src, _value_bytes);
 					CAT_IF_ROWOP(++heavyops;)
 
 					CAT_IF_DUMP(cout << " h" << ge_column_i << "=[" << (int)src[0] << "*" << (int)code_value << "]";)
@@ -3285,7 +3436,7 @@ void Codec::AddSubdiagonalValues()
 				// Add pivot for non-zero bit to destination row value
 				u16 column_i = _ge_col_map[ge_sub_i];
 				const u8 *src = _recovery_blocks + _block_bytes * column_i;
-				memxor(dest, src, _block_bytes);
+				memxor(dest, src, _value_bytes);
 				CAT_IF_ROWOP(++rowops;)
 
 				CAT_IF_DUMP(cout << " " << ge_sub_i << "=[" << (int)src[0] << "]";)
@@ -3471,7 +3622,7 @@ void Codec::BackSubstituteAboveDiagonal()
 					// Normalize code value, setting it to 1 (implicitly nonzero)
 					if (code_value != 1)
 					{
-						GF256MemDivide(src, code_value, _block_bytes);
+						GF256MemDivide(src, code_value, _value_bytes);
 						CAT_IF_ROWOP(++heavyops;)
 					}
 
@@ -3498,14 +3649,14 @@ void Codec::BackSubstituteAboveDiagonal()
 						u8 *dest = _recovery_blocks + _block_bytes * _ge_col_map[dest_pivot_i];
 						if (code_value != 1)
 						{
-							GF256MemMulAdd(dest, code_value, src, _block_bytes);
+							GF256MemMulAdd(dest, code_value, src, _value_bytes);
 							CAT_IF_ROWOP(++heavyops;)
 
 							CAT_IF_DUMP(cout << " h" << dest_pivot_i;)
 						}
 						else
 						{
-							memxor(dest, src, _block_bytes);
+							memxor(dest, src, _value_bytes);
 							CAT_IF_ROWOP(++rowops;)
 
 							CAT_IF_DUMP(cout << " *" << dest_pivot_i;)
@@ -3518,7 +3669,7 @@ void Codec::BackSubstituteAboveDiagonal()
 						{
 							// Back-substitute
 							u8 *dest = _recovery_blocks + _block_bytes * _ge_col_map[dest_pivot_i];
-							memxor(dest, src, _block_bytes);
+							memxor(dest, src, _value_bytes);
 							CAT_IF_ROWOP(++rowops;)
 
 							CAT_IF_DUMP(cout << " " << dest_pivot_i;)
@@ -3542,7 +3693,7 @@ void Codec::BackSubstituteAboveDiagonal()
 				if (code_value != 1)
 				{
 					u8 *src = _recovery_blocks + _block_bytes * _ge_col_map[backsub_i];
-					GF256MemDivide(src, code_value, _block_bytes);
+					GF256MemDivide(src, code_value, _value_bytes);
 					CAT_IF_ROWOP(++heavyops;)
 				}
 			}
@@ -3552,20 +3703,20 @@ void Codec::BackSubstituteAboveDiagonal()
 			// Generate window table: 2 bits
 			win_table[1] = _recovery_blocks + _block_bytes * _ge_col_map[backsub_i];
 			win_table[2] = _recovery_blocks + _block_bytes * _ge_col_map[backsub_i + 1];
-			memxor_set(win_table[3], win_table[1], win_table[2], _block_bytes);
+			memxor_set(win_table[3], win_table[1], win_table[2], _value_bytes);
 			CAT_IF_ROWOP(++rowops;)
 
 			// Generate window table: 3 bits
 			win_table[4] = _recovery_blocks + _block_bytes * _ge_col_map[backsub_i + 2];
-			memxor_set(win_table[5], win_table[1], win_table[4], _block_bytes);
-			memxor_set(win_table[6], win_table[2], win_table[4], _block_bytes);
-			memxor_set(win_table[7], win_table[1], win_table[6], _block_bytes);
+			memxor_set(win_table[5], win_table[1], win_table[4], _value_bytes);
+			memxor_set(win_table[6], win_table[2], win_table[4], _value_bytes);
+			memxor_set(win_table[7], win_table[1], win_table[6], _value_bytes);
 			CAT_IF_ROWOP(rowops += 3;)
 
 			// Generate window table: 4 bits
 			win_table[8] = _recovery_blocks + _block_bytes * _ge_col_map[backsub_i + 3];
 			for (int ii = 1; ii < 8; ++ii)
-				memxor_set(win_table[8 + ii], win_table[ii], win_table[8], _block_bytes);
+				memxor_set(win_table[8 + ii], win_table[ii], win_table[8], _value_bytes);
 			CAT_IF_ROWOP(rowops += 7;)
 
 			// Generate window table: 5+ bits
@@ -3573,21 +3724,21 @@ void Codec::BackSubstituteAboveDiagonal()
 			{
 				win_table[16] = _recovery_blocks + _block_bytes * _ge_col_map[backsub_i + 4];
 				for (int ii = 1; ii < 16; ++ii)
-					memxor_set(win_table[16 + ii], win_table[ii], win_table[16], _block_bytes);
+					memxor_set(win_table[16 + ii], win_table[ii], win_table[16], _value_bytes);
 				CAT_IF_ROWOP(rowops += 15;)
 
 				if (w >= 6)
 				{
 					win_table[32] = _recovery_blocks + _block_bytes * _ge_col_map[backsub_i + 5];
 					for (int ii = 1; ii < 32; ++ii)
-						memxor_set(win_table[32 + ii], win_table[ii], win_table[32], _block_bytes);
+						memxor_set(win_table[32 + ii], win_table[ii], win_table[32], _value_bytes);
 					CAT_IF_ROWOP(rowops += 31;)
 
 					if (w >= 7)
 					{
 						win_table[64] = _recovery_blocks + _block_bytes * _ge_col_map[backsub_i + 6];
 						for (int ii = 1; ii < 64; ++ii)
-							memxor_set(win_table[64 + ii], win_table[ii], win_table[64], _block_bytes);
+							memxor_set(win_table[64 + ii], win_table[ii], win_table[64], _value_bytes);
 						CAT_IF_ROWOP(rowops += 63;)
 					}
 				}
@@ -3620,7 +3771,7 @@ void Codec::BackSubstituteAboveDiagonal()
 							if (ge_row[ge_column_j >> 6] & ge_mask)
 							{
 								const u8 *src = _recovery_blocks + _block_bytes * _ge_col_map[ge_column_j];
-								memxor(dest, src, _block_bytes);
+								memxor(dest, src, _value_bytes);
 								CAT_IF_ROWOP(++rowops;)
 							}
 						}
@@ -3640,12 +3791,12 @@ void Codec::BackSubstituteAboveDiagonal()
 						const u8 *src = _recovery_blocks + _block_bytes * _ge_col_map[ge_column_j];
 						if (code_value != 1)
 						{
-							GF256MemMulAdd(dest, code_value, src, _block_bytes);
+							GF256MemMulAdd(dest, code_value, src, _value_bytes);
 							CAT_IF_ROWOP(++heavyops;)
 						}
 						else
 						{
-							memxor(dest, src, _block_bytes);
+							memxor(dest, src, _value_bytes);
 							CAT_IF_ROWOP(++rowops;)
 						}
 					} // next column in row
@@ -3681,7 +3832,7 @@ void Codec::BackSubstituteAboveDiagonal()
 
 						// Back-substitute
 						u8 *dest = _recovery_blocks + _block_bytes * _ge_col_map[above_pivot_i];
-						memxor(dest, win_table[win_bits], _block_bytes);
+						memxor(dest, win_table[win_bits], _value_bytes);
 						CAT_IF_ROWOP(++rowops;)
 					}
 				}
@@ -3709,7 +3860,7 @@ void Codec::BackSubstituteAboveDiagonal()
 
 						// Back-substitute
 						u8 *dest = _recovery_blocks + _block_bytes * _ge_col_map[above_pivot_i];
-						memxor(dest, win_table[win_bits], _block_bytes);
+						memxor(dest, win_table[win_bits], _value_bytes);
 						CAT_IF_ROWOP(++rowops;)
 					}
 				}
@@ -3762,7 +3913,7 @@ void Codec::BackSubstituteAboveDiagonal()
 			// Normalize code value, setting it to 1 (implicitly nonzero)
 			if (code_value != 1)
 			{
-				GF256MemDivide(src, code_value, _block_bytes);
+				GF256MemDivide(src, code_value, _value_bytes);
 				CAT_IF_ROWOP(++heavyops;)
 			}
 
@@ -3789,14 +3940,14 @@ void Codec::BackSubstituteAboveDiagonal()
 				u8 *dest = _recovery_blocks + _block_bytes * _ge_col_map[ge_up_i];
 				if (code_value != 1)
 				{
-					GF256MemMulAdd(dest, code_value, src, _block_bytes);
+					GF256MemMulAdd(dest, code_value, src, _value_bytes);
 					CAT_IF_ROWOP(++heavyops;)
 
 					CAT_IF_DUMP(cout << " h" << up_row_i;)
 				}
 				else
 				{
-					memxor(dest, src, _block_bytes);
+					memxor(dest, src, _value_bytes);
 					CAT_IF_ROWOP(++rowops;)
 
 					CAT_IF_DUMP(cout << " *" << up_row_i;)
@@ -3809,7 +3960,7 @@ void Codec::BackSubstituteAboveDiagonal()
 				{
 					// Back-substitute
 					u8 *dest = _recovery_blocks + _block_bytes * _ge_col_map[ge_up_i];
-					memxor(dest, src, _block_bytes);
+					memxor(dest, src, _value_bytes);
 					CAT_IF_ROWOP(++rowops;)
 
 					CAT_IF_DUMP(cout << " " << up_row_i;)
@@ -3857,7 +4008,7 @@ void Codec::Substitute()
 
 		CAT_IF_DUMP(cout << "Generating column " << dest_column_i << ":";)
 
-		const u8 *input_src = _input_blocks + _block_bytes * row_i;
+		const u8 *input_src = GetInputBlock(row_i);
 		CAT_IF_DUMP(cout << " " << row_i << ":[" << (int)input_src[0] << "]";)
 
 		// Set up mixing column generator
@@ -3867,11 +4018,11 @@ void Codec::Substitute()
 
 		// If copying from final block,
 		if (row_i != _block_count - 1)
-			memxor_set(dest, src, input_src, _block_bytes);
+			memxor_set(dest, src, input_src, _value_bytes);
 		else
 		{
 			memxor_set(dest, src, input_src, _input_final_bytes);
-			memcpy(dest + _input_final_bytes, src + _input_final_bytes, _block_bytes - _input_final_bytes);
+			memcpy(dest + _input_final_bytes, src + _input_final_bytes, _value_bytes - _input_final_bytes);
 		}
 		CAT_IF_ROWOP(++rowops;)
 
@@ -3880,7 +4031,7 @@ void Codec::Substitute()
 		const u8 *src0 = _recovery_blocks + _block_bytes * (_block_count + mix_x);
 		IterateNextColumn(mix_x, _mix_count, _mix_next_prime, mix_a);
 		const u8 *src1 = _recovery_blocks + _block_bytes * (_block_count + mix_x);
-		memxor_add(dest, src0, src1, _block_bytes);
+		memxor_add(dest, src0, src1, _value_bytes);
 		CAT_IF_ROWOP(++rowops;)
 
 		// If at least two peeling columns are set,
@@ -3901,12 +4052,12 @@ void Codec::Substitute()
 
 				// Common case:
 				if (column_i != dest_column_i)
-					memxor_add(dest, peel0, _recovery_blocks + _block_bytes * column_i, _block_bytes);
+					memxor_add(dest, peel0, _recovery_blocks + _block_bytes * column_i, _value_bytes);
 				else // rare:
-					memxor(dest, peel0, _block_bytes);
+					memxor(dest, peel0, _value_bytes);
 			}
 			else // rare:
-				memxor(dest, _recovery_blocks + _block_bytes * column_i, _block_bytes);
+				memxor(dest, _recovery_blocks + _block_bytes * column_i, _value_bytes);
 			CAT_IF_ROWOP(++rowops;)
 
 			// For each remaining column,
@@ -3920,7 +4071,7 @@ void Codec::Substitute()
 				// If column is not the solved one,
 				if (column_i != dest_column_i)
 				{
-					memxor(dest, src, _block_bytes);
+					memxor(dest, src, _value_bytes);
 					CAT_IF_ROWOP(++rowops;)
 					CAT_IF_DUMP(cout << "[" << (int)src[0] << "]";)
 				}
@@ -4270,6 +4421,7 @@ Result Codec::ChooseMatrix(int message_bytes, int block_bytes)
 
 	// Calculate message block count
 	_block_bytes = block_bytes;
+	_value_bytes = block_bytes;
 	_block_count = (message_bytes + _block_bytes - 1) / _block_bytes;
 	_block_next_prime = NextPrime16(_block_count);
 
@@ -4536,6 +4688,14 @@ Result Codec::SolveMatrix()
 
 	(4) Substitution:
 
+		Maps dense rows to their columns:
+
+			MapDenseRows()
+
+		Generates the Compression row values:
+
+			PeelDiagonalValues()
+
 		Solves across GE matrix rows:
 
 			InitializeColumnValues()
@@ -4549,12 +4709,26 @@ Result Codec::SolveMatrix()
 		Solves remaining columns:
 
 			Substitute()
+
+		Every step after MapDenseRows() works on each byte of the blocks
+	independently, so with worker threads enabled the blocks are split
+	into column ranges that are solved in parallel.
 */
 
 void Codec::GenerateRecoveryBlocks()
 {
 	// (4) Substitution
 
+	MapDenseRows();
+
+	// If the value operations could not be shared with worker threads,
+	if (!RunSlicedPass(PASS_RECOVERY, 0))
+		GenerateRecoveryValues();
+}
+
+void Codec::GenerateRecoveryValues()
+{
+	PeelDiagonalValues();
 	InitializeColumnValues();
 	MultiplyDenseValues();
 	AddSubdiagonalValues();
@@ -4637,7 +4811,7 @@ Result Codec::ResumeSolveMatrix(u32 id, const void *block)
 	row->id = id;
 
 	// Copy new block to input blocks
-	u8 *block_store_dest = _input_blocks + _block_bytes * row_i;
+	u8 *block_store_dest = GetInputBlock(row_i);
 	if (id != _block_count - 1)
 		memcpy(block_store_dest, block, _block_bytes);
 	else
@@ -4902,32 +5076,54 @@ Result Codec::ReconstructOutput(void *message_out)
 	// Copy any original message rows that were received:
 	// For each row,
 	PeelRow *row = _peel_rows;
-	const u8 *src = _input_blocks;
-	for (u16 row_i = 0; row_i < _row_count; ++row_i, ++row, src += _block_bytes)
+	for (u16 row_i = 0; row_i < _row_count; ++row_i, ++row)
 	{
 		u32 id = row->id;
 
 		// If the row identifier indicates it is part of the original message data,
 		if (id < _block_count)
 		{
+			copied_rows[id] = 1;
+
+			// If the streaming decoder already stored it in place, skip it
+			if (id == row_i && row_i < _stream_rows)
+				continue;
+
 			CAT_IF_DUMP(cout << "Copying received row " << id << endl;)
 
 			u8 *dest = output_blocks + _block_bytes * id;
 			int bytes = (id != _block_count - 1) ? _block_bytes : _output_final_bytes;
-			memcpy(dest, src, bytes);
-
-			copied_rows[id] = 1;
+			memcpy(dest, GetInputBlock(row_i), bytes);
 		}
 	}
 #endif // CAT_COPY_FIRST_N
 
-	// Regenerate any rows that got lost:
+	// Regenerate any rows that got lost
+	if (!RunSlicedPass(PASS_RECONSTRUCT, output_blocks))
+		RegenerateOutput(output_blocks);
+
+	// If streaming, report that the whole message is final
+	if (_stream_rows && _on_progress.IsValid())
+		_on_progress(_block_bytes * (_block_count - 1) + _output_final_bytes);
+
+	return R_WIN;
+}
+
+/*
+	RegenerateOutput
 
+		This function regenerates the output blocks that were not copied
+	from the received original data.  It may run on a column range of the
+	blocks, in which case output_blocks points at the start of the range.
+*/
+
+void Codec::RegenerateOutput(u8 *output_blocks)
+{
 	// For each row,
 	u8 *dest = output_blocks;
-	u32 block_bytes = _block_bytes;
+	u32 block_bytes = _value_bytes;
 #if defined(CAT_COPY_FIRST_N)
-	u8 *copied_row = copied_rows;
+	const u8 *copied_row = reinterpret_cast<const u8*>( _peel_cols );
 	for (u16 row_i = 0; row_i < _block_count; ++row_i, dest += _block_bytes, ++copied_row)
 	{
 		// If already copied, skip it
@@ -4999,8 +5195,6 @@ Result Codec::ReconstructOutput(void *message_out)
 
 		CAT_IF_DUMP(cout << endl;)
 	} // next row
-
-	return R_WIN;
 }
 
 
@@ -5008,6 +5202,17 @@ Result Codec::ReconstructOutput(void *message_out)
 
 Codec::Codec()
 {
+	// Single-threaded until UseWorkerThreads()
+	_worker_count = 0;
+
+	// Nothing solved yet
+	_encoder_solved = false;
+
+	// Not streaming
+	_stream_blocks = 0;
+	_stream_rows = 0;
+	_on_progress.Invalidate();
+
 	// Workspace
 	_recovery_blocks = 0;
 	_workspace_allocated = 0;
@@ -5042,7 +5247,8 @@ bool Codec::AllocateInput()
 	CAT_IF_DUMP(cout << endl << "---- AllocateInput ----" << endl << endl;)
 
 	// If need to allocate more,
-	u32 size = (_block_count + _extra_count) * _block_bytes;
+	// NOTE: Row slots stored in the output message while streaming are not allocated here
+	u32 size = (_block_count + _extra_count - _stream_rows) * _block_bytes;
 	if (_input_allocated < size)
 	{
 		FreeInput();
@@ -5194,6 +5400,135 @@ void Codec::FreeWorkspace()
 }
 
 
+//// Worker Threads
+
+void Codec::UseWorkerThreads(bool enable)
+{
+	_worker_count = 0;
+
+	if (enable)
+	{
+		_worker_count = WorkerThreads::ref()->GetWorkerCount();
+		if (_worker_count > MAX_WORKER_THREADS) _worker_count = MAX_WORKER_THREADS;
+	}
+}
+
+/*
+	SetValueView
+
+		The value operations touch each byte of the blocks independently,
+	so a column range of every block can be solved by a copy of the codec
+	that shares the parent's matrices.  The block pitch stays the same,
+	and the block pointers and byte counts are narrowed to the range.
+*/
+
+void Codec::SetValueView(const Codec &parent, u32 offset, u32 bytes)
+{
+	*this = parent;
+
+	_recovery_blocks += offset;
+	_input_blocks += offset;
+	if (_stream_blocks) _stream_blocks += offset;
+	_value_bytes = bytes;
+
+	// Clip partial final blocks to the range
+	_input_final_bytes = (_input_final_bytes > offset) ? _input_final_bytes - offset : 0;
+	if (_input_final_bytes > bytes) _input_final_bytes = bytes;
+	_output_final_bytes = (_output_final_bytes > offset) ? _output_final_bytes - offset : 0;
+	if (_output_final_bytes > bytes) _output_final_bytes = bytes;
+}
+
+void Codec::ClearValueView()
+{
+	// Release references to the parent's memory without freeing it
+	_recovery_blocks = 0;
+	_workspace_allocated = 0;
+	_compress_matrix = 0;
+	_ge_allocated = 0;
+	_input_blocks = 0;
+	_input_allocated = 0;
+	_stream_blocks = 0;
+}
+
+void Codec::RunWorkerItem(WorkerJob *job, u32 index)
+{
+	// If encoding a block of a batch,
+	if (job->pass == PASS_ENCODE)
+	{
+		job->bytes_out[index] = Encode(job->first_id + index, job->blocks_out[index]);
+		return;
+	}
+
+	// Look up column range
+	u32 offset = job->slice_bytes * index;
+	u32 bytes = _block_bytes - offset;
+	if (bytes > job->slice_bytes) bytes = job->slice_bytes;
+
+	Codec view;
+	view.SetValueView(*this, offset, bytes);
+
+	if (job->pass == PASS_RECOVERY)
+		view.GenerateRecoveryValues();
+	else
+		view.RegenerateOutput(job->output_blocks + offset);
+
+	view.ClearValueView();
+}
+
+void Codec::RunWorkerJob(WorkerJob *job)
+{
+	u32 helpers = _worker_count;
+	if (helpers + 1 > job->item_count) helpers = job->item_count - 1;
+
+	job->codec = this;
+	job->next_item = 0;
+	job->done_items = 0;
+	job->refs = helpers + 1;
+
+	WorkerThreads *workers = WorkerThreads::ref();
+
+	for (u32 ii = 0; ii < helpers; ++ii)
+	{
+		WorkerTask *task = &job->tasks[ii];
+		task->job = job;
+		task->callback.SetMember<WorkerJob, &WorkerJob::OnWork>(job);
+
+		workers->DeliverBuffers(WQPRIO_LO, ii, task);
+	}
+
+	// Help out, then wait for items still being worked on by the workers
+	job->Work();
+
+	while (job->done_items != job->item_count)
+		job->finished.Wait();
+
+	job->Release();
+}
+
+bool Codec::RunSlicedPass(int pass, u8 *output_blocks)
+{
+	// If there are no workers or the blocks are too small to split,
+	u32 slice_count = _block_bytes / CAT_WORKER_MIN_SLICE;
+	if (slice_count > _worker_count + 1) slice_count = _worker_count + 1;
+	if (slice_count < 2) return false;
+
+	WorkerJob *job = new (std::nothrow) WorkerJob;
+	if (!job) return false;
+
+	// Round ranges up to a cache line so workers do not share lines
+	u32 slice_bytes = (_block_bytes + slice_count - 1) / slice_count;
+	slice_bytes = (slice_bytes + 63) & ~63;
+
+	job->pass = pass;
+	job->item_count = (_block_bytes + slice_bytes - 1) / slice_bytes;
+	job->slice_bytes = slice_bytes;
+	job->output_blocks = output_blocks;
+
+	RunWorkerJob(job);
+	return true;
+}
+
+
 //// Diagnostic
 
 #if defined(CAT_DUMP_CODEC_DEBUG) || defined(CAT_DUMP_GE_MATRIX)
@@ -5368,6 +5703,24 @@ void Codec::PrintDeferredColumns()
 
 Result Codec::InitializeEncoder(int message_bytes, int block_bytes)
 {
+	// If the previous message solved the same matrix,
+	// NOTE: The seeds are chosen from N alone, so N and block bytes are the whole key
+	if (_encoder_solved && block_bytes > 0 && (u32)block_bytes == _block_bytes &&
+		message_bytes > 0 && (u32)(message_bytes + block_bytes - 1) / (u32)block_bytes == _block_count)
+	{
+		// Only the partial final block can differ
+		u32 partial_final_bytes = message_bytes % _block_bytes;
+		if (partial_final_bytes <= 0) partial_final_bytes = _block_bytes;
+
+		_input_final_bytes = partial_final_bytes;
+
+		CAT_IF_DUMP(cout << "InitializeEncoder: Reusing matrix solution for N = " << _block_count << endl;)
+
+		return R_WIN;
+	}
+
+	_encoder_solved = false;
+
 	Result r = ChooseMatrix(message_bytes, block_bytes);
 	if (!r)
 	{
@@ -5398,6 +5751,10 @@ Result Codec::InitializeEncoder(int message_bytes, int block_bytes)
 		In practice, the solver should always succeed because the
 	encoder should be looking up its check matrix parameters from
 	a table, which guarantees the matrix is invertible.
+
+		The matrix only depends on N and the seeds, so after the first
+	message it is kept for the next message with the same N and block
+	bytes.  Then only the recovery block values are regenerated.
 */
 
 Result Codec::EncodeFeed(const void *message_in)
@@ -5409,6 +5766,13 @@ Result Codec::EncodeFeed(const void *message_in)
 
 	SetInput(message_in);
 
+	// If the matrix is already solved, only the block values are new
+	if (_encoder_solved)
+	{
+		GenerateRecoveryBlocks();
+		return R_WIN;
+	}
+
 	// For each input row,
 	for (u16 id = 0; id < _block_count; ++id)
 	{
@@ -5418,7 +5782,11 @@ Result Codec::EncodeFeed(const void *message_in)
 
 	// Solve matrix and generate recovery blocks
 	Result r = SolveMatrix();
-	if (!r) GenerateRecoveryBlocks();
+	if (!r)
+	{
+		GenerateRecoveryBlocks();
+		_encoder_solved = true;
+	}
 	else if (r == R_MORE_BLOCKS) r = R_BAD_PEEL_SEED;
 	return r;
 }
@@ -5515,11 +5883,45 @@ u32 Codec::Encode(u32 id, void *block_out)
 	return _block_bytes;
 }
 
+/*
+	EncodeBatch
+
+		This function encodes a run of consecutive block identifiers,
+	sharing the blocks with the worker threads when they are enabled.
+	bytes_out receives the Encode() result for each block.
+*/
+
+void Codec::EncodeBatch(u32 first_id, u32 count, void * const *blocks_out, u32 *bytes_out)
+{
+	// If the batch can be shared with worker threads,
+	if (_worker_count > 0 && count > 1)
+	{
+		WorkerJob *job = new (std::nothrow) WorkerJob;
+		if (job)
+		{
+			job->pass = PASS_ENCODE;
+			job->item_count = count;
+			job->first_id = first_id;
+			job->blocks_out = blocks_out;
+			job->bytes_out = bytes_out;
+
+			RunWorkerJob(job);
+			return;
+		}
+	}
+
+	for (u32 ii = 0; ii < count; ++ii)
+		bytes_out[ii] = Encode(first_id + ii, blocks_out[ii]);
+}
+
 
 //// Decoder Mode
 
-Result Codec::InitializeDecoder(int message_bytes, int block_bytes)
+Result Codec::InitializeDecoder(int message_bytes, int block_bytes, void *message_out)
 {
+	// Decoder matrix depends on the received blocks, so it cannot be reused
+	_encoder_solved = false;
+
 	Result r = ChooseMatrix(message_bytes, block_bytes);
 	if (r == R_WIN)
 	{
@@ -5529,6 +5931,7 @@ Result Codec::InitializeDecoder(int message_bytes, int block_bytes)
 
 		// Decoder-specific
 		_row_count = 0;
+		_decoder_solving = false;
 		_output_final_bytes = partial_final_bytes;
 
 		// Hack: Prevents row-based ids from causing partial copies when they happen to be the last block id
@@ -5540,8 +5943,21 @@ Result Codec::InitializeDecoder(int message_bytes, int block_bytes)
 		_all_original = true;
 #endif
 
+		// If streaming, all but the final block are stored in the output message
+		_stream_blocks = reinterpret_cast<u8*>( message_out );
+		_stream_rows = message_out ? _block_count - 1 : 0;
+		_ready_blocks = 0;
+		_free_row = 0;
+
 		if (!AllocateInput() || !AllocateWorkspace())
 			return R_OUT_OF_MEMORY;
+
+		// If streaming, mark all row slots unused
+		if (message_out)
+		{
+			for (u16 row_i = 0; row_i < _block_count; ++row_i)
+				_peel_rows[row_i].id = UNUSED_ROW_ID;
+		}
 	}
 
 	return r;
@@ -5553,6 +5969,15 @@ Result Codec::InitializeDecoder(int message_bytes, int block_bytes)
 		This function accumulates the new block in a large input
 	buffer.  As soon as N blocks are collected, the matrix solver
 	is attempted.  After N blocks, ResumeSolveMatrix() is used.
+
+		When streaming, row slot k is stored at block k of the output
+	message, so original block k is written straight into its final
+	place.  Recovery blocks take the lowest unused slot, which is most
+	likely the slot of a lost original.  An original that finds its
+	slot taken is dropped rather than stored out of place, so that no
+	stored block is ever overwritten by another one when the output is
+	reconstructed.  This costs an extra block only when blocks arrive
+	out of order.
 */
 
 Result Codec::DecodeFeed(u32 id, const void *block_in)
@@ -5565,6 +5990,28 @@ Result Codec::DecodeFeed(u32 id, const void *block_in)
 	u16 row_i = _row_count;
 	if (row_i < _block_count)
 	{
+		// If streaming, choose a row slot
+		if (_stream_rows)
+		{
+			// If original data,
+			if (id < _block_count)
+			{
+				// If its slot is taken, drop it
+				if (_peel_rows[id].id != UNUSED_ROW_ID)
+					return R_MORE_BLOCKS;
+
+				row_i = (u16)id;
+			}
+			else
+			{
+				// Find the lowest unused slot (there is one because fewer than N are used)
+				while (_peel_rows[_free_row].id != UNUSED_ROW_ID)
+					++_free_row;
+
+				row_i = _free_row;
+			}
+		}
+
 #if defined(CAT_ALL_ORIGINAL)
 		// If original data,
 		if (id >= _block_count)
@@ -5574,7 +6021,7 @@ Result Codec::DecodeFeed(u32 id, const void *block_in)
 		// If opportunistic peeling did not fail,
 		if (OpportunisticPeeling(row_i, id))
 		{
-			u8 *block_store = _input_blocks + _block_bytes * row_i;
+			u8 *block_store = GetInputBlock(row_i);
 
 			// If this is the last block id,
 			if (id == _block_count - 1)
@@ -5591,6 +6038,16 @@ Result Codec::DecodeFeed(u32 id, const void *block_in)
 			{
 				// Copy the new row data into the input block area
 				memcpy(block_store, block_in, _block_bytes);
+
+				// If this extends the run of leading original blocks in place,
+				if (row_i == _ready_blocks && id == row_i && row_i < _stream_rows)
+				{
+					do ++_ready_blocks;
+					while (_ready_blocks < _stream_rows && _peel_rows[_ready_blocks].id == _ready_blocks);
+
+					if (_on_progress.IsValid())
+						_on_progress(_block_bytes * _ready_blocks);
+				}
 			}
 
 			// If just acquired N blocks,
@@ -5599,6 +6056,11 @@ Result Codec::DecodeFeed(u32 id, const void *block_in)
 				return R_WIN;
 			}
 		} // end if opportunistic peeling succeeded
+		else if (_stream_rows)
+		{
+			// Release the row slot
+			_peel_rows[row_i].id = UNUSED_ROW_ID;
+		}
 
 		return R_MORE_BLOCKS;
 	}
@@ -5614,7 +6076,7 @@ Result Codec::DecodeSolve(u32 id, const void *block_in)
 
 	// If just acquired N blocks,
 	Result r;
-	if (_row_count == _block_count)
+	if (!_decoder_solving)
 	{
 #if defined(CAT_ALL_ORIGINAL)
 		// If all original data,
@@ -5624,6 +6086,12 @@ Result Codec::DecodeSolve(u32 id, const void *block_in)
 
 		// Attempt to solve the matrix and generate recovery blocks
 		r = SolveMatrix();
+
+		// NOTE: DecodeFeed() stops counting rows at N, so _row_count cannot
+		// tell the N-th block from the ones after a failed solve.  Running
+		// SolveMatrix() again would ignore the new block and start over on
+		// peeling state left by the failed attempt.
+		_decoder_solving = true;
 	}
 	else
 	{
@@ -0,0 +1,215 @@
+/*
+	Copyright (c) 2012 Christopher A. Taylor.  All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	* Redistributions of source code must retain the above copyright notice,
+	  this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	* Neither the name of LibCat nor the names of its contributors may be used
+	  to endorse or promote products derived from this software without
+	  specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Use 64-bit file offsets on 32-bit targets
+#if !defined(_FILE_OFFSET_BITS)
+# define _FILE_OFFSET_BITS 64
+#endif
+
+#include <cat/io/AsyncFile.hpp>
+#include <cat/io/Buffers.hpp>
+#include <cat/port/SystemInfo.hpp>
+#include <cat/io/Log.hpp>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+using namespace std;
+using namespace cat;
+
+bool AsyncFile::OnInitialize()
+{
+	return true;
+}
+
+void AsyncFile::OnDestroy()
+{
+	Close();
+}
+
+bool AsyncFile::OnFinalize()
+{
+	return true;
+}
+
+AsyncFile::AsyncFile()
+{
+	_file = -1;
+	_align_mask = 0;
+	_pool = 0;
+}
+
+AsyncFile::~AsyncFile()
+{
+	Close();
+}
+
+bool AsyncFile::Open(const char *file_path, u32 async_file_modes)
+{
+	Close();
+
+	int flags;
+
+	if (async_file_modes & ASYNCFILE_WRITE)
+	{
+		flags = (async_file_modes & ASYNCFILE_READ) ? O_RDWR : O_WRONLY;
+
+		// Open it whether it exists or not
+		flags |= O_CREAT;
+
+		// If in truncate mode,
+		if (async_file_modes & ASYNCFILE_TRUNC)
+		{
+			// Truncate existing file
+			flags |= O_TRUNC;
+		}
+	}
+	else
+		flags = O_RDONLY;
+
+#if defined(O_CLOEXEC)
+	flags |= O_CLOEXEC;
+#endif
+
+	bool no_buffer = (async_file_modes & ASYNCFILE_NOBUFFER) != 0;
+
+#if defined(O_DIRECT)
+	if (no_buffer)
+	{
+		_file = open(file_path, flags | O_DIRECT, 0644);
+
+		// If the filesystem does not support direct IO,
+		if (_file < 0 && errno == EINVAL)
+		{
+			CAT_INFO("AsyncFile") << "O_DIRECT is not supported for " << file_path << " so falling back to buffered IO";
+			no_buffer = false;
+		}
+	}
+#else
+	no_buffer = false;
+#endif
+
+	if (!no_buffer)
+		_file = open(file_path, flags, 0644);
+
+	if (_file < 0)
+	{
+		CAT_WARN("AsyncFile") << "open error: " << errno << " for " << file_path;
+		return false;
+	}
+
+	// Direct IO must be aligned to the logical sector size
+	if (no_buffer)
+	{
+		u32 sector_size = SystemInfo::ref()->GetMaxSectorSize();
+		_align_mask = sector_size - 1;
+	}
+
+#if defined(POSIX_FADV_SEQUENTIAL)
+	if (async_file_modes & ASYNCFILE_RANDOM)
+		posix_fadvise(_file, 0, 0, POSIX_FADV_RANDOM);
+	else if (async_file_modes & ASYNCFILE_SEQUENTIAL)
+		posix_fadvise(_file, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+	_pool = IOThreadPools::ref()->GetSharedPool();
+
+	return true;
+}
+
+void AsyncFile::Close()
+{
+	if (_file >= 0)
+	{
+		close(_file);
+		_file = -1;
+	}
+
+	_align_mask = 0;
+}
+
+bool AsyncFile::SetSize(u64 bytes)
+{
+	if (ftruncate(_file, (off_t)bytes) != 0)
+	{
+		CAT_WARN("AsyncFile") << "ftruncate error: " << errno;
+		return false;
+	}
+
+	return true;
+}
+
+u64 AsyncFile::GetSize()
+{
+	struct stat st;
+
+	if (fstat(_file, &st) != 0)
+		return 0;
+
+	return (u64)st.st_size;
+}
+
+bool AsyncFile::Post(BatchHead *request, IOLayerFileOverhead &iointernal, u32 io_type, u64 offset, void *data, u32 bytes)
+{
+	// If the request would violate the O_DIRECT alignment rules,
+	if (((u32)offset | bytes | (u32)(size_t)data) & _align_mask)
+	{
+		CAT_WARN("AsyncFile") << "Unaligned request for unbuffered file: offset=" << offset << " bytes=" << bytes;
+		return false;
+	}
+
+	iointernal.file = this;
+	iointernal.offset = offset;
+	iointernal.bytes = bytes;
+	iointernal.io_type = io_type;
+
+	AddRef(CAT_REFOBJECT_TRACE);
+
+	if (!_pool || !_pool->Post(request))
+	{
+		ReleaseRef(CAT_REFOBJECT_TRACE);
+		return false;
+	}
+
+	return true;
+}
+
+bool AsyncFile::Read(ReadBuffer *buffer, u64 offset, void *data, u32 bytes)
+{
+	buffer->data = data;
+
+	return Post(buffer, buffer->iointernal, IOTYPE_FILE_READ, offset, data, bytes);
+}
+
+bool AsyncFile::Write(WriteBuffer *buffer, u64 offset, void *data, u32 bytes)
+{
+	buffer->data = data;
+
+	return Post(buffer, buffer->iointernal, IOTYPE_FILE_WRITE, offset, data, bytes);
+}
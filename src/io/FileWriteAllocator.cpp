@@ -77,7 +77,7 @@ bool FileWriteAllocator::OnInitialize()
 	_buffers = buffers;
 
 	// Align start of buffers with buffer bytes
-	u32 buffer_low_bits = (u32)buffers & (buffer_bytes - 1);
+	u32 buffer_low_bits = (u32)((size_t)buffers & (buffer_bytes - 1));
 	if (buffer_low_bits)
 		buffers += buffer_bytes - buffer_low_bits;
 
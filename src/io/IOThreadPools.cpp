@@ -0,0 +1,334 @@
+/*
+	Copyright (c) 2012 Christopher A. Taylor.  All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	* Redistributions of source code must retain the above copyright notice,
+	  this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	* Neither the name of LibCat nor the names of its contributors may be used
+	  to endorse or promote products derived from this software without
+	  specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// Use 64-bit file offsets with pread()/pwrite() on 32-bit targets
+#if !defined(_FILE_OFFSET_BITS)
+# define _FILE_OFFSET_BITS 64
+#endif
+
+#include <cat/io/IOThreadPools.hpp>
+#include <cat/io/Buffers.hpp>
+#include <cat/threads/Atomic.hpp>
+#include <cat/time/Clock.hpp>
+#include <cat/port/SystemInfo.hpp>
+#include <cat/io/Log.hpp>
+#include <cat/io/Settings.hpp>
+#include <cat/threads/WorkerThreads.hpp>
+#include <unistd.h>
+#include <errno.h>
+using namespace cat;
+
+static Settings *m_settings = 0;
+static SystemInfo *m_system_info = 0;
+static WorkerThreads *m_worker_threads = 0;
+
+static const u32 MAX_IO_THREADS = 64;
+static const u32 MIN_IO_THREADS = 4;
+
+
+// Blocking transfer that retries after signals and partial writes
+// Returns the number of bytes actually transferred
+static u32 TransferAt(int fd, bool write, u8 *data, u32 bytes, u64 offset)
+{
+	u32 done = 0;
+
+	while (done < bytes)
+	{
+		u32 remaining = bytes - done;
+		ssize_t result;
+
+		if (write)
+			result = pwrite(fd, data + done, remaining, (off_t)(offset + done));
+		else
+			result = pread(fd, data + done, remaining, (off_t)(offset + done));
+
+		if (result < 0)
+		{
+			if (errno == EINTR) continue;
+
+			CAT_WARN("IOThread") << (write ? "pwrite" : "pread") << " error: " << errno;
+			break;
+		}
+
+		if (result == 0) break;
+
+		done += (u32)result;
+
+		// A short read means end of file.  Retrying would also break the
+		// O_DIRECT alignment rules, since the remainder is not aligned
+		if (!write && (u32)result < remaining)
+			break;
+	}
+
+	return done;
+}
+
+
+//// IOThread
+
+IOThread::IOThread()
+{
+	_kill_flag = false;
+	_queue.Clear();
+}
+
+void IOThread::Post(BatchHead *request)
+{
+	_queue_lock.Enter();
+	_queue.PushBack(request);
+	_queue_lock.Leave();
+
+	_event_flag.Set();
+}
+
+void IOThread::HandleRequests(BatchHead *node)
+{
+	// Completions with a callback are handed to the worker threads as one batch
+	BatchSet completed;
+	completed.Clear();
+
+	// ReadBuffer and WriteBuffer share a layout up to and including iointernal
+	for (BatchHead *next; node; node = next)
+	{
+		next = node->batch_next;
+
+		IOLayerFileOverhead &iointernal = static_cast<ReadBuffer*>( node )->iointernal;
+		AsyncFile *async_file = iointernal.file;
+		u64 offset = iointernal.offset;
+		u32 bytes = iointernal.bytes;
+
+		switch (iointernal.io_type)
+		{
+		case IOTYPE_FILE_WRITE:
+			{
+				WriteBuffer *buffer = static_cast<WriteBuffer*>( node );
+
+				bytes = TransferAt(async_file->_file, true, (u8*)buffer->data, bytes, offset);
+
+				CAT_INANE("IOThread") << "IOTYPE_FILE_WRITE completed for " << async_file;
+
+				// Write event completion results to buffer
+				buffer->offset = offset;
+				buffer->data_bytes = bytes;
+
+				// If callback is valid,
+				if (buffer->callback.IsValid())
+				{
+					// Defer to the worker threads so the IO thread can issue the next request
+					completed.PushBack(buffer);
+				}
+			}
+			break;
+
+		case IOTYPE_FILE_READ:
+			{
+				ReadBuffer *buffer = static_cast<ReadBuffer*>( node );
+
+				bytes = TransferAt(async_file->_file, false, (u8*)buffer->data, bytes, offset);
+
+				CAT_INANE("IOThread") << "IOTYPE_FILE_READ completed for " << async_file;
+
+				// Write event completion results to buffer
+				buffer->offset = offset;
+				buffer->data_bytes = bytes;
+
+				// If callback is valid,
+				if (buffer->callback.IsValid())
+				{
+					// Defer to the worker threads so the IO thread can issue the next request
+					completed.PushBack(buffer);
+				}
+			}
+			break;
+		}
+
+		async_file->ReleaseRef(CAT_REFOBJECT_TRACE);
+	}
+
+	if (completed.head)
+		m_worker_threads->DeliverBuffersRoundRobin(WQPRIO_LO, completed);
+}
+
+bool IOThread::Entrypoint(void *vmaster)
+{
+	CAT_FOREVER
+	{
+		// Grab everything queued so far
+		_queue_lock.Enter();
+		BatchHead *node = _queue.head;
+		_queue.Clear();
+		_queue_lock.Leave();
+
+		if (node)
+		{
+			HandleRequests(node);
+			continue;
+		}
+
+		// Only quit once the queue has drained
+		if (_kill_flag) break;
+
+		_event_flag.Wait();
+	}
+
+	return true;
+}
+
+
+//// IOThreadPool
+
+IOThreadPool::IOThreadPool()
+{
+	_worker_count = 0;
+	_workers = 0;
+	_next_worker = 0;
+}
+
+bool IOThreadPool::Startup(u32 max_worker_count)
+{
+	// If startup was previously attempted,
+	if (_worker_count)
+	{
+		// Clean up and try again
+		Shutdown();
+	}
+
+	// Each thread holds one request in flight, so run a few per processor
+	// to keep the disk queue full
+	u32 worker_count = m_system_info->GetProcessorCount() * 2;
+	if (worker_count < MIN_IO_THREADS) worker_count = MIN_IO_THREADS;
+
+	// If worker count override is set,
+	u32 worker_count_override = m_settings->getInt("IO.IOThreadPool.WorkerCount", 0);
+	if (worker_count_override != 0)
+	{
+		// Use it instead of the default
+		worker_count = worker_count_override;
+	}
+
+	if (worker_count > MAX_IO_THREADS) worker_count = MAX_IO_THREADS;
+
+	// Impose max worker count if it is specified
+	if (max_worker_count && worker_count > max_worker_count)
+		worker_count = max_worker_count;
+
+	_workers = new (std::nothrow) IOThread[worker_count];
+	if (!_workers)
+	{
+		CAT_FATAL("IOThreadPools") << "Out of memory while allocating " << worker_count << " worker thread objects";
+		return false;
+	}
+
+	// For each worker,
+	for (u32 ii = 0; ii < worker_count; ++ii)
+	{
+		// Start its thread
+		if (!_workers[ii].StartThread(this))
+		{
+			CAT_FATAL("IOThreadPools") << "StartThread error " << errno;
+			_worker_count = ii;
+			return false;
+		}
+	}
+
+	_worker_count = worker_count;
+
+	return true;
+}
+
+bool IOThreadPool::Shutdown()
+{
+	u32 worker_count = _worker_count;
+
+	if (worker_count)
+	{
+		CAT_INFO("IOThreadPool") << "Shutting down thread pool...";
+	}
+
+	// Ask each worker to finish its queue and exit
+	for (u32 ii = 0; ii < worker_count; ++ii)
+		_workers[ii].SetKillFlag();
+
+	const int SHUTDOWN_WAIT_TIMEOUT = 15000; // 15 seconds
+
+	// For each worker thread,
+	for (u32 ii = 0; ii < worker_count; ++ii)
+	{
+		if (!_workers[ii].WaitForThread(SHUTDOWN_WAIT_TIMEOUT))
+		{
+			CAT_FATAL("IOThreadPools") << "Thread " << ii << "/" << worker_count << " refused to die!  Attempting lethal force...";
+			_workers[ii].AbortThread();
+		}
+	}
+
+	// Free worker thread objects
+	if (_workers)
+	{
+		delete []_workers;
+		_workers = 0;
+	}
+
+	_worker_count = 0;
+
+	return true;
+}
+
+bool IOThreadPool::Post(BatchHead *request)
+{
+	u32 worker_count = _worker_count;
+
+	if (!worker_count)
+	{
+		CAT_FATAL("IOThreadPools") << "Unable to post request since the thread pool was never started";
+		return false;
+	}
+
+	// Spread requests round-robin so that they run in parallel
+	u32 worker_id = Atomic::Add(&_next_worker, 1) % worker_count;
+
+	_workers[worker_id].Post(request);
+
+	return true;
+}
+
+
+//// IOThreadPools
+
+CAT_REF_SINGLETON(IOThreadPools);
+
+bool IOThreadPools::OnInitialize()
+{
+	Use(m_settings, m_system_info, m_worker_threads);
+
+	return IsInitialized() && _shared_pool.Startup();
+}
+
+void IOThreadPools::OnFinalize()
+{
+	_shared_pool.Shutdown();
+}
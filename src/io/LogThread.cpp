@@ -28,6 +28,8 @@
 
 #include <cat/io/LogThread.hpp>
 #include <cat/io/Log.hpp>
+#include <cat/threads/Atomic.hpp>
+#include <cat/time/Clock.hpp>
 using namespace cat;
 
 static Log *m_log = 0;
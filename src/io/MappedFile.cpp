@@ -31,10 +31,12 @@
 #include <cat/port/SystemInfo.hpp>
 using namespace cat;
 
-#if defined(CAT_OS_LINUX)
+#if !defined(CAT_OS_WINDOWS)
 # include <sys/mman.h>
 # include <sys/stat.h>
 # include <fcntl.h>
+# include <unistd.h>
+# include <errno.h>
 #endif
 
 MappedFile::MappedFile()
@@ -79,7 +81,28 @@ bool MappedFile::Open(const char *path, bool random_access)
 	}
 
 #else
-#error "TODO"
+
+	_fd = open(path, O_RDONLY);
+	if (_fd == -1)
+	{
+		CAT_WARN("MappedFile") << "open error " << errno << " for " << path;
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(_fd, &st))
+	{
+		CAT_WARN("MappedFile") << "fstat error " << errno << " for " << path;
+		Close();
+		return false;
+	}
+
+	_len = (u64)st.st_size;
+
+#if defined(POSIX_FADV_RANDOM)
+	posix_fadvise(_fd, 0, 0, random_access ? POSIX_FADV_RANDOM : POSIX_FADV_SEQUENTIAL);
+#endif
+
 #endif
 
 	return true;
@@ -119,9 +142,6 @@ MappedView::MappedView()
 
 	_map = 0;
 
-#else
-
-
 #endif
 }
 
@@ -147,9 +167,6 @@ bool MappedView::Open(MappedFile *file)
 		return false;
 	}
 
-#else
-
-
 #endif
 
 	return true;
@@ -186,6 +203,17 @@ u8 *MappedView::MapView(u64 offset, u32 length)
 
 #else
 
+	if (_data) munmap(_data, _length);
+
+	void *view = mmap(0, length, PROT_READ, MAP_SHARED, _file->_fd, (off_t)offset);
+	if (view == MAP_FAILED)
+	{
+		CAT_WARN("MappedView") << "mmap error " << errno;
+		_data = 0;
+		return 0;
+	}
+
+	_data = (u8*)view;
 
 #endif
 
@@ -197,9 +225,6 @@ u8 *MappedView::MapView(u64 offset, u32 length)
 
 void MappedView::Close()
 {
-	_length = 0;
-	_offset = 0;
-
 #if defined(CAT_OS_WINDOWS)
 
 	if (_data)
@@ -215,13 +240,16 @@ void MappedView::Close()
 
 #else
 
-	if (data)
+	if (_data)
 	{
-		munmap(data, len);
-		data = 0;
+		munmap(_data, _length);
+		_data = 0;
 	}
 
 #endif
+
+	_length = 0;
+	_offset = 0;
 }
 
 
@@ -263,10 +291,12 @@ u8 *MappedSequentialReader::Peek(u32 bytes)
 
 	// Map new view of file
 	u8 *data = _view.MapView(file_offset, acquire);
+	if (!data) return 0;
 
-	_offset = 0;
+	// The view starts on an allocation granularity boundary at or before the offset
+	_offset = (u32)(file_offset - _view.GetOffset());
 
-	return data;
+	return data + _offset;
 }
 
 int MappedSequentialReader::ReadLine(char *outs, int len)
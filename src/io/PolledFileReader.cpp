@@ -29,36 +29,156 @@
 #include <cat/io/PolledFileReader.hpp>
 #include <cat/port/SystemInfo.hpp>
 #include <cat/io/Settings.hpp>
+#include <cat/io/Log.hpp>
 #include <cat/mem/LargeAllocator.hpp>
+#include <cat/math/BitMath.hpp>
+#include <cat/threads/Atomic.hpp>
+#include <cat/time/Clock.hpp>
 using namespace cat;
 
+static Clock *m_clock = 0;
+
+// A new operating point must beat the best so far by this factor to be kept
+static const double TUNE_IMPROVEMENT = 1.05;
+
+// Completions per measurement window, as a multiple of the queue depth
+static const u32 TUNE_WINDOW_DEPTHS = 4;
+static const u32 TUNE_MIN_WINDOW_READS = 32;
+
 PolledFileReader::PolledFileReader()
 {
-	u32 cache_size = Settings::ref()->getInt("IO.PolledFileReader.ReadAheadCacheSize", 1024*1024*2);
+	m_clock = Clock::ref();
+
+	u32 cache_size = Settings::ref()->getInt("IO.PolledFileReader.ReadAheadCacheSize", 1024*1024*8);
 	u32 page_size = SystemInfo::ref()->GetPageSize();
 
 	// Make it a multiple of the page size
 	// NOTE: Actually needs to be sector aligned but if the file is on a CD then the sector size
 	// is usually larger than any of the fixed disks.  The page size is usually larger than the
 	// sector size of any media, so it is safe to use here.
+	if (cache_size < MIN_FILE_READ_CHUNK_SIZE * 2)
+		cache_size = MIN_FILE_READ_CHUNK_SIZE * 2;
 	cache_size -= cache_size % page_size;
-	cache_size += page_size;
 	_cache_size = cache_size;
 
-	// Allocate cache space and split it into two buffers
-	_cache[0] = (u8*)LargeAllocator::ref()->Acquire(cache_size * 2);
-	_cache[1] = _cache[0] + cache_size;
+	_cache = (u8*)LargeAllocator::ref()->Acquire(cache_size);
+
+	// For each slot,
+	for (u32 ii = 0; ii < MAX_FILE_READ_DEPTH; ++ii)
+	{
+		_slots[ii].buffer.callback.SetMember<PolledFileReader, &PolledFileReader::OnRead>(this);
+		_slots[ii].done = 0;
+	}
+
+	_in_flight = 0;
+	_busy_start_usec = 0;
+
+	_pinned = false;
+	_chunk_size = OPTIMAL_FILE_READ_CHUNK_SIZE;
+	_depth = OPTIMAL_FILE_MINIMUM_PARALLELISM;
+
+	// If the operating point is pinned in the settings file,
+	u32 pinned_chunk_size = Settings::ref()->getInt("IO.PolledFileReader.ChunkSize", 0);
+	u32 pinned_depth = Settings::ref()->getInt("IO.PolledFileReader.QueueDepth", 0);
+	if (pinned_chunk_size || pinned_depth)
+	{
+		SetOperatingPoint(pinned_chunk_size ? pinned_chunk_size : _chunk_size,
+						  pinned_depth ? pinned_depth : _depth);
+	}
+	else
+	{
+		// Pass through the clamping logic without pinning
+		SetOperatingPoint(_chunk_size, _depth);
+		_pinned = false;
+	}
+
+	_best.chunk_size = _chunk_size;
+	_best.queue_depth = _depth;
+	_best.mbps = 0;
+	_best.latency_usec = 0;
+	_best.converged = _pinned;
+	_tune_stage = _pinned ? TUNE_DONE : TUNE_DEPTH_UP;
+	_tune_moved = false;
 }
 
 PolledFileReader::~PolledFileReader()
 {
-	LargeAllocator::ref()->Release(_cache[0]);
+	WaitForReads();
+
+	LargeAllocator::ref()->Release(_cache);
+}
+
+void PolledFileReader::OnDestroy()
+{
+	// Reads abandoned after a short read may still be landing in the cache
+	WaitForReads();
+
+	AsyncFile::OnDestroy();
+}
+
+void PolledFileReader::WaitForReads()
+{
+	while (_in_flight)
+		Clock::sleep(1);
+}
+
+void PolledFileReader::SetOperatingPoint(u32 chunk_size, u32 queue_depth)
+{
+	// Chunks must be powers of two so that every slot stays sector aligned
+	if (chunk_size < MIN_FILE_READ_CHUNK_SIZE) chunk_size = MIN_FILE_READ_CHUNK_SIZE;
+	if (chunk_size > MAX_FILE_READ_CHUNK_SIZE) chunk_size = MAX_FILE_READ_CHUNK_SIZE;
+	if (!CAT_IS_POWER_OF_2(chunk_size)) chunk_size = NextHighestPow2(chunk_size);
+
+	if (queue_depth < 1) queue_depth = 1;
+	if (queue_depth > MAX_FILE_READ_DEPTH) queue_depth = MAX_FILE_READ_DEPTH;
+
+	// Fit within the read-ahead budget, giving up depth before chunk size
+	while (chunk_size * queue_depth > _cache_size && queue_depth > 1)
+		--queue_depth;
+	while (chunk_size * queue_depth > _cache_size && chunk_size > MIN_FILE_READ_CHUNK_SIZE)
+		chunk_size >>= 1;
+
+	_chunk_size = _next_chunk_size = chunk_size;
+	_depth = _next_depth = queue_depth;
+	_pinned = true;
+
+	_best.chunk_size = chunk_size;
+	_best.queue_depth = queue_depth;
+	_best.mbps = 0;
+	_best.latency_usec = 0;
+	_best.converged = true;
+	_tune_stage = TUNE_DONE;
+}
+
+void PolledFileReader::GetOperatingPoint(FileReadOperatingPoint &point)
+{
+	// If tuning has settled or the point was pinned,
+	if (_tune_stage == TUNE_DONE)
+	{
+		point = _best;
+		return;
+	}
+
+	point.chunk_size = _chunk_size;
+	point.queue_depth = _depth;
+	point.mbps = _best.mbps;
+	point.latency_usec = _best.latency_usec;
+	point.converged = false;
 }
 
 bool PolledFileReader::Open(const char *file_path, u32 worker_id)
 {
+	if (!_cache)
+	{
+		CAT_WARN("PolledFileReader") << "Out of memory: Unable to allocate read-ahead cache";
+		return false;
+	}
+
+	// If reopened after a short read, the abandoned reads must land before the slots are laid out again
+	WaitForReads();
+
 	// If file could not be opened,
-	if (!AsyncFile::Open(file_path, ASYNCFILE_READ))
+	if (!AsyncFile::Open(file_path, OPTIMAL_FILE_READ_MODE))
 	{
 		CAT_WARN("PolledFileReader") << "Unable to open " << file_path;
 		return false;
@@ -66,148 +186,316 @@ bool PolledFileReader::Open(const char *file_path, u32 worker_id)
 
 	// Reset members
 	_file_size = AsyncFile::GetSize();
-	_offset = _cache_size * 2;
-	_cache_front_index = 0;
-	_cache_front_bytes = 0;
-	_cache_back_bytes = 0;
-	_cache_offset = 0;
-	_cache_back_done = 0;
-
-	_buffer.worker_id = worker_id;
-	_buffer.callback.SetMember<PolledFileReader, &PolledFileReader::OnFirstRead>(this);
-
-	CAT_FENCE_COMPILER
-
-	// Read both buffers at once
-	if (!AsyncFile::Read(&_buffer, 0, _cache[0], _cache_size * 2))
+	_offset = 0;
+	_consumed = 0;
+	_eof = false;
+
+	// Reset tuning
+	_best.chunk_size = _chunk_size;
+	_best.queue_depth = _depth;
+	_best.mbps = 0;
+	_best.latency_usec = 0;
+	_best.converged = _pinned;
+	_tune_stage = _pinned ? TUNE_DONE : TUNE_DEPTH_UP;
+	_tune_moved = false;
+
+	_next_chunk_size = _chunk_size;
+	_next_depth = _depth;
+	ApplyOperatingPoint();
+
+	if (!IssueReads())
 	{
 		CAT_WARN("PolledFileReader") << "Unable to make initial read";
-
-		// Simulate an EOF in Read()
-		_cache_front_done = 1;
-		_cache_back_done = 1;
 		return false;
 	}
 
 	return true;
 }
 
-bool PolledFileReader::Read(u8 *buffer, u32 requested, u32 &bytes_read)
+void PolledFileReader::ApplyOperatingPoint()
 {
-	// If front buffer hasn't finished reading yet,
-	if (!_cache_front_done)
+	u32 chunk_size = _next_chunk_size;
+	u32 depth = _next_depth;
+
+	_chunk_size = chunk_size;
+	_depth = depth;
+
+	// Lay the slots out over the cache; every slot starts on a chunk boundary
+	for (u32 ii = 0; ii < depth; ++ii)
 	{
-		bytes_read = 0;
-		return true;
+		_slots[ii].data = _cache + ii * chunk_size;
+		_slots[ii].done = 0;
 	}
 
-	CAT_FOREVER
+	_head = 0;
+	_occupied = 0;
+	_consume_offset = 0;
+
+	// Start a fresh measurement window; the ring is drained so no completions race with this
+	_window_bytes = 0;
+	_window_reads = 0;
+	_window_latency_usec = 0;
+	_window_busy_usec = 0;
+}
+
+bool PolledFileReader::IssueReads()
+{
+	// If a new operating point is waiting for the ring to drain,
+	if (_next_chunk_size != _chunk_size || _next_depth != _depth)
 	{
-		// Calculate number of bytes to be read off the front buffer
-		u32 front_remaining = _cache_front_bytes - _cache_offset;
-		u32 front_read = min(front_remaining, requested);
+		if (_occupied) return true;
 
-		// Copy from front buffer
-		memcpy(buffer, _cache[_cache_front_index] + _cache_offset, front_read);
+		ApplyOperatingPoint();
+	}
 
-		// Update counters
-		buffer += front_read;
-		bytes_read = front_read;
-		requested -= front_read;
-		_cache_offset += front_read;
+	u32 chunk_size = _chunk_size;
 
-		// If front still has more data, stop reading here
-		if (front_remaining > front_read)
+	// Keep the ring full
+	while (_occupied < _depth && !_eof)
+	{
+		// If the whole file has been requested,
+		if (_offset >= _file_size)
+		{
+			_eof = true;
 			break;
+		}
 
-		// If back buffer read is not done, stop reading here
-		if (!_cache_back_done)
-			break;
+		ReadSlot *slot = &_slots[(_head + _occupied) % _depth];
 
-		// If end of file was reached,
-		if (_cache_back_bytes == 0)
-			return false;
+		slot->bytes = 0;
+		slot->done = 0;
+		slot->issue_usec = m_clock->usec();
 
-		// Otherwise swap in the new data to the front buffer
-		_cache_front_bytes = _cache_back_bytes;
-		_cache_back_bytes = 0;
-		_cache_offset = 0;
-		_cache_back_done = 0;
+		// If the disk was idle, a busy period starts now.  Only written while
+		// nothing is in flight, so completions never see it change under them
+		if (!_in_flight)
+			_busy_start_usec = slot->issue_usec;
 
-		CAT_FENCE_COMPILER
+		// NOTE: Atomic add is a full barrier, so the slot setup is visible first
+		Atomic::Add(&_in_flight, 1);
 
 		// If read request fails,
-		if (!AsyncFile::Read(&_buffer, _offset, _cache[_cache_front_index], _cache_size))
+		if (!AsyncFile::Read(&slot->buffer, _offset, slot->data, chunk_size))
 		{
-			CAT_WARN("PolledFileReader") << "Unable to make initial read";
-			Close();
+			CAT_WARN("PolledFileReader") << "Unable to read at offset " << _offset;
 
-			// Simulate an EOF condition
-			_cache_back_done = 1;
-			_cache_back_bytes = 0;
-			break;
+			Atomic::Add(&_in_flight, -1);
+
+			// Simulate an EOF condition after the reads already in flight
+			_eof = true;
+			return false;
 		}
 
-		// Swap buffers
-		_cache_front_index ^= 1;
-		_offset += _cache_size;
+		_offset += chunk_size;
+		++_occupied;
 	}
 
 	return true;
 }
 
-void PolledFileReader::OnFirstRead(ThreadLocalStorage &tls, const BatchSet &buffers)
+bool PolledFileReader::Read(u8 *buffer, u32 requested, u32 &bytes_read)
 {
-	// For each buffer,
-	for (BatchHead *node = buffers.head; node; node = node->batch_next)
+	bytes_read = 0;
+
+	while (requested > 0)
 	{
-		ReadBuffer *buffer = static_cast<ReadBuffer*>( node );
-		u32 data_bytes = buffer->data_bytes;
+		// If the ring is empty,
+		if (!_occupied)
+		{
+			if (!_eof) IssueReads();
+
+			// If there is nothing left to read, report EOF once the last bytes are out
+			if (!_occupied)
+				return bytes_read > 0;
+		}
+
+		ReadSlot *slot = &_slots[_head];
+
+		// If head slot hasn't finished reading yet, stop reading here
+		if (!slot->done)
+			break;
+
+		// Copy from head slot
+		u32 slot_bytes = slot->bytes;
+		u32 copy_bytes = slot_bytes - _consume_offset;
+		if (copy_bytes > requested) copy_bytes = requested;
+
+		memcpy(buffer, slot->data + _consume_offset, copy_bytes);
+
+		// Update counters
+		buffer += copy_bytes;
+		bytes_read += copy_bytes;
+		requested -= copy_bytes;
+		_consume_offset += copy_bytes;
+		_consumed += copy_bytes;
+
+		// If head slot still has more data, stop reading here
+		if (_consume_offset < slot_bytes)
+			break;
 
-		// Set the number of bytes in the back buffer
-		_cache_back_bytes = data_bytes;
+		// Retire the head slot
+		_consume_offset = 0;
+		_head = (_head + 1) % _depth;
+		--_occupied;
 
-		// If the file is larger than a cache buffer,
-		if (data_bytes > _cache_size)
+		// If the read came up short,
+		if (slot_bytes < _chunk_size)
 		{
-			_cache_front_bytes = _cache_size;
-			data_bytes -= _cache_size;
+			if (_consumed < _file_size)
+			{
+				CAT_WARN("PolledFileReader") << "Short read at offset " << _consumed << " of " << _file_size;
+			}
+
+			// Nothing after a short read can be trusted.  Reads still in flight
+			// land in slots that will not be reused, since no more are issued,
+			// and they stay counted in _in_flight so Open() and OnDestroy() wait
+			_eof = true;
+			_occupied = 0;
+			continue;
 		}
-		else
+
+		// If enough completions have been seen to judge this operating point,
+		// and it is not already waiting for the ring to drain to a new one,
+		if (_tune_stage != TUNE_DONE && _next_chunk_size == _chunk_size && _next_depth == _depth)
 		{
-			_cache_front_bytes = data_bytes;
-			data_bytes = 0;
+			u32 window_reads = _depth * TUNE_WINDOW_DEPTHS;
+			if (window_reads < TUNE_MIN_WINDOW_READS) window_reads = TUNE_MIN_WINDOW_READS;
+
+			if (_window_reads >= window_reads)
+				OnWindowComplete(m_clock->usec());
 		}
 
-		_cache_back_done = 1;
-		_cache_back_bytes = data_bytes;
+		IssueReads();
+	}
 
-		_buffer.callback.SetMember<PolledFileReader, &PolledFileReader::OnRead>(this);
+	return true;
+}
 
-		CAT_FENCE_COMPILER
+bool PolledFileReader::TryOperatingPoint(u32 chunk_size, u32 depth)
+{
+	if (chunk_size < MIN_FILE_READ_CHUNK_SIZE || chunk_size > MAX_FILE_READ_CHUNK_SIZE)
+		return false;
+
+	if (depth < 1 || depth > MAX_FILE_READ_DEPTH)
+		return false;
+
+	if (chunk_size * depth > _cache_size)
+		return false;
+
+	// Takes effect once the reads in flight have been consumed
+	_next_chunk_size = chunk_size;
+	_next_depth = depth;
+
+	return true;
+}
+
+void PolledFileReader::OnWindowComplete(double now)
+{
+	u32 reads = _window_reads;
+
+	// Time the disk spent with reads in flight, including the current busy period.
+	// Wall time would also count time the ring sat full waiting on the consumer
+	double busy_start = _busy_start_usec;
+	double io_usec = _window_busy_usec;
+	if (_in_flight) io_usec += now - busy_start;
+	if (io_usec < 1) io_usec = 1;
+
+	// Bytes per microsecond is megabytes per second
+	double mbps = _window_bytes / io_usec;
+	double latency_usec = reads ? _window_latency_usec / (double)reads : 0;
+
+	CAT_INANE("PolledFileReader") << "Measured " << _chunk_size << " x " << _depth << ": " << mbps << " MB/s, " << latency_usec << " usec latency";
+
+	// If this is the starting point or it beat the best so far,
+	if (_best.mbps == 0 || mbps > _best.mbps * TUNE_IMPROVEMENT)
+	{
+		// Only count it as a move in the current direction after the baseline
+		_tune_moved = _best.mbps != 0;
+
+		_best.chunk_size = _chunk_size;
+		_best.queue_depth = _depth;
+		_best.mbps = mbps;
+		_best.latency_usec = latency_usec;
+	}
+	else
+	{
+		// If going up helped, there is no point trying to go down
+		if (_tune_moved && (_tune_stage == TUNE_DEPTH_UP || _tune_stage == TUNE_CHUNK_UP))
+			_tune_stage += 2;
+		else
+			_tune_stage += 1;
+
+		_tune_moved = false;
+	}
 
-		_cache_front_done = 1;
+	// Pick the next neighbour of the best point to measure
+	CAT_FOREVER
+	{
+		u32 chunk_size = _best.chunk_size, depth = _best.queue_depth;
+
+		switch (_tune_stage)
+		{
+		case TUNE_DEPTH_UP:		depth *= 2;			break;
+		case TUNE_DEPTH_DOWN:	depth /= 2;			break;
+		case TUNE_CHUNK_UP:		chunk_size *= 2;	break;
+		case TUNE_CHUNK_DOWN:	chunk_size /= 2;	break;
+		default:
+			SettleOperatingPoint();
+			return;
+		}
+
+		if (TryOperatingPoint(chunk_size, depth))
+			return;
 
-		// Just handle the first response - only ever have one outstanding at a time
-		break;
+		// Out of bounds in this direction, so move on
+		++_tune_stage;
+		_tune_moved = false;
 	}
 }
 
+void PolledFileReader::SettleOperatingPoint()
+{
+	_tune_stage = TUNE_DONE;
+	_best.converged = true;
+
+	// Return to the best point measured
+	TryOperatingPoint(_best.chunk_size, _best.queue_depth);
+
+	CAT_INFO("PolledFileReader") << "Settled on " << _best.chunk_size << " byte reads x " << _best.queue_depth
+		<< " outstanding at " << _best.mbps << " MB/s with " << _best.latency_usec << " usec average latency.  "
+		<< "Pin with IO.PolledFileReader.ChunkSize=" << _best.chunk_size << " and IO.PolledFileReader.QueueDepth=" << _best.queue_depth;
+}
+
 void PolledFileReader::OnRead(ThreadLocalStorage &tls, const BatchSet &buffers)
 {
+	double now = m_clock->usec();
+
 	// For each buffer,
-	for (BatchHead *node = buffers.head; node; node = node->batch_next)
+	for (BatchHead *next, *node = buffers.head; node; node = next)
 	{
+		next = node->batch_next;
+
 		ReadBuffer *buffer = static_cast<ReadBuffer*>( node );
+		ReadSlot *slot = reinterpret_cast<ReadSlot*>( buffer );
 		u32 data_bytes = buffer->data_bytes;
 
-		// Set the number of bytes in the back buffer
-		_cache_back_bytes = data_bytes;
+		// Accumulate measurements for the current window
+		Atomic::Add(&_window_bytes, data_bytes);
+		Atomic::Add(&_window_latency_usec, (u32)(now - slot->issue_usec));
+		Atomic::Add(&_window_reads, 1);
+
+		slot->bytes = data_bytes;
+
+		// Read the busy period start while this read still holds it open
+		double busy_start = _busy_start_usec;
 
 		CAT_FENCE_COMPILER
 
-		_cache_back_done = 1;
+		slot->done = 1;
 
-		break;
+		// Last touch of the slot: WaitForReads() may reuse or free it after this.
+		// If this was the last read in flight, close the busy period
+		if (Atomic::Add(&_in_flight, -1) == 1)
+			Atomic::Add(&_window_busy_usec, (u32)(now - busy_start));
 	}
 }
@@ -950,7 +950,7 @@ bool File::Write(const char *file_path, bool force)
 	temp_path += ".tmp";
 
 	// Attempt to open the temporary file for write
-	ofstream file(temp_path, ios::binary);
+	ofstream file(temp_path.c_str(), ios::binary);
 	if (!file)
 	{
 		CAT_WARN("Ragdoll") << "Unable to open output file " << file_path;
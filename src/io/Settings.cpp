@@ -28,6 +28,7 @@
 
 #include <cat/io/Settings.hpp>
 #include <cat/io/Log.hpp>
+#include <cstdio>
 using namespace cat;
 
 static Log *m_logging = 0;
@@ -0,0 +1,543 @@
+/*
+	Copyright (c) 2012 Christopher A. Taylor.  All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	* Redistributions of source code must retain the above copyright notice,
+	  this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	* Neither the name of LibCat nor the names of its contributors may be used
+	  to endorse or promote products derived from this software without
+	  specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <cat/io/UDPEndpoint.hpp>
+#include <cat/io/Log.hpp>
+#include <cat/io/Buffers.hpp>
+#include <cat/net/UDPRecvAllocator.hpp>
+#include <cat/time/Clock.hpp>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <errno.h>
+using namespace std;
+using namespace cat;
+
+#if defined(CAT_OS_LINUX)
+
+#include <netinet/udp.h>
+
+// Add missing definitions for older C library headers (Linux 4.18 and 5.0)
+#if !defined(SOL_UDP)
+#define SOL_UDP 17
+#endif
+#if !defined(UDP_SEGMENT)
+#define UDP_SEGMENT 103
+#endif
+#if !defined(UDP_GRO)
+#define UDP_GRO 104
+#endif
+
+#define CAT_UDP_OFFLOAD /* Kernel may support UDP_SEGMENT and UDP_GRO */
+
+#endif
+
+static UDPRecvAllocator *m_recv_allocator = 0;
+static UDPSendAllocator *m_udp_send_allocator = 0;
+static Clock *m_clock = 0;
+
+
+//// UDPReadThread
+
+bool UDPReadThread::Entrypoint(void *vendpoint)
+{
+	UDPEndpoint *endpoint = static_cast<UDPEndpoint*>( vendpoint );
+
+	endpoint->ProcessReads();
+
+	// Release the reference held by the reader since Initialize()
+	endpoint->ReleaseRef(CAT_REFOBJECT_TRACE);
+
+	return true;
+}
+
+
+//// UDPEndpoint
+
+bool UDPEndpoint::OnInitialize()
+{
+	Use(m_udp_send_allocator, m_recv_allocator, m_clock);
+
+	return true;
+}
+
+void UDPEndpoint::OnDestroy()
+{
+	// Wake the reader thread.  The socket stays open until OnFinalize() so
+	// that the descriptor cannot be reused while the reader is still on it
+	if (Valid())
+		shutdown(GetSocket(), SHUT_RDWR);
+}
+
+bool UDPEndpoint::OnFinalize()
+{
+	// Reader has released its reference, so it is on the way out
+	_reader.WaitForThread();
+
+	Close();
+
+	return true;
+}
+
+UDPEndpoint::UDPEndpoint()
+{
+	_gso = _gro = false;
+	_gso_proven = false;
+	_gro_buffer = 0;
+}
+
+UDPEndpoint::~UDPEndpoint()
+{
+	if (_gro_buffer)
+		delete []_gro_buffer;
+}
+
+void UDPEndpoint::EnableOffload()
+{
+	_gso = _gro = false;
+
+#if defined(CAT_UDP_OFFLOAD)
+
+	// Probe for GSO: Setting a zero segment size is harmless and fails on kernels without it
+	int segment_bytes = 0;
+	if (!setsockopt(GetSocket(), SOL_UDP, UDP_SEGMENT, &segment_bytes, sizeof(segment_bytes)))
+		_gso = true;
+	else
+		CAT_INFO("UDPEndpoint") << "UDP segmentation offload unavailable: " << Sockets::GetLastErrorString();
+
+	int enable = 1;
+	if (!setsockopt(GetSocket(), SOL_UDP, UDP_GRO, &enable, sizeof(enable)))
+	{
+		if (!_gro_buffer)
+			_gro_buffer = new (std::nothrow) u8[UDP_GRO_BUFFER_BYTES];
+
+		// If workspace is unavailable, turn it back off so reads are not coalesced
+		if (_gro_buffer)
+			_gro = true;
+		else
+		{
+			enable = 0;
+			setsockopt(GetSocket(), SOL_UDP, UDP_GRO, &enable, sizeof(enable));
+		}
+	}
+	else
+		CAT_INFO("UDPEndpoint") << "UDP receive offload unavailable: " << Sockets::GetLastErrorString();
+
+#endif
+}
+
+bool UDPEndpoint::Initialize(Port port, bool ignoreUnreachable, bool RequestIPv6, bool RequireIPv4, int kernelReceiveBufferBytes)
+{
+	// If not able to create a socket,
+	if (!Create(RequestIPv6, RequireIPv4))
+		return false;
+
+	// Set SO_RCVBUF as requested (often defaults are far too low for UDP servers or UDP file transfer clients)
+	if (kernelReceiveBufferBytes < 64000) kernelReceiveBufferBytes = 64000;
+	SetRecvBufferSize(kernelReceiveBufferBytes);
+
+	// NOTE: Unlike IOCP, SO_SNDBUF is left alone because writes are not overlapped
+
+	// If ignoring ICMP unreachable,
+    if (ignoreUnreachable)
+		IgnoreUnreachable(true);
+
+	// If not able to bind,
+	if (!Bind(port))
+		return false;
+
+	// Let the reader notice shutdown even where shutdown() does not wake it
+	struct timeval timeout;
+	timeout.tv_sec = 0;
+	timeout.tv_usec = UDP_READ_TIMEOUT_MSEC * 1000;
+	if (setsockopt(GetSocket(), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)))
+		CAT_WARN("UDPEndpoint") << "Unable to set read timeout: " << Sockets::GetLastErrorString();
+
+	// Batch datagrams through the kernel where supported
+	EnableOffload();
+
+	// Reference held by the reader thread until it exits
+	AddRef(CAT_REFOBJECT_TRACE);
+
+	if (!_reader.StartThread(this))
+	{
+		CAT_FATAL("UDPEndpoint") << "Unable to start reader thread";
+		ReleaseRef(CAT_REFOBJECT_TRACE);
+		Close();
+		return false;
+	}
+
+    CAT_INFO("UDPEndpoint") << "Open on port " << GetPort();
+
+    return true;
+}
+
+
+//// Reads
+
+u32 UDPEndpoint::ReadDirect(BatchSet &set, int flags)
+{
+	BatchSet allocated;
+
+	if (m_recv_allocator->AcquireBatch(allocated, 1) == 0)
+	{
+		CAT_WARN("UDPEndpoint") << "Out of memory acquiring read buffers";
+		Clock::sleep(10);
+		return 0;
+	}
+
+	RecvBuffer *buffer = static_cast<RecvBuffer*>( allocated.head );
+
+	struct iovec iov;
+	iov.iov_base = GetTrailingBytes(buffer);
+	iov.iov_len = IOTHREADS_BUFFER_READ_BYTES;
+
+	struct msghdr msg;
+	CAT_OBJCLR(msg);
+	msg.msg_name = &buffer->iointernal.addr;
+	msg.msg_namelen = sizeof(buffer->iointernal.addr);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	int bytes = recvmsg(GetSocket(), &msg, flags);
+
+	// Zero-byte reads are also how shutdown() wakes the reader, and
+	// truncated datagrams are dropped as they are on IOCP
+	if (bytes <= 0 || (msg.msg_flags & MSG_TRUNC))
+	{
+		// Timeouts and an empty queue are expected
+		if (bytes < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && !IsShutdown())
+			CAT_WARN("UDPEndpoint") << "recvmsg error: " << Sockets::GetLastErrorString();
+
+		m_recv_allocator->ReleaseBatch(allocated);
+		return 0;
+	}
+
+	// Address is left raw for SetRemoteAddress() in OnRecvRouting(), as on IOCP
+	buffer->iointernal.addr_len = msg.msg_namelen;
+	buffer->data_bytes = bytes;
+	buffer->event_msec = m_clock->msec();
+
+	set.PushBack(buffer);
+	return 1;
+}
+
+u32 UDPEndpoint::ReadCoalesced(BatchSet &set, int flags)
+{
+#if defined(CAT_UDP_OFFLOAD)
+
+	sockaddr_in6 addr;
+	struct iovec iov;
+	iov.iov_base = _gro_buffer;
+	iov.iov_len = UDP_GRO_BUFFER_BYTES;
+
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control;
+
+	struct msghdr msg;
+	CAT_OBJCLR(msg);
+	msg.msg_name = &addr;
+	msg.msg_namelen = sizeof(addr);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	int result = recvmsg(GetSocket(), &msg, flags);
+	if (result <= 0 || (msg.msg_flags & MSG_TRUNC))
+	{
+		if (result < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && !IsShutdown())
+			CAT_WARN("UDPEndpoint") << "recvmsg error: " << Sockets::GetLastErrorString();
+
+		return 0;
+	}
+
+	u32 bytes = (u32)result;
+	u32 segment_bytes = bytes;
+
+	// If the kernel coalesced several datagrams, find their size
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+	{
+		if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+		{
+			int gso_size;
+			memcpy(&gso_size, CMSG_DATA(cmsg), sizeof(gso_size));
+			if (gso_size > 0) segment_bytes = (u32)gso_size;
+		}
+	}
+
+	// Datagrams that would not fit a receive buffer are dropped, as they are truncated without offload
+	if (segment_bytes > IOTHREADS_BUFFER_READ_BYTES)
+		return 0;
+
+	u32 count = (bytes + segment_bytes - 1) / segment_bytes;
+
+	BatchSet allocated;
+	u32 acquired = m_recv_allocator->AcquireBatch(allocated, count);
+
+	if (acquired < count)
+	{
+		CAT_WARN("UDPEndpoint") << "Out of memory acquiring read buffers: Dropped " << (count - acquired) << " datagrams";
+
+		if (acquired == 0)
+			return 0;
+	}
+
+	u32 event_msec = m_clock->msec();
+	const u8 *src = _gro_buffer;
+
+	// Split the coalesced read into one buffer per datagram
+	for (BatchHead *next, *node = allocated.head; node; node = next)
+	{
+		next = node->batch_next;
+		RecvBuffer *buffer = static_cast<RecvBuffer*>( node );
+		u32 copy_bytes = bytes < segment_bytes ? bytes : segment_bytes;
+
+		memcpy(GetTrailingBytes(buffer), src, copy_bytes);
+		buffer->data_bytes = copy_bytes;
+		buffer->event_msec = event_msec;
+		memcpy(&buffer->iointernal.addr, &addr, sizeof(addr));
+		buffer->iointernal.addr_len = msg.msg_namelen;
+
+		src += copy_bytes;
+		bytes -= copy_bytes;
+
+		set.PushBack(buffer);
+	}
+
+	return acquired;
+
+#else
+
+	return 0;
+
+#endif
+}
+
+void UDPEndpoint::ProcessReads()
+{
+	while (!IsShutdown())
+	{
+		BatchSet set;
+		set.Clear();
+
+		// Block for the first read, then drain what else is queued so it is routed together
+		u32 count = 0;
+		int flags = 0;
+
+		for (;;)
+		{
+			u32 read_count = _gro ? ReadCoalesced(set, flags) : ReadDirect(set, flags);
+
+			if (read_count == 0)
+				break;
+
+			count += read_count;
+			if (count >= UDP_READ_BATCH_LIMIT)
+				break;
+
+			flags = MSG_DONTWAIT;
+		}
+
+		if (count == 0)
+			continue;
+
+		// If reads completed during shutdown,
+		if (IsShutdown())
+		{
+			// Just release the read buffers
+			m_recv_allocator->ReleaseBatch(set);
+			break;
+		}
+
+		// Each buffer holds a reference until ReleaseRecvBuffers()
+		AddRef(CAT_REFOBJECT_TRACE, count);
+
+		// Notify derived class about new buffers
+		OnRecvRouting(set);
+	}
+}
+
+void UDPEndpoint::SetRemoteAddress(RecvBuffer *buffer)
+{
+	buffer->addr.Wrap(buffer->iointernal.addr);
+}
+
+void UDPEndpoint::ReleaseRecvBuffers(BatchSet buffers, u32 count)
+{
+	if (!buffers.head) return;
+
+	m_recv_allocator->ReleaseBatch(buffers);
+
+	ReleaseRef(CAT_REFOBJECT_TRACE, count);
+}
+
+
+//// Writes
+
+BatchHead *UDPEndpoint::WriteRun(BatchHead *node, const sockaddr *addr, int addr_len, u32 &write_count)
+{
+	BatchHead *next = node->batch_next;
+
+#if defined(CAT_UDP_OFFLOAD)
+
+	// If segmentation offload is available,
+	if (_gso)
+	{
+		// Gather a run of datagrams that the kernel can cut back apart:
+		// All but the last must be exactly the first one's size
+		u32 segment_bytes = static_cast<SendBuffer*>( node )->data_bytes;
+		struct iovec iov[UDP_GSO_MAX_SEGMENTS];
+		u32 count = 0, total_bytes = 0;
+
+		next = node;
+		do
+		{
+			SendBuffer *buffer = static_cast<SendBuffer*>( next );
+			u32 bytes = buffer->data_bytes;
+
+			if (count > 0 && (bytes > segment_bytes || total_bytes + bytes > UDP_GSO_MAX_BYTES))
+				break;
+
+			iov[count].iov_base = GetTrailingBytes(buffer);
+			iov[count].iov_len = bytes;
+			++count;
+			total_bytes += bytes;
+			next = next->batch_next;
+
+			// A short datagram ends the run
+			if (bytes < segment_bytes)
+				break;
+		} while (next && count < UDP_GSO_MAX_SEGMENTS);
+
+		// If there is more than one datagram to send,
+		if (count > 1)
+		{
+			union {
+				char buf[CMSG_SPACE(sizeof(u16))];
+				struct cmsghdr align;
+			} control;
+			CAT_OBJCLR(control);
+
+			struct msghdr msg;
+			CAT_OBJCLR(msg);
+			msg.msg_name = const_cast<sockaddr*>( addr );
+			msg.msg_namelen = addr_len;
+			msg.msg_iov = iov;
+			msg.msg_iovlen = count;
+			msg.msg_control = control.buf;
+			msg.msg_controllen = sizeof(control.buf);
+
+			struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+			cmsg->cmsg_level = SOL_UDP;
+			cmsg->cmsg_type = UDP_SEGMENT;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(u16));
+			u16 gso_size = (u16)segment_bytes;
+			memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(gso_size));
+
+			if (sendmsg(GetSocket(), &msg, 0) >= 0)
+			{
+				_gso_proven = true;
+				write_count += count;
+				return next;
+			}
+
+			int code = errno;
+
+			// If the socket cannot segment at all, or the device failed the first try,
+			if (code == ENOPROTOOPT || code == EOPNOTSUPP || (code == EIO && !_gso_proven))
+			{
+				CAT_WARN("UDPEndpoint") << "Disabling UDP segmentation offload after sendmsg() failure: " << Sockets::GetErrorString(code);
+				_gso = false;
+			}
+			else if (code != EINVAL && code != EIO)
+			{
+				// Other errors, like a full socket buffer, are treated as loss
+				CAT_WARN("UDPEndpoint") << "sendmsg error: " << Sockets::GetErrorString(code);
+				return next;
+			}
+
+			// Send this run one datagram at a time.  EINVAL is usually one
+			// segment too large for the path, which says nothing about the next run
+			for (; node != next; node = node->batch_next)
+			{
+				SendBuffer *buffer = static_cast<SendBuffer*>( node );
+
+				if (sendto(GetSocket(), GetTrailingBytes(buffer), buffer->data_bytes, 0, addr, addr_len) >= 0)
+					++write_count;
+				else
+					CAT_WARN("UDPEndpoint") << "sendto error: " << Sockets::GetLastErrorString();
+			}
+
+			return next;
+		}
+	}
+
+#endif
+
+	SendBuffer *buffer = static_cast<SendBuffer*>( node );
+
+	if (sendto(GetSocket(), GetTrailingBytes(buffer), buffer->data_bytes, 0, addr, addr_len) >= 0)
+		++write_count;
+	else
+		CAT_WARN("UDPEndpoint") << "sendto error: " << Sockets::GetLastErrorString();
+
+	return node->batch_next;
+}
+
+bool UDPEndpoint::Write(const BatchSet &buffers, u32 count, const NetAddr &addr)
+{
+	NetAddr::SockAddr out_addr;
+	int addr_len;
+
+	// If in the process of shutdown or input invalid,
+	if (IsShutdown() || !addr.Unwrap(out_addr, addr_len))
+	{
+		m_udp_send_allocator->ReleaseBatch(buffers);
+		return false;
+	}
+
+	u32 write_count = 0;
+
+	// For each run of buffers that can go out in one call,
+	for (BatchHead *node = buffers.head; node; )
+		node = WriteRun(node, reinterpret_cast<const sockaddr*>( &out_addr ), addr_len, write_count);
+
+	// Writes are complete once the kernel has copied them
+	m_udp_send_allocator->ReleaseBatch(buffers);
+
+	return count == write_count;
+}
+
+bool UDPEndpoint::Write(u8 *data, u32 data_bytes, const NetAddr &addr)
+{
+	SendBuffer *buffer = SendBuffer::Promote(data);
+	buffer->data_bytes = data_bytes;
+	return Write(buffer, 1, addr);
+}
@@ -27,6 +27,7 @@
 */
 
 #include <cat/lang/HashTable.hpp>
+#include <cat/hash/Murmur.hpp>
 using namespace cat;
 
 
@@ -29,18 +29,48 @@
 #include <cat/math/MemXOR.hpp>
 using namespace cat;
 
+#if defined(CAT_ISA_X86) && !defined(CAT_HAS_AVX2) && defined(CAT_HAS_SSE2)
+// AVX2 kernels are built anyway and selected at runtime if the CPU has AVX2
+# if defined(CAT_COMPILER_MSVC) && (_MSC_VER >= 1700)
+#  define CAT_MEMXOR_AVX2_DISPATCH
+#  define CAT_AVX2_TARGET
+# elif defined(__clang__) || (defined(CAT_COMPILER_GCC) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)))
+#  define CAT_MEMXOR_AVX2_DISPATCH
+#  define CAT_AVX2_TARGET __attribute__((target("avx2")))
+# endif
+#endif
 
-void cat::memxor(void *voutput, const void *vinput, int bytes)
+#if defined(CAT_HAS_SSE2)
+# include <emmintrin.h>
+#endif
+
+#if defined(CAT_HAS_AVX2) || defined(CAT_MEMXOR_AVX2_DISPATCH)
+# include <immintrin.h>
+#endif
+
+#if defined(CAT_MEMXOR_AVX2_DISPATCH)
+# if defined(CAT_COMPILER_MSVC)
+#  include <intrin.h>
+# else
+#  include <cpuid.h>
+# endif
+#endif
+
+#if defined(CAT_HAS_NEON)
+# include <arm_neon.h>
+#endif
+
+
+//// Scalar engine
+
+static void memxor_scalar(void *voutput, const void *vinput, int bytes)
 {
 	/*
 		Often times the output is XOR'd in-place so this version is
 		faster than the one below with two inputs.
 
-		There would be a decent performance improvement by using MMX
-		if the buffers are all aligned.  However, I don't really have
-		control over how the buffers are aligned because the block
-		sizes are not always multiples of 16 bytes.  So after an hour
-		of tuning this is the best version I found.
+		This is the portable engine, and it also handles the unaligned
+		heads and short tails for the SIMD engines below.
 	*/
 
 	// Primary engine
@@ -97,7 +127,7 @@ void cat::memxor(void *voutput, const void *vinput, int bytes)
 	}
 }
 
-void cat::memxor_set(void *voutput, const void *va, const void *vb, int bytes)
+static void memxor_set_scalar(void *voutput, const void *va, const void *vb, int bytes)
 {
 	/*
 		This version exists to avoid an expensive memory copy operation when
@@ -161,7 +191,7 @@ void cat::memxor_set(void *voutput, const void *va, const void *vb, int bytes)
 	}
 }
 
-void cat::memxor_add(void *voutput, const void *va, const void *vb, int bytes)
+static void memxor_add_scalar(void *voutput, const void *va, const void *vb, int bytes)
 {
 	/*
 		This version adds to the output instead of overwriting it.
@@ -223,3 +253,310 @@ void cat::memxor_add(void *voutput, const void *va, const void *vb, int bytes)
 		break;
 	}
 }
+
+
+//// SIMD engines
+
+/*
+	For large buffers the output pointer is first brought up to the vector
+	size with the scalar engine, so stores never split a cache line.  Short
+	buffers skip this since the extra scalar call costs more than it saves.
+	Inputs are loaded unaligned since they rarely share the output alignment.
+	Whatever is left after the last whole vector goes to the scalar engine.
+
+	The three kernels are the same for each instruction set, so they are
+	written once here and stamped out below.
+*/
+
+#define CAT_MEMXOR_KERNELS(NAME, TARGET, VEC, VEC_BYTES, LOAD, STORE, XOR)							\
+																									\
+static TARGET void memxor_##NAME(void *voutput, const void *vinput, int bytes)						\
+{																									\
+	u8 *output = reinterpret_cast<u8*>( voutput );													\
+	const u8 *input = reinterpret_cast<const u8*>( vinput );										\
+																									\
+	if (bytes >= VEC_BYTES * 16)																	\
+	{																								\
+		int head = (int)((0 - (uintptr_t)output) & (VEC_BYTES - 1));								\
+		memxor_scalar(output, input, head);															\
+		output += head;																				\
+		input += head;																				\
+		bytes -= head;																				\
+	}																								\
+																									\
+	while (bytes >= VEC_BYTES * 4)																	\
+	{																								\
+		VEC x0 = XOR(LOAD(output), LOAD(input));													\
+		VEC x1 = XOR(LOAD(output + VEC_BYTES), LOAD(input + VEC_BYTES));							\
+		VEC x2 = XOR(LOAD(output + VEC_BYTES*2), LOAD(input + VEC_BYTES*2));						\
+		VEC x3 = XOR(LOAD(output + VEC_BYTES*3), LOAD(input + VEC_BYTES*3));						\
+		STORE(output, x0);																			\
+		STORE(output + VEC_BYTES, x1);																\
+		STORE(output + VEC_BYTES*2, x2);															\
+		STORE(output + VEC_BYTES*3, x3);															\
+		output += VEC_BYTES * 4;																	\
+		input += VEC_BYTES * 4;																		\
+		bytes -= VEC_BYTES * 4;																		\
+	}																								\
+																									\
+	while (bytes >= VEC_BYTES)																		\
+	{																								\
+		STORE(output, XOR(LOAD(output), LOAD(input)));												\
+		output += VEC_BYTES;																		\
+		input += VEC_BYTES;																			\
+		bytes -= VEC_BYTES;																			\
+	}																								\
+																									\
+	memxor_scalar(output, input, bytes);															\
+}																									\
+																									\
+static TARGET void memxor_set_##NAME(void *voutput, const void *va, const void *vb, int bytes)		\
+{																									\
+	u8 *output = reinterpret_cast<u8*>( voutput );													\
+	const u8 *a = reinterpret_cast<const u8*>( va );												\
+	const u8 *b = reinterpret_cast<const u8*>( vb );												\
+																									\
+	if (bytes >= VEC_BYTES * 16)																	\
+	{																								\
+		int head = (int)((0 - (uintptr_t)output) & (VEC_BYTES - 1));								\
+		memxor_set_scalar(output, a, b, head);														\
+		output += head;																				\
+		a += head;																					\
+		b += head;																					\
+		bytes -= head;																				\
+	}																								\
+																									\
+	while (bytes >= VEC_BYTES * 4)																	\
+	{																								\
+		VEC x0 = XOR(LOAD(a), LOAD(b));																\
+		VEC x1 = XOR(LOAD(a + VEC_BYTES), LOAD(b + VEC_BYTES));										\
+		VEC x2 = XOR(LOAD(a + VEC_BYTES*2), LOAD(b + VEC_BYTES*2));									\
+		VEC x3 = XOR(LOAD(a + VEC_BYTES*3), LOAD(b + VEC_BYTES*3));									\
+		STORE(output, x0);																			\
+		STORE(output + VEC_BYTES, x1);																\
+		STORE(output + VEC_BYTES*2, x2);															\
+		STORE(output + VEC_BYTES*3, x3);															\
+		output += VEC_BYTES * 4;																	\
+		a += VEC_BYTES * 4;																			\
+		b += VEC_BYTES * 4;																			\
+		bytes -= VEC_BYTES * 4;																		\
+	}																								\
+																									\
+	while (bytes >= VEC_BYTES)																		\
+	{																								\
+		STORE(output, XOR(LOAD(a), LOAD(b)));														\
+		output += VEC_BYTES;																		\
+		a += VEC_BYTES;																				\
+		b += VEC_BYTES;																				\
+		bytes -= VEC_BYTES;																			\
+	}																								\
+																									\
+	memxor_set_scalar(output, a, b, bytes);															\
+}																									\
+																									\
+static TARGET void memxor_add_##NAME(void *voutput, const void *va, const void *vb, int bytes)		\
+{																									\
+	u8 *output = reinterpret_cast<u8*>( voutput );													\
+	const u8 *a = reinterpret_cast<const u8*>( va );												\
+	const u8 *b = reinterpret_cast<const u8*>( vb );												\
+																									\
+	if (bytes >= VEC_BYTES * 16)																	\
+	{																								\
+		int head = (int)((0 - (uintptr_t)output) & (VEC_BYTES - 1));								\
+		memxor_add_scalar(output, a, b, head);														\
+		output += head;																				\
+		a += head;																					\
+		b += head;																					\
+		bytes -= head;																				\
+	}																								\
+																									\
+	while (bytes >= VEC_BYTES * 2)																	\
+	{																								\
+		VEC x0 = XOR(LOAD(output), XOR(LOAD(a), LOAD(b)));											\
+		VEC x1 = XOR(LOAD(output + VEC_BYTES), XOR(LOAD(a + VEC_BYTES), LOAD(b + VEC_BYTES)));		\
+		STORE(output, x0);																			\
+		STORE(output + VEC_BYTES, x1);																\
+		output += VEC_BYTES * 2;																	\
+		a += VEC_BYTES * 2;																			\
+		b += VEC_BYTES * 2;																			\
+		bytes -= VEC_BYTES * 2;																		\
+	}																								\
+																									\
+	while (bytes >= VEC_BYTES)																		\
+	{																								\
+		STORE(output, XOR(LOAD(output), XOR(LOAD(a), LOAD(b))));									\
+		output += VEC_BYTES;																		\
+		a += VEC_BYTES;																				\
+		b += VEC_BYTES;																				\
+		bytes -= VEC_BYTES;																			\
+	}																								\
+																									\
+	memxor_add_scalar(output, a, b, bytes);															\
+}
+
+#if defined(CAT_HAS_SSE2)
+
+#define CAT_SSE2_LOAD(p) _mm_loadu_si128(reinterpret_cast<const __m128i*>( p ))
+#define CAT_SSE2_STORE(p, x) _mm_storeu_si128(reinterpret_cast<__m128i*>( p ), x)
+
+CAT_MEMXOR_KERNELS(sse2, , __m128i, 16, CAT_SSE2_LOAD, CAT_SSE2_STORE, _mm_xor_si128)
+
+#undef CAT_SSE2_LOAD
+#undef CAT_SSE2_STORE
+
+#endif // CAT_HAS_SSE2
+
+#if defined(CAT_HAS_AVX2) || defined(CAT_MEMXOR_AVX2_DISPATCH)
+
+#if !defined(CAT_AVX2_TARGET)
+# define CAT_AVX2_TARGET
+#endif
+
+#define CAT_AVX2_LOAD(p) _mm256_loadu_si256(reinterpret_cast<const __m256i*>( p ))
+#define CAT_AVX2_STORE(p, x) _mm256_storeu_si256(reinterpret_cast<__m256i*>( p ), x)
+
+CAT_MEMXOR_KERNELS(avx2, CAT_AVX2_TARGET, __m256i, 32, CAT_AVX2_LOAD, CAT_AVX2_STORE, _mm256_xor_si256)
+
+#undef CAT_AVX2_LOAD
+#undef CAT_AVX2_STORE
+
+#endif // CAT_HAS_AVX2
+
+#if defined(CAT_HAS_NEON)
+
+#define CAT_NEON_LOAD(p) vld1q_u8(p)
+#define CAT_NEON_STORE(p, x) vst1q_u8(p, x)
+
+CAT_MEMXOR_KERNELS(neon, , uint8x16_t, 16, CAT_NEON_LOAD, CAT_NEON_STORE, veorq_u8)
+
+#undef CAT_NEON_LOAD
+#undef CAT_NEON_STORE
+
+#endif // CAT_HAS_NEON
+
+#undef CAT_MEMXOR_KERNELS
+
+
+//// Engine selection
+
+struct MemXOREngine
+{
+	const char *name;
+	void (*xor_in_place)(void *voutput, const void *vinput, int bytes);
+	void (*xor_set)(void *voutput, const void *va, const void *vb, int bytes);
+	void (*xor_add)(void *voutput, const void *va, const void *vb, int bytes);
+};
+
+static const MemXOREngine m_scalar_engine = {
+	"Scalar", memxor_scalar, memxor_set_scalar, memxor_add_scalar
+};
+
+#if defined(CAT_HAS_SSE2)
+static const MemXOREngine m_sse2_engine = {
+	"SSE2", memxor_sse2, memxor_set_sse2, memxor_add_sse2
+};
+#endif
+
+#if defined(CAT_HAS_AVX2) || defined(CAT_MEMXOR_AVX2_DISPATCH)
+static const MemXOREngine m_avx2_engine = {
+	"AVX2", memxor_avx2, memxor_set_avx2, memxor_add_avx2
+};
+#endif
+
+#if defined(CAT_HAS_NEON)
+static const MemXOREngine m_neon_engine = {
+	"NEON", memxor_neon, memxor_set_neon, memxor_add_neon
+};
+#endif
+
+#if defined(CAT_MEMXOR_AVX2_DISPATCH)
+
+// True if both the CPU and the OS support AVX2
+static bool HasAVX2()
+{
+	u32 regs[4], xcr0;
+
+#if defined(CAT_COMPILER_MSVC)
+	int info[4];
+
+	__cpuid(info, 0);
+	if (info[0] < 7) return false;
+
+	__cpuid(info, 1);
+	regs[2] = info[2];
+#else
+	if (__get_cpuid_max(0, 0) < 7) return false;
+
+	__cpuid(1, regs[0], regs[1], regs[2], regs[3]);
+#endif
+
+	// If the OS does not save the AVX registers (OSXSAVE and AVX bits),
+	if ((regs[2] & 0x18000000) != 0x18000000)
+		return false;
+
+#if defined(CAT_COMPILER_MSVC)
+	xcr0 = (u32)_xgetbv(0);
+
+	__cpuidex(info, 7, 0);
+	regs[1] = info[1];
+#else
+	u32 xcr0_high;
+	__asm__ __volatile__ ("xgetbv" : "=a" (xcr0), "=d" (xcr0_high) : "c" (0));
+
+	__cpuid_count(7, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+
+	// XMM and YMM state enabled, and AVX2 present
+	return (xcr0 & 6) == 6 && (regs[1] & (1 << 5)) != 0;
+}
+
+#endif // CAT_MEMXOR_AVX2_DISPATCH
+
+static const MemXOREngine *SelectEngine()
+{
+#if defined(CAT_HAS_AVX2)
+	return &m_avx2_engine;
+#elif defined(CAT_MEMXOR_AVX2_DISPATCH)
+	return HasAVX2() ? &m_avx2_engine : &m_sse2_engine;
+#elif defined(CAT_HAS_SSE2)
+	return &m_sse2_engine;
+#elif defined(CAT_HAS_NEON)
+	return &m_neon_engine;
+#else
+	return &m_scalar_engine;
+#endif
+}
+
+// Selected on first use; racing threads all pick the same engine
+static const MemXOREngine *m_engine = 0;
+
+static CAT_INLINE const MemXOREngine *GetEngine()
+{
+	if (!m_engine)
+		m_engine = SelectEngine();
+
+	return m_engine;
+}
+
+
+//// Public interface
+
+void cat::memxor(void *voutput, const void *vinput, int bytes)
+{
+	GetEngine()->xor_in_place(voutput, vinput, bytes);
+}
+
+void cat::memxor_set(void *voutput, const void *va, const void *vb, int bytes)
+{
+	GetEngine()->xor_set(voutput, va, vb, bytes);
+}
+
+void cat::memxor_add(void *voutput, const void *va, const void *vb, int bytes)
+{
+	GetEngine()->xor_add(voutput, va, vb, bytes);
+}
+
+const char *cat::memxor_engine()
+{
+	return GetEngine()->name;
+}
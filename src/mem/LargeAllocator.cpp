@@ -27,6 +27,7 @@
 */
 
 #include <cat/mem/LargeAllocator.hpp>
+#include <cat/port/SystemInfo.hpp>
 #include <cstdlib>
 #include <cstdio>
 using namespace std;
@@ -34,13 +35,17 @@ using namespace cat;
 
 CAT_SINGLETON(LargeAllocator);
 
-// Allocates memory aligned to a CPU cache-line byte boundary from the heap
+// Allocates memory aligned to a page boundary from the heap
 void *LargeAllocator::Acquire(u32 bytes)
 {
 #if defined(CAT_OS_WINDOWS)
 	return VirtualAlloc(0, bytes, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
 #else
-	return AlignedAllocator::Acquire(bytes);
+	// Page-aligned like VirtualAlloc, so the memory can back unbuffered (O_DIRECT) file IO
+	void *ptr;
+	if (posix_memalign(&ptr, SystemInfo::ref()->GetPageSize(), bytes))
+		return 0;
+	return ptr;
 #endif
 }
 
@@ -52,7 +57,7 @@ void LargeAllocator::Release(void *ptr)
 #if defined(CAT_OS_WINDOWS)
 		VirtualFree(ptr, 0, MEM_RELEASE);
 #else
-		AlignedAllocator::Release(ptr);
+		free(ptr);
 #endif
 	}
 }
@@ -35,14 +35,21 @@ using namespace cat;
 #pragma comment(lib, "ws2_32.lib")
 #endif
 
+#if !defined(CAT_OS_WINDOWS)
+# include <errno.h>
+#endif
+
 // Fix missing definitions (mainly for MinGW)
 #if !defined(IPV6_V6ONLY)
 #define IPV6_V6ONLY 27
 #endif
-#if !defined(SIO_UDP_CONNRESET)
+#if defined(CAT_OS_WINDOWS) && !defined(SIO_UDP_CONNRESET)
 #define SIO_UDP_CONNRESET _WSAIOW(IOC_VENDOR,12)
 #endif
 
+// Defined ahead of Socket::Create(), which is the first user of Sockets::ref()
+CAT_REF_SINGLETON(Sockets);
+
 
 //// Socket
 
@@ -138,18 +145,30 @@ bool UDPSocket::IgnoreUnreachable(bool ignore)
 	// ICMP Port Unreachable or other failures until you get the first packet.
 	// After that call IgnoreUnreachable() to avoid spoofed ICMP exploits.
 
+#if defined(CAT_OS_WINDOWS)
 	DWORD behavior = ignore ? FALSE : TRUE;
 	if (ioctlsocket(GetSocket(), SIO_UDP_CONNRESET, &behavior) == SOCKET_ERROR)
 	{
 		CAT_WARN("UDPSocket") << "Unable to ignore ICMP Unreachable: " << Sockets::GetLastErrorString();
 		return false;
 	}
+#else
+	// POSIX only reports ICMP errors on unconnected UDP sockets when
+	// IP_RECVERR is set, which is never done here, so they are always ignored
+	if (!ignore)
+	{
+		CAT_WARN("UDPSocket") << "Unable to listen for ICMP Unreachable: Not supported on this platform";
+		return false;
+	}
+#endif
 
 	return true;
 }
 
 bool UDPSocket::DontFragment(bool df)
 {
+#if defined(CAT_OS_WINDOWS)
+
 	DWORD behavior = df ? TRUE : FALSE;
 	if (setsockopt(GetSocket(), IPPROTO_IP, IP_DONTFRAGMENT, (const char*)&behavior, sizeof(behavior)))
 	{
@@ -157,14 +176,78 @@ bool UDPSocket::DontFragment(bool df)
 		return false;
 	}
 
+#if defined(IPV6_DONTFRAG)
+	if (SupportsIPv6() &&
+		setsockopt(GetSocket(), IPPROTO_IPV6, IPV6_DONTFRAG, (const char*)&behavior, sizeof(behavior)))
+	{
+		CAT_WARN("UDPSocket") << "Unable to change IPv6 don't fragment option: " << Sockets::GetLastErrorString();
+		return false;
+	}
+#endif
+
+#elif defined(IP_MTU_DISCOVER)
+
+	// Linux: The PROBE mode sets DF but does not clamp sends to the path MTU
+	// that the kernel learned from ICMP, so MTU probes measure the path directly
+#if defined(IP_PMTUDISC_PROBE)
+	int behavior = df ? IP_PMTUDISC_PROBE : IP_PMTUDISC_DONT;
+#else
+	int behavior = df ? IP_PMTUDISC_DO : IP_PMTUDISC_DONT;
+#endif
+	if (setsockopt(GetSocket(), IPPROTO_IP, IP_MTU_DISCOVER, &behavior, sizeof(behavior)))
+	{
+		CAT_WARN("UDPSocket") << "Unable to change don't fragment bit: " << Sockets::GetLastErrorString();
+		return false;
+	}
+
+	if (SupportsIPv6())
+	{
+#if defined(IPV6_PMTUDISC_PROBE)
+		int behavior6 = df ? IPV6_PMTUDISC_PROBE : IPV6_PMTUDISC_DONT;
+#else
+		int behavior6 = df ? IPV6_PMTUDISC_DO : IPV6_PMTUDISC_DONT;
+#endif
+		int dontfrag = df ? 1 : 0;
+		if (setsockopt(GetSocket(), IPPROTO_IPV6, IPV6_MTU_DISCOVER, &behavior6, sizeof(behavior6)) ||
+			setsockopt(GetSocket(), IPPROTO_IPV6, IPV6_DONTFRAG, &dontfrag, sizeof(dontfrag)))
+		{
+			CAT_WARN("UDPSocket") << "Unable to change IPv6 don't fragment option: " << Sockets::GetLastErrorString();
+			return false;
+		}
+	}
+
+#elif defined(IP_DONTFRAG)
+
+	// BSD and Mac OS X
+	int behavior = df ? 1 : 0;
+	if (setsockopt(GetSocket(), IPPROTO_IP, IP_DONTFRAG, &behavior, sizeof(behavior)))
+	{
+		CAT_WARN("UDPSocket") << "Unable to change don't fragment bit: " << Sockets::GetLastErrorString();
+		return false;
+	}
+
+#if defined(IPV6_DONTFRAG)
+	if (SupportsIPv6() &&
+		setsockopt(GetSocket(), IPPROTO_IPV6, IPV6_DONTFRAG, &behavior, sizeof(behavior)))
+	{
+		CAT_WARN("UDPSocket") << "Unable to change IPv6 don't fragment option: " << Sockets::GetLastErrorString();
+		return false;
+	}
+#endif
+
+#else
+
+	CAT_WARN("UDPSocket") << "Unable to change don't fragment bit: Not supported on this platform";
+	return false;
+
+#endif
+
 	return true;
 }
 
 
 //// Sockets
 
-CAT_REF_SINGLETON(Sockets);
-
 bool Sockets::OnInitialize()
 {
 #if defined(CAT_OS_WINDOWS)
@@ -266,7 +349,7 @@ bool Sockets::NetBind(SocketHandle s, Port port, bool SupportIPv6)
 		sockaddr_in *addr4 = reinterpret_cast<sockaddr_in*>( &addr );
 
 		addr4->sin_family = AF_INET;
-		addr4->sin_addr.S_un.S_addr = INADDR_ANY;
+		addr4->sin_addr.s_addr = INADDR_ANY;
 		addr4->sin_port = htons(port);
 		CAT_OBJCLR(addr4->sin_zero);
 
@@ -280,7 +363,7 @@ bool Sockets::NetBind(SocketHandle s, Port port, bool SupportIPv6)
 Port Sockets::GetBoundPort(SocketHandle s)
 {
 	sockaddr_in6 addr;
-	int namelen = sizeof(addr);
+	socklen_t namelen = sizeof(addr);
 
 	// If socket name cannot be determined,
 	if (getsockname(s, reinterpret_cast<sockaddr*>( &addr ), &namelen))
@@ -351,6 +434,14 @@ std::string Sockets::GetErrorString(int code)
 	case ECHILD:	return "[No child processes]";
 	case EAGAIN:	return "[Try again]";
 	case ENOMEM:	return "[Out of memory]";
+	case EINVAL:	return "[Invalid argument]";
+	case EMSGSIZE:	return "[Message too long]";
+	case ENOBUFS:	return "[No buffer space available]";
+	case ENOPROTOOPT:	return "[Protocol not available]";
+	case EOPNOTSUPP:	return "[Operation not supported]";
+	case EADDRINUSE:	return "[Address is in use]";
+	case EADDRNOTAVAIL:	return "[Address not available]";
+	case ECONNREFUSED:	return "[Connection refused]";
 #endif
 	};
 
@@ -368,7 +459,7 @@ bool UNetAddr::Wrap(const sockaddr_in &addr)
 	if (addr.sin_family == AF_INET)
 	{
 		Port port = ntohs(addr.sin_port);
-		u32 ip = addr.sin_addr.S_un.S_addr;
+		u32 ip = addr.sin_addr.s_addr;
 
 		_family = AF_INET;
 		_port = port;
@@ -391,7 +482,7 @@ bool UNetAddr::Wrap(const sockaddr *addr)
 	{
 		const sockaddr_in *addr4 = reinterpret_cast<const sockaddr_in*>( addr );
 		Port port = ntohs(addr4->sin_port);
-		u32 ip = addr4->sin_addr.S_un.S_addr;
+		u32 ip = addr4->sin_addr.s_addr;
 
 		_family = AF_INET;
 		_port = port;
@@ -550,10 +641,15 @@ bool UNetAddr::SetFromString(const char *ip_str, Port port)
 {
 	// Try to convert from IPv6 address first
 	sockaddr_in6 addr6;
+
+#if defined(CAT_OS_WINDOWS)
 	int out_addr_len6 = sizeof(addr6);
 
 	if (!WSAStringToAddressA((char*)ip_str, AF_INET6, 0,
 							 (sockaddr*)&addr6, &out_addr_len6))
+#else
+	if (1 == inet_pton(AF_INET6, ip_str, &addr6.sin6_addr))
+#endif
 	{
 		// Copy address from temporary object
 		_family = AF_INET6;
@@ -565,15 +661,20 @@ bool UNetAddr::SetFromString(const char *ip_str, Port port)
 	{
 		// Try to convert from IPv4 address if that failed
 		sockaddr_in addr4;
+
+#if defined(CAT_OS_WINDOWS)
 		int out_addr_len4 = sizeof(addr4);
 
 		if (!WSAStringToAddressA((char*)ip_str, AF_INET, 0,
 								 (sockaddr*)&addr4, &out_addr_len4))
+#else
+		if (1 == inet_pton(AF_INET, ip_str, &addr4.sin_addr))
+#endif
 		{
 			// Copy address from temporary object
 			_family = AF_INET;
 			_port = port;
-			_ip.v4 = addr4.sin_addr.S_un.S_addr;
+			_ip.v4 = addr4.sin_addr.s_addr;
 			return true;
 		}
 		else
@@ -640,12 +741,18 @@ std::string UNetAddr::IPToString() const
 
 		// Allocate space for address string
 		char addr_str6[INET6_ADDRSTRLEN + 32];
+
+#if defined(CAT_OS_WINDOWS)
 		DWORD str_len6 = sizeof(addr_str6);
 
 		// Because inet_ntop() is not supported in Windows XP, only Vista+
 		if (SOCKET_ERROR == WSAAddressToStringA((sockaddr*)&addr6, sizeof(addr6),
 												0, addr_str6, &str_len6))
 			return Sockets::GetLastErrorString();
+#else
+		if (!inet_ntop(AF_INET6, &addr6.sin6_addr, addr_str6, sizeof(addr_str6)))
+			return Sockets::GetLastErrorString();
+#endif
 
 		return addr_str6;
 	}
@@ -655,16 +762,22 @@ std::string UNetAddr::IPToString() const
 		sockaddr_in addr4;
 		CAT_OBJCLR(addr4);
 		addr4.sin_family = _family;
-		addr4.sin_addr.S_un.S_addr = _ip.v4;
+		addr4.sin_addr.s_addr = _ip.v4;
 
 		// Allocate space for address string
 		char addr_str4[INET_ADDRSTRLEN + 32];
+
+#if defined(CAT_OS_WINDOWS)
 		DWORD str_len4 = sizeof(addr_str4);
 
 		// Because inet_ntop() is not supported in Windows XP, only Vista+
 		if (SOCKET_ERROR == WSAAddressToStringA((sockaddr*)&addr4, sizeof(addr4),
 												0, addr_str4, &str_len4))
 			return Sockets::GetLastErrorString();
+#else
+		if (!inet_ntop(AF_INET, &addr4.sin_addr, addr_str4, sizeof(addr_str4)))
+			return Sockets::GetLastErrorString();
+#endif
 
 		return addr_str4;
 	}
@@ -713,7 +826,7 @@ bool UNetAddr::Unwrap(SockAddr &addr, int &addr_len, bool PromoteToIP6) const
 
 			addr4->sin_family = AF_INET;
 			addr4->sin_port = htons(_port);
-			addr4->sin_addr.S_un.S_addr = _ip.v4;
+			addr4->sin_addr.s_addr = _ip.v4;
 			CAT_OBJCLR(addr4->sin_zero);
 
 			addr_len = sizeof(sockaddr_in);
@@ -184,8 +184,7 @@ void Client::OnRecv(ThreadLocalStorage &tls, const BatchSet &buffers)
 					_key_agreement_initiator.KeyEncryption(&key_hash, &_auth_enc, _session_key) &&
 					InitializeTransportSecurity(true, _auth_enc))
 				{
-					_last_recv_tsc = _next_sync_time = _mtu_discovery_time = _clock->msec();
-					_mtu_discovery_attempts = 2;
+					_last_recv_tsc = _next_sync_time = _clock->msec();
 					_sync_attempts = 0;
 
 #if defined(CAT_SPHYNX_ROAMING_IP)
@@ -200,12 +199,17 @@ void Client::OnRecv(ThreadLocalStorage &tls, const BatchSet &buffers)
 					{
 						CAT_WARN("Client") << "Unable to detect MTU: Unable to set DF bit";
 
-						_mtu_discovery_attempts = 0;
+						_mtu_discovery.Disable();
 					}
-					else if (!PostMTUProbe(MAXIMUM_MTU) ||
-							 !PostMTUProbe(MEDIUM_MTU))
+					else
 					{
-						CAT_WARN("Client") << "Unable to detect MTU: First probe post failure";
+						// Search from the initial datagram size up to jumbo frames,
+						// or as large as the receive buffers allow
+						u32 ceiling = MAXIMUM_JUMBO_MTU - _udpip_bytes;
+						if (ceiling > IOTHREADS_BUFFER_READ_BYTES)
+							ceiling = IOTHREADS_BUFFER_READ_BYTES;
+
+						_mtu_discovery.Initialize(_last_recv_tsc, _max_payload_bytes + SPHYNX_OVERHEAD, ceiling);
 					}
 
 					_connected = true;
@@ -339,39 +343,22 @@ void Client::OnTick(ThreadLocalStorage &tls, u32 now)
 				}
 			}
 
-			// If MTU discovery attempts continue,
-			if (_mtu_discovery_attempts > 0)
+			// If an MTU probe is due,
+			bool black_hole;
+			u32 probe_bytes = _mtu_discovery.Tick(now, black_hole);
+
+			if (black_hole)
 			{
-				// If it is time to re-probe the MTU,
-				if ((s32)(now - _mtu_discovery_time) >= MTU_PROBE_INTERVAL)
-				{
-					// If payload bytes already maxed out,
-					if (_max_payload_bytes >= MAXIMUM_MTU - _udpip_bytes - SPHYNX_C2S_OVERHEAD ||
-						_mtu_discovery_attempts <= 0)
-					{
-						// Stop posting probes
-						_mtu_discovery_attempts = 0;
+				_max_payload_bytes = _mtu_discovery.GetPMTU() - SPHYNX_OVERHEAD;
 
-						// On final attempt set DF=0
-						DontFragment(false);
-					}
-					else
-					{
-						if (!PostMTUProbe(MAXIMUM_MTU))
-						{
-							CAT_WARN("Client") << "Unable to detect MTU: Probe post failure";
-						}
-
-						if (_max_payload_bytes < MEDIUM_MTU - _udpip_bytes - SPHYNX_C2S_OVERHEAD &&
-							!PostMTUProbe(MEDIUM_MTU))
-						{
-							CAT_WARN("Client") << "Unable to detect MTU: Probe post failure";
-						}
-
-						_mtu_discovery_time = now;
-						--_mtu_discovery_attempts;
-					}
-				}
+				CAT_WARN("Client") << "MTU black hole detected.  Max payload bytes = " << _max_payload_bytes;
+			}
+
+			if (probe_bytes && !PostMTUProbe(probe_bytes, _mtu_discovery.GetState() == MTUDiscovery::STATE_RESET))
+			{
+				CAT_WARN("Client") << "Unable to detect MTU: Probe post failure";
+
+				_mtu_discovery.OnProbeFailure(now);
 			}
 
 			// Do derived class tick event so any messages posted do not need to wait for the next tick
@@ -704,14 +691,14 @@ void Client::OnInternal(u32 recv_time, BufferStream data, u32 bytes)
 			max_payload_bytes -= 2;
 #endif
 
-			// If new maximum payload is greater than the previous one,
-			if (max_payload_bytes > _max_payload_bytes)
+			// If the probe raised the path MTU,
+			if (_mtu_discovery.OnProbeReport(recv_time, max_payload_bytes + SPHYNX_OVERHEAD))
 			{
 				// Set max payload bytes
-				_max_payload_bytes = max_payload_bytes;
-			}
+				_max_payload_bytes = _mtu_discovery.GetPMTU() - SPHYNX_OVERHEAD;
 
-			CAT_WARN("Client") << "Got IOP_S2C_MTU_SET.  Max payload bytes = " << max_payload_bytes;
+				CAT_INFO("Client") << "Path MTU increased.  Max payload bytes = " << _max_payload_bytes;
+			}
 		}
 		break;
 
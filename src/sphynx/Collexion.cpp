@@ -27,6 +27,7 @@
 */
 
 #include <cat/sphynx/Collexion.hpp>
+#include <cat/sphynx/Connexion.hpp>
 using namespace cat;
 using namespace sphynx;
 
@@ -39,3 +40,51 @@ void BinnedConnexionSubset::Insert(Connexion *conn)
 
 	_count++;
 }
+
+
+//// ConnexionSnapshot
+
+ConnexionSnapshot *ConnexionSnapshot::Acquire(u32 version, int max_count, int worker_count)
+{
+	if (max_count < 0 || worker_count <= 0) return 0;
+
+	// Members first to keep them pointer-aligned, then the bin offsets
+	u32 member_bytes = (u32)max_count * sizeof(Connexion*);
+	u32 offset_bytes = (u32)(worker_count + 1) * sizeof(int);
+
+	ConnexionSnapshot *snapshot = StdAllocator::ref()->AcquireTrailing<ConnexionSnapshot>(member_bytes + offset_bytes);
+	if (!snapshot) return 0;
+
+	snapshot->_version = version;
+	snapshot->_count = 0;
+	snapshot->_worker_count = worker_count;
+	snapshot->_members = reinterpret_cast<Connexion**>( snapshot + 1 );
+	snapshot->_offsets = reinterpret_cast<int*>( (u8*)snapshot->_members + member_bytes );
+
+	CAT_CLR(snapshot->_offsets, offset_bytes);
+
+	return snapshot;
+}
+
+void ConnexionSnapshot::Release(void *snapshot)
+{
+	StdAllocator::ref()->Release(snapshot);
+}
+
+void ConnexionSnapshot::FinishCount()
+{
+	// Convert bin sizes into bin start offsets
+	for (int ii = 1; ii <= _worker_count; ++ii)
+		_offsets[ii] += _offsets[ii - 1];
+
+	_count = _offsets[_worker_count];
+}
+
+void ConnexionSnapshot::FinishPlace()
+{
+	// Placing advanced each start offset to the start of the next bin, so shift them back
+	for (int ii = _worker_count; ii > 0; --ii)
+		_offsets[ii] = _offsets[ii - 1];
+
+	_offsets[0] = 0;
+}
@@ -229,6 +229,7 @@ void Connexion::OnTick(ThreadLocalStorage &tls, u32 now)
 
 Connexion::Connexion()
 {
+	_parent = 0;
 	_my_id = ConnexionMap::INVALID_KEY;
 	_seen_encrypted = false;
 
@@ -289,17 +290,18 @@ void Connexion::OnInternal(u32 recv_time, BufferStream data, u32 bytes)
 			bytes += 2;
 #endif
 
-			// If new maximum payload is greater than the previous one,
-			if (bytes > _max_payload_bytes)
-			{
-				// Set max payload bytes
+			// Any probe that arrives gets through, so raise to its size.
+			// Only lower on a reset probe, which follows the client down after
+			// it detects a black hole; a late or reordered search probe that
+			// is smaller than the current size must not shrink it
+			if (bytes > _max_payload_bytes || (data[0] & IOP_C2S_MTU_PROBE_RESET))
 				_max_payload_bytes = bytes;
 
-				u16 mtu = getLE((u16)bytes);
-				WriteReliable(STREAM_UNORDERED, IOP_S2C_MTU_SET, &mtu, 2, SOP_INTERNAL);
-			}
+			// Report every probe, so the client can confirm its current size
+			u16 mtu = getLE((u16)bytes);
+			WriteReliable(STREAM_UNORDERED, IOP_S2C_MTU_SET, &mtu, 2, SOP_INTERNAL);
 
-			CAT_WARN("Connexion") << "Got IOP_C2S_MTU_PROBE.  Max payload bytes = " << bytes;
+			CAT_INANE("Connexion") << "Got IOP_C2S_MTU_PROBE of " << bytes << " bytes.  Max payload bytes = " << _max_payload_bytes;
 		}
 		break;
 
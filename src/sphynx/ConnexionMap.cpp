@@ -29,6 +29,8 @@
 #include <cat/sphynx/ConnexionMap.hpp>
 #include <cat/hash/Murmur.hpp>
 #include <cat/io/Log.hpp>
+#include <cat/math/BitMath.hpp>
+#include <vector>
 using namespace cat;
 using namespace sphynx;
 
@@ -98,15 +100,39 @@ static CAT_INLINE u32 map_hash_addr(const NetAddr &addr, u32 ip_salt, u32 port_s
 
 //// ConnexionMap
 
+// Marks a removed address slot so that probes continue past it
+static Connexion * const TOMBSTONE = reinterpret_cast<Connexion*>( 1 );
+
+ConnexionMap::Table *ConnexionMap::AcquireTable(u32 size)
+{
+	Table *table;
+	do table = reinterpret_cast<Table*>( new (std::nothrow) u8[sizeof(Table) + sizeof(Connexion*) * size] );
+	while (!table);
+
+	table->mask = size - 1;
+	table->used = 0;
+	memset((void*)table->GetSlots(), 0, sizeof(Connexion*) * size);
+
+	return table;
+}
+
+void ConnexionMap::ReleaseTable(void *table)
+{
+	delete []reinterpret_cast<u8*>( table );
+}
+
+void ConnexionMap::ReleaseConnexion(void *conn)
+{
+	static_cast<Connexion*>( conn )->ReleaseRef(CAT_REFOBJECT_TRACE);
+}
+
 ConnexionMap::ConnexionMap()
 {
-#if defined(CAT_SPHYNX_ROAMING_IP)
-	_conn_table = 0;
-	_free_table = 0;
-	_first_free = ConnexionMap::INVALID_KEY;
-	_map_alloc = 0;
-#else
-	CAT_OBJCLR(_map_table);
+	_id_table = 0;
+	_free_ids = 0;
+	_first_free = INVALID_KEY;
+#if !defined(CAT_SPHYNX_ROAMING_IP)
+	_addr_table = 0;
 #endif
 	CAT_OBJCLR(_flood_table);
 	_is_shutdown = false;
@@ -115,19 +141,28 @@ ConnexionMap::ConnexionMap()
 
 ConnexionMap::~ConnexionMap()
 {
-#if defined(CAT_SPHYNX_ROAMING_IP)
-	if (_conn_table)
+	// Release retired tables before the live ones
+	_reclaim.Synchronize();
+
+	if (_id_table)
 	{
-		delete []_conn_table;
-		_conn_table = 0;
+		ReleaseTable(_id_table);
+		_id_table = 0;
 	}
 
-	if (_free_table)
+#if !defined(CAT_SPHYNX_ROAMING_IP)
+	if (_addr_table)
 	{
-		delete []_free_table;
-		_free_table = 0;
+		ReleaseTable(_addr_table);
+		_addr_table = 0;
 	}
 #endif
+
+	if (_free_ids)
+	{
+		delete []_free_ids;
+		_free_ids = 0;
+	}
 }
 
 void ConnexionMap::Initialize(FortunaOutput *csprng)
@@ -139,6 +174,53 @@ void ConnexionMap::Initialize(FortunaOutput *csprng)
 	_flood_salt = csprng->Generate();
 }
 
+bool ConnexionMap::AllocateID(u32 &id)
+{
+	// If no free ids,
+	if (_first_free == INVALID_KEY)
+	{
+		Table *old_table = _id_table;
+		u32 old_size = old_table ? old_table->mask + 1 : 0;
+
+		// If out of room,
+		if (old_size >= MAX_POPULATION)
+			return false;
+
+		// Expand!
+		u32 new_size = old_size ? old_size * 2 : MAP_PREALLOC;
+
+		Table *new_table = AcquireTable(new_size);
+
+		u32 *free_ids;
+		do free_ids = new (std::nothrow) u32[new_size];
+		while (!free_ids);
+
+		// Copy old data over
+		if (old_table) memcpy((void*)new_table->GetSlots(), (const void*)old_table->GetSlots(), sizeof(Connexion*) * old_size);
+
+		// Initialize free list, leaving out any ids past the population limit
+		u32 id_limit = (new_size < MAX_POPULATION) ? new_size : MAX_POPULATION;
+		for (u32 ii = old_size; ii < id_limit - 1; ++ii)
+			free_ids[ii] = ii + 1;
+		free_ids[id_limit - 1] = INVALID_KEY;
+
+		if (_free_ids) delete []_free_ids;
+		_free_ids = free_ids;
+		_first_free = old_size;
+
+		// Publish the new table, and free the old one after readers move on
+		Atomic::StoreMemoryBarrier();
+		_id_table = new_table;
+
+		if (old_table) _reclaim.Retire(old_table, &ConnexionMap::ReleaseTable);
+	}
+
+	id = _first_free;
+	_first_free = _free_ids[id];
+
+	return true;
+}
+
 #if defined(CAT_SPHYNX_ROAMING_IP)
 
 bool ConnexionMap::LookupCheckFlood(Connexion * &connexion, const NetAddr &addr, u16 id)
@@ -149,7 +231,7 @@ bool ConnexionMap::LookupCheckFlood(Connexion * &connexion, const NetAddr &addr,
 	if (!connexion)
 	{
 		// Do flood key computation only if address is not in the address map table
-		u32 flood_key = flood_hash_addr(addr, _flood_salt) & HASH_TABLE_MASK;
+		u32 flood_key = flood_hash_addr(addr, _flood_salt) & FLOOD_TABLE_MASK;
 
 		// If flood threshold breached,
 		return (_flood_table[flood_key] >= CONNECTION_FLOOD_THRESHOLD);
@@ -160,12 +242,48 @@ bool ConnexionMap::LookupCheckFlood(Connexion * &connexion, const NetAddr &addr,
 
 #else
 
+void ConnexionMap::RebuildAddressTable(u32 size)
+{
+	Table *old_table = _addr_table;
+	Table *new_table = AcquireTable(size);
+
+	Connexion * volatile *new_slots = new_table->GetSlots();
+	u32 new_mask = new_table->mask;
+
+	// If there is an old table,
+	if (old_table)
+	{
+		Connexion * volatile *old_slots = old_table->GetSlots();
+
+		// Reinsert each connexion, dropping the tombstones
+		for (u32 ii = 0, old_size = old_table->mask + 1; ii < old_size; ++ii)
+		{
+			Connexion *conn = old_slots[ii];
+			if (!conn || conn == TOMBSTONE) continue;
+
+			u32 key = map_hash_addr(conn->_client_addr, _ip_salt, _port_salt) & new_mask;
+
+			while (new_slots[key])
+				key = (key * COLLISION_MULTIPLIER + COLLISION_INCREMENTER) & new_mask;
+
+			new_slots[key] = conn;
+			new_table->used++;
+		}
+	}
+
+	// Publish the new table, and free the old one after readers move on
+	Atomic::StoreMemoryBarrier();
+	_addr_table = new_table;
+
+	if (old_table) _reclaim.Retire(old_table, &ConnexionMap::ReleaseTable);
+}
+
 bool ConnexionMap::LookupCheckFlood(Connexion * &connexion, const NetAddr &addr)
 {
 	// Hash IP:port:salt to get the hash table key
-	u32 key = map_hash_addr(addr, _ip_salt, _port_salt) & HASH_TABLE_MASK;
+	u32 hash = map_hash_addr(addr, _ip_salt, _port_salt);
 
-	AutoReadLock lock(_table_lock);
+	AutoEpochRead reader(_reclaim);
 
 	if (IsShutdown())
 	{
@@ -173,41 +291,34 @@ bool ConnexionMap::LookupCheckFlood(Connexion * &connexion, const NetAddr &addr)
 		return false;
 	}
 
-	CAT_FOREVER
-	{
-		// Grab the slot
-		Slot *slot = &_map_table[key];
+	Table *table = _addr_table;
 
-		Connexion *conn = slot->conn;
+	if (table)
+	{
+		Connexion * volatile *slots = table->GetSlots();
+		u32 mask = table->mask;
 
-		// If the slot is used and the user address matches,
-		if (conn && conn->_client_addr == addr)
+		// Walk the collision list until an empty slot is found
+		for (u32 key = hash & mask;; key = (key * COLLISION_MULTIPLIER + COLLISION_INCREMENTER) & mask)
 		{
-			conn->AddRef(CAT_REFOBJECT_TRACE);
+			Connexion *conn = slots[key];
 
-			connexion = conn;
-			return false;
-		}
-		else
-		{
-			// If the slot indicates a collision,
-			if (slot->collision)
-			{
-				// Calculate next collision key
-				key = (key * COLLISION_MULTIPLIER + COLLISION_INCREMENTER) & HASH_TABLE_MASK;
+			// Reached end of collision list, so the address was not found in the table
+			if (!conn) break;
 
-				// Loop around and process the next slot in the collision list
-			}
-			else
+			// If the slot is used and the user address matches,
+			if (conn != TOMBSTONE && conn->_client_addr == addr)
 			{
-				// Reached end of collision list, so the address was not found in the table
-				break;
+				conn->AddRef(CAT_REFOBJECT_TRACE);
+
+				connexion = conn;
+				return false;
 			}
 		}
 	}
 
 	// Do flood key computation only if address is not in the address map table
-	u32 flood_key = flood_hash_addr(addr, _flood_salt) & HASH_TABLE_MASK;
+	u32 flood_key = flood_hash_addr(addr, _flood_salt) & FLOOD_TABLE_MASK;
 
 	connexion = 0;
 	return (_flood_table[flood_key] >= CONNECTION_FLOOD_THRESHOLD);
@@ -217,22 +328,14 @@ bool ConnexionMap::LookupCheckFlood(Connexion * &connexion, const NetAddr &addr)
 
 Connexion *ConnexionMap::Lookup(u32 key)
 {
-#if defined(CAT_SPHYNX_ROAMING_IP)
-	if (key >= _map_alloc) return 0;
-#else
-	if (key >= HASH_TABLE_SIZE) return 0;
-#endif
+	AutoEpochRead reader(_reclaim);
 
-	AutoReadLock lock(_table_lock);
+	Table *table = _id_table;
 
-	if (IsShutdown())
+	if (IsShutdown() || !table || key > table->mask)
 		return 0;
 
-#if defined(CAT_SPHYNX_ROAMING_IP)
-	Connexion *conn = _conn_table[key];
-#else
-	Connexion *conn = _map_table[key].conn;
-#endif
+	Connexion *conn = table->GetSlots()[key];
 
 	if (conn)
 	{
@@ -245,19 +348,15 @@ Connexion *ConnexionMap::Lookup(u32 key)
 
 SphynxError ConnexionMap::Insert(Connexion *conn)
 {
+	u32 flood_key = flood_hash_addr(conn->_client_addr, _flood_salt) & FLOOD_TABLE_MASK;
 #if !defined(CAT_SPHYNX_ROAMING_IP)
-
-	// Hash IP:port:salt to get the hash table key
-	u32 key = map_hash_addr(conn->_client_addr, _ip_salt, _port_salt) & HASH_TABLE_MASK;
-	u32 flood_key = flood_hash_addr(conn->_client_addr, _flood_salt) & HASH_TABLE_MASK;
-
-	// Grab the slot
-	Slot *slot = &_map_table[key];
+	u32 hash = map_hash_addr(conn->_client_addr, _ip_salt, _port_salt);
+#endif
 
 	// Add a reference to the Connexion
 	conn->AddRef(CAT_REFOBJECT_TRACE);
 
-	AutoWriteLock lock(_table_lock);
+	AutoMutex lock(_write_lock);
 
 	if (IsShutdown())
 	{
@@ -266,54 +365,7 @@ SphynxError ConnexionMap::Insert(Connexion *conn)
 		return ERR_SHUTDOWN;
 	}
 
-	// While collision keys are marked used,
-	while (slot->conn)
-	{
-		// If client is already connected,
-		if (slot->conn->_client_addr == conn->_client_addr)
-		{
-			lock.Release();
-			conn->ReleaseRef(CAT_REFOBJECT_TRACE);
-			return ERR_ALREADY_CONN;
-		}
-
-		// Set flag for collision
-		slot->collision = true;
-
-		// Iterate to next collision key
-		key = (key * COLLISION_MULTIPLIER + COLLISION_INCREMENTER) & HASH_TABLE_MASK;
-		slot = &_map_table[key];
-
-		// NOTE: This will loop forever if every table key is marked used
-	}
-
-	_count++;
-
-	_flood_table[flood_key]++;
-
-	// Mark used
-	slot->conn = conn;
-	conn->_my_id = key;
-	conn->_flood_key = flood_key;
-
-	lock.Release();
-
-#else // Roaming IP version:
-
-	// Hash IP:port:salt to get the hash table key
-	u32 flood_key = flood_hash_addr(conn->_client_addr, _flood_salt) & HASH_TABLE_MASK;
-
-	// Add a reference to the Connexion
-	conn->AddRef(CAT_REFOBJECT_TRACE);
-
-	AutoWriteLock lock(_table_lock);
-
-	if (IsShutdown())
-	{
-		lock.Release();
-		conn->ReleaseRef(CAT_REFOBJECT_TRACE);
-		return ERR_SHUTDOWN;
-	}
+#if defined(CAT_SPHYNX_ROAMING_IP)
 
 	// If flood count is above threshold,
 	if (_flood_table[flood_key] > CONNECTION_FLOOD_THRESHOLD)
@@ -324,65 +376,51 @@ SphynxError ConnexionMap::Insert(Connexion *conn)
 		return ERR_FLOOD;
 	}
 
-	// If no free slots,
-	u16 slot_id = _first_free;
-	if (slot_id == ConnexionMap::INVALID_KEY)
+#else // IP-based version:
+
+	// If the address table would be more than half full of connexions and tombstones,
+	Table *table = _addr_table;
+	if (!table || (table->used + 1) * 2 > table->mask + 1)
+	{
+		// Rebuild it with room for the population to double
+		u32 size = NextHighestPow2((_count + 1) * 2);
+		if (size < MAP_PREALLOC) size = MAP_PREALLOC;
+
+		RebuildAddressTable(size);
+		table = _addr_table;
+	}
+
+	Connexion * volatile *slots = table->GetSlots();
+	u32 mask = table->mask, key = hash & mask, tomb_key = INVALID_KEY;
+
+	// While collision keys are marked used,
+	for (Connexion *slot_conn; (slot_conn = slots[key]); key = (key * COLLISION_MULTIPLIER + COLLISION_INCREMENTER) & mask)
 	{
-		// If out of room,
-		if (_map_alloc >= MAX_POPULATION)
+		// If this is the first tombstone, remember it for reuse
+		if (slot_conn == TOMBSTONE)
+		{
+			if (tomb_key == INVALID_KEY) tomb_key = key;
+		}
+		else if (slot_conn->_client_addr == conn->_client_addr)
 		{
+			// Client is already connected
 			lock.Release();
-			CAT_INFO("ConnexionMap") << "Cannot accept new connexion from " << conn->GetAddress().IPToString() << " : " << conn->GetAddress().GetPort();
 			conn->ReleaseRef(CAT_REFOBJECT_TRACE);
-			return ERR_SERVER_FULL;
+			return ERR_ALREADY_CONN;
 		}
-
-		// Expand!
-
-		u32 old_alloc = _map_alloc;
-		u32 new_alloc = old_alloc * 2;
-		if (new_alloc > MAX_POPULATION) new_alloc = MAX_POPULATION;
-		else if (new_alloc < MAP_PREALLOC) new_alloc = MAP_PREALLOC;
-
-		// Allocate tables
-		Connexion **conn_table;
-		do conn_table = new (std::nothrow) Connexion*[new_alloc];
-		while (!conn_table);
-
-		u16 *free_table;
-		do free_table = new (std::nothrow) u16[new_alloc];
-		while (!free_table);
-
-		// Copy old data over
-		if (_conn_table) memcpy(conn_table, _conn_table, sizeof(Connexion*) * old_alloc);
-
-		// Clear the new connexion pointers
-		memset(conn_table + old_alloc, 0, sizeof(Connexion*) * (new_alloc - old_alloc));
-
-		// Release old tables
-		delete []_conn_table;
-		delete []_free_table;
-
-		// Replace old table
-		_map_alloc = new_alloc;
-		_conn_table = conn_table;
-		_free_table = free_table;
-
-		// Initialize free list
-		_first_free = old_alloc;
-		for (u32 ii = old_alloc; ii < new_alloc - 1; ++ii)
-			_free_table[ii] = (u16)(ii + 1);
-		_free_table[new_alloc - 1] = ConnexionMap::INVALID_KEY;
-
-		// Use the first free slot for the new slot
-		slot_id = old_alloc;
 	}
 
-	// Set connexion pointer for the slot
-	_conn_table[slot_id] = conn;
+#endif // CAT_SPHYNX_ROAMING_IP
 
-	// Advance first free index
-	_first_free = _free_table[slot_id];
+	// If out of room,
+	u32 id;
+	if (!AllocateID(id))
+	{
+		lock.Release();
+		CAT_INFO("ConnexionMap") << "Cannot accept new connexion from " << conn->GetAddress().IPToString() << " : " << conn->GetAddress().GetPort();
+		conn->ReleaseRef(CAT_REFOBJECT_TRACE);
+		return ERR_SERVER_FULL;
+	}
 
 	// Increment population count
 	_count++;
@@ -390,14 +428,29 @@ SphynxError ConnexionMap::Insert(Connexion *conn)
 	// Increment flood count
 	_flood_table[flood_key]++;
 
-	// Set map properties in connexion object
-	conn->_my_id = slot_id;
+	// Set map properties in connexion object before readers can see it
+	conn->_my_id = id;
 	conn->_flood_key = flood_key;
 
-	lock.Release();
+	Atomic::StoreMemoryBarrier();
 
+	_id_table->GetSlots()[id] = conn;
+
+#if !defined(CAT_SPHYNX_ROAMING_IP)
+	// Reuse the first tombstone on the collision list, or else take the empty slot at the end
+	if (tomb_key != INVALID_KEY)
+		key = tomb_key;
+	else
+		table->used++;
+
+	slots[key] = conn;
 #endif // CAT_SPHYNX_ROAMING_IP
 
+	lock.Release();
+
+	// Release any connexions and tables that readers have moved past
+	_reclaim.Reclaim();
+
 	CAT_INFO("ConnexionMap") << "Inserted connexion from " << conn->GetAddress().IPToString() << " : " << conn->GetAddress().GetPort() << " id=" << conn->GetMyID();
 
 	// Keeps reference held
@@ -408,56 +461,69 @@ void ConnexionMap::Remove(Connexion *conn)
 {
 	if (!conn) return;
 
-	u32 key = conn->GetMyID();
+	u32 id = conn->GetMyID();
 
 	// If key is invalid,
-	if (key >= HASH_TABLE_SIZE) return;
+	if (id == INVALID_KEY) return;
 
-	CAT_INFO("ConnexionMap") << "Removing connexion from " << conn->GetAddress().IPToString() << " : " << conn->GetAddress().GetPort() << " id=" << conn->GetMyID();
+	CAT_INFO("ConnexionMap") << "Removing connexion from " << conn->GetAddress().IPToString() << " : " << conn->GetAddress().GetPort() << " id=" << id;
 
-	u32 flood_key = conn->_flood_key;
+#if !defined(CAT_SPHYNX_ROAMING_IP)
+	u32 hash = map_hash_addr(conn->_client_addr, _ip_salt, _port_salt);
+#endif
 
-	AutoWriteLock lock(_table_lock);
+	AutoMutex lock(_write_lock);
 
-#if !defined(CAT_SPHYNX_ROAMING_IP)
+	// If the connexion is not in the table,
+	Table *id_table = _id_table;
+	if (!id_table || id > id_table->mask || id_table->GetSlots()[id] != conn)
+		return;
 
-	// Remove connexion
-	_map_table[key].conn = 0;
+	// Remove connexion and free its id
+	id_table->GetSlots()[id] = 0;
+	_free_ids[id] = _first_free;
+	_first_free = id;
 
-	// If at a leaf in the collision list,
-	if (!_map_table[key].collision)
-	{
-		// Unset collision flags until first filled entry is found
-		do 
-		{
-			// Roll backwards
-			key = ((key + COLLISION_INCRINVERSE) * COLLISION_MULTINVERSE) & HASH_TABLE_MASK;
+#if !defined(CAT_SPHYNX_ROAMING_IP)
 
-			// If collision list is done,
-			if (!_map_table[key].collision)
-				break;
+	Table *table = _addr_table;
+	Connexion * volatile *slots = table->GetSlots();
+	u32 mask = table->mask, key = hash & mask;
 
-			// Remove collision flag
-			_map_table[key].collision = false;
+	// Find the connexion on its collision list
+	while (slots[key] != conn)
+		key = (key * COLLISION_MULTIPLIER + COLLISION_INCREMENTER) & mask;
 
-		} while (!_map_table[key].conn);
+	// If the collision list continues past this slot,
+	if (slots[(key * COLLISION_MULTIPLIER + COLLISION_INCREMENTER) & mask])
+	{
+		// Leave a tombstone so that probes continue past it
+		slots[key] = TOMBSTONE;
 	}
+	else
+	{
+		// At a leaf in the collision list: Clear tombstones until first filled entry is found
+		do
+		{
+			slots[key] = 0;
+			table->used--;
 
-#else
+			// Roll backwards
+			key = ((key + COLLISION_INCRINVERSE) * COLLISION_MULTINVERSE) & mask;
 
-	_conn_table[key] = 0;
-	_free_table[key] = _first_free;
-	_first_free = key;
+		} while (slots[key] == TOMBSTONE);
+	}
 
 #endif // CAT_SPHYNX_ROAMING_IP
 
 	_count--;
-	_flood_table[flood_key]--;
+	_flood_table[conn->_flood_key]--;
 
 	lock.Release();
 
-	// Finally release reference so that it can die
-	conn->ReleaseRef(CAT_REFOBJECT_TRACE);
+	// Finally release reference so that it can die, once no reader can still see it
+	_reclaim.Retire(conn, &ConnexionMap::ReleaseConnexion);
+	_reclaim.Reclaim();
 }
 
 void ConnexionMap::ShutdownAll()
@@ -466,50 +532,29 @@ void ConnexionMap::ShutdownAll()
 
 	std::vector<Connexion*> connexions;
 
-	AutoWriteLock lock(_table_lock);
+	AutoMutex lock(_write_lock);
 
 	_is_shutdown = true;
 
-#if !defined(CAT_SPHYNX_ROAMING_IP)
-
-	// For each hash table bin,
-	for (int key = 0; key < HASH_TABLE_SIZE; ++key)
-	{
-		Connexion *conn = _map_table[key].conn;
-
-		// If table entry is populated,
-		if (conn)
-		{
-			conn->AddRef(CAT_REFOBJECT_TRACE);
-			connexions.push_back(conn);
-
-			_map_table[key].conn = 0;
-		}
-
-		_map_table[key].collision = false;
-	}
-
-#else
-
-	// For each bin,
-	for (u32 key = 0; key < _map_alloc; ++key)
+	// For each id table entry,
+	Table *table = _id_table;
+	if (table)
 	{
-		Connexion *conn = _conn_table[key];
+		Connexion * volatile *slots = table->GetSlots();
 
-		// If table entry is populated,
-		if (conn)
+		for (u32 key = 0, size = table->mask + 1; key < size; ++key)
 		{
-			conn->AddRef(CAT_REFOBJECT_TRACE);
-			connexions.push_back(conn);
+			Connexion *conn = slots[key];
 
-			_conn_table[key] = 0;
+			// If table entry is populated,
+			if (conn)
+			{
+				conn->AddRef(CAT_REFOBJECT_TRACE);
+				connexions.push_back(conn);
+			}
 		}
 	}
 
-#endif // CAT_SPHYNX_ROAMING_IP
-
-	_count = 0;
-
 	lock.Release();
 
 	// For each Connexion object to release,
@@ -517,7 +562,12 @@ void ConnexionMap::ShutdownAll()
 	{
 		Connexion *conn = connexions[ii];
 
+		// Destroy() invokes Remove(), which releases the reference held by the map
 		conn->Destroy(CAT_REFOBJECT_TRACE);
 		conn->ReleaseRef(CAT_REFOBJECT_TRACE);
 	}
+
+	// Wait out routing lookups still in flight so that every removed
+	// connexion drops the map's reference now instead of on a later tick
+	_reclaim.Synchronize();
 }
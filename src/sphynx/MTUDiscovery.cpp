@@ -0,0 +1,256 @@
+/*
+	Copyright (c) 2012 Christopher A. Taylor.  All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	* Redistributions of source code must retain the above copyright notice,
+	  this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	* Neither the name of LibCat nor the names of its contributors may be used
+	  to endorse or promote products derived from this software without
+	  specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <cat/sphynx/MTUDiscovery.hpp>
+using namespace cat;
+using namespace sphynx;
+
+
+//// MTUDiscovery
+
+MTUDiscovery::MTUDiscovery()
+{
+	_state = STATE_DISABLED;
+	_base = _ceiling = _low = _high = 0;
+	_probe_bytes = 0;
+	_black_hole_count = 0;
+}
+
+void MTUDiscovery::Initialize(u32 now, u32 base_bytes, u32 ceiling_bytes)
+{
+	_base = base_bytes;
+	_ceiling = ceiling_bytes < base_bytes ? base_bytes : ceiling_bytes;
+	_low = base_bytes;
+	_search_time = now;
+	_black_hole_count = 0;
+
+	StartSearch(_ceiling);
+}
+
+void MTUDiscovery::Disable()
+{
+	_state = STATE_DISABLED;
+	_low = _base;
+	_probe_bytes = 0;
+}
+
+void MTUDiscovery::StartSearch(u32 high)
+{
+	_state = STATE_SEARCH;
+	_high = high;
+	_probe_bytes = 0;
+	_try_ceiling = (high == _ceiling);
+}
+
+void MTUDiscovery::FinishSearch(u32 now)
+{
+	_state = STATE_COMPLETE;
+	_search_time = now;
+	_next_time = now + MTU_PROBE_INTERVAL;
+}
+
+u32 MTUDiscovery::NextSearchProbe()
+{
+	// If the range is narrow enough, the search is done
+	if (_high < _low + SEARCH_RESOLUTION)
+		return 0;
+
+	// Most paths carry the ceiling, so try it before bisecting
+	if (_try_ceiling)
+	{
+		_try_ceiling = false;
+		return _high;
+	}
+
+	return (_low + _high + 1) / 2;
+}
+
+void MTUDiscovery::OnProbeLost(bool &black_hole)
+{
+	u32 lost_bytes = _probe_bytes;
+	_probe_bytes = 0;
+
+	switch (_state)
+	{
+	case STATE_SEARCH:
+		// Too large: Search below it
+		_high = lost_bytes - 1;
+		break;
+
+	case STATE_CONFIRM:
+		// The current size stopped getting through
+		++_black_hole_count;
+		black_hole = true;
+
+		_low = _base;
+		_high = lost_bytes - 1;
+		_state = STATE_RESET;
+		break;
+
+	default:
+		break;
+	}
+}
+
+u32 MTUDiscovery::Tick(u32 now, bool &black_hole)
+{
+	black_hole = false;
+
+	switch (_state)
+	{
+	case STATE_DISABLED:
+		return 0;
+
+	case STATE_COMPLETE:
+		if ((s32)(now - _next_time) < 0)
+			return 0;
+
+		// If there is something above the base to confirm,
+		if (_low > _base)
+		{
+			_state = STATE_CONFIRM;
+			_probe_bytes = _low;
+			_probe_tries = 1;
+			_probe_time = now;
+			return _probe_bytes;
+		}
+
+		// If it is time to look for a larger size,
+		if ((s32)(now - _search_time) >= (s32)RAISE_INTERVAL && _low < _ceiling)
+			StartSearch(_ceiling);
+		else
+		{
+			_next_time = now + MTU_PROBE_INTERVAL;
+			return 0;
+		}
+		break;
+
+	default:
+		break;
+	}
+
+	// If a probe is in flight,
+	if (_probe_bytes)
+	{
+		// If it may still be reported, wait for it
+		if ((s32)(now - _probe_time) < (s32)PROBE_TIMEOUT)
+			return 0;
+
+		u32 max_tries = (_state == STATE_CONFIRM) ? CONFIRM_TRIES : PROBE_TRIES;
+
+		// If it has more tries left or is the base size that always gets through,
+		if (_probe_tries < max_tries || _state == STATE_RESET)
+		{
+			++_probe_tries;
+			_probe_time = now;
+			return _probe_bytes;
+		}
+
+		OnProbeLost(black_hole);
+	}
+
+	if (_state == STATE_RESET)
+	{
+		_probe_bytes = _base;
+	}
+	else
+	{
+		_probe_bytes = NextSearchProbe();
+
+		// If the search has converged,
+		if (!_probe_bytes)
+		{
+			FinishSearch(now);
+			return 0;
+		}
+	}
+
+	_probe_tries = 1;
+	_probe_time = now;
+	return _probe_bytes;
+}
+
+bool MTUDiscovery::OnProbeReport(u32 now, u32 bytes)
+{
+	if (_state == STATE_DISABLED || bytes > _ceiling)
+		return false;
+
+	// While falling back, only the base size report counts
+	if (_state == STATE_RESET && bytes != _base)
+		return false;
+
+	bool increased = false;
+
+	// Any size that was reported gets through, even a late report
+	if (bytes > _low)
+	{
+		_low = bytes;
+		if (_high < _low) _high = _low;
+		increased = true;
+	}
+
+	// If it does not answer the probe in flight, done
+	if (!_probe_bytes || bytes < _probe_bytes)
+		return increased;
+
+	_probe_bytes = 0;
+
+	switch (_state)
+	{
+	case STATE_RESET:
+		// The peer has fallen back too: Search below the black hole
+		StartSearch(_high);
+		break;
+
+	case STATE_CONFIRM:
+		// If it is time to look for a larger size,
+		if ((s32)(now - _search_time) >= (s32)RAISE_INTERVAL && _low < _ceiling)
+			StartSearch(_ceiling);
+		else
+		{
+			_state = STATE_COMPLETE;
+			_next_time = now + MTU_PROBE_INTERVAL;
+		}
+		break;
+
+	default:
+		break;
+	}
+
+	return increased;
+}
+
+void MTUDiscovery::OnProbeFailure(u32 now)
+{
+	// If a search probe is in flight, skip its remaining tries
+	if (_probe_bytes && _state == STATE_SEARCH)
+	{
+		_probe_tries = PROBE_TRIES;
+		_probe_time = now - PROBE_TIMEOUT;
+	}
+}
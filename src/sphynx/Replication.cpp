@@ -0,0 +1,385 @@
+/*
+	Copyright (c) 2012 Christopher A. Taylor.  All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	* Redistributions of source code must retain the above copyright notice,
+	  this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	* Neither the name of LibCat nor the names of its contributors may be used
+	  to endorse or promote products derived from this software without
+	  specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+#include <cat/sphynx/Replication.hpp>
+#include <cat/mem/StdAllocator.hpp>
+using namespace cat;
+using namespace sphynx;
+
+
+//// Run encoding
+
+static CAT_INLINE u8 *WriteVarInt(u8 *out, u32 x)
+{
+	while (x >= 0x80)
+	{
+		*out++ = (u8)x | 0x80;
+		x >>= 7;
+	}
+	*out++ = (u8)x;
+	return out;
+}
+
+static CAT_INLINE bool ReadVarInt(const u8 *&in, const u8 *end, u32 &x)
+{
+	x = 0;
+	for (u32 shift = 0; shift < 35; shift += 7)
+	{
+		if (in >= end) return false;
+
+		u8 b = *in++;
+		x |= (u32)(b & 0x7f) << shift;
+
+		if (!(b & 0x80)) return true;
+	}
+	return false;
+}
+
+static CAT_INLINE u8 Diff(const u8 *state, const u8 *base, u32 base_bytes, u32 ii)
+{
+	return state[ii] ^ (ii < base_bytes ? base[ii] : 0);
+}
+
+static bool ResizeBaseline(u8 *&data, u32 &allocated, u32 bytes)
+{
+	if (bytes <= allocated) return true;
+
+	u8 *new_data = reinterpret_cast<u8*>( StdAllocator::ref()->Resize(data, bytes) );
+	if (!new_data) return false;
+
+	data = new_data;
+	allocated = bytes;
+	return true;
+}
+
+
+//// StateReplicator
+
+StateReplicator::StateReplicator()
+{
+	CAT_OBJCLR(_history);
+
+	_next_seq = 0;
+	_acked_seq = 0;
+	_has_ack = false;
+
+	_workspace = 0;
+	_workspace_bytes = 0;
+
+	_full_count = 0;
+	_delta_count = 0;
+	_state_bytes = 0;
+	_encoded_bytes = 0;
+}
+
+StateReplicator::~StateReplicator()
+{
+	for (u32 ii = 0; ii < HISTORY; ++ii)
+	{
+		if (_history[ii].data)
+			StdAllocator::ref()->Release(_history[ii].data);
+	}
+
+	if (_workspace)
+		StdAllocator::ref()->Release(_workspace);
+}
+
+StateReplicator::Baseline *StateReplicator::GetAckedBaseline()
+{
+	if (!_has_ack) return 0;
+
+	// If the acked state has been overwritten by newer ones,
+	if ((u16)(_next_seq - _acked_seq) >= HISTORY)
+	{
+		_has_ack = false;
+		return 0;
+	}
+
+	Baseline *base = &_history[_acked_seq & (HISTORY - 1)];
+	if (!base->valid || base->seq != _acked_seq)
+		return 0;
+
+	return base;
+}
+
+u32 StateReplicator::Encode(const void *vstate, u32 state_bytes, u8 *out, u32 out_limit)
+{
+	const u8 *state = reinterpret_cast<const u8*>( vstate );
+
+	if (state_bytes > MAX_STATE_BYTES || out_limit < HEADER_BYTES)
+	{
+		CAT_WARN("StateReplicator") << "Invalid input: State too large or output buffer too small";
+		return 0;
+	}
+
+	// Pick the newest acknowledged state as the baseline, or zeros if none
+	Baseline *base = GetAckedBaseline();
+	const u8 *base_data = base ? base->data : 0;
+	u32 base_bytes = base ? base->bytes : 0;
+	u16 seq = _next_seq;
+
+	// Write header
+	out[0] = (u8)seq;
+	out[1] = (u8)(seq >> 8);
+	out[2] = base ? (u8)(seq - base->seq) : 0;
+	u8 *pos = WriteVarInt(out + 3, state_bytes);
+	u8 *end = out + out_limit;
+
+	// For each run,
+	u32 ii = 0;
+	while (ii < state_bytes)
+	{
+		// Skip bytes that match the baseline
+		u32 zero_start = ii;
+		while (ii < state_bytes && !Diff(state, base_data, base_bytes, ii))
+			++ii;
+		u32 zero_count = ii - zero_start;
+
+		// Extend the literal until a long enough zero run or the end
+		u32 literal_start = ii, literal_end = ii;
+		for (u32 jj = ii; jj < state_bytes; ++jj)
+		{
+			if (Diff(state, base_data, base_bytes, jj))
+				literal_end = jj + 1;
+			else if (jj - literal_end + 1 >= MIN_ZERO_RUN)
+				break;
+		}
+		u32 literal_count = literal_end - literal_start;
+
+		// Worst case for the two varints is 10 bytes
+		if ((u32)(end - pos) < literal_count + 10)
+		{
+			CAT_WARN("StateReplicator") << "Output buffer too small for " << state_bytes << " byte state";
+			return 0;
+		}
+
+		pos = WriteVarInt(pos, zero_count);
+		pos = WriteVarInt(pos, literal_count);
+
+		for (u32 jj = literal_start; jj < literal_end; ++jj)
+			*pos++ = Diff(state, base_data, base_bytes, jj);
+
+		ii = literal_end;
+	}
+
+	// Remember what was sent so it can serve as a baseline once acked
+	Baseline *slot = &_history[seq & (HISTORY - 1)];
+	if (!ResizeBaseline(slot->data, slot->allocated, state_bytes))
+	{
+		CAT_WARN("StateReplicator") << "Out of memory";
+		slot->valid = false;
+		return 0;
+	}
+
+	memcpy(slot->data, state, state_bytes);
+	slot->bytes = state_bytes;
+	slot->seq = seq;
+	slot->valid = true;
+
+	++_next_seq;
+
+	u32 encoded_bytes = (u32)(pos - out);
+
+	if (base) ++_delta_count;
+	else ++_full_count;
+	_state_bytes += state_bytes;
+	_encoded_bytes += encoded_bytes;
+
+	return encoded_bytes;
+}
+
+bool StateReplicator::Write(Transport *transport, u8 msg_opcode, const void *state, u32 state_bytes, StreamMode fallback_stream)
+{
+	u32 max_bytes = MaxEncodedBytes(state_bytes);
+
+	if (!ResizeBaseline(_workspace, _workspace_bytes, max_bytes))
+	{
+		CAT_WARN("StateReplicator") << "Out of memory";
+		return false;
+	}
+
+	u32 bytes = Encode(state, state_bytes, _workspace, _workspace_bytes);
+	if (!bytes) return false;
+
+	// If it fits in a datagram with the message header and opcode,
+	if (bytes + 3 <= transport->GetMaxPayloadBytes())
+		return transport->WriteUnreliable(msg_opcode, _workspace, bytes);
+
+	// Too big to lose, so deliver it reliably and let newer updates overtake it
+	return transport->WriteReliable(fallback_stream, msg_opcode, _workspace, bytes);
+}
+
+bool StateReplicator::OnAck(const u8 *msg, u32 bytes)
+{
+	if (bytes < StateReceiver::ACK_BYTES)
+		return false;
+
+	u16 seq = (u16)msg[0] | ((u16)msg[1] << 8);
+
+	// Ignore acks for states that were never sent
+	u16 age = (u16)(_next_seq - seq);
+	if (age == 0 || age >= HISTORY)
+		return false;
+
+	// Ignore acks older than the current baseline
+	if (_has_ack && (s16)(seq - _acked_seq) <= 0)
+		return true;
+
+	Baseline *base = &_history[seq & (HISTORY - 1)];
+	if (!base->valid || base->seq != seq)
+		return false;
+
+	_acked_seq = seq;
+	_has_ack = true;
+	return true;
+}
+
+void StateReplicator::Reset()
+{
+	_has_ack = false;
+}
+
+
+//// StateReceiver
+
+StateReceiver::StateReceiver()
+{
+	CAT_OBJCLR(_history);
+
+	_latest = 0;
+}
+
+StateReceiver::~StateReceiver()
+{
+	for (u32 ii = 0; ii < HISTORY; ++ii)
+	{
+		if (_history[ii].data)
+			StdAllocator::ref()->Release(_history[ii].data);
+	}
+}
+
+bool StateReceiver::OnUpdate(const u8 *msg, u32 bytes)
+{
+	const u8 *end = msg + bytes;
+
+	if (bytes < 4) return false;
+
+	u16 seq = (u16)msg[0] | ((u16)msg[1] << 8);
+	u32 age = msg[2];
+	const u8 *in = msg + 3;
+
+	u32 state_bytes;
+	if (!ReadVarInt(in, end, state_bytes) || state_bytes > StateReplicator::MAX_STATE_BYTES)
+		return false;
+
+	// Drop updates that arrive after a newer one
+	if (_latest && (s16)(seq - _latest->seq) <= 0)
+		return false;
+
+	// Find the baseline, if it is a delta
+	const u8 *base_data = 0;
+	u32 base_bytes = 0;
+	if (age)
+	{
+		if (age >= HISTORY) return false;
+
+		u16 base_seq = (u16)(seq - age);
+		Baseline *base = &_history[base_seq & (HISTORY - 1)];
+		if (!base->valid || base->seq != base_seq)
+		{
+			CAT_INFO("StateReceiver") << "Baseline " << base_seq << " for update " << seq << " is no longer available";
+			return false;
+		}
+
+		base_data = base->data;
+		base_bytes = base->bytes;
+	}
+
+	// Decode into the slot for this sequence number, which is never the baseline slot
+	Baseline *slot = &_history[seq & (HISTORY - 1)];
+	if (slot == _latest) _latest = 0;
+	slot->valid = false;
+
+	if (!ResizeBaseline(slot->data, slot->allocated, state_bytes))
+	{
+		CAT_WARN("StateReceiver") << "Out of memory";
+		return false;
+	}
+
+	u8 *out = slot->data;
+
+	// For each run,
+	u32 ii = 0;
+	while (ii < state_bytes)
+	{
+		u32 zero_count, literal_count;
+		if (!ReadVarInt(in, end, zero_count) ||
+			!ReadVarInt(in, end, literal_count))
+			return false;
+
+		// Runs must make progress and stay inside the state
+		if (zero_count + literal_count == 0 ||
+			zero_count > state_bytes - ii ||
+			literal_count > state_bytes - ii - zero_count ||
+			literal_count > (u32)(end - in))
+			return false;
+
+		// Copy matching bytes from the baseline
+		for (u32 stop = ii + zero_count; ii < stop; ++ii)
+			out[ii] = ii < base_bytes ? base_data[ii] : 0;
+
+		// Apply changed bytes
+		for (u32 stop = ii + literal_count; ii < stop; ++ii)
+			out[ii] = *in++ ^ (ii < base_bytes ? base_data[ii] : 0);
+	}
+
+	slot->bytes = state_bytes;
+	slot->seq = seq;
+	slot->valid = true;
+	_latest = slot;
+
+	return true;
+}
+
+bool StateReceiver::GetAck(u8 *out)
+{
+	if (!_latest) return false;
+
+	u16 seq = _latest->seq;
+	out[0] = (u8)seq;
+	out[1] = (u8)(seq >> 8);
+	return true;
+}
+
+bool StateReceiver::WriteAck(Transport *transport, u8 msg_opcode)
+{
+	u8 ack[ACK_BYTES];
+
+	if (!GetAck(ack)) return false;
+
+	return transport->WriteUnreliable(msg_opcode, ack, sizeof(ack));
+}
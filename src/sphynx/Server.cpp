@@ -76,7 +76,7 @@ void Server::OnRecvRouting(const BatchSet &buffers)
 
 	RecvBuffer *prev_buffer = 0;
 #if defined(CAT_SPHYNX_ROAMING_IP)
-	u16 prev_buffer_id = ConnexionMap::INVALID_KEY;
+	u32 prev_buffer_id = ConnexionMap::INVALID_KEY;
 #endif
 
 	Connexion *conn;
@@ -218,10 +218,32 @@ void Server::OnRecvRouting(const BatchSet &buffers)
 		ReleaseRecvBuffers(garbage, garbage_count);
 }
 
+// Queue the cookie for a handshake packet from this address
+static void QueueCookie(QueuedCookie &cookie, const NetAddr &addr)
+{
+	if (addr.Is6())
+	{
+		cookie.address_info = &addr;
+		cookie.bytes = sizeof(addr);
+	}
+	else
+	{
+		cookie.address_info = 0;
+		cookie.ip = addr.GetIP4();
+		cookie.port = addr.GetPort();
+	}
+}
+
 void Server::OnRecv(ThreadLocalStorage &tls, const BatchSet &buffers)
 {
 	u32 buffer_count = 0;
 
+	// Cookies are generated and verified a batch at a time, since during a
+	// flood of spoofed hellos that is nearly all of the work done here
+	RecvBuffer *hellos[COOKIE_BATCH], *challenges[COOKIE_BATCH];
+	QueuedCookie hello_cookies[COOKIE_BATCH], challenge_cookies[COOKIE_BATCH];
+	int hello_count = 0, challenge_count = 0;
+
 	// For each buffer received,
 	for (BatchHead *node = buffers.head; node; node = node->batch_next)
 	{
@@ -257,210 +279,256 @@ void Server::OnRecv(ThreadLocalStorage &tls, const BatchSet &buffers)
 				continue;
 			}
 
-			CAT_WARN("Server") << "Accepted hello and posted cookie";
+			hellos[hello_count] = buffer;
+			QueueCookie(hello_cookies[hello_count], buffer->GetAddr());
 
-			PostConnectionCookie(buffer->GetAddr());
+			if (++hello_count >= COOKIE_BATCH)
+			{
+				OnHelloBatch(hellos, hello_cookies, hello_count);
+				hello_count = 0;
+			}
 		}
 		else if (bytes == C2S_CHALLENGE_LEN && data[0] == C2S_CHALLENGE)
 		{
-			// If cookie is invalid, ignore packet
-			u32 *cookie = reinterpret_cast<u32*>( data + 1 );
-			bool good_cookie = buffer->GetAddr().Is6() ?
-				_cookie_jar.Verify(&buffer->GetAddr(), sizeof(buffer->GetAddr()), *cookie) :
-				_cookie_jar.Verify(buffer->GetAddr().GetIP4(), buffer->GetAddr().GetPort(), *cookie);
+			challenges[challenge_count] = buffer;
+			QueueCookie(challenge_cookies[challenge_count], buffer->GetAddr());
+			challenge_cookies[challenge_count].cookie = *reinterpret_cast<u32*>( data + 1 );
 
-			if (!good_cookie)
+			if (++challenge_count >= COOKIE_BATCH)
 			{
-				CAT_WARN("Server") << "Ignoring challenge: Stale cookie";
-				continue;
+				OnChallengeBatch(tls, challenges, challenge_cookies, challenge_count);
+				challenge_count = 0;
 			}
+		}
+		else
+		{
+			CAT_WARN("Server") << "Ignoring handshake packet: Unrecognized type";
+		}
+	}
 
-			if (IsShutdown())
-			{
-				CAT_WARN("Server") << "Ignoring challenge: Server is shutting down";
-				PostConnectionError(buffer->GetAddr(), ERR_SHUTDOWN);
-				continue;
-			}
+	if (hello_count > 0)
+		OnHelloBatch(hellos, hello_cookies, hello_count);
 
-			// If the derived server object does not like this address,
-			if (!AcceptNewConnexion(buffer->GetAddr()))
-			{
-				CAT_WARN("Server") << "Ignoring challenge: Source address is blocked";
-				PostConnectionError(buffer->GetAddr(), ERR_BLOCKED);
-				continue;
-			}
+	if (challenge_count > 0)
+		OnChallengeBatch(tls, challenges, challenge_cookies, challenge_count);
 
-			// If server is overpopulated,
-			if (_conn_map.GetCount() >= ConnexionMap::MAX_POPULATION)
-			{
-				CAT_WARN("Server") << "Ignoring challenge: Server is full";
-				PostConnectionError(buffer->GetAddr(), ERR_SERVER_FULL);
-				continue;
-			}
+	ReleaseRecvBuffers(buffers, buffer_count);
+}
 
-			TunnelTLS *tunnel_tls = m_tunnel_tls.Ref(tls);
-			if (!tunnel_tls)
-			{
-				CAT_FATAL("Server") << "Ignoring challenge: Unable to get TLS object";
-				PostConnectionError(buffer->GetAddr(), ERR_SERVER_ERROR);
-				continue;
-			}
+void Server::OnHelloBatch(RecvBuffer **buffers, QueuedCookie *cookies, int count)
+{
+	_cookie_jar.GenerateBatch(cookies, count);
 
-			u8 *pkt = m_udp_send_allocator->Acquire(S2C_ANSWER_LEN);
-			u8 *challenge = data + 1 + 4;
+	for (int ii = 0; ii < count; ++ii)
+	{
+		CAT_WARN("Server") << "Accepted hello and posted cookie";
 
-			Skein key_hash;
-			AutoDestroy<Connexion> conn;
+		PostConnectionCookie(buffers[ii]->GetAddr(), cookies[ii].cookie);
+	}
+}
 
-			// Verify that post buffer could be allocated
-			if (!pkt)
-			{
-				CAT_WARN("Server") << "Ignoring challenge: Unable to allocate post buffer";
-			}
-			// If challenge is invalid,
-			else if (!_key_agreement_responder.ProcessChallenge(tunnel_tls, challenge, CHALLENGE_BYTES,
-																pkt + 1, ANSWER_BYTES, &key_hash))
-			{
-				CAT_WARN("Server") << "Ignoring challenge: Invalid";
+void Server::OnChallengeBatch(ThreadLocalStorage &tls, RecvBuffer **buffers, QueuedCookie *cookies, int count)
+{
+	_cookie_jar.VerifyBatch(cookies, count);
 
-				pkt[0] = S2C_ERROR;
-				pkt[1] = (u8)(ERR_TAMPERING);
-				Write(pkt, S2C_ERROR_LEN, buffer->GetAddr());
-			}
-			// If out of memory for Connexion objects,
-			else if (!(conn = NewConnexion()))
-			{
-				CAT_WARN("Server") << "Out of memory: Unable to allocate new Connexion";
+	for (int ii = 0; ii < count; ++ii)
+	{
+		// If cookie is invalid, ignore packet
+		if (!cookies[ii].valid)
+		{
+			CAT_WARN("Server") << "Ignoring challenge: Stale cookie";
+			continue;
+		}
 
-				pkt[0] = S2C_ERROR;
-				pkt[1] = (u8)(ERR_SERVER_ERROR);
-				Write(pkt, S2C_ERROR_LEN, buffer->GetAddr());
-			}
-			// If unable to key encryption from session key,
-			else if (!_key_agreement_responder.KeyEncryption(&key_hash, &conn->_auth_enc, _session_key))
-			{
-				CAT_WARN("Server") << "Ignoring challenge: Unable to key encryption";
+		OnChallenge(tls, buffers[ii]);
+	}
+}
 
-				pkt[0] = S2C_ERROR;
-				pkt[1] = (u8)(ERR_SERVER_ERROR);
-				Write(pkt, S2C_ERROR_LEN, buffer->GetAddr());
-			}
-			else if (!conn->InitializeTransportSecurity(false, conn->_auth_enc))
+void Server::OnChallenge(ThreadLocalStorage &tls, RecvBuffer *buffer)
+{
+	u8 *data = GetTrailingBytes(buffer);
+
+	if (IsShutdown())
+	{
+		CAT_WARN("Server") << "Ignoring challenge: Server is shutting down";
+		PostConnectionError(buffer->GetAddr(), ERR_SHUTDOWN);
+		return;
+	}
+
+	// If the derived server object does not like this address,
+	if (!AcceptNewConnexion(buffer->GetAddr()))
+	{
+		CAT_WARN("Server") << "Ignoring challenge: Source address is blocked";
+		PostConnectionError(buffer->GetAddr(), ERR_BLOCKED);
+		return;
+	}
+
+	// If server is overpopulated,
+	if (_conn_map.GetCount() >= ConnexionMap::MAX_POPULATION)
+	{
+		CAT_WARN("Server") << "Ignoring challenge: Server is full";
+		PostConnectionError(buffer->GetAddr(), ERR_SERVER_FULL);
+		return;
+	}
+
+	TunnelTLS *tunnel_tls = m_tunnel_tls.Ref(tls);
+	if (!tunnel_tls)
+	{
+		CAT_FATAL("Server") << "Ignoring challenge: Unable to get TLS object";
+		PostConnectionError(buffer->GetAddr(), ERR_SERVER_ERROR);
+		return;
+	}
+
+	u8 *pkt = m_udp_send_allocator->Acquire(S2C_ANSWER_LEN);
+	u8 *challenge = data + 1 + 4;
+
+	Skein key_hash;
+	AutoDestroy<Connexion> conn;
+
+	// Verify that post buffer could be allocated
+	if (!pkt)
+	{
+		CAT_WARN("Server") << "Ignoring challenge: Unable to allocate post buffer";
+	}
+	// If challenge is invalid,
+	else if (!_key_agreement_responder.ProcessChallenge(tunnel_tls, challenge, CHALLENGE_BYTES,
+														pkt + 1, ANSWER_BYTES, &key_hash))
+	{
+		CAT_WARN("Server") << "Ignoring challenge: Invalid";
+
+		pkt[0] = S2C_ERROR;
+		pkt[1] = (u8)(ERR_TAMPERING);
+		Write(pkt, S2C_ERROR_LEN, buffer->GetAddr());
+	}
+	// If out of memory for Connexion objects,
+	else if (!(conn = NewConnexion()))
+	{
+		CAT_WARN("Server") << "Out of memory: Unable to allocate new Connexion";
+
+		pkt[0] = S2C_ERROR;
+		pkt[1] = (u8)(ERR_SERVER_ERROR);
+		Write(pkt, S2C_ERROR_LEN, buffer->GetAddr());
+	}
+	// If unable to key encryption from session key,
+	else if (!_key_agreement_responder.KeyEncryption(&key_hash, &conn->_auth_enc, _session_key))
+	{
+		CAT_WARN("Server") << "Ignoring challenge: Unable to key encryption";
+
+		pkt[0] = S2C_ERROR;
+		pkt[1] = (u8)(ERR_SERVER_ERROR);
+		Write(pkt, S2C_ERROR_LEN, buffer->GetAddr());
+	}
+	else if (!conn->InitializeTransportSecurity(false, conn->_auth_enc))
+	{
+		CAT_WARN("Server") << "Ignoring challenge: Unable to initialize transport security";
+
+		pkt[0] = S2C_ERROR;
+		pkt[1] = (u8)(ERR_SERVER_ERROR);
+		Write(pkt, S2C_ERROR_LEN, buffer->GetAddr());
+	}
+	else // Good so far:
+	{
+		// Finish constructing the answer packet
+		pkt[0] = S2C_ANSWER;
+
+#if !defined(CAT_SPHYNX_ROAMING_IP)
+		// Initialize Connexion object
+		conn->_first_challenge_hash = MurmurHash(challenge, CHALLENGE_BYTES).Get64();
+		memcpy(conn->_cached_answer, pkt + 1, ANSWER_BYTES);
+#endif
+		conn->_client_addr = buffer->GetAddr();
+		conn->_last_recv_tsc = buffer->event_msec;
+		conn->_parent = this;
+		conn->InitializePayloadBytes(SupportsIPv6());
+
+		// If we have come this far, then there is now a reference to this Server object
+		// in the Connexion.  So we need to add to our reference count at this point to
+		// avoid a race condition.
+
+		// Add a reference to the server on behalf of the Connexion
+		// When the Connexion dies, it will release this reference
+		AddRef(CAT_REFOBJECT_TRACE);
+
+		// Find least populated worker id
+		u32 worker_id = m_worker_threads->FindLeastPopulatedWorker();
+
+		// Set Transport TLS from worker id
+		TransportTLS *remote_tls = m_transport_tls.Peek(m_worker_threads->GetTLS(worker_id));
+		TransportTLS *local_tls = m_transport_tls.Peek(tls);
+		if (!remote_tls || !local_tls)
+		{
+			CAT_WARN("Server") << "Ignoring challenge: Unable to get TLS";
+
+			pkt[0] = S2C_ERROR;
+			pkt[1] = (u8)ERR_SERVER_ERROR;
+			Write(pkt, S2C_ERROR_LEN, buffer->GetAddr());
+		}
+		else
+		{
+			//u32 lock_rv = local_tls->rand_pad.Next();
+			conn->InitializeTLS(remote_tls);
+
+			// Assign to a worker
+			if (!m_worker_threads->AssignTimer(worker_id, conn, WorkerTimerDelegate::FromMember<Connexion, &Connexion::OnTick>(conn)))
 			{
-				CAT_WARN("Server") << "Ignoring challenge: Unable to initialize transport security";
+				CAT_WARN("Server") << "Ignoring challenge: Unable to assign timer";
 
 				pkt[0] = S2C_ERROR;
-				pkt[1] = (u8)(ERR_SERVER_ERROR);
+				pkt[1] = (u8)ERR_SERVER_ERROR;
 				Write(pkt, S2C_ERROR_LEN, buffer->GetAddr());
 			}
-			else // Good so far:
+			else
 			{
-				// Finish constructing the answer packet
-				pkt[0] = S2C_ANSWER;
+				conn->_worker_id = worker_id;
 
-#if !defined(CAT_SPHYNX_ROAMING_IP)
-				// Initialize Connexion object
-				conn->_first_challenge_hash = MurmurHash(challenge, CHALLENGE_BYTES).Get64();
-				memcpy(conn->_cached_answer, pkt + 1, ANSWER_BYTES);
-#endif
-				conn->_client_addr = buffer->GetAddr();
-				conn->_last_recv_tsc = buffer->event_msec;
-				conn->_parent = this;
-				conn->InitializePayloadBytes(SupportsIPv6());
-
-				// If we have come this far, then there is now a reference to this Server object
-				// in the Connexion.  So we need to add to our reference count at this point to
-				// avoid a race condition.
-
-				// Add a reference to the server on behalf of the Connexion
-				// When the Connexion dies, it will release this reference
-				AddRef(CAT_REFOBJECT_TRACE);
-
-				// Find least populated worker id
-				u32 worker_id = m_worker_threads->FindLeastPopulatedWorker();
-
-				// Set Transport TLS from worker id
-				TransportTLS *remote_tls = m_transport_tls.Peek(m_worker_threads->GetTLS(worker_id));
-				TransportTLS *local_tls = m_transport_tls.Peek(tls);
-				if (!remote_tls || !local_tls)
+				// Attempt to insert connexion into the map
+				SphynxError err = _conn_map.Insert(conn);
+
+				// If hash key could not be inserted,
+				if (err != ERR_NO_PROBLEMO)
 				{
-					CAT_WARN("Server") << "Ignoring challenge: Unable to get TLS";
+					CAT_WARN("Server") << "Ignoring challenge: Connexion map rejected the new connexion";
 
 					pkt[0] = S2C_ERROR;
-					pkt[1] = (u8)ERR_SERVER_ERROR;
+					pkt[1] = (u8)err;
 					Write(pkt, S2C_ERROR_LEN, buffer->GetAddr());
 				}
 				else
 				{
-					//u32 lock_rv = local_tls->rand_pad.Next();
-					conn->InitializeTLS(remote_tls);
+#if defined(CAT_SPHYNX_ROAMING_IP)
+					u16 *user_id = reinterpret_cast<u16*>( pkt + 1 + ANSWER_BYTES );
+					*user_id = getLE((u16)conn->GetMyID());
+#endif
 
-					// Assign to a worker
-					if (!m_worker_threads->AssignTimer(worker_id, conn, WorkerTimerDelegate::FromMember<Connexion, &Connexion::OnTick>(conn)))
+					// If unable to post packet,
+					if (!Write(pkt, S2C_ANSWER_LEN, buffer->GetAddr()))
 					{
-						CAT_WARN("Server") << "Ignoring challenge: Unable to assign timer";
-
-						pkt[0] = S2C_ERROR;
-						pkt[1] = (u8)ERR_SERVER_ERROR;
-						Write(pkt, S2C_ERROR_LEN, buffer->GetAddr());
+						CAT_WARN("Server") << "Ignoring challenge: Unable to post packet";
 					}
-					else
+					// If server is still not shutting down,
+					else if (!IsShutdown())
 					{
-						conn->_worker_id = worker_id;
-
-						// Attempt to insert connexion into the map
-						SphynxError err = _conn_map.Insert(conn);
-
-						// If hash key could not be inserted,
-						if (err != ERR_NO_PROBLEMO)
-						{
-							CAT_WARN("Server") << "Ignoring challenge: Connexion map rejected the new connexion";
-
-							pkt[0] = S2C_ERROR;
-							pkt[1] = (u8)err;
-							Write(pkt, S2C_ERROR_LEN, buffer->GetAddr());
-						}
-						else
-						{
-#if defined(CAT_SPHYNX_ROAMING_IP)
-							u16 *user_id = reinterpret_cast<u16*>( pkt + 1 + ANSWER_BYTES );
-							*user_id = getLE((u16)conn->GetMyID());
-#endif
+						CAT_WARN("Server") << "Accepted challenge and posted answer.  Client connected";
 
-							// If unable to post packet,
-							if (!Write(pkt, S2C_ANSWER_LEN, buffer->GetAddr()))
-							{
-								CAT_WARN("Server") << "Ignoring challenge: Unable to post packet";
-							}
-							// If server is still not shutting down,
-							else if (!IsShutdown())
-							{
-								CAT_WARN("Server") << "Accepted challenge and posted answer.  Client connected";
-
-								conn->OnConnect();
-
-								// Do not shutdown the object
-								conn.Forget();
-							}
-						}
+						conn->OnConnect();
+
+						// Do not shutdown the object
+						conn.Forget();
 					}
 				}
 			}
-
-			// If execution gets here, the Connexion object will be shutdown
-		}
-		else
-		{
-			CAT_WARN("Server") << "Ignoring handshake packet: Unrecognized type";
 		}
 	}
 
-	ReleaseRecvBuffers(buffers, buffer_count);
+	// If execution gets here, the Connexion object will be shutdown
 }
 
 void Server::OnTick(ThreadLocalStorage &tls, u32 now)
 {
 	// Not synchronous with OnRecv() callback because offline events are distributed between threads
+
+	// Release connexions removed since the last map write
+	_conn_map.Reclaim();
 }
 
 Server::Server()
@@ -510,10 +578,17 @@ bool Server::StartServer(Port port, TunnelKeyPair &key_pair, const char *session
 		return false;
 	}
 
+	// Tick on a worker thread until shutdown
+	if (!m_worker_threads->AssignTimer(m_worker_threads->FindLeastPopulatedWorker(), this, WorkerTimerDelegate::FromMember<Server, &Server::OnTick>(this)))
+	{
+		CAT_WARN("Server") << "Failed to initialize: Unable to assign timer";
+		return false;
+	}
+
 	return true;
 }
 
-bool Server::PostConnectionCookie(const NetAddr &dest)
+bool Server::PostConnectionCookie(const NetAddr &dest, u32 cookie)
 {
 	u8 *pkt = m_udp_send_allocator->Acquire(S2C_COOKIE_LEN);
 	if (!pkt)
@@ -527,8 +602,7 @@ bool Server::PostConnectionCookie(const NetAddr &dest)
 
 	// Endianness does not matter since we will read it back the same way
 	u32 *pkt_cookie = reinterpret_cast<u32*>( pkt + 1 );
-	*pkt_cookie = dest.Is6() ? _cookie_jar.Generate(&dest, sizeof(dest))
-							 : _cookie_jar.Generate(dest.GetIP4(), dest.GetPort());
+	*pkt_cookie = cookie;
 
 	// Attempt to post the packet, ignoring failures
 	return Write(pkt, S2C_COOKIE_LEN, dest);
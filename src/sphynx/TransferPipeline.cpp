@@ -0,0 +1,1308 @@
+/*
+	Copyright (c) 2012 Christopher A. Taylor.  All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	* Redistributions of source code must retain the above copyright notice,
+	  this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	* Neither the name of LibCat nor the names of its contributors may be used
+	  to endorse or promote products derived from this software without
+	  specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <cat/sphynx/TransferPipeline.hpp>
+#include <cat/mem/LargeAllocator.hpp>
+#include <cat/hash/Murmur.hpp>
+#include <cat/io/Log.hpp>
+#include <ext/lz4/lz4.h>
+#include <cmath>
+using namespace cat;
+using namespace sphynx;
+
+static const u32 MAX_BLOCK_ID = 0xffffff; // 24-bit block ids
+
+// Milliseconds of sending the token bucket can save up
+static const u32 PACING_BURST = 10;
+
+// Gap in block ids past which a stream is assumed to have started over
+static const u32 MAX_ID_GAP = 1024;
+
+// Blocks past twice the block count before a decoder is given up on
+static const u32 MAX_EXTRA_BLOCKS = 32;
+
+
+//// TransferSource
+
+TransferSource::TransferSource()
+{
+	_reader = 0;
+	_block_bytes = _chunk_bytes = _window = 0;
+	_next_file = _next_seq = _send_slot = 0;
+	_rate = 0;
+	_tokens = 0;
+	_last_refill = 0;
+	_sent_blocks = _read_bytes = _compress_bytes = 0;
+
+	_on_stream_start.Invalidate();
+	_on_file_done.Invalidate();
+
+	for (u32 ii = 0; ii < FT_MAX_STREAMS; ++ii)
+	{
+		Slot *slot = &_slots[ii];
+
+		slot->state = SLOT_FREE;
+		slot->busy = false;
+		slot->read_buffer = 0;
+		slot->compress_buffer = 0;
+	}
+}
+
+TransferSource::~TransferSource()
+{
+	FreeBuffers();
+}
+
+void TransferSource::FreeBuffers()
+{
+	for (u32 ii = 0; ii < FT_MAX_STREAMS; ++ii)
+	{
+		Slot *slot = &_slots[ii];
+
+		if (slot->read_buffer)
+		{
+			LargeAllocator::ref()->Release(slot->read_buffer);
+			slot->read_buffer = 0;
+		}
+
+		if (slot->compress_buffer)
+		{
+			LargeAllocator::ref()->Release(slot->compress_buffer);
+			slot->compress_buffer = 0;
+		}
+
+		slot->state = SLOT_FREE;
+	}
+}
+
+bool TransferSource::Initialize(ITransferReader *reader, u32 block_bytes, u32 chunk_bytes, u32 window)
+{
+	if (!reader || block_bytes < 1 || chunk_bytes < 1 || chunk_bytes > 0x7fffffff ||
+		(chunk_bytes + block_bytes - 1) / block_bytes > CAT_WIREHAIR_MAX_N ||
+		window < 1 || window > FT_MAX_STREAMS)
+	{
+		CAT_WARN("TransferSource") << "Invalid parameters: block bytes " << block_bytes << ", chunk bytes " << chunk_bytes << ", window " << window;
+		return false;
+	}
+
+	FreeBuffers();
+
+	u32 compress_bound = LZ4_compressBound(chunk_bytes);
+
+	for (u32 ii = 0; ii < window; ++ii)
+	{
+		Slot *slot = &_slots[ii];
+
+		slot->read_buffer = (u8*)LargeAllocator::ref()->Acquire(chunk_bytes);
+		slot->compress_buffer = (u8*)LargeAllocator::ref()->Acquire(compress_bound);
+
+		if (!slot->read_buffer || !slot->compress_buffer)
+		{
+			CAT_WARN("TransferSource") << "Out of memory allocating " << window << " chunks of " << chunk_bytes << " bytes";
+			FreeBuffers();
+			return false;
+		}
+	}
+
+	_reader = reader;
+	_block_bytes = block_bytes;
+	_chunk_bytes = chunk_bytes;
+	_window = window;
+	_send_slot = 0;
+
+	return true;
+}
+
+TransferSource::File *TransferSource::FindFile(u32 file_id)
+{
+	for (u32 ii = 0, count = (u32)_files.size(); ii < count; ++ii)
+		if (_files[ii].file_id == file_id)
+			return &_files[ii];
+
+	return 0;
+}
+
+bool TransferSource::AddFile(u32 file_id, u64 file_bytes, u64 start_offset)
+{
+	if (start_offset > file_bytes)
+	{
+		CAT_WARN("TransferSource") << "Start offset " << start_offset << " is past the end of file " << file_id;
+		return false;
+	}
+
+	AutoMutex lock(_lock);
+
+	if (!_window || FindFile(file_id))
+	{
+		CAT_WARN("TransferSource") << "Unable to add file " << file_id;
+		return false;
+	}
+
+	File file;
+	file.file_id = file_id;
+	file.file_bytes = file_bytes;
+	file.next_offset = start_offset;
+	file.in_flight = 0;
+	file.reason = TXERR_NO_PROBLEMO;
+
+	_files.push_back(file);
+
+	FillWindow();
+
+	return true;
+}
+
+void TransferSource::FillWindow()
+{
+	u32 file_count = (u32)_files.size();
+	if (!file_count) return;
+
+	for (u32 ii = 0; ii < _window; ++ii)
+	{
+		Slot *slot = &_slots[ii];
+		if (slot->state != SLOT_FREE) continue;
+
+		// Take the next chunk from each file in turn
+		File *file = 0;
+		for (u32 tries = 0; tries < file_count; ++tries)
+		{
+			File *candidate = &_files[_next_file++ % file_count];
+
+			if (candidate->reason == TXERR_NO_PROBLEMO &&
+				candidate->next_offset < candidate->file_bytes)
+			{
+				file = candidate;
+				break;
+			}
+		}
+
+		// Nothing left to read
+		if (!file) return;
+
+		u64 remaining = file->file_bytes - file->next_offset;
+		u32 chunk_bytes = remaining < _chunk_bytes ? (u32)remaining : _chunk_bytes;
+
+		slot->state = SLOT_READ;
+		slot->busy = false;
+		slot->seq = _next_seq++;
+		slot->file_id = file->file_id;
+		slot->file_offset = file->next_offset;
+		slot->chunk_bytes = chunk_bytes;
+		slot->next_id = 0;
+		slot->requested = 0;
+
+		file->next_offset += chunk_bytes;
+		++file->in_flight;
+	}
+}
+
+void TransferSource::FailSlot(Slot *slot, int reason)
+{
+	CAT_WARN("TransferSource") << "Chunk at offset " << slot->file_offset << " of file " << slot->file_id
+		<< " failed: " << reason;
+
+	File *file = FindFile(slot->file_id);
+	if (file)
+	{
+		if (file->reason == TXERR_NO_PROBLEMO)
+			file->reason = reason;
+
+		--file->in_flight;
+	}
+
+	slot->state = SLOT_FREE;
+	slot->requested = 0;
+}
+
+bool TransferSource::PopDoneFile(u32 &file_id, int &reason)
+{
+	for (u32 ii = 0, count = (u32)_files.size(); ii < count; ++ii)
+	{
+		File *file = &_files[ii];
+
+		if (file->in_flight == 0 &&
+			(file->reason != TXERR_NO_PROBLEMO || file->next_offset >= file->file_bytes))
+		{
+			file_id = file->file_id;
+			reason = file->reason;
+
+			_files.erase(_files.begin() + ii);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void TransferSource::ReportDoneFiles()
+{
+	for (;;)
+	{
+		u32 file_id;
+		int reason;
+
+		_lock.Enter();
+		bool done = PopDoneFile(file_id, reason);
+		_lock.Leave();
+
+		if (!done) break;
+
+		if (_on_file_done.IsValid())
+			_on_file_done(file_id, reason);
+	}
+}
+
+bool TransferSource::DoWork()
+{
+	_lock.Enter();
+
+	FillWindow();
+
+	// Pick the oldest chunk that is waiting on a worker
+	Slot *slot = 0;
+	u32 stream_id = 0;
+
+	for (u32 ii = 0; ii < _window; ++ii)
+	{
+		Slot *candidate = &_slots[ii];
+
+		if (candidate->busy) continue;
+
+		switch (candidate->state)
+		{
+		case SLOT_READ:
+		case SLOT_COMPRESS:
+		case SLOT_ENCODE:
+			if (!slot || (s32)(candidate->seq - slot->seq) < 0)
+			{
+				slot = candidate;
+				stream_id = ii;
+			}
+			break;
+		}
+	}
+
+	if (!slot)
+	{
+		_lock.Leave();
+
+		ReportDoneFiles();
+		return false;
+	}
+
+	u32 state = slot->state;
+	slot->busy = true;
+
+	_lock.Leave();
+
+	// The slot is owned by this thread until busy is cleared
+	int reason = TXERR_NO_PROBLEMO;
+
+	switch (state)
+	{
+	case SLOT_READ:
+		if (!_reader->ReadChunk(slot->file_id, slot->file_offset, slot->read_buffer, slot->chunk_bytes))
+			reason = TXERR_FILE_READ_FAIL;
+		else
+			slot->chunk_hash = MurmurHash(slot->read_buffer, slot->chunk_bytes).Get32();
+		break;
+
+	case SLOT_COMPRESS:
+		{
+			int compress_bytes = LZ4_compress((const char*)slot->read_buffer, (char*)slot->compress_buffer, slot->chunk_bytes);
+
+			// Send the raw data if it does not get smaller
+			if (compress_bytes > 0 && (u32)compress_bytes < slot->chunk_bytes)
+			{
+				slot->message = slot->compress_buffer;
+				slot->compress_bytes = compress_bytes;
+			}
+			else
+			{
+				slot->message = slot->read_buffer;
+				slot->compress_bytes = slot->chunk_bytes;
+			}
+		}
+		break;
+
+	case SLOT_ENCODE:
+		slot->block_count = (slot->compress_bytes + _block_bytes - 1) / _block_bytes;
+
+		// A single block is sent as-is, since Wirehair needs at least two
+		if (slot->block_count > 1)
+		{
+			wirehair::Result r = slot->encoder.BeginEncode(slot->message, slot->compress_bytes, _block_bytes);
+
+			if (r)
+			{
+				CAT_WARN("TransferSource") << "BeginEncode error " << wirehair::GetResultString(r);
+				reason = TXERR_FEC_FAIL;
+			}
+		}
+		break;
+	}
+
+	TransferStreamInfo info;
+	bool started = false;
+
+	_lock.Enter();
+
+	slot->busy = false;
+
+	if (reason != TXERR_NO_PROBLEMO)
+		FailSlot(slot, reason);
+	else if (state == SLOT_READ)
+	{
+		_read_bytes += slot->chunk_bytes;
+		slot->state = SLOT_COMPRESS;
+	}
+	else if (state == SLOT_COMPRESS)
+	{
+		_compress_bytes += slot->compress_bytes;
+		slot->state = SLOT_ENCODE;
+	}
+	else
+	{
+		slot->state = SLOT_SEND;
+
+		info.stream_id = stream_id;
+		info.file_id = slot->file_id;
+		info.file_offset = slot->file_offset;
+		info.chunk_bytes = slot->chunk_bytes;
+		info.compress_bytes = slot->compress_bytes;
+		info.block_bytes = _block_bytes;
+		info.chunk_hash = slot->chunk_hash;
+		started = true;
+	}
+
+	_lock.Leave();
+
+	if (started && _on_stream_start.IsValid())
+		_on_stream_start(info);
+
+	ReportDoneFiles();
+
+	return true;
+}
+
+bool TransferSource::HasData()
+{
+	AutoMutex lock(_lock);
+
+	for (u32 ii = 0; ii < _window; ++ii)
+		if (_slots[ii].state == SLOT_SEND && _slots[ii].requested > 0)
+			return true;
+
+	return false;
+}
+
+u32 TransferSource::NextBlock(u32 now, u8 *packet)
+{
+	AutoMutex lock(_lock);
+
+	if (_rate)
+	{
+		// Top up the token bucket
+		u32 elapsed = now - _last_refill;
+
+		if (elapsed > 0)
+		{
+			s32 burst = (s32)((u64)_rate * PACING_BURST / 1000);
+			s32 min_burst = (s32)(2 * GetMaxPacketBytes());
+			if (burst < min_burst) burst = min_burst;
+
+			u64 tokens = (u64)_rate * elapsed / 1000 + _tokens;
+			_tokens = tokens > (u64)burst ? burst : (s32)tokens;
+			_last_refill = now;
+		}
+
+		if (_tokens <= 0)
+			return 0;
+	}
+
+	// Interleave the streams one block at a time
+	for (u32 tries = 0; tries < _window; ++tries)
+	{
+		u32 stream_id = _send_slot;
+		if (++_send_slot >= _window) _send_slot = 0;
+
+		Slot *slot = &_slots[stream_id];
+		if (slot->state != SLOT_SEND || slot->requested == 0)
+			continue;
+
+		u32 id = slot->next_id;
+		if (id > MAX_BLOCK_ID)
+		{
+			slot->requested = 0;
+			continue;
+		}
+
+		slot->next_id = id + 1;
+		--slot->requested;
+
+		// Write header
+		u32 hdr = (stream_id & FT_STREAM_ID_MASK) << FT_STREAM_ID_SHIFT;
+		u32 hdr_bytes;
+
+		if (id < 65536)
+		{
+			hdr |= FT_COMPRESS_ID_MASK;
+			hdr_bytes = 3;
+		}
+		else
+		{
+			packet[3] = (u8)(id >> 16);
+			hdr_bytes = 4;
+		}
+
+		packet[0] = (u8)hdr;
+		packet[1] = (u8)id;
+		packet[2] = (u8)(id >> 8);
+
+		u8 *block = packet + hdr_bytes;
+		u32 bytes;
+
+		// If FEC is bypassed,
+		if (slot->block_count <= 1)
+		{
+			bytes = slot->compress_bytes;
+			memcpy(block, slot->message, bytes);
+		}
+		else
+			bytes = slot->encoder.Encode(id, block);
+
+		++_sent_blocks;
+		_tokens -= hdr_bytes + bytes;
+
+		return hdr_bytes + bytes;
+	}
+
+	return 0;
+}
+
+void TransferSource::OnStreamRequest(u32 stream_id, u32 count)
+{
+	if (stream_id >= _window)
+	{
+		CAT_WARN("TransferSource") << "Ignored request for invalid stream " << stream_id;
+		return;
+	}
+
+	AutoMutex lock(_lock);
+
+	Slot *slot = &_slots[stream_id];
+
+	if (slot->state == SLOT_SEND)
+	{
+		slot->requested += count;
+
+		if (slot->requested > MAX_BLOCK_ID)
+			slot->requested = MAX_BLOCK_ID;
+	}
+}
+
+void TransferSource::OnStreamDone(u32 stream_id)
+{
+	if (stream_id >= _window)
+	{
+		CAT_WARN("TransferSource") << "Ignored done for invalid stream " << stream_id;
+		return;
+	}
+
+	_lock.Enter();
+
+	Slot *slot = &_slots[stream_id];
+
+	if (slot->state == SLOT_SEND)
+	{
+		File *file = FindFile(slot->file_id);
+		if (file) --file->in_flight;
+
+		slot->state = SLOT_FREE;
+		slot->requested = 0;
+
+		FillWindow();
+	}
+
+	_lock.Leave();
+
+	ReportDoneFiles();
+}
+
+void TransferSource::OnRate(u32 rate_counter)
+{
+	AutoMutex lock(_lock);
+
+	_rate = rate_counter;
+}
+
+bool TransferSource::IsIdle()
+{
+	AutoMutex lock(_lock);
+
+	return _files.empty();
+}
+
+
+//// TransferSink
+
+TransferSink::TransferSink()
+{
+	_writer = 0;
+	_chunk_bytes = 0;
+	_request_timeout = REQUEST_TIMEOUT;
+	_received_blocks = _useless_blocks = 0;
+	_corrupt_chunks = _stalled_chunks = 0;
+
+	_rate_interval = RATE_INTERVAL;
+	_rate = 0;
+	_slow_start = true;
+	_interval_start = 0;
+	_interval_bytes = 0;
+	_loss = 0;
+	_loss_index = 0;
+	_random_loss = 0;
+
+	// No history yet, so these never win the minimum
+	for (u32 ii = 0; ii < LOSS_HISTORY; ++ii)
+		_loss_history[ii] = 65536;
+
+	_on_stream_request.Invalidate();
+	_on_stream_done.Invalidate();
+	_on_file_done.Invalidate();
+	_on_rate.Invalidate();
+
+	for (u32 ii = 0; ii < FT_MAX_STREAMS; ++ii)
+	{
+		Slot *slot = &_slots[ii];
+
+		slot->state = SLOT_FREE;
+		slot->busy = false;
+		slot->write_buffer = 0;
+		slot->compress_buffer = 0;
+		slot->next_id = 0;
+		slot->interval_arrived = 0;
+		slot->interval_lost = 0;
+		slot->loss = 0;
+	}
+}
+
+TransferSink::~TransferSink()
+{
+	FreeBuffers();
+}
+
+void TransferSink::FreeBuffers()
+{
+	for (u32 ii = 0; ii < FT_MAX_STREAMS; ++ii)
+	{
+		Slot *slot = &_slots[ii];
+
+		if (slot->write_buffer)
+		{
+			LargeAllocator::ref()->Release(slot->write_buffer);
+			slot->write_buffer = 0;
+		}
+
+		if (slot->compress_buffer)
+		{
+			LargeAllocator::ref()->Release(slot->compress_buffer);
+			slot->compress_buffer = 0;
+		}
+
+		slot->state = SLOT_FREE;
+	}
+}
+
+bool TransferSink::Initialize(ITransferWriter *writer, u32 chunk_bytes)
+{
+	if (!writer || chunk_bytes < 1 || chunk_bytes > 0x7fffffff)
+	{
+		CAT_WARN("TransferSink") << "Invalid parameters: chunk bytes " << chunk_bytes;
+		return false;
+	}
+
+	// Buffers are allocated when each stream is first used
+	FreeBuffers();
+
+	_writer = writer;
+	_chunk_bytes = chunk_bytes;
+
+	return true;
+}
+
+TransferSink::File *TransferSink::FindFile(u32 file_id)
+{
+	for (u32 ii = 0, count = (u32)_files.size(); ii < count; ++ii)
+		if (_files[ii].file_id == file_id)
+			return &_files[ii];
+
+	return 0;
+}
+
+TransferSink::Progress *TransferSink::FindProgress(u64 file_hash)
+{
+	for (u32 ii = 0, count = (u32)_progress.size(); ii < count; ++ii)
+		if (_progress[ii].file_hash == file_hash)
+			return &_progress[ii];
+
+	return 0;
+}
+
+u64 TransferSink::GetResumeOffset(u64 file_hash)
+{
+	AutoMutex lock(_lock);
+
+	Progress *progress = FindProgress(file_hash);
+
+	return progress ? progress->done_bytes : 0;
+}
+
+void TransferSink::SetResumeOffset(u64 file_hash, u64 done_bytes)
+{
+	AutoMutex lock(_lock);
+
+	Progress *progress = FindProgress(file_hash);
+
+	if (progress)
+		progress->done_bytes = done_bytes;
+	else
+	{
+		Progress record;
+		record.file_hash = file_hash;
+		record.done_bytes = done_bytes;
+
+		_progress.push_back(record);
+	}
+}
+
+u64 TransferSink::AddFile(u32 file_id, u64 file_hash, u64 file_bytes)
+{
+	AutoMutex lock(_lock);
+
+	Progress *progress = FindProgress(file_hash);
+	u64 done_bytes = progress ? progress->done_bytes : 0;
+
+	// Progress past the end cannot be for this file
+	if (done_bytes > file_bytes)
+		done_bytes = 0;
+
+	if (done_bytes == file_bytes)
+		return file_bytes;
+
+	if (FindFile(file_id))
+	{
+		CAT_WARN("TransferSink") << "File " << file_id << " was already added";
+		return done_bytes;
+	}
+
+	File file;
+	file.file_id = file_id;
+	file.file_hash = file_hash;
+	file.file_bytes = file_bytes;
+	file.done_bytes = done_bytes;
+
+	_files.push_back(file);
+
+	return done_bytes;
+}
+
+bool TransferSink::CompleteExtent(File *file, u64 offset, u32 bytes)
+{
+	if (offset != file->done_bytes)
+	{
+		// Remember it until the gap before it is filled
+		Extent extent;
+		extent.offset = offset;
+		extent.end = offset + bytes;
+
+		file->later.push_back(extent);
+		return false;
+	}
+
+	file->done_bytes += bytes;
+
+	// Absorb any later chunks that are now contiguous
+	for (u32 ii = 0; ii < (u32)file->later.size();)
+	{
+		if (file->later[ii].offset == file->done_bytes)
+		{
+			file->done_bytes = file->later[ii].end;
+			file->later.erase(file->later.begin() + ii);
+			ii = 0;
+		}
+		else
+			++ii;
+	}
+
+	Progress *progress = FindProgress(file->file_hash);
+
+	if (progress)
+		progress->done_bytes = file->done_bytes;
+	else
+	{
+		Progress record;
+		record.file_hash = file->file_hash;
+		record.done_bytes = file->done_bytes;
+
+		_progress.push_back(record);
+	}
+
+	return file->done_bytes >= file->file_bytes;
+}
+
+void TransferSink::RemoveFile(u32 file_id)
+{
+	for (u32 ii = 0, count = (u32)_files.size(); ii < count; ++ii)
+	{
+		if (_files[ii].file_id == file_id)
+		{
+			_files.erase(_files.begin() + ii);
+			return;
+		}
+	}
+}
+
+u32 TransferSink::GetRequestCount(Slot *slot)
+{
+	u32 needed = slot->received < slot->block_count ? slot->block_count - slot->received : 1;
+
+	// Make up for the blocks this stream is expected to lose
+	u32 loss = slot->loss < MAX_LOSS ? slot->loss : MAX_LOSS;
+	u32 extra = (u32)(((u64)needed * loss + (65535 - loss)) / (65536 - loss));
+
+	return needed + extra + (needed * REQUEST_OVERHEAD + 255) / 256;
+}
+
+bool TransferSink::OnStreamStart(u32 now, const TransferStreamInfo &info)
+{
+	if (info.stream_id >= FT_MAX_STREAMS || info.chunk_bytes < 1 || info.chunk_bytes > _chunk_bytes ||
+		info.compress_bytes < 1 || info.compress_bytes > info.chunk_bytes || info.block_bytes < 1 ||
+		(info.compress_bytes + info.block_bytes - 1) / info.block_bytes > CAT_WIREHAIR_MAX_N)
+	{
+		CAT_WARN("TransferSink") << "Ignored invalid stream start for stream " << info.stream_id;
+		return false;
+	}
+
+	Slot *slot = &_slots[info.stream_id];
+
+	_lock.Enter();
+
+	if (slot->state != SLOT_FREE)
+	{
+		_lock.Leave();
+
+		CAT_WARN("TransferSink") << "Ignored stream start for busy stream " << info.stream_id;
+		return false;
+	}
+
+	if (!FindFile(info.file_id))
+	{
+		_lock.Leave();
+
+		// Release the stream so the source can move on
+		CAT_WARN("TransferSink") << "Ignored stream start for unexpected file " << info.file_id;
+
+		if (_on_stream_done.IsValid())
+			_on_stream_done(info.stream_id);
+
+		return false;
+	}
+
+	slot->state = SLOT_RECEIVE;
+
+	_lock.Leave();
+
+	// The slot is owned by the receiving thread while in SLOT_RECEIVE
+	slot->file_id = info.file_id;
+	slot->file_offset = info.file_offset;
+	slot->chunk_bytes = info.chunk_bytes;
+	slot->chunk_hash = info.chunk_hash;
+	slot->compress_bytes = info.compress_bytes;
+	slot->block_bytes = info.block_bytes;
+	slot->block_count = (info.compress_bytes + info.block_bytes - 1) / info.block_bytes;
+	slot->retries = 0;
+	slot->last_msec = now;
+	slot->next_id = 0;
+
+	// Expect the loss seen on all streams until this one has its own
+	slot->loss = _loss;
+
+	// The first stream sets the starting pace
+	if (!_rate)
+	{
+		_rate = INITIAL_RATE;
+		_interval_start = now;
+		_interval_bytes = 0;
+
+		if (_on_rate.IsValid())
+			_on_rate(_rate);
+	}
+
+	if (!slot->write_buffer)
+		slot->write_buffer = (u8*)LargeAllocator::ref()->Acquire(_chunk_bytes);
+	if (!slot->compress_buffer)
+		slot->compress_buffer = (u8*)LargeAllocator::ref()->Acquire(_chunk_bytes);
+
+	if (!slot->write_buffer || !slot->compress_buffer)
+	{
+		CAT_WARN("TransferSink") << "Out of memory for stream " << info.stream_id;
+	}
+	else if (StartDecode(info.stream_id))
+		return true;
+
+	_lock.Enter();
+	slot->state = SLOT_FREE;
+	_lock.Leave();
+
+	return false;
+}
+
+bool TransferSink::StartDecode(u32 stream_id)
+{
+	Slot *slot = &_slots[stream_id];
+
+	slot->received = 0;
+
+	if (slot->block_count > 1)
+	{
+		u8 *message = slot->compress_bytes < slot->chunk_bytes ? slot->compress_buffer : slot->write_buffer;
+
+		wirehair::Result r = slot->decoder.BeginDecode(message, slot->compress_bytes, slot->block_bytes);
+
+		if (r)
+		{
+			CAT_WARN("TransferSink") << "BeginDecode error " << wirehair::GetResultString(r);
+			return false;
+		}
+	}
+
+	slot->requested = GetRequestCount(slot);
+
+	if (_on_stream_request.IsValid())
+		_on_stream_request(stream_id, slot->requested);
+
+	return true;
+}
+
+void TransferSink::OnBlock(u32 now, const u8 *packet, u32 bytes)
+{
+	if (bytes < 3) return;
+
+	// Read header
+	u32 hdr = packet[0];
+	u32 stream_id = (hdr >> FT_STREAM_ID_SHIFT) & FT_STREAM_ID_MASK;
+	u32 id = ((u32)packet[2] << 8) | packet[1];
+	u32 hdr_bytes = 3;
+
+	if (!(hdr & FT_COMPRESS_ID_MASK))
+	{
+		if (bytes < 4) return;
+
+		id |= (u32)packet[3] << 16;
+		hdr_bytes = 4;
+	}
+
+	++_received_blocks;
+	_interval_bytes += bytes;
+
+	// Only this thread moves a slot into or out of SLOT_RECEIVE
+	Slot *slot = &_slots[stream_id];
+
+	// Ids skipped over are counted lost, and taken back if they turn up late
+	++slot->interval_arrived;
+
+	if (id >= slot->next_id)
+	{
+		u32 gap = id - slot->next_id;
+
+		if (gap <= MAX_ID_GAP)
+			slot->interval_lost += gap;
+
+		slot->next_id = id + 1;
+	}
+	else if (slot->interval_lost > 0)
+		--slot->interval_lost;
+
+	if (slot->state != SLOT_RECEIVE)
+	{
+		++_useless_blocks;
+		return;
+	}
+
+	// The final original block may be short, and so is every copy of a single block
+	u32 block_bytes = slot->block_bytes;
+	if (slot->block_count <= 1)
+		block_bytes = slot->compress_bytes;
+	else if (id == slot->block_count - 1)
+		block_bytes = slot->compress_bytes - id * slot->block_bytes;
+
+	if (bytes - hdr_bytes < block_bytes)
+	{
+		CAT_WARN("TransferSink") << "Ignored truncated block " << id << " on stream " << stream_id;
+		return;
+	}
+
+	const u8 *block = packet + hdr_bytes;
+
+	slot->last_msec = now;
+	++slot->received;
+
+	int reason = TXERR_NO_PROBLEMO;
+	bool decoded = false;
+
+	// If FEC is bypassed,
+	if (slot->block_count <= 1)
+	{
+		u8 *message = slot->compress_bytes < slot->chunk_bytes ? slot->compress_buffer : slot->write_buffer;
+		memcpy(message, block, slot->compress_bytes);
+		decoded = true;
+	}
+	else
+	{
+		wirehair::Result r = slot->decoder.Decode(id, block);
+
+		if (r == wirehair::R_WIN)
+			decoded = true;
+		else if (r != wirehair::R_MORE_BLOCKS)
+		{
+			CAT_WARN("TransferSink") << "Decode error " << wirehair::GetResultString(r) << " on stream " << stream_id;
+			reason = TXERR_FEC_FAIL;
+		}
+	}
+
+	if (!decoded && reason == TXERR_NO_PROBLEMO)
+	{
+		// Wirehair needs only a few blocks more than block_count, so a
+		// decoder that has taken far more has gone wrong: start it over
+		if (slot->received < slot->block_count * 2 + MAX_EXTRA_BLOCKS)
+			return;
+
+		CAT_WARN("TransferSink") << "Decoder stalled after " << slot->received << " blocks on stream " << stream_id;
+
+		_lock.Enter();
+
+		++_stalled_chunks;
+
+		bool retry = ++slot->retries <= MAX_CHUNK_RETRIES;
+		if (retry) slot->state = SLOT_RETRY;
+
+		_lock.Leave();
+
+		if (retry) return;
+
+		reason = TXERR_FEC_FAIL;
+	}
+
+	u32 file_id = slot->file_id;
+
+	_lock.Enter();
+
+	if (decoded)
+		slot->state = SLOT_WRITE;
+	else
+	{
+		slot->state = SLOT_FREE;
+		RemoveFile(file_id);
+	}
+
+	_lock.Leave();
+
+	if (reason != TXERR_NO_PROBLEMO)
+	{
+		if (_on_stream_done.IsValid())
+			_on_stream_done(stream_id);
+
+		if (_on_file_done.IsValid())
+			_on_file_done(file_id, reason);
+	}
+}
+
+void TransferSink::Tick(u32 now)
+{
+	// At low rates each stream only gets a block every so often, so wait
+	// a few of those gaps on top of the timeout before asking again
+	u32 timeout = _request_timeout;
+
+	if (_rate && _on_rate.IsValid())
+	{
+		u32 round_bytes = 0;
+		for (u32 ii = 0; ii < FT_MAX_STREAMS; ++ii)
+			if (_slots[ii].state == SLOT_RECEIVE)
+				round_bytes += FT_BLOCK_HEADER_BYTES + _slots[ii].block_bytes;
+
+		timeout += (u32)((u64)round_bytes * 2000 / _rate);
+	}
+
+	for (u32 ii = 0; ii < FT_MAX_STREAMS; ++ii)
+	{
+		Slot *slot = &_slots[ii];
+
+		if (slot->state == SLOT_RETRY)
+		{
+			// Decode the chunk again from fresh blocks
+			slot->last_msec = now;
+
+			bool success = StartDecode(ii);
+			u32 file_id = slot->file_id;
+
+			_lock.Enter();
+			slot->state = success ? SLOT_RECEIVE : SLOT_FREE;
+			if (!success) RemoveFile(file_id);
+			_lock.Leave();
+
+			if (!success)
+			{
+				if (_on_stream_done.IsValid())
+					_on_stream_done(ii);
+
+				if (_on_file_done.IsValid())
+					_on_file_done(file_id, TXERR_FEC_FAIL);
+			}
+			continue;
+		}
+
+		if (slot->state != SLOT_RECEIVE ||
+			(s32)(now - slot->last_msec) < (s32)timeout)
+			continue;
+
+		// Blocks stopped arriving before the chunk decoded
+		u32 count = GetRequestCount(slot);
+
+		slot->requested += count;
+		slot->last_msec = now;
+
+		if (_on_stream_request.IsValid())
+			_on_stream_request(ii, count);
+	}
+
+	UpdateRate(now);
+}
+
+void TransferSink::UpdateRate(u32 now)
+{
+	u32 elapsed = now - _interval_start;
+
+	if (!_rate || elapsed < _rate_interval)
+		return;
+
+	u32 arrived = 0, lost = 0;
+
+	for (u32 ii = 0; ii < FT_MAX_STREAMS; ++ii)
+	{
+		arrived += _slots[ii].interval_arrived;
+		lost += _slots[ii].interval_lost;
+	}
+
+	// At low rates, stretch the interval until there are enough blocks to judge by
+	u32 samples = arrived + lost;
+	if (samples < MIN_LOSS_SAMPLES && elapsed < _rate_interval * LOSS_HISTORY)
+		return;
+
+	// Collect the loss on each stream
+	for (u32 ii = 0; ii < FT_MAX_STREAMS; ++ii)
+	{
+		Slot *slot = &_slots[ii];
+		u32 stream_samples = slot->interval_arrived + slot->interval_lost;
+
+		if (stream_samples >= MIN_LOSS_SAMPLES)
+		{
+			u32 loss = (u32)(((u64)slot->interval_lost << 16) / stream_samples);
+			slot->loss = (slot->loss * 3 + loss) / 4;
+		}
+
+		slot->interval_arrived = 0;
+		slot->interval_lost = 0;
+	}
+
+	u64 bytes = _interval_bytes;
+	_interval_bytes = 0;
+	_interval_start = now;
+
+	// Too little traffic to say anything, as when the source has run dry
+	if (samples < MIN_LOSS_SAMPLES)
+		return;
+
+	u32 loss = (u32)(((u64)lost << 16) / samples);
+	_loss = (_loss * 3 + loss) / 4;
+
+	// The loss that remains at every rate is not caused by sending too fast
+	_loss_history[_loss_index] = loss;
+	if (++_loss_index >= LOSS_HISTORY) _loss_index = 0;
+
+	_random_loss = 65536;
+	for (u32 ii = 0; ii < LOSS_HISTORY; ++ii)
+		if (_random_loss > _loss_history[ii])
+			_random_loss = _loss_history[ii];
+
+	u32 excess = loss - _random_loss;
+	u64 rate = _rate;
+
+	// Random loss alone makes the loss jump around from one interval to the
+	// next, the more so the fewer blocks there were, so allow for that
+	u32 noise = (u32)sqrt((double)_random_loss * (65536 - _random_loss) / samples);
+
+	// Rate the link carried, not counting random loss
+	u64 delivered = bytes * 1000 / elapsed;
+	u32 random_loss = _random_loss < MAX_LOSS ? _random_loss : MAX_LOSS;
+	u64 capacity = (delivered << 16) / (65536 - random_loss);
+
+	if (excess > LOSS_HIGH + 2 * noise)
+	{
+		// Fall back to what the link delivered, and a little less so its queue drains
+		rate = capacity - capacity / 16;
+		_slow_start = false;
+	}
+	else if (excess <= LOSS_LOW + noise)
+	{
+		// Only grow while the link keeps up.  Arrivals falling behind the
+		// rate mean that a queue is filling or the source has run dry
+		if (capacity * 8 >= rate * 7)
+			rate += _slow_start ? rate : rate / 16;
+	}
+
+	if (rate < MIN_RATE)
+		rate = MIN_RATE;
+	else if (rate > 0xffffffff)
+		rate = 0xffffffff;
+
+	_rate = (u32)rate;
+
+	if (_on_rate.IsValid())
+		_on_rate(_rate);
+}
+
+bool TransferSink::DoWork()
+{
+	_lock.Enter();
+
+	Slot *slot = 0;
+	u32 stream_id = 0;
+
+	for (u32 ii = 0; ii < FT_MAX_STREAMS; ++ii)
+	{
+		if (_slots[ii].state == SLOT_WRITE && !_slots[ii].busy)
+		{
+			slot = &_slots[ii];
+			stream_id = ii;
+			break;
+		}
+	}
+
+	if (!slot)
+	{
+		_lock.Leave();
+		return false;
+	}
+
+	slot->busy = true;
+
+	_lock.Leave();
+
+	int reason = TXERR_NO_PROBLEMO;
+	bool intact = true;
+
+	if (slot->compress_bytes < slot->chunk_bytes)
+	{
+		int bytes = LZ4_uncompress_unknownOutputSize((const char*)slot->compress_buffer, (char*)slot->write_buffer, slot->compress_bytes, slot->chunk_bytes);
+
+		intact = (bytes == (int)slot->chunk_bytes);
+	}
+
+	if (intact)
+		intact = (MurmurHash(slot->write_buffer, slot->chunk_bytes).Get32() == slot->chunk_hash);
+
+	if (!intact)
+	{
+		CAT_WARN("TransferSink") << "Chunk at offset " << slot->file_offset << " of file " << slot->file_id
+			<< " decoded to the wrong data on stream " << stream_id;
+
+		_lock.Enter();
+
+		++_corrupt_chunks;
+
+		// Let the receiving thread decode it again
+		bool retry = ++slot->retries <= MAX_CHUNK_RETRIES;
+		if (retry)
+		{
+			slot->busy = false;
+			slot->state = SLOT_RETRY;
+		}
+
+		_lock.Leave();
+
+		if (retry) return true;
+
+		reason = TXERR_FEC_FAIL;
+	}
+	else if (!_writer->WriteChunk(slot->file_id, slot->file_offset, slot->write_buffer, slot->chunk_bytes))
+	{
+		reason = TXERR_FILE_WRITE_FAIL;
+	}
+
+	u32 file_id = slot->file_id;
+	bool file_done = false;
+
+	_lock.Enter();
+
+	File *file = FindFile(file_id);
+
+	if (file)
+	{
+		if (reason != TXERR_NO_PROBLEMO)
+		{
+			RemoveFile(file_id);
+			file_done = true;
+		}
+		else if (CompleteExtent(file, slot->file_offset, slot->chunk_bytes))
+		{
+			RemoveFile(file_id);
+			file_done = true;
+		}
+	}
+
+	slot->busy = false;
+	slot->state = SLOT_FREE;
+
+	_lock.Leave();
+
+	if (_on_stream_done.IsValid())
+		_on_stream_done(stream_id);
+
+	if (file_done && _on_file_done.IsValid())
+		_on_file_done(file_id, reason);
+
+	return true;
+}
+
+bool TransferSink::IsIdle()
+{
+	AutoMutex lock(_lock);
+
+	return _files.empty();
+}
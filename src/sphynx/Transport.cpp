@@ -27,6 +27,7 @@
 */
 
 #include <cat/sphynx/Transport.hpp>
+#include <cat/sphynx/Connexion.hpp>
 #include <cat/port/EndianNeutral.hpp>
 #include <cat/net/UDPSendAllocator.hpp>
 #include <cat/io/Log.hpp>
@@ -186,6 +187,65 @@ void Transport::QueueWriteDatagram(SendCluster &cluster)
 }
 
 
+//// Shared message data
+
+CAT_INLINE u8 *Transport::GetMessageData(OutgoingMessage *node)
+{
+	SharedPayload *shared = node->shared;
+
+	// If the message data follows the node,
+	if (!shared) return GetTrailingBytes(node);
+
+	u8 *data = GetTrailingBytes(shared);
+
+	// If the node switched to the compressed copy when it started fragmenting,
+	if (node->GetBytes() != shared->bytes)
+		data += shared->bytes;
+
+	return data;
+}
+
+CAT_INLINE void Transport::ReleaseMessage(OutgoingMessage *node)
+{
+	SharedPayload *shared = node->shared;
+
+	// If this was the last node pointing at the shared data,
+	if (shared && Atomic::Add(&shared->references, -1) == 1)
+		m_std_allocator->Release(shared);
+
+	m_std_allocator->Release(node);
+}
+
+SharedPayload *Transport::AcquireSharedPayload(u8 msg_opcode, const void *msg_data, u32 msg_bytes)
+{
+	u32 data_bytes = 1 + msg_bytes;
+
+	// If the message will be fragmented, reserve room to compress it once for all connexions
+	// Inlined from LZ4 code - Remember to update this if it changes!
+	u32 compress_bound = (data_bytes > FRAG_THRESHOLD) ? (data_bytes + (data_bytes/255) + 16) : 0;
+
+	SharedPayload *payload = m_std_allocator->AcquireTrailing<SharedPayload>(data_bytes + compress_bound);
+	if (!payload) return 0;
+
+	u8 *data = GetTrailingBytes(payload);
+	data[0] = msg_opcode;
+	memcpy(data + 1, msg_data, msg_bytes);
+
+	payload->bytes = data_bytes;
+	payload->compressed_bytes = 0;
+
+	if (compress_bound)
+	{
+		// Only keep the compressed copy if it is actually smaller
+		int compress_bytes = LZ4_compress((const char*)data, (char*)data + data_bytes, data_bytes);
+		if (compress_bytes > 0 && (u32)compress_bytes < data_bytes)
+			payload->compressed_bytes = compress_bytes;
+	}
+
+	return payload;
+}
+
+
 //// SendQueue
 
 CAT_INLINE void SendQueue::FreeMemory()
@@ -193,7 +253,7 @@ CAT_INLINE void SendQueue::FreeMemory()
 	for (OutgoingMessage *node = head, *next; node; node = next)
 	{
 		next = node->next;
-		m_std_allocator->Release(node);
+		Transport::ReleaseMessage(node);
 	}
 }
 
@@ -323,12 +383,12 @@ void Transport::FreeSentNode(OutgoingMessage *node)
 			// If message has completed sending,
 			if (full_data_node->sent_bytes >= full_data_node->GetBytes())
 			{
-				m_std_allocator->Release(full_data_node);
+				ReleaseMessage(full_data_node);
 			}
 		}
 	}
 
-	m_std_allocator->Release(node);
+	ReleaseMessage(node);
 }
 
 CAT_INLINE void Transport::QueueFragFree(u8 *data)
@@ -396,6 +456,23 @@ Transport::Transport()
 	CAT_OBJCLR(_send_queue);
 	CAT_OBJCLR(_sending_queue);
 	CAT_OBJCLR(_sent_list);
+	CAT_OBJCLR(_send_unreliable_queue);
+	CAT_OBJCLR(_sending_unreliable_queue);
+
+	// Default scheduler settings favor the latency-sensitive queues over bulk data
+	_queue_weight[STREAM_UNORDERED] = 8;
+	_queue_weight[STREAM_1] = 8;
+	_queue_weight[STREAM_2] = 4;
+	_queue_weight[STREAM_BULK] = 1;
+	_queue_weight[UNRELIABLE_QUEUE] = 8;
+
+	_queue_deadline[STREAM_UNORDERED] = 20;
+	_queue_deadline[STREAM_1] = 20;
+	_queue_deadline[STREAM_2] = 50;
+	_queue_deadline[STREAM_BULK] = 500;
+	_queue_deadline[UNRELIABLE_QUEUE] = 20;
+
+	CAT_OBJCLR(_queue_delay);
 
 	// Just clear these for now.  When security is initialized these will be filled in
 	CAT_OBJCLR(_next_send_id);
@@ -432,6 +509,9 @@ Transport::~Transport()
 		_send_queue[stream].FreeMemory();
 		_sending_queue[stream].FreeMemory();
 	}
+
+	_send_unreliable_queue.FreeMemory();
+	_sending_unreliable_queue.FreeMemory();
 }
 
 void Transport::Disconnect(u8 reason)
@@ -1042,27 +1122,18 @@ bool Transport::WriteOOB(u8 msg_opcode, const void *msg_data, u32 msg_bytes, Sup
 	return WriteDatagrams(buffer, 1) > 0;
 }
 
-bool Transport::WriteUnreliable(u8 msg_opcode, const void *vmsg_data, u32 msg_bytes, SuperOpcode super_opcode)
+u32 Transport::ClusterUnreliableAppend(u8 msg_opcode, const u8 *msg_data, u32 msg_bytes, u32 super_opcode)
 {
-	const u8 *msg_data = reinterpret_cast<const u8*>( vmsg_data );
-
 	u32 max_payload_bytes = _max_payload_bytes;
 	u32 data_bytes = msg_bytes + 1;
 	u32 header_bytes = data_bytes > BLO_MASK ? 2 : 1;
 	u32 needed = header_bytes + data_bytes;
-
-	// Fail on invalid input
-	if (needed > max_payload_bytes)
-	{
-		CAT_WARN("Transport") << "Invalid input: Unreliable buffer size request too large";
-		return false;
-	}
-
-	_send_cluster_lock->Enter();
+	u32 flushed = 0;
 
 	// If growing the send buffer cannot contain the new message,
 	if (_send_cluster.bytes + needed > max_payload_bytes)
 	{
+		flushed = _send_cluster.bytes;
 		QueueWriteDatagram(_send_cluster);
 		_send_cluster.Clear();
 	}
@@ -1084,6 +1155,27 @@ bool Transport::WriteUnreliable(u8 msg_opcode, const void *vmsg_data, u32 msg_by
 	pkt[0] = msg_opcode;
 	memcpy(pkt + 1, msg_data, msg_bytes);
 
+	return flushed;
+}
+
+bool Transport::WriteUnreliable(u8 msg_opcode, const void *vmsg_data, u32 msg_bytes, SuperOpcode super_opcode)
+{
+	const u8 *msg_data = reinterpret_cast<const u8*>( vmsg_data );
+
+	u32 data_bytes = msg_bytes + 1;
+	u32 header_bytes = data_bytes > BLO_MASK ? 2 : 1;
+
+	// Fail on invalid input
+	if (header_bytes + data_bytes > _max_payload_bytes)
+	{
+		CAT_WARN("Transport") << "Invalid input: Unreliable buffer size request too large";
+		return false;
+	}
+
+	_send_cluster_lock->Enter();
+
+	ClusterUnreliableAppend(msg_opcode, msg_data, msg_bytes, super_opcode);
+
 	_send_cluster_lock->Leave();
 
 	CAT_INFO("Transport") << "Wrote unreliable message with " << data_bytes << " bytes";
@@ -1091,6 +1183,69 @@ bool Transport::WriteUnreliable(u8 msg_opcode, const void *vmsg_data, u32 msg_by
 	return true;
 }
 
+bool Transport::QueueUnreliable(u8 msg_opcode, const void *msg_data, u32 msg_bytes, u32 expire_msec, SuperOpcode super_opcode)
+{
+	u32 data_bytes = msg_bytes + 1;
+	u32 header_bytes = data_bytes > BLO_MASK ? 2 : 1;
+
+	// Fail on invalid input
+	if (header_bytes + data_bytes > _max_payload_bytes)
+	{
+		CAT_WARN("Transport") << "Invalid input: Unreliable buffer size request too large";
+		return false;
+	}
+
+	u8 *msg = OutgoingMessage::Acquire(data_bytes);
+	if (!msg) return false;
+
+	msg[0] = msg_opcode;
+	memcpy(msg + 1, msg_data, msg_bytes);
+
+	u32 now = m_clock->msec();
+
+	// Fill the object
+	OutgoingMessage *node = OutgoingMessage::Promote(msg);
+	node->shared = 0;
+	node->SetBytes(data_bytes);
+	node->ts_expire = now + expire_msec;
+	node->sop = super_opcode;
+	node->send_bytes = 0;
+	node->sent_bytes = 0;
+	node->ts_queued = now;
+
+	// Add to back of unreliable queue
+	_send_queue_lock->Enter();
+	_send_unreliable_queue.Append(node);
+	_send_queue_lock->Leave();
+
+	return true;
+}
+
+void Transport::SetQueueWeight(u32 queue, u32 weight)
+{
+	if (queue < NUM_SCHEDULED_QUEUES)
+		_queue_weight[queue] = weight;
+}
+
+void Transport::SetQueueDeadline(u32 queue, u32 msec)
+{
+	if (queue < NUM_SCHEDULED_QUEUES)
+		_queue_deadline[queue] = msec;
+}
+
+void Transport::GetQueueDelayStats(u32 queue, QueueDelayStats &stats)
+{
+	if (queue < NUM_SCHEDULED_QUEUES)
+		stats = _queue_delay[queue];
+	else
+		CAT_OBJCLR(stats);
+}
+
+void Transport::ResetQueueDelayStats()
+{
+	CAT_OBJCLR(_queue_delay);
+}
+
 bool Transport::WriteReliable(StreamMode stream, u8 msg_opcode, const void *msg_data, u32 msg_bytes, SuperOpcode super_opcode)
 {
 	u32 data_bytes = 1 + msg_bytes;
@@ -1103,6 +1258,60 @@ bool Transport::WriteReliable(StreamMode stream, u8 msg_opcode, const void *msg_
 	return WriteReliableZeroCopy(stream, msg, data_bytes, super_opcode);
 }
 
+OutgoingMessage *Transport::AcquireSharedMessages(SharedPayload *payload, int count, SuperOpcode super_opcode)
+{
+	u32 now = m_clock->msec();
+
+	// Prepare one message header for each connexion
+	OutgoingMessage *head = 0;
+	for (int msg_id = 0; msg_id < count; ++msg_id)
+	{
+		OutgoingMessage *node;
+		do node = m_std_allocator->AcquireObject<OutgoingMessage>();
+		while (!node);
+
+		// Initialize outgoing message object
+		node->shared = payload;
+		node->SetBytes(payload->bytes);
+		node->frag_count = 0;
+		node->sop = super_opcode;
+		node->send_bytes = 0;
+		node->sent_bytes = 0;
+		node->ts_queued = now;
+
+		// Link to head of list
+		node->next = head;
+		head = node;
+	}
+
+	Atomic::Add(&payload->references, count);
+
+	return head;
+}
+
+void Transport::AppendSharedPayload(SharedPayload *payload, int worker_id, Connexion **list, int count, StreamMode stream, SuperOpcode super_opcode)
+{
+	OutgoingMessage *head = AcquireSharedMessages(payload, count, super_opcode);
+
+	// Lookup send queue lock for this worker id
+	TransportTLS *tls = m_transport_tls.Peek(m_worker_threads->GetTLS(worker_id));
+	Mutex *send_queue_lock = &tls->locks.send_queue_lock;
+
+	send_queue_lock->Enter();
+
+	// For each client,
+	for (int ii = 0; ii < count; ++ii)
+	{
+		OutgoingMessage *next = head->next;
+
+		list[ii]->_send_queue[stream].Append(head);
+
+		head = next;
+	}
+
+	send_queue_lock->Leave();
+}
+
 bool Transport::BroadcastReliable(BinnedConnexionSubset &subset, StreamMode stream, u8 msg_opcode, const void *msg_data, u32 msg_bytes, SuperOpcode super_opcode)
 {
 	if (msg_bytes > MAX_MESSAGE_SIZE)
@@ -1111,6 +1320,14 @@ bool Transport::BroadcastReliable(BinnedConnexionSubset &subset, StreamMode stre
 		return false;
 	}
 
+	// Copy the message data once for all of the connexions
+	SharedPayload *payload;
+	do payload = AcquireSharedPayload(msg_opcode, msg_data, msg_bytes);
+	while (!payload);
+
+	// Hold a reference until every bin is queued, since other workers may finish with theirs first
+	payload->references = 1;
+
 	// For each worker,
 	u32 acquire_sum = 0;
 	for (int worker_id = 0, worker_count = subset.WorkerCount(); worker_id < worker_count; ++worker_id)
@@ -1120,54 +1337,52 @@ bool Transport::BroadcastReliable(BinnedConnexionSubset &subset, StreamMode stre
 		const int subset_count = subsubset.Count();
 		if (subset_count <= 0) continue;
 
-		// Prepare one message for each subset connexion
-		OutgoingMessage *head = 0;
-		for (int msg_id = 0; msg_id < subset_count; ++msg_id)
-		{
-			// Acquire buffer
-			u8 *msg;
-			do msg = OutgoingMessage::Acquire(1 + msg_bytes);
-			while (!msg);
-
-			// Initialize outgoing message object
-			OutgoingMessage *node = OutgoingMessage::Promote(msg);
-			node->SetBytes(1 + msg_bytes);
-			node->frag_count = 0;
-			node->sop = super_opcode;
-			node->send_bytes = 0;
-			node->sent_bytes = 0;
-
-			// Link to head of list
-			node->next = head;
-			head = node;
-
-			// Fill data
-			msg[0] = msg_opcode;
-			memcpy(msg + 1, msg_data, msg_bytes);
-		}
+		AppendSharedPayload(payload, worker_id, subsubset.GetList(), subset_count, stream, super_opcode);
 
-		// Lookup send queue lock for this worker id
-		TransportTLS *tls = m_transport_tls.Peek(m_worker_threads->GetTLS(worker_id));
-		Mutex *send_queue_lock = &tls->locks.send_queue_lock;
+		acquire_sum += subset_count;
+	}
 
-		send_queue_lock->Enter();
+	// Drop the reference held while queuing
+	if (Atomic::Add(&payload->references, -1) == 1)
+		m_std_allocator->Release(payload);
 
-		// For each client,
-		for (int ii = 0; ii < subset_count; ++ii)
-		{
-			OutgoingMessage *next = head->next;
+	CAT_INFO("Transport") << "Appended reliable message with " << msg_bytes << " bytes to stream " << stream << " for " << acquire_sum << " connexions";
 
-			subsubset[ii]->_send_queue[stream].Append(head);
+	return true;
+}
 
-			head = next;
-		}
+bool Transport::BroadcastReliable(ConnexionSnapshot *snapshot, StreamMode stream, u8 msg_opcode, const void *msg_data, u32 msg_bytes, SuperOpcode super_opcode)
+{
+	if (msg_bytes > MAX_MESSAGE_SIZE)
+	{
+		CAT_WARN("Transport") << "Reliable write request too large " << msg_bytes;
+		return false;
+	}
 
-		send_queue_lock->Leave();
+	// Copy the message data once for all of the connexions
+	SharedPayload *payload;
+	do payload = AcquireSharedPayload(msg_opcode, msg_data, msg_bytes);
+	while (!payload);
 
-		acquire_sum += subset_count;
+	// Hold a reference until every bin is queued, since other workers may finish with theirs first
+	payload->references = 1;
+
+	// For each worker,
+	for (int worker_id = 0, worker_count = snapshot->WorkerCount(); worker_id < worker_count; ++worker_id)
+	{
+		// Skip empty bins
+		int bin_count;
+		Connexion **bin = snapshot->GetBin(worker_id, bin_count);
+		if (bin_count <= 0) continue;
+
+		AppendSharedPayload(payload, worker_id, bin, bin_count, stream, super_opcode);
 	}
 
-	CAT_INFO("Transport") << "Appended reliable message with " << msg_bytes << " bytes to stream " << stream << " for " << acquire_sum << " connexions";
+	// Drop the reference held while queuing
+	if (Atomic::Add(&payload->references, -1) == 1)
+		m_std_allocator->Release(payload);
+
+	CAT_INFO("Transport") << "Appended reliable message with " << msg_bytes << " bytes to stream " << stream << " for " << snapshot->Count() << " connexions";
 
 	return true;
 }
@@ -1183,11 +1398,13 @@ bool Transport::WriteReliableZeroCopy(StreamMode stream, u8 *msg, u32 msg_bytes,
 
 	// Fill the object
 	OutgoingMessage *node = OutgoingMessage::Promote(msg);
+	node->shared = 0;
 	node->SetBytes(msg_bytes);
 	node->frag_count = 0;
 	node->sop = super_opcode;
 	node->send_bytes = 0;
 	node->sent_bytes = 0;
+	node->ts_queued = m_clock->msec();
 
 	// Add to back of send queue
 	_send_queue_lock->Enter();
@@ -1224,14 +1441,14 @@ void Transport::Retransmit(u32 stream, OutgoingMessage *node, u32 now)
 		OutgoingMessage *full_node = frag->full_data;
 		frag_total_bytes = full_node->GetBytes();
 		frag_comp_bytes = full_node->orig_bytes;
-		data = GetTrailingBytes(full_node) + frag->offset;
+		data = GetMessageData(full_node) + frag->offset;
 
 		// If this is the first fragment of the message,
 		if (frag->offset == 0) frag_overhead = FRAG_HEADER_BYTES;
 	}
 	else
 	{
-		data = GetTrailingBytes(node);
+		data = GetMessageData(node);
 	}
 
 	// Calculate message length
@@ -1549,14 +1766,15 @@ bool Transport::PostHugeZeroCopy(const BatchSet &buffers, u32 count)
 	return false;
 }
 
-bool Transport::PostMTUProbe(u32 mtu)
+bool Transport::PostMTUProbe(u32 datagram_bytes, bool reset)
 {
-	CAT_INANE("Transport") << "Posting MTU Probe";
+	CAT_INANE("Transport") << "Posting MTU Probe of " << datagram_bytes << " bytes";
 
-	if (mtu < MINIMUM_MTU || mtu > MAXIMUM_MTU)
+	if (datagram_bytes < MINIMUM_MTU - _udpip_bytes ||
+		datagram_bytes > IOTHREADS_BUFFER_READ_BYTES)
 		return false;
 
-	u32 payload_bytes = mtu - _udpip_bytes - SPHYNX_OVERHEAD;
+	u32 payload_bytes = datagram_bytes - SPHYNX_OVERHEAD;
 
 	const u32 pkt_bytes = payload_bytes + SPHYNX_OVERHEAD;
 	u8 *pkt = m_udp_send_allocator->Acquire(pkt_bytes);
@@ -1570,11 +1788,11 @@ bool Transport::PostMTUProbe(u32 mtu)
 	//	I = 0 (no ack id follows)
 	//	R = 0 (unreliable)
 	//	C = 1 (large packet size)
-	//	SOP = IOP_C2S_MTU_PROBE
+	//	SOP = IOP_C2S_MTU_PROBE (with IOP_C2S_MTU_PROBE_RESET if falling back)
 	u32 data_bytes = payload_bytes - MAX_MESSAGE_HEADER_BYTES;
 	pkt[0] = (u8)((SOP_INTERNAL << SOP_SHIFT) | C_MASK | (data_bytes & BLO_MASK));
 	pkt[1] = (u8)(data_bytes >> BHI_SHIFT);
-	pkt[2] = IOP_C2S_MTU_PROBE;
+	pkt[2] = reset ? (IOP_C2S_MTU_PROBE | IOP_C2S_MTU_PROBE_RESET) : IOP_C2S_MTU_PROBE;
 
 	// Fill payload with random bytes
 	Abyssinian &prng = _ttls->rand_pad;
@@ -2060,26 +2278,46 @@ bool Transport::WriteSendQueueNode(OutgoingMessage *node, u32 now, u32 stream, s
 			do frag = m_std_allocator->AcquireObject<SendFrag>();
 			while (!frag);
 
+			++node->frag_count;
+
 			// If node is just now fragmenting for the first time,
-			if (!node->frag_count++)
+			// NOTE: Not keyed on frag_count, which drops back to zero whenever every
+			// fragment sent so far has been acknowledged before the rest are sent
+			if (sent_bytes == 0)
 			{
-				// Calculate compression output buffer size
 				u32 src_bytes = node->GetBytes();
+				int compress_bytes;
 
-				// Inlined from LZ4 code - Remember to update this if it changes!
-				u32 dest_bytes = (src_bytes + (src_bytes/255) + 16);
+				// If the message data is shared, it was already compressed by BroadcastReliable()
+				if (node->shared)
+					compress_bytes = node->shared->compressed_bytes;
+				else
+				{
+					// Calculate compression output buffer size
+					// Inlined from LZ4 code - Remember to update this if it changes!
+					u32 dest_bytes = (src_bytes + (src_bytes/255) + 16);
+
+					// Acquire compression output buffer
+					u8 *dest;
+					do dest = new (std::nothrow) u8[dest_bytes];
+					while (!dest);
+
+					// Attempt compression
+					u8 *src_data = GetTrailingBytes(node);
+					compress_bytes = LZ4_compress((const char*)src_data, (char*)dest, src_bytes);
+
+					// If compression helped, replace the message data in place
+					// NOTE: The receiver assumes the data is uncompressed if it did not shrink
+					if (compress_bytes > 0 && (u32)compress_bytes < src_bytes)
+						memcpy(src_data, dest, compress_bytes);
+					else
+						compress_bytes = 0;
 
-				// Acquire compression output buffer
-				u8 *dest;
-				do dest = new (std::nothrow) u8[dest_bytes];
-				while (!dest);
+					delete []dest;
+				}
 
-				// Attempt compression
-				u8 *src_data = GetTrailingBytes(node);
-				int compress_bytes = LZ4_compress((const char*)src_data, (char*)dest, src_bytes);
 				if (compress_bytes > 0)
 				{
-					memcpy(src_data, dest, compress_bytes);
 					node->SetBytes(compress_bytes);
 
 					// Recalculate copy bytes
@@ -2095,11 +2333,10 @@ bool Transport::WriteSendQueueNode(OutgoingMessage *node, u32 now, u32 stream, s
 				}
 
 				node->orig_bytes = (u16)src_bytes;
-
-				delete []dest;
 			}
 
 			// Fill fragment object
+			frag->shared = 0;
 			frag->SetBytes(data_bytes_to_copy);
 			frag->offset = sent_bytes;
 			frag->full_data = node;
@@ -2108,6 +2345,10 @@ bool Transport::WriteSendQueueNode(OutgoingMessage *node, u32 now, u32 stream, s
 			add_node = static_cast<OutgoingMessage*>( frag );
 		}
 
+		// If this is the first time the message leaves the queue,
+		if (sent_bytes == 0)
+			RecordQueueDelay(stream, now - node->ts_queued);
+
 		// Write common data
 		add_node->id = ack_id;
 		add_node->ts_firstsend = now;
@@ -2130,7 +2371,7 @@ bool Transport::WriteSendQueueNode(OutgoingMessage *node, u32 now, u32 stream, s
 
 		// Append to cluster
 		ClusterReliableAppend(stream, ack_id, msg, ack_id_overhead, frag_overhead,
-			_send_cluster, add_node->sop, GetTrailingBytes(node) + sent_bytes,
+			_send_cluster, add_node->sop, GetMessageData(node) + sent_bytes,
 			data_bytes_to_copy, node->GetBytes(), node->orig_bytes);
 
 		send_limit -= data_bytes_to_copy;
@@ -2156,16 +2397,144 @@ bool Transport::WriteSendQueueNode(OutgoingMessage *node, u32 now, u32 stream, s
 	}
 }
 
+CAT_INLINE void Transport::RecordQueueDelay(u32 queue, u32 delay)
+{
+	QueueDelayStats *stats = &_queue_delay[queue];
+
+	stats->messages++;
+	stats->total_msec += delay;
+	if (stats->max_msec < delay)
+		stats->max_msec = delay;
+}
+
+void Transport::WriteQueuedUnreliable(u32 now, OutgoingMessage *tail, s32 &remaining)
+{
+	OutgoingMessage *node = _sending_unreliable_queue.head;
+
+	// For each message to send,
+	while (node)
+	{
+		OutgoingMessage *next = node->next;
+		bool last = (node == tail);
+
+		// If it waited too long to be worth sending,
+		if ((s32)(now - node->ts_expire) >= 0)
+			_queue_delay[UNRELIABLE_QUEUE].expired++;
+		else
+		{
+			RecordQueueDelay(UNRELIABLE_QUEUE, now - node->ts_queued);
+
+			u8 *data = GetTrailingBytes(node);
+			remaining -= ClusterUnreliableAppend(data[0], data + 1, node->GetBytes() - 1, node->sop);
+		}
+
+		ReleaseMessage(node);
+		node = next;
+
+		if (last) break;
+	}
+
+	// Drop expired messages that are still waiting so they do not hold up the deadline order
+	while (node && (s32)(now - node->ts_expire) >= 0)
+	{
+		OutgoingMessage *next = node->next;
+
+		_queue_delay[UNRELIABLE_QUEUE].expired++;
+		ReleaseMessage(node);
+
+		node = next;
+	}
+
+	_sending_unreliable_queue.head = node;
+	if (!node) _sending_unreliable_queue.tail = 0;
+}
+
+u32 Transport::ScheduleQueues(s32 bandwidth, OutgoingMessage *out_head[], OutgoingMessage *out_tail[], u32 order[])
+{
+	u32 order_count = 0, total_weight = 0;
+
+	// For each scheduled queue,
+	for (u32 queue = 0; queue < NUM_SCHEDULED_QUEUES; ++queue)
+	{
+		OutgoingMessage *node = out_head[queue];
+		out_tail[queue] = node;
+
+		if (!node) continue;
+
+		// Reset the send bytes of the head node on the first pass since it may
+		// have been retained from the previous timer tick
+		node->send_bytes = 0;
+
+		total_weight += _queue_weight[queue];
+
+		// Insert into the order list, earliest deadline for the oldest message first
+		u32 deadline = node->ts_queued + _queue_deadline[queue];
+		u32 ii = order_count++;
+		for (; ii > 0; --ii)
+		{
+			u32 prev = order[ii - 1];
+			OutgoingMessage *prev_head = out_head[prev];
+
+			if ((s32)(prev_head->ts_queued + _queue_deadline[prev] - deadline) <= 0)
+				break;
+
+			order[ii] = prev;
+		}
+		order[ii] = queue;
+	}
+
+	s32 remaining = bandwidth;
+
+	// Weighted fair share: Each backlogged queue gets bandwidth in proportion to its weight,
+	// so a large bulk backlog cannot starve the latency-sensitive streams
+	if (total_weight > 0)
+	{
+		for (u32 ii = 0; remaining > 0 && ii < order_count; ++ii)
+		{
+			u32 queue = order[ii];
+			s32 share = (s32)(((u64)bandwidth * _queue_weight[queue]) / total_weight);
+
+			if (share > 0)
+				out_tail[queue] = DequeueBandwidth(out_head[queue], share, remaining);
+		}
+	}
+
+	// Any bandwidth left over goes to the queues in deadline order
+	for (u32 ii = 0; remaining > 0 && ii < order_count; ++ii)
+	{
+		u32 queue = order[ii];
+		OutgoingMessage *node = out_tail[queue];
+
+		if (node) out_tail[queue] = DequeueBandwidth(node, remaining, remaining);
+	}
+
+	// Queues that were given no bandwidth send nothing this time, as with
+	// weight 0 when the other queues use it all up
+	u32 scheduled_count = 0;
+	for (u32 ii = 0; ii < order_count; ++ii)
+	{
+		u32 queue = order[ii];
+
+		if (out_tail[queue] == out_head[queue])
+			out_head[queue] = 0;
+		else
+			order[scheduled_count++] = queue;
+	}
+
+	return scheduled_count;
+}
+
 bool Transport::WriteQueuedReliable()
 {
 	// Avoid locking to transmit queued if no queued exist
-	int stream;
+	u32 stream;
 	for (stream = 0; stream < NUM_STREAMS; ++stream)
 		if (_send_queue[stream].head || _sending_queue[stream].head)
 			break;
 
 	// If no reliable data to send,
-	if (stream >= NUM_STREAMS)
+	if (stream >= NUM_STREAMS &&
+		!_send_unreliable_queue.head && !_sending_unreliable_queue.head)
 	{
 		// If no huge data to send either,
 		if (!_huge_endpoint || !_huge_endpoint->HasData())
@@ -2187,67 +2556,41 @@ bool Transport::WriteQueuedReliable()
 	_send_queue_lock->Enter();
 	for (u32 stream = 0; stream < NUM_STREAMS; ++stream)
 		_sending_queue[stream].Steal(_send_queue[stream]);
+	_sending_unreliable_queue.Steal(_send_unreliable_queue);
 	_send_queue_lock->Leave();
 
 	// Generate a list of messages to transmit based on the bandwidth available
-	OutgoingMessage *out_head[NUM_STREAMS], *out_tail[NUM_STREAMS];
-	s32 remaining = bandwidth;
-
-	// Split bandwidth evenly between normal streams
-	for (u32 stream = 0; stream < NUM_STREAMS - 1; ++stream)
-	{
-		OutgoingMessage *node = remaining > 0 ? _sending_queue[stream].head : 0;
-		out_head[stream] = node;
-
-		if (!node)
-		{
-			out_tail[stream] = 0;
-			continue;
-		}
-
-		// Reset the send bytes of the head node on the first pass since it may
-		// have been retained from the previous timer tick
-		node->send_bytes = 0;
+	OutgoingMessage *out_head[NUM_SCHEDULED_QUEUES], *out_tail[NUM_SCHEDULED_QUEUES];
+	u32 order[NUM_SCHEDULED_QUEUES];
 
-		out_tail[stream] = DequeueBandwidth(node, remaining / (NUM_STREAMS - 1 - stream), remaining);
-	}
+	for (u32 queue = 0; queue < NUM_SCHEDULED_QUEUES; ++queue)
+		out_head[queue] = (queue == UNRELIABLE_QUEUE) ? _sending_unreliable_queue.head : _sending_queue[queue].head;
 
-	// All streams may claim remaining bandwidth with stream 0 as highest priority
-	for (u32 stream = 0; remaining > 0 && stream < NUM_STREAMS - 1; ++stream)
-	{
-		OutgoingMessage *node = out_tail[stream];
-		if (node) out_tail[stream] = DequeueBandwidth(node, remaining, remaining);
-	}
-
-	// If any bandwidth remains, give it to the bulk stream
-	OutgoingMessage *node = remaining > 0 ? _sending_queue[STREAM_BULK].head : 0;
-	out_head[STREAM_BULK] = node;
-	if (!node)
-		out_tail[STREAM_BULK] = 0;
-	else
-	{
-		// Reset the send bytes of the head node on the first pass since it may
-		// have been retained from the previous timer tick
-		node->send_bytes = 0;
-
-		out_tail[STREAM_BULK] = DequeueBandwidth(node, remaining, remaining);
-	}
+	u32 order_count = ScheduleQueues(bandwidth, out_head, out_tail, order);
 
 	// NOTE: What we have now is a *best guess* at how much data can fit into
 	// the bandwidth allowed by the rate limiter.  Due to message headers, the
 	// actual amount of data we can send is somewhat lower.
 	// There may also be messages in the send cluster that greatly reduce the
 	// amount of bandwidth remaining.
-	remaining = bandwidth;
+	s32 remaining = bandwidth;
 
 	// Write dequeued messages to the send cluster
 	_send_cluster_lock->Enter();
 
-	// For each stream,
-	for (u32 stream = 0; stream < NUM_STREAMS; ++stream)
+	// For each queue in deadline order,
+	for (u32 ii = 0; ii < order_count; ++ii)
 	{
+		u32 queue = order[ii];
+
+		if (queue == UNRELIABLE_QUEUE)
+		{
+			WriteQueuedUnreliable(now, out_tail[queue], remaining);
+			continue;
+		}
+
+		u32 stream = queue;
 		OutgoingMessage *node = out_head[stream];
-		if (!node) continue;
 
 		// For each message to send,
 		OutgoingMessage *next;
@@ -0,0 +1,197 @@
+/*
+	Copyright (c) 2012 Christopher A. Taylor.  All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	* Redistributions of source code must retain the above copyright notice,
+	  this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	* Neither the name of LibCat nor the names of its contributors may be used
+	  to endorse or promote products derived from this software without
+	  specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <cat/threads/EpochReclaim.hpp>
+#include <new>
+using namespace cat;
+
+#if !defined(CAT_OS_WINDOWS)
+# include <sched.h>
+#endif
+
+
+//// Reader stripe assignment
+
+// Stripe index + 1 for this thread, or 0 if not assigned yet
+static CAT_TLS u32 m_thread_stripe = 0;
+static volatile u32 m_next_stripe = 0;
+
+u32 EpochReclaim::GetStripe()
+{
+	u32 stripe = m_thread_stripe;
+
+	// If this thread has not read before,
+	if (!stripe)
+	{
+		// Deal stripes out round-robin so that busy threads rarely share a cache line
+		stripe = (Atomic::Add(&m_next_stripe, 1) & (STRIPES - 1)) + 1;
+		m_thread_stripe = stripe;
+	}
+
+	return stripe - 1;
+}
+
+
+//// EpochReclaim
+
+EpochReclaim::EpochReclaim()
+{
+	CAT_OBJCLR(_stripes);
+	_epoch = 0;
+	_retired = 0;
+	_retired_count = 0;
+}
+
+EpochReclaim::~EpochReclaim()
+{
+	Synchronize();
+}
+
+u32 EpochReclaim::EnterRead()
+{
+	u32 ticket = (GetStripe() << 1) | (_epoch & 1);
+
+	// NOTE: Atomic add is a full barrier, so data loads cannot move above it
+	Atomic::Add(&_stripes[ticket >> 1].active[ticket & 1], 1);
+
+	return ticket;
+}
+
+bool EpochReclaim::TryAdvance()
+{
+	// Unlinking stores must be visible before the reader counts are checked
+	Atomic::DataMemoryBarrier();
+
+	u32 epoch = _epoch;
+	u32 parity = (epoch + 1) & 1;
+
+	// If any reader from two epochs ago is still inside, it may hold retired pointers
+	for (u32 ii = 0; ii < STRIPES; ++ii)
+		if (_stripes[ii].active[parity])
+			return false;
+
+	Atomic::Set(&_epoch, epoch + 1);
+
+	return true;
+}
+
+EpochReclaim::Retired *EpochReclaim::CollectReady()
+{
+	u32 epoch = _epoch;
+
+	// List is sorted newest first, so everything after the first ready node is ready too
+	for (Retired **link = &_retired, *node; (node = *link); link = &node->next)
+	{
+		if ((s32)(epoch - node->epoch) >= 2)
+		{
+			*link = 0;
+
+			for (Retired *ready = node; ready; ready = ready->next)
+				--_retired_count;
+
+			return node;
+		}
+	}
+
+	return 0;
+}
+
+void EpochReclaim::ReleaseList(Retired *list)
+{
+	for (Retired *next, *node = list; node; node = next)
+	{
+		next = node->next;
+
+		node->releaser(node->object);
+
+		delete node;
+	}
+}
+
+void EpochReclaim::Retire(void *object, EpochReleaser releaser)
+{
+	Retired *node;
+	do node = new (std::nothrow) Retired;
+	while (!node);
+
+	node->object = object;
+	node->releaser = releaser;
+
+	_lock.Enter();
+
+	node->epoch = _epoch;
+	node->next = _retired;
+	_retired = node;
+	++_retired_count;
+
+	_lock.Leave();
+}
+
+void EpochReclaim::Reclaim()
+{
+	// Avoid the lock when nothing is waiting
+	if (!_retired_count) return;
+
+	_lock.Enter();
+
+	// Objects need two advances, so attempt both now
+	if (TryAdvance()) TryAdvance();
+
+	Retired *ready = CollectReady();
+
+	_lock.Leave();
+
+	// Release outside of the lock since releasers may retire more objects
+	ReleaseList(ready);
+}
+
+void EpochReclaim::Synchronize()
+{
+	_lock.Enter();
+
+	// Two advances past the current epoch covers everything retired so far
+	for (int advances = 0; advances < 2;)
+	{
+		if (TryAdvance())
+			++advances;
+		else
+		{
+#if defined(CAT_OS_WINDOWS)
+			SwitchToThread();
+#else
+			sched_yield();
+#endif
+		}
+	}
+
+	Retired *ready = CollectReady();
+
+	_lock.Leave();
+
+	ReleaseList(ready);
+}
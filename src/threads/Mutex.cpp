@@ -40,7 +40,14 @@ Mutex::Mutex()
 
 #else
 
-	init_failure = pthread_mutex_init(&mx, 0);
+	// Critical sections are recursive, and singleton initialization relies on it
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+
+	init_failure = pthread_mutex_init(&mx, &attr);
+
+	pthread_mutexattr_destroy(&attr);
 
 #endif
 }
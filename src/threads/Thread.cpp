@@ -214,13 +214,18 @@ void *Thread::ThreadWrapper(void *this_object)
 
 	CAT_DEBUG_CHECK_MEMORY();
 
-	thread_object->_thread_running = false;
-
 	// Invoke any thread-atexit() callbacks
 	thread_object->InvokeAtExit();
 
 	CAT_DEBUG_CHECK_MEMORY();
 
+	CAT_FENCE_COMPILER;
+
+	// Cleared last since WaitForThread() returns early once it is clear
+	thread_object->_thread_running = false;
+
+	CAT_FENCE_COMPILER;
+
 	return (void*)(success ? 0 : 1);
 }
 
@@ -397,7 +397,11 @@ bool WorkerThreads::OnInitialize()
 		// Start its thread
 		if (!_workers[ii].StartThread(this))
 		{
+#if defined(CAT_OS_WINDOWS)
 			CAT_WARN("WorkerThreads") << "StartThread error " << GetLastError();
+#else
+			CAT_WARN("WorkerThreads") << "StartThread error";
+#endif
 			return ii > 0; // Indicate success if at least one thread was started successfully
 		}
 
@@ -113,7 +113,12 @@ u32 Clock::msec_fast()
 
 #else
 
-	return msec();
+    struct timeval cateq_v;
+    struct timezone cateq_z;
+
+    gettimeofday(&cateq_v, &cateq_z);
+
+    return static_cast<u32>(1000.0 * static_cast<double>(cateq_v.tv_sec) + static_cast<double>(cateq_v.tv_usec) / 1000.0);
 
 #endif
 }
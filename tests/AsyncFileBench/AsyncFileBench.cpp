@@ -1,10 +1,20 @@
 #include <cat/AllAsyncIO.hpp>
 using namespace cat;
 
+#if !defined(CAT_OS_WINDOWS)
+# include <unistd.h> // unlink()
+#endif
+
 static SystemInfo *m_system_info = 0;
 static Clock *m_clock = 0;
 static LargeAllocator *m_large_allocator = 0;
 
+// Each chunk starts with its file offset, so reads can be checked
+static u32 m_bad_chunks = 0;
+
+static const u32 DEFAULT_FILE_MB = 200;
+static const int BENCH_TIMEOUT = 5 * 60 * 1000; // milliseconds
+
 class ReadTester
 {
 	u8 m_padding1[CAT_DEFAULT_CACHE_LINE_SIZE];
@@ -49,6 +59,12 @@ class ReadTester
 
 			if (data_bytes)
 			{
+				if (data_bytes < sizeof(u32) || *(u32*)data != (u32)buffer->offset)
+				{
+					CAT_WARN("AsyncFileBench") << "Read the wrong data at offset " << buffer->offset;
+					Atomic::Add(&m_bad_chunks, 1);
+				}
+
 				if (AccumulateFilePiece(data_bytes))
 				{
 					double delta = m_clock->usec() - m_start_time;
@@ -229,7 +245,7 @@ class WriteTester
 
 					_file->Destroy(CAT_REFOBJECT_TRACE);
 
-					Sleep(1000);
+					m_clock->sleep(1000);
 
 					_reader = new ReadTester(_flag);
 
@@ -241,6 +257,7 @@ class WriteTester
 					//CAT_WARN("AsyncFileBench") << "Wrote at " << buffer->offset << " bytes=" << data_bytes << " done=" << m_file_progress << "/" << m_file_total;
 
 					u32 offset = GetNextFileOffset();
+					*(u32*)data = offset;
 
 					if (offset < m_file_total && !_file->Write(buffer, offset, data, m_file_chunk_size))
 					{
@@ -281,7 +298,7 @@ public:
 		}
 	}
 
-	bool StartWriting(bool no_buffer, bool seq, u32 parallelism, u32 chunk_size, const char *file_path)
+	bool StartWriting(bool no_buffer, bool seq, u32 parallelism, u32 chunk_size, u32 file_bytes, const char *file_path)
 	{
 		// Start timing before file object is created
 		_no_buffer = no_buffer;
@@ -309,7 +326,11 @@ public:
 			return false;
 		}
 
+#if defined(CAT_OS_WINDOWS)
 		_unlink(file_path);
+#else
+		unlink(file_path);
+#endif
 
 		if (!_file->Open(file_path, ASYNCFILE_WRITE | (no_buffer ? ASYNCFILE_NOBUFFER : 0) | (seq ? ASYNCFILE_SEQUENTIAL : 0)))
 		{
@@ -317,7 +338,7 @@ public:
 			return false;
 		}
 
-		m_file_total = 200000000;
+		m_file_total = file_bytes;
 		m_file_total -= m_file_total % _chunk_size;
 		m_file_progress = 0;
 		m_file_offset = 0;
@@ -337,6 +358,8 @@ public:
 			}
 
 			u32 offset = GetNextFileOffset();
+			*(u32*)_data[ii] = offset;
+
 			if (!_file->Write(_buffers+ii, offset, _data[ii], m_file_chunk_size))
 			{
 				CAT_WARN("AsyncFileBench") << "Unable to write to offset " << offset;
@@ -355,6 +378,8 @@ public:
 
 
 
+#if defined(CAT_OS_WINDOWS)
+
 #include <winioctl.h>	// DeviceIoControl()
 
 
@@ -475,6 +500,8 @@ void GetCdRomDump()
 	}
 }
 
+#endif // CAT_OS_WINDOWS
+
 
 
 
@@ -493,6 +520,7 @@ bool Main(WriteTester *writer, char **argv, int argc)
 	int parallelism = 0;
 	int no_buffer = 0;
 	int seq = 0;
+	int file_mb = DEFAULT_FILE_MB;
 
 	if (argc >= 5)
 	{
@@ -500,11 +528,12 @@ bool Main(WriteTester *writer, char **argv, int argc)
 		seq = atoi(argv[2]);
 		parallelism = atoi(argv[3]);
 		chunk_size = atoi(argv[4]);
+		if (argc >= 6) file_mb = atoi(argv[5]);
 		file_path = "writer2.tst";
 	}
 	else
 	{
-		CAT_WARN("AsyncFileBench") << "Expected arguments: <no_buffer(1/0)> <seq(1/0)> <parallelism> <chunk size>";
+		CAT_WARN("AsyncFileBench") << "Expected arguments: <no_buffer(1/0)> <seq(1/0)> <parallelism> <chunk size> [file MB]";
 		return false;
 	}
 
@@ -514,13 +543,20 @@ bool Main(WriteTester *writer, char **argv, int argc)
 		return false;
 	}
 
-	if (chunk_size < 0 || !CAT_IS_POWER_OF_2(chunk_size))
+	if (chunk_size < (int)sizeof(u32) || !CAT_IS_POWER_OF_2(chunk_size))
 	{
 		CAT_WARN("AsyncFileBench") << "Chunk size needs to be a power of 2";
 		return false;
 	}
 
-	return writer->StartWriting(no_buffer != 0, seq != 0, parallelism, chunk_size, file_path);
+	// Every parallel write needs a chunk of its own
+	if (file_mb <= 0 || file_mb > 2000 || (u32)file_mb * 1000000 < (u32)chunk_size * parallelism)
+	{
+		CAT_WARN("AsyncFileBench") << "File size needs to be between parallelism * chunk size and 2000 MB";
+		return false;
+	}
+
+	return writer->StartWriting(no_buffer != 0, seq != 0, parallelism, chunk_size, file_mb * 1000000, file_path);
 }
 
 
@@ -645,12 +681,16 @@ int RunCRC7Tests()
 	return 0;
 }
 
+#if defined(CAT_OS_WINDOWS)
+
 void MeasureGetDiskFreeSpace()
 {
 	DWORD sectors_per_cluster, bytes_per_sector, number_of_free_clusters, total_number_of_clusters;
 	GetDiskFreeSpace(0, &sectors_per_cluster, &bytes_per_sector, &number_of_free_clusters, &total_number_of_clusters);
 }
 
+#endif // CAT_OS_WINDOWS
+
 int main(int argc, char **argv)
 {
 	RunCRC7Tests();
@@ -659,6 +699,7 @@ int main(int argc, char **argv)
 	m_clock = Clock::ref();
 	m_large_allocator = LargeAllocator::ref();
 
+#if defined(CAT_OS_WINDOWS)
 	u32 cycles_start = Clock::cycles();
 	DWORD sectors_per_cluster, bytes_per_sector, number_of_free_clusters, total_number_of_clusters;
 	GetDiskFreeSpace(0, &sectors_per_cluster, &bytes_per_sector, &number_of_free_clusters, &total_number_of_clusters);
@@ -667,6 +708,7 @@ int main(int argc, char **argv)
 	u32 cycles = Clock::MeasureClocks(1000, &MeasureGetDiskFreeSpace);
 
 	CAT_WARN("AsyncFileBench") << "GetDiskFreeSpace timing: first=" << cycles_end - cycles_start << " avg=" << cycles;
+#endif
 
 	CAT_WARN("AsyncFileBench") << "Allocation granularity = " << m_system_info->GetAllocationGranularity();
 	CAT_WARN("AsyncFileBench") << "Cache line bytes = " << m_system_info->GetCacheLineBytes();
@@ -674,17 +716,34 @@ int main(int argc, char **argv)
 	CAT_WARN("AsyncFileBench") << "Processor count = " << m_system_info->GetProcessorCount();
 	CAT_WARN("AsyncFileBench") << "Physical max sector size = " << m_system_info->GetMaxSectorSize();
 
+#if defined(CAT_OS_WINDOWS)
 	GetCdRomDump();
-	
+#endif
+
 	WaitableFlag flag;
 	WriteTester writer(&flag);
 
+	bool success = false;
+
 	if (Main(&writer, argv, argc))
 	{
-		flag.Wait();
+		if (!flag.Wait(BENCH_TIMEOUT))
+		{
+			CAT_WARN("AsyncFileBench") << "Timed out waiting for the file to be written and read back";
+		}
+		else if (m_bad_chunks)
+		{
+			CAT_WARN("AsyncFileBench") << m_bad_chunks << " chunks read back with the wrong data";
+		}
+		else
+		{
+			success = true;
+		}
 	}
 
-	cin.get();
+	// A scripted run (ctest) gives the file size and does not wait for a key
+	if (argc < 6)
+		cin.get();
 
-	return 0;
+	return success ? 0 : 1;
 }
@@ -0,0 +1,981 @@
+/*
+	Copyright (c) 2009-2010 Christopher A. Taylor.  All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	* Redistributions of source code must retain the above copyright notice,
+	  this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	* Neither the name of LibCat nor the names of its contributors may be used
+	  to endorse or promote products derived from this software without
+	  specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	Bombay database test
+
+	RecordCache checks run against the cache directly, since it is a
+	plain data structure with no IO:
+
+		A scan of records that are touched once must not evict records
+		that were promoted to the protected segment.
+		A Remove() or Store() while a read is in flight must win over
+		the data that the read brings back from disk.
+		A read that could not pin a node must not drop another read's pin.
+		GetStats() must count what happened.
+
+	Table checks write a small database file, query it back through the
+	IO threads, and reopen it to make sure the records and the saved
+	index survive.
+
+	QueryBatch checks read batches laid out around the gap and size limits
+	for coalescing misses into one read, and mix cache hits, misses and
+	failed reads in one batch that must complete with a single callback.
+
+	TableIndex checks grow an index through several incremental resizes
+	while looking up and removing keys, and damage one chunk of a saved
+	index to make sure it is detected and rebuilt from the database.
+*/
+
+#include <cat/AllBombay.hpp>
+#include <cstdio>
+using namespace cat;
+using namespace bombay;
+
+static Clock *m_clock = 0;
+
+static const u32 RECORD_BYTES = 64;
+static const u32 WAIT_MSEC = 10000;
+
+static const char *DB_PATH = "BombayTest.db";
+static const char *INDEX_PATH = "BombayTest.idx";
+
+
+//// Records
+
+// Record key is the first word; zero marks a removed record
+static void MakeRecord(u8 *record, u32 key, u32 version)
+{
+	*reinterpret_cast<u32*>( record ) = key;
+
+	for (u32 ii = 4; ii < RECORD_BYTES; ++ii)
+		record[ii] = (u8)(key * 7 + version * 13 + ii);
+}
+
+static bool CheckRecord(const u8 *record, u32 key, u32 version)
+{
+	u8 expected[RECORD_BYTES];
+	MakeRecord(expected, key, version);
+
+	return memcmp(record, expected, RECORD_BYTES) == 0;
+}
+
+DECL_BOMBAY_SCHEMA_FIXED_FIELD_HASH(KeyHash);
+
+u64 KeyHash::HashField(const void *just_field)
+{
+	u32 key = *reinterpret_cast<const u32*>( just_field );
+	if (!key) return 0;
+
+	// Never zero, since a zero hash is ignored by the index
+	return MurmurHash(&key, sizeof(key)).Get64() | 1;
+}
+
+u64 KeyHash::HashComplete(const void *complete_record)
+{
+	return HashField(complete_record);
+}
+
+
+//// RecordCache
+
+static bool CheckScanResistance()
+{
+	RecordCache cache;
+	if (!cache.Initialize(RECORD_BYTES, 0))
+	{
+		CAT_WARN("BombayTest") << "Unable to initialize cache";
+		return false;
+	}
+
+	const u32 HOT = 48, SCAN = 4096;
+	u8 record[RECORD_BYTES];
+	bool pinned;
+
+	// Store the working set and touch it so that it is promoted
+	for (u32 ii = 0; ii < HOT; ++ii)
+	{
+		MakeRecord(record, ii + 1, 0);
+		cache.Store(ii * RECORD_BYTES, record);
+
+		if (!cache.Lookup(ii * RECORD_BYTES, record, pinned))
+		{
+			CAT_WARN("BombayTest") << "FAILURE: Stored record " << ii << " missed in cache";
+			return false;
+		}
+	}
+
+	// Scan many more records than the cache holds, reading each one once
+	for (u32 ii = 0; ii < SCAN; ++ii)
+	{
+		u64 offset = (HOT + ii) * (u64)RECORD_BYTES;
+
+		if (cache.Lookup(offset, record, pinned))
+		{
+			CAT_WARN("BombayTest") << "FAILURE: Scan record " << ii << " hit before it was read";
+			return false;
+		}
+
+		MakeRecord(record, HOT + ii + 1, 0);
+		cache.Fill(offset, record, pinned);
+	}
+
+	CacheStats stats;
+	cache.GetStats(stats);
+
+	if (stats.evictions < SCAN - cache.GetCacheBytes() / RECORD_BYTES)
+	{
+		CAT_WARN("BombayTest") << "FAILURE: Scan only evicted " << stats.evictions << " records";
+		return false;
+	}
+
+	// The working set must have survived the scan
+	for (u32 ii = 0; ii < HOT; ++ii)
+	{
+		if (!cache.Peek(ii * RECORD_BYTES, record) || !CheckRecord(record, ii + 1, 0))
+		{
+			CAT_WARN("BombayTest") << "FAILURE: Scan evicted protected record " << ii;
+			return false;
+		}
+	}
+
+	CAT_INFO("BombayTest") << "Scan of " << SCAN << " records made " << stats.evictions << " evictions and kept all " << HOT << " protected records";
+
+	return true;
+}
+
+static bool CheckInFlightWrites()
+{
+	RecordCache cache;
+	if (!cache.Initialize(RECORD_BYTES, 0))
+		return false;
+
+	u8 record[RECORD_BYTES];
+	bool pinned_a, pinned_b;
+	CacheStats stats;
+
+	// Remove while two reads share a pin
+	const u64 removed = 10 * RECORD_BYTES;
+
+	if (cache.Lookup(removed, record, pinned_a) || !pinned_a ||
+		cache.Lookup(removed, record, pinned_b) || !pinned_b)
+	{
+		CAT_WARN("BombayTest") << "FAILURE: Misses were not pinned";
+		return false;
+	}
+
+	cache.Remove(removed);
+
+	MakeRecord(record, 11, 0);
+	cache.Fill(removed, record, pinned_a);
+
+	if (cache.Peek(removed, record))
+	{
+		CAT_WARN("BombayTest") << "FAILURE: Read cached a record removed while it was in flight";
+		return false;
+	}
+
+	cache.Unpin(removed);
+
+	cache.GetStats(stats);
+	if (stats.pinned != 0 || stats.resident != 0)
+	{
+		CAT_WARN("BombayTest") << "FAILURE: Removed record left " << stats.pinned << " pinned and " << stats.resident << " resident nodes";
+		return false;
+	}
+
+	// Store while a read is in flight
+	const u64 stored = 20 * RECORD_BYTES;
+
+	if (cache.Lookup(stored, record, pinned_a) || !pinned_a)
+		return false;
+
+	MakeRecord(record, 21, 1);
+	cache.Store(stored, record);
+
+	// The read brings back the older copy from disk
+	MakeRecord(record, 21, 0);
+	cache.Fill(stored, record, pinned_a);
+
+	if (!CheckRecord(record, 21, 1))
+	{
+		CAT_WARN("BombayTest") << "FAILURE: Read did not return the record stored while it was in flight";
+		return false;
+	}
+
+	if (!cache.Peek(stored, record) || !CheckRecord(record, 21, 1))
+	{
+		CAT_WARN("BombayTest") << "FAILURE: Read overwrote the record stored while it was in flight";
+		return false;
+	}
+
+	return true;
+}
+
+static bool CheckPinFailures()
+{
+	RecordCache cache;
+	if (!cache.Initialize(RECORD_BYTES, 0))
+		return false;
+
+	const u32 READS = 2048;
+	u8 record[RECORD_BYTES];
+	bool pinned[READS];
+
+	// Start far more reads than there are nodes, so every stripe fills with pins
+	u32 failed = READS;
+	for (u32 ii = 0; ii < READS; ++ii)
+	{
+		cache.Lookup(ii * (u64)RECORD_BYTES, record, pinned[ii]);
+
+		if (!pinned[ii] && failed == READS)
+			failed = ii;
+	}
+
+	if (failed == READS)
+	{
+		CAT_WARN("BombayTest") << "FAILURE: No read failed to pin";
+		return false;
+	}
+
+	// Finish the pinned reads so that the unpinned one can be retried
+	for (u32 ii = 0; ii < READS; ++ii)
+		if (pinned[ii]) cache.Unpin(ii * (u64)RECORD_BYTES);
+
+	const u64 offset = failed * (u64)RECORD_BYTES;
+
+	bool retry_pinned;
+	if (cache.Lookup(offset, record, retry_pinned) || !retry_pinned)
+	{
+		CAT_WARN("BombayTest") << "FAILURE: Retried read was not pinned";
+		return false;
+	}
+
+	// The first read completes without a pin: it must leave the retry's pin alone
+	MakeRecord(record, failed + 1, 0);
+	cache.Fill(offset, record, false);
+
+	CacheStats stats;
+	cache.GetStats(stats);
+
+	if (stats.pinned != 1)
+	{
+		CAT_WARN("BombayTest") << "FAILURE: Unpinned read dropped another read's pin";
+		return false;
+	}
+
+	cache.Fill(offset, record, retry_pinned);
+
+	cache.GetStats(stats);
+
+	if (stats.pinned != 0 || !cache.Peek(offset, record) || !CheckRecord(record, failed + 1, 0))
+	{
+		CAT_WARN("BombayTest") << "FAILURE: Pinned read was not cached";
+		return false;
+	}
+
+	CAT_INFO("BombayTest") << "Counted " << stats.pin_failures << " pin failures for " << READS << " concurrent reads";
+
+	return stats.pin_failures > 0;
+}
+
+static bool CheckStats()
+{
+	RecordCache cache;
+	if (!cache.Initialize(RECORD_BYTES, 0))
+		return false;
+
+	u8 record[RECORD_BYTES];
+	bool pinned;
+	CacheStats stats;
+
+	for (u32 ii = 0; ii < 10; ++ii)
+	{
+		MakeRecord(record, ii + 1, 0);
+		cache.Store(ii * RECORD_BYTES, record);
+	}
+
+	for (u32 ii = 0; ii < 10; ++ii)
+		cache.Lookup(ii * RECORD_BYTES, record, pinned);
+
+	for (u32 ii = 10; ii < 15; ++ii)
+		cache.Lookup(ii * RECORD_BYTES, record, pinned);
+
+	cache.GetStats(stats);
+
+	if (stats.hits != 10 || stats.misses != 5 || stats.promotions != 10 ||
+		stats.pinned != 5 || stats.resident != 10 || stats.evictions != 0 || stats.pin_failures != 0)
+	{
+		CAT_WARN("BombayTest") << "FAILURE: Stats after lookups: hits=" << stats.hits << " misses=" << stats.misses
+			<< " promotions=" << stats.promotions << " pinned=" << stats.pinned << " resident=" << stats.resident;
+		return false;
+	}
+
+	for (u32 ii = 10; ii < 15; ++ii)
+	{
+		MakeRecord(record, ii + 1, 0);
+		cache.Fill(ii * RECORD_BYTES, record, true);
+	}
+
+	// Peek does not count as a reference
+	cache.Peek(0, record);
+
+	cache.GetStats(stats);
+
+	if (stats.hits != 10 || stats.misses != 5 || stats.pinned != 0 || stats.resident != 15)
+	{
+		CAT_WARN("BombayTest") << "FAILURE: Stats after reads: hits=" << stats.hits << " misses=" << stats.misses
+			<< " pinned=" << stats.pinned << " resident=" << stats.resident;
+		return false;
+	}
+
+	return true;
+}
+
+
+//// Table
+
+static volatile u32 m_tables_finalized = 0;
+
+class TestTable : public Table
+{
+	virtual bool OnFinalize()
+	{
+		bool result = Table::OnFinalize();
+
+		Atomic::Add(&m_tables_finalized, 1);
+
+		return result;
+	}
+};
+
+static TestTable *OpenTable(u32 cache_bytes, TableIndex **key_index = 0)
+{
+	TestTable *table;
+	if (!RefObjects::Create(CAT_REFOBJECT_TRACE, table))
+	{
+		CAT_WARN("BombayTest") << "Unable to create table";
+		return 0;
+	}
+
+	TableIndex *index = table->MakeIndex<KeyHash>(INDEX_PATH, true);
+
+	if (!index || !table->Initialize(DB_PATH, RECORD_BYTES, cache_bytes))
+	{
+		CAT_WARN("BombayTest") << "Unable to initialize table";
+		table->Destroy(CAT_REFOBJECT_TRACE);
+		return 0;
+	}
+
+	if (key_index) *key_index = index;
+
+	return table;
+}
+
+// Destroy the table and wait for its reads and writes to finish and its index to be saved
+static bool CloseTable(TestTable *table)
+{
+	u32 finalized = m_tables_finalized;
+
+	table->Destroy(CAT_REFOBJECT_TRACE);
+
+	u32 end_msec = m_clock->msec() + WAIT_MSEC;
+	while (m_tables_finalized == finalized)
+	{
+		if ((s32)(m_clock->msec() - end_msec) >= 0)
+		{
+			CAT_WARN("BombayTest") << "FAILURE: Timed out waiting for table to close";
+			return false;
+		}
+
+		Clock::sleep(1);
+	}
+
+	return true;
+}
+
+static bool WaitForIndexing(Table *table)
+{
+	u32 end_msec = m_clock->msec() + WAIT_MSEC;
+	while (table->IsIndexing())
+	{
+		if ((s32)(m_clock->msec() - end_msec) >= 0)
+		{
+			CAT_WARN("BombayTest") << "FAILURE: Timed out waiting for indexing";
+			return false;
+		}
+
+		Clock::sleep(1);
+	}
+
+	return true;
+}
+
+class QueryChecker
+{
+	volatile u32 _completed, _failed;
+
+	bool OnQuery(ThreadLocalStorage *tls, bool success, QueryBuffer *buffer)
+	{
+		u32 key = (u32)(buffer->GetOffset() / RECORD_BYTES) + 1;
+
+		if (!success || !CheckRecord(buffer->GetData(), key, 0))
+			Atomic::Add(&_failed, 1);
+
+		Atomic::Add(&_completed, 1);
+
+		return true;
+	}
+
+public:
+	QueryChecker()
+	{
+		_completed = 0;
+		_failed = 0;
+	}
+
+	CAT_INLINE u32 GetFailed() { return _failed; }
+
+	bool Query(Table *table, u64 offset)
+	{
+		QueryBuffer *buffer = QueryBuffer::Acquire(RECORD_BYTES);
+		if (!buffer) return false;
+
+		buffer->SetCallback(QueryCallback::FromMember<QueryChecker, &QueryChecker::OnQuery>(this));
+
+		if (!table->Query(offset, buffer))
+		{
+			buffer->Release();
+			return false;
+		}
+
+		return true;
+	}
+
+	bool Wait(u32 count)
+	{
+		u32 end_msec = m_clock->msec() + WAIT_MSEC;
+		while (_completed < count)
+		{
+			if ((s32)(m_clock->msec() - end_msec) >= 0)
+			{
+				CAT_WARN("BombayTest") << "FAILURE: Timed out with " << _completed << " of " << count << " queries complete";
+				return false;
+			}
+
+			Clock::sleep(1);
+		}
+
+		return true;
+	}
+};
+
+static bool CheckTableRoundTrip()
+{
+	const u32 RECORDS = 1000;
+
+	remove(DB_PATH);
+	remove(INDEX_PATH);
+
+	TestTable *table = OpenTable(0);
+	if (!table) return false;
+
+	u8 record[RECORD_BYTES];
+
+	for (u32 ii = 0; ii < RECORDS; ++ii)
+	{
+		MakeRecord(record, ii + 1, 0);
+
+		if (table->Insert(record) != ii * (u64)RECORD_BYTES)
+		{
+			CAT_WARN("BombayTest") << "FAILURE: Insert of record " << ii << " landed at the wrong offset";
+			CloseTable(table);
+			return false;
+		}
+	}
+
+	// A duplicate key is refused by the unique index
+	MakeRecord(record, 1, 0);
+	if (table->Insert(record) != INVALID_RECORD_OFFSET)
+	{
+		CAT_WARN("BombayTest") << "FAILURE: Duplicate key was inserted";
+		CloseTable(table);
+		return false;
+	}
+
+	if (!CloseTable(table)) return false;
+
+	// Reopen with a cold cache, so every query goes to disk
+	table = OpenTable(0);
+	if (!table) return false;
+
+	// The index saved at close must still know every key
+	for (u32 ii = 0; ii < RECORDS; ++ii)
+	{
+		MakeRecord(record, ii + 1, 0);
+
+		if (table->Insert(record) != INVALID_RECORD_OFFSET)
+		{
+			CAT_WARN("BombayTest") << "FAILURE: Reopened index lost key " << ii + 1;
+			CloseTable(table);
+			return false;
+		}
+	}
+
+	QueryChecker checker;
+
+	for (u32 ii = 0; ii < RECORDS; ++ii)
+	{
+		if (!checker.Query(table, ii * (u64)RECORD_BYTES))
+		{
+			CAT_WARN("BombayTest") << "FAILURE: Unable to queue query " << ii;
+			CloseTable(table);
+			return false;
+		}
+	}
+
+	bool success = checker.Wait(RECORDS) && checker.GetFailed() == 0;
+
+	CacheStats stats;
+	table->GetCacheStats(stats);
+
+	CAT_INFO("BombayTest") << "Queried " << RECORDS << " records from disk: " << checker.GetFailed() << " wrong, "
+		<< stats.hits << " hits, " << stats.misses << " misses";
+
+	return CloseTable(table) && success;
+}
+
+
+//// QueryBatch
+
+class BatchChecker
+{
+	volatile u32 _callbacks;
+	BatchQuery *_batch;
+	bool _on_worker;
+
+	void OnBatch(ThreadLocalStorage *tls, BatchQuery *batch)
+	{
+		_batch = batch;
+		_on_worker = tls != 0;
+
+		Atomic::Add(&_callbacks, 1);
+	}
+
+public:
+	BatchChecker()
+	{
+		_callbacks = 0;
+		_batch = 0;
+		_on_worker = false;
+	}
+
+	CAT_INLINE u32 GetCallbacks() { return _callbacks; }
+	CAT_INLINE bool OnWorker() { return _on_worker; }
+
+	// Query the records in the order given
+	BatchQuery *Start(Table *table, const u32 *records, u32 count)
+	{
+		BatchQuery *batch = BatchQuery::Acquire(count, RECORD_BYTES);
+		if (!batch) return 0;
+
+		for (u32 ii = 0; ii < count; ++ii)
+			batch->SetOffset(ii, records[ii] * (u64)RECORD_BYTES);
+
+		batch->SetCallback(BatchQueryCallback::FromMember<BatchChecker, &BatchChecker::OnBatch>(this));
+
+		table->QueryBatch(batch);
+
+		return batch;
+	}
+
+	// Query the records and wait for the batch to complete
+	BatchQuery *Run(Table *table, const u32 *records, u32 count)
+	{
+		BatchQuery *batch = Start(table, records, count);
+		if (!batch) return 0;
+
+		u32 end_msec = m_clock->msec() + WAIT_MSEC;
+		while (!_callbacks)
+		{
+			if ((s32)(m_clock->msec() - end_msec) >= 0)
+			{
+				CAT_WARN("BombayTest") << "FAILURE: Timed out waiting for batch of " << count << " records";
+				return 0;
+			}
+
+			Clock::sleep(1);
+		}
+
+		// Give a second callback time to show up
+		Clock::sleep(20);
+
+		if (_callbacks != 1 || _batch != batch)
+		{
+			CAT_WARN("BombayTest") << "FAILURE: Batch completed with " << _callbacks << " callbacks";
+			return 0;
+		}
+
+		return batch;
+	}
+};
+
+// Runs a batch of records that are not cached and checks the number of disk reads
+static bool CheckBatchReads(Table *table, const u32 *records, u32 count, u32 expected_reads, const char *name)
+{
+	BatchChecker checker;
+
+	BatchQuery *batch = checker.Run(table, records, count);
+	if (!batch) return false;
+
+	bool success = true;
+
+	for (u32 ii = 0; ii < count; ++ii)
+	{
+		BatchQueryItem &item = batch->GetItem(ii);
+
+		if (!item.Succeeded() || !CheckRecord(item.GetData(), records[ii] + 1, 0))
+		{
+			CAT_WARN("BombayTest") << "FAILURE: " << name << " returned the wrong data for record " << records[ii];
+			success = false;
+			break;
+		}
+	}
+
+	if (batch->GetCacheHits() != 0 || batch->GetDiskReads() != expected_reads)
+	{
+		CAT_WARN("BombayTest") << "FAILURE: " << name << " made " << batch->GetDiskReads() << " disk reads and "
+			<< batch->GetCacheHits() << " cache hits, expected " << expected_reads << " reads";
+		success = false;
+	}
+
+	batch->Release();
+
+	return success;
+}
+
+static bool CheckQueryBatch()
+{
+	const u32 RECORDS = 4000;
+
+	remove(DB_PATH);
+	remove(INDEX_PATH);
+
+	TestTable *table = OpenTable(0);
+	if (!table) return false;
+
+	u8 record[RECORD_BYTES];
+
+	for (u32 ii = 0; ii < RECORDS; ++ii)
+	{
+		MakeRecord(record, ii + 1, 0);
+		table->Insert(record);
+	}
+
+	if (!CloseTable(table)) return false;
+
+	// Reopen so that every batch starts with a cold cache
+	table = OpenTable(0);
+	if (!table) return false;
+
+	// 64-byte records: a miss joins the run if it starts within 4096 bytes
+	// (64 records) of the run end, and the run stays within 65536 bytes (1024 records).
+	// Each case uses records that no earlier case has touched
+	static const u32 GAP_JOINED[] = { 165, 100 };	// 165 starts exactly 4096 bytes after 100 ends
+	static const u32 GAP_SPLIT[] = { 366, 300 };	// 366 starts 4160 bytes after 300 ends
+
+	u32 *size_records = new u32[1025];
+
+	bool success = CheckBatchReads(table, GAP_JOINED, 2, 1, "Batch at the read gap limit") &&
+				   CheckBatchReads(table, GAP_SPLIT, 2, 2, "Batch past the read gap limit");
+
+	// Exactly 65536 bytes of records, listed in reverse
+	for (u32 ii = 0; ii < 1024; ++ii)
+		size_records[ii] = 2023 - ii;
+
+	success = success && CheckBatchReads(table, size_records, 1024, 1, "Batch at the read size limit");
+
+	// One record more
+	for (u32 ii = 0; ii < 1025; ++ii)
+		size_records[ii] = 3124 - ii;
+
+	success = success && CheckBatchReads(table, size_records, 1025, 2, "Batch past the read size limit");
+
+	delete []size_records;
+
+	// Warm up a few records
+	static const u32 WARM[] = { 3500, 3501, 3502, 3503 };
+
+	success = success && CheckBatchReads(table, WARM, 4, 1, "Warm-up batch");
+
+	// Mix cache hits, two neighbouring misses and a record past the end of the file
+	static const u32 MIXED[] = { 3601, 3502, RECORDS + 10000, 3500, 3600, 3503, 3501 };
+	const u32 MIXED_COUNT = sizeof(MIXED) / sizeof(MIXED[0]);
+
+	BatchChecker mixed_checker;
+	BatchQuery *batch = success ? mixed_checker.Run(table, MIXED, MIXED_COUNT) : 0;
+
+	if (batch)
+	{
+		for (u32 ii = 0; ii < MIXED_COUNT; ++ii)
+		{
+			BatchQueryItem &item = batch->GetItem(ii);
+			bool exists = MIXED[ii] < RECORDS;
+
+			if (item.Succeeded() != exists ||
+				(exists && !CheckRecord(item.GetData(), MIXED[ii] + 1, 0)))
+			{
+				CAT_WARN("BombayTest") << "FAILURE: Mixed batch returned the wrong result for record " << MIXED[ii];
+				success = false;
+			}
+		}
+
+		if (batch->GetCacheHits() != 4 || batch->GetDiskReads() != 2 || !mixed_checker.OnWorker())
+		{
+			CAT_WARN("BombayTest") << "FAILURE: Mixed batch made " << batch->GetDiskReads() << " disk reads and "
+				<< batch->GetCacheHits() << " cache hits";
+			success = false;
+		}
+
+		batch->Release();
+	}
+	else success = false;
+
+	// A batch of only cache hits completes before QueryBatch() returns
+	BatchChecker hit_checker;
+	BatchQuery *hits = success ? hit_checker.Start(table, WARM, 4) : 0;
+	if (hits)
+	{
+		if (hit_checker.GetCallbacks() != 1 || hit_checker.OnWorker() ||
+			hits->GetCacheHits() != 4 || hits->GetDiskReads() != 0)
+		{
+			CAT_WARN("BombayTest") << "FAILURE: Batch of cache hits did not complete immediately";
+			success = false;
+		}
+
+		hits->Release();
+	}
+
+	if (success)
+		CAT_INFO("BombayTest") << "Batched queries coalesced reads at the gap and size limits";
+
+	return CloseTable(table) && success;
+}
+
+
+//// TableIndex
+
+static CAT_INLINE u64 GetTestHash(u32 key)
+{
+	return MurmurHash(&key, sizeof(key), 1).Get64() | 1;
+}
+
+// Key ii is removed a few inserts after it goes in if ii % 3 == 0
+static CAT_INLINE bool IsRemovedKey(u32 key)
+{
+	return key % 3 == 0;
+}
+
+static bool CheckIndexGrowth()
+{
+	// 20000 keys grow the 64-bucket minimum table five times, and each
+	// resize is drained over the following operations
+	const u32 KEYS = 20000, REMOVE_LAG = 5;
+
+	remove(DB_PATH);
+	remove(INDEX_PATH);
+
+	TableIndex *index;
+	TestTable *table = OpenTable(0, &index);
+	if (!table) return false;
+
+	if (!WaitForIndexing(table))
+	{
+		CloseTable(table);
+		return false;
+	}
+
+	for (u32 ii = 0; ii < KEYS; ++ii)
+	{
+		index->Insert(GetTestHash(ii), ii * (u64)RECORD_BYTES);
+
+		if (ii >= REMOVE_LAG && IsRemovedKey(ii - REMOVE_LAG))
+			index->Remove(GetTestHash(ii - REMOVE_LAG));
+
+		// Look up the new key, an older live key and an older removed key
+		u32 older = ii / 2, removed = older - older % 3;
+
+		if (index->Lookup(GetTestHash(ii)) != ii * (u64)RECORD_BYTES ||
+			(!IsRemovedKey(older) && index->Lookup(GetTestHash(older)) != older * (u64)RECORD_BYTES) ||
+			(removed + REMOVE_LAG <= ii && index->Lookup(GetTestHash(removed)) != INVALID_RECORD_OFFSET))
+		{
+			CAT_WARN("BombayTest") << "FAILURE: Index lookup was wrong after inserting key " << ii;
+			CloseTable(table);
+			return false;
+		}
+	}
+
+	for (u32 ii = 0; ii < KEYS; ++ii)
+	{
+		u64 expected = (IsRemovedKey(ii) && ii + REMOVE_LAG < KEYS) ? INVALID_RECORD_OFFSET : ii * (u64)RECORD_BYTES;
+
+		if (index->Lookup(GetTestHash(ii)) != expected)
+		{
+			CAT_WARN("BombayTest") << "FAILURE: Index lookup was wrong for key " << ii << " after growth";
+			CloseTable(table);
+			return false;
+		}
+	}
+
+	CAT_INFO("BombayTest") << "Index grew to " << KEYS << " keys with lookups and removes during each resize";
+
+	return CloseTable(table);
+}
+
+static bool CheckIndexCorruption()
+{
+	// Enough records for the saved index to span more than one chunk
+	const u32 RECORDS = 5000;
+
+	remove(DB_PATH);
+	remove(INDEX_PATH);
+
+	TableIndex *index;
+	TestTable *table = OpenTable(0, &index);
+	if (!table) return false;
+
+	u8 record[RECORD_BYTES];
+
+	for (u32 ii = 0; ii < RECORDS; ++ii)
+	{
+		MakeRecord(record, ii + 1, 0);
+
+		if (table->Insert(record) == INVALID_RECORD_OFFSET)
+		{
+			CAT_WARN("BombayTest") << "FAILURE: Unable to insert record " << ii;
+			CloseTable(table);
+			return false;
+		}
+	}
+
+	if (!CloseTable(table)) return false;
+
+	// Flip a byte in the last chunk of buckets, leaving the chunk checksums and footer intact
+	FILE *file = fopen(INDEX_PATH, "r+b");
+	if (!file)
+	{
+		CAT_WARN("BombayTest") << "FAILURE: Index file was not saved";
+		return false;
+	}
+
+	u64 footer[3]; // Used elements, bucket count, footer checksum
+	fseek(file, -(long)sizeof(footer), SEEK_END);
+	if (fread(footer, 1, sizeof(footer), file) != sizeof(footer) || footer[1] < 512)
+	{
+		CAT_WARN("BombayTest") << "FAILURE: Saved index is too small to have several chunks";
+		fclose(file);
+		return false;
+	}
+
+	const long BUCKET_BYTES = 272;
+	long damaged = (long)(footer[1] - 1) * BUCKET_BYTES + 100;
+
+	u8 byte;
+	fseek(file, damaged, SEEK_SET);
+	fread(&byte, 1, 1, file);
+	byte ^= 0x55;
+	fseek(file, damaged, SEEK_SET);
+	fwrite(&byte, 1, 1, file);
+	fclose(file);
+
+	table = OpenTable(0, &index);
+	if (!table) return false;
+
+	// Touching the index loads every chunk, finds the damage and starts a rebuild
+	u32 misses = 0;
+	for (u32 ii = 0; ii < RECORDS; ++ii)
+	{
+		MakeRecord(record, ii + 1, 0);
+
+		if (index->LookupComplete(record) == INVALID_RECORD_OFFSET)
+			++misses;
+	}
+
+	if (!misses)
+	{
+		CAT_WARN("BombayTest") << "FAILURE: Damaged index chunk was not detected";
+		CloseTable(table);
+		return false;
+	}
+
+	if (!WaitForIndexing(table))
+	{
+		CloseTable(table);
+		return false;
+	}
+
+	for (u32 ii = 0; ii < RECORDS; ++ii)
+	{
+		MakeRecord(record, ii + 1, 0);
+
+		if (index->LookupComplete(record) != ii * (u64)RECORD_BYTES)
+		{
+			CAT_WARN("BombayTest") << "FAILURE: Rebuilt index lost record " << ii;
+			CloseTable(table);
+			return false;
+		}
+	}
+
+	CAT_INFO("BombayTest") << "Damaged index chunk hid " << misses << " records until the index was rebuilt";
+
+	return CloseTable(table);
+}
+
+
+int main()
+{
+	m_clock = Clock::ref();
+
+	CAT_INFO("BombayTest") << "BombayTest 1.0";
+
+	bool success = CheckScanResistance() &&
+				   CheckInFlightWrites() &&
+				   CheckPinFailures() &&
+				   CheckStats() &&
+				   CheckTableRoundTrip() &&
+				   CheckQueryBatch() &&
+				   CheckIndexGrowth() &&
+				   CheckIndexCorruption();
+
+	remove(DB_PATH);
+	remove(INDEX_PATH);
+
+	CAT_INFO("BombayTest") << (success ? "SUCCESS" : "FAILURE");
+
+	return success ? 0 : 1;
+}
@@ -0,0 +1,282 @@
+/*
+	Copyright (c) 2012 Christopher A. Taylor.  All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	* Redistributions of source code must retain the above copyright notice,
+	  this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	* Neither the name of LibCat nor the names of its contributors may be used
+	  to endorse or promote products derived from this software without
+	  specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	Collexion snapshot churn test
+
+	Reader threads walk member snapshots and subsets and check every
+	member they see, while the main thread removes and re-inserts members
+	200k times and a ticker thread calls Collexion::Reclaim() like a
+	server tick.  A member whose last reference was dropped while a reader
+	could still see it shows up as a bad magic number, or as a
+	use-after-free when built with -fsanitize=address.  Afterwards every
+	member must be finalized, so removed references are not leaked.
+*/
+
+#include <cat/AllSphynx.hpp>
+using namespace cat;
+using namespace sphynx;
+
+static Clock *m_clock = 0;
+
+static const u32 CHURN = 200000;
+static const u32 SLOTS = 500;
+static const int READER_THREADS = 3;
+static const u32 MAGIC = 0x600dc0de;
+
+
+//// TestConnexion
+
+class TestConnexion;
+
+static Collexion<TestConnexion> *m_collexion = 0;
+static volatile u32 m_created = 0, m_finalized = 0;
+
+class TestConnexion : public Connexion
+{
+public:
+	volatile u32 _magic;
+
+	TestConnexion() { _magic = MAGIC; }
+	~TestConnexion() { _magic = 0; }
+
+	CAT_INLINE const char *GetRefObjectName() { return "TestConnexion"; }
+
+	// Leave the Collexion on shutdown, like a game connexion
+	virtual void OnDestroy() { m_collexion->Remove(this); }
+
+	virtual bool OnFinalize()
+	{
+		Atomic::Add(&m_finalized, 1);
+		return Connexion::OnFinalize();
+	}
+
+	virtual void OnConnect() {}
+	virtual void OnMessages(IncomingMessage msgs[], u32 count) {}
+	virtual void OnCycle(u32 now) {}
+	virtual void OnDisconnectReason(u8 reason) {}
+};
+
+
+//// CollexionTest
+
+namespace cat {
+
+namespace sphynx {
+
+class CollexionTest
+{
+public:
+	static TestConnexion *Connect(u32 index)
+	{
+		TestConnexion *conn;
+		if (!RefObjects::Create(CAT_REFOBJECT_TRACE, conn))
+			return 0;
+
+		Atomic::Add(&m_created, 1);
+
+		// Spread members over the workers as Server does
+		conn->_worker_id = index % WorkerThreads::ref()->GetWorkerCount();
+
+		if (!m_collexion->Insert(conn))
+		{
+			conn->Destroy(CAT_REFOBJECT_TRACE);
+			return 0;
+		}
+
+		return conn;
+	}
+};
+
+} // namespace sphynx
+
+} // namespace cat
+
+
+static CAT_INLINE bool Valid(TestConnexion *conn, u32 worker_count)
+{
+	return conn && conn->_magic == MAGIC && conn->GetWorkerID() < worker_count;
+}
+
+
+//// ReaderThread
+
+class ReaderThread : public Thread
+{
+public:
+	volatile bool _stop;
+	u32 _walks, _members, _errors;
+
+	bool Entrypoint(void *param)
+	{
+		const u32 worker_count = WorkerThreads::ref()->GetWorkerCount();
+		BinnedConnexionSubset subset;
+
+		_walks = 0;
+		_members = 0;
+		_errors = 0;
+
+		while (!_stop)
+		{
+			// Mostly snapshots, as broadcasts use them
+			{
+				AutoCollexionSnapshot<TestConnexion> snapshot(*m_collexion);
+
+				for (int ii = 0, count = snapshot.Count(); ii < count; ++ii)
+					if (!Valid(snapshot[ii], worker_count))
+						++_errors;
+
+				_members += snapshot.Count();
+
+				// Sometimes stay inside while members are removed
+				if ((_walks & 63) == 0)
+				{
+					Clock::sleep(1);
+
+					for (int ii = 0, count = snapshot.Count(); ii < count; ++ii)
+						if (!Valid(snapshot[ii], worker_count))
+							++_errors;
+				}
+			}
+
+			// Sometimes a subset, whose removed members wait for SubsetRelease()
+			if ((_walks & 15) == 0 && m_collexion->BinnedSubsetAcquire(subset) > 0)
+			{
+				for (int worker = 0; worker < subset.WorkerCount(); ++worker)
+					for (int ii = 0, count = subset[worker].Count(); ii < count; ++ii)
+						if (!Valid(static_cast<TestConnexion*>(subset[worker][ii]), worker_count))
+							++_errors;
+
+				m_collexion->SubsetRelease();
+			}
+
+			++_walks;
+		}
+
+		return true;
+	}
+};
+
+
+//// TickerThread
+
+class TickerThread : public Thread
+{
+public:
+	volatile bool _stop;
+
+	bool Entrypoint(void *param)
+	{
+		while (!_stop)
+		{
+			m_collexion->Reclaim();
+
+			Clock::sleep(1);
+		}
+
+		return true;
+	}
+};
+
+
+//// Test
+
+int main()
+{
+	m_clock = Clock::ref();
+
+	CAT_INFO("CollexionTest") << "CollexionTest 1.0: " << CHURN << " removals across " << SLOTS << " members";
+
+	m_collexion = new Collexion<TestConnexion>;
+
+	TestConnexion *slots[SLOTS];
+	for (u32 ii = 0; ii < SLOTS; ++ii)
+		slots[ii] = CollexionTest::Connect(ii);
+
+	ReaderThread readers[READER_THREADS];
+	for (int ii = 0; ii < READER_THREADS; ++ii)
+	{
+		readers[ii]._stop = false;
+		readers[ii].StartThread();
+	}
+
+	TickerThread ticker;
+	ticker._stop = false;
+	ticker.StartThread();
+
+	Abyssinian prng;
+	prng.Initialize(0);
+
+	double start = m_clock->usec();
+
+	// Disconnect a random member and connect a new one in its place
+	for (u32 ii = 0; ii < CHURN; ++ii)
+	{
+		u32 slot = prng.Next() % SLOTS;
+
+		if (slots[slot]) slots[slot]->Destroy(CAT_REFOBJECT_TRACE);
+
+		slots[slot] = CollexionTest::Connect(slot);
+	}
+
+	double churn_usec = m_clock->usec() - start;
+
+	u32 walks = 0, members = 0, errors = 0;
+	for (int ii = 0; ii < READER_THREADS; ++ii)
+	{
+		readers[ii]._stop = true;
+		readers[ii].WaitForThread();
+		walks += readers[ii]._walks;
+		members += readers[ii]._members;
+		errors += readers[ii]._errors;
+	}
+
+	CAT_INFO("CollexionTest") << "Churned in " << churn_usec / 1000. << " ms while " << READER_THREADS << " readers made "
+		<< walks << " walks over " << members << " members, " << errors << " bad members";
+
+	for (u32 ii = 0; ii < SLOTS; ++ii)
+		if (slots[ii]) slots[ii]->Destroy(CAT_REFOBJECT_TRACE);
+
+	// The tick alone must hand back every removed member
+	u32 end_msec = m_clock->msec() + 5000;
+	while (m_finalized != m_created && (s32)(m_clock->msec() - end_msec) < 0)
+		Clock::sleep(10);
+
+	ticker._stop = true;
+	ticker.WaitForThread();
+
+	CAT_INFO("CollexionTest") << m_finalized << " of " << m_created << " members finalized after the ticks";
+
+	bool success = (errors == 0) && (m_finalized == m_created);
+
+	delete m_collexion;
+
+	CAT_INFO("CollexionTest") << (success ? "SUCCESS" : "FAILURE");
+
+	return success ? 0 : 1;
+}
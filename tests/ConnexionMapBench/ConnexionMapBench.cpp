@@ -0,0 +1,314 @@
+/*
+	Copyright (c) 2012 Christopher A. Taylor.  All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	* Redistributions of source code must retain the above copyright notice,
+	  this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	* Neither the name of LibCat nor the names of its contributors may be used
+	  to endorse or promote products derived from this software without
+	  specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	ConnexionMap routing benchmark
+
+	Times the address lookup that Server::OnRecvRouting() performs for each
+	datagram batch, at several connexion populations.  The concurrent pass
+	runs reader threads against the map while the main thread keeps
+	removing and re-inserting connexions, as happens when clients churn.
+*/
+
+#include <cat/AllSphynx.hpp>
+using namespace cat;
+using namespace sphynx;
+
+static Clock *m_clock = 0;
+
+static const int LOOKUPS = 2000000;
+static const int READER_THREADS = 4;
+static const int CHURN_PER_MSEC = 10;
+
+
+//// BenchConnexion
+
+class BenchConnexion : public Connexion
+{
+public:
+	ConnexionMap *_map;
+
+	CAT_INLINE const char *GetRefObjectName() { return "BenchConnexion"; }
+
+	// Mirror Connexion::OnDestroy() without a Server parent
+	virtual void OnDestroy() { _map->Remove(this); }
+
+	virtual void OnConnect() {}
+	virtual void OnMessages(IncomingMessage msgs[], u32 count) {}
+	virtual void OnCycle(u32 now) {}
+	virtual void OnDisconnectReason(u8 reason) {}
+};
+
+
+//// ConnexionMapBench
+
+// Connexion id for each client index, as the client would put on its packets
+static volatile u32 *m_ids = 0;
+
+namespace cat {
+
+namespace sphynx {
+
+class ConnexionMapBench
+{
+public:
+	static NetAddr MakeAddress(u32 index)
+	{
+		return NetAddr(10, (index >> 16) & 255, (index >> 8) & 255, index & 255, 22000);
+	}
+
+	static bool Connect(ConnexionMap *map, u32 index)
+	{
+		BenchConnexion *conn;
+		if (!RefObjects::Create(CAT_REFOBJECT_TRACE, conn))
+			return false;
+
+		conn->_map = map;
+		conn->_client_addr = MakeAddress(index);
+
+		// If the map rejected it,
+		if (map->Insert(conn) != ERR_NO_PROBLEMO)
+		{
+			conn->Destroy(CAT_REFOBJECT_TRACE);
+			return false;
+		}
+
+		m_ids[index] = conn->GetMyID();
+
+		return true;
+	}
+
+	// Same lookup as Server::OnRecvRouting()
+	static CAT_INLINE Connexion *Route(ConnexionMap *map, u32 index)
+	{
+		Connexion *conn;
+#if defined(CAT_SPHYNX_ROAMING_IP)
+		map->LookupCheckFlood(conn, MakeAddress(index), (u16)m_ids[index]);
+#else
+		map->LookupCheckFlood(conn, MakeAddress(index));
+#endif
+		return conn;
+	}
+};
+
+} // namespace sphynx
+
+} // namespace cat
+
+
+//// RouterThread
+
+class RouterThread : public Thread
+{
+public:
+	ConnexionMap *_map;
+	u32 _population;
+	volatile bool _stop;
+	u32 _lookups, _hits;
+
+	bool Entrypoint(void *param)
+	{
+		Abyssinian prng;
+		prng.Initialize((u32)(size_t)this);
+
+		_lookups = 0;
+		_hits = 0;
+
+		while (!_stop)
+		{
+			for (int ii = 0; ii < 1000; ++ii)
+			{
+				Connexion *conn = ConnexionMapBench::Route(_map, prng.Next() % _population);
+
+				if (conn)
+				{
+					++_hits;
+					conn->ReleaseRef(CAT_REFOBJECT_TRACE);
+				}
+			}
+
+			_lookups += 1000;
+		}
+
+		return true;
+	}
+};
+
+
+//// Benchmark
+
+static bool BenchPopulation(u32 population, FortunaOutput *csprng)
+{
+	// Roaming IP builds are limited by the 16-bit connexion id
+	if (population > ConnexionMap::MAX_POPULATION)
+	{
+		CAT_WARN("ConnexionMapBench") << "Limiting " << population << " connexions to the map maximum of " << ConnexionMap::MAX_POPULATION;
+		population = ConnexionMap::MAX_POPULATION;
+	}
+
+	// Indices past the population are never connected, for misses
+	m_ids = new u32[population * 2];
+	for (u32 ii = 0; ii < population * 2; ++ii)
+		m_ids[ii] = ConnexionMap::INVALID_KEY;
+
+	ConnexionMap *map = new ConnexionMap;
+	map->Initialize(csprng);
+
+	double start = m_clock->usec();
+	for (u32 ii = 0; ii < population; ++ii)
+	{
+		if (!ConnexionMapBench::Connect(map, ii))
+		{
+			CAT_WARN("ConnexionMapBench") << "Insert failed at " << ii;
+			break;
+		}
+	}
+	double insert_usec = m_clock->usec() - start;
+
+	Abyssinian prng;
+	prng.Initialize(population);
+
+	// Single reader: hits
+	u32 hits = 0;
+	start = m_clock->usec();
+	for (int ii = 0; ii < LOOKUPS; ++ii)
+	{
+		Connexion *conn = ConnexionMapBench::Route(map, prng.Next() % population);
+
+		if (conn)
+		{
+			++hits;
+			conn->ReleaseRef(CAT_REFOBJECT_TRACE);
+		}
+	}
+	double hit_usec = m_clock->usec() - start;
+
+	// Single reader: misses, as for handshake traffic
+	start = m_clock->usec();
+	for (int ii = 0; ii < LOOKUPS; ++ii)
+	{
+		Connexion *conn = ConnexionMapBench::Route(map, population + prng.Next() % population);
+
+		if (conn) conn->ReleaseRef(CAT_REFOBJECT_TRACE);
+	}
+	double miss_usec = m_clock->usec() - start;
+
+	CAT_INFO("ConnexionMapBench") << population << " connexions: insert " << insert_usec * 1000. / population
+		<< " ns, hit " << hit_usec * 1000. / LOOKUPS << " ns, miss " << miss_usec * 1000. / LOOKUPS
+		<< " ns (" << hits << "/" << LOOKUPS << " found)";
+
+	bool success = (hits == LOOKUPS);
+
+	// Concurrent readers while connexions churn
+	RouterThread readers[READER_THREADS];
+	for (int ii = 0; ii < READER_THREADS; ++ii)
+	{
+		readers[ii]._map = map;
+		readers[ii]._population = population;
+		readers[ii]._stop = false;
+		readers[ii].StartThread();
+	}
+
+	u32 churned = 0;
+	start = m_clock->usec();
+	u32 end_msec = m_clock->msec() + 1000;
+	while ((s32)(m_clock->msec() - end_msec) < 0)
+	{
+		for (int ii = 0; ii < CHURN_PER_MSEC; ++ii, ++churned)
+		{
+			u32 index = prng.Next() % population;
+
+			Connexion *conn = ConnexionMapBench::Route(map, index);
+
+			// Disconnect and reconnect the same address
+			if (conn)
+			{
+				conn->Destroy(CAT_REFOBJECT_TRACE);
+				conn->ReleaseRef(CAT_REFOBJECT_TRACE);
+			}
+
+			ConnexionMapBench::Connect(map, index);
+		}
+
+		Clock::sleep(1);
+	}
+
+	u32 lookups = 0;
+	for (int ii = 0; ii < READER_THREADS; ++ii)
+	{
+		readers[ii]._stop = true;
+		readers[ii].WaitForThread();
+		lookups += readers[ii]._lookups;
+	}
+	double churn_usec = m_clock->usec() - start;
+
+	CAT_INFO("ConnexionMapBench") << "  " << READER_THREADS << " readers: " << lookups / churn_usec
+		<< " M lookups/sec with " << churned << " reconnects, " << map->GetCount() << " connected";
+
+	// Every address is reconnected right after it is dropped
+	if (map->GetCount() != population)
+		success = false;
+
+	map->ShutdownAll();
+	delete map;
+
+	delete [](u32*)m_ids;
+
+	return success;
+}
+
+int main()
+{
+	m_clock = Clock::ref();
+
+	CAT_INFO("ConnexionMapBench") << "ConnexionMapBench 1.0: " << LOOKUPS << " lookups per pass";
+
+	FortunaOutput *csprng = FortunaFactory::ref()->Create();
+	if (!csprng)
+	{
+		CAT_FATAL("ConnexionMapBench") << "Unable to create CSPRNG";
+		return 1;
+	}
+
+	static const u32 POPULATIONS[] = { 1000, 16384, 100000 };
+
+	int result = 0;
+
+	for (int ii = 0; ii < (int)(sizeof(POPULATIONS) / sizeof(POPULATIONS[0])); ++ii)
+	{
+		if (!BenchPopulation(POPULATIONS[ii], csprng))
+		{
+			CAT_WARN("ConnexionMapBench") << "FAILURE: Lost connexions at population " << POPULATIONS[ii];
+			result = 1;
+		}
+	}
+
+	delete csprng;
+
+	return result;
+}
@@ -116,7 +116,7 @@ void SecureServerDemo::OnSessionMessage(TunnelTLS *tls, Connection *client, u8 *
 {
     //cout << "Server: Processing valid message from client (" << bytes << " bytes)" << endl;
 
-    u8 response[AuthenticatedEncryption::OVERHEAD_BYTES + 2560];
+    u8 response[AuthenticatedEncryption::OVERHEAD_BYTES + 2560] = {0};
     if (bytes > 2560) bytes = 2560;
     memcpy(response, buffer, bytes);
 
@@ -31,6 +31,10 @@
 #include "SecureServerDemo.hpp"
 #include "SecureClientDemo.hpp"
 #include <cat/crypt/rand/Fortuna.hpp>
+#include <cat/crypt/hash/SkeinMultiBuffer.hpp>
+#include <cat/crypt/hash/SkeinTree.hpp>
+#include <cat/crypt/pass/Passwords.hpp>
+#include <cat/crypt/cookie/CookieJar.hpp>
 using namespace std;
 using namespace cat;
 
@@ -57,10 +61,13 @@ void TestIVReconstruction();
 
 void TestSkein256();
 void TestSkein512();
+void TestSkeinMultiBuffer();
+void TestSkeinTree();
 
 void TestCurveParameterD();
 
 void TestChaCha();
+void TestCookieJar();
 /*
 void test1()
 {
@@ -1334,6 +1341,327 @@ void TestSkein512()
 	cout << "Skein-512 ran in " << m_clock->MeasureClocks(1000, Skein512OneRun) << " clock cycles (median of test data)" << endl;
 }
 
+static QueuedLogin mb_logins[64];
+
+void VerifyHashOneRun()
+{
+	PasswordVerifier verifier;
+
+	for (int ii = 0; ii < 64; ++ii)
+		verifier.VerifyHash(mb_logins[ii].hash, mb_logins[ii].salted_hash, mb_logins[ii].salt);
+}
+
+void VerifyHashBatchOneRun()
+{
+	PasswordVerifier verifier;
+
+	verifier.VerifyHashBatch(mb_logins, 64);
+}
+
+void TestSkeinMultiBuffer()
+{
+	static const int MSG_BYTES = 200;
+	static const int OUT_BYTES = 100;
+
+	u8 msg[SkeinMultiBuffer::MAX_LANES][MSG_BYTES];
+	u8 out[SkeinMultiBuffer::MAX_LANES][OUT_BYTES], expected[OUT_BYTES];
+	const void *msg_ptrs[SkeinMultiBuffer::MAX_LANES];
+	void *out_ptrs[SkeinMultiBuffer::MAX_LANES];
+	int msg_bytes[SkeinMultiBuffer::MAX_LANES];
+
+	for (int lane = 0; lane < SkeinMultiBuffer::MAX_LANES; ++lane)
+	{
+		for (int ii = 0; ii < MSG_BYTES; ++ii)
+			msg[lane][ii] = (u8)(ii * 17 + lane);
+
+		msg_ptrs[lane] = msg[lane];
+		out_ptrs[lane] = out[lane];
+	}
+
+	// Every lane must match the scalar Skein for the same message
+	for (int bits = 256; bits <= 512; bits += 256)
+	{
+		for (int bytes = 0; bytes <= MSG_BYTES; ++bytes)
+		{
+			for (int lane = 0; lane < SkeinMultiBuffer::MAX_LANES; ++lane)
+				msg_bytes[lane] = bytes;
+
+			SkeinMultiBuffer multi;
+			multi.BeginKey(SkeinMultiBuffer::MAX_LANES, bits);
+			multi.CrunchFinal(msg_ptrs, msg_bytes);
+			multi.Generate(out_ptrs, OUT_BYTES, 3);
+
+			for (int lane = 0; lane < SkeinMultiBuffer::MAX_LANES; ++lane)
+			{
+				// Feed the scalar hash a block at a time, so the reference does not
+				// depend on how Skein::Crunch() positions runs of several blocks
+				Skein hash;
+				hash.BeginKey(bits);
+				for (int offset = 0; offset < bytes; offset += bits / 8)
+					hash.Crunch(msg[lane] + offset, bytes - offset < bits / 8 ? bytes - offset : bits / 8);
+				hash.End();
+				hash.Generate(expected, OUT_BYTES, 3);
+
+				if (!SecureEqual(expected, out[lane], OUT_BYTES))
+				{
+					cout << "FAIL: Skein-" << bits << " multi-buffer lane " << lane << " does not match for " << bytes << " bytes." << endl;
+					return;
+				}
+			}
+		}
+	}
+
+	cout << "SUCCESS: Multi-buffer Skein matches Skein-256 and Skein-512 in every lane." << endl;
+
+	// Time a storm of 64 logins, half of them with the wrong password
+	static u8 hashes[64][32], salted_hashes[64][32];
+	PasswordVerifier verifier;
+
+	for (int ii = 0; ii < 64; ++ii)
+	{
+		for (int jj = 0; jj < 32; ++jj)
+			hashes[ii][jj] = (u8)(ii + jj);
+
+		u32 salt;
+		verifier.SaltHash(m_tls->CSPRNG(), hashes[ii], salted_hashes[ii], &salt);
+
+		mb_logins[ii].hash = hashes[ii];
+		mb_logins[ii].salted_hash = salted_hashes[ii];
+		mb_logins[ii].salt = (ii & 1) ? salt + 1 : salt;
+	}
+
+	verifier.VerifyHashBatch(mb_logins, 64);
+
+	for (int ii = 0; ii < 64; ++ii)
+	{
+		if (mb_logins[ii].valid != verifier.VerifyHash(mb_logins[ii].hash, mb_logins[ii].salted_hash, mb_logins[ii].salt))
+		{
+			cout << "FAIL: VerifyHashBatch() disagrees with VerifyHash() for login " << ii << "." << endl;
+			return;
+		}
+	}
+
+	cout << "SUCCESS: VerifyHashBatch() agrees with VerifyHash()." << endl;
+
+	cout << "64 logins with " << SkeinMultiBuffer::GetEngineName() << " lanes: VerifyHash() ran in " << m_clock->MeasureClocks(100, VerifyHashOneRun) << " clock cycles, ";
+	cout << "VerifyHashBatch() ran in " << m_clock->MeasureClocks(100, VerifyHashBatchOneRun) << " clock cycles (median)" << endl;
+}
+
+// Hands out a message a little at a time, with nothing ready on every other call
+class PacedReader
+{
+	const u8 *_msg;
+	u32 _remaining, _calls;
+
+public:
+	PacedReader(const u8 *msg, u32 bytes)
+	{
+		_msg = msg;
+		_remaining = bytes;
+		_calls = 0;
+	}
+
+	bool Read(u8 *buffer, u32 requested, u32 &bytes_read)
+	{
+		bytes_read = 0;
+
+		if (!_remaining) return false;
+		if (++_calls & 1) return true;
+
+		bytes_read = _remaining < 100 ? _remaining : 100;
+		if (bytes_read > requested) bytes_read = requested;
+
+		memcpy(buffer, _msg, bytes_read);
+		_msg += bytes_read;
+		_remaining -= bytes_read;
+		return true;
+	}
+};
+
+bool VerifySkeinTree(int bits, u32 leaf_bytes, u32 fanout, bool use_workers, const char *expected)
+{
+	static const u32 MSG_BYTES = 1200;
+
+	u8 msg[MSG_BYTES];
+	for (u32 ii = 0; ii < MSG_BYTES; ++ii)
+		msg[ii] = (u8)ii;
+
+	u8 expected_data[64], actual_data[64];
+	int expected_bytes = ParseHexText(expected, expected_data, sizeof(expected_data));
+
+	SkeinTree hash;
+	if (!hash.BeginKey(bits, leaf_bytes, fanout, use_workers))
+		return false;
+
+	// Poll until the reader reports the end of the message
+	PacedReader reader(msg, MSG_BYTES);
+	while (hash.CrunchReader(reader));
+
+	hash.End();
+	hash.Generate(actual_data, hash.GetDigestByteCount());
+
+	return expected_bytes == hash.GetDigestByteCount() && SecureEqual(actual_data, expected_data, expected_bytes);
+}
+
+void TestSkeinTree()
+{
+	// Known answers for bytes 00 01 02 .. of a 1200-byte message, computed with an
+	// independent implementation of the tree mode in the Skein 1.3 specification.
+	// The trees have a partial last leaf and partial nodes on several levels
+	if (!VerifySkeinTree(512, 128, 2, false,
+		"3F 35 94 CA 31 E4 91 DB B6 B3 6C 46 A1 7B CA 84"
+		"9C B4 0E D4 42 F6 23 BA 9E B1 6A F0 DD 95 E4 98"
+		"CF 4C DB 56 78 2C BE 9B DE 11 C5 7A 58 DA EF 40"
+		"B0 28 70 F1 0D 25 DA 04 23 CC D2 BF D2 CA 00 85"))
+	{
+		cout << "FAIL: Skein-512 tree output does not match the known answer." << endl;
+		return;
+	}
+
+	if (!VerifySkeinTree(256, 64, 4, true,
+		"0E 19 88 8B 3F 52 A0 50 04 84 B9 D5 B8 BA CA 51"
+		"37 BE 3E F4 13 77 CC 29 0B 69 BA C4 68 2E 43 79"))
+	{
+		cout << "FAIL: Skein-256 tree output does not match the known answer." << endl;
+		return;
+	}
+
+	// Leaves of eight blocks, so each leaf is a run of several blocks
+	if (!VerifySkeinTree(512, 512, 2, false,
+		"AC 75 11 C7 1C 7E B8 21 FA 06 EA CF A8 22 27 C9"
+		"68 83 88 30 67 B8 5B D4 EA DB F2 3F B2 2C 07 9E"
+		"7A C2 9E FB 81 5C F4 CC E3 17 7F 8D E6 27 26 4C"
+		"8B ED 71 21 E2 71 B6 C9 C1 80 C1 74 F5 7A 25 7D"))
+	{
+		cout << "FAIL: Skein-512 tree output with multi-block leaves does not match the known answer." << endl;
+		return;
+	}
+
+	cout << "SUCCESS: Skein tree output matches the known answers." << endl;
+
+	static const u32 MSG_BYTES = 1000000;
+	static const u32 LEAF_BYTES = 4096;
+
+	u8 *msg = new u8[MSG_BYTES];
+	u8 expected[64], out[64];
+
+	for (u32 ii = 0; ii < MSG_BYTES; ++ii)
+		msg[ii] = (u8)(ii * 131);
+
+	// Feeding the message in odd-sized pieces must not change the digest
+	SkeinTree whole;
+	whole.BeginKey(512, LEAF_BYTES, 8, false);
+	whole.Crunch(msg, MSG_BYTES);
+	whole.End();
+	whole.Generate(expected, sizeof(expected));
+
+	SkeinTree pieces;
+	pieces.BeginKey(512, LEAF_BYTES, 8, true);
+	for (u32 offset = 0, piece = 1; offset < MSG_BYTES; offset += piece, piece = piece * 3 + 1)
+	{
+		if (piece > MSG_BYTES - offset) piece = MSG_BYTES - offset;
+		pieces.Crunch(msg + offset, piece);
+	}
+	pieces.End();
+	pieces.Generate(out, sizeof(out));
+
+	if (!SecureEqual(expected, out, sizeof(out)))
+		cout << "FAIL: Skein tree digest depends on how the message was split." << endl;
+	else
+		cout << "SUCCESS: Skein tree digest is the same for whole and split messages." << endl;
+
+	double t0 = m_clock->usec();
+	SkeinTree timed;
+	timed.BeginKey(512);
+	timed.Crunch(msg, MSG_BYTES);
+	timed.End();
+	double t1 = m_clock->usec();
+
+	cout << "Skein-512 tree hashed " << MSG_BYTES << " bytes at " << MSG_BYTES / (t1 - t0) << " MB/s" << endl;
+
+	delete []msg;
+}
+
+static const int COOKIE_FLOOD = 1024;
+static CookieJar cookie_jar;
+static QueuedCookie flood_cookies[COOKIE_FLOOD];
+static u32 cookie_sink;
+
+void CookieGenerateOnce()
+{
+	for (int ii = 0; ii < COOKIE_FLOOD; ++ii)
+		cookie_sink += cookie_jar.Generate(flood_cookies[ii].ip, flood_cookies[ii].port);
+}
+
+void CookieGenerateBatchOnce()
+{
+	cookie_jar.GenerateBatch(flood_cookies, COOKIE_FLOOD);
+}
+
+void TestCookieJar()
+{
+	cookie_jar.Initialize(m_tls->CSPRNG());
+
+	// Half IPv4 address/port pairs and half opaque address info
+	static u8 address_info[COOKIE_FLOOD][20];
+
+	for (int ii = 0; ii < COOKIE_FLOOD; ++ii)
+	{
+		m_tls->CSPRNG()->Generate(address_info[ii], sizeof(address_info[ii]));
+
+		flood_cookies[ii].address_info = (ii & 1) ? address_info[ii] : 0;
+		flood_cookies[ii].bytes = sizeof(address_info[ii]);
+		flood_cookies[ii].ip = m_tls->CSPRNG()->Generate();
+		flood_cookies[ii].port = (u16)ii;
+	}
+
+	cookie_jar.GenerateBatch(flood_cookies, COOKIE_FLOOD);
+
+	for (int ii = 0; ii < COOKIE_FLOOD; ++ii)
+	{
+		QueuedCookie &cookie = flood_cookies[ii];
+
+		bool good = cookie.address_info ?
+			cookie_jar.Verify(cookie.address_info, cookie.bytes, cookie.cookie) :
+			cookie_jar.Verify(cookie.ip, cookie.port, cookie.cookie);
+
+		if (!good)
+		{
+			cout << "FAIL: GenerateBatch() cookie " << ii << " does not verify." << endl;
+			return;
+		}
+
+		// Corrupt every third cookie before verifying the batch
+		if (ii % 3 == 0) cookie.cookie ^= 0x80;
+	}
+
+	cookie_jar.VerifyBatch(flood_cookies, COOKIE_FLOOD);
+
+	for (int ii = 0; ii < COOKIE_FLOOD; ++ii)
+	{
+		if (flood_cookies[ii].valid != (ii % 3 != 0))
+		{
+			cout << "FAIL: VerifyBatch() is wrong for cookie " << ii << "." << endl;
+			return;
+		}
+	}
+
+	cout << "SUCCESS: Batched cookies match Generate() and Verify()." << endl;
+
+	for (int ii = 0; ii < COOKIE_FLOOD; ++ii)
+		flood_cookies[ii].address_info = 0;
+
+	double scalar_clocks = m_clock->MeasureClocks(100, CookieGenerateOnce) / (double)COOKIE_FLOOD;
+	double batch_clocks = m_clock->MeasureClocks(100, CookieGenerateBatchOnce) / (double)COOKIE_FLOOD;
+
+	double t0 = m_clock->usec();
+	for (int ii = 0; ii < 100; ++ii) CookieGenerateBatchOnce();
+	double t1 = m_clock->usec();
+
+	cout << "Generate(): " << scalar_clocks << " cycles/cookie, GenerateBatch(): " << batch_clocks << " cycles/cookie" << endl;
+	cout << "Hello flood throughput: " << 100 * COOKIE_FLOOD / (t1 - t0) << " million cookies/second on one core" << endl;
+}
+
 static int cc_bytes;
 static ChaChaKey cc_test_key;
 
@@ -1346,6 +1674,25 @@ void ChaChaOnce()
 	cc_test.Crypt(in, out, cc_bytes);
 }
 
+void ChaChaKeyStreamOnce()
+{
+	static u8 keystream[4096];
+
+	ChaChaOutput cc_test;
+	cc_test.ReKey(cc_test_key, 0x0123456701234567LL);
+	cc_test.GenerateKeyStream(keystream, sizeof(keystream) / 64);
+}
+
+static u32 fortuna_sink;
+
+void FortunaGenerateOnce()
+{
+	FortunaOutput *csprng = m_tls->CSPRNG();
+
+	for (int ii = 0; ii < 1000; ++ii)
+		fortuna_sink += csprng->Generate();
+}
+
 void TestChaCha()
 {
 	cout << "ChaCha timing results:" << endl;
@@ -1363,6 +1710,9 @@ void TestChaCha()
 		cc_bytes = TIMING_BYTES[ii];
 		cout << cc_bytes << " bytes: " << m_clock->MeasureClocks(1000, ChaChaOnce)/(float)cc_bytes << " cycles/byte" << endl;
 	}
+
+	cout << "4 KB keystream batch: " << m_clock->MeasureClocks(1000, ChaChaKeyStreamOnce)/4096.f << " cycles/byte" << endl;
+	cout << "Fortuna 32-bit Generate(): " << m_clock->MeasureClocks(1000, FortunaGenerateOnce)/1000.f << " cycles" << endl;
 }
 
 
@@ -1588,10 +1938,15 @@ int main()
 	cout << endl << "Hash testing and timing:" << endl;
 	TestSkein256();
 	TestSkein512();
+	TestSkeinMultiBuffer();
+	TestSkeinTree();
 
 	cout << endl << "ChaCha testing and timing:" << endl;
 	TestChaCha();
 
+	cout << endl << "Cookie jar testing and timing:" << endl;
+	TestCookieJar();
+
 	GenerateLottoTicketNumbers();
 	GenerateLottoTicketNumbers();
 
@@ -0,0 +1,762 @@
+#include <cat/AllCommon.hpp>
+#include <cat/fec/Wirehair.hpp>
+#include <cat/codec/RaptorQ.hpp>
+#include <cat/rand/AbyssinianPRNG.hpp>
+using namespace cat;
+
+static Clock *m_clock = 0;
+
+/*
+	Compares Wirehair against RaptorQ on the same messages and the same
+	loss pattern.  For each message size it reports the time to set up the
+	encoder, the time to decode from a lossy stream, and the average number
+	of symbols needed beyond the source block count.
+*/
+
+static const int BLOCK_BYTES = 1300;
+static const int TRIALS = 10;
+static const u32 LOSS_PERCENT = 10;
+
+struct BenchResult
+{
+	double encode_usec, decode_usec;
+	u32 overhead, failures;
+};
+
+// Returns true if the symbol with this id is dropped
+static CAT_INLINE bool IsLost(Abyssinian &prng)
+{
+	return prng.Next() % 100 < LOSS_PERCENT;
+}
+
+static void BenchWirehair(const u8 *message, u8 *message_out, u8 *block, int message_bytes, u32 seed, BenchResult &result)
+{
+	wirehair::Encoder encoder;
+	wirehair::Decoder decoder;
+
+	double start = m_clock->usec();
+	wirehair::Result r = encoder.BeginEncode(message, message_bytes, BLOCK_BYTES);
+	result.encode_usec += m_clock->usec() - start;
+
+	if (r || decoder.BeginDecode(message_out, message_bytes, BLOCK_BYTES))
+	{
+		++result.failures;
+		return;
+	}
+
+	Abyssinian prng;
+	prng.Initialize(seed);
+
+	u32 block_count = encoder.BlockCount(), received = 0;
+
+	start = m_clock->usec();
+	for (u32 id = 0; id < block_count * 2; ++id)
+	{
+		if (IsLost(prng)) continue;
+
+		encoder.Encode(id, block);
+		++received;
+
+		r = decoder.Decode(id, block);
+		if (r != wirehair::R_MORE_BLOCKS) break;
+	}
+	result.decode_usec += m_clock->usec() - start;
+
+	if (r || memcmp(message, message_out, message_bytes))
+		++result.failures;
+	else
+		result.overhead += received - block_count;
+}
+
+static void BenchRaptorQ(const u8 *message, u8 *message_out, u8 *block, int message_bytes, u32 seed, BenchResult &result)
+{
+	raptorq::Encoder encoder;
+	raptorq::Decoder decoder;
+
+	double start = m_clock->usec();
+	raptorq::Result r = encoder.BeginEncode(message, message_bytes, BLOCK_BYTES);
+	result.encode_usec += m_clock->usec() - start;
+
+	if (r || decoder.BeginDecode(message_out, message_bytes, BLOCK_BYTES))
+	{
+		++result.failures;
+		return;
+	}
+
+	Abyssinian prng;
+	prng.Initialize(seed);
+
+	u32 source_count = encoder.SourceCount(), received = 0;
+
+	start = m_clock->usec();
+	for (u32 esi = 0; esi < source_count * 2; ++esi)
+	{
+		if (IsLost(prng)) continue;
+
+		encoder.Encode(esi, block);
+		++received;
+
+		r = decoder.Decode(esi, block);
+		if (r != raptorq::R_MORE_BLOCKS) break;
+	}
+	result.decode_usec += m_clock->usec() - start;
+
+	if (r || memcmp(message, message_out, message_bytes))
+		++result.failures;
+	else
+		result.overhead += received - source_count;
+}
+
+/*
+	Pins the repair symbols RaptorQ generates for a fixed message, so that a
+	change to the symbol layout is caught.  This is a regression vector for
+	this codec, not a vector from RFC 6330: see RaptorQ.hpp for why it is not
+	wire compatible yet.  Replace it with a published vector once the RFC
+	tables are in.
+*/
+static bool CheckRaptorQVector()
+{
+	static const int MESSAGE_BYTES = 100;
+	static const int SYMBOL_BYTES = 16;
+	static const u8 EXPECTED[3][SYMBOL_BYTES] = {
+		{ 0xED, 0xCB, 0x0C, 0x2A, 0xA9, 0x42, 0xDA, 0x24, 0x99, 0xFF, 0x67, 0x6A, 0x9D, 0x99, 0x7D, 0x79 },
+		{ 0xE3, 0xF0, 0x65, 0x76, 0x23, 0x96, 0x50, 0x5F, 0x5D, 0xB6, 0x70, 0x47, 0xD0, 0x74, 0x98, 0x3C },
+		{ 0x8E, 0x89, 0xBF, 0xB8, 0x6F, 0x84, 0x8F, 0xC3, 0xCC, 0x53, 0x58, 0x75, 0x72, 0x7B, 0xA0, 0xA9 }
+	};
+
+	u8 message[MESSAGE_BYTES], message_out[MESSAGE_BYTES], symbol[SYMBOL_BYTES];
+
+	for (int ii = 0; ii < MESSAGE_BYTES; ++ii)
+		message[ii] = (u8)(ii * 7 + 3);
+
+	raptorq::Encoder encoder;
+	raptorq::Decoder decoder;
+
+	if (encoder.BeginEncode(message, MESSAGE_BYTES, SYMBOL_BYTES) ||
+		decoder.BeginDecode(message_out, MESSAGE_BYTES, SYMBOL_BYTES))
+	{
+		CAT_WARN("FECBench") << "RaptorQ vector: Unable to set up the codec";
+		return false;
+	}
+
+	// The first repair symbols must match the pinned bytes
+	u32 source_count = encoder.SourceCount();
+
+	for (u32 ii = 0; ii < 3; ++ii)
+	{
+		encoder.Encode(source_count + ii, symbol);
+
+		if (memcmp(symbol, EXPECTED[ii], SYMBOL_BYTES))
+		{
+			CAT_WARN("FECBench") << "RaptorQ vector: Repair symbol " << source_count + ii << " does not match";
+			return false;
+		}
+	}
+
+	// The message must come back from repair symbols alone
+	raptorq::Result r = raptorq::R_MORE_BLOCKS;
+
+	for (u32 esi = source_count; r == raptorq::R_MORE_BLOCKS && esi < source_count * 3; ++esi)
+	{
+		encoder.Encode(esi, symbol);
+		r = decoder.Decode(esi, symbol);
+	}
+
+	if (r || memcmp(message, message_out, MESSAGE_BYTES))
+	{
+		CAT_WARN("FECBench") << "RaptorQ vector: Unable to decode from repair symbols";
+		return false;
+	}
+
+	CAT_INFO("FECBench") << "RaptorQ vector: OK";
+	return true;
+}
+
+/*
+	Decodes the same lossy stream with and without UseWorkerThreads(), so
+	the column slices the workers solve are checked against the
+	single-thread decoder.  Both must reproduce the message exactly.  The
+	block sizes cover one and several slices and a partial final slice.
+*/
+static bool CheckWirehairThreads()
+{
+	static const int BLOCK_SIZES[] = { 1300, 4096, 555 };
+	static const int BLOCK_COUNTS[] = { 2, 50, 1000 };
+
+	Abyssinian prng;
+	prng.Initialize(0x12345678);
+
+	for (int ii = 0; ii < (int)(sizeof(BLOCK_SIZES) / sizeof(BLOCK_SIZES[0])); ++ii)
+	{
+		for (int jj = 0; jj < (int)(sizeof(BLOCK_COUNTS) / sizeof(BLOCK_COUNTS[0])); ++jj)
+		{
+			int block_bytes = BLOCK_SIZES[ii];
+			int message_bytes = BLOCK_COUNTS[jj] * block_bytes - 37;
+
+			u8 *message = new u8[message_bytes];
+			u8 *single_out = new u8[message_bytes];
+			u8 *threaded_out = new u8[message_bytes];
+			u8 *block = new u8[block_bytes];
+
+			for (int kk = 0; kk < message_bytes; ++kk)
+				message[kk] = (u8)prng.Next();
+
+			wirehair::Encoder encoder;
+			wirehair::Decoder single, threaded;
+			threaded.UseWorkerThreads();
+
+			wirehair::Result r = encoder.BeginEncode(message, message_bytes, block_bytes);
+			if (!r) r = single.BeginDecode(single_out, message_bytes, block_bytes);
+			if (!r) r = threaded.BeginDecode(threaded_out, message_bytes, block_bytes);
+
+			// Feed both decoders the same blocks until both are done
+			wirehair::Result rs = wirehair::R_MORE_BLOCKS, rt = wirehair::R_MORE_BLOCKS;
+			u32 block_count = encoder.BlockCount();
+
+			for (u32 id = 0; !r && id < block_count * 2; ++id)
+			{
+				if (IsLost(prng)) continue;
+
+				encoder.Encode(id, block);
+
+				if (rs == wirehair::R_MORE_BLOCKS) rs = single.Decode(id, block);
+				if (rt == wirehair::R_MORE_BLOCKS) rt = threaded.Decode(id, block);
+				if (rs != wirehair::R_MORE_BLOCKS && rt != wirehair::R_MORE_BLOCKS) break;
+			}
+
+			bool success = !r && !rs && !rt &&
+				!memcmp(message, single_out, message_bytes) &&
+				!memcmp(single_out, threaded_out, message_bytes);
+
+			delete []message;
+			delete []single_out;
+			delete []threaded_out;
+			delete []block;
+
+			if (!success)
+			{
+				CAT_WARN("FECBench") << "Wirehair threads: Decode of " << message_bytes << " bytes in "
+					<< block_bytes << " byte blocks does not match: " << wirehair::GetResultString(r)
+					<< " / " << wirehair::GetResultString(rs) << " / " << wirehair::GetResultString(rt);
+				return false;
+			}
+		}
+	}
+
+	CAT_INFO("FECBench") << "Wirehair threads: OK";
+	return true;
+}
+
+/*
+	Runs one Encoder through a series of messages and compares every block it
+	produces against a fresh Encoder for the same message.  Consecutive
+	messages share N and block bytes but differ in contents and message bytes,
+	so the reused matrix solve is exercised, and a change of N in between must
+	drop it.
+*/
+static bool CheckWirehairReuse()
+{
+	static const int BLOCK_SIZES[] = { 1300, 555 };
+	static const int BLOCK_COUNTS[] = { 2, 50, 1000 };
+
+	// Bytes short of N full blocks for each message in the series; the third changes N
+	static const int SHORT_BYTES[] = { 37, 500, -1, 0, 37 };
+
+	Abyssinian prng;
+	prng.Initialize(0x87654321);
+
+	for (int ii = 0; ii < (int)(sizeof(BLOCK_SIZES) / sizeof(BLOCK_SIZES[0])); ++ii)
+	{
+		for (int jj = 0; jj < (int)(sizeof(BLOCK_COUNTS) / sizeof(BLOCK_COUNTS[0])); ++jj)
+		{
+			int block_bytes = BLOCK_SIZES[ii];
+			int block_count = BLOCK_COUNTS[jj];
+
+			u8 *message = new u8[(block_count + 1) * block_bytes];
+			u8 *reused_block = new u8[block_bytes];
+			u8 *fresh_block = new u8[block_bytes];
+
+			wirehair::Encoder reused;
+			bool success = true;
+
+			for (int kk = 0; success && kk < (int)(sizeof(SHORT_BYTES) / sizeof(SHORT_BYTES[0])); ++kk)
+			{
+				// A negative entry adds one more block instead
+				int message_bytes = SHORT_BYTES[kk] >= 0 ? block_count * block_bytes - SHORT_BYTES[kk] : (block_count + 1) * block_bytes - 11;
+
+				for (int ll = 0; ll < message_bytes; ++ll)
+					message[ll] = (u8)prng.Next();
+
+				wirehair::Encoder fresh;
+
+				wirehair::Result r = reused.BeginEncode(message, message_bytes, block_bytes);
+				wirehair::Result rf = fresh.BeginEncode(message, message_bytes, block_bytes);
+
+				if (r || rf || reused.BlockCount() != fresh.BlockCount())
+				{
+					CAT_WARN("FECBench") << "Wirehair reuse: Unable to encode " << message_bytes << " bytes: "
+						<< wirehair::GetResultString(r) << " / " << wirehair::GetResultString(rf);
+					success = false;
+					break;
+				}
+
+				// Compare the original blocks and as many recovery blocks
+				for (u32 id = 0; id < fresh.BlockCount() * 2; ++id)
+				{
+					u32 bytes = reused.Encode(id, reused_block);
+
+					if (bytes != fresh.Encode(id, fresh_block) || memcmp(reused_block, fresh_block, bytes))
+					{
+						CAT_WARN("FECBench") << "Wirehair reuse: Block " << id << " of message " << kk << " with "
+							<< message_bytes << " bytes in " << block_bytes << " byte blocks does not match a fresh encoder";
+						success = false;
+						break;
+					}
+				}
+			}
+
+			delete []message;
+			delete []reused_block;
+			delete []fresh_block;
+
+			if (!success) return false;
+		}
+	}
+
+	CAT_INFO("FECBench") << "Wirehair reuse: OK";
+	return true;
+}
+
+/*
+	Watches the progress reports from a streaming decoder.  Each report
+	must not go backwards, and the message prefix it covers must already
+	match the original message when the report is made.
+*/
+class StreamChecker
+{
+	const u8 *_message, *_message_out;
+	u32 _message_bytes;
+
+public:
+	u32 reports, last_bytes;
+	bool backwards, mismatch;
+
+	StreamChecker(const u8 *message, const u8 *message_out, u32 message_bytes)
+	{
+		_message = message;
+		_message_out = message_out;
+		_message_bytes = message_bytes;
+
+		reports = 0;
+		last_bytes = 0;
+		backwards = false;
+		mismatch = false;
+	}
+
+	void OnProgress(u32 bytes)
+	{
+		++reports;
+
+		if (bytes < last_bytes) backwards = true;
+		last_bytes = bytes;
+
+		if (bytes > _message_bytes || memcmp(_message, _message_out, bytes))
+			mismatch = true;
+	}
+};
+
+/*
+	Decodes lossy streams with BeginStreamingDecode() and checks each
+	progress report against the original message.  The block counts
+	include N = 2 and a message whose final block is partial.
+*/
+static bool CheckWirehairStreaming()
+{
+	static const int BLOCK_SIZES[] = { 1300, 555 };
+	static const int BLOCK_COUNTS[] = { 2, 50, 1000 };
+
+	Abyssinian prng;
+	prng.Initialize(0x31415926);
+
+	u32 partial_reports = 0;
+
+	for (int ii = 0; ii < (int)(sizeof(BLOCK_SIZES) / sizeof(BLOCK_SIZES[0])); ++ii)
+	{
+		for (int jj = 0; jj < (int)(sizeof(BLOCK_COUNTS) / sizeof(BLOCK_COUNTS[0])); ++jj)
+		{
+			int block_bytes = BLOCK_SIZES[ii];
+			int message_bytes = BLOCK_COUNTS[jj] * block_bytes - 37;
+
+			u8 *message = new u8[message_bytes];
+			u8 *message_out = new u8[message_bytes];
+			u8 *block = new u8[block_bytes];
+
+			for (int kk = 0; kk < message_bytes; ++kk)
+				message[kk] = (u8)prng.Next();
+
+			// Stale output must not pass for decoded data
+			memset(message_out, 0, message_bytes);
+
+			StreamChecker checker(message, message_out, message_bytes);
+
+			wirehair::Encoder encoder;
+			wirehair::Decoder decoder;
+
+			wirehair::Result r = encoder.BeginEncode(message, message_bytes, block_bytes);
+			if (!r) r = decoder.BeginStreamingDecode(message_out, message_bytes, block_bytes,
+				wirehair::DecodeProgress::FromMember<StreamChecker, &StreamChecker::OnProgress>(&checker));
+
+			wirehair::Result rd = wirehair::R_MORE_BLOCKS;
+			u32 block_count = encoder.BlockCount();
+
+			for (u32 id = 0; !r && id < block_count * 2; ++id)
+			{
+				if (IsLost(prng)) continue;
+
+				encoder.Encode(id, block);
+
+				rd = decoder.Decode(id, block);
+				if (rd != wirehair::R_MORE_BLOCKS) break;
+			}
+
+			// Reports made before the final one cover only part of the message
+			if (checker.reports > 1) partial_reports += checker.reports - 1;
+
+			bool success = !r && !rd && !checker.backwards && !checker.mismatch &&
+				checker.last_bytes == (u32)message_bytes && !memcmp(message, message_out, message_bytes);
+
+			if (!success)
+			{
+				CAT_WARN("FECBench") << "Wirehair streaming: Decode of " << message_bytes << " bytes in "
+					<< block_bytes << " byte blocks failed: " << wirehair::GetResultString(r) << " / "
+					<< wirehair::GetResultString(rd) << ", " << checker.reports << " reports ending at "
+					<< checker.last_bytes << (checker.backwards ? ", went backwards" : "")
+					<< (checker.mismatch ? ", reported bytes that did not match" : "");
+			}
+
+			delete []message;
+			delete []message_out;
+			delete []block;
+
+			if (!success) return false;
+		}
+	}
+
+	// With 10% loss the leading blocks usually arrive, so some reports must come early
+	if (!partial_reports)
+	{
+		CAT_WARN("FECBench") << "Wirehair streaming: No progress was reported before decoding completed";
+		return false;
+	}
+
+	CAT_INFO("FECBench") << "Wirehair streaming: OK with " << partial_reports << " early progress reports";
+	return true;
+}
+
+/*
+	Compares EncodeBatch() with one Encode() call per id, for batches of
+	original blocks only, recovery blocks only, and batches that cross
+	from the original blocks at N - 1 (which may be partial) into the
+	recovery blocks.  Both the single-thread and the worker-thread
+	encoders are checked.
+*/
+static bool CheckWirehairBatch()
+{
+	static const int BLOCK_SIZES[] = { 1300, 555 };
+	static const int BLOCK_COUNTS[] = { 2, 50, 1000 };
+	static const u32 BATCH_MAX = 16;
+
+	Abyssinian prng;
+	prng.Initialize(0x27182818);
+
+	u8 *batch_data = new u8[BATCH_MAX * 1300];
+	u8 *single = new u8[1300];
+	void *batch_blocks[BATCH_MAX];
+	u32 batch_bytes[BATCH_MAX];
+
+	bool success = true;
+
+	for (int threaded = 0; success && threaded < 2; ++threaded)
+	{
+		for (int ii = 0; success && ii < (int)(sizeof(BLOCK_SIZES) / sizeof(BLOCK_SIZES[0])); ++ii)
+		{
+			for (int jj = 0; success && jj < (int)(sizeof(BLOCK_COUNTS) / sizeof(BLOCK_COUNTS[0])); ++jj)
+			{
+				int block_bytes = BLOCK_SIZES[ii];
+				int message_bytes = BLOCK_COUNTS[jj] * block_bytes - 37;
+
+				u8 *message = new u8[message_bytes];
+				for (int kk = 0; kk < message_bytes; ++kk)
+					message[kk] = (u8)prng.Next();
+
+				for (u32 kk = 0; kk < BATCH_MAX; ++kk)
+					batch_blocks[kk] = batch_data + kk * block_bytes;
+
+				wirehair::Encoder encoder;
+				if (threaded) encoder.UseWorkerThreads();
+
+				wirehair::Result r = encoder.BeginEncode(message, message_bytes, block_bytes);
+				if (r)
+				{
+					CAT_WARN("FECBench") << "Wirehair batch: Unable to encode " << message_bytes << " bytes: " << wirehair::GetResultString(r);
+					success = false;
+				}
+
+				u32 n = encoder.BlockCount();
+
+				// First id and count of each batch: before, across and after N
+				const u32 starts[] = { 0, n > 3 ? n - 3 : 0, n - 1, n, n + 100 };
+				const u32 counts[] = { n < BATCH_MAX ? n : BATCH_MAX, 7, 2, BATCH_MAX, 5 };
+
+				for (int kk = 0; success && kk < (int)(sizeof(starts) / sizeof(starts[0])); ++kk)
+				{
+					encoder.EncodeBatch(starts[kk], counts[kk], batch_blocks, batch_bytes);
+
+					for (u32 ll = 0; ll < counts[kk]; ++ll)
+					{
+						u32 id = starts[kk] + ll;
+						u32 bytes = encoder.Encode(id, single);
+
+						if (bytes != batch_bytes[ll] || memcmp(single, batch_blocks[ll], bytes))
+						{
+							CAT_WARN("FECBench") << "Wirehair batch: Block " << id << " of N = " << n << " in "
+								<< block_bytes << " byte blocks does not match Encode()" << (threaded ? " with worker threads" : "");
+							success = false;
+							break;
+						}
+					}
+				}
+
+				delete []message;
+			}
+		}
+	}
+
+	delete []batch_data;
+	delete []single;
+
+	if (success)
+		CAT_INFO("FECBench") << "Wirehair batch: OK";
+
+	return success;
+}
+
+/*
+	A decoder that has N blocks can still fail to solve, and must then
+	pick up the solve from each later block.  Decodes many short lossy
+	streams, with and without streaming output, and counts the decodes
+	that needed more than N blocks: every one of them went through a
+	failed solve and must still reproduce the message exactly.
+*/
+static bool CheckWirehairResume()
+{
+	static const int BLOCK_COUNTS[] = { 2, 3, 5, 10, 20, 50, 100, 200, 500 };
+	static const int RESUME_TRIALS = 50;
+	static const u32 RESUME_LOSS_PERCENT = 33;
+
+	Abyssinian prng;
+	prng.Initialize(0x16180339);
+
+	u8 block[BLOCK_BYTES];
+	u32 resumed = 0, failed_solves = 0;
+
+	for (int streaming = 0; streaming < 2; ++streaming)
+	{
+		for (int ii = 0; ii < (int)(sizeof(BLOCK_COUNTS) / sizeof(BLOCK_COUNTS[0])); ++ii)
+		{
+			int message_bytes = BLOCK_COUNTS[ii] * BLOCK_BYTES - 37;
+
+			u8 *message = new u8[message_bytes];
+			u8 *message_out = new u8[message_bytes];
+
+			for (int trial = 0; trial < RESUME_TRIALS; ++trial)
+			{
+				for (int kk = 0; kk < message_bytes; ++kk)
+					message[kk] = (u8)prng.Next();
+
+				wirehair::Encoder encoder;
+				wirehair::Decoder decoder;
+
+				wirehair::Result r = encoder.BeginEncode(message, message_bytes, BLOCK_BYTES);
+				if (!r)
+				{
+					if (streaming)
+						r = decoder.BeginStreamingDecode(message_out, message_bytes, BLOCK_BYTES, wirehair::DecodeProgress());
+					else
+						r = decoder.BeginDecode(message_out, message_bytes, BLOCK_BYTES);
+				}
+
+				u32 block_count = encoder.BlockCount(), received = 0;
+				wirehair::Result rd = wirehair::R_MORE_BLOCKS;
+
+				for (u32 id = 0; !r && id < block_count * 4; ++id)
+				{
+					if (prng.Next() % 100 < RESUME_LOSS_PERCENT) continue;
+
+					encoder.Encode(id, block);
+					++received;
+
+					rd = decoder.Decode(id, block);
+					if (rd != wirehair::R_MORE_BLOCKS) break;
+
+					// Holding N or more blocks and still short means the solve failed
+					if (received >= block_count) ++failed_solves;
+				}
+
+				if (r || rd || memcmp(message, message_out, message_bytes))
+				{
+					CAT_WARN("FECBench") << "Wirehair resume: Decode of N = " << block_count << (streaming ? " (streaming)" : "")
+						<< " failed after " << received << " blocks: " << wirehair::GetResultString(r) << " / " << wirehair::GetResultString(rd);
+
+					delete []message;
+					delete []message_out;
+					return false;
+				}
+
+				if (received > block_count) ++resumed;
+			}
+
+			delete []message;
+			delete []message_out;
+		}
+	}
+
+	if (!resumed)
+	{
+		CAT_WARN("FECBench") << "Wirehair resume: No decode needed more than N blocks, so no failed solve was resumed";
+		return false;
+	}
+
+	CAT_INFO("FECBench") << "Wirehair resume: OK, " << resumed << " decodes recovered from " << failed_solves << " failed solves";
+	return true;
+}
+
+// Reproducer for the case quoted in the TransferPipeline commit: at N = 191
+// and 10% loss, a decode that needs more than N blocks used to report R_WIN
+// with the wrong message.  Fixed by the _decoder_solving flag in DecodeSolve()
+static bool CheckWirehairLossCase()
+{
+	static const u32 CASE_BLOCK_COUNT = 191;
+	static const u32 CASE_LOSS_PERCENT = 10;
+	static const int CASE_TRIALS = 400;
+
+	Abyssinian prng;
+	prng.Initialize(0x191);
+
+	int message_bytes = CASE_BLOCK_COUNT * BLOCK_BYTES;
+	u8 *message = new u8[message_bytes];
+	u8 *message_out = new u8[message_bytes];
+	u8 block[BLOCK_BYTES];
+	u32 resumed = 0;
+	bool success = true;
+
+	for (int trial = 0; success && trial < CASE_TRIALS; ++trial)
+	{
+		for (int kk = 0; kk < message_bytes; ++kk)
+			message[kk] = (u8)prng.Next();
+
+		wirehair::Encoder encoder;
+		wirehair::Decoder decoder;
+
+		wirehair::Result r = encoder.BeginEncode(message, message_bytes, BLOCK_BYTES);
+		if (!r) r = decoder.BeginDecode(message_out, message_bytes, BLOCK_BYTES);
+
+		u32 received = 0;
+		wirehair::Result rd = wirehair::R_MORE_BLOCKS;
+
+		for (u32 id = 0; !r && id < CASE_BLOCK_COUNT * 4; ++id)
+		{
+			if (prng.Next() % 100 < CASE_LOSS_PERCENT) continue;
+
+			encoder.Encode(id, block);
+			++received;
+
+			rd = decoder.Decode(id, block);
+			if (rd != wirehair::R_MORE_BLOCKS) break;
+		}
+
+		if (r || rd || memcmp(message, message_out, message_bytes))
+		{
+			CAT_WARN("FECBench") << "Wirehair N = " << CASE_BLOCK_COUNT << " at " << CASE_LOSS_PERCENT << "% loss: Trial " << trial
+				<< " failed after " << received << " blocks: " << wirehair::GetResultString(r) << " / " << wirehair::GetResultString(rd)
+				<< (!r && !rd ? " with wrong output" : "");
+			success = false;
+		}
+		else if (received > CASE_BLOCK_COUNT) ++resumed;
+	}
+
+	delete []message;
+	delete []message_out;
+
+	if (success && !resumed)
+	{
+		CAT_WARN("FECBench") << "Wirehair N = " << CASE_BLOCK_COUNT << " at " << CASE_LOSS_PERCENT << "% loss: No decode needed more than N blocks";
+		success = false;
+	}
+
+	if (success)
+		CAT_INFO("FECBench") << "Wirehair N = " << CASE_BLOCK_COUNT << " at " << CASE_LOSS_PERCENT << "% loss: OK, " << resumed << " of " << CASE_TRIALS << " decodes needed more than N blocks";
+
+	return success;
+}
+
+static void Report(const char *name, int message_bytes, const BenchResult &result)
+{
+	u32 wins = TRIALS - result.failures;
+	double mbytes = (double)message_bytes * TRIALS;
+
+	CAT_INFO("FECBench") << name << ": encode " << result.encode_usec / TRIALS << " usec ("
+		<< mbytes / result.encode_usec << " MB/s), decode " << result.decode_usec / TRIALS << " usec ("
+		<< mbytes / result.decode_usec << " MB/s), overhead "
+		<< (wins ? (double)result.overhead / wins : 0.) << " symbols, failures " << result.failures;
+}
+
+int main()
+{
+	m_clock = Clock::ref();
+
+	CAT_INFO("FECBench") << "FECBench 1.0: " << BLOCK_BYTES << " byte symbols, " << LOSS_PERCENT << "% loss";
+
+	if (!CheckRaptorQVector() || !CheckWirehairThreads() || !CheckWirehairReuse() ||
+		!CheckWirehairStreaming() || !CheckWirehairBatch() ||
+		!CheckWirehairResume() || !CheckWirehairLossCase())
+		return 1;
+
+	static const int BLOCK_COUNTS[] = { 16, 100, 1000, 10000, 32000 };
+
+	for (int ii = 0; ii < (int)(sizeof(BLOCK_COUNTS) / sizeof(BLOCK_COUNTS[0])); ++ii)
+	{
+		int message_bytes = BLOCK_COUNTS[ii] * BLOCK_BYTES - 123;
+
+		u8 *message = new u8[message_bytes];
+		u8 *message_out = new u8[message_bytes];
+		u8 block[BLOCK_BYTES];
+
+		Abyssinian prng;
+		prng.Initialize(m_clock->msec_fast());
+
+		BenchResult wirehair_result, raptorq_result;
+		CAT_OBJCLR(wirehair_result);
+		CAT_OBJCLR(raptorq_result);
+
+		for (int trial = 0; trial < TRIALS; ++trial)
+		{
+			for (int jj = 0; jj < message_bytes; ++jj)
+				message[jj] = (u8)prng.Next();
+
+			u32 seed = prng.Next();
+
+			BenchWirehair(message, message_out, block, message_bytes, seed, wirehair_result);
+			BenchRaptorQ(message, message_out, block, message_bytes, seed, raptorq_result);
+		}
+
+		CAT_INFO("FECBench") << BLOCK_COUNTS[ii] << " blocks (" << message_bytes << " bytes):";
+		Report("  Wirehair", message_bytes, wirehair_result);
+		Report("  RaptorQ ", message_bytes, raptorq_result);
+
+		delete []message;
+		delete []message_out;
+	}
+
+	return 0;
+}
@@ -0,0 +1,244 @@
+/*
+	Copyright (c) 2012 Christopher A. Taylor.  All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	* Redistributions of source code must retain the above copyright notice,
+	  this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	* Neither the name of LibCat nor the names of its contributors may be used
+	  to endorse or promote products derived from this software without
+	  specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	Collexion area-of-interest benchmark
+
+	Scatters members over a square world and times a radius query through
+	the InterestGrid against the same query done by running a distance
+	criterion over every member, as proximity broadcasts did before the
+	grid.  Both must find the same members.  Also times SetPosition() for
+	small moves, which mostly stay within a cell.
+*/
+
+#include <cat/AllSphynx.hpp>
+using namespace cat;
+using namespace sphynx;
+
+static Clock *m_clock = 0;
+
+static const u32 MEMBERS = 20000;
+static const float WORLD_SIZE = 4000.f;
+static const float QUERY_RADIUS = 100.f;
+static const int QUERIES = 2000;
+static const int SCANS = 100;
+static const int MOVES = 1000000;
+
+
+//// BenchConnexion
+
+class BenchConnexion : public Connexion
+{
+public:
+	float _x, _y;
+
+	CAT_INLINE const char *GetRefObjectName() { return "BenchConnexion"; }
+
+	virtual void OnConnect() {}
+	virtual void OnMessages(IncomingMessage msgs[], u32 count) {}
+	virtual void OnCycle(u32 now) {}
+	virtual void OnDisconnectReason(u8 reason) {}
+};
+
+
+//// RadiusCriterion
+
+// The per-member test a proximity broadcast used before the grid
+class RadiusCriterion : public IConnexionCriterion<BenchConnexion>
+{
+public:
+	float _x, _y, _radius_squared;
+
+	bool In(BenchConnexion *conn)
+	{
+		float dx = conn->_x - _x, dy = conn->_y - _y;
+		return dx * dx + dy * dy <= _radius_squared;
+	}
+};
+
+
+//// InterestGridBench
+
+namespace cat {
+
+namespace sphynx {
+
+class InterestGridBench
+{
+public:
+	static BenchConnexion *Connect(u32 index)
+	{
+		BenchConnexion *conn;
+		if (!RefObjects::Create(CAT_REFOBJECT_TRACE, conn))
+			return 0;
+
+		// Spread members over the workers as Server does
+		conn->_worker_id = index % WorkerThreads::ref()->GetWorkerCount();
+
+		return conn;
+	}
+};
+
+} // namespace sphynx
+
+} // namespace cat
+
+
+static float RandomCoordinate(Abyssinian &prng)
+{
+	return (prng.Next() % 1000000) * (WORLD_SIZE / 1000000.f);
+}
+
+
+//// Benchmark
+
+int main()
+{
+	m_clock = Clock::ref();
+
+	CAT_INFO("InterestGridBench") << "InterestGridBench 1.0: " << MEMBERS << " members in a " << WORLD_SIZE
+		<< " unit world, " << QUERY_RADIUS << " unit queries";
+
+	Collexion<BenchConnexion> *collexion = new Collexion<BenchConnexion>;
+	collexion->EnableInterestGrid(QUERY_RADIUS);
+
+	Abyssinian prng;
+	prng.Initialize(0);
+
+	BenchConnexion **members = new BenchConnexion*[MEMBERS];
+	for (u32 ii = 0; ii < MEMBERS; ++ii)
+	{
+		BenchConnexion *conn = InterestGridBench::Connect(ii);
+		members[ii] = conn;
+
+		if (!conn || !collexion->Insert(conn))
+		{
+			CAT_FATAL("InterestGridBench") << "Insert failed at " << ii;
+			return 1;
+		}
+
+		conn->_x = RandomCoordinate(prng);
+		conn->_y = RandomCoordinate(prng);
+
+		if (!collexion->SetPosition(conn, conn->_x, conn->_y))
+		{
+			CAT_FATAL("InterestGridBench") << "SetPosition failed at " << ii;
+			return 1;
+		}
+	}
+
+	BinnedConnexionSubset subset;
+	RadiusCriterion criterion;
+	criterion._radius_squared = QUERY_RADIUS * QUERY_RADIUS;
+
+	bool success = true;
+
+	// Query centers, shared by the grid and the scan
+	float *query_x = new float[QUERIES], *query_y = new float[QUERIES];
+	for (int ii = 0; ii < QUERIES; ++ii)
+	{
+		query_x[ii] = RandomCoordinate(prng);
+		query_y[ii] = RandomCoordinate(prng);
+	}
+
+	u32 found = 0;
+	double start = m_clock->usec();
+	for (int ii = 0; ii < QUERIES; ++ii)
+	{
+		int count = collexion->BinnedRadiusAcquire(subset, query_x[ii], query_y[ii], QUERY_RADIUS);
+		if (count > 0) collexion->SubsetRelease();
+
+		found += count;
+	}
+	double grid_usec = m_clock->usec() - start;
+
+	u32 scan_found = 0;
+	start = m_clock->usec();
+	for (int ii = 0; ii < SCANS; ++ii)
+	{
+		criterion._x = query_x[ii];
+		criterion._y = query_y[ii];
+
+		int count = collexion->BinnedSubsetAcquire(subset, &criterion);
+		if (count > 0) collexion->SubsetRelease();
+
+		scan_found += count;
+	}
+	double scan_usec = m_clock->usec() - start;
+
+	CAT_INFO("InterestGridBench") << "Radius query: grid " << grid_usec / QUERIES << " us, criterion scan "
+		<< scan_usec / SCANS << " us (" << found / (double)QUERIES << " members per query)";
+
+	// Both must find the same members
+	for (int ii = 0; ii < SCANS; ++ii)
+	{
+		criterion._x = query_x[ii];
+		criterion._y = query_y[ii];
+
+		int scan_count = collexion->BinnedSubsetAcquire(subset, &criterion);
+		if (scan_count > 0) collexion->SubsetRelease();
+
+		int grid_count = collexion->BinnedRadiusAcquire(subset, query_x[ii], query_y[ii], QUERY_RADIUS);
+		if (grid_count > 0) collexion->SubsetRelease();
+
+		if (scan_count != grid_count)
+		{
+			CAT_WARN("InterestGridBench") << "Grid query at (" << query_x[ii] << ", " << query_y[ii] << ") found "
+				<< grid_count << " members but the scan found " << scan_count;
+			success = false;
+		}
+	}
+
+	delete []query_x;
+	delete []query_y;
+
+	// Small moves, as from player movement updates
+	start = m_clock->usec();
+	for (int ii = 0; ii < MOVES; ++ii)
+	{
+		BenchConnexion *conn = members[prng.Next() % MEMBERS];
+
+		conn->_x += (s32)(prng.Next() % 21 - 10) * 0.1f;
+		conn->_y += (s32)(prng.Next() % 21 - 10) * 0.1f;
+
+		collexion->SetPosition(conn, conn->_x, conn->_y);
+	}
+	double move_usec = m_clock->usec() - start;
+
+	CAT_INFO("InterestGridBench") << "SetPosition: " << move_usec * 1000. / MOVES << " ns";
+
+	delete collexion;
+
+	for (u32 ii = 0; ii < MEMBERS; ++ii)
+		members[ii]->Destroy(CAT_REFOBJECT_TRACE);
+	delete []members;
+
+	CAT_INFO("InterestGridBench") << (success ? "SUCCESS" : "FAILURE");
+
+	return success ? 0 : 1;
+}
@@ -0,0 +1,278 @@
+#include <cat/AllSphynx.hpp>
+#include <cat/rand/AbyssinianPRNG.hpp>
+using namespace cat;
+using namespace sphynx;
+
+/*
+	Path MTU discovery test
+
+	Drives the MTUDiscovery state machine against a simulated path with no
+	sockets involved: each probe no larger than the path MTU is reported a
+	step later unless it is dropped at random, and larger probes are lost.
+	Checks that the search converges to within SEARCH_RESOLUTION of the path
+	MTU, that a drop in the path MTU is found as a black hole and handled by
+	falling back to the base size until the peer reports it, that stale and
+	oversized reports are ignored, and that the search runs again above the
+	current size after RAISE_INTERVAL.  The clock starts just before it
+	wraps around.
+*/
+
+static const u32 BASE_BYTES = MINIMUM_MTU - 28;
+static const u32 CEILING_BYTES = 1450;
+static const u32 STEP = 50; // milliseconds
+static const u32 MAX_PENDING = 16;
+
+
+class SimulatedPath
+{
+	Abyssinian _prng;
+	u32 _loss_percent;
+
+	u32 _pending[MAX_PENDING], _pending_count;
+
+public:
+	u32 mtu, max_pmtu, black_holes, probes;
+
+	SimulatedPath(u32 path_mtu, u32 loss_percent, u32 seed)
+	{
+		_prng.Initialize(seed);
+		_loss_percent = loss_percent;
+		_pending_count = 0;
+
+		mtu = path_mtu;
+		max_pmtu = black_holes = probes = 0;
+	}
+
+	// Run the discovery for the given time, reporting probes that get through
+	void Run(MTUDiscovery &discovery, u32 &now, u32 duration)
+	{
+		for (u32 elapsed = 0; elapsed < duration; elapsed += STEP, now += STEP)
+		{
+			// Deliver reports for the probes that got through on the last step
+			for (u32 ii = 0; ii < _pending_count; ++ii)
+				discovery.OnProbeReport(now, _pending[ii]);
+			_pending_count = 0;
+
+			bool black_hole;
+			u32 probe_bytes = discovery.Tick(now, black_hole);
+
+			if (black_hole) ++black_holes;
+
+			if (probe_bytes)
+			{
+				++probes;
+
+				if (probe_bytes <= mtu && _prng.Next() % 100 >= _loss_percent && _pending_count < MAX_PENDING)
+					_pending[_pending_count++] = probe_bytes;
+			}
+
+			if (max_pmtu < discovery.GetPMTU())
+				max_pmtu = discovery.GetPMTU();
+		}
+	}
+};
+
+static bool Check(bool condition, const char *what)
+{
+	if (!condition)
+		CAT_WARN("MTUDiscoveryTest") << "FAILED: " << what;
+
+	return condition;
+}
+
+static bool Converged(MTUDiscovery &discovery, u32 path_mtu)
+{
+	u32 pmtu = discovery.GetPMTU();
+	return pmtu <= path_mtu && pmtu + MTUDiscovery::SEARCH_RESOLUTION > path_mtu;
+}
+
+static bool TestSearch()
+{
+	bool success = true;
+
+	// The ceiling is tried first, so a path that carries it converges on the first report
+	{
+		MTUDiscovery discovery;
+		u32 now = 0xffffff00;
+		discovery.Initialize(now, BASE_BYTES, CEILING_BYTES);
+
+		bool black_hole;
+		success &= Check(discovery.Tick(now, black_hole) == CEILING_BYTES && !black_hole, "First search probe is the ceiling");
+		success &= Check(discovery.OnProbeReport(now + STEP, CEILING_BYTES), "Ceiling report raises the size");
+		success &= Check(discovery.GetPMTU() == CEILING_BYTES, "Path that carries the ceiling uses it");
+
+		now += 2 * STEP;
+		success &= Check(discovery.Tick(now, black_hole) == 0 && discovery.GetState() == MTUDiscovery::STATE_COMPLETE,
+			"Search completes once the ceiling is reported");
+	}
+
+	// Bisection below the ceiling, with and without loss
+	static const u32 PATH_MTUS[] = { BASE_BYTES, BASE_BYTES + 1, 1000, 1280, 1400, CEILING_BYTES - 1 };
+
+	for (u32 loss = 0; loss <= 10; loss += 10)
+	{
+		for (u32 ii = 0; ii < sizeof(PATH_MTUS) / sizeof(PATH_MTUS[0]); ++ii)
+		{
+			MTUDiscovery discovery;
+			SimulatedPath path(PATH_MTUS[ii], loss, 0x1234 + ii);
+			u32 now = 0xfffff000;
+
+			discovery.Initialize(now, BASE_BYTES, CEILING_BYTES);
+			path.Run(discovery, now, 30000);
+
+			CAT_INFO("MTUDiscoveryTest") << "Search: path MTU " << PATH_MTUS[ii] << " at " << loss << "% loss found "
+				<< discovery.GetPMTU() << " bytes with " << path.probes << " probes";
+
+			success &= Check(Converged(discovery, PATH_MTUS[ii]), "Search converges to within the resolution of the path MTU");
+			success &= Check(path.max_pmtu <= PATH_MTUS[ii], "Search never uses a size above the path MTU");
+			success &= Check(path.black_holes == 0, "Stable path has no black holes");
+		}
+	}
+
+	return success;
+}
+
+static bool TestBlackHole()
+{
+	MTUDiscovery discovery;
+	SimulatedPath path(1400, 0, 0x5678);
+	u32 now = 0xfffff000;
+
+	discovery.Initialize(now, BASE_BYTES, CEILING_BYTES);
+	path.Run(discovery, now, 30000);
+
+	bool success = true;
+	success &= Check(Converged(discovery, 1400), "Black hole: Search converges before the route change");
+
+	// Route change onto a tunnel: confirmations of the current size start getting lost
+	path.mtu = 1200;
+
+	u32 detect_time = 0;
+	while (!path.black_holes && detect_time < 2 * MTU_PROBE_INTERVAL + MTUDiscovery::CONFIRM_TRIES * MTUDiscovery::PROBE_TIMEOUT)
+	{
+		path.Run(discovery, now, STEP);
+		detect_time += STEP;
+	}
+
+	CAT_INFO("MTUDiscoveryTest") << "Black hole: Detected after " << detect_time << " ms";
+
+	success &= Check(path.black_holes == 1, "Lost confirmations are found as a black hole");
+	success &= Check(discovery.GetBlackHoleCount() == 1, "Black hole count is kept");
+	success &= Check(discovery.GetPMTU() == BASE_BYTES, "Black hole drops straight to the base size");
+	success &= Check(discovery.GetState() == MTUDiscovery::STATE_RESET, "Black hole starts a fall back");
+
+	// While falling back, only the base size report counts
+	success &= Check(!discovery.OnProbeReport(now, 1000) && discovery.GetPMTU() == BASE_BYTES,
+		"Search report is ignored while falling back");
+	success &= Check(!discovery.OnProbeReport(now, 1400) && discovery.GetPMTU() == BASE_BYTES,
+		"Late report of the black hole size is ignored while falling back");
+
+	// The base size probe is repeated until it is reported, however many tries that takes
+	bool black_hole;
+	u32 base_probes = 0;
+	for (u32 ii = 0; ii < 20; ++ii, now += MTUDiscovery::PROBE_TIMEOUT)
+		if (discovery.Tick(now, black_hole) == BASE_BYTES)
+			++base_probes;
+
+	success &= Check(base_probes > MTUDiscovery::PROBE_TRIES && discovery.GetState() == MTUDiscovery::STATE_RESET,
+		"Unreported base size probe is repeated");
+	success &= Check(discovery.GetPMTU() == BASE_BYTES, "Size stays at the base while falling back");
+
+	// Once the base is reported, the search runs again below the failed size
+	discovery.OnProbeReport(now, BASE_BYTES);
+	success &= Check(discovery.GetState() == MTUDiscovery::STATE_SEARCH, "Base size report restarts the search");
+
+	path.max_pmtu = 0;
+	path.Run(discovery, now, 30000);
+
+	CAT_INFO("MTUDiscoveryTest") << "Black hole: Found " << discovery.GetPMTU() << " bytes after the route change";
+
+	success &= Check(Converged(discovery, 1200), "Search after a black hole converges to the new path MTU");
+	success &= Check(path.max_pmtu <= 1200, "Search after a black hole never uses a size above the new path MTU");
+	success &= Check(path.black_holes == 1, "Only one black hole is found");
+	return success;
+}
+
+static bool TestReports()
+{
+	MTUDiscovery discovery;
+	u32 now = 1000;
+	bool success = true;
+
+	// Reports before the discovery starts are ignored
+	success &= Check(!discovery.OnProbeReport(now, 1000) && discovery.GetPMTU() == 0, "Disabled discovery ignores reports");
+
+	discovery.Initialize(now, BASE_BYTES, CEILING_BYTES);
+
+	bool black_hole;
+	u32 probe_bytes = discovery.Tick(now, black_hole);
+
+	// Reports above the ceiling or at or below the current size do not raise it
+	success &= Check(!discovery.OnProbeReport(now, CEILING_BYTES + 1) && discovery.GetPMTU() == BASE_BYTES,
+		"Report above the ceiling is ignored");
+	success &= Check(!discovery.OnProbeReport(now, BASE_BYTES) && discovery.GetPMTU() == BASE_BYTES,
+		"Report of the base size does not raise it");
+
+	// The ceiling is lost, so the search bisects below it
+	now += MTUDiscovery::PROBE_TIMEOUT;
+	success &= Check(discovery.Tick(now, black_hole) == probe_bytes, "Lost search probe is sent again");
+	now += MTUDiscovery::PROBE_TIMEOUT;
+	u32 bisect_bytes = discovery.Tick(now, black_hole);
+	success &= Check(bisect_bytes == (BASE_BYTES + CEILING_BYTES) / 2, "Search bisects below a lost probe");
+
+	// A late report of a size that was given up on still raises the size, since it got through
+	success &= Check(discovery.OnProbeReport(now, 1300) && discovery.GetPMTU() == 1300, "Late report raises the size");
+
+	// A probe that cannot be posted is treated as lost without waiting
+	u32 failed_bytes = discovery.Tick(now, black_hole);
+	discovery.OnProbeFailure(now);
+	u32 next_bytes = discovery.Tick(now, black_hole);
+	success &= Check(failed_bytes > 1300 && next_bytes > 1300 && next_bytes < failed_bytes,
+		"Probe post failure moves the search below it at once");
+
+	// Disabling falls back to the base and stops probing
+	discovery.Disable();
+	success &= Check(discovery.GetPMTU() == BASE_BYTES && discovery.Tick(now + MTUDiscovery::RAISE_INTERVAL, black_hole) == 0,
+		"Disabled discovery stays at the base and does not probe");
+	return success;
+}
+
+static bool TestRaise()
+{
+	MTUDiscovery discovery;
+	SimulatedPath path(1000, 0, 0x9abc);
+	u32 now = 0xfffff000;
+
+	discovery.Initialize(now, BASE_BYTES, CEILING_BYTES);
+	path.Run(discovery, now, 30000);
+
+	bool success = true;
+	success &= Check(Converged(discovery, 1000), "Raise: Search converges on the narrow path");
+
+	// The path gets better: Nothing changes until the raise interval is up
+	path.mtu = CEILING_BYTES;
+	path.Run(discovery, now, MTUDiscovery::RAISE_INTERVAL / 2);
+	success &= Check(Converged(discovery, 1000), "Size is not raised before the raise interval");
+
+	path.Run(discovery, now, MTUDiscovery::RAISE_INTERVAL);
+
+	CAT_INFO("MTUDiscoveryTest") << "Raise: Found " << discovery.GetPMTU() << " bytes after the path improved";
+
+	success &= Check(discovery.GetPMTU() == CEILING_BYTES, "Search above the current size finds the better path");
+	success &= Check(path.black_holes == 0, "Raising the size finds no black holes");
+	return success;
+}
+
+int main()
+{
+	bool success = true;
+
+	success &= TestSearch();
+	success &= TestBlackHole();
+	success &= TestReports();
+	success &= TestRaise();
+
+	CAT_INFO("MTUDiscoveryTest") << (success ? "SUCCESS" : "FAILURE");
+
+	return success ? 0 : 1;
+}
@@ -0,0 +1,220 @@
+/*
+	Copyright (c) 2012 Christopher A. Taylor.  All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	* Redistributions of source code must retain the above copyright notice,
+	  this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	* Neither the name of LibCat nor the names of its contributors may be used
+	  to endorse or promote products derived from this software without
+	  specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	State replication bandwidth benchmark
+
+	Simulates one client receiving a world of entities every tick, where a
+	fraction of the entities move or change each tick.  Updates and acks are
+	dropped at the given loss rate and acks arrive ACK_DELAY_TICKS late.
+	Reports the bytes per tick that StateReplicator puts on the wire,
+	compared to sending the full state every tick, and checks that every
+	decoded state matches what the server sent.
+*/
+
+#include <cat/AllSphynx.hpp>
+using namespace cat;
+using namespace sphynx;
+
+static Clock *m_clock = 0;
+
+static const int TICKS = 20000;
+static const int ENTITY_COUNT = 128;
+static const int ACK_DELAY_TICKS = 6;
+
+
+//// World
+
+#pragma pack(push)
+#pragma pack(1)
+struct EntityState
+{
+	u32 id;
+	float x, y, z;
+	float yaw;
+	u16 health;
+	u8 animation;
+	u8 flags;
+};
+#pragma pack(pop)
+
+static u32 m_seed = 1;
+
+static CAT_INLINE u32 NextRand()
+{
+	// xorshift32
+	m_seed ^= m_seed << 13;
+	m_seed ^= m_seed >> 17;
+	m_seed ^= m_seed << 5;
+	return m_seed;
+}
+
+static void InitializeWorld(EntityState *world)
+{
+	for (int ii = 0; ii < ENTITY_COUNT; ++ii)
+	{
+		EntityState *e = &world[ii];
+		e->id = ii + 1000;
+		e->x = (float)(NextRand() % 4000);
+		e->y = (float)(NextRand() % 4000);
+		e->z = 0.f;
+		e->yaw = 0.f;
+		e->health = 100;
+		e->animation = 0;
+		e->flags = 0;
+	}
+}
+
+static void TickWorld(EntityState *world, u32 move_percent)
+{
+	for (int ii = 0; ii < ENTITY_COUNT; ++ii)
+	{
+		EntityState *e = &world[ii];
+
+		if (NextRand() % 100 < move_percent)
+		{
+			e->x += (float)((s32)(NextRand() % 9) - 4) * 0.25f;
+			e->y += (float)((s32)(NextRand() % 9) - 4) * 0.25f;
+			e->yaw = (float)(NextRand() % 360);
+			e->animation = 1;
+		}
+		else
+			e->animation = 0;
+
+		if (NextRand() % 100 == 0)
+			e->health = (u16)(NextRand() % 101);
+	}
+}
+
+
+//// Simulation
+
+static bool BenchScenario(u32 loss_percent, u32 move_percent)
+{
+	EntityState world[ENTITY_COUNT];
+	InitializeWorld(world);
+
+	StateReplicator replicator;
+	StateReceiver receiver;
+
+	u8 *packet = new u8[StateReplicator::MaxEncodedBytes(sizeof(world))];
+
+	// Acks in flight, indexed by arrival tick
+	u8 acks[ACK_DELAY_TICKS][StateReceiver::ACK_BYTES];
+	bool ack_pending[ACK_DELAY_TICKS];
+	CAT_OBJCLR(ack_pending);
+
+	u32 delivered = 0, decode_failures = 0;
+	double encode_usec = 0;
+
+	for (int tick = 0; tick < TICKS; ++tick)
+	{
+		// Deliver the ack that was sent ACK_DELAY_TICKS ago
+		int ack_slot = tick % ACK_DELAY_TICKS;
+		if (ack_pending[ack_slot])
+		{
+			replicator.OnAck(acks[ack_slot], StateReceiver::ACK_BYTES);
+			ack_pending[ack_slot] = false;
+		}
+
+		TickWorld(world, move_percent);
+
+		double start = m_clock->usec();
+		u32 bytes = replicator.Encode(world, sizeof(world), packet, StateReplicator::MaxEncodedBytes(sizeof(world)));
+		encode_usec += m_clock->usec() - start;
+
+		if (!bytes)
+		{
+			CAT_FATAL("ReplicationBench") << "Encode failed";
+			delete []packet;
+			return false;
+		}
+
+		// Lose the update
+		if (NextRand() % 100 < loss_percent)
+			continue;
+
+		if (!receiver.OnUpdate(packet, bytes))
+		{
+			++decode_failures;
+			continue;
+		}
+
+		if (receiver.GetStateBytes() != sizeof(world) ||
+			memcmp(receiver.GetState(), world, sizeof(world)) != 0)
+		{
+			CAT_FATAL("ReplicationBench") << "Decoded state does not match on tick " << tick;
+			delete []packet;
+			return false;
+		}
+
+		++delivered;
+
+		// Send the ack back unless it is lost too
+		if (NextRand() % 100 >= loss_percent)
+		{
+			receiver.GetAck(acks[ack_slot]);
+			ack_pending[ack_slot] = true;
+		}
+	}
+
+	delete []packet;
+
+	double full_per_tick = (double)replicator.GetStateBytes() / TICKS;
+	double encoded_per_tick = (double)replicator.GetEncodedBytes() / TICKS;
+
+	CAT_INFO("ReplicationBench") << "loss " << loss_percent << "%, moving " << move_percent << "%: "
+		<< encoded_per_tick << " bytes/tick vs " << full_per_tick << " full ("
+		<< full_per_tick / encoded_per_tick << "x), " << replicator.GetDeltaCount() << " deltas, "
+		<< replicator.GetFullCount() << " full, " << delivered << " delivered, "
+		<< decode_failures << " undecodable, encode " << encode_usec / TICKS << " usec";
+
+	return true;
+}
+
+int main()
+{
+	m_clock = Clock::ref();
+
+	CAT_INFO("ReplicationBench") << "ReplicationBench 1.0: " << ENTITY_COUNT << " entities, "
+		<< sizeof(EntityState) * ENTITY_COUNT << " byte state, " << TICKS << " ticks";
+
+	static const u32 LOSS[] = { 0, 5, 20 };
+	static const u32 MOVING[] = { 10, 50 };
+
+	for (int ii = 0; ii < (int)(sizeof(LOSS) / sizeof(LOSS[0])); ++ii)
+	{
+		for (int jj = 0; jj < (int)(sizeof(MOVING) / sizeof(MOVING[0])); ++jj)
+		{
+			if (!BenchScenario(LOSS[ii], MOVING[jj]))
+				return 1;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,272 @@
+#include <cat/AllSphynx.hpp>
+using namespace cat;
+using namespace sphynx;
+
+/*
+	Transport send scheduler test
+
+	Builds send queues by hand and runs them through the scheduler that
+	WriteQueuedReliable() uses, checking that backlogged queues split the
+	bandwidth by weight, that leftover bandwidth goes to the earliest
+	deadline first (including a queue already past its deadline), and that
+	a weight-0 queue sends nothing while the other queues use it all.
+*/
+
+static const u32 MSG_BYTES = 100;
+static const u32 NODE_COST = MSG_BYTES + 1; // DequeueBandwidth() adds a byte per message for the header
+static const u32 BACKLOG = 200;
+
+
+class TestTransport : public Transport
+{
+protected:
+	void OnDisconnectComplete() {}
+	s32 WriteDatagrams(const BatchSet &buffers, u32 count) { return 0; }
+	void OnMessages(IncomingMessage msgs[], u32 count) {}
+	void OnInternal(u32 recv_time, BufferStream msg, u32 bytes) {}
+	void OnDisconnectReason(u8 reason) {}
+};
+
+
+namespace cat {
+
+namespace sphynx {
+
+class SchedulerTest
+{
+	TestTransport _transport;
+	OutgoingMessage *_queue[Transport::NUM_SCHEDULED_QUEUES];
+	OutgoingMessage *_out_head[Transport::NUM_SCHEDULED_QUEUES], *_out_tail[Transport::NUM_SCHEDULED_QUEUES];
+	u32 _order[Transport::NUM_SCHEDULED_QUEUES], _order_count;
+
+	void FreeQueues()
+	{
+		for (u32 queue = 0; queue < Transport::NUM_SCHEDULED_QUEUES; ++queue)
+		{
+			for (OutgoingMessage *next, *node = _queue[queue]; node; node = next)
+			{
+				next = node->next;
+				OutgoingMessage::Release(node);
+			}
+
+			_queue[queue] = 0;
+		}
+	}
+
+public:
+	SchedulerTest()
+	{
+		CAT_OBJCLR(_queue);
+	}
+
+	~SchedulerTest()
+	{
+		FreeQueues();
+	}
+
+	bool Reset(u32 weight[Transport::NUM_SCHEDULED_QUEUES])
+	{
+		FreeQueues();
+
+		for (u32 queue = 0; queue < Transport::NUM_SCHEDULED_QUEUES; ++queue)
+		{
+			_transport.SetQueueWeight(queue, weight[queue]);
+			_transport.SetQueueDeadline(queue, queue == Transport::UNRELIABLE_QUEUE ? 20 : 100);
+		}
+
+		return true;
+	}
+
+	CAT_INLINE void SetDeadline(u32 queue, u32 msec) { _transport.SetQueueDeadline(queue, msec); }
+
+	bool Fill(u32 queue, u32 count, u32 ts_queued)
+	{
+		OutgoingMessage *tail = 0;
+
+		for (u32 ii = 0; ii < count; ++ii)
+		{
+			u8 *msg = OutgoingMessage::Acquire(MSG_BYTES);
+			if (!msg) return false;
+
+			OutgoingMessage *node = OutgoingMessage::Promote(msg);
+			node->next = 0;
+			node->shared = 0;
+			node->SetBytes(MSG_BYTES);
+			node->send_bytes = 0;
+			node->sent_bytes = 0;
+			node->ts_queued = ts_queued;
+
+			if (tail) tail->next = node;
+			else _queue[queue] = node;
+			tail = node;
+		}
+
+		return true;
+	}
+
+	void Schedule(s32 bandwidth)
+	{
+		for (u32 queue = 0; queue < Transport::NUM_SCHEDULED_QUEUES; ++queue)
+			_out_head[queue] = _queue[queue];
+
+		_order_count = _transport.ScheduleQueues(bandwidth, _out_head, _out_tail, _order);
+	}
+
+	// Number of messages the scheduler dequeued from the queue, or 0 if it will not be written
+	u32 Dequeued(u32 queue)
+	{
+		if (!_out_head[queue]) return 0;
+
+		u32 count = 0;
+		for (OutgoingMessage *node = _out_head[queue]; node && node != _out_tail[queue]; node = node->next)
+			++count;
+
+		return count;
+	}
+
+	// Position of the queue in the write order, or -1 if it is not written
+	int Position(u32 queue)
+	{
+		for (u32 ii = 0; ii < _order_count; ++ii)
+			if (_order[ii] == queue)
+				return (int)ii;
+
+		return -1;
+	}
+
+	CAT_INLINE u32 GetOrderCount() { return _order_count; }
+};
+
+} // namespace sphynx
+
+} // namespace cat
+
+
+static bool Check(bool condition, const char *what)
+{
+	if (!condition)
+		CAT_WARN("SchedulerTest") << "FAILED: " << what;
+
+	return condition;
+}
+
+static bool Near(u32 actual, u32 expected, u32 slack)
+{
+	return actual + slack >= expected && actual <= expected + slack;
+}
+
+static bool TestShares(SchedulerTest &test)
+{
+	u32 weight[Transport::NUM_SCHEDULED_QUEUES] = { 8, 8, 4, 1, 8 };
+	test.Reset(weight);
+
+	// Three streams backlogged at once, more than the bandwidth can carry
+	if (!test.Fill(STREAM_1, BACKLOG, 0) || !test.Fill(STREAM_2, BACKLOG, 0) || !test.Fill(STREAM_BULK, BACKLOG, 0))
+		return false;
+
+	const u32 bandwidth = 130 * NODE_COST;
+	test.Schedule(bandwidth);
+
+	u32 s1 = test.Dequeued(STREAM_1), s2 = test.Dequeued(STREAM_2), bulk = test.Dequeued(STREAM_BULK);
+
+	CAT_INFO("SchedulerTest") << "Shares 8:4:1 of " << bandwidth << " bytes: " << s1 << " / " << s2 << " / " << bulk << " messages";
+
+	bool success = true;
+	success &= Check(Near(s1, 80, 2), "Stream 1 gets 8/13 of the bandwidth");
+	success &= Check(Near(s2, 40, 2), "Stream 2 gets 4/13 of the bandwidth");
+	success &= Check(Near(bulk, 10, 2), "Bulk stream gets 1/13 of the bandwidth");
+	success &= Check(test.Dequeued(STREAM_UNORDERED) == 0 && test.Position(STREAM_UNORDERED) < 0, "Empty queue is not scheduled");
+	return success;
+}
+
+static bool TestDeadlines(SchedulerTest &test)
+{
+	// With no weights, everything is leftover bandwidth handed out by deadline
+	u32 weight[Transport::NUM_SCHEDULED_QUEUES] = { 0, 0, 0, 0, 0 };
+	test.Reset(weight);
+
+	test.SetDeadline(STREAM_1, 20);
+	test.SetDeadline(STREAM_BULK, 500);
+
+	// Bulk has waited past its deadline across the clock wrap, so it is due
+	// before the fresher stream 1 message even though its target delay is longer
+	const u32 bulk_queued = 0xffffff00, s1_queued = 0x00000200;
+	if (!test.Fill(STREAM_1, BACKLOG, s1_queued) || !test.Fill(STREAM_BULK, 20, bulk_queued))
+		return false;
+
+	test.Schedule(30 * NODE_COST);
+
+	u32 s1 = test.Dequeued(STREAM_1), bulk = test.Dequeued(STREAM_BULK);
+
+	CAT_INFO("SchedulerTest") << "Deadlines: bulk " << bulk << " messages at position " << test.Position(STREAM_BULK)
+		<< ", stream 1 " << s1 << " messages at position " << test.Position(STREAM_1);
+
+	bool success = true;
+	success &= Check(test.Position(STREAM_BULK) == 0 && test.Position(STREAM_1) == 1, "Overdue bulk queue is written first");
+	success &= Check(bulk == 20, "Overdue bulk queue is drained first");
+	success &= Check(Near(s1, 10, 1), "Stream 1 gets what the bulk queue leaves");
+
+	// Out of bandwidth: nothing is written at all
+	test.Schedule(0);
+
+	success &= Check(test.GetOrderCount() == 0 && test.Dequeued(STREAM_1) == 0 && test.Dequeued(STREAM_BULK) == 0,
+		"Nothing is scheduled without bandwidth");
+	return success;
+}
+
+static bool TestZeroWeight(SchedulerTest &test)
+{
+	u32 weight[Transport::NUM_SCHEDULED_QUEUES] = { 8, 8, 4, 0, 8 };
+	test.Reset(weight);
+
+	// Bulk has the earliest deadline but no weight, and stream 1 uses up all the bandwidth
+	test.SetDeadline(STREAM_BULK, 0);
+
+	if (!test.Fill(STREAM_1, BACKLOG, 0) || !test.Fill(STREAM_BULK, BACKLOG, 0))
+		return false;
+
+	test.Schedule(50 * NODE_COST);
+
+	u32 s1 = test.Dequeued(STREAM_1), bulk = test.Dequeued(STREAM_BULK);
+
+	CAT_INFO("SchedulerTest") << "Weight 0 while backlogged: stream 1 " << s1 << " messages, bulk " << bulk;
+
+	bool success = true;
+	success &= Check(Near(s1, 50, 1), "Stream 1 gets all the bandwidth");
+	success &= Check(bulk == 0 && test.Position(STREAM_BULK) < 0, "Weight-0 queue sends nothing while the others are backlogged");
+
+	// Now stream 1 has only a little to send, leaving bandwidth over for bulk
+	test.Reset(weight);
+	test.SetDeadline(STREAM_BULK, 0);
+
+	if (!test.Fill(STREAM_1, 5, 0) || !test.Fill(STREAM_BULK, BACKLOG, 0))
+		return false;
+
+	test.Schedule(50 * NODE_COST);
+
+	s1 = test.Dequeued(STREAM_1);
+	bulk = test.Dequeued(STREAM_BULK);
+
+	CAT_INFO("SchedulerTest") << "Weight 0 with bandwidth left over: stream 1 " << s1 << " messages, bulk " << bulk;
+
+	success &= Check(s1 == 5, "Stream 1 sends its whole queue");
+	success &= Check(Near(bulk, 45, 1), "Weight-0 queue gets the leftover bandwidth");
+	return success;
+}
+
+int main()
+{
+	SchedulerTest *test = new SchedulerTest;
+
+	bool success = true;
+
+	success &= TestShares(*test);
+	success &= TestDeadlines(*test);
+	success &= TestZeroWeight(*test);
+
+	delete test;
+
+	CAT_INFO("SchedulerTest") << (success ? "SUCCESS" : "FAILURE");
+
+	return success ? 0 : 1;
+}
@@ -39,6 +39,7 @@ protected:
 
 	virtual void OnDestroy();
 	virtual bool OnFinalize();
+	virtual void OnTick(ThreadLocalStorage &tls, u32 now);
 	virtual Connexion *NewConnexion();
 	virtual bool AcceptNewConnexion(const NetAddr &src);
 };
@@ -76,7 +77,7 @@ void GameConnexion::OnConnect()
 		test_msg[ii] = (u8)(prng.Next() % 10);
 	//WriteReliable(STREAM_2, OP_TEST_FRAGMENTS, test_msg, sizeof(test_msg));
 
-	u16 key = getLE(GetMyID());
+	u16 key = getLE((u16)GetMyID());
 
 	Collexion<GameConnexion> *user_list = &GetServer<GameServer>()->_collexion;
 
@@ -127,7 +128,7 @@ void GameConnexion::OnDisconnectReason(u8 reason)
 {
 	CAT_WARN("Connexion") << "-- DISCONNECTED REASON " << (int)reason;
 
-	u16 key = getLE(GetMyID());
+	u16 key = getLE((u16)GetMyID());
 
 	Collexion<GameConnexion> *user_list = &GetServer<GameServer>()->_collexion;
 
@@ -156,6 +157,14 @@ bool GameServer::OnFinalize()
 	return Server::OnFinalize();
 }
 
+void GameServer::OnTick(ThreadLocalStorage &tls, u32 now)
+{
+	// Release users that left, once no broadcast is still walking them
+	_collexion.Reclaim();
+
+	Server::OnTick(tls, now);
+}
+
 Connexion *GameServer::NewConnexion()
 {
 	CAT_WARN("Server") << "-- Allocating a new Connexion";
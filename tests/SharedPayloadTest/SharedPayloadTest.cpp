@@ -0,0 +1,312 @@
+#include <cat/AllSphynx.hpp>
+#include <cat/rand/AbyssinianPRNG.hpp>
+using namespace cat;
+using namespace sphynx;
+
+/*
+	Shared broadcast payload test
+
+	Queues one SharedPayload on several transports the way BroadcastReliable()
+	does, with a message several datagrams long so that every transport
+	sends it in fragments.  Each transport then lets go of its node along a
+	different path: acknowledged after a full send, acknowledged part way
+	through the send and again at the end, or torn down while still queued,
+	part sent, or waiting for acknowledgment.
+
+	The test holds HOLD references of its own, so the payload is never freed
+	while it is being checked.  After each step the count must be exactly
+	HOLD plus the number of transports still holding the message: one less
+	means a node released it twice, one more means a node leaked it.  Once
+	only the test holds it, the test drops its references and frees it.  A
+	payload that compresses and one that does not are both tried, since a
+	fragmented send switches the node over to the compressed copy.
+*/
+
+static const u32 MSG_BYTES = 8000;
+static const u32 TRANSPORT_COUNT = 6;
+static const u32 HOLD = 1000;
+static const StreamMode STREAM = STREAM_BULK;
+static const s32 ALL_BANDWIDTH = 1000000;
+
+
+class TestTransport : public Transport
+{
+protected:
+	void OnDisconnectComplete() {}
+	void OnMessages(IncomingMessage msgs[], u32 count) {}
+	void OnInternal(u32 recv_time, BufferStream msg, u32 bytes) {}
+	void OnDisconnectReason(u8 reason) {}
+
+	// Drop the datagrams; acknowledgments are made up by the test
+	s32 WriteDatagrams(const BatchSet &buffers, u32 count)
+	{
+		s32 bytes = 0;
+
+		for (BatchHead *node = buffers.head; node; node = node->batch_next)
+			bytes += static_cast<SendBuffer*>( node )->data_bytes;
+
+		UDPSendAllocator::ref()->ReleaseBatch(buffers);
+
+		return bytes;
+	}
+};
+
+
+namespace cat {
+
+namespace sphynx {
+
+class SharedPayloadTest
+{
+	TransportTLS _tls;
+
+public:
+	bool Initialize()
+	{
+		return _tls.OnInitialize();
+	}
+
+	TestTransport *NewTransport()
+	{
+		TestTransport *transport = new TestTransport;
+
+		transport->InitializePayloadBytes(false);
+		transport->InitializeTLS(&_tls);
+
+		return transport;
+	}
+
+	SharedPayload *AcquirePayload(bool compressible, Abyssinian &prng)
+	{
+		u8 msg[MSG_BYTES];
+
+		// Runs of zeroes between random bytes compress, but not into a single datagram
+		for (u32 ii = 0; ii < MSG_BYTES; ++ii)
+			msg[ii] = (compressible && (ii & 16)) ? 0 : (u8)prng.Next();
+
+		SharedPayload *payload = Transport::AcquireSharedPayload(1, msg, MSG_BYTES);
+		if (payload) payload->references = HOLD;
+
+		return payload;
+	}
+
+	// Queue one node per transport, as AppendSharedPayload() does
+	void Queue(SharedPayload *payload, TestTransport *transports[], u32 count)
+	{
+		OutgoingMessage *head = Transport::AcquireSharedMessages(payload, count, SOP_DATA);
+
+		for (u32 ii = 0; ii < count; ++ii)
+		{
+			OutgoingMessage *next = head->next;
+			SendQueue &queue = transports[ii]->_send_queue[STREAM];
+
+			head->next = 0;
+			queue.head = queue.tail = head;
+
+			head = next;
+		}
+	}
+
+	// Write the queued message with the given bandwidth, as WriteQueuedReliable() does.
+	// Returns true if the whole message has been written
+	bool Send(Transport *transport, s32 bandwidth)
+	{
+		// Each transport only ever has one message queued
+		SendQueue &queue = transport->_send_queue[STREAM];
+		if (queue.head)
+		{
+			transport->_sending_queue[STREAM] = queue;
+			queue.head = queue.tail = 0;
+		}
+
+		OutgoingMessage *node = transport->_sending_queue[STREAM].head;
+		if (!node) return true;
+
+		u32 now = Clock::ref()->msec();
+
+		transport->_send_cluster_lock->Enter();
+
+		bool done = transport->WriteSendQueueNode(node, now, STREAM, bandwidth);
+		if (done)
+		{
+			transport->_sending_queue[STREAM].head = node->next;
+			if (!node->next) transport->_sending_queue[STREAM].tail = 0;
+		}
+
+		// Write out the datagrams without pulling anything else from the queues, as FlushWrites() does
+		if (transport->_send_cluster.bytes)
+		{
+			transport->QueueWriteDatagram(transport->_send_cluster);
+			transport->_send_cluster.Clear();
+		}
+
+		BatchSet outgoing_datagrams = transport->_outgoing_datagrams;
+		u32 count = transport->_outgoing_datagrams_count;
+
+		transport->_outgoing_datagrams.Clear();
+		transport->_outgoing_datagrams_count = 0;
+
+		transport->_send_cluster_lock->Leave();
+
+		if (outgoing_datagrams.head)
+			transport->WriteDatagrams(outgoing_datagrams, count);
+
+		return done;
+	}
+
+	// Acknowledge everything written so far with a rollup ACK
+	void Acknowledge(Transport *transport)
+	{
+		u32 ack_id = transport->_next_send_id[STREAM];
+
+		u8 ack[3];
+		ack[0] = (u8)(1 | (STREAM << 1) | ((ack_id & 31) << 3));
+		ack[1] = (u8)(ack_id >> 5);
+		ack[2] = (u8)(ack_id >> 13);
+
+		transport->OnACK(Clock::ref()->msec(), ack, sizeof(ack));
+	}
+
+	// Number of fragments written but not yet acknowledged
+	u32 Unacknowledged(Transport *transport)
+	{
+		u32 count = 0;
+
+		for (OutgoingMessage *node = transport->_sent_list[STREAM].head; node; node = node->next)
+			++count;
+
+		return count;
+	}
+
+	// The message still waiting to be written, or 0
+	OutgoingMessage *Sending(Transport *transport)
+	{
+		return transport->_sending_queue[STREAM].head;
+	}
+};
+
+} // namespace sphynx
+
+} // namespace cat
+
+
+static bool Check(bool condition, const char *what)
+{
+	if (!condition)
+		CAT_WARN("SharedPayloadTest") << "FAILED: " << what;
+
+	return condition;
+}
+
+static bool CheckReferences(SharedPayload *payload, u32 holders, const char *what)
+{
+	if (payload->references == HOLD + holders)
+		return true;
+
+	CAT_WARN("SharedPayloadTest") << "FAILED: " << what << ": " << (s32)(payload->references - HOLD)
+		<< " references for " << holders << " transports";
+	return false;
+}
+
+static bool TestPayload(SharedPayloadTest &test, bool compressible, Abyssinian &prng)
+{
+	SharedPayload *payload = test.AcquirePayload(compressible, prng);
+	if (!payload) return Check(false, "Out of memory");
+
+	TestTransport *transports[TRANSPORT_COUNT];
+	for (u32 ii = 0; ii < TRANSPORT_COUNT; ++ii)
+		transports[ii] = test.NewTransport();
+
+	test.Queue(payload, transports, TRANSPORT_COUNT);
+
+	CAT_INFO("SharedPayloadTest") << (compressible ? "Compressible" : "Incompressible") << " payload: " << payload->bytes
+		<< " bytes, " << payload->compressed_bytes << " compressed";
+
+	bool success = true;
+	success &= Check(compressible == (payload->compressed_bytes > 0), "Only the compressible payload has a compressed copy");
+	success &= CheckReferences(payload, TRANSPORT_COUNT, "Every transport holds the queued message");
+
+	// 0: Sent in full, then acknowledged
+	success &= Check(test.Send(transports[0], ALL_BANDWIDTH), "Message is written in one pass");
+	success &= Check(test.Unacknowledged(transports[0]) > 1, "Message is written in fragments");
+	success &= CheckReferences(payload, TRANSPORT_COUNT, "Fragments keep the message until they are acknowledged");
+
+	test.Acknowledge(transports[0]);
+	success &= Check(test.Unacknowledged(transports[0]) == 0, "Acknowledged fragments are freed");
+	success &= CheckReferences(payload, TRANSPORT_COUNT - 1, "Acknowledged message is released");
+
+	// 1: Every fragment written so far is acknowledged before the rest are written
+	success &= Check(!test.Send(transports[1], 1), "Message is written in part");
+	test.Acknowledge(transports[1]);
+	success &= CheckReferences(payload, TRANSPORT_COUNT - 1, "Part sent message is kept after its fragments are acknowledged");
+
+	OutgoingMessage *node = test.Sending(transports[1]);
+	u32 node_bytes = node ? node->GetBytes() : 0;
+
+	bool done = false;
+	for (u32 pass = 0; !done && pass < 100; ++pass)
+		done = test.Send(transports[1], 1);
+
+	success &= Check(done, "Rest of the message is written after an acknowledgment");
+	success &= Check(node && node->orig_bytes == payload->bytes && node->GetBytes() == node_bytes && node->sent_bytes == node_bytes,
+		"Writing resumes where it left off after every fragment is acknowledged");
+
+	test.Acknowledge(transports[1]);
+	success &= CheckReferences(payload, TRANSPORT_COUNT - 2, "Message acknowledged in two parts is released once");
+
+	// 2: Sent in full but never acknowledged
+	test.Send(transports[2], ALL_BANDWIDTH);
+
+	// 3: Sent in part and never acknowledged
+	test.Send(transports[3], 1);
+
+	// 4: Never sent
+
+	// 5: Sent in part and acknowledged, then torn down before the rest is sent
+	test.Send(transports[5], 1);
+	test.Acknowledge(transports[5]);
+
+	success &= CheckReferences(payload, TRANSPORT_COUNT - 2, "Unacknowledged messages are still held");
+
+	// Tear down the rest
+	for (u32 ii = 2; ii < TRANSPORT_COUNT; ++ii)
+	{
+		delete transports[ii];
+		success &= CheckReferences(payload, TRANSPORT_COUNT - 1 - ii, "Torn down transport releases its message once");
+	}
+
+	delete transports[0];
+	delete transports[1];
+
+	success &= CheckReferences(payload, 0, "Only the test holds the payload at the end");
+
+	// Drop the test's references the way BroadcastReliable() drops its own
+	if (Atomic::Add(&payload->references, -(s32)HOLD) == HOLD)
+		StdAllocator::ref()->Release(payload);
+	else
+		success &= Check(false, "Test held the last references");
+
+	return success;
+}
+
+int main()
+{
+	SharedPayloadTest *test = new SharedPayloadTest;
+
+	Abyssinian prng;
+	prng.Initialize(0x5eed);
+
+	bool success = test->Initialize();
+
+	if (success)
+	{
+		success &= TestPayload(*test, true, prng);
+		success &= TestPayload(*test, false, prng);
+	}
+
+	delete test;
+
+	CAT_INFO("SharedPayloadTest") << (success ? "SUCCESS" : "FAILURE");
+
+	return success ? 0 : 1;
+}
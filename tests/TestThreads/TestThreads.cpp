@@ -1,4 +1,5 @@
 #include <cat/AllCommon.hpp>
+#include <cat/math/MemXOR.hpp>
 #include <conio.h> // kbhit()
 using namespace cat;
 
@@ -42,262 +43,85 @@ public:
 
 /*
 	XOR engine timing
-*/
-
-
-static void memxor(void *voutput, const void *vinput, int bytes)
-{
-	u64 *output64 = reinterpret_cast<u64*>( voutput );
-	const u64 *input64 = reinterpret_cast<const u64*>( vinput );
-
-	int words = bytes / 8;
-	for (int ii = 0; ii < words; ++ii)
-		output64[ii] ^= input64[ii];
-
-	u8 *output = reinterpret_cast<u8*>( output64 + words );
-	const u8 *input = reinterpret_cast<const u8*>( input64 + words );
-
-	bytes %= 8;
-	while (bytes--)
-		*output++ ^= *input++;
-}
-
-
-
-
-static void memxor2(void *voutput, const void *vinput, int bytes)
-{
-	u64 *output64 = reinterpret_cast<u64*>( voutput );
-	const u64 *input64 = reinterpret_cast<const u64*>( vinput );
-
-	while (bytes >= 32)
-	{
-		*output64++ ^= *input64++;
-		*output64++ ^= *input64++;
-		*output64++ ^= *input64++;
-		*output64++ ^= *input64++;
-		bytes -= 32;
-	}
-
-	while (bytes >= 8)
-	{
-		*output64++ ^= *input64++;
-		bytes -= 8;
-	}
-
-	u8 *output = reinterpret_cast<u8*>( output64 );
-	const u8 *input = reinterpret_cast<const u8*>( input64 );
-
-	while (bytes--)
-		*output++ ^= *input++;
-}
 
+	Times the shared cat::memxor engine over the block sizes that Wirehair
+	and the file transfer code use, with misaligned buffers on purpose.
+*/
 
+static const int XOR_BUFFER_BYTES = 65536 + 64;
 
+static u8 xor_output[XOR_BUFFER_BYTES], xor_a[XOR_BUFFER_BYTES], xor_b[XOR_BUFFER_BYTES];
 
-static void memxor3(void *voutput, const void *vinput, int bytes)
+// Check the engine against a byte-at-a-time XOR for every length up to max_bytes
+static bool XORCheck(int max_bytes)
 {
-	u64 *output64 = reinterpret_cast<u64*>( voutput );
-	const u64 *input64 = reinterpret_cast<const u64*>( vinput );
-
-	while (bytes >= 128)
-	{
-		output64[0] ^= input64[0];
-		output64[1] ^= input64[1];
-		output64[2] ^= input64[2];
-		output64[3] ^= input64[3];
-		output64[4] ^= input64[4];
-		output64[5] ^= input64[5];
-		output64[6] ^= input64[6];
-		output64[7] ^= input64[7];
-		output64[8] ^= input64[8];
-		output64[9] ^= input64[9];
-		output64[10] ^= input64[10];
-		output64[11] ^= input64[11];
-		output64[12] ^= input64[12];
-		output64[13] ^= input64[13];
-		output64[14] ^= input64[14];
-		output64[15] ^= input64[15];
-		output64 += 16;
-		input64 += 16;
-		bytes -= 128;
-	}
+	static u8 expected[XOR_BUFFER_BYTES];
 
-	while (bytes >= 8)
+	for (int bytes = 0; bytes <= max_bytes; ++bytes)
 	{
-		*output64++ ^= *input64++;
-		bytes -= 8;
-	}
+		int offset = bytes % 61;
 
-	u8 *output = reinterpret_cast<u8*>( output64 );
-	const u8 *input = reinterpret_cast<const u8*>( input64 );
-
-	while (bytes--)
-		*output++ ^= *input++;
-}
-
-
-static void memxor(void *voutput, const void *va, const void *vb, int bytes)
-{
-	u64 *output64 = reinterpret_cast<u64*>( voutput );
-	const u64 *a64 = reinterpret_cast<const u64*>( va );
-	const u64 *b64 = reinterpret_cast<const u64*>( vb );
+		for (int ii = 0; ii < bytes; ++ii)
+			expected[ii] = xor_output[offset + ii] ^ xor_a[ii + 3] ^ xor_b[ii + 7];
 
-	int words = bytes / 8;
-	for (int ii = 0; ii < words; ++ii)
-		output64[ii] = a64[ii] ^ b64[ii];
-
-	u8 *output = reinterpret_cast<u8*>( output64 + words );
-	const u8 *a = reinterpret_cast<const u8*>( a64 + words );
-	const u8 *b = reinterpret_cast<const u8*>( b64 + words );
-
-	bytes %= 8;
-	while (bytes--)
-		*output++ = *a++ ^ *b++;
-}
-
-
-
-static void memxor4(void *voutput, const void *va, const void *vb, int bytes)
-{
-	u64 *output64 = reinterpret_cast<u64*>( voutput );
-	const u64 *a64 = reinterpret_cast<const u64*>( va );
-	const u64 *b64 = reinterpret_cast<const u64*>( vb );
-
-	while (bytes >= 128)
-	{
-		output64[0] = a64[0] ^ b64[0];
-		output64[1] = a64[1] ^ b64[1];
-		output64[2] = a64[2] ^ b64[2];
-		output64[3] = a64[3] ^ b64[3];
-		output64[4] = a64[4] ^ b64[4];
-		output64[5] = a64[5] ^ b64[5];
-		output64[6] = a64[6] ^ b64[6];
-		output64[7] = a64[7] ^ b64[7];
-		output64[8] = a64[8] ^ b64[8];
-		output64[9] = a64[9] ^ b64[9];
-		output64[10] = a64[10] ^ b64[10];
-		output64[11] = a64[11] ^ b64[11];
-		output64[12] = a64[12] ^ b64[12];
-		output64[13] = a64[13] ^ b64[13];
-		output64[14] = a64[14] ^ b64[14];
-		output64[15] = a64[15] ^ b64[15];
-		output64 += 16;
-		a64 += 16;
-		b64 += 16;
-		bytes -= 128;
-	}
+		memxor_add(xor_output + offset, xor_a + 3, xor_b + 7, bytes);
 
-	while (bytes >= 8)
-	{
-		*output64++ = *a64++ ^ *b64++;
-		bytes -= 8;
+		if (memcmp(expected, xor_output + offset, bytes))
+			return false;
 	}
 
-	u8 *output = reinterpret_cast<u8*>( output64 );
-	const u8 *a = reinterpret_cast<const u8*>( a64 );
-	const u8 *b = reinterpret_cast<const u8*>( b64 );
-
-	while (bytes--)
-		*output++ = *a++ ^ *b++;
+	return true;
 }
 
-
-
-struct Block
-{
-	u8 data[1431];
-};
-
-
 void XORTest()
 {
-	Block *blocks = new Block[65536];
-
 	Abyssinian prng;
 	prng.Initialize(m_clock->msec_fast());
 
-	double start, end;
-
-
-	start = m_clock->usec();
-
-	for (int ii = 0; ii < 2000000; ++ii)
-	{
-		int a = prng.Next() % 65536;
-		int to = prng.Next() % 65536;
-
-		memxor(&blocks[to], &blocks[a], sizeof(Block));
-	}
-
-	end = m_clock->usec();
-
-	CAT_INFO("XOR") << "memxor took " << (end - start) / 1000.f << " ms";
-
-
-	start = m_clock->usec();
-
-	for (int ii = 0; ii < 2000000; ++ii)
-	{
-		int a = prng.Next() % 65536;
-		int to = prng.Next() % 65536;
-
-		memxor2(&blocks[to], &blocks[a], sizeof(Block));
-	}
-
-	end = m_clock->usec();
-
-	CAT_INFO("XOR") << "memxor2 took " << (end - start) / 1000.f << " ms";
-
-
-	start = m_clock->usec();
-
-	for (int ii = 0; ii < 2000000; ++ii)
+	for (int ii = 0; ii < XOR_BUFFER_BYTES; ++ii)
 	{
-		int a = prng.Next() % 65536;
-		int to = prng.Next() % 65536;
-
-		memxor3(&blocks[to], &blocks[a], sizeof(Block));
+		xor_output[ii] = (u8)prng.Next();
+		xor_a[ii] = (u8)prng.Next();
+		xor_b[ii] = (u8)prng.Next();
 	}
 
-	end = m_clock->usec();
-
-	CAT_INFO("XOR") << "memxor3 took " << (end - start) / 1000.f << " ms";
-
-
-	start = m_clock->usec();
-
-	for (int ii = 0; ii < 2000000; ++ii)
+	if (!XORCheck(4096))
 	{
-		int a = prng.Next() % 65536;
-		int b = prng.Next() % 65536;
-		int to = prng.Next() % 65536;
-
-		memxor(&blocks[to], &blocks[a], &blocks[b], sizeof(Block));
+		CAT_WARN("XOR") << "memxor_add result does not match";
+		return;
 	}
 
-	end = m_clock->usec();
-
-	CAT_INFO("XOR") << "memxor(2 input) took " << (end - start) / 1000.f << " ms";
-
-
-	start = m_clock->usec();
+	CAT_INFO("XOR") << "XOR engine: " << memxor_engine();
 
-	for (int ii = 0; ii < 2000000; ++ii)
+	for (int bytes = 64; bytes <= 65536; bytes *= 2)
 	{
-		int a = prng.Next() % 65536;
-		int b = prng.Next() % 65536;
-		int to = prng.Next() % 65536;
-
-		memxor4(&blocks[to], &blocks[a], &blocks[b], sizeof(Block));
+		// Move about 256 MB through each function
+		int reps = (256 << 20) / bytes;
+		double start, end, xor_usec, set_usec, add_usec;
+
+		start = m_clock->usec();
+		for (int ii = 0; ii < reps; ++ii)
+			memxor(xor_output + 1, xor_a + 3, bytes);
+		end = m_clock->usec();
+		xor_usec = end - start;
+
+		start = m_clock->usec();
+		for (int ii = 0; ii < reps; ++ii)
+			memxor_set(xor_output + 1, xor_a + 3, xor_b + 7, bytes);
+		end = m_clock->usec();
+		set_usec = end - start;
+
+		start = m_clock->usec();
+		for (int ii = 0; ii < reps; ++ii)
+			memxor_add(xor_output + 1, xor_a + 3, xor_b + 7, bytes);
+		end = m_clock->usec();
+		add_usec = end - start;
+
+		double total_bytes = (double)reps * bytes;
+
+		CAT_INFO("XOR") << bytes << " bytes: memxor " << total_bytes / xor_usec << " MB/s, memxor_set "
+			<< total_bytes / set_usec << " MB/s, memxor_add " << total_bytes / add_usec << " MB/s";
 	}
-
-	end = m_clock->usec();
-
-	CAT_INFO("XOR") << "memxor4(2 input) took " << (end - start) / 1000.f << " ms";
-
-
-	delete []blocks;
 }
 
 
@@ -1467,6 +1467,102 @@ void TestFilenameCompression(const char *filename)
 }
 
 
+/*
+	Compare HuffmanCodec against RangeEncoder::Text() on each line of the corpora.
+
+	The Huffman codes are trained on the same corpora that produced the
+	ChatText table, with every byte given a code so any line is encodable.
+	Both coders include the null terminator, so the sizes compare directly.
+*/
+void RunHuffmanCodecBench(const char **files)
+{
+	const int dmax = 32768, cmax = dmax * 2;
+	char *line = new char[dmax];
+	char *comp = new char[cmax];
+	char *decomp = new char[dmax];
+
+	// Train code lengths
+	u32 counts[HuffmanCodec::MAX_SYMBOLS];
+	for (u32 ii = 0; ii < HuffmanCodec::MAX_SYMBOLS; ++ii)
+		counts[ii] = 1;
+
+	for (int ii = 0; files[ii]; ++ii)
+	{
+		std::ifstream file(files[ii]);
+
+		while (file.getline(line, dmax, '\n') && !file.eof())
+		{
+			const char *x = line;
+			do ++counts[(u8)*x]; while (*x++);
+		}
+	}
+
+	HuffmanCodec codec;
+	if (!codec.InitializeFromCounts(counts))
+	{
+		CAT_WARN("Huffman Bench") << "Unable to build codes";
+		return;
+	}
+
+	u32 uncompressed = 0, huffman_bytes = 0, range_bytes = 0;
+	double huffman_ctime = 0, huffman_dtime = 0, range_ctime = 0, range_dtime = 0;
+
+	for (int ii = 0; files[ii]; ++ii)
+	{
+		std::ifstream file(files[ii]);
+
+		while (file.getline(line, dmax, '\n') && !file.eof())
+		{
+			int chars = (int)strlen(line) + 1;
+			uncompressed += chars;
+
+			double start = m_clock->usec();
+			RangeEncoder re(comp, cmax);
+			re.Text(line, ChatText);
+			re.Finish();
+			range_ctime += m_clock->usec() - start;
+			int used = re.Used();
+			range_bytes += used;
+
+			start = m_clock->usec();
+			RangeDecoder rd(comp, used);
+			rd.Text(decomp, dmax, ChatText);
+			range_dtime += m_clock->usec() - start;
+
+			start = m_clock->usec();
+			used = codec.Encode(line, chars, comp, cmax);
+			huffman_ctime += m_clock->usec() - start;
+			if (used < 0)
+			{
+				CAT_WARN("Huffman Bench") << "Compression failure!";
+				continue;
+			}
+			huffman_bytes += used;
+
+			start = m_clock->usec();
+			int len = codec.DecodeText(comp, used, decomp, dmax);
+			huffman_dtime += m_clock->usec() - start;
+
+			if (len + 1 != chars || memcmp(decomp, line, chars))
+			{
+				CAT_WARN("Huffman Bench") << "Decompression failure!";
+				CAT_WARN("Huffman Bench") << "origin   : " << line;
+			}
+		}
+	}
+
+	CAT_WARN("Huffman Bench") << "uncompressed = " << uncompressed;
+	CAT_WARN("Huffman Bench") << "RangeEncoder: compressed = " << range_bytes << " (" << range_bytes * 100.0f / uncompressed
+		<< "%), " << uncompressed / range_ctime << " MB/s compress, " << uncompressed / range_dtime << " MB/s decompress";
+	CAT_WARN("Huffman Bench") << "HuffmanCodec: compressed = " << huffman_bytes << " (" << huffman_bytes * 100.0f / uncompressed
+		<< "%), " << uncompressed / huffman_ctime << " MB/s compress, " << uncompressed / huffman_dtime << " MB/s decompress";
+
+	delete []line;
+	delete []comp;
+	delete []decomp;
+}
+
+
 int main(int argc, const char **argv)
 {
 	m_clock = Clock::ref();
@@ -1728,6 +1824,8 @@ int main(int argc, const char **argv)
         CAT_WARN("Text Compression Test") << "Average input length = " << uncompressed / linect;
         CAT_WARN("Text Compression Test") << "Compression ratio = " << compressed * 100.0f / uncompressed;
         CAT_WARN("Text Compression Test") << "Table bytes = " << sizeof(_ChatText);
+
+        RunHuffmanCodecBench(Files);
 #else
         ofstream ofile("ChatText.stats");
         if (!ofile)
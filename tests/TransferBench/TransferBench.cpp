@@ -0,0 +1,528 @@
+/*
+	Copyright (c) 2012 Christopher A. Taylor.  All rights reserved.
+
+	Redistribution and use in source and binary forms, with or without
+	modification, are permitted provided that the following conditions are met:
+
+	* Redistributions of source code must retain the above copyright notice,
+	  this list of conditions and the following disclaimer.
+	* Redistributions in binary form must reproduce the above copyright notice,
+	  this list of conditions and the following disclaimer in the documentation
+	  and/or other materials provided with the distribution.
+	* Neither the name of LibCat nor the names of its contributors may be used
+	  to endorse or promote products derived from this software without
+	  specific prior written permission.
+
+	THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+	AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+	IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+	ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+	LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+	CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+	SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+	INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+	CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+	ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+	POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+	Pipelined file transfer benchmark
+
+	Sends a set of in-memory files from a TransferSource to a TransferSink
+	over a simulated link that drops block messages at a set loss rate.
+	Control messages are delivered reliably.  Worker threads run the read,
+	compress, encode, decompress and write stages while the main thread
+	moves blocks across the link, so the result is the throughput of the
+	whole pipeline on this machine.  The next pass resumes a transfer from
+	progress saved by an earlier session.
+
+	The last passes squeeze the link down to a fixed rate with a short
+	queue that drops whatever does not fit, first with the sink setting
+	the send rate and then with the source sending as fast as it can, to
+	show how much of the link each one wastes.
+*/
+
+#include <cat/AllSphynx.hpp>
+#include <deque>
+using namespace cat;
+using namespace sphynx;
+
+static Clock *m_clock = 0;
+
+static const int WORKER_THREADS = 4;
+static const u32 BLOCK_BYTES = CAT_FT_MSS_TO_BLOCK_BYTES(1450);
+static const u32 CHUNK_BYTES = 1000000;
+static const u32 WINDOW = 8;
+static const u32 REQUEST_TIMEOUT = 20;
+static const int FILE_COUNT = 3;
+static const u64 FILE_BYTES[FILE_COUNT] = { 24000000, 9000777, 1000 };
+
+// Bottleneck for the rate control passes
+static const u32 LINK_RATE = 20000000; // bytes per second
+static const u32 LINK_QUEUE = 20000; // usec of data the queue holds
+static const u32 LINK_DELAY = 10000; // usec
+static const u32 RATE_INTERVAL = 50;
+
+static u32 m_seed = 1;
+
+static CAT_INLINE u32 NextRand()
+{
+	// xorshift32
+	m_seed ^= m_seed << 13;
+	m_seed ^= m_seed >> 17;
+	m_seed ^= m_seed << 5;
+	return m_seed;
+}
+
+
+//// Files
+
+static u8 *m_source_data[FILE_COUNT];
+static u8 *m_sink_data[FILE_COUNT];
+
+static void GenerateFiles()
+{
+	for (int ii = 0; ii < FILE_COUNT; ++ii)
+	{
+		u32 bytes = (u32)FILE_BYTES[ii];
+		u8 *data = new u8[bytes];
+
+		// First file is text that compresses well, the others do not compress
+		if (ii == 0)
+		{
+			static const char *WORDS[] = {
+				"the ", "quick ", "brown ", "fox ", "jumps ", "over ", "lazy ", "dog ", "and ", "a ",
+				"packet ", "stream ", "chunk ", "block ", "file ", "sphynx ", "transfer ", "pipeline ", "\n", ". "
+			};
+
+			for (u32 jj = 0; jj < bytes;)
+			{
+				const char *word = WORDS[NextRand() % 20];
+
+				while (*word && jj < bytes)
+					data[jj++] = (u8)*word++;
+			}
+		}
+		else
+		{
+			for (u32 jj = 0; jj < bytes; ++jj)
+				data[jj] = (u8)NextRand();
+		}
+
+		m_source_data[ii] = data;
+		m_sink_data[ii] = new u8[bytes];
+	}
+}
+
+static void FreeFiles()
+{
+	for (int ii = 0; ii < FILE_COUNT; ++ii)
+	{
+		delete []m_source_data[ii];
+		delete []m_sink_data[ii];
+	}
+}
+
+class BenchReader : public ITransferReader
+{
+public:
+	bool ReadChunk(u32 file_id, u64 offset, u8 *buffer, u32 bytes)
+	{
+		memcpy(buffer, m_source_data[file_id] + offset, bytes);
+		return true;
+	}
+};
+
+class BenchWriter : public ITransferWriter
+{
+public:
+	bool WriteChunk(u32 file_id, u64 offset, const u8 *data, u32 bytes)
+	{
+		memcpy(m_sink_data[file_id] + offset, data, bytes);
+		return true;
+	}
+};
+
+
+//// Link
+
+// Block message or stream start on its way to the sink
+struct LinkPacket
+{
+	double deliver_usec;
+	bool start;
+	TransferStreamInfo info;
+	u32 bytes;
+	u8 data[FT_BLOCK_HEADER_BYTES + BLOCK_BYTES];
+};
+
+class BenchLink
+{
+public:
+	TransferSource source;
+	TransferSink sink;
+
+	Mutex lock;
+	std::vector<TransferStreamInfo> starts; // Stream starts waiting for the receiving thread
+
+	volatile u32 source_done, sink_done;
+	volatile bool failed;
+
+	// Stream starts are raised by source workers, but the sink takes them
+	// on its receiving thread, as FECHugeEndpoint would from the network
+	void OnStreamStart(const TransferStreamInfo &info)
+	{
+		AutoMutex guard(lock);
+		starts.push_back(info);
+	}
+
+	void OnSourceFileDone(u32 file_id, int reason)
+	{
+		if (reason != TXERR_NO_PROBLEMO)
+		{
+			CAT_WARN("TransferBench") << "Source failed file " << file_id << ": " << reason;
+			failed = true;
+		}
+
+		Atomic::Add(&source_done, 1);
+	}
+
+	void OnStreamRequest(u32 stream_id, u32 count)
+	{
+		source.OnStreamRequest(stream_id, count);
+	}
+
+	void OnStreamDone(u32 stream_id)
+	{
+		source.OnStreamDone(stream_id);
+	}
+
+	void OnRate(u32 rate_counter)
+	{
+		source.OnRate(rate_counter);
+	}
+
+	void OnSinkFileDone(u32 file_id, int reason)
+	{
+		if (reason != TXERR_NO_PROBLEMO)
+		{
+			CAT_WARN("TransferBench") << "Sink failed file " << file_id << ": " << reason;
+			failed = true;
+		}
+
+		Atomic::Add(&sink_done, 1);
+	}
+
+	// Stream starts share the link with blocks, so a stream start cannot
+	// overtake blocks still queued for the chunk that stream carried before
+	std::deque<LinkPacket> queue;
+	double link_free_usec;	// When the bottleneck has sent everything queued so far
+	u32 link_rate;			// Bytes per second, or 0 for no bottleneck
+	u32 link_delay;
+	u32 loss_percent;
+	u64 queue_drops;
+
+	void SendStarts(double now_usec)
+	{
+		lock.Enter();
+		std::vector<TransferStreamInfo> pending;
+		pending.swap(starts);
+		lock.Leave();
+
+		for (u32 ii = 0; ii < (u32)pending.size(); ++ii)
+		{
+			queue.push_back(LinkPacket());
+
+			LinkPacket &packet = queue.back();
+			packet.deliver_usec = (link_free_usec > now_usec ? link_free_usec : now_usec) + link_delay;
+			packet.start = true;
+			packet.info = pending[ii];
+		}
+	}
+
+	void SendBlock(double now_usec, const u8 *data, u32 bytes)
+	{
+		if (link_rate)
+		{
+			if (link_free_usec < now_usec)
+				link_free_usec = now_usec;
+
+			// Tail drop when the queue is full
+			if (link_free_usec - now_usec > LINK_QUEUE)
+			{
+				++queue_drops;
+				return;
+			}
+
+			link_free_usec += bytes * 1000000. / link_rate;
+		}
+
+		if (NextRand() % 100 < loss_percent)
+			return;
+
+		queue.push_back(LinkPacket());
+
+		LinkPacket &packet = queue.back();
+		packet.deliver_usec = (link_free_usec > now_usec ? link_free_usec : now_usec) + link_delay;
+		packet.start = false;
+		packet.bytes = bytes;
+		memcpy(packet.data, data, bytes);
+	}
+
+	// Returns true if anything arrived
+	bool Deliver(double now_usec, u32 now)
+	{
+		bool delivered = false;
+
+		while (!queue.empty() && queue.front().deliver_usec <= now_usec)
+		{
+			LinkPacket &packet = queue.front();
+
+			if (packet.start)
+				sink.OnStreamStart(now, packet.info);
+			else
+				sink.OnBlock(now, packet.data, packet.bytes);
+
+			queue.pop_front();
+			delivered = true;
+		}
+
+		return delivered;
+	}
+};
+
+
+//// PipelineThread
+
+class PipelineThread : public Thread
+{
+public:
+	BenchLink *_link;
+	volatile bool _stop;
+
+	bool Entrypoint(void *param)
+	{
+		while (!_stop)
+		{
+			bool worked = _link->sink.DoWork();
+			worked |= _link->source.DoWork();
+
+			if (!worked)
+				Clock::sleep(1);
+		}
+
+		return true;
+	}
+};
+
+
+//// Benchmark
+
+// link_rate: Bottleneck in bytes per second, or 0 for none
+// paced: Let the sink set the send rate
+static bool BenchScenario(u32 loss_percent, bool resume, u32 link_rate = 0, bool paced = false)
+{
+	BenchReader reader;
+	BenchWriter writer;
+	BenchLink *link = new BenchLink;
+
+	link->source_done = link->sink_done = 0;
+	link->failed = false;
+	link->link_free_usec = 0;
+	link->link_rate = link_rate;
+	link->link_delay = link_rate ? LINK_DELAY : 0;
+	link->loss_percent = loss_percent;
+	link->queue_drops = 0;
+
+	if (!link->source.Initialize(&reader, BLOCK_BYTES, CHUNK_BYTES, WINDOW) ||
+		!link->sink.Initialize(&writer, CHUNK_BYTES))
+	{
+		CAT_FATAL("TransferBench") << "Initialization failed";
+		delete link;
+		return false;
+	}
+
+	link->source.SetCallbacks(TransferSource::OnStreamStart::FromMember<BenchLink, &BenchLink::OnStreamStart>(link),
+		TransferSource::OnFileDone::FromMember<BenchLink, &BenchLink::OnSourceFileDone>(link));
+	link->sink.SetCallbacks(TransferSink::OnStreamRequest::FromMember<BenchLink, &BenchLink::OnStreamRequest>(link),
+		TransferSink::OnStreamDone::FromMember<BenchLink, &BenchLink::OnStreamDone>(link),
+		TransferSink::OnFileDone::FromMember<BenchLink, &BenchLink::OnSinkFileDone>(link));
+
+	// The bottleneck queue adds delay, so keep the default timeout there
+	if (!link_rate)
+		link->sink.SetRequestTimeout(REQUEST_TIMEOUT);
+
+	if (paced)
+	{
+		link->sink.SetRateCallback(TransferSink::OnRate::FromMember<BenchLink, &BenchLink::OnRate>(link));
+		link->sink.SetRateInterval(RATE_INTERVAL);
+	}
+
+	u64 total_bytes = 0, resumed_bytes = 0;
+
+	for (int ii = 0; ii < FILE_COUNT; ++ii)
+	{
+		memset(m_sink_data[ii], 0, (u32)FILE_BYTES[ii]);
+
+		u64 file_hash = 0x1234567800000000ULL + ii;
+
+		// Pretend an earlier session wrote the first half of the largest file
+		if (resume && ii == 0)
+		{
+			u64 saved = FILE_BYTES[ii] / 2;
+			memcpy(m_sink_data[ii], m_source_data[ii], (u32)saved);
+			link->sink.SetResumeOffset(file_hash, saved);
+		}
+
+		u64 start_offset = link->sink.AddFile(ii, file_hash, FILE_BYTES[ii]);
+
+		resumed_bytes += start_offset;
+		total_bytes += FILE_BYTES[ii];
+
+		link->source.AddFile(ii, FILE_BYTES[ii], start_offset);
+	}
+
+	PipelineThread workers[WORKER_THREADS];
+	for (int ii = 0; ii < WORKER_THREADS; ++ii)
+	{
+		workers[ii]._link = link;
+		workers[ii]._stop = false;
+		workers[ii].StartThread();
+	}
+
+	u8 packet[FT_BLOCK_HEADER_BYTES + BLOCK_BYTES];
+	u64 sent_blocks = 0, sent_bytes = 0;
+
+	double start = m_clock->usec();
+
+	while (link->sink_done < FILE_COUNT || link->source_done < FILE_COUNT)
+	{
+		if (link->failed) break;
+
+		u32 now = m_clock->msec();
+		double now_usec = m_clock->usec();
+
+		link->SendStarts(now_usec);
+
+		u32 sent = 0;
+		for (; sent < 256; ++sent)
+		{
+			u32 bytes = link->source.NextBlock(now, packet);
+			if (!bytes) break;
+
+			sent_bytes += bytes;
+
+			link->SendBlock(now_usec, packet, bytes);
+		}
+		sent_blocks += sent;
+
+		bool delivered = link->Deliver(now_usec, now);
+
+		link->sink.Tick(now);
+
+		if (!sent && !delivered)
+			Clock::sleep(0);
+	}
+
+	double usec = m_clock->usec() - start;
+
+	for (int ii = 0; ii < WORKER_THREADS; ++ii)
+	{
+		workers[ii]._stop = true;
+		workers[ii].WaitForThread();
+	}
+
+	bool success = !link->failed;
+
+	for (int ii = 0; success && ii < FILE_COUNT; ++ii)
+	{
+		if (memcmp(m_sink_data[ii], m_source_data[ii], (u32)FILE_BYTES[ii]) != 0)
+		{
+			CAT_FATAL("TransferBench") << "File " << ii << " does not match after loss " << loss_percent << "%";
+			success = false;
+		}
+	}
+
+	// The hash check and stall guard are safety nets: the codec should need neither
+	if (success && (link->sink.GetCorruptChunks() || link->sink.GetStalledChunks()))
+	{
+		CAT_FATAL("TransferBench") << link->sink.GetCorruptChunks() << " chunks decoded wrong and "
+			<< link->sink.GetStalledChunks() << " stalled after loss " << loss_percent << "%";
+		success = false;
+	}
+
+	if (success && !link_rate)
+	{
+		u64 moved_bytes = total_bytes - resumed_bytes;
+
+		CAT_INFO("TransferBench") << "loss " << loss_percent << "%" << (resume ? ", resumed" : "") << ": "
+			<< moved_bytes / usec << " MB/s for " << moved_bytes << " bytes, "
+			<< sent_bytes / usec << " MB/s on the wire, compressed to "
+			<< 100. * link->source.GetCompressedBytes() / link->source.GetReadBytes() << "%, "
+			<< sent_blocks << " blocks sent, " << link->sink.GetUselessBlocks() << " unneeded, "
+			<< link->sink.GetCorruptChunks() << " chunks decoded again, " << link->sink.GetStalledChunks() << " stalled";
+	}
+	else if (success)
+	{
+		// Share of the bytes put on the wire that the sink needed
+		double needed = 100. * link->source.GetCompressedBytes() / sent_bytes;
+
+		CAT_INFO("TransferBench") << (paced ? "paced" : "unpaced") << ", " << link_rate / 1000000. << " MB/s link, loss "
+			<< loss_percent << "%: " << link->source.GetCompressedBytes() / usec << " MB/s goodput, "
+			<< sent_bytes / usec << " MB/s sent, " << needed << "% of it needed, "
+			<< link->queue_drops << " blocks dropped by the queue, "
+			<< link->sink.GetCorruptChunks() << " chunks decoded again, " << link->sink.GetStalledChunks() << " stalled";
+
+		if (paced)
+		{
+			CAT_INFO("TransferBench") << "  ended at " << link->sink.GetRate() / 1000000. << " MB/s with "
+				<< 100. * link->sink.GetRandomLoss() / 65536 << "% random loss";
+		}
+	}
+
+	delete link;
+
+	return success;
+}
+
+int main()
+{
+	m_clock = Clock::ref();
+
+	CAT_INFO("TransferBench") << "TransferBench 1.0: " << FILE_COUNT << " files, " << CHUNK_BYTES
+		<< " byte chunks, " << WINDOW << " in flight, " << WORKER_THREADS << " workers";
+
+	GenerateFiles();
+
+	static const u32 LOSS[] = { 0, 1, 5, 20 };
+
+	int result = 0;
+
+	for (int ii = 0; ii < (int)(sizeof(LOSS) / sizeof(LOSS[0])); ++ii)
+	{
+		if (!BenchScenario(LOSS[ii], false))
+		{
+			result = 1;
+			break;
+		}
+	}
+
+	if (!result && !BenchScenario(5, true))
+		result = 1;
+
+	static const u32 LINK_LOSS[] = { 0, 2, 10 };
+
+	for (int ii = 0; !result && ii < (int)(sizeof(LINK_LOSS) / sizeof(LINK_LOSS[0])); ++ii)
+	{
+		if (!BenchScenario(LINK_LOSS[ii], false, LINK_RATE, true) ||
+			!BenchScenario(LINK_LOSS[ii], false, LINK_RATE, false))
+		{
+			result = 1;
+		}
+	}
+
+	FreeFiles();
+
+	return result;
+}
@@ -0,0 +1,163 @@
+#include <cat/AllAsyncIO.hpp>
+using namespace cat;
+
+/*
+	UDP endpoint loopback test
+
+	Sends runs of nine full-size datagrams and one short one to itself, so
+	that each Write() is a candidate for one segmentation offload send, and
+	checks that every datagram comes back once and intact.
+*/
+
+static const u32 TEST_DATAGRAMS = 2000;
+static const u32 TEST_RUN = 10;
+static const u32 TEST_FULL_BYTES = 1200;
+static const u32 TEST_SHORT_BYTES = 600;
+static const u32 TEST_WAIT_MSEC = 2000;
+
+static UDPSendAllocator *m_udp_send_allocator = 0;
+
+
+class LoopbackEndpoint : public UDPEndpoint
+{
+	volatile u32 _received, _corrupt;
+	u8 _seen[TEST_DATAGRAMS];
+
+	void OnRecvRouting(const BatchSet &buffers)
+	{
+		u32 count = 0, corrupt = 0;
+
+		for (BatchHead *node = buffers.head; node; node = node->batch_next)
+		{
+			RecvBuffer *buffer = static_cast<RecvBuffer*>( node );
+			const u8 *data = GetTrailingBytes(buffer);
+			u32 bytes = buffer->data_bytes;
+
+			SetRemoteAddress(buffer);
+			++count;
+
+			u32 seq = (bytes >= 4) ? getLE(*reinterpret_cast<const u32*>( data )) : TEST_DATAGRAMS;
+
+			if (seq >= TEST_DATAGRAMS || _seen[seq]++ ||
+				bytes != ((seq % TEST_RUN == TEST_RUN - 1) ? TEST_SHORT_BYTES : TEST_FULL_BYTES))
+			{
+				++corrupt;
+				continue;
+			}
+
+			for (u32 ii = 4; ii < bytes; ++ii)
+			{
+				if (data[ii] != (u8)(seq + ii))
+				{
+					++corrupt;
+					break;
+				}
+			}
+		}
+
+		ReleaseRecvBuffers(buffers, count);
+
+		if (corrupt) Atomic::Add(&_corrupt, corrupt);
+		Atomic::Add(&_received, count);
+	}
+
+public:
+	LoopbackEndpoint()
+	{
+		_received = 0;
+		_corrupt = 0;
+		CAT_OBJCLR(_seen);
+	}
+
+	CAT_INLINE const char *GetRefObjectName() { return "LoopbackEndpoint"; }
+
+	CAT_INLINE u32 GetReceived() { return _received; }
+	CAT_INLINE u32 GetCorrupt() { return _corrupt; }
+
+	bool SendRun(u32 first_seq, const NetAddr &addr)
+	{
+		BatchSet buffers;
+		buffers.Clear();
+
+		for (u32 seq = first_seq; seq < first_seq + TEST_RUN; ++seq)
+		{
+			u32 bytes = (seq % TEST_RUN == TEST_RUN - 1) ? TEST_SHORT_BYTES : TEST_FULL_BYTES;
+
+			u8 *data = m_udp_send_allocator->Acquire(bytes);
+			if (!data) return false;
+
+			*reinterpret_cast<u32*>( data ) = getLE(seq);
+			for (u32 ii = 4; ii < bytes; ++ii)
+				data[ii] = (u8)(seq + ii);
+
+			SendBuffer *buffer = SendBuffer::Promote(data);
+			buffer->data_bytes = bytes;
+			buffers.PushBack(buffer);
+		}
+
+		return Write(buffers, TEST_RUN, addr);
+	}
+};
+
+
+int main()
+{
+	m_udp_send_allocator = UDPSendAllocator::ref();
+
+	LoopbackEndpoint *endpoint;
+	if (!RefObjects::Create(CAT_REFOBJECT_TRACE, endpoint))
+	{
+		CAT_FATAL("UDPEndpointTest") << "Unable to acquire endpoint object";
+		return 1;
+	}
+
+	if (!endpoint->Initialize(0, true, true, true, 4000000))
+	{
+		CAT_FATAL("UDPEndpointTest") << "Unable to initialize endpoint";
+		endpoint->Destroy(CAT_REFOBJECT_TRACE);
+		return 1;
+	}
+
+	NetAddr addr(CAT_LOOPBACK_IPV4, endpoint->GetPort());
+	if (endpoint->SupportsIPv6()) addr.PromoteTo6();
+
+	CAT_INFO("UDPEndpointTest") << "Segmentation offload: " << endpoint->UsesSegmentOffload() << ", receive offload: " << endpoint->UsesReceiveOffload();
+
+	bool success = true;
+
+	// Send one run at a time so the kernel receive buffer never overflows
+	for (u32 seq = 0; success && seq < TEST_DATAGRAMS; seq += TEST_RUN)
+	{
+		if (!endpoint->SendRun(seq, addr))
+		{
+			CAT_WARN("UDPEndpointTest") << "Write failed at datagram " << seq;
+			success = false;
+			break;
+		}
+
+		u32 start = Clock::msec_fast();
+		while (endpoint->GetReceived() < seq + TEST_RUN)
+		{
+			if (Clock::msec_fast() - start > TEST_WAIT_MSEC)
+			{
+				CAT_WARN("UDPEndpointTest") << "Timed out waiting for datagram " << endpoint->GetReceived();
+				success = false;
+				break;
+			}
+
+			Clock::sleep(1);
+		}
+	}
+
+	u32 received = endpoint->GetReceived(), corrupt = endpoint->GetCorrupt();
+
+	endpoint->Destroy(CAT_REFOBJECT_TRACE);
+
+	if (received != TEST_DATAGRAMS || corrupt != 0)
+		success = false;
+
+	CAT_INFO("UDPEndpointTest") << "Received " << received << " of " << TEST_DATAGRAMS << " datagrams, " << corrupt << " corrupt";
+	CAT_INFO("UDPEndpointTest") << (success ? "SUCCESS" : "FAILURE");
+
+	return success ? 0 : 1;
+}